@@ -65,6 +65,7 @@
 #include <sys/zfs_fuid.h>
 #include <sys/arc.h>
 #include <sys/ddt.h>
+#include <sys/brt.h>
 #include <sys/zfeature.h>
 #include <sys/abd.h>
 #include <sys/blkptr.h>
@@ -945,7 +946,7 @@ dump_metaslab_stats(metaslab_t *msp)
 {
 	char maxbuf[32];
 	range_tree_t *rt = msp->ms_allocatable;
-	avl_tree_t *t = &msp->ms_allocatable_by_size;
+	zfs_btree_t *t = &msp->ms_allocatable_by_size;
 	int free_pct = range_tree_space(rt) * 100 / msp->ms_size;
 
 	/* max sure nicenum has enough space */
@@ -954,7 +955,7 @@ dump_metaslab_stats(metaslab_t *msp)
 	zdb_nicenum(metaslab_block_maxsize(msp), maxbuf, sizeof (maxbuf));
 
 	(void) printf("\t %25s %10lu   %7s  %6s   %4s %4d%%\n",
-	    "segments", avl_numnodes(t), "maxsize", maxbuf,
+	    "segments", zfs_btree_numnodes(t), "maxsize", maxbuf,
 	    "freepct", free_pct);
 	(void) printf("\tIn-memory histogram:\n");
 	dump_histogram(rt->rt_histogram, RANGE_TREE_HISTOGRAM_SIZE, 0);
@@ -1320,6 +1321,23 @@ dump_ddt(ddt_t *ddt, enum ddt_type type, enum ddt_class class)
 	(void) printf("\n");
 }
 
+static void
+dump_ddt_log(ddt_t *ddt)
+{
+	for (int l = 0; l < DDT_LOGS; l++) {
+		ddt_log_t *ddl = &ddt->ddt_log[l];
+
+		if (ddl->ddl_phys.dlp_object == 0)
+			continue;
+
+		(void) printf("DDT-log-%s-%s: %llu entries, %llu bytes "
+		    "on disk\n", zio_checksum_table[ddt->ddt_checksum].ci_name,
+		    ddl == ddt->ddt_log_active ? "active" : "flushing",
+		    (u_longlong_t)avl_numnodes(&ddl->ddl_tree),
+		    (u_longlong_t)ddl->ddl_phys.dlp_length);
+	}
+}
+
 static void
 dump_all_ddts(spa_t *spa)
 {
@@ -1337,6 +1355,7 @@ dump_all_ddts(spa_t *spa)
 				dump_ddt(ddt, type, class);
 			}
 		}
+		dump_ddt_log(ddt);
 	}
 
 	ddt_get_dedup_stats(spa, &dds_total);
@@ -3550,6 +3569,8 @@ typedef struct zdb_cb {
 	uint64_t	zcb_checkpoint_size;
 	uint64_t	zcb_dedup_asize;
 	uint64_t	zcb_dedup_blocks;
+	uint64_t	zcb_clone_asize;
+	uint64_t	zcb_clone_blocks;
 	uint64_t	zcb_embedded_blocks[NUM_BP_EMBEDDED_TYPES];
 	uint64_t	zcb_embedded_histogram[NUM_BP_EMBEDDED_TYPES]
 	    [BPE_PAYLOAD_SIZE + 1];
@@ -3690,6 +3711,17 @@ zdb_count_block(zdb_cb_t *zcb, zilog_t *zilog, const blkptr_t *bp,
 		ddt_exit(ddt);
 	}
 
+	/*
+	 * A cloned block is claimed only when its last reference is
+	 * visited, just like a deduplicated block.
+	 */
+	if (brt_maybe_exists(zcb->zcb_spa, bp) &&
+	    brt_entry_decref(zcb->zcb_spa, bp)) {
+		zcb->zcb_clone_asize += BP_GET_ASIZE(bp);
+		zcb->zcb_clone_blocks++;
+		refcnt = 1;
+	}
+
 	VERIFY3U(zio_wait(zio_claim(NULL, zcb->zcb_spa,
 	    refcnt ? 0 : spa_min_claim_txg(zcb->zcb_spa),
 	    bp, NULL, NULL, ZIO_FLAG_CANFAIL)), ==, 0);
@@ -3964,7 +3996,7 @@ zdb_claim_removing(spa_t *spa, zdb_cb_t *zcb)
 
 	ASSERT0(range_tree_space(svr->svr_allocd_segs));
 
-	range_tree_t *allocs = range_tree_create(NULL, NULL);
+	range_tree_t *allocs = range_tree_create(NULL, RANGE_SEG64, NULL, 0, 0);
 	for (uint64_t msi = 0; msi < vd->vdev_ms_count; msi++) {
 		metaslab_t *msp = vd->vdev_ms[msi];
 
@@ -4730,8 +4762,9 @@ dump_block_stats(spa_t *spa)
 	    metaslab_class_get_alloc(spa_special_class(spa)) +
 	    metaslab_class_get_alloc(spa_dedup_class(spa)) +
 	    get_unflushed_alloc_space(spa);
-	total_found = tzb->zb_asize - zcb.zcb_dedup_asize +
-	    zcb.zcb_removing_size + zcb.zcb_checkpoint_size;
+	total_found = tzb->zb_asize - zcb.zcb_dedup_asize -
+	    zcb.zcb_clone_asize + zcb.zcb_removing_size +
+	    zcb.zcb_checkpoint_size;
 
 	if (total_found == total_alloc && !dump_opt['L']) {
 		(void) printf("\n\tNo leaks (block sum matches space"
@@ -4769,6 +4802,9 @@ dump_block_stats(spa_t *spa)
 	    "bp deduped:", (u_longlong_t)zcb.zcb_dedup_asize,
 	    (u_longlong_t)zcb.zcb_dedup_blocks,
 	    (double)zcb.zcb_dedup_asize / tzb->zb_asize + 1.0);
+	(void) printf("\t%-16s %14llu    count: %6llu\n",
+	    "bp cloned:", (u_longlong_t)zcb.zcb_clone_asize,
+	    (u_longlong_t)zcb.zcb_clone_blocks);
 	(void) printf("\t%-16s %14llu     used: %5.2f%%\n", "Normal class:",
 	    (u_longlong_t)norm_alloc, 100.0 * norm_alloc / norm_space);
 
@@ -5743,6 +5779,24 @@ dump_mos_leaks(spa_t *spa)
 		}
 	}
 
+	for (uint64_t cksum = 0; cksum < ZIO_CHECKSUM_FUNCTIONS; cksum++) {
+		ddt_t *ddt = spa->spa_ddt[cksum];
+		for (int l = 0; l < DDT_LOGS; l++)
+			mos_obj_refd(ddt->ddt_log[l].ddl_phys.dlp_object);
+	}
+
+	if (spa->spa_brt != NULL) {
+		brt_t *brt = spa->spa_brt;
+
+		mos_obj_refd(brt->brt_object);
+		for (uint64_t vdevid = 0; vdevid < brt->brt_nvdevs; vdevid++) {
+			if (brt->brt_vdevs[vdevid] != NULL) {
+				mos_obj_refd(
+				    brt->brt_vdevs[vdevid]->bv_phys.bvp_object);
+			}
+		}
+	}
+
 	/*
 	 * Visit all allocated objects and make sure they are referenced.
 	 */
@@ -5887,7 +5941,8 @@ dump_zpool(spa_t *spa)
 
 	if (dump_opt['d'] || dump_opt['i']) {
 		spa_feature_t f;
-		mos_refd_objs = range_tree_create(NULL, NULL);
+		mos_refd_objs = range_tree_create(NULL, RANGE_SEG64, NULL, 0,
+		    0);
 		dump_dir(dp->dp_meta_objset);
 
 		if (dump_opt['d'] >= 3) {
@@ -65,6 +65,7 @@ typedef struct callback_data {
 	int			cb_depth_limit;
 	int			cb_depth;
 	uint8_t			cb_props_table[ZFS_NUM_PROPS];
+	nvlist_t		*cb_props;
 } callback_data_t;
 
 uu_avl_pool_t *avl_pool;
@@ -144,14 +145,15 @@ zfs_callback(zfs_handle_t *zhp, void *data)
 		    (cb->cb_types &
 		    (ZFS_TYPE_FILESYSTEM | ZFS_TYPE_VOLUME))) &&
 		    zfs_get_type(zhp) == ZFS_TYPE_FILESYSTEM) {
-			(void) zfs_iter_filesystems(zhp, zfs_callback, data);
+			(void) zfs_iter_filesystems_props(zhp, cb->cb_props,
+			    zfs_callback, data);
 		}
 
 		if (((zfs_get_type(zhp) & (ZFS_TYPE_SNAPSHOT |
 		    ZFS_TYPE_BOOKMARK)) == 0) && include_snaps) {
-			(void) zfs_iter_snapshots(zhp,
+			(void) zfs_iter_snapshots_props(zhp,
 			    (cb->cb_flags & ZFS_ITER_SIMPLE) != 0,
-			    zfs_callback, data, 0, 0);
+			    cb->cb_props, zfs_callback, data, 0, 0);
 		}
 
 		if (((zfs_get_type(zhp) & (ZFS_TYPE_SNAPSHOT |
@@ -417,14 +419,29 @@ zfs_for_each(int argc, char **argv, int flags, zfs_type_t types,
 	 * always retain the zoned property, which some other properties
 	 * need (userquota & friends), and the createtxg property, which
 	 * we need to sort snapshots.
+	 *
+	 * Unless all properties were asked for, the names of the retained
+	 * ones, user properties included, are also collected in cb_props, so
+	 * that the kernel only has to look up those for the child datasets.
 	 */
 	if (cb.cb_proplist && *cb.cb_proplist) {
 		zprop_list_t *p = *cb.cb_proplist;
 
+		if (!p->pl_all)
+			cb.cb_props = fnvlist_alloc();
+
 		while (p) {
 			if (p->pl_prop >= ZFS_PROP_TYPE &&
 			    p->pl_prop < ZFS_NUM_PROPS) {
 				cb.cb_props_table[p->pl_prop] = B_TRUE;
+				if (cb.cb_props != NULL) {
+					fnvlist_add_boolean(cb.cb_props,
+					    zfs_prop_to_name(p->pl_prop));
+				}
+			} else if (p->pl_prop == ZPROP_INVAL &&
+			    cb.cb_props != NULL) {
+				fnvlist_add_boolean(cb.cb_props,
+				    p->pl_user_prop);
 			}
 			p = p->pl_next;
 		}
@@ -433,12 +450,26 @@ zfs_for_each(int argc, char **argv, int flags, zfs_type_t types,
 			if (sortcol->sc_prop >= ZFS_PROP_TYPE &&
 			    sortcol->sc_prop < ZFS_NUM_PROPS) {
 				cb.cb_props_table[sortcol->sc_prop] = B_TRUE;
+				if (cb.cb_props != NULL) {
+					fnvlist_add_boolean(cb.cb_props,
+					    zfs_prop_to_name(sortcol->sc_prop));
+				}
+			} else if (sortcol->sc_prop == ZPROP_INVAL &&
+			    cb.cb_props != NULL) {
+				fnvlist_add_boolean(cb.cb_props,
+				    sortcol->sc_user_prop);
 			}
 			sortcol = sortcol->sc_next;
 		}
 
 		cb.cb_props_table[ZFS_PROP_ZONED] = B_TRUE;
 		cb.cb_props_table[ZFS_PROP_CREATETXG] = B_TRUE;
+		if (cb.cb_props != NULL) {
+			fnvlist_add_boolean(cb.cb_props,
+			    zfs_prop_to_name(ZFS_PROP_ZONED));
+			fnvlist_add_boolean(cb.cb_props,
+			    zfs_prop_to_name(ZFS_PROP_CREATETXG));
+		}
 	} else {
 		(void) memset(cb.cb_props_table, B_TRUE,
 		    sizeof (cb.cb_props_table));
@@ -507,6 +538,7 @@ zfs_for_each(int argc, char **argv, int flags, zfs_type_t types,
 	uu_avl_walk_end(walk);
 	uu_avl_destroy(cb.cb_avl);
 	uu_avl_pool_destroy(avl_pool);
+	nvlist_free(cb.cb_props);
 
 	return (ret);
 }
@@ -615,6 +615,20 @@ make_leaf_vdev(nvlist_t *props, const char *arg, uint64_t is_log)
 	uint64_t ashift = 0;
 	int err;
 
+	/*
+	 * A dRAID distributed spare is not backed by a device, its name
+	 * identifies the dRAID vdev which provides the spare capacity.
+	 */
+	if (zpool_is_draid_spare(arg)) {
+		verify(nvlist_alloc(&vdev, NV_UNIQUE_NAME, 0) == 0);
+		verify(nvlist_add_string(vdev, ZPOOL_CONFIG_PATH, arg) == 0);
+		verify(nvlist_add_string(vdev, ZPOOL_CONFIG_TYPE,
+		    VDEV_TYPE_DRAID_SPARE) == 0);
+		verify(nvlist_add_uint64(vdev, ZPOOL_CONFIG_IS_LOG,
+		    is_log) == 0);
+		return (vdev);
+	}
+
 	/*
 	 * Determine what type of vdev this is, and put the full path into
 	 * 'path'.  We detect whether this is a device of file afterwards by
@@ -847,7 +861,8 @@ get_replication(nvlist_t *nvroot, boolean_t fatal)
 			rep.zprl_type = type;
 			rep.zprl_children = 0;
 
-			if (strcmp(type, VDEV_TYPE_RAIDZ) == 0) {
+			if (strcmp(type, VDEV_TYPE_RAIDZ) == 0 ||
+			    strcmp(type, VDEV_TYPE_DRAID) == 0) {
 				verify(nvlist_lookup_uint64(nv,
 				    ZPOOL_CONFIG_NPARITY,
 				    &rep.zprl_parity) == 0);
@@ -1462,6 +1477,22 @@ is_grouping(const char *type, int *mindev, int *maxdev)
 		return (VDEV_TYPE_RAIDZ);
 	}
 
+	if (strncmp(type, VDEV_TYPE_DRAID, strlen(VDEV_TYPE_DRAID)) == 0) {
+		uint64_t nparity, ndata, nchildren, nspares;
+
+		if (draid_parse_type(type, &nparity, &ndata, &nchildren,
+		    &nspares) != 0)
+			return (NULL);
+
+		if (mindev != NULL) {
+			*mindev = nchildren != 0 ? nchildren :
+			    nparity + MAX(ndata, 1) + nspares;
+		}
+		if (maxdev != NULL)
+			*maxdev = nchildren != 0 ? nchildren : 255;
+		return (VDEV_TYPE_DRAID);
+	}
+
 	if (maxdev != NULL)
 		*maxdev = INT_MAX;
 
@@ -1534,6 +1565,7 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 		 */
 		if ((type = is_grouping(argv[0], &mindev, &maxdev)) != NULL) {
 			nvlist_t **child = NULL;
+			const char *grouping = argv[0];
 			int c, children = 0;
 
 			if (strcmp(type, VDEV_TYPE_SPARE) == 0) {
@@ -1686,6 +1718,27 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 					    ZPOOL_CONFIG_NPARITY,
 					    mindev - 1) == 0);
 				}
+				if (strcmp(type, VDEV_TYPE_DRAID) == 0) {
+					uint64_t nparity, ndata, nchildren;
+					uint64_t nspares;
+
+					verify(draid_parse_type(grouping,
+					    &nparity, &ndata, &nchildren,
+					    &nspares) == 0);
+					if (ndata == 0) {
+						ndata = MIN(8, children -
+						    nspares - nparity);
+					}
+					verify(nvlist_add_uint64(nv,
+					    ZPOOL_CONFIG_NPARITY,
+					    nparity) == 0);
+					verify(nvlist_add_uint64(nv,
+					    ZPOOL_CONFIG_DRAID_NDATA,
+					    ndata) == 0);
+					verify(nvlist_add_uint64(nv,
+					    ZPOOL_CONFIG_DRAID_NSPARES,
+					    nspares) == 0);
+				}
 				verify(nvlist_add_nvlist_array(nv,
 				    ZPOOL_CONFIG_CHILDREN, child,
 				    children) == 0);
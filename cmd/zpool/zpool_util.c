@@ -28,6 +28,7 @@
 #include <libintl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <strings.h>
 #include <ctype.h>
 
@@ -137,3 +138,78 @@ lowbit64(uint64_t i)
 
 	return (__builtin_ffsll(i));
 }
+
+/*
+ * Parse a dRAID vdev type of the form:
+ *
+ *	dcraid[<parity>][:<data>d][:<children>c][:<spares>s]
+ *
+ * The parity defaults to 1, the remaining values are returned as zero
+ * when not specified.  Returns 0 on success and -1 if the type is invalid.
+ */
+int
+draid_parse_type(const char *type, uint64_t *nparity, uint64_t *ndata,
+    uint64_t *nchildren, uint64_t *nspares)
+{
+	boolean_t seen_data = B_FALSE, seen_children = B_FALSE;
+	boolean_t seen_spares = B_FALSE;
+	const char *p;
+	char *end;
+
+	if (strncmp(type, VDEV_TYPE_DRAID, strlen(VDEV_TYPE_DRAID)) != 0)
+		return (-1);
+
+	p = type + strlen(VDEV_TYPE_DRAID);
+	*nparity = 1;
+	*ndata = *nchildren = *nspares = 0;
+
+	if (isdigit(*p)) {
+		if (*p == '0')
+			return (-1); /* no zero prefixes allowed */
+
+		errno = 0;
+		*nparity = strtoull(p, &end, 10);
+		if (errno != 0 || *nparity > VDEV_DRAID_MAXPARITY)
+			return (-1);
+		p = end;
+	}
+
+	while (*p == ':') {
+		uint64_t value;
+
+		p++;
+		if (!isdigit(*p))
+			return (-1);
+
+		errno = 0;
+		value = strtoull(p, &end, 10);
+		if (errno != 0)
+			return (-1);
+
+		switch (*end) {
+		case 'd':
+			if (seen_data || value == 0)
+				return (-1);
+			seen_data = B_TRUE;
+			*ndata = value;
+			break;
+		case 'c':
+			if (seen_children || value == 0)
+				return (-1);
+			seen_children = B_TRUE;
+			*nchildren = value;
+			break;
+		case 's':
+			if (seen_spares)
+				return (-1);
+			seen_spares = B_TRUE;
+			*nspares = value;
+			break;
+		default:
+			return (-1);
+		}
+		p = end + 1;
+	}
+
+	return (*p == '\0' ? 0 : -1);
+}
@@ -45,6 +45,8 @@ uint64_t array64_max(uint64_t array[], unsigned int len);
 int zfs_isnumber(char *str);
 int highbit64(uint64_t i);
 int lowbit64(uint64_t i);
+int draid_parse_type(const char *type, uint64_t *nparity, uint64_t *ndata,
+    uint64_t *nchildren, uint64_t *nspares);
 
 /*
  * Misc utility functions
@@ -108,6 +108,7 @@
 #include <sys/vdev_file.h>
 #include <sys/vdev_initialize.h>
 #include <sys/vdev_raidz.h>
+#include <sys/vdev_draid.h>
 #include <sys/vdev_trim.h>
 #include <sys/spa_impl.h>
 #include <sys/metaslab_impl.h>
@@ -172,6 +173,9 @@ typedef struct ztest_shared_opts {
 	int zo_mirrors;
 	int zo_raidz;
 	int zo_raidz_parity;
+	char zo_raid_type[8];
+	int zo_draid_data;
+	int zo_draid_spares;
 	int zo_datasets;
 	int zo_threads;
 	uint64_t zo_passtime;
@@ -196,6 +200,9 @@ static const ztest_shared_opts_t ztest_opts_defaults = {
 	.zo_mirrors = 2,
 	.zo_raidz = 4,
 	.zo_raidz_parity = 1,
+	.zo_raid_type = VDEV_TYPE_RAIDZ,
+	.zo_draid_data = 2,
+	.zo_draid_spares = 1,
 	.zo_vdev_size = SPA_MINDEVSIZE * 4,	/* 256m default size */
 	.zo_datasets = 7,
 	.zo_threads = 23,
@@ -216,8 +223,13 @@ extern unsigned long zfs_deadman_synctime_ms;
 extern int metaslab_preload_limit;
 extern boolean_t zfs_arc_compression_enabled;
 extern int zfs_abd_scatter_enabled;
+extern int zfs_vdev_queue_fast_non_rotating;
+extern int zfs_arc_evict_threads;
+extern int zfs_dedup_log_flush_entries_min;
+extern int zfs_dedup_log_txg_max;
 extern int dmu_object_alloc_chunk_shift;
 extern boolean_t zfs_force_some_double_word_sm_entries;
+extern boolean_t zfs_metaslab_force_large_segs;
 extern unsigned long zio_decompress_fail_fraction;
 extern unsigned long zfs_reconstruct_indirect_damage_fraction;
 
@@ -356,6 +368,7 @@ ztest_func_t ztest_zil_remount;
 ztest_func_t ztest_dmu_read_write_zcopy;
 ztest_func_t ztest_dmu_objset_create_destroy;
 ztest_func_t ztest_dmu_prealloc;
+ztest_func_t ztest_dmu_brt_clone;
 ztest_func_t ztest_fzap;
 ztest_func_t ztest_dmu_snapshot_create_destroy;
 ztest_func_t ztest_dsl_prop_get_set;
@@ -412,6 +425,7 @@ ztest_info_t ztest_info[] = {
 #if 0
 	ZTI_INIT(ztest_dmu_prealloc, 1, &zopt_sometimes),
 #endif
+	ZTI_INIT(ztest_dmu_brt_clone, 1, &zopt_sometimes),
 	ZTI_INIT(ztest_fzap, 1, &zopt_sometimes),
 	ZTI_INIT(ztest_dmu_snapshot_create_destroy, 1, &zopt_sometimes),
 	ZTI_INIT(ztest_spa_create_destroy, 1, &zopt_sometimes),
@@ -689,6 +703,9 @@ usage(boolean_t requested)
 	    "\t[-m mirror_copies (default: %d)]\n"
 	    "\t[-r raidz_disks (default: %d)]\n"
 	    "\t[-R raidz_parity (default: %d)]\n"
+	    "\t[-K raid_kind (default: %s)] raidz|dcraid\n"
+	    "\t[-D draid_data (default: %d)]\n"
+	    "\t[-S draid_spares (default: %d)]\n"
 	    "\t[-d datasets (default: %d)]\n"
 	    "\t[-t threads (default: %d)]\n"
 	    "\t[-g gang_block_threshold (default: %s)]\n"
@@ -716,6 +733,9 @@ usage(boolean_t requested)
 	    zo->zo_mirrors,				/* -m */
 	    zo->zo_raidz,				/* -r */
 	    zo->zo_raidz_parity,			/* -R */
+	    zo->zo_raid_type,				/* -K */
+	    zo->zo_draid_data,				/* -D */
+	    zo->zo_draid_spares,			/* -S */
 	    zo->zo_datasets,				/* -d */
 	    zo->zo_threads,				/* -t */
 	    nice_force_ganging,				/* -g */
@@ -782,7 +802,7 @@ process_options(int argc, char **argv)
 	bcopy(&ztest_opts_defaults, zo, sizeof (*zo));
 
 	while ((opt = getopt(argc, argv,
-	    "v:s:a:m:r:R:d:t:g:i:k:p:f:MVET:P:hF:B:C:o:G")) != EOF) {
+	    "v:s:a:m:r:R:K:D:S:d:t:g:i:k:p:f:MVET:P:hF:B:C:o:G")) != EOF) {
 		value = 0;
 		switch (opt) {
 		case 'v':
@@ -791,6 +811,8 @@ process_options(int argc, char **argv)
 		case 'm':
 		case 'r':
 		case 'R':
+		case 'D':
+		case 'S':
 		case 'd':
 		case 't':
 		case 'g':
@@ -820,6 +842,22 @@ process_options(int argc, char **argv)
 		case 'R':
 			zo->zo_raidz_parity = MIN(MAX(value, 1), 3);
 			break;
+		case 'K':
+			if (strcmp(optarg, VDEV_TYPE_RAIDZ) != 0 &&
+			    strcmp(optarg, VDEV_TYPE_DRAID) != 0) {
+				(void) fprintf(stderr, "invalid raid kind "
+				    "'%s'\n", optarg);
+				usage(B_FALSE);
+			}
+			(void) strlcpy(zo->zo_raid_type, optarg,
+			    sizeof (zo->zo_raid_type));
+			break;
+		case 'D':
+			zo->zo_draid_data = MAX(1, value);
+			break;
+		case 'S':
+			zo->zo_draid_spares = value;
+			break;
 		case 'd':
 			zo->zo_datasets = MAX(1, value);
 			break;
@@ -895,6 +933,23 @@ process_options(int argc, char **argv)
 
 	zo->zo_raidz_parity = MIN(zo->zo_raidz_parity, zo->zo_raidz - 1);
 
+	if (strcmp(zo->zo_raid_type, VDEV_TYPE_DRAID) == 0) {
+		/*
+		 * A dRAID vdev needs at least one data and one parity child
+		 * in addition to its distributed spares.  Shrink the layout
+		 * to fit the requested number of children, and never mirror
+		 * dRAID vdevs.
+		 */
+		zo->zo_raidz = MAX(zo->zo_raidz, 2);
+		zo->zo_raidz_parity = MIN(zo->zo_raidz_parity,
+		    zo->zo_raidz - 1);
+		zo->zo_draid_spares = MIN(zo->zo_draid_spares,
+		    zo->zo_raidz - zo->zo_raidz_parity - 1);
+		zo->zo_draid_data = MIN(zo->zo_draid_data, zo->zo_raidz -
+		    zo->zo_raidz_parity - zo->zo_draid_spares);
+		zo->zo_mirrors = 0;
+	}
+
 	zo->zo_vdevtime =
 	    (zo->zo_vdevs > 0 ? zo->zo_time * NANOSEC / zo->zo_vdevs :
 	    UINT64_MAX >> 2);
@@ -1058,9 +1113,15 @@ make_vdev_raidz(char *path, char *aux, char *pool, size_t size,
 
 	VERIFY(nvlist_alloc(&raidz, NV_UNIQUE_NAME, 0) == 0);
 	VERIFY(nvlist_add_string(raidz, ZPOOL_CONFIG_TYPE,
-	    VDEV_TYPE_RAIDZ) == 0);
+	    ztest_opts.zo_raid_type) == 0);
 	VERIFY(nvlist_add_uint64(raidz, ZPOOL_CONFIG_NPARITY,
 	    ztest_opts.zo_raidz_parity) == 0);
+	if (strcmp(ztest_opts.zo_raid_type, VDEV_TYPE_DRAID) == 0) {
+		VERIFY0(nvlist_add_uint64(raidz, ZPOOL_CONFIG_DRAID_NDATA,
+		    ztest_opts.zo_draid_data));
+		VERIFY0(nvlist_add_uint64(raidz, ZPOOL_CONFIG_DRAID_NSPARES,
+		    ztest_opts.zo_draid_spares));
+	}
 	VERIFY(nvlist_add_nvlist_array(raidz, ZPOOL_CONFIG_CHILDREN,
 	    child, r) == 0);
 
@@ -1234,6 +1295,12 @@ ztest_random_vdev_top(spa_t *spa, boolean_t log_ok)
 	return (top);
 }
 
+static boolean_t
+ztest_is_draid(void)
+{
+	return (strcmp(ztest_opts.zo_raid_type, VDEV_TYPE_DRAID) == 0);
+}
+
 static uint64_t
 ztest_random_dsl_prop(zfs_prop_t prop)
 {
@@ -2807,6 +2874,10 @@ ztest_spa_upgrade(ztest_ds_t *zd, uint64_t id)
 	if (ztest_opts.zo_mmp_test)
 		return;
 
+	/* dRAID requires feature flags, skip the legacy version upgrade */
+	if (ztest_is_draid())
+		return;
+
 	mutex_enter(&ztest_vdev_lock);
 	name = kmem_asprintf("%s_upgrade", ztest_opts.zo_pool);
 
@@ -3018,11 +3089,15 @@ ztest_vdev_add_remove(ztest_ds_t *zd, uint64_t id)
 		spa_config_exit(spa, SCL_VDEV, FTAG);
 
 		/*
-		 * Make 1/4 of the devices be log devices
+		 * Make 1/4 of the devices be log devices.  dRAID may not be
+		 * used for log devices so a single file is used instead.
 		 */
+		boolean_t log = (ztest_random(4) == 0);
+
 		nvroot = make_vdev_root(NULL, NULL, NULL,
-		    ztest_opts.zo_vdev_size, 0, (ztest_random(4) == 0) ?
-		    "log" : NULL, ztest_opts.zo_raidz, zs->zs_mirrors, 1);
+		    ztest_opts.zo_vdev_size, 0, log ? "log" : NULL,
+		    (log && ztest_is_draid()) ? 1 : ztest_opts.zo_raidz,
+		    zs->zs_mirrors, 1);
 
 		error = spa_vdev_add(spa, nvroot);
 		nvlist_free(nvroot);
@@ -3153,9 +3228,18 @@ ztest_vdev_aux_add_remove(ztest_ds_t *zd, uint64_t id)
 
 	if (sav->sav_count != 0 && ztest_random(4) == 0) {
 		/*
-		 * Pick a random device to remove.
+		 * Pick a random device to remove.  dRAID distributed spares
+		 * are part of their dRAID vdev and cannot be removed.
 		 */
-		guid = sav->sav_vdevs[ztest_random(sav->sav_count)]->vdev_guid;
+		vdev_t *svd = sav->sav_vdevs[ztest_random(sav->sav_count)];
+
+		if (svd->vdev_ops == &vdev_draid_spare_ops) {
+			spa_config_exit(spa, SCL_VDEV, FTAG);
+			mutex_exit(&ztest_vdev_lock);
+			umem_free(path, MAXPATHLEN);
+			return;
+		}
+		guid = svd->vdev_guid;
 	} else {
 		/*
 		 * Find an unused device we can add.
@@ -3339,8 +3423,10 @@ ztest_vdev_attach_detach(ztest_ds_t *zd, uint64_t id)
 	uint64_t oldsize, newsize;
 	char *oldpath, *newpath;
 	int replacing;
+	int rebuild = B_FALSE;
 	int oldvd_has_siblings = B_FALSE;
 	int newvd_is_spare = B_FALSE;
+	int newvd_is_dspare = B_FALSE;
 	int oldvd_is_log;
 	int error, expected_error;
 
@@ -3373,9 +3459,10 @@ ztest_vdev_attach_detach(ztest_ds_t *zd, uint64_t id)
 	replacing = ztest_random(2);
 
 	/*
-	 * Pick a random top-level vdev.
+	 * Pick a random top-level vdev.  When testing dRAID the log
+	 * devices are plain files and are not considered.
 	 */
-	top = ztest_random_vdev_top(spa, B_TRUE);
+	top = ztest_random_vdev_top(spa, !ztest_is_draid());
 
 	/*
 	 * Pick a random leaf within it.
@@ -3394,9 +3481,10 @@ ztest_vdev_attach_detach(ztest_ds_t *zd, uint64_t id)
 		oldvd = oldvd->vdev_child[leaf / ztest_opts.zo_raidz];
 	}
 
-	/* pick a child out of the raidz group */
+	/* pick a child out of the raidz or draid group */
 	if (ztest_opts.zo_raidz > 1) {
-		ASSERT(oldvd->vdev_ops == &vdev_raidz_ops);
+		ASSERT(oldvd->vdev_ops == &vdev_raidz_ops ||
+		    oldvd->vdev_ops == &vdev_draid_ops);
 		ASSERT(oldvd->vdev_children == ztest_opts.zo_raidz);
 		oldvd = oldvd->vdev_child[leaf % ztest_opts.zo_raidz];
 	}
@@ -3445,6 +3533,8 @@ ztest_vdev_attach_detach(ztest_ds_t *zd, uint64_t id)
 	if (sav->sav_count != 0 && ztest_random(3) == 0) {
 		newvd = sav->sav_vdevs[ztest_random(sav->sav_count)];
 		newvd_is_spare = B_TRUE;
+		newvd_is_dspare =
+		    (newvd->vdev_ops == &vdev_draid_spare_ops);
 		(void) strcpy(newpath, newvd->vdev_path);
 	} else {
 		(void) snprintf(newpath, MAXPATHLEN, ztest_dev_template,
@@ -3486,26 +3576,61 @@ ztest_vdev_attach_detach(ztest_ds_t *zd, uint64_t id)
 		expected_error = ENOTSUP;
 	else if (newvd_is_spare && (!replacing || oldvd_is_log))
 		expected_error = ENOTSUP;
+	else if (newvd_is_dspare &&
+	    !vdev_draid_spare_is_for(newvd, oldvd->vdev_top))
+		expected_error = ENOTSUP;
 	else if (newvd == oldvd)
 		expected_error = replacing ? 0 : EBUSY;
 	else if (vdev_lookup_by_path(rvd, newpath) != NULL)
 		expected_error = EBUSY;
 	else if (newsize < oldsize)
 		expected_error = EOVERFLOW;
-	else if (ashift > oldvd->vdev_top->vdev_ashift)
+	else if (!newvd_is_dspare && ashift > oldvd->vdev_top->vdev_ashift)
 		expected_error = EDOM;
 	else
 		expected_error = 0;
 
+	/*
+	 * Sequential rebuild is only supported when every vdev above oldvd
+	 * is a mirror, replacing, spare, or dRAID vdev.  Use it half of the
+	 * time when possible.
+	 */
+	if (oldvd->vdev_top->vdev_top_zap != 0 && ztest_random(2) == 0) {
+		rebuild = B_TRUE;
+		for (vdev_t *vd = pvd; vd != rvd; vd = vd->vdev_parent) {
+			if (vd->vdev_ops != &vdev_mirror_ops &&
+			    vd->vdev_ops != &vdev_replacing_ops &&
+			    vd->vdev_ops != &vdev_spare_ops &&
+			    vd->vdev_ops != &vdev_draid_ops)
+				rebuild = B_FALSE;
+		}
+	}
+
 	spa_config_exit(spa, SCL_ALL, FTAG);
 
 	/*
 	 * Build the nvlist describing newpath.
 	 */
-	root = make_vdev_root(newpath, NULL, NULL, newvd == NULL ? newsize : 0,
-	    ashift, NULL, 0, 0, 1);
+	if (newvd_is_dspare) {
+		nvlist_t *dspare;
+
+		VERIFY0(nvlist_alloc(&dspare, NV_UNIQUE_NAME, 0));
+		VERIFY0(nvlist_add_string(dspare, ZPOOL_CONFIG_TYPE,
+		    VDEV_TYPE_DRAID_SPARE));
+		VERIFY0(nvlist_add_string(dspare, ZPOOL_CONFIG_PATH, newpath));
+
+		VERIFY0(nvlist_alloc(&root, NV_UNIQUE_NAME, 0));
+		VERIFY0(nvlist_add_string(root, ZPOOL_CONFIG_TYPE,
+		    VDEV_TYPE_ROOT));
+		VERIFY0(nvlist_add_nvlist_array(root, ZPOOL_CONFIG_CHILDREN,
+		    &dspare, 1));
+		nvlist_free(dspare);
+	} else {
+		root = make_vdev_root(newpath, NULL, NULL,
+		    newvd == NULL ? newsize : 0, ashift, NULL, 0, 0, 1);
+	}
 
-	error = spa_vdev_attach(spa, oldguid, root, replacing);
+	error = spa_vdev_attach(spa, oldguid, root, replacing, rebuild);
 
 	nvlist_free(root);
 
@@ -4961,6 +5086,109 @@ ztest_dmu_prealloc(ztest_ds_t *zd, uint64_t id)
 	umem_free(od, sizeof (ztest_od_t));
 }
 
+/*
+ * Verify that a cloned range reads back the same as its source, and that
+ * either side can be freed without affecting the other.  Both ranges are
+ * freed at the end, so that the BRT doesn't stay in use and keep device
+ * removal from being tested.
+ */
+void
+ztest_dmu_brt_clone(ztest_ds_t *zd, uint64_t id)
+{
+	objset_t *os = zd->zd_os;
+	ztest_od_t *od;
+	dmu_tx_t *tx;
+	blkptr_t *bps;
+	size_t nbps;
+	uint64_t blocksize = ztest_random_blocksize();
+	uint64_t nblocks = ztest_random(16) + 1;
+	uint64_t size = nblocks * blocksize;
+	uint64_t offset[2], txg;
+	uint64_t *data, *buf;
+	int error;
+
+	if (!spa_feature_is_enabled(dmu_objset_spa(os),
+	    SPA_FEATURE_BLOCK_CLONING) || os->os_encrypted)
+		return;
+
+	od = umem_alloc(2 * sizeof (ztest_od_t), UMEM_NOFAIL);
+	ztest_od_init(&od[0], id, FTAG, 0, DMU_OT_PLAIN_FILE_CONTENTS,
+	    blocksize, 0, 0);
+	ztest_od_init(&od[1], id, FTAG, 1, DMU_OT_PLAIN_FILE_CONTENTS,
+	    blocksize, 0, 0);
+
+	if (ztest_object_init(zd, od, 2 * sizeof (ztest_od_t), B_TRUE) != 0) {
+		umem_free(od, 2 * sizeof (ztest_od_t));
+		return;
+	}
+
+	offset[0] = ztest_random(8) * blocksize;
+	offset[1] = ztest_random(8) * blocksize;
+
+	data = umem_alloc(size, UMEM_NOFAIL);
+	buf = umem_alloc(size, UMEM_NOFAIL);
+	bps = umem_alloc(nblocks * sizeof (blkptr_t), UMEM_NOFAIL);
+
+	for (uint64_t i = 0; i < size / sizeof (uint64_t); i++)
+		data[i] = ztest_random(-1ULL);
+
+	tx = dmu_tx_create(os);
+	dmu_tx_hold_write(tx, od[0].od_object, offset[0], size);
+	txg = ztest_tx_assign(tx, TXG_WAIT, FTAG);
+	if (txg == 0)
+		goto out;
+	dmu_write(os, od[0].od_object, offset[0], size, data, tx);
+	dmu_tx_commit(tx);
+
+	/*
+	 * Only synced blocks can be cloned.  Deduplicated blocks can't be
+	 * cloned at all.
+	 */
+	txg_wait_synced(dmu_objset_pool(os), txg);
+	error = dmu_read_l0_bps(os, od[0].od_object, offset[0], size,
+	    bps, &nbps);
+	if (error == EOPNOTSUPP)
+		goto out;
+	if (error != 0)
+		fatal(0, "dmu_read_l0_bps() = %d", error);
+	VERIFY3U(nbps, ==, nblocks);
+
+	tx = dmu_tx_create(os);
+	dmu_tx_hold_write(tx, od[1].od_object, offset[1], size);
+	txg = ztest_tx_assign(tx, TXG_WAIT, FTAG);
+	if (txg == 0)
+		goto out;
+	VERIFY0(dmu_brt_clone(os, od[1].od_object, offset[1], size, tx,
+	    bps, nbps));
+	dmu_tx_commit(tx);
+
+	txg_wait_synced(dmu_objset_pool(os), txg);
+	VERIFY0(dmu_read(os, od[1].od_object, offset[1], size, buf,
+	    DMU_READ_PREFETCH));
+	if (bcmp(data, buf, size) != 0)
+		fatal(0, "cloned range differs from its source");
+
+	/*
+	 * Free one side and make sure the other is intact, then free
+	 * the other.
+	 */
+	int first = ztest_random(2);
+	(void) ztest_truncate(zd, od[first].od_object, offset[first], size);
+	txg_wait_synced(dmu_objset_pool(os), 0);
+	VERIFY0(dmu_read(os, od[!first].od_object, offset[!first], size, buf,
+	    DMU_READ_PREFETCH));
+	if (bcmp(data, buf, size) != 0)
+		fatal(0, "clone changed by freeing its %s",
+		    first == 0 ? "source" : "destination");
+	(void) ztest_truncate(zd, od[!first].od_object, offset[!first], size);
+
+out:
+	umem_free(bps, nblocks * sizeof (blkptr_t));
+	umem_free(buf, size);
+	umem_free(data, size);
+	umem_free(od, 2 * sizeof (ztest_od_t));
+}
+
 /*
  * Verify that zap_{create,destroy,add,remove,update} work as expected.
  */
@@ -5784,8 +6012,9 @@ ztest_fault_inject(ztest_ds_t *zd, uint64_t id)
 	if (ztest_random(2) == 0) {
 		/*
 		 * Inject errors on a normal data device or slog device.
+		 * The slog devices of a dRAID pool are not redundant.
 		 */
-		top = ztest_random_vdev_top(spa, B_TRUE);
+		top = ztest_random_vdev_top(spa, !ztest_is_draid());
 		leaf = ztest_random(leaves) + zs->zs_splits;
 
 		/*
@@ -6619,6 +6848,13 @@ ztest_resume_thread(void *arg)
 		 */
 		if (ztest_random(10) == 0)
 			zfs_abd_scatter_enabled = ztest_random(2);
+
+		/*
+		 * Periodically change the zfs_vdev_queue_fast_non_rotating
+		 * setting, it takes effect the next time a vdev is opened.
+		 */
+		if (ztest_random(10) == 0)
+			zfs_vdev_queue_fast_non_rotating = ztest_random(2);
 	}
 
 	thread_exit();
@@ -7645,6 +7881,11 @@ main(int argc, char **argv)
 		metaslab_force_ganging = ztest_opts.zo_metaslab_force_ganging;
 		metaslab_df_alloc_threshold =
 		    zs->zs_metaslab_df_alloc_threshold;
+		zfs_arc_evict_threads = ztest_random(4) + 1;
+		zfs_dedup_log_flush_entries_min = ztest_random(64) + 1;
+		zfs_dedup_log_txg_max = ztest_random(16) + 1;
+		/* exercise both the 32-bit and 64-bit metaslab segments */
+		zfs_metaslab_force_large_segs = ztest_random(2);
 
 		if (zs->zs_do_init)
 			ztest_run_init();
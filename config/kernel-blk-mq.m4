@@ -0,0 +1,49 @@
+dnl #
+dnl # 4.13 API - blk-mq request based block drivers.  The zvol blk-mq
+dnl # mode requires a queue_rq() callback returning a blk_status_t and
+dnl # the BLK_MQ_F_BLOCKING flag, which permits queue_rq() to sleep.
+dnl # Older kernels only support the bio based make_request interface.
+dnl #
+AC_DEFUN([ZFS_AC_KERNEL_BLK_MQ], [
+	AC_MSG_CHECKING([whether block multiqueue with blocking queue_rq is available])
+	ZFS_LINUX_TRY_COMPILE([
+		#include <linux/blkdev.h>
+		#include <linux/blk-mq.h>
+
+		static blk_status_t
+		test_queue_rq(struct blk_mq_hw_ctx *hctx,
+		    const struct blk_mq_queue_data *bd)
+		{
+			return (BLK_STS_OK);
+		}
+
+		static const struct blk_mq_ops test_mq_ops
+		    __attribute__ ((unused)) = {
+			.queue_rq = test_queue_rq,
+		};
+	],[
+		struct blk_mq_tag_set tag_set __attribute__ ((unused));
+		struct request_queue *q __attribute__ ((unused));
+		struct request *rq = NULL;
+
+		tag_set.ops = &test_mq_ops;
+		tag_set.nr_hw_queues = 1;
+		tag_set.queue_depth = 128;
+		tag_set.numa_node = NUMA_NO_NODE;
+		tag_set.cmd_size = 0;
+		tag_set.flags = BLK_MQ_F_SHOULD_MERGE | BLK_MQ_F_BLOCKING;
+		tag_set.driver_data = NULL;
+
+		(void) blk_mq_alloc_tag_set(&tag_set);
+		q = blk_mq_init_queue(&tag_set);
+		blk_mq_start_request(rq);
+		blk_mq_end_request(rq, BLK_STS_OK);
+		(void) blk_mq_rq_to_pdu(rq);
+		blk_mq_free_tag_set(&tag_set);
+	],[
+		AC_MSG_RESULT(yes)
+		AC_DEFINE(HAVE_BLK_MQ, 1, [block multiqueue is available])
+	],[
+		AC_MSG_RESULT(no)
+	])
+])
@@ -67,6 +67,7 @@ int lzc_initialize(const char *, pool_initialize_func_t, nvlist_t *,
 int lzc_trim(const char *, pool_trim_func_t, uint64_t, boolean_t,
     nvlist_t *, nvlist_t **);
 int lzc_redact(const char *, const char *, nvlist_t *);
+int lzc_list_batch(const char *, nvlist_t *, nvlist_t **);
 
 int lzc_snaprange_space(const char *, const char *, uint64_t *);
 
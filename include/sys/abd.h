@@ -42,6 +42,7 @@ extern "C" {
 #endif
 
 struct bio;
+struct page;
 
 typedef enum abd_flags {
 	ABD_FLAG_LINEAR	= 1 << 0,	/* is buffer linear (or scattered)? */
@@ -50,6 +51,7 @@ typedef enum abd_flags {
 	ABD_FLAG_MULTI_ZONE  = 1 << 3,	/* pages split over memory zones */
 	ABD_FLAG_MULTI_CHUNK = 1 << 4,	/* pages split over multiple chunks */
 	ABD_FLAG_LINEAR_PAGE = 1 << 5,	/* linear but allocd from page */
+	ABD_FLAG_FROM_PAGES = 1 << 6,	/* scatter over caller's pages */
 } abd_flags_t;
 
 typedef struct abd {
@@ -77,6 +79,11 @@ typedef struct abd {
 
 typedef int abd_iter_func_t(void *buf, size_t len, void *private);
 typedef int abd_iter_func2_t(void *bufa, void *bufb, size_t len, void *private);
+typedef int abd_iter_func_many_t(void **bufs, uint_t n, size_t len,
+    void *private);
+
+/* The most ABDs abd_iterate_func_many() iterates over at once */
+#define	ABD_ITER_MANY_MAX	8
 
 extern int zfs_abd_scatter_enabled;
 
@@ -126,6 +133,8 @@ void abd_release_ownership_of_buf(abd_t *);
 int abd_iterate_func(abd_t *, size_t, size_t, abd_iter_func_t *, void *);
 int abd_iterate_func2(abd_t *, abd_t *, size_t, size_t, size_t,
     abd_iter_func2_t *, void *);
+int abd_iterate_func_many(abd_t **, uint_t, size_t, abd_iter_func_many_t *,
+    void *);
 void abd_copy_off(abd_t *, abd_t *, size_t, size_t, size_t);
 void abd_copy_from_buf_off(abd_t *, const void *, size_t, size_t);
 void abd_copy_to_buf_off(void *, abd_t *, size_t, size_t);
@@ -137,6 +146,7 @@ void abd_zero_off(abd_t *, size_t, size_t);
 unsigned int abd_scatter_bio_map_off(struct bio *, abd_t *, unsigned int,
 		size_t);
 unsigned long abd_nr_pages_off(abd_t *, unsigned int, size_t);
+abd_t *abd_get_from_pages(struct page **, uint_t, size_t, size_t);
 #endif
 
 void abd_raidz_gen_iterate(abd_t **cabds, abd_t *dabd,
@@ -204,18 +204,140 @@ typedef struct arc_buf_hdr_crypt {
 	uint8_t			b_mac[ZIO_DATA_MAC_LEN];
 } arc_buf_hdr_crypt_t;
 
+/*
+ * Persistent L2ARC
+ *
+ * The L2ARC describes the buffers it writes to a cache device in a chain
+ * of log blocks stored on the device itself, so that the L2ARC buffer
+ * headers can be rebuilt when the pool is imported again. The on-disk
+ * layout of a cache device looks like this:
+ *
+ *	+------+------+------------+----------------------------+------+
+ *	| vdev | dev  |  payload   |  log  |      payload       |  log |
+ *	|labels| hdr  |  buffers   |  blk  |      buffers       |  blk |
+ *	+------+------+------------+----------------------------+------+
+ *	              ^            ^       ^                    ^
+ *	         l2ad_start        |       |                    |
+ *	                           +-------+--------------------+
+ *	                          lb_prev_lbp  dh_start_lbp (newest)
+ *
+ * The device header sits right after the front vdev labels and points at
+ * the most recently written log block. Each log block is written after
+ * the payload buffers it describes and points back at its predecessor, so
+ * the chain is walked from the newest log block to the oldest one. Only
+ * log blocks (and payloads) which lie between the evict hand and the write
+ * hand recorded in the device header are still valid.
+ */
+#define	L2ARC_DEV_HDR_MAGIC	0x5a46534341434845LLU	/* ASCII: "ZFSCACHE" */
+#define	L2ARC_LOG_BLK_MAGIC	0x4c4f47424c4b4844LLU	/* ASCII: "LOGBLKHD" */
+#define	L2ARC_PERSISTENT_VERSION	1
+
+/* The device header is being written during the first sweep */
+#define	L2ARC_DEV_HDR_EVICT_FIRST	(1ULL << 0)
+
+/*
+ * Log block and log entry properties are stored in a single 64-bit field
+ * using the same conventions as the block pointer.
+ */
+#define	L2BLK_GET_LSIZE(field)	\
+	BF64_GET_SB((field), 0, SPA_LSIZEBITS, SPA_MINBLOCKSHIFT, 1)
+#define	L2BLK_SET_LSIZE(field, x)	\
+	BF64_SET_SB((field), 0, SPA_LSIZEBITS, SPA_MINBLOCKSHIFT, 1, x)
+#define	L2BLK_GET_PSIZE(field)	\
+	BF64_GET_SB((field), 16, SPA_PSIZEBITS, SPA_MINBLOCKSHIFT, 1)
+#define	L2BLK_SET_PSIZE(field, x)	\
+	BF64_SET_SB((field), 16, SPA_PSIZEBITS, SPA_MINBLOCKSHIFT, 1, x)
+#define	L2BLK_GET_COMPRESS(field)	BF64_GET((field), 32, SPA_COMPRESSBITS)
+#define	L2BLK_SET_COMPRESS(field, x)	\
+	BF64_SET((field), 32, SPA_COMPRESSBITS, x)
+#define	L2BLK_GET_PREFETCH(field)	BF64_GET((field), 39, 1)
+#define	L2BLK_SET_PREFETCH(field, x)	BF64_SET((field), 39, 1, x)
+#define	L2BLK_GET_CHECKSUM(field)	BF64_GET((field), 40, 8)
+#define	L2BLK_SET_CHECKSUM(field, x)	BF64_SET((field), 40, 8, x)
+#define	L2BLK_GET_TYPE(field)		BF64_GET((field), 48, 8)
+#define	L2BLK_SET_TYPE(field, x)	BF64_SET((field), 48, 8, x)
+#define	L2BLK_GET_PROTECTED(field)	BF64_GET((field), 56, 1)
+#define	L2BLK_SET_PROTECTED(field, x)	BF64_SET((field), 56, 1, x)
+
+/*
+ * Pointer to a log block on the cache device. The log block spans
+ * [lbp_daddr, lbp_daddr + asize) and describes buffers written starting
+ * at lbp_payload_start, which is where its validity range begins.
+ */
+typedef struct l2arc_log_blkptr {
+	uint64_t	lbp_daddr;		/* device address of log blk */
+	uint64_t	lbp_payload_start;	/* first payload buf addr */
+	uint64_t	lbp_prop;		/* lsize, psize, cksum, ... */
+	zio_cksum_t	lbp_cksum;		/* fletcher4 of the log blk */
+} l2arc_log_blkptr_t;
+
+/*
+ * The device header is written with an embedded label checksum and is
+ * padded to exactly 512 bytes.
+ */
+typedef struct l2arc_dev_hdr_phys {
+	uint64_t	dh_magic;	/* L2ARC_DEV_HDR_MAGIC */
+	uint64_t	dh_version;	/* L2ARC_PERSISTENT_VERSION */
+	uint64_t	dh_spa_guid;	/* owning pool */
+	uint64_t	dh_vdev_guid;	/* cache device */
+	uint64_t	dh_log_entries;	/* entries per log block */
+	uint64_t	dh_evict;	/* evict hand */
+	uint64_t	dh_flags;	/* L2ARC_DEV_HDR_* flags */
+	uint64_t	dh_start;	/* l2ad_start when written */
+	uint64_t	dh_end;		/* l2ad_end when written */
+	l2arc_log_blkptr_t dh_start_lbp; /* newest log block */
+	uint64_t	dh_pad[43];
+	zio_eck_t	dh_tail;
+} l2arc_dev_hdr_phys_t;
+
+/*
+ * A log entry describes a single buffer in the L2ARC; it carries just
+ * enough to recreate the buffer's L2-only header.
+ */
+typedef struct l2arc_log_ent_phys {
+	dva_t		le_dva;		/* dva of buffer */
+	uint64_t	le_birth;	/* birth txg of buffer */
+	uint64_t	le_prop;	/* lsize, psize, compress, ... */
+	uint64_t	le_daddr;	/* buffer address on the device */
+	uint64_t	le_pad[3];
+} l2arc_log_ent_phys_t;
+
+#define	L2ARC_LOG_BLK_MAX_ENTRIES	(1022)
+
+/*
+ * A log block is 64KiB in memory and is compressed with LZ4 before it is
+ * written out, if that saves space.
+ */
+typedef struct l2arc_log_blk_phys {
+	uint64_t		lb_magic;	/* L2ARC_LOG_BLK_MAGIC */
+	l2arc_log_blkptr_t	lb_prev_lbp;	/* previous log block */
+	uint64_t		lb_pad[8];
+	l2arc_log_ent_phys_t	lb_entries[L2ARC_LOG_BLK_MAX_ENTRIES];
+} l2arc_log_blk_phys_t;
+
 typedef struct l2arc_dev {
 	vdev_t			*l2ad_vdev;	/* vdev */
 	spa_t			*l2ad_spa;	/* spa */
 	uint64_t		l2ad_hand;	/* next write location */
 	uint64_t		l2ad_start;	/* first addr on device */
 	uint64_t		l2ad_end;	/* last addr on device */
+	uint64_t		l2ad_evict;	/* last addr evicted */
 	boolean_t		l2ad_first;	/* first sweep through */
 	boolean_t		l2ad_writing;	/* currently writing */
 	kmutex_t		l2ad_mtx;	/* lock for buffer list */
 	list_t			l2ad_buflist;	/* buffer list */
 	list_node_t		l2ad_node;	/* device list node */
 	zfs_refcount_t		l2ad_alloc;	/* allocated bytes */
+	/* persistent device header, written at VDEV_LABEL_START_SIZE */
+	l2arc_dev_hdr_phys_t	*l2ad_dev_hdr;
+	uint64_t		l2ad_dev_hdr_asize;
+	/* log block being filled and the payload address it starts at */
+	l2arc_log_blk_phys_t	*l2ad_log_blk;
+	int			l2ad_log_ent_idx;
+	uint64_t		l2ad_log_blk_payload_start;
+	/* protected by l2arc_rebuild_thr_lock */
+	boolean_t		l2ad_rebuild;	/* rebuild in progress */
+	boolean_t		l2ad_rebuild_cancel;
 } l2arc_dev_t;
 
 typedef struct l2arc_buf_hdr {
@@ -530,6 +652,30 @@ typedef struct arc_stats {
 	kstat_named_t arcstat_l2_psize;
 	/* Not updated directly; only synced in arc_kstat_update. */
 	kstat_named_t arcstat_l2_hdr_size;
+	/*
+	 * Number of log blocks written to cache devices, and a moving
+	 * average of their allocated size.
+	 */
+	kstat_named_t arcstat_l2_log_blk_writes;
+	kstat_named_t arcstat_l2_log_blk_avg_asize;
+	/*
+	 * L2ARC rebuild statistics. A rebuild either completes, or is
+	 * aborted for one of the reasons below; the buffer and log block
+	 * counters are updated as the rebuild progresses.
+	 */
+	kstat_named_t arcstat_l2_rebuild_success;
+	kstat_named_t arcstat_l2_rebuild_unsupported;
+	kstat_named_t arcstat_l2_rebuild_io_errors;
+	kstat_named_t arcstat_l2_rebuild_dh_errors;
+	kstat_named_t arcstat_l2_rebuild_cksum_lb_errors;
+	kstat_named_t arcstat_l2_rebuild_lowmem;
+	kstat_named_t arcstat_l2_rebuild_size;
+	kstat_named_t arcstat_l2_rebuild_asize;
+	kstat_named_t arcstat_l2_rebuild_bufs;
+	kstat_named_t arcstat_l2_rebuild_bufs_precached;
+	kstat_named_t arcstat_l2_rebuild_log_blks;
+	/* Total time spent rebuilding, in milliseconds. */
+	kstat_named_t arcstat_l2_rebuild_time_ms;
 	kstat_named_t arcstat_memory_throttle_count;
 	kstat_named_t arcstat_memory_direct_count;
 	kstat_named_t arcstat_memory_indirect_count;
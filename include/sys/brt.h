@@ -0,0 +1,118 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef _SYS_BRT_H
+#define	_SYS_BRT_H
+
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+#include <sys/fs/zfs.h>
+#include <sys/zio.h>
+#include <sys/dmu.h>
+#include <sys/avl.h>
+#include <sys/txg.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * Every vdev is divided into regions of BRT_RANGESIZE bytes, and a count
+ * of the BRT entries in each region is kept in memory.  This lets frees
+ * of blocks which were never cloned skip the BRT lookup in most cases.
+ * A region can hold at most BRT_RANGESIZE / SPA_MINBLOCKSIZE entries,
+ * so the counts fit in 16 bits.
+ */
+#define	BRT_RANGESIZE_SHIFT	24
+#define	BRT_RANGESIZE		(1ULL << BRT_RANGESIZE_SHIFT)
+
+/*
+ * The per-vdev state stored in the MOS directory.
+ */
+typedef struct brt_vdev_phys {
+	uint64_t	bvp_object;	/* object holding the region counts */
+	uint64_t	bvp_nregions;	/* number of regions in the object */
+	uint64_t	bvp_usedspace;	/* space of the cloned blocks */
+	uint64_t	bvp_savedspace;	/* space saved by cloned blocks */
+} brt_vdev_phys_t;
+
+typedef struct brt_vdev {
+	uint64_t	bv_vdevid;
+	brt_vdev_phys_t	bv_phys;
+	uint16_t	*bv_entcount;	/* entries in each region */
+	uint64_t	bv_nregions;	/* size of bv_entcount */
+	uint64_t	bv_dirty_start;	/* first region to write out */
+	uint64_t	bv_dirty_end;	/* one past the last */
+	boolean_t	bv_dirty;	/* bv_phys needs to be written */
+} brt_vdev_t;
+
+/*
+ * An in-core BRT entry.  The refcount is the number of references to the
+ * block in addition to the one held by the original owner; the entry is
+ * removed when it drops to zero.  The same structure is used for the
+ * clones of each open txg which have not been applied yet.  The vdev and
+ * offset are used as the two word ZAP key and must stay adjacent.
+ */
+typedef struct brt_entry {
+	uint64_t	bre_vdev;
+	uint64_t	bre_offset;
+	uint64_t	bre_refcount;
+	boolean_t	bre_ondisk;	/* entry exists in the BRT object */
+	blkptr_t	bre_bp;		/* pending entries only */
+	avl_node_t	bre_node;
+} brt_entry_t;
+
+struct brt {
+	spa_t		*brt_spa;
+	krwlock_t	brt_lock;
+	uint64_t	brt_object;	/* ZAP of { vdev, offset } -> refs */
+	uint64_t	brt_nentries;	/* entries, including dirty ones */
+	brt_vdev_t	**brt_vdevs;
+	uint64_t	brt_nvdevs;
+	avl_tree_t	brt_tree;	/* entries modified this txg */
+	kmutex_t	brt_pending_lock[TXG_SIZE];
+	avl_tree_t	brt_pending_tree[TXG_SIZE];
+};
+
+extern void brt_init(void);
+extern void brt_fini(void);
+
+extern void brt_create(spa_t *spa);
+extern int brt_load(spa_t *spa);
+extern void brt_unload(spa_t *spa);
+
+extern boolean_t brt_maybe_exists(spa_t *spa, const blkptr_t *bp);
+extern boolean_t brt_entry_decref(spa_t *spa, const blkptr_t *bp);
+extern uint64_t brt_entry_get_refcount(spa_t *spa, const blkptr_t *bp);
+extern uint64_t brt_get_dspace(spa_t *spa);
+extern uint64_t brt_get_used(spa_t *spa);
+extern uint64_t brt_get_saved(spa_t *spa);
+extern uint64_t brt_get_ratio(spa_t *spa);
+
+extern void brt_pending_add(spa_t *spa, const blkptr_t *bp, dmu_tx_t *tx);
+extern void brt_pending_apply(spa_t *spa, uint64_t txg);
+extern void brt_sync(spa_t *spa, uint64_t txg);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_BRT_H */
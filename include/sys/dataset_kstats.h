@@ -30,6 +30,7 @@
 #include <sys/aggsum.h>
 #include <sys/dmu.h>
 #include <sys/kstat.h>
+#include <sys/zil.h>
 
 typedef struct dataset_aggsum_stats_t {
 	aggsum_t das_writes;
@@ -38,6 +39,13 @@ typedef struct dataset_aggsum_stats_t {
 	aggsum_t das_nread;
 	aggsum_t das_nunlinks;
 	aggsum_t das_nunlinked;
+	aggsum_t das_write_limit_delays;
+	aggsum_t das_write_limit_delay_us;
+	aggsum_t das_direct_writes;
+	aggsum_t das_direct_write_fallbacks;
+	aggsum_t das_direct_reads;
+	aggsum_t das_direct_read_fallbacks;
+	aggsum_t das_mmap_direct_bytes;
 } dataset_aggsum_stats_t;
 
 typedef struct dataset_kstat_values {
@@ -56,6 +64,33 @@ typedef struct dataset_kstat_values {
 	 * entry is removed from the unlinked set
 	 */
 	kstat_named_t dkv_nunlinked;
+	/*
+	 * zil_replay_* describe the intent log replay performed when the
+	 * dataset was mounted or the volume was created, and are zero if
+	 * there was nothing to replay
+	 */
+	kstat_named_t dkv_zil_replay_records;
+	kstat_named_t dkv_zil_replay_blocks;
+	kstat_named_t dkv_zil_replay_time_us;
+	/*
+	 * write_limit_* count the transactions delayed by the write_limit
+	 * and write_ops_limit properties, and the total time they waited
+	 */
+	kstat_named_t dkv_write_limit_delays;
+	kstat_named_t dkv_write_limit_delay_us;
+	/*
+	 * direct_* count the O_DIRECT block I/Os which bypassed the ARC, and
+	 * those which fell back to buffered I/O, see the direct property
+	 */
+	kstat_named_t dkv_direct_writes;
+	kstat_named_t dkv_direct_write_fallbacks;
+	kstat_named_t dkv_direct_reads;
+	kstat_named_t dkv_direct_read_fallbacks;
+	/*
+	 * mmap_direct_bytes counts the bytes which page faults read into the
+	 * page cache without keeping a copy in the ARC, see zfs_mmap_direct
+	 */
+	kstat_named_t dkv_mmap_direct_bytes;
 } dataset_kstat_values_t;
 
 typedef struct dataset_kstats {
@@ -72,4 +107,10 @@ void dataset_kstats_update_read_kstats(dataset_kstats_t *, int64_t);
 void dataset_kstats_update_nunlinks_kstat(dataset_kstats_t *, int64_t);
 void dataset_kstats_update_nunlinked_kstat(dataset_kstats_t *, int64_t);
 
+void dataset_kstats_update_zil_replay_kstats(dataset_kstats_t *, zilog_t *);
+void dataset_kstats_update_write_limit_kstats(dataset_kstats_t *, hrtime_t);
+void dataset_kstats_update_direct_write_kstats(dataset_kstats_t *, boolean_t);
+void dataset_kstats_update_direct_read_kstats(dataset_kstats_t *, boolean_t);
+void dataset_kstats_update_mmap_direct_kstats(dataset_kstats_t *, int64_t);
+
 #endif /* _SYS_DATASET_KSTATS_H */
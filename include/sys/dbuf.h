@@ -160,6 +160,8 @@ typedef struct dbuf_dirty_record {
 			override_states_t dr_override_state;
 			uint8_t dr_copies;
 			boolean_t dr_nopwrite;
+			boolean_t dr_brtwrite;
+			boolean_t dr_diowrite;
 			boolean_t dr_has_raw_params;
 
 			/*
@@ -296,6 +298,12 @@ typedef struct dmu_buf_impl {
 	 */
 	uint8_t db_pending_evict;
 
+	/*
+	 * A direct write of this block is in flight, and the dbuf is in
+	 * DB_NOFILL until dmu_buf_write_direct_done() makes it DB_UNCACHED.
+	 */
+	uint8_t db_direct_write;
+
 	uint8_t db_dirtycnt;
 } dmu_buf_impl_t;
 
@@ -338,6 +346,7 @@ dmu_buf_impl_t *dbuf_find(struct objset *os, uint64_t object, uint8_t level,
     uint64_t blkid);
 
 int dbuf_read(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags);
+blkptr_t *dbuf_read_bp(dmu_buf_impl_t *db);
 void dmu_buf_will_not_fill(dmu_buf_t *db, dmu_tx_t *tx);
 void dmu_buf_will_fill(dmu_buf_t *db, dmu_tx_t *tx);
 void dmu_buf_fill_done(dmu_buf_t *db, dmu_tx_t *tx);
@@ -349,6 +358,10 @@ void dmu_buf_write_embedded(dmu_buf_t *dbuf, void *data,
     int uncompressed_size, int compressed_size, int byteorder, dmu_tx_t *tx);
 
 void dmu_buf_redact(dmu_buf_t *dbuf, dmu_tx_t *tx);
+void dmu_buf_write_clone(dmu_buf_t *dbuf, const blkptr_t *bp, dmu_tx_t *tx);
+int dmu_buf_will_write_direct(dmu_buf_t *dbuf, dmu_tx_t *tx);
+void dmu_buf_write_direct_done(dmu_buf_t *dbuf, const blkptr_t *bp,
+    int copies, int error, dmu_tx_t *tx);
 void dbuf_destroy(dmu_buf_impl_t *db);
 
 void dbuf_unoverride(dbuf_dirty_record_t *dr);
@@ -125,12 +125,63 @@ struct ddt_entry {
 	struct abd	*dde_repair_abd;
 	enum ddt_type	dde_type;
 	enum ddt_class	dde_class;
+	enum ddt_type	dde_disk_type;	/* DDT object holding the entry */
+	enum ddt_class	dde_disk_class;
 	uint8_t		dde_loading;
 	uint8_t		dde_loaded;
 	kcondvar_t	dde_cv;
 	avl_node_t	dde_node;
 };
 
+/*
+ * On-disk DDT log record, describing the state of an entry as of the txg
+ * in which it was logged.  The type and class are those the entry logically
+ * belongs to (DDT_TYPES and DDT_CLASSES once it has been freed), while the
+ * disk type and class identify the DDT object which still holds it.
+ */
+typedef struct ddt_log_record {
+	ddt_key_t	dlr_key;
+	ddt_phys_t	dlr_phys[DDT_PHYS_TYPES];
+	uint64_t	dlr_type;
+	uint64_t	dlr_class;
+	uint64_t	dlr_disk_type;
+	uint64_t	dlr_disk_class;
+} ddt_log_record_t;
+
+/*
+ * In-core DDT log entry
+ */
+typedef struct ddt_log_entry {
+	ddt_log_record_t dle_rec;
+	avl_node_t	dle_node;
+} ddt_log_entry_t;
+
+/*
+ * On-disk DDT log header, stored in the pool directory.  The checkpoint is
+ * the last key of a flushing log which has been written to the DDT objects.
+ */
+typedef struct ddt_log_phys {
+	uint64_t	dlp_object;	/* object holding the records */
+	uint64_t	dlp_length;	/* length of the records in bytes */
+	uint64_t	dlp_first_txg;	/* txg of the first record */
+	uint64_t	dlp_flags;
+	ddt_key_t	dlp_checkpoint;
+} ddt_log_phys_t;
+
+#define	DDL_FLAG_CHECKPOINT	(1ULL << 0)	/* dlp_checkpoint is valid */
+
+/*
+ * In-core DDT log
+ */
+typedef struct ddt_log {
+	avl_tree_t	ddl_tree;
+	ddt_log_phys_t	ddl_phys;
+} ddt_log_t;
+
+#define	DDT_LOG_ACTIVE		0
+#define	DDT_LOG_FLUSHING	1
+#define	DDT_LOGS		2
+
 /*
  * In-core ddt
  */
@@ -146,12 +197,22 @@ struct ddt {
 	ddt_histogram_t	ddt_histogram[DDT_TYPES][DDT_CLASSES];
 	ddt_histogram_t	ddt_histogram_cache[DDT_TYPES][DDT_CLASSES];
 	ddt_object_t	ddt_object_stats[DDT_TYPES][DDT_CLASSES];
+	ddt_log_t	ddt_log[DDT_LOGS];
+	ddt_log_t	*ddt_log_active;	/* receives new updates */
+	ddt_log_t	*ddt_log_flushing;	/* being written to the DDT */
+	ddt_key_t	ddt_log_walk_key;	/* last key walked in the log */
 	avl_node_t	ddt_node;
 };
 
 /*
- * In-core and on-disk bookmark for DDT walks
+ * In-core and on-disk bookmark for DDT walks.  For each class the entries
+ * in the DDT objects are visited first, followed by those held in the DDT
+ * log (ddb_type DDB_TYPE_LOG), which is only walked while the ddt_log
+ * feature is active.
  */
+#define	DDB_TYPE_LOG		DDT_TYPES
+#define	DDB_TYPES		(DDT_TYPES + 1)
+
 typedef struct ddt_bookmark {
 	uint64_t	ddb_class;
 	uint64_t	ddb_type;
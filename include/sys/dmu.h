@@ -59,6 +59,7 @@ struct vnode;
 struct spa;
 struct zilog;
 struct zio;
+struct dataset_kstats;
 struct blkptr;
 struct zap_cursor;
 struct dsl_dataset;
@@ -74,6 +75,7 @@ struct zio_prop;
 struct sa_handle;
 struct dsl_crypto_params;
 struct locked_range;
+struct abd;
 
 typedef struct objset objset_t;
 typedef struct dmu_tx dmu_tx_t;
@@ -371,6 +373,9 @@ typedef struct dmu_buf {
 #define	DMU_POOL_TMP_USERREFS		"tmp_userrefs"
 #define	DMU_POOL_DDT			"DDT-%s-%s-%s"
 #define	DMU_POOL_DDT_STATS		"DDT-statistics"
+#define	DMU_POOL_DDT_LOG		"DDT-log-%s-%s"
+#define	DMU_POOL_BRT			"BRT"
+#define	DMU_POOL_BRT_VDEV		"BRT-vdev-%llu"
 #define	DMU_POOL_CREATION_VERSION	"creation_version"
 #define	DMU_POOL_SCAN			"scan"
 #define	DMU_POOL_FREE_BPOBJ		"free_bpobj"
@@ -503,6 +508,14 @@ void dmu_write_embedded(objset_t *os, uint64_t object, uint64_t offset,
     int compressed_size, int byteorder, dmu_tx_t *tx);
 void dmu_redact(objset_t *os, uint64_t object, uint64_t offset, uint64_t size,
     dmu_tx_t *tx);
+int dmu_read_l0_bps(objset_t *os, uint64_t object, uint64_t offset,
+    uint64_t length, struct blkptr *bps, size_t *nbpsp);
+int dmu_brt_clone(objset_t *os, uint64_t object, uint64_t offset,
+    uint64_t length, dmu_tx_t *tx, const struct blkptr *bps, size_t nbps);
+int dmu_write_direct_dbuf(dmu_buf_t *zdb, uint64_t offset, struct abd *data,
+    dmu_tx_t *tx);
+int dmu_read_direct_dbuf(dmu_buf_t *zdb, uint64_t offset, uint64_t size,
+    struct abd *data);
 
 /*
  * Decide how to write a block: checksum, compression, number of copies, etc.
@@ -890,6 +903,11 @@ extern int zfs_max_recordsize;
 void dmu_prefetch(objset_t *os, uint64_t object, int64_t level, uint64_t offset,
 	uint64_t len, enum zio_priority pri);
 
+/*
+ * Returns B_TRUE if a read of the range would be served from cached dbufs.
+ */
+boolean_t dmu_dnode_range_cached(dnode_t *dn, uint64_t offset, uint64_t len);
+
 typedef struct dmu_object_info {
 	/* All sizes are in bytes unless otherwise indicated. */
 	uint32_t doi_data_block_size;
@@ -1023,6 +1041,7 @@ extern void dmu_objset_register_type(dmu_objset_type_t ost,
     objset_used_cb_t *cb);
 extern void dmu_objset_set_user(objset_t *os, void *user_ptr);
 extern void *dmu_objset_get_user(objset_t *os);
+extern void dmu_objset_set_kstats(objset_t *os, struct dataset_kstats *dk);
 
 /*
  * Return the txg number for the given assigned transaction.
@@ -255,6 +255,7 @@ void dmu_object_zapify(objset_t *, uint64_t, dmu_object_type_t, dmu_tx_t *);
 void dmu_object_free_zapified(objset_t *, uint64_t, dmu_tx_t *);
 int dmu_buf_hold_noread(objset_t *, uint64_t, uint64_t,
     void *, dmu_buf_t **);
+int dmu_buf_hold_noread_by_dnode(dnode_t *, uint64_t, void *, dmu_buf_t **);
 
 #ifdef	__cplusplus
 }
@@ -125,6 +125,7 @@ struct objset {
 	zfs_cache_type_t os_primary_cache;
 	zfs_cache_type_t os_secondary_cache;
 	zfs_sync_type_t os_sync;
+	zfs_direct_t os_direct;
 	zfs_redundant_metadata_type_t os_redundant_metadata;
 	int os_recordsize;
 	/*
@@ -143,6 +144,17 @@ struct objset {
 	 */
 	int os_zpl_special_smallblock;
 
+	/*
+	 * Write limits, in bytes and transactions per second, and the
+	 * theoretical arrival time of the next transaction under each,
+	 * protected by os_throttle_lock.  See dmu_objset_throttle().
+	 */
+	kmutex_t os_throttle_lock;
+	uint64_t os_write_limit;
+	uint64_t os_write_ops_limit;
+	hrtime_t os_write_limit_tat;
+	hrtime_t os_write_ops_limit_tat;
+
 	/*
 	 * Pointer is constant; the blkptr it points to is protected by
 	 * os_dsl_dataset->ds_bp_rwlock
@@ -181,6 +193,7 @@ struct objset {
 	/* stuff we store for the user */
 	kmutex_t os_user_ptr_lock;
 	void *os_user_ptr;
+	struct dataset_kstats *os_dataset_kstats;
 	sa_os_t *os_sa;
 
 	/* kernel thread to upgrade this dataset */
@@ -228,6 +241,7 @@ int dmu_objset_find_dp(struct dsl_pool *dp, uint64_t ddobj,
     int func(struct dsl_pool *, struct dsl_dataset *, void *),
     void *arg, int flags);
 void dmu_objset_evict_dbufs(objset_t *os);
+hrtime_t dmu_objset_throttle(objset_t *os, uint64_t bytes);
 inode_timespec_t dmu_objset_snap_cmtime(objset_t *os);
 
 /* called from dsl */
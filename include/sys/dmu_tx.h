@@ -79,6 +79,15 @@ struct dmu_tx {
 	/* has this transaction already been delayed? */
 	boolean_t tx_dirty_delayed;
 
+	/* need to wait for the dataset's write limits */
+	boolean_t tx_wait_throttle;
+
+	/* has this transaction been charged to the dataset's write limits? */
+	boolean_t tx_throttled;
+
+	/* time at which the dataset's write limits permit this transaction */
+	hrtime_t tx_throttle_wakeup;
+
 	int tx_err;
 };
 
@@ -126,6 +135,7 @@ typedef struct dmu_tx_stats {
 	kstat_named_t dmu_tx_dirty_over_max;
 	kstat_named_t dmu_tx_dirty_frees_delay;
 	kstat_named_t dmu_tx_quota;
+	kstat_named_t dmu_tx_write_limit;
 } dmu_tx_stats_t;
 
 extern dmu_tx_stats_t dmu_tx_stats;
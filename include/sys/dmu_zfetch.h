@@ -40,10 +40,23 @@ extern unsigned long	zfetch_array_rd_sz;
 
 struct dnode;				/* so we can reference dnode */
 
+/* number of recent unmatched accesses remembered for stride detection */
+#define	ZFETCH_HISTORY		8
+
 typedef struct zstream {
 	uint64_t	zs_blkid;	/* expect next access at this blkid */
 	uint64_t	zs_pf_blkid;	/* next block to prefetch */
 
+	/*
+	 * Distance in blocks between the starts of consecutive accesses
+	 * of a strided stream; negative for reverse streams.  Zero for a
+	 * sequential stream.  For strided streams zs_pf_blkid is the start
+	 * of the next predicted access which has not been prefetched.
+	 */
+	int64_t		zs_stride;
+	uint64_t	zs_hits;	/* accesses predicted by this stream */
+	uint64_t	zs_misses;	/* predicted accesses skipped */
+
 	/*
 	 * We will next prefetch the L1 indirect block of this level-0
 	 * block id.
@@ -59,6 +72,9 @@ typedef struct zfetch {
 	krwlock_t	zf_rwlock;	/* protects zfetch structure */
 	list_t		zf_stream;	/* list of zstream_t's */
 	struct dnode	*zf_dnode;	/* dnode that owns this zfetch */
+	/* recent unmatched accesses, used to detect strided streams */
+	uint64_t	zf_hist[ZFETCH_HISTORY];
+	uint_t		zf_hist_next;	/* next zf_hist slot to replace */
 } zfetch_t;
 
 void		zfetch_init(void);
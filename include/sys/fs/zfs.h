@@ -186,6 +186,9 @@ typedef enum {
 	ZFS_PROP_IVSET_GUID,		/* not exposed to the user */
 	ZFS_PROP_REDACTED,
 	ZFS_PROP_REDACT_SNAPS,
+	ZFS_PROP_WRITE_LIMIT,
+	ZFS_PROP_WRITE_OPS_LIMIT,
+	ZFS_PROP_DIRECT,
 	ZFS_NUM_PROPS
 } zfs_prop_t;
 
@@ -246,6 +249,9 @@ typedef enum {
 	ZPOOL_PROP_CHECKPOINT,
 	ZPOOL_PROP_LOAD_GUID,
 	ZPOOL_PROP_AUTOTRIM,
+	ZPOOL_PROP_BCLONEUSED,
+	ZPOOL_PROP_BCLONESAVED,
+	ZPOOL_PROP_BCLONERATIO,
 	ZPOOL_NUM_PROPS
 } zpool_prop_t;
 
@@ -404,6 +410,12 @@ typedef enum {
 	ZFS_SYNC_DISABLED = 2
 } zfs_sync_type_t;
 
+typedef enum {
+	ZFS_DIRECT_DISABLED = 0,
+	ZFS_DIRECT_STANDARD = 1,
+	ZFS_DIRECT_ALWAYS = 2
+} zfs_direct_t;
+
 typedef enum {
 	ZFS_XATTR_OFF = 0,
 	ZFS_XATTR_DIR = 1,
@@ -680,6 +692,8 @@ typedef struct zpool_load_policy {
 #define	ZPOOL_CONFIG_SPARES		"spares"
 #define	ZPOOL_CONFIG_IS_SPARE		"is_spare"
 #define	ZPOOL_CONFIG_NPARITY		"nparity"
+#define	ZPOOL_CONFIG_DRAID_NDATA	"dcraid_ndata"
+#define	ZPOOL_CONFIG_DRAID_NSPARES	"dcraid_nspares"
 #define	ZPOOL_CONFIG_HOSTID		"hostid"
 #define	ZPOOL_CONFIG_HOSTNAME		"hostname"
 #define	ZPOOL_CONFIG_LOADED_TIME	"initial_load_time"
@@ -699,6 +713,7 @@ typedef struct zpool_load_policy {
 #define	ZPOOL_CONFIG_SPLIT_LIST		"guid_list"
 #define	ZPOOL_CONFIG_REMOVING		"removing"
 #define	ZPOOL_CONFIG_RESILVER_TXG	"resilver_txg"
+#define	ZPOOL_CONFIG_REBUILD_TXG	"rebuild_txg"
 #define	ZPOOL_CONFIG_COMMENT		"comment"
 #define	ZPOOL_CONFIG_SUSPENDED		"suspended"	/* not stored on disk */
 #define	ZPOOL_CONFIG_SUSPENDED_REASON	"suspended_reason"	/* not stored */
@@ -754,6 +769,8 @@ typedef struct zpool_load_policy {
 #define	VDEV_TYPE_MIRROR		"mirror"
 #define	VDEV_TYPE_REPLACING		"replacing"
 #define	VDEV_TYPE_RAIDZ			"raidz"
+#define	VDEV_TYPE_DRAID			"dcraid"
+#define	VDEV_TYPE_DRAID_SPARE		"dcspare"
 #define	VDEV_TYPE_DISK			"disk"
 #define	VDEV_TYPE_FILE			"file"
 #define	VDEV_TYPE_MISSING		"missing"
@@ -763,6 +780,9 @@ typedef struct zpool_load_policy {
 #define	VDEV_TYPE_L2CACHE		"l2cache"
 #define	VDEV_TYPE_INDIRECT		"indirect"
 
+/* maximum number of parity devices in a dRAID redundancy group */
+#define	VDEV_DRAID_MAXPARITY		3
+
 /* VDEV_TOP_ZAP_* are used in top-level vdev ZAP objects. */
 #define	VDEV_TOP_ZAP_INDIRECT_OBSOLETE_SM \
 	"com.delphix:indirect_obsolete_sm"
@@ -772,6 +792,8 @@ typedef struct zpool_load_policy {
 	"com.delphix:pool_checkpoint_sm"
 #define	VDEV_TOP_ZAP_MS_UNFLUSHED_PHYS_TXGS \
 	"com.delphix:ms_unflushed_phys_txgs"
+#define	VDEV_TOP_ZAP_VDEV_REBUILD_PHYS \
+	"org.openzfs:vdev_rebuild"
 
 #define	VDEV_TOP_ZAP_ALLOCATION_BIAS \
 	"org.zfsonlinux:allocation_bias"
@@ -899,6 +921,7 @@ typedef enum pool_scan_func {
 	POOL_SCAN_NONE,
 	POOL_SCAN_SCRUB,
 	POOL_SCAN_RESILVER,
+	POOL_SCAN_REBUILD,	/* sequential resilver, see vdev_rebuild.c */
 	POOL_SCAN_FUNCS
 } pool_scan_func_t;
 
@@ -1284,6 +1307,7 @@ typedef enum zfs_ioc {
 	ZFS_IOC_POOL_TRIM,			/* 0x5a50 */
 	ZFS_IOC_REDACT,				/* 0x5a51 */
 	ZFS_IOC_GET_BOOKMARK_PROPS,		/* 0x5a52 */
+	ZFS_IOC_LIST_BATCH,			/* 0x5a53 */
 
 	/*
 	 * Linux - 3/64 numbers reserved.
@@ -1398,6 +1422,27 @@ typedef enum {
 #define	ZPOOL_TRIM_RATE			"trim_rate"
 #define	ZPOOL_TRIM_SECURE		"trim_secure"
 
+/*
+ * The following are names used when invoking ZFS_IOC_LIST_BATCH.  The
+ * SNAP_ITER_MIN_TXG and SNAP_ITER_MAX_TXG names may also be used.
+ */
+#define	ZFS_LIST_SNAPSHOTS		"list_snapshots"
+#define	ZFS_LIST_CURSOR			"list_cursor"
+#define	ZFS_LIST_COUNT			"list_count"
+#define	ZFS_LIST_PROPS			"list_props"
+#define	ZFS_LIST_SIMPLE			"list_simple"
+#define	ZFS_LIST_DATASETS		"list_datasets"
+#define	ZFS_LIST_DONE			"list_done"
+#define	ZFS_LIST_STATS			"list_stats"
+
+/*
+ * ZFS_IOC_LIST_BATCH returns at most ZFS_LIST_BATCH_MAX datasets per call,
+ * and stops adding datasets once about ZFS_LIST_BATCH_BYTES of nvlist have
+ * been gathered, so that a batch fits the default result buffer.
+ */
+#define	ZFS_LIST_BATCH_MAX		1024
+#define	ZFS_LIST_BATCH_BYTES		(96 * 1024)
+
 /*
  * Flags for ZFS_IOC_VDEV_SET_STATE
  */
@@ -194,12 +194,43 @@ SHA2Final(void *p, SHA2_CTX *c)
 	}
 }
 
+static inline void
+SHA2UpdateMB(SHA2_CTX *const *c, const void *const *p, size_t s, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		SHA2Update(c[i], p[i], s);
+}
+
 #else
 extern void SHA2Init(uint64_t mech, SHA2_CTX *);
 
 extern void SHA2Update(SHA2_CTX *, const void *, size_t);
 
+/*
+ * Update n contexts of the same type at once, each with s bytes of its own
+ * input.  All contexts must have been fed the same number of bytes so far.
+ * This allows multi-buffer implementations to hash the independent inputs
+ * in a single SIMD pass.
+ */
+extern void SHA2UpdateMB(SHA2_CTX *const *, const void *const *, size_t,
+    size_t);
+
 extern void SHA2Final(void *, SHA2_CTX *);
+
+/*
+ * Implementation selection.  These work like their fletcher_4
+ * counterparts, except that they take a SHA2 mechanism to choose between
+ * the SHA-256 and the SHA-384/512 implementations: sha2_impl_init() finds
+ * the supported implementations and, in the kernel, benchmarks them to
+ * pick the fastest ones, after which sha2_impl_set() accepts "fastest",
+ * "cycle" or the name of any supported implementation.
+ */
+extern void sha2_impl_init(void *);
+extern void sha2_impl_fini(void);
+extern int sha2_impl_set(uint64_t mech, const char *);
+extern uint32_t sha2_impl_getcnt(uint64_t mech);
+extern const char *sha2_impl_getname(uint64_t mech);
+extern void sha2_impl_setid(uint64_t mech, uint32_t);
 #endif
 
 #ifdef _SHA2_IMPL
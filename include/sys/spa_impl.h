@@ -175,6 +175,36 @@ typedef enum spa_proc_state {
 	SPA_PROC_GONE		/* spa_thread() is exiting, spa_proc = &p0 */
 } spa_proc_state_t;
 
+/*
+ * Per-CPU slot holding the batch of asynchronous writes which is currently
+ * accepting zios, see zio_issue_async().
+ */
+typedef struct spa_zio_batch {
+	kmutex_t		szb_lock;
+	struct zio_batch	*szb_open;	/* protected by szb_lock */
+} spa_zio_batch_t;
+
+/*
+ * Phases of spa_load_impl() whose durations are kept for the pool's
+ * load_times kstat.
+ */
+typedef enum spa_load_phase {
+	SPA_LOAD_PHASE_OPEN_MOS,	/* vdevs, uberblock, trusted config */
+	SPA_LOAD_PHASE_INDIRECT_VDEVS,
+	SPA_LOAD_PHASE_FEATURES,
+	SPA_LOAD_PHASE_SPECIAL_DIRS,
+	SPA_LOAD_PHASE_PROPS,
+	SPA_LOAD_PHASE_AUX_VDEVS,
+	SPA_LOAD_PHASE_VDEV_METADATA,	/* metaslabs, DTLs, log spacemaps */
+	SPA_LOAD_PHASE_DEDUP_TABLES,
+	SPA_LOAD_PHASE_BRT,
+	SPA_LOAD_PHASE_VERIFY_LOGS,
+	SPA_LOAD_PHASE_VERIFY_POOL_DATA,
+	SPA_LOAD_PHASE_CLAIM,		/* claim and sync ZIL blocks */
+	SPA_LOAD_PHASE_FINISH,		/* remaining read-write setup */
+	SPA_LOAD_PHASES
+} spa_load_phase_t;
+
 typedef struct spa_taskqs {
 	uint_t stqs_count;
 	taskq_t **stqs_taskq;
@@ -207,6 +237,7 @@ struct spa {
 	nvlist_t	*spa_config_syncing;	/* currently syncing config */
 	nvlist_t	*spa_config_splitting;	/* config for splitting */
 	nvlist_t	*spa_load_info;		/* info and errors from load */
+	hrtime_t	spa_load_phase_time[SPA_LOAD_PHASES]; /* last load */
 	uint64_t	spa_config_txg;		/* txg of last config change */
 	int		spa_sync_pass;		/* iterate-to-convergence */
 	pool_state_t	spa_state;		/* pool state */
@@ -218,6 +249,7 @@ struct spa {
 	spa_config_source_t spa_config_source;	/* where config comes from? */
 	uint64_t	spa_import_flags;	/* import specific flags */
 	spa_taskqs_t	spa_zio_taskq[ZIO_TYPES][ZIO_TASKQ_TYPES];
+	spa_zio_batch_t	*spa_zio_batch;		/* per-CPU write batches */
 	dsl_pool_t	*spa_dsl_pool;
 	boolean_t	spa_is_initializing;	/* true while opening pool */
 	boolean_t	spa_is_exporting;	/* true while exporting pool */
@@ -362,6 +394,7 @@ struct spa {
 	uint64_t	spa_ddt_stat_object;	/* DDT statistics */
 	uint64_t	spa_dedup_dspace;	/* Cache get_dedup_dspace() */
 	uint64_t	spa_dedup_checksum;	/* default dedup checksum */
+	brt_t		*spa_brt;		/* in-core block ref table */
 	uint64_t	spa_dspace;		/* dspace in normal class */
 	kmutex_t	spa_vdev_top_lock;	/* dueling offline/remove */
 	kmutex_t	spa_proc_lock;		/* protects spa_proc* */
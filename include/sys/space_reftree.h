@@ -30,6 +30,7 @@
 #ifndef _SYS_SPACE_REFTREE_H
 #define	_SYS_SPACE_REFTREE_H
 
+#include <sys/avl.h>
 #include <sys/range_tree.h>
 
 #ifdef	__cplusplus
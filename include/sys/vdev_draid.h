@@ -0,0 +1,75 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef _SYS_VDEV_DRAID_H
+#define	_SYS_VDEV_DRAID_H
+
+#include <sys/types.h>
+#include <sys/abd.h>
+#include <sys/nvpair.h>
+#include <sys/zio.h>
+#include <sys/vdev_impl.h>
+#include <sys/vdev_raidz_impl.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * Constants required to generate and use dRAID permutations.
+ */
+#define	VDEV_DRAID_MAX_CHILDREN	255	/* maximum number of children */
+#define	VDEV_DRAID_NPERMS	256	/* number of permutations per vdev */
+#define	VDEV_DRAID_SEED		0xd7a1d5eed4a4c0ffULL
+
+/*
+ * The dRAID configuration is derived from the vdev's config nvlist when
+ * the vdev is allocated and is stored in vdev_tsd for its lifetime.
+ */
+typedef struct vdev_draid_config {
+	uint64_t vdc_ndata;		/* data devices per redundancy group */
+	uint64_t vdc_nparity;		/* parity devices per group */
+	uint64_t vdc_nspares;		/* distributed spares */
+	uint64_t vdc_children;		/* total number of children */
+	uint64_t vdc_ndisks;		/* children - nspares */
+	uint64_t vdc_groupwidth;	/* ndata + nparity */
+	uint64_t vdc_ngroups;		/* redundancy groups per slice */
+	uint64_t vdc_slicerows;		/* rows per slice */
+	uint64_t vdc_nperms;		/* number of permutations */
+	uint8_t *vdc_perms;		/* nperms * children permutations */
+	uint8_t *vdc_invperms;		/* inverse of vdc_perms */
+} vdev_draid_config_t;
+
+extern int vdev_draid_config_create(nvlist_t *, uint64_t,
+    vdev_draid_config_t **);
+extern void vdev_draid_config_destroy(vdev_draid_config_t *);
+extern void vdev_draid_config_generate(vdev_t *, nvlist_t *);
+extern void vdev_draid_set_asize(vdev_t *);
+extern uint64_t vdev_draid_min_asize(vdev_t *);
+extern boolean_t vdev_draid_spare_is_for(vdev_t *, vdev_t *);
+extern void vdev_draid_spare_create(nvlist_t *, vdev_t *, uint64_t);
+extern nvlist_t *vdev_draid_read_config_spare(vdev_t *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* _SYS_VDEV_DRAID_H */
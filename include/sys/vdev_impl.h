@@ -39,6 +39,7 @@
 #include <sys/vdev_indirect_mapping.h>
 #include <sys/vdev_indirect_births.h>
 #include <sys/vdev_removal.h>
+#include <sys/vdev_rebuild.h>
 #include <sys/zfs_ratelimit.h>
 
 #ifdef	__cplusplus
@@ -62,6 +63,7 @@ struct abd;
 
 extern int zfs_vdev_queue_depth_pct;
 extern int zfs_vdev_def_queue_depth;
+extern int zfs_vdev_queue_fast_non_rotating;
 extern uint32_t zfs_vdev_async_write_max_active;
 
 /*
@@ -86,8 +88,8 @@ typedef void	vdev_remap_func_t(vdev_t *vd, uint64_t offset, uint64_t size,
  * Given a target vdev, translates the logical range "in" to the physical
  * range "res"
  */
-typedef void vdev_xlation_func_t(vdev_t *cvd, const range_seg_t *in,
-    range_seg_t *res);
+typedef void vdev_xlation_func_t(vdev_t *cvd, const range_seg64_t *in,
+    range_seg64_t *res);
 
 typedef const struct vdev_ops {
 	vdev_open_func_t		*vdev_op_open;
@@ -139,6 +141,17 @@ typedef struct vdev_queue_class {
 	avl_tree_t	vqc_queued_tree;
 } vdev_queue_class_t;
 
+/*
+ * Per-CPU submission list used by the fast queue mode of non-rotational
+ * leaf vdevs.  Queued i/os are kept in FIFO order for each class, and
+ * issued i/os in the order they were issued, for the deadman.
+ */
+typedef struct vdev_queue_fast_list {
+	kmutex_t	vqfl_lock;
+	list_t		vqfl_queued[ZIO_PRIORITY_NUM_QUEUEABLE];
+	list_t		vqfl_active;
+} ____cacheline_aligned vdev_queue_fast_list_t;
+
 struct vdev_queue {
 	vdev_t		*vq_vdev;
 	vdev_queue_class_t vq_class[ZIO_PRIORITY_NUM_QUEUEABLE];
@@ -151,6 +164,19 @@ struct vdev_queue {
 	hrtime_t	vq_io_delta_ts;
 	zio_t		vq_io_search; /* used as local for stack reduction */
 	kmutex_t	vq_lock;
+
+	/*
+	 * Fast queue mode, which bypasses vq_lock, aggregation and the
+	 * sorted trees above.  Only used by non-rotational leaf vdevs.
+	 */
+	boolean_t	vq_fast;
+	uint_t		vq_fast_nlists;
+	vdev_queue_fast_list_t *vq_fast_lists;
+	uint32_t	vq_fast_rotor;
+	uint32_t	vq_fast_nactive;
+	uint32_t	vq_fast_nqueued;
+	uint32_t	vq_fast_active[ZIO_PRIORITY_NUM_QUEUEABLE];
+	uint32_t	vq_fast_queued[ZIO_PRIORITY_NUM_QUEUEABLE];
 };
 
 typedef enum vdev_alloc_bias {
@@ -252,6 +278,7 @@ struct vdev {
 	boolean_t	vdev_nonrot;	/* true if solid state		*/
 	int		vdev_open_error; /* error on last open		*/
 	kthread_t	*vdev_open_thread; /* thread opening children	*/
+	int		vdev_load_error; /* error on last load		*/
 	uint64_t	vdev_crtxg;	/* txg when top-level was added */
 
 	/*
@@ -316,6 +343,17 @@ struct vdev {
 	uint64_t	vdev_trim_secure;	/* requested secure TRIM */
 	time_t		vdev_trim_action_time;	/* start and end time */
 
+	/* Rebuild related */
+	boolean_t	vdev_rebuilding;
+	boolean_t	vdev_rebuild_exit_wanted;
+	boolean_t	vdev_rebuild_cancel_wanted;
+	boolean_t	vdev_rebuild_reset_wanted;
+	/* Protects vdev_rebuild_thread and vdev_rebuild_config. */
+	kmutex_t	vdev_rebuild_lock;
+	kcondvar_t	vdev_rebuild_cv;
+	kthread_t	*vdev_rebuild_thread;
+	vdev_rebuild_t	vdev_rebuild_config;
+
 	/* for limiting outstanding I/Os (initialize and TRIM) */
 	kmutex_t	vdev_initialize_io_lock;
 	kcondvar_t	vdev_initialize_io_cv;
@@ -379,6 +417,7 @@ struct vdev {
 	uint64_t	vdev_degraded;	/* persistent degraded state	*/
 	uint64_t	vdev_removed;	/* persistent removed state	*/
 	uint64_t	vdev_resilver_txg; /* persistent resilvering state */
+	uint64_t	vdev_rebuild_txg; /* persistent rebuilding state */
 	uint64_t	vdev_nparity;	/* number of parity devices for raidz */
 	char		*vdev_path;	/* vdev path (if any)		*/
 	char		*vdev_devid;	/* vdev devid (if any)		*/
@@ -539,6 +578,8 @@ extern vdev_ops_t vdev_root_ops;
 extern vdev_ops_t vdev_mirror_ops;
 extern vdev_ops_t vdev_replacing_ops;
 extern vdev_ops_t vdev_raidz_ops;
+extern vdev_ops_t vdev_draid_ops;
+extern vdev_ops_t vdev_draid_spare_ops;
 extern vdev_ops_t vdev_disk_ops;
 extern vdev_ops_t vdev_file_ops;
 extern vdev_ops_t vdev_missing_ops;
@@ -549,8 +590,8 @@ extern vdev_ops_t vdev_indirect_ops;
 /*
  * Common size functions
  */
-extern void vdev_default_xlate(vdev_t *vd, const range_seg_t *in,
-    range_seg_t *out);
+extern void vdev_default_xlate(vdev_t *vd, const range_seg64_t *in,
+    range_seg64_t *out);
 extern uint64_t vdev_default_asize(vdev_t *vd, uint64_t psize);
 extern uint64_t vdev_get_min_asize(vdev_t *vd);
 extern void vdev_set_min_asize(vdev_t *vd);
@@ -32,7 +32,9 @@ extern "C" {
 #endif
 
 struct zio;
+struct vdev;
 struct raidz_map;
+struct zio_vsd_ops;
 #if !defined(_KERNEL)
 struct kernel_param {};
 #endif
@@ -45,6 +47,11 @@ struct raidz_map *vdev_raidz_map_alloc(struct zio *, uint64_t, uint64_t,
 void vdev_raidz_map_free(struct raidz_map *);
 void vdev_raidz_generate_parity(struct raidz_map *);
 int vdev_raidz_reconstruct(struct raidz_map *, const int *, int);
+void vdev_raidz_io_start_map(struct zio *, struct raidz_map *);
+void vdev_raidz_io_done(struct zio *);
+void vdev_raidz_state_change(struct vdev *, int, int);
+
+extern const struct zio_vsd_ops vdev_raidz_vsd_ops;
 
 /*
  * vdev_raidz_math interface
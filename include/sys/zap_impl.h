@@ -158,6 +158,12 @@ typedef struct zap {
 			 * zap_num_entries
 			 */
 			kmutex_t zap_num_entries_mtx;
+			/*
+			 * zap_split_mtx protects zap_freeblk, zap_num_leafs
+			 * and the pointer table entries while a leaf splits
+			 * with zap_rwlock only held as reader
+			 */
+			kmutex_t zap_split_mtx;
 			int zap_block_shift;
 		} zap_fat;
 		struct {
@@ -45,6 +45,16 @@ typedef void zio_checksum_t(struct abd *abd, uint64_t size,
 typedef void *zio_checksum_tmpl_init_t(const zio_cksum_salt_t *salt);
 typedef void zio_checksum_tmpl_free_t(void *ctx_template);
 
+/*
+ * Signature for functions checksumming n buffers of the same size at once,
+ * storing the checksum of abds[i] in zcps[i].  n is at most
+ * ZIO_CHECKSUM_MANY_MAX.
+ */
+typedef void zio_checksum_many_t(struct abd **abds, uint64_t size,
+    const void *ctx_template, zio_cksum_t *zcps, uint_t n);
+
+#define	ZIO_CHECKSUM_MANY_MAX	8
+
 typedef enum zio_checksum_flags {
 	/* Strong enough for metadata? */
 	ZCHECKSUM_FLAG_METADATA = (1 << 1),
@@ -90,6 +100,8 @@ typedef const struct zio_checksum_info {
 	zio_checksum_tmpl_free_t	*ci_tmpl_free;
 	zio_checksum_flags_t		ci_flags;
 	char				*ci_name;	/* descriptive name */
+	/* optional multi-buffer checksum function for each byteorder */
+	zio_checksum_many_t		*ci_func_many[2];
 } zio_checksum_info_t;
 
 typedef struct zio_bad_cksum {
@@ -109,6 +121,9 @@ extern zio_checksum_info_t zio_checksum_table[ZIO_CHECKSUM_FUNCTIONS];
 extern zio_checksum_t abd_checksum_SHA256;
 extern zio_checksum_t abd_checksum_SHA512_native;
 extern zio_checksum_t abd_checksum_SHA512_byteswap;
+extern zio_checksum_many_t abd_checksum_SHA256_many;
+extern zio_checksum_many_t abd_checksum_SHA512_native_many;
+extern zio_checksum_many_t abd_checksum_SHA512_byteswap_many;
 
 /* Skein */
 extern zio_checksum_t abd_checksum_skein_native;
@@ -122,6 +137,12 @@ extern zio_checksum_t abd_checksum_edonr_byteswap;
 extern zio_checksum_tmpl_init_t abd_checksum_edonr_tmpl_init;
 extern zio_checksum_tmpl_free_t abd_checksum_edonr_tmpl_free;
 
+/* BLAKE3 */
+extern zio_checksum_t abd_checksum_blake3_native;
+extern zio_checksum_t abd_checksum_blake3_byteswap;
+extern zio_checksum_tmpl_init_t abd_checksum_blake3_tmpl_init;
+extern zio_checksum_tmpl_free_t abd_checksum_blake3_tmpl_free;
+
 extern zio_abd_checksum_func_t fletcher_4_abd_ops;
 extern zio_checksum_t abd_fletcher_4_native;
 extern zio_checksum_t abd_fletcher_4_byteswap;
@@ -130,6 +151,8 @@ extern int zio_checksum_equal(spa_t *, blkptr_t *, enum zio_checksum,
     void *, uint64_t, uint64_t, zio_bad_cksum_t *);
 extern void zio_checksum_compute(zio_t *, enum zio_checksum,
     struct abd *, uint64_t);
+extern boolean_t zio_checksum_batchable(zio_t *, enum zio_checksum);
+extern void zio_checksum_compute_many(zio_t **, uint_t);
 extern int zio_checksum_error_impl(spa_t *, const blkptr_t *, enum zio_checksum,
     struct abd *, uint64_t, uint64_t, zio_bad_cksum_t *);
 extern int zio_checksum_error(zio_t *zio, zio_bad_cksum_t *out);
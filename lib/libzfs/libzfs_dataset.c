@@ -384,16 +384,14 @@ get_recvd_props_ioctl(zfs_handle_t *zhp)
 	return (0);
 }
 
+/*
+ * Store the given properties in the handle, which takes ownership of
+ * allprops even on failure.
+ */
 static int
-put_stats_zhdl(zfs_handle_t *zhp, zfs_cmd_t *zc)
+put_props_zhdl(zfs_handle_t *zhp, nvlist_t *allprops)
 {
-	nvlist_t *allprops, *userprops;
-
-	zhp->zfs_dmustats = zc->zc_objset_stats; /* structure assignment */
-
-	if (zcmd_read_dst_nvlist(zhp->zfs_hdl, zc, &allprops) != 0) {
-		return (-1);
-	}
+	nvlist_t *userprops;
 
 	/*
 	 * XXX Why do we store the user props separately, in addition to
@@ -413,6 +411,20 @@ put_stats_zhdl(zfs_handle_t *zhp, zfs_cmd_t *zc)
 	return (0);
 }
 
+static int
+put_stats_zhdl(zfs_handle_t *zhp, zfs_cmd_t *zc)
+{
+	nvlist_t *allprops;
+
+	zhp->zfs_dmustats = zc->zc_objset_stats; /* structure assignment */
+
+	if (zcmd_read_dst_nvlist(zhp->zfs_hdl, zc, &allprops) != 0) {
+		return (-1);
+	}
+
+	return (put_props_zhdl(zhp, allprops));
+}
+
 static int
 get_stats(zfs_handle_t *zhp)
 {
@@ -443,11 +455,8 @@ zfs_refresh_properties(zfs_handle_t *zhp)
  * zfs_iter_* to create child handles on the fly.
  */
 static int
-make_dataset_handle_common(zfs_handle_t *zhp, zfs_cmd_t *zc)
+make_dataset_handle_type(zfs_handle_t *zhp)
 {
-	if (put_stats_zhdl(zhp, zc) != 0)
-		return (-1);
-
 	/*
 	 * We've managed to open the dataset and gather statistics.  Determine
 	 * the high-level type.
@@ -476,6 +485,15 @@ make_dataset_handle_common(zfs_handle_t *zhp, zfs_cmd_t *zc)
 	return (0);
 }
 
+static int
+make_dataset_handle_common(zfs_handle_t *zhp, zfs_cmd_t *zc)
+{
+	if (put_stats_zhdl(zhp, zc) != 0)
+		return (-1);
+
+	return (make_dataset_handle_type(zhp));
+}
+
 zfs_handle_t *
 make_dataset_handle(libzfs_handle_t *hdl, const char *path)
 {
@@ -522,8 +540,51 @@ make_dataset_handle_zc(libzfs_handle_t *hdl, zfs_cmd_t *zc)
 	return (zhp);
 }
 
+/*
+ * Makes a handle from an entry returned by ZFS_IOC_LIST_BATCH, which holds
+ * the dataset's objset stats and the properties which were asked for.
+ */
+zfs_handle_t *
+make_dataset_handle_nvl(libzfs_handle_t *hdl, const char *name,
+    nvlist_t *entry)
+{
+	nvlist_t *props, *allprops;
+	zfs_handle_t *zhp;
+	uint8_t *stats;
+	uint_t len;
+
+	if (nvlist_lookup_uint8_array(entry, ZFS_LIST_STATS, &stats,
+	    &len) != 0 || len != sizeof (dmu_objset_stats_t) ||
+	    nvlist_lookup_nvlist(entry, ZFS_LIST_PROPS, &props) != 0)
+		return (NULL);
+
+	if ((zhp = calloc(1, sizeof (zfs_handle_t))) == NULL)
+		return (NULL);
+
+	zhp->zfs_hdl = hdl;
+	(void) strlcpy(zhp->zfs_name, name, sizeof (zhp->zfs_name));
+	(void) memcpy(&zhp->zfs_dmustats, stats, len);
+	if (nvlist_dup(props, &allprops, 0) != 0) {
+		(void) no_memory(hdl);
+		free(zhp);
+		return (NULL);
+	}
+	if (put_props_zhdl(zhp, allprops) != 0 ||
+	    make_dataset_handle_type(zhp) != 0) {
+		zfs_close(zhp);
+		return (NULL);
+	}
+	return (zhp);
+}
+
 zfs_handle_t *
 make_dataset_simple_handle_zc(zfs_handle_t *pzhp, zfs_cmd_t *zc)
+{
+	return (make_dataset_simple_handle(pzhp, zc->zc_name));
+}
+
+zfs_handle_t *
+make_dataset_simple_handle(zfs_handle_t *pzhp, const char *name)
 {
 	zfs_handle_t *zhp = calloc(1, sizeof (zfs_handle_t));
 
@@ -531,7 +592,7 @@ make_dataset_simple_handle_zc(zfs_handle_t *pzhp, zfs_cmd_t *zc)
 		return (NULL);
 
 	zhp->zfs_hdl = pzhp->zfs_hdl;
-	(void) strlcpy(zhp->zfs_name, zc->zc_name, sizeof (zhp->zfs_name));
+	(void) strlcpy(zhp->zfs_name, name, sizeof (zhp->zfs_name));
 	zhp->zfs_head_type = pzhp->zfs_type;
 	zhp->zfs_type = ZFS_TYPE_SNAPSHOT;
 	zhp->zpool_hdl = zpool_handle(zhp);
@@ -2881,14 +2942,15 @@ zfs_prop_get(zfs_handle_t *zhp, zfs_prop_t prop, char *propbuf, size_t proplen,
 	case ZFS_PROP_REFQUOTA:
 	case ZFS_PROP_RESERVATION:
 	case ZFS_PROP_REFRESERVATION:
+	case ZFS_PROP_WRITE_LIMIT:
 
 		if (get_numeric_property(zhp, prop, src, &source, &val) != 0)
 			return (-1);
 		/*
-		 * If quota or reservation is 0, we translate this into 'none'
-		 * (unless literal is set), and indicate that it's the default
-		 * value.  Otherwise, we print the number nicely and indicate
-		 * that its set locally.
+		 * If quota, reservation or write limit is 0, we translate this
+		 * into 'none' (unless literal is set), and indicate that it's
+		 * the default value.  Otherwise, we print the number nicely
+		 * and indicate that its set locally.
 		 */
 		if (val == 0) {
 			if (literal)
@@ -2931,6 +2993,22 @@ zfs_prop_get(zfs_handle_t *zhp, zfs_prop_t prop, char *propbuf, size_t proplen,
 		zcp_check(zhp, prop, val, NULL);
 		break;
 
+	case ZFS_PROP_WRITE_OPS_LIMIT:
+		if (get_numeric_property(zhp, prop, src, &source, &val) != 0)
+			return (-1);
+
+		if (literal) {
+			(void) snprintf(propbuf, proplen, "%llu",
+			    (u_longlong_t)val);
+		} else if (val == 0) {
+			(void) strlcpy(propbuf, "none", proplen);
+		} else {
+			zfs_nicenum(val, propbuf, proplen);
+		}
+
+		zcp_check(zhp, prop, val, NULL);
+		break;
+
 	case ZFS_PROP_REFRATIO:
 	case ZFS_PROP_COMPRESSRATIO:
 		if (get_numeric_property(zhp, prop, src, &source, &val) != 0)
@@ -33,6 +33,7 @@
 #include <stddef.h>
 #include <libintl.h>
 #include <libzfs.h>
+#include <libzfs_core.h>
 #include <libzutil.h>
 #include <sys/mntent.h>
 
@@ -100,19 +101,107 @@ top:
 	return (rc);
 }
 
+/*
+ * Iterate over the datasets listed by ZFS_IOC_LIST_BATCH for args, one batch
+ * at a time.  If the kernel module does not support the ioctl, *unavailp is
+ * set before func is ever called, and the caller should fall back to the
+ * ioctls which list one dataset at a time.
+ */
+static int
+zfs_iter_batch(zfs_handle_t *zhp, nvlist_t *args, boolean_t simple,
+    zfs_iter_f func, void *data, boolean_t *unavailp)
+{
+	nvlist_t *result, *datasets;
+	zfs_handle_t *nzhp;
+	nvpair_t *pair;
+	uint64_t cursor = 0;
+	boolean_t done = B_FALSE;
+	int ret;
+
+	*unavailp = B_FALSE;
+	while (!done) {
+		fnvlist_add_uint64(args, ZFS_LIST_CURSOR, cursor);
+		ret = lzc_list_batch(zhp->zfs_name, args, &result);
+		switch (ret) {
+		case 0:
+			break;
+		case ZFS_ERR_IOC_CMD_UNAVAIL:
+			*unavailp = B_TRUE;
+			return (0);
+		/*
+		 * If ENOENT is returned, then the underlying dataset
+		 * has been removed since we obtained the handle.
+		 */
+		case ENOENT:
+			return (0);
+		default:
+			return (zfs_standard_error(zhp->zfs_hdl, ret,
+			    dgettext(TEXT_DOMAIN,
+			    "cannot iterate filesystems")));
+		}
+
+		cursor = fnvlist_lookup_uint64(result, ZFS_LIST_CURSOR);
+		done = nvlist_exists(result, ZFS_LIST_DONE);
+		datasets = fnvlist_lookup_nvlist(result, ZFS_LIST_DATASETS);
+
+		for (pair = nvlist_next_nvpair(datasets, NULL); pair != NULL;
+		    pair = nvlist_next_nvpair(datasets, pair)) {
+			if (simple) {
+				nzhp = make_dataset_simple_handle(zhp,
+				    nvpair_name(pair));
+			} else {
+				nzhp = make_dataset_handle_nvl(zhp->zfs_hdl,
+				    nvpair_name(pair),
+				    fnvpair_value_nvlist(pair));
+			}
+			if (nzhp == NULL)
+				continue;
+
+			if ((ret = func(nzhp, data)) != 0) {
+				fnvlist_free(result);
+				return (ret);
+			}
+		}
+		fnvlist_free(result);
+	}
+	return (0);
+}
+
 /*
  * Iterate over all child filesystems
  */
 int
 zfs_iter_filesystems(zfs_handle_t *zhp, zfs_iter_f func, void *data)
+{
+	return (zfs_iter_filesystems_props(zhp, NULL, func, data));
+}
+
+/*
+ * Iterate over all child filesystems.  If props is not NULL, the handles
+ * passed to func have only the properties named in it, which saves the
+ * kernel from looking up the others.
+ */
+int
+zfs_iter_filesystems_props(zfs_handle_t *zhp, nvlist_t *props,
+    zfs_iter_f func, void *data)
 {
 	zfs_cmd_t zc = {"\0"};
 	zfs_handle_t *nzhp;
+	nvlist_t *args;
+	boolean_t unavail;
 	int ret;
 
 	if (zhp->zfs_type != ZFS_TYPE_FILESYSTEM)
 		return (0);
 
+	args = fnvlist_alloc();
+	if (props != NULL)
+		fnvlist_add_nvlist(args, ZFS_LIST_PROPS, props);
+	ret = zfs_iter_batch(zhp, args, B_FALSE, func, data, &unavail);
+	fnvlist_free(args);
+	if (!unavail)
+		return (ret);
+
 	if (zcmd_alloc_dst_nvlist(zhp->zfs_hdl, &zc, 0) != 0)
 		return (-1);
 
@@ -142,16 +231,44 @@ zfs_iter_filesystems(zfs_handle_t *zhp, zfs_iter_f func, void *data)
 int
 zfs_iter_snapshots(zfs_handle_t *zhp, boolean_t simple, zfs_iter_f func,
     void *data, uint64_t min_txg, uint64_t max_txg)
+{
+	return (zfs_iter_snapshots_props(zhp, simple, NULL, func, data,
+	    min_txg, max_txg));
+}
+
+/*
+ * Iterate over all snapshots.  If props is not NULL, the handles passed to
+ * func have only the properties named in it.
+ */
+int
+zfs_iter_snapshots_props(zfs_handle_t *zhp, boolean_t simple, nvlist_t *props,
+    zfs_iter_f func, void *data, uint64_t min_txg, uint64_t max_txg)
 {
 	zfs_cmd_t zc = {"\0"};
 	zfs_handle_t *nzhp;
 	int ret;
-	nvlist_t *range_nvl = NULL;
+	nvlist_t *args, *range_nvl = NULL;
+	boolean_t unavail;
 
 	if (zhp->zfs_type == ZFS_TYPE_SNAPSHOT ||
 	    zhp->zfs_type == ZFS_TYPE_BOOKMARK)
 		return (0);
 
+	args = fnvlist_alloc();
+	fnvlist_add_boolean(args, ZFS_LIST_SNAPSHOTS);
+	if (simple)
+		fnvlist_add_boolean(args, ZFS_LIST_SIMPLE);
+	if (props != NULL)
+		fnvlist_add_nvlist(args, ZFS_LIST_PROPS, props);
+	if (min_txg != 0)
+		fnvlist_add_uint64(args, SNAP_ITER_MIN_TXG, min_txg);
+	if (max_txg != 0)
+		fnvlist_add_uint64(args, SNAP_ITER_MAX_TXG, max_txg);
+	ret = zfs_iter_batch(zhp, args, simple, func, data, &unavail);
+	fnvlist_free(args);
+	if (!unavail)
+		return (ret);
+
 	zc.zc_simple = simple;
 
 	if (zcmd_alloc_dst_nvlist(zhp->zfs_hdl, &zc, 0) != 0)
@@ -344,6 +344,8 @@ zpool_get_prop(zpool_handle_t *zhp, zpool_prop_t prop, char *buf,
 		case ZPOOL_PROP_FREEING:
 		case ZPOOL_PROP_LEAKED:
 		case ZPOOL_PROP_ASHIFT:
+		case ZPOOL_PROP_BCLONEUSED:
+		case ZPOOL_PROP_BCLONESAVED:
 			if (literal)
 				(void) snprintf(buf, len, "%llu",
 				    (u_longlong_t)intval);
@@ -386,6 +388,7 @@ zpool_get_prop(zpool_handle_t *zhp, zpool_prop_t prop, char *buf,
 			break;
 
 		case ZPOOL_PROP_DEDUPRATIO:
+		case ZPOOL_PROP_BCLONERATIO:
 			if (literal)
 				(void) snprintf(buf, len, "%llu.%02llu",
 				    (u_longlong_t)(intval / 100),
@@ -2589,12 +2592,36 @@ zpool_find_vdev_by_physpath(zpool_handle_t *zhp, const char *ppath,
 	return (ret);
 }
 
+/*
+ * Determine if the name is a dRAID distributed spare, these are named
+ * dcraid<parity>-<top-level vdev id>-<spare id>.
+ */
+boolean_t
+zpool_is_draid_spare(const char *name)
+{
+	u_longlong_t parity, vdev_id, spare_id;
+	char buf[64];
+
+	if (sscanf(name, VDEV_TYPE_DRAID "%llu-%llu-%llu",
+	    &parity, &vdev_id, &spare_id) != 3)
+		return (B_FALSE);
+
+	(void) snprintf(buf, sizeof (buf), "%s%llu-%llu-%llu",
+	    VDEV_TYPE_DRAID, parity, vdev_id, spare_id);
+
+	return (strcmp(buf, name) == 0);
+}
+
 /*
  * Determine if we have an "interior" top-level vdev (i.e mirror/raidz).
  */
 static boolean_t
 zpool_vdev_is_interior(const char *name)
 {
+	if (strncmp(name, VDEV_TYPE_DRAID, strlen(VDEV_TYPE_DRAID)) == 0 &&
+	    !zpool_is_draid_spare(name))
+		return (B_TRUE);
+
 	if (strncmp(name, VDEV_TYPE_RAIDZ, strlen(VDEV_TYPE_RAIDZ)) == 0 ||
 	    strncmp(name, VDEV_TYPE_SPARE, strlen(VDEV_TYPE_SPARE)) == 0 ||
 	    strncmp(name,
@@ -3102,10 +3129,11 @@ is_replacing_spare(nvlist_t *search, nvlist_t *tgt, int which)
 /*
  * Attach new_disk (fully described by nvroot) to old_disk.
  * If 'replacing' is specified, the new disk will replace the old one.
+ * If 'rebuild' is specified, the new disk is sequentially resilvered.
  */
 int
-zpool_vdev_attach(zpool_handle_t *zhp,
-    const char *old_disk, const char *new_disk, nvlist_t *nvroot, int replacing)
+zpool_vdev_attach(zpool_handle_t *zhp, const char *old_disk,
+    const char *new_disk, nvlist_t *nvroot, int replacing, boolean_t rebuild)
 {
 	zfs_cmd_t zc = {"\0"};
 	char msg[1024];
@@ -3140,6 +3168,7 @@ zpool_vdev_attach(zpool_handle_t *zhp,
 
 	verify(nvlist_lookup_uint64(tgt, ZPOOL_CONFIG_GUID, &zc.zc_guid) == 0);
 	zc.zc_cookie = replacing;
+	zc.zc_simple = rebuild;
 
 	if (nvlist_lookup_nvlist_array(nvroot, ZPOOL_CONFIG_CHILDREN,
 	    &child, &children) != 0 || children != 1) {
@@ -3196,7 +3225,11 @@ zpool_vdev_attach(zpool_handle_t *zhp,
 		/*
 		 * Can't attach to or replace this type of vdev.
 		 */
-		if (replacing) {
+		if (rebuild) {
+			zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+			    "sequential resilver can only be used on "
+			    "mirrors, dRAID, and top-level disks"));
+		} else if (replacing) {
 			uint64_t version = zpool_get_prop_int(zhp,
 			    ZPOOL_PROP_VERSION, NULL);
 
@@ -4091,6 +4124,30 @@ zpool_vdev_name(libzfs_handle_t *hdl, zpool_handle_t *zhp, nvlist_t *nv,
 			path = buf;
 		}
 
+		/*
+		 * If it's a dRAID device, we add the parity, data, children,
+		 * and spares to describe its layout.
+		 */
+		if (strcmp(path, VDEV_TYPE_DRAID) == 0) {
+			nvlist_t **child;
+			uint_t children;
+			uint64_t ndata, nspares;
+
+			verify(nvlist_lookup_uint64(nv, ZPOOL_CONFIG_NPARITY,
+			    &value) == 0);
+			verify(nvlist_lookup_uint64(nv,
+			    ZPOOL_CONFIG_DRAID_NDATA, &ndata) == 0);
+			verify(nvlist_lookup_uint64(nv,
+			    ZPOOL_CONFIG_DRAID_NSPARES, &nspares) == 0);
+			verify(nvlist_lookup_nvlist_array(nv,
+			    ZPOOL_CONFIG_CHILDREN, &child, &children) == 0);
+			(void) snprintf(buf, sizeof (buf),
+			    "%s%llu:%llud:%uc:%llus", path,
+			    (u_longlong_t)value, (u_longlong_t)ndata, children,
+			    (u_longlong_t)nspares);
+			path = buf;
+		}
+
 		/*
 		 * We identify each top-level vdev by using a <type-id>
 		 * naming convention.
@@ -1582,3 +1582,46 @@ lzc_redact(const char *snapshot, const char *bookname, nvlist_t *snapnv)
 	fnvlist_free(args);
 	return (error);
 }
+
+/*
+ * List the child datasets, or the snapshots, of a dataset in batches.
+ *
+ * The args nvlist may contain the following, all of which are optional:
+ *
+ * ZFS_LIST_SNAPSHOTS (boolean) - list snapshots rather than children
+ * ZFS_LIST_CURSOR (uint64) - the cursor returned by the previous call, or 0
+ * ZFS_LIST_COUNT (uint64) - the maximum number of datasets to return
+ * ZFS_LIST_PROPS (nvlist) - the names of the properties to return, with no
+ *     values; all properties are returned if this is omitted
+ * ZFS_LIST_SIMPLE (boolean) - return only the names of the datasets
+ * SNAP_ITER_MIN_TXG, SNAP_ITER_MAX_TXG (uint64) - the range of creation
+ *     txgs of the snapshots to return
+ *
+ * The format of the returned nvlist is as follows:
+ * {
+ *     ZFS_LIST_CURSOR -> uint64 cursor to pass to the next call
+ *     ZFS_LIST_DONE -> present if there are no more datasets
+ *     ZFS_LIST_DATASETS -> {
+ *         <full name of dataset> -> {
+ *             ZFS_LIST_STATS -> dmu_objset_stats_t as a uint8 array
+ *             ZFS_LIST_PROPS -> {
+ *                 <name of property> -> {
+ *                     "value" -> value of property
+ *                     "source" -> where the property was set
+ *                 }
+ *                 ...
+ *             }
+ *         }
+ *         ...
+ *     }
+ * }
+ *
+ * The nvlists of the datasets are empty if ZFS_LIST_SIMPLE was given.  A
+ * call may return fewer datasets than requested, or none if all snapshots
+ * seen were outside the txg range, before the listing is done.
+ */
+int
+lzc_list_batch(const char *fsname, nvlist_t *args, nvlist_t **result)
+{
+	return (lzc_ioctl(ZFS_IOC_LIST_BATCH, fsname, args, result));
+}
@@ -79,6 +79,7 @@
 #define	IMPORT_ORDER_SCAN_OFFSET	10
 #define	IMPORT_ORDER_DEFAULT		100
 #define	DEFAULT_IMPORT_PATH_SIZE	9
+#define	IMPORT_MAX_THREADS		256
 
 #define	EZFS_BADCACHE	"invalid or missing cache file"
 #define	EZFS_BADPATH	"must be an absolute path"
@@ -1384,7 +1385,7 @@ zpool_read_label(int fd, nvlist_t **config, int *num_labels)
 {
 	struct stat64 statbuf;
 	int l, count = 0;
-	vdev_label_t *label;
+	vdev_phys_t *label;
 	nvlist_t *expected_config = NULL;
 	uint64_t expected_guid = 0, size;
 	int error;
@@ -1402,12 +1403,14 @@ zpool_read_label(int fd, nvlist_t **config, int *num_labels)
 	for (l = 0; l < VDEV_LABELS; l++) {
 		uint64_t state, guid, txg;
 
-		if (pread64(fd, label, sizeof (vdev_label_t),
-		    label_offset(size, l)) != sizeof (vdev_label_t))
+		/* Only the vdev_phys_t of each label is needed. */
+		if (pread64(fd, label, sizeof (vdev_phys_t),
+		    label_offset(size, l) + VDEV_SKIP_SIZE) !=
+		    sizeof (vdev_phys_t))
 			continue;
 
-		if (nvlist_unpack(label->vl_vdev_phys.vp_nvlist,
-		    sizeof (label->vl_vdev_phys.vp_nvlist), config, 0) != 0)
+		if (nvlist_unpack(label->vp_nvlist,
+		    sizeof (label->vp_nvlist), config, 0) != 0)
 			continue;
 
 		if (nvlist_lookup_uint64(*config, ZPOOL_CONFIG_GUID,
@@ -1461,6 +1464,9 @@ typedef struct rdsk_node {
 	avl_node_t rn_node;
 	pthread_mutex_t *rn_lock;
 	boolean_t rn_labelpaths;
+	struct stat64 rn_stat;		/* Device stat when label was read */
+	boolean_t rn_scanned;		/* Label read, rn_stat is valid */
+	nvlist_t *rn_cached;		/* Unchanged scan cache entry */
 } rdsk_node_t;
 
 #ifdef __linux__
@@ -1629,6 +1635,9 @@ zpool_open_func(void *arg)
 		return;
 	}
 
+	rn->rn_stat = statbuf;
+	rn->rn_scanned = B_TRUE;
+
 	if (num_labels == 0) {
 		(void) close(fd);
 		nvlist_free(config);
@@ -2026,6 +2035,205 @@ zpool_find_import_blkid(libpc_handle_t *hdl, pthread_mutex_t *lock,
 	return (0);
 }
 
+/*
+ * The optional persistent scan cache, enabled by setting the
+ * ZPOOL_IMPORT_SCAN_CACHE environment variable to a file name, records
+ * the identity of each device examined by a previous search along with
+ * the pool, if any, its label belonged to.  When importing a specific
+ * pool, devices which are unchanged since they were last examined and
+ * which are known not to belong to that pool are skipped rather than
+ * opened and read.  The cache is an nvlist keyed by device path.
+ */
+#define	SCAN_CACHE_RDEV		"rdev"
+#define	SCAN_CACHE_INO		"ino"
+#define	SCAN_CACHE_SIZE		"size"
+#define	SCAN_CACHE_MTIME	"mtime"
+#define	SCAN_CACHE_CTIME	"ctime"
+#define	SCAN_CACHE_POOL_GUID	"pool_guid"
+#define	SCAN_CACHE_POOL_NAME	"pool_name"
+#define	SCAN_CACHE_AUX		"aux"
+
+static nvlist_t *
+zpool_scan_cache_read(const char *file)
+{
+	struct stat64 statbuf;
+	nvlist_t *scache = NULL;
+	char *buf;
+	int fd;
+
+	if ((fd = open(file, O_RDONLY | O_CLOEXEC)) < 0)
+		return (NULL);
+
+	if (fstat64(fd, &statbuf) != 0 || statbuf.st_size == 0 ||
+	    (buf = malloc(statbuf.st_size)) == NULL) {
+		(void) close(fd);
+		return (NULL);
+	}
+
+	if (read(fd, buf, statbuf.st_size) == statbuf.st_size)
+		(void) nvlist_unpack(buf, statbuf.st_size, &scache, 0);
+
+	(void) close(fd);
+	free(buf);
+
+	return (scache);
+}
+
+static void
+zpool_scan_cache_write(const char *file, nvlist_t *scache)
+{
+	char *buf = NULL, *tmpfile;
+	size_t buflen;
+	int fd;
+
+	if (asprintf(&tmpfile, "%s.tmp", file) == -1)
+		return;
+
+	if (nvlist_pack(scache, &buf, &buflen, NV_ENCODE_XDR, 0) != 0) {
+		free(tmpfile);
+		return;
+	}
+
+	/*
+	 * Write a new file and rename it over the old one so a concurrent
+	 * or interrupted import never sees a partially written cache.
+	 */
+	fd = open(tmpfile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd >= 0) {
+		if (write(fd, buf, buflen) == (ssize_t)buflen &&
+		    fsync(fd) == 0) {
+			(void) close(fd);
+			if (rename(tmpfile, file) != 0)
+				(void) unlink(tmpfile);
+		} else {
+			(void) close(fd);
+			(void) unlink(tmpfile);
+		}
+	}
+
+	free(buf);
+	free(tmpfile);
+}
+
+/*
+ * Return the scan cache entry for a device when the device has not
+ * changed since it was recorded.  Block devices are matched on their
+ * device number, files on their inode, and both on size, mtime and ctime.
+ */
+static nvlist_t *
+zpool_scan_cache_lookup(nvlist_t *scache, const char *path)
+{
+	struct stat64 statbuf;
+	nvlist_t *entry;
+	uint64_t *mtime, *ctime;
+	uint64_t rdev, ino, size;
+	uint_t n;
+
+	if (nvlist_lookup_nvlist(scache, path, &entry) != 0 ||
+	    stat64(path, &statbuf) != 0 ||
+	    nvlist_lookup_uint64(entry, SCAN_CACHE_RDEV, &rdev) != 0 ||
+	    nvlist_lookup_uint64(entry, SCAN_CACHE_INO, &ino) != 0 ||
+	    nvlist_lookup_uint64(entry, SCAN_CACHE_SIZE, &size) != 0 ||
+	    nvlist_lookup_uint64_array(entry, SCAN_CACHE_MTIME,
+	    &mtime, &n) != 0 || n != 2 ||
+	    nvlist_lookup_uint64_array(entry, SCAN_CACHE_CTIME,
+	    &ctime, &n) != 0 || n != 2)
+		return (NULL);
+
+	if (rdev != statbuf.st_rdev || ino != statbuf.st_ino ||
+	    size != statbuf.st_size ||
+	    mtime[0] != statbuf.st_mtim.tv_sec ||
+	    mtime[1] != statbuf.st_mtim.tv_nsec ||
+	    ctime[0] != statbuf.st_ctim.tv_sec ||
+	    ctime[1] != statbuf.st_ctim.tv_nsec)
+		return (NULL);
+
+	return (entry);
+}
+
+/*
+ * A device can only be skipped when its cached label belongs to a pool
+ * other than the one being imported.  Spares and cache devices carry no
+ * pool name in their label so they are always examined.
+ */
+static boolean_t
+zpool_scan_cache_skip(nvlist_t *entry, importargs_t *iarg)
+{
+	uint64_t pool_guid;
+	char *pool_name;
+
+	if (iarg->poolname == NULL && iarg->guid == 0)
+		return (B_FALSE);
+
+	if (nvlist_exists(entry, SCAN_CACHE_AUX) ||
+	    nvlist_lookup_uint64(entry, SCAN_CACHE_POOL_GUID, &pool_guid) != 0)
+		return (B_FALSE);
+
+	if (pool_guid == 0)
+		return (B_TRUE);
+
+	if (iarg->poolname != NULL)
+		return (nvlist_lookup_string(entry, SCAN_CACHE_POOL_NAME,
+		    &pool_name) == 0 && strcmp(iarg->poolname, pool_name) != 0);
+
+	return (iarg->guid != pool_guid);
+}
+
+static void
+zpool_scan_cache_add(nvlist_t *scache, rdsk_node_t *slice)
+{
+	struct stat64 *sb = &slice->rn_stat;
+	nvlist_t *config = slice->rn_config;
+	uint64_t mtime[2], ctime[2];
+	uint64_t pool_guid = 0, state;
+	char *pool_name;
+	nvlist_t *entry;
+
+	if (slice->rn_cached != NULL) {
+		(void) nvlist_add_nvlist(scache, slice->rn_name,
+		    slice->rn_cached);
+		return;
+	}
+
+	/*
+	 * Only devices found directly by the search are recorded, entries
+	 * added for the paths stored in a label are expected to be present.
+	 */
+	if (!slice->rn_scanned || slice->rn_vdev_guid != 0)
+		return;
+
+	if (nvlist_alloc(&entry, NV_UNIQUE_NAME, 0) != 0)
+		return;
+
+	mtime[0] = sb->st_mtim.tv_sec;
+	mtime[1] = sb->st_mtim.tv_nsec;
+	ctime[0] = sb->st_ctim.tv_sec;
+	ctime[1] = sb->st_ctim.tv_nsec;
+
+	fnvlist_add_uint64(entry, SCAN_CACHE_RDEV, sb->st_rdev);
+	fnvlist_add_uint64(entry, SCAN_CACHE_INO, sb->st_ino);
+	fnvlist_add_uint64(entry, SCAN_CACHE_SIZE, sb->st_size);
+	fnvlist_add_uint64_array(entry, SCAN_CACHE_MTIME, mtime, 2);
+	fnvlist_add_uint64_array(entry, SCAN_CACHE_CTIME, ctime, 2);
+
+	if (config != NULL) {
+		if (nvlist_lookup_uint64(config, ZPOOL_CONFIG_POOL_STATE,
+		    &state) == 0 && (state == POOL_STATE_SPARE ||
+		    state == POOL_STATE_L2CACHE))
+			fnvlist_add_boolean(entry, SCAN_CACHE_AUX);
+		(void) nvlist_lookup_uint64(config, ZPOOL_CONFIG_POOL_GUID,
+		    &pool_guid);
+		if (nvlist_lookup_string(config, ZPOOL_CONFIG_POOL_NAME,
+		    &pool_name) == 0)
+			fnvlist_add_string(entry, SCAN_CACHE_POOL_NAME,
+			    pool_name);
+	}
+	fnvlist_add_uint64(entry, SCAN_CACHE_POOL_GUID, pool_guid);
+
+	(void) nvlist_add_nvlist(scache, slice->rn_name, entry);
+	nvlist_free(entry);
+}
+
 /*
  * Given a list of directories to search, find all pools stored on disk.  This
  * includes partial pools which are not available to import.  If no args are
@@ -2045,8 +2253,11 @@ zpool_find_import_impl(libpc_handle_t *hdl, importargs_t *iarg)
 	pthread_mutex_t lock;
 	avl_tree_t *cache;
 	rdsk_node_t *slice;
+	nvlist_t *scache = NULL, *new_scache = NULL;
+	const char *scache_file;
 	void *cookie;
 	tpool_t *t;
+	long threads;
 
 	verify(iarg->poolname == NULL || iarg->guid == 0);
 	pthread_mutex_init(&lock, NULL);
@@ -2073,15 +2284,37 @@ zpool_find_import_impl(libpc_handle_t *hdl, importargs_t *iarg)
 			return (NULL);
 	}
 
+	scache_file = getenv("ZPOOL_IMPORT_SCAN_CACHE");
+	if (scache_file != NULL && scache_file[0] != '\0') {
+		scache = zpool_scan_cache_read(scache_file);
+		if (nvlist_alloc(&new_scache, NV_UNIQUE_NAME, 0) != 0)
+			new_scache = NULL;
+	}
+
 	/*
 	 * Create a thread pool to parallelize the process of reading and
 	 * validating labels, a large number of threads can be used due to
-	 * minimal contention.
+	 * minimal contention.  Reading a label is dominated by device
+	 * latency rather than CPU, so size the pool to the number of
+	 * devices so one slow device doesn't hold up the others.
 	 */
-	t = tpool_create(1, 2 * sysconf(_SC_NPROCESSORS_ONLN), 0, NULL);
+	threads = MIN(avl_numnodes(cache), IMPORT_MAX_THREADS);
+	threads = MAX(threads, 2 * sysconf(_SC_NPROCESSORS_ONLN));
+	t = tpool_create(1, threads, 0, NULL);
 	for (slice = avl_first(cache); slice;
-	    (slice = avl_walk(cache, slice, AVL_AFTER)))
+	    (slice = avl_walk(cache, slice, AVL_AFTER))) {
+		nvlist_t *entry;
+
+		if (scache != NULL &&
+		    (entry = zpool_scan_cache_lookup(scache,
+		    slice->rn_name)) != NULL &&
+		    zpool_scan_cache_skip(entry, iarg)) {
+			slice->rn_cached = entry;
+			continue;
+		}
+
 		(void) tpool_dispatch(t, zpool_open_func, slice);
+	}
 
 	tpool_wait(t);
 	tpool_destroy(t);
@@ -2092,6 +2325,9 @@ zpool_find_import_impl(libpc_handle_t *hdl, importargs_t *iarg)
 	 */
 	cookie = NULL;
 	while ((slice = avl_destroy_nodes(cache, &cookie)) != NULL) {
+		if (new_scache != NULL)
+			zpool_scan_cache_add(new_scache, slice);
+
 		if (slice->rn_config != NULL) {
 			nvlist_t *config = slice->rn_config;
 			boolean_t matched = B_TRUE;
@@ -2153,6 +2389,12 @@ zpool_find_import_impl(libpc_handle_t *hdl, importargs_t *iarg)
 	free(cache);
 	pthread_mutex_destroy(&lock);
 
+	if (new_scache != NULL) {
+		zpool_scan_cache_write(scache_file, new_scache);
+		nvlist_free(new_scache);
+	}
+	nvlist_free(scache);
+
 	ret = get_configs(hdl, &pools, iarg->can_be_active, iarg->policy);
 
 	for (pe = pools.pools; pe != NULL; pe = penext) {
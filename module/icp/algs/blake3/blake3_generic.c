@@ -0,0 +1,181 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://opensource.org/licenses/CDDL-1.0.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Based on BLAKE3 v0.3.7, https://github.com/BLAKE3-team/BLAKE3
+ * Copyright (c) 2019-2020 Samuel Neves and Jack O'Connor
+ */
+
+#include <sys/zfs_context.h>
+#include "blake3_impl.h"
+
+#define	rotr32(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+
+static inline void
+g(uint32_t *state, size_t a, size_t b, size_t c, size_t d,
+    uint32_t x, uint32_t y)
+{
+	state[a] = state[a] + state[b] + x;
+	state[d] = rotr32(state[d] ^ state[a], 16);
+	state[c] = state[c] + state[d];
+	state[b] = rotr32(state[b] ^ state[c], 12);
+	state[a] = state[a] + state[b] + y;
+	state[d] = rotr32(state[d] ^ state[a], 8);
+	state[c] = state[c] + state[d];
+	state[b] = rotr32(state[b] ^ state[c], 7);
+}
+
+static inline void
+round_fn(uint32_t state[16], const uint32_t *msg, size_t round)
+{
+	/* Select the message schedule based on the round. */
+	const uint8_t *schedule = BLAKE3_MSG_SCHEDULE[round];
+
+	/* Mix the columns. */
+	g(state, 0, 4, 8, 12, msg[schedule[0]], msg[schedule[1]]);
+	g(state, 1, 5, 9, 13, msg[schedule[2]], msg[schedule[3]]);
+	g(state, 2, 6, 10, 14, msg[schedule[4]], msg[schedule[5]]);
+	g(state, 3, 7, 11, 15, msg[schedule[6]], msg[schedule[7]]);
+
+	/* Mix the rows. */
+	g(state, 0, 5, 10, 15, msg[schedule[8]], msg[schedule[9]]);
+	g(state, 1, 6, 11, 12, msg[schedule[10]], msg[schedule[11]]);
+	g(state, 2, 7, 8, 13, msg[schedule[12]], msg[schedule[13]]);
+	g(state, 3, 4, 9, 14, msg[schedule[14]], msg[schedule[15]]);
+}
+
+static inline void
+compress_pre(uint32_t state[16], const uint32_t cv[8],
+    const uint8_t block[BLAKE3_BLOCK_LEN],
+    uint8_t block_len, uint64_t counter, uint8_t flags)
+{
+	uint32_t block_words[16];
+
+	for (int i = 0; i < 16; i++)
+		block_words[i] = load32(block + 4 * i);
+
+	state[0] = cv[0];
+	state[1] = cv[1];
+	state[2] = cv[2];
+	state[3] = cv[3];
+	state[4] = cv[4];
+	state[5] = cv[5];
+	state[6] = cv[6];
+	state[7] = cv[7];
+	state[8] = BLAKE3_IV[0];
+	state[9] = BLAKE3_IV[1];
+	state[10] = BLAKE3_IV[2];
+	state[11] = BLAKE3_IV[3];
+	state[12] = counter_low(counter);
+	state[13] = counter_high(counter);
+	state[14] = (uint32_t)block_len;
+	state[15] = (uint32_t)flags;
+
+	for (int r = 0; r < 7; r++)
+		round_fn(state, &block_words[0], r);
+}
+
+void
+blake3_compress_in_place_generic(uint32_t cv[8],
+    const uint8_t block[BLAKE3_BLOCK_LEN], uint8_t block_len,
+    uint64_t counter, uint8_t flags)
+{
+	uint32_t state[16];
+
+	compress_pre(state, cv, block, block_len, counter, flags);
+	cv[0] = state[0] ^ state[8];
+	cv[1] = state[1] ^ state[9];
+	cv[2] = state[2] ^ state[10];
+	cv[3] = state[3] ^ state[11];
+	cv[4] = state[4] ^ state[12];
+	cv[5] = state[5] ^ state[13];
+	cv[6] = state[6] ^ state[14];
+	cv[7] = state[7] ^ state[15];
+}
+
+void
+blake3_compress_xof_generic(const uint32_t cv[8],
+    const uint8_t block[BLAKE3_BLOCK_LEN], uint8_t block_len,
+    uint64_t counter, uint8_t flags, uint8_t out[64])
+{
+	uint32_t state[16];
+
+	compress_pre(state, cv, block, block_len, counter, flags);
+
+	for (int i = 0; i < 8; i++) {
+		store32(&out[i * 4], state[i] ^ state[i + 8]);
+		store32(&out[(i + 8) * 4], state[i + 8] ^ cv[i]);
+	}
+}
+
+static inline void
+hash_one_generic(const uint8_t *input, size_t blocks,
+    const uint32_t key[8], uint64_t counter, uint8_t flags,
+    uint8_t flags_start, uint8_t flags_end, uint8_t out[BLAKE3_OUT_LEN])
+{
+	uint32_t cv[8];
+	uint8_t block_flags = flags | flags_start;
+
+	memcpy(cv, key, BLAKE3_KEY_LEN);
+	while (blocks > 0) {
+		if (blocks == 1)
+			block_flags |= flags_end;
+		blake3_compress_in_place_generic(cv, input, BLAKE3_BLOCK_LEN,
+		    counter, block_flags);
+		input = &input[BLAKE3_BLOCK_LEN];
+		blocks -= 1;
+		block_flags = flags;
+	}
+	store_cv_words(out, cv);
+}
+
+void
+blake3_hash_many_generic(const uint8_t * const *inputs, size_t num_inputs,
+    size_t blocks, const uint32_t key[8], uint64_t counter,
+    boolean_t increment_counter, uint8_t flags, uint8_t flags_start,
+    uint8_t flags_end, uint8_t *out)
+{
+	while (num_inputs > 0) {
+		hash_one_generic(inputs[0], blocks, key, counter, flags,
+		    flags_start, flags_end, out);
+		if (increment_counter)
+			counter += 1;
+		inputs += 1;
+		num_inputs -= 1;
+		out = &out[BLAKE3_OUT_LEN];
+	}
+}
+
+static boolean_t
+blake3_is_generic_supported(void)
+{
+	return (B_TRUE);
+}
+
+const blake3_ops_t blake3_generic_impl = {
+	.compress_in_place = blake3_compress_in_place_generic,
+	.compress_xof = blake3_compress_xof_generic,
+	.hash_many = blake3_hash_many_generic,
+	.is_supported = blake3_is_generic_supported,
+	.degree = 4,
+	.uses_fpu = B_FALSE,
+	.name = "generic"
+};
@@ -0,0 +1,434 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://opensource.org/licenses/CDDL-1.0.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/blake3.h>
+#if defined(__linux__) || !defined(_KERNEL)
+#include <linux/simd.h>
+#elif defined(__amd64__)
+#include <sys/simd_x86.h>
+#else
+#define	kfpu_allowed()	(0)
+#endif
+
+#include "blake3_impl.h"
+
+static const blake3_ops_t *const blake3_impls[] = {
+	&blake3_generic_impl,
+#if defined(__x86_64) && defined(HAVE_SSE2)
+	&blake3_sse2_impl,
+#endif
+#if defined(__x86_64) && defined(HAVE_SSE2) && defined(HAVE_SSE4_1)
+	&blake3_sse41_impl,
+#endif
+#if defined(__x86_64) && defined(HAVE_AVX2)
+	&blake3_avx2_impl,
+#endif
+#if defined(__x86_64) && defined(HAVE_AVX512F)
+	&blake3_avx512_impl,
+#endif
+};
+
+/* Hold all supported implementations */
+static uint32_t blake3_supp_impls_cnt = 0;
+static const blake3_ops_t *blake3_supp_impls[ARRAY_SIZE(blake3_impls)];
+
+static blake3_ops_t blake3_fastest_impl = {
+	.name = "fastest"
+};
+
+/* Select BLAKE3 implementation */
+#define	IMPL_FASTEST	(UINT32_MAX)
+#define	IMPL_CYCLE	(UINT32_MAX - 1)
+#define	IMPL_GENERIC	(0)
+
+static uint32_t blake3_impl_chosen = IMPL_FASTEST;
+
+#define	IMPL_READ(i)	(*(volatile uint32_t *) &(i))
+
+static struct blake3_impl_selector {
+	const char	*bis_name;
+	uint32_t	bis_sel;
+} blake3_impl_selectors[] = {
+	{ "cycle",	IMPL_CYCLE },
+	{ "fastest",	IMPL_FASTEST },
+	{ "generic",	IMPL_GENERIC }
+};
+
+#if defined(_KERNEL)
+static kstat_t *blake3_kstat;
+
+/* bandwidth of each implementation in B/s, the last entry is the fastest */
+static uint64_t blake3_stat_data[ARRAY_SIZE(blake3_impls) + 1];
+#endif
+
+/* Indicate that benchmark has been completed */
+static boolean_t blake3_initialized = B_FALSE;
+
+/*
+ * Returns the BLAKE3 operations.  When a SIMD implementation is not
+ * allowed in the current context, then fallback to the generic one.
+ */
+const blake3_ops_t *
+blake3_impl_get_ops(void)
+{
+	if (!kfpu_allowed())
+		return (&blake3_generic_impl);
+
+	const blake3_ops_t *ops = NULL;
+	uint32_t impl = IMPL_READ(blake3_impl_chosen);
+
+	switch (impl) {
+	case IMPL_FASTEST:
+		ASSERT(blake3_initialized);
+		ops = &blake3_fastest_impl;
+		break;
+	case IMPL_CYCLE:
+		/* Cycle through supported implementations */
+		ASSERT(blake3_initialized);
+		ASSERT3U(blake3_supp_impls_cnt, >, 0);
+		static uint32_t cycle_count = 0;
+		uint32_t idx = (++cycle_count) % blake3_supp_impls_cnt;
+		ops = blake3_supp_impls[idx];
+		break;
+	default:
+		ASSERT3U(blake3_supp_impls_cnt, >, 0);
+		ASSERT3U(impl, <, blake3_supp_impls_cnt);
+		ops = blake3_supp_impls[impl];
+		break;
+	}
+
+	ASSERT3P(ops, !=, NULL);
+
+	return (ops);
+}
+
+int
+blake3_impl_set(const char *val)
+{
+	int err = -EINVAL;
+	uint32_t impl = IMPL_READ(blake3_impl_chosen);
+	size_t i, val_len;
+
+	val_len = strlen(val);
+	while ((val_len > 0) && !!isspace(val[val_len-1])) /* trim '\n' */
+		val_len--;
+
+	/* check mandatory implementations */
+	for (i = 0; i < ARRAY_SIZE(blake3_impl_selectors); i++) {
+		const char *name = blake3_impl_selectors[i].bis_name;
+
+		if (val_len == strlen(name) &&
+		    strncmp(val, name, val_len) == 0) {
+			impl = blake3_impl_selectors[i].bis_sel;
+			err = 0;
+			break;
+		}
+	}
+
+	if (err != 0 && blake3_initialized) {
+		/* check all supported implementations */
+		for (i = 0; i < blake3_supp_impls_cnt; i++) {
+			const char *name = blake3_supp_impls[i]->name;
+
+			if (val_len == strlen(name) &&
+			    strncmp(val, name, val_len) == 0) {
+				impl = i;
+				err = 0;
+				break;
+			}
+		}
+	}
+
+	if (err == 0) {
+		atomic_swap_32(&blake3_impl_chosen, impl);
+		membar_producer();
+	}
+
+	return (err);
+}
+
+uint32_t
+blake3_impl_getcnt(void)
+{
+	return (blake3_supp_impls_cnt);
+}
+
+uint32_t
+blake3_impl_getid(void)
+{
+	return (IMPL_READ(blake3_impl_chosen));
+}
+
+const char *
+blake3_impl_getname(void)
+{
+	return (blake3_impl_get_ops()->name);
+}
+
+void
+blake3_impl_setid(uint32_t id)
+{
+	ASSERT(id == IMPL_FASTEST || id == IMPL_CYCLE ||
+	    id < blake3_supp_impls_cnt);
+
+	atomic_swap_32(&blake3_impl_chosen, id);
+	membar_producer();
+}
+
+#if defined(_KERNEL)
+/*
+ * BLAKE3 kstats
+ */
+static int
+blake3_kstat_headers(char *buf, size_t size)
+{
+	ssize_t off = 0;
+
+	off += snprintf(buf + off, size, "%-17s", "implementation");
+	(void) snprintf(buf + off, size - off, "%-15s\n", "speed");
+
+	return (0);
+}
+
+static int
+blake3_kstat_data(char *buf, size_t size, void *data)
+{
+	uint64_t *fastest_stat = &blake3_stat_data[blake3_supp_impls_cnt];
+	uint64_t *curr_stat = (uint64_t *)data;
+	ssize_t off = 0;
+
+	if (curr_stat == fastest_stat) {
+		off += snprintf(buf + off, size - off, "%-17s", "fastest");
+		(void) snprintf(buf + off, size - off, "%-15s\n",
+		    blake3_supp_impls[*fastest_stat]->name);
+	} else {
+		ptrdiff_t id = curr_stat - blake3_stat_data;
+
+		off += snprintf(buf + off, size - off, "%-17s",
+		    blake3_supp_impls[id]->name);
+		(void) snprintf(buf + off, size - off, "%-15llu\n",
+		    (u_longlong_t)*curr_stat);
+	}
+
+	return (0);
+}
+
+static void *
+blake3_kstat_addr(kstat_t *ksp, loff_t n)
+{
+	if (n <= blake3_supp_impls_cnt)
+		ksp->ks_private = (void *) (blake3_stat_data + n);
+	else
+		ksp->ks_private = NULL;
+
+	return (ksp->ks_private);
+}
+
+#define	BLAKE3_BENCH_NS		(MSEC2NSEC(50))		/* 50ms */
+#define	BLAKE3_BENCH_SIZE	(128 * 1024)		/* 128kiB */
+
+static void
+blake3_benchmark_impl(const uint8_t *data)
+{
+	uint64_t *fastest_stat = &blake3_stat_data[blake3_supp_impls_cnt];
+	BLAKE3_CTX *ctx = kmem_alloc(sizeof (BLAKE3_CTX), KM_SLEEP);
+	uint8_t digest[BLAKE3_OUT_LEN];
+	hrtime_t start;
+	uint64_t run_bw, run_time_ns, best_run = 0;
+	uint32_t i, l, sel_save = IMPL_READ(blake3_impl_chosen);
+
+	for (i = 0; i < blake3_supp_impls_cnt; i++) {
+		uint64_t run_count = 0;
+
+		/* temporary set an implementation */
+		blake3_impl_chosen = i;
+
+		kpreempt_disable();
+		start = gethrtime();
+		do {
+			for (l = 0; l < 32; l++, run_count++) {
+				Blake3_Init(ctx);
+				Blake3_Update(ctx, data, BLAKE3_BENCH_SIZE);
+				Blake3_Final(ctx, digest);
+			}
+
+			run_time_ns = gethrtime() - start;
+		} while (run_time_ns < BLAKE3_BENCH_NS);
+		kpreempt_enable();
+
+		run_bw = BLAKE3_BENCH_SIZE * run_count * NANOSEC;
+		run_bw /= run_time_ns;	/* B/s */
+
+		blake3_stat_data[i] = run_bw;
+
+		if (run_bw > best_run) {
+			best_run = run_bw;
+			*fastest_stat = i;
+			memcpy(&blake3_fastest_impl, blake3_supp_impls[i],
+			    sizeof (blake3_fastest_impl));
+		}
+	}
+	blake3_fastest_impl.name = "fastest";
+
+	kmem_free(ctx, sizeof (BLAKE3_CTX));
+
+	/* restore original selection */
+	atomic_swap_32(&blake3_impl_chosen, sel_save);
+}
+#endif /* _KERNEL */
+
+/*
+ * Initialize and benchmark all supported implementations.
+ */
+static void
+blake3_benchmark(void *arg)
+{
+	const blake3_ops_t *curr_impl;
+	int i, c;
+
+	/* Move supported implementations into blake3_supp_impls */
+	for (i = 0, c = 0; i < ARRAY_SIZE(blake3_impls); i++) {
+		curr_impl = blake3_impls[i];
+
+		if (curr_impl->is_supported())
+			blake3_supp_impls[c++] = curr_impl;
+	}
+	membar_producer();	/* complete blake3_supp_impls[] init */
+	blake3_supp_impls_cnt = c;	/* number of supported impl */
+
+#if defined(_KERNEL)
+	uint8_t *databuf = vmem_alloc(BLAKE3_BENCH_SIZE, KM_SLEEP);
+
+	for (i = 0; i < BLAKE3_BENCH_SIZE / sizeof (uint64_t); i++)
+		((uint64_t *)databuf)[i] = (uintptr_t)(databuf+i); /* warm-up */
+
+	blake3_benchmark_impl(databuf);
+
+	vmem_free(databuf, BLAKE3_BENCH_SIZE);
+#else
+	/*
+	 * Skip the benchmark in user space to avoid impacting libzpool
+	 * consumers (zdb, zhack, zinject, ztest).  The last implementation
+	 * is assumed to be the fastest and used by default.
+	 */
+	memcpy(&blake3_fastest_impl,
+	    blake3_supp_impls[blake3_supp_impls_cnt - 1],
+	    sizeof (blake3_fastest_impl));
+	blake3_fastest_impl.name = "fastest";
+	membar_producer();
+#endif /* _KERNEL */
+}
+
+void
+blake3_impl_init(void)
+{
+#if defined(_KERNEL)
+	/*
+	 * The benchmark is run in a kernel thread to allow Linux 5.0+
+	 * kernels to use SIMD operations, see include/linux/simd_x86.h
+	 * for details.
+	 */
+	taskqid_t id = taskq_dispatch(system_taskq, blake3_benchmark,
+	    NULL, TQ_SLEEP);
+	if (id != TASKQID_INVALID) {
+		taskq_wait_id(system_taskq, id);
+	} else {
+		blake3_benchmark(NULL);
+	}
+
+	/* Install kstats for all implementations */
+	blake3_kstat = kstat_create("icp", 0, "blake3_bench", "misc",
+	    KSTAT_TYPE_RAW, 0, KSTAT_FLAG_VIRTUAL);
+	if (blake3_kstat != NULL) {
+		blake3_kstat->ks_data = NULL;
+		blake3_kstat->ks_ndata = UINT32_MAX;
+		kstat_set_raw_ops(blake3_kstat,
+		    blake3_kstat_headers,
+		    blake3_kstat_data,
+		    blake3_kstat_addr);
+		kstat_install(blake3_kstat);
+	}
+#else
+	blake3_benchmark(NULL);
+#endif
+
+	/* Finish initialization */
+	blake3_initialized = B_TRUE;
+}
+
+void
+blake3_impl_fini(void)
+{
+#if defined(_KERNEL)
+	if (blake3_kstat != NULL) {
+		kstat_delete(blake3_kstat);
+		blake3_kstat = NULL;
+	}
+#endif
+}
+
+#if defined(_KERNEL) && defined(__linux__)
+#include <linux/mod_compat.h>
+
+static int
+icp_blake3_impl_get(char *buffer, zfs_kernel_param_t *unused)
+{
+	const uint32_t impl = IMPL_READ(blake3_impl_chosen);
+	char *fmt;
+	int i, cnt = 0;
+
+	/* list fastest */
+	fmt = (impl == IMPL_FASTEST) ? "[%s] " : "%s ";
+	cnt += sprintf(buffer + cnt, fmt, "fastest");
+
+	/* list all supported implementations */
+	for (i = 0; i < blake3_supp_impls_cnt; i++) {
+		fmt = (i == impl) ? "[%s] " : "%s ";
+		cnt += sprintf(buffer + cnt, fmt, blake3_supp_impls[i]->name);
+	}
+
+	return (cnt);
+}
+
+static int
+icp_blake3_impl_set(const char *val, zfs_kernel_param_t *unused)
+{
+	return (blake3_impl_set(val));
+}
+
+/*
+ * Choose a BLAKE3 implementation.
+ * Users can choose "cycle" to exercise all implementations, but this is
+ * for testing purpose therefore it can only be set in user space.
+ */
+module_param_call(icp_blake3_impl, icp_blake3_impl_set, icp_blake3_impl_get,
+    NULL, 0644);
+MODULE_PARM_DESC(icp_blake3_impl, "Select BLAKE3 implementation.");
+
+EXPORT_SYMBOL(blake3_impl_init);
+EXPORT_SYMBOL(blake3_impl_fini);
+EXPORT_SYMBOL(blake3_impl_set);
+EXPORT_SYMBOL(blake3_impl_getcnt);
+EXPORT_SYMBOL(blake3_impl_getid);
+EXPORT_SYMBOL(blake3_impl_getname);
+EXPORT_SYMBOL(blake3_impl_setid);
+#endif
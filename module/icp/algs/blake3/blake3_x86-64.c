@@ -0,0 +1,583 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://opensource.org/licenses/CDDL-1.0.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * SIMD implementations of the BLAKE3 hash_many() method for x86_64.
+ *
+ * Each kernel compresses one 64 byte block of N independent chains at
+ * once (N = 4 for SSE2/SSE4.1, 8 for AVX2 and 16 for AVX-512).  The state
+ * is kept "transposed": vector i holds word i of the state of every
+ * chain, so the message schedule reduces to picking which message vector
+ * is added in each G step and no shuffling is required.  The message
+ * words are transposed into that layout in C before each block.
+ *
+ * The single block compress_in_place() and compress_xof() methods are
+ * only used for partial chunks and for the few parent nodes near the
+ * root, so the portable versions are used for those.
+ */
+
+#include <sys/zfs_context.h>
+#include "blake3_impl.h"
+
+#if defined(__x86_64)
+
+#if defined(__linux__) || !defined(_KERNEL)
+#include <linux/simd_x86.h>
+#elif defined(__FreeBSD__)
+#include <os/freebsd/spl/sys/simd_x86.h>
+#endif
+
+/*
+ * The compiler is not allowed to use the vector registers in the kernel,
+ * in which case it also refuses to accept them as clobbers.
+ */
+#if defined(__SSE2__)
+#define	BLAKE3_SIMD_CLOBBERS						\
+	"xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7",	\
+	"xmm8", "xmm9", "xmm10", "xmm11", "xmm12", "xmm13", "xmm14",	\
+	"xmm15", "memory"
+#else
+#define	BLAKE3_SIMD_CLOBBERS	"memory"
+#endif
+
+/*
+ * One BLAKE3 round as four pairs of G functions, first on the columns and
+ * then on the diagonals of the state.  The arguments of G2() are the
+ * state words of both G functions followed by their message words.  The
+ * message word indices in BLAKE3_ROUNDS() must match BLAKE3_MSG_SCHEDULE.
+ */
+#define	BLAKE3_ROUND(G2, s0, s1, s2, s3, s4, s5, s6, s7,		\
+    s8, s9, s10, s11, s12, s13, s14, s15)				\
+	G2(0, 4, 8, 12, 1, 5, 9, 13, s0, s1, s2, s3)			\
+	G2(2, 6, 10, 14, 3, 7, 11, 15, s4, s5, s6, s7)			\
+	G2(0, 5, 10, 15, 1, 6, 11, 12, s8, s9, s10, s11)		\
+	G2(2, 7, 8, 13, 3, 4, 9, 14, s12, s13, s14, s15)
+
+#define	BLAKE3_ROUNDS(G2)						\
+	BLAKE3_ROUND(G2, 0, 1, 2, 3, 4, 5, 6, 7,			\
+	    8, 9, 10, 11, 12, 13, 14, 15)				\
+	BLAKE3_ROUND(G2, 2, 6, 3, 10, 7, 0, 4, 13,			\
+	    1, 11, 12, 5, 9, 14, 15, 8)					\
+	BLAKE3_ROUND(G2, 3, 4, 10, 12, 13, 2, 7, 14,			\
+	    6, 5, 9, 0, 11, 15, 8, 1)					\
+	BLAKE3_ROUND(G2, 10, 7, 12, 9, 14, 3, 13, 15,			\
+	    4, 0, 11, 2, 5, 8, 1, 6)					\
+	BLAKE3_ROUND(G2, 12, 13, 9, 11, 15, 10, 14, 8,			\
+	    7, 2, 5, 3, 0, 1, 6, 4)					\
+	BLAKE3_ROUND(G2, 9, 14, 11, 5, 8, 12, 15, 1,			\
+	    13, 3, 0, 10, 2, 6, 4, 7)					\
+	BLAKE3_ROUND(G2, 11, 15, 5, 0, 1, 9, 8, 6,			\
+	    14, 10, 2, 12, 3, 4, 7, 13)
+
+/*
+ * A kernel compresses one block for N chains.  h[] holds the N-wide
+ * chaining values on entry and the resulting ones on return, ctr[] the
+ * low and high words of the chunk counter of each chain and msg[] the
+ * transposed message block.  s[] holds the block length and flags, which
+ * are the same for all chains.
+ */
+typedef void (*blake3_kernel_f)(uint32_t *h, const uint32_t *ctr,
+    const uint32_t *msg, const uint32_t s[2]);
+
+/* pshufb masks for rotating each 32-bit word right by 16 and 8 bits */
+static const uint8_t blake3_rot_masks[32] __attribute__((aligned(16))) = {
+	2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+	1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12
+};
+
+/*
+ * Hash up to n inputs at a time with the given kernel.  A trailing group
+ * of fewer than n inputs is padded by repeating its last input, and the
+ * results for the padding are discarded.  A single remaining input is
+ * hashed with the portable implementation instead.
+ */
+static inline void
+blake3_hash_many_simd(const uint8_t * const *inputs, size_t num_inputs,
+    size_t blocks, const uint32_t key[8], uint64_t counter,
+    boolean_t increment_counter, uint8_t flags, uint8_t flags_start,
+    uint8_t flags_end, uint8_t *out, const size_t n, blake3_kernel_f kernel)
+{
+	uint32_t h[8 * 16] __attribute__((aligned(64)));
+	uint32_t msg[16 * 16] __attribute__((aligned(64)));
+	uint32_t ctr[2 * 16] __attribute__((aligned(64)));
+	const uint8_t *src[16];
+	uint32_t s[2];
+
+	ASSERT3U(n, <=, 16);
+
+	while (num_inputs > 1) {
+		size_t lanes = MIN(num_inputs, n);
+
+		for (size_t j = 0; j < n; j++) {
+			uint64_t c = counter;
+
+			if (increment_counter)
+				c += j;
+			src[j] = inputs[MIN(j, lanes - 1)];
+			ctr[j] = counter_low(c);
+			ctr[n + j] = counter_high(c);
+		}
+		for (size_t i = 0; i < 8; i++) {
+			for (size_t j = 0; j < n; j++)
+				h[i * n + j] = key[i];
+		}
+
+		s[0] = BLAKE3_BLOCK_LEN;
+		for (size_t b = 0; b < blocks; b++) {
+			size_t off = b * BLAKE3_BLOCK_LEN;
+
+			s[1] = flags;
+			if (b == 0)
+				s[1] |= flags_start;
+			if (b == blocks - 1)
+				s[1] |= flags_end;
+
+			for (size_t j = 0; j < n; j++) {
+				const uint8_t *p = src[j] + off;
+
+				for (size_t w = 0; w < 16; w++)
+					msg[w * n + j] = load32(p + 4 * w);
+			}
+
+			kernel(h, ctr, msg, s);
+		}
+
+		for (size_t j = 0; j < lanes; j++) {
+			for (size_t i = 0; i < 8; i++)
+				store32(&out[j * BLAKE3_OUT_LEN + i * 4],
+				    h[i * n + j]);
+		}
+
+		if (increment_counter)
+			counter += lanes;
+		inputs += lanes;
+		num_inputs -= lanes;
+		out += lanes * BLAKE3_OUT_LEN;
+	}
+
+	if (num_inputs == 1) {
+		blake3_hash_many_generic(inputs, 1, blocks, key, counter,
+		    increment_counter, flags, flags_start, flags_end, out);
+	}
+}
+
+/*
+ * SSE2 and SSE4.1
+ *
+ * Sixteen xmm registers cannot hold the state plus temporaries, so the
+ * state lives in v[] and each G2() step loads the eight words used by its
+ * two G functions into xmm0-xmm7, using xmm8 and xmm9 as temporaries.
+ */
+#if defined(HAVE_SSE2)
+
+#define	SSE_V(i)	#i "*16(%[v])"
+#define	SSE_M(i)	#i "*16(%[m])"
+
+#define	SSE_ROTR(r, t, n)						\
+	"movdqa	%%xmm" #r ", %%xmm" #t "\n"				\
+	"psrld	$" #n ", %%xmm" #r "\n"					\
+	"pslld	$(32-" #n "), %%xmm" #t "\n"				\
+	"por	%%xmm" #t ", %%xmm" #r "\n"
+
+#define	SSE2_ROTR16(r, t)						\
+	"pshuflw $0xb1, %%xmm" #r ", %%xmm" #r "\n"			\
+	"pshufhw $0xb1, %%xmm" #r ", %%xmm" #r "\n"
+
+#define	SSE2_ROTR8(r, t)	SSE_ROTR(r, t, 8)
+
+#define	SSE41_ROTR16(r, t)	"pshufb	%%xmm14, %%xmm" #r "\n"
+
+#define	SSE41_ROTR8(r, t)	"pshufb	%%xmm15, %%xmm" #r "\n"
+
+#define	SSE_G(ROTR16, ROTR8, a, b, c, d, t, x, y)			\
+	"paddd	%%xmm" #b ", %%xmm" #a "\n"				\
+	"paddd	" SSE_M(x) ", %%xmm" #a "\n"				\
+	"pxor	%%xmm" #a ", %%xmm" #d "\n"				\
+	ROTR16(d, t)							\
+	"paddd	%%xmm" #d ", %%xmm" #c "\n"				\
+	"pxor	%%xmm" #c ", %%xmm" #b "\n"				\
+	SSE_ROTR(b, t, 12)						\
+	"paddd	%%xmm" #b ", %%xmm" #a "\n"				\
+	"paddd	" SSE_M(y) ", %%xmm" #a "\n"				\
+	"pxor	%%xmm" #a ", %%xmm" #d "\n"				\
+	ROTR8(d, t)							\
+	"paddd	%%xmm" #d ", %%xmm" #c "\n"				\
+	"pxor	%%xmm" #c ", %%xmm" #b "\n"				\
+	SSE_ROTR(b, t, 7)
+
+#define	SSE_LOAD(i, r)	"movdqa	" SSE_V(i) ", %%xmm" #r "\n"
+#define	SSE_STORE(i, r)	"movdqa	%%xmm" #r ", " SSE_V(i) "\n"
+
+#define	SSE_G2(ROTR16, ROTR8, a0, b0, c0, d0, a1, b1, c1, d1,		\
+    x0, y0, x1, y1)							\
+	SSE_LOAD(a0, 0) SSE_LOAD(b0, 1) SSE_LOAD(c0, 2) SSE_LOAD(d0, 3)	\
+	SSE_LOAD(a1, 4) SSE_LOAD(b1, 5) SSE_LOAD(c1, 6) SSE_LOAD(d1, 7)	\
+	SSE_G(ROTR16, ROTR8, 0, 1, 2, 3, 8, x0, y0)			\
+	SSE_G(ROTR16, ROTR8, 4, 5, 6, 7, 9, x1, y1)			\
+	SSE_STORE(a0, 0) SSE_STORE(b0, 1) SSE_STORE(c0, 2)		\
+	SSE_STORE(d0, 3) SSE_STORE(a1, 4) SSE_STORE(b1, 5)		\
+	SSE_STORE(c1, 6) SSE_STORE(d1, 7)
+
+#define	SSE2_G2(...)	SSE_G2(SSE2_ROTR16, SSE2_ROTR8, __VA_ARGS__)
+#define	SSE41_G2(...)	SSE_G2(SSE41_ROTR16, SSE41_ROTR8, __VA_ARGS__)
+
+#define	SSE_INIT_H(i)							\
+	"movdqu	" #i "*16(%[h]), %%xmm0\n"				\
+	"movdqa	%%xmm0, " SSE_V(i) "\n"
+
+#define	SSE_INIT_B(i, p)						\
+	"movd	" p ", %%xmm0\n"					\
+	"pshufd	$0, %%xmm0, %%xmm0\n"					\
+	"movdqa	%%xmm0, " SSE_V(i) "\n"
+
+/* v[] = h[0-7], IV[0-3], counter low, counter high, block len, flags */
+#define	SSE_INIT							\
+	SSE_INIT_H(0) SSE_INIT_H(1) SSE_INIT_H(2) SSE_INIT_H(3)		\
+	SSE_INIT_H(4) SSE_INIT_H(5) SSE_INIT_H(6) SSE_INIT_H(7)		\
+	SSE_INIT_B(8, "0(%[iv])") SSE_INIT_B(9, "4(%[iv])")		\
+	SSE_INIT_B(10, "8(%[iv])") SSE_INIT_B(11, "12(%[iv])")		\
+	"movdqu	0(%[c]), %%xmm0\n"					\
+	"movdqa	%%xmm0, " SSE_V(12) "\n"				\
+	"movdqu	16(%[c]), %%xmm0\n"					\
+	"movdqa	%%xmm0, " SSE_V(13) "\n"				\
+	SSE_INIT_B(14, "0(%[s])") SSE_INIT_B(15, "4(%[s])")
+
+#define	SSE_FINI_H(i, j)						\
+	"movdqa	" SSE_V(i) ", %%xmm0\n"					\
+	"pxor	" SSE_V(j) ", %%xmm0\n"					\
+	"movdqu	%%xmm0, " #i "*16(%[h])\n"
+
+/* h[i] = v[i] ^ v[i + 8] */
+#define	SSE_FINI							\
+	SSE_FINI_H(0, 8) SSE_FINI_H(1, 9) SSE_FINI_H(2, 10)		\
+	SSE_FINI_H(3, 11) SSE_FINI_H(4, 12) SSE_FINI_H(5, 13)		\
+	SSE_FINI_H(6, 14) SSE_FINI_H(7, 15)
+
+static void
+blake3_kernel_sse2(uint32_t *h, const uint32_t *ctr, const uint32_t *msg,
+    const uint32_t s[2])
+{
+	uint32_t v[16 * 4] __attribute__((aligned(16)));
+
+	__asm__ __volatile__(
+	    SSE_INIT
+	    BLAKE3_ROUNDS(SSE2_G2)
+	    SSE_FINI
+	    : /* no outputs */
+	    : [v] "r" (v), [h] "r" (h), [c] "r" (ctr), [m] "r" (msg),
+	    [iv] "r" (BLAKE3_IV), [s] "r" (s)
+	    : BLAKE3_SIMD_CLOBBERS);
+}
+
+static void
+blake3_hash_many_sse2(const uint8_t * const *inputs, size_t num_inputs,
+    size_t blocks, const uint32_t key[8], uint64_t counter,
+    boolean_t increment_counter, uint8_t flags, uint8_t flags_start,
+    uint8_t flags_end, uint8_t *out)
+{
+	blake3_hash_many_simd(inputs, num_inputs, blocks, key, counter,
+	    increment_counter, flags, flags_start, flags_end, out, 4,
+	    blake3_kernel_sse2);
+}
+
+static boolean_t
+blake3_is_sse2_supported(void)
+{
+	return (kfpu_allowed() && zfs_sse2_available());
+}
+
+const blake3_ops_t blake3_sse2_impl = {
+	.compress_in_place = blake3_compress_in_place_generic,
+	.compress_xof = blake3_compress_xof_generic,
+	.hash_many = blake3_hash_many_sse2,
+	.is_supported = blake3_is_sse2_supported,
+	.degree = 4,
+	.uses_fpu = B_TRUE,
+	.name = "sse2"
+};
+
+#if defined(HAVE_SSE4_1)
+
+static void
+blake3_kernel_sse41(uint32_t *h, const uint32_t *ctr, const uint32_t *msg,
+    const uint32_t s[2])
+{
+	uint32_t v[16 * 4] __attribute__((aligned(16)));
+
+	__asm__ __volatile__(
+	    "movdqa	0(%[r]), %%xmm14\n"
+	    "movdqa	16(%[r]), %%xmm15\n"
+	    SSE_INIT
+	    BLAKE3_ROUNDS(SSE41_G2)
+	    SSE_FINI
+	    : /* no outputs */
+	    : [v] "r" (v), [h] "r" (h), [c] "r" (ctr), [m] "r" (msg),
+	    [iv] "r" (BLAKE3_IV), [s] "r" (s), [r] "r" (blake3_rot_masks)
+	    : BLAKE3_SIMD_CLOBBERS);
+}
+
+static void
+blake3_hash_many_sse41(const uint8_t * const *inputs, size_t num_inputs,
+    size_t blocks, const uint32_t key[8], uint64_t counter,
+    boolean_t increment_counter, uint8_t flags, uint8_t flags_start,
+    uint8_t flags_end, uint8_t *out)
+{
+	blake3_hash_many_simd(inputs, num_inputs, blocks, key, counter,
+	    increment_counter, flags, flags_start, flags_end, out, 4,
+	    blake3_kernel_sse41);
+}
+
+static boolean_t
+blake3_is_sse41_supported(void)
+{
+	return (kfpu_allowed() && zfs_sse4_1_available());
+}
+
+const blake3_ops_t blake3_sse41_impl = {
+	.compress_in_place = blake3_compress_in_place_generic,
+	.compress_xof = blake3_compress_xof_generic,
+	.hash_many = blake3_hash_many_sse41,
+	.is_supported = blake3_is_sse41_supported,
+	.degree = 4,
+	.uses_fpu = B_TRUE,
+	.name = "sse41"
+};
+
+#endif /* HAVE_SSE4_1 */
+#endif /* HAVE_SSE2 */
+
+/*
+ * AVX2
+ *
+ * Same layout as the SSE kernels with eight chains per ymm register.
+ */
+#if defined(HAVE_AVX2)
+
+#define	AVX2_V(i)	#i "*32(%[v])"
+#define	AVX2_M(i)	#i "*32(%[m])"
+
+#define	AVX2_ROTR(r, t, n)						\
+	"vpsrld	$" #n ", %%ymm" #r ", %%ymm" #t "\n"			\
+	"vpslld	$(32-" #n "), %%ymm" #r ", %%ymm" #r "\n"		\
+	"vpor	%%ymm" #t ", %%ymm" #r ", %%ymm" #r "\n"
+
+#define	AVX2_G(a, b, c, d, t, x, y)					\
+	"vpaddd	%%ymm" #b ", %%ymm" #a ", %%ymm" #a "\n"		\
+	"vpaddd	" AVX2_M(x) ", %%ymm" #a ", %%ymm" #a "\n"		\
+	"vpxor	%%ymm" #a ", %%ymm" #d ", %%ymm" #d "\n"		\
+	"vpshufb %%ymm14, %%ymm" #d ", %%ymm" #d "\n"			\
+	"vpaddd	%%ymm" #d ", %%ymm" #c ", %%ymm" #c "\n"		\
+	"vpxor	%%ymm" #c ", %%ymm" #b ", %%ymm" #b "\n"		\
+	AVX2_ROTR(b, t, 12)						\
+	"vpaddd	%%ymm" #b ", %%ymm" #a ", %%ymm" #a "\n"		\
+	"vpaddd	" AVX2_M(y) ", %%ymm" #a ", %%ymm" #a "\n"		\
+	"vpxor	%%ymm" #a ", %%ymm" #d ", %%ymm" #d "\n"		\
+	"vpshufb %%ymm15, %%ymm" #d ", %%ymm" #d "\n"			\
+	"vpaddd	%%ymm" #d ", %%ymm" #c ", %%ymm" #c "\n"		\
+	"vpxor	%%ymm" #c ", %%ymm" #b ", %%ymm" #b "\n"		\
+	AVX2_ROTR(b, t, 7)
+
+#define	AVX2_LOAD(i, r)		"vmovdqu " AVX2_V(i) ", %%ymm" #r "\n"
+#define	AVX2_STORE(i, r)	"vmovdqu %%ymm" #r ", " AVX2_V(i) "\n"
+
+#define	AVX2_G2(a0, b0, c0, d0, a1, b1, c1, d1, x0, y0, x1, y1)		\
+	AVX2_LOAD(a0, 0) AVX2_LOAD(b0, 1) AVX2_LOAD(c0, 2)		\
+	AVX2_LOAD(d0, 3) AVX2_LOAD(a1, 4) AVX2_LOAD(b1, 5)		\
+	AVX2_LOAD(c1, 6) AVX2_LOAD(d1, 7)				\
+	AVX2_G(0, 1, 2, 3, 8, x0, y0)					\
+	AVX2_G(4, 5, 6, 7, 9, x1, y1)					\
+	AVX2_STORE(a0, 0) AVX2_STORE(b0, 1) AVX2_STORE(c0, 2)		\
+	AVX2_STORE(d0, 3) AVX2_STORE(a1, 4) AVX2_STORE(b1, 5)		\
+	AVX2_STORE(c1, 6) AVX2_STORE(d1, 7)
+
+#define	AVX2_INIT_H(i)							\
+	"vmovdqu " #i "*32(%[h]), %%ymm0\n"				\
+	"vmovdqu %%ymm0, " AVX2_V(i) "\n"
+
+#define	AVX2_INIT_B(i, p)						\
+	"vpbroadcastd " p ", %%ymm0\n"					\
+	"vmovdqu %%ymm0, " AVX2_V(i) "\n"
+
+#define	AVX2_INIT							\
+	AVX2_INIT_H(0) AVX2_INIT_H(1) AVX2_INIT_H(2) AVX2_INIT_H(3)	\
+	AVX2_INIT_H(4) AVX2_INIT_H(5) AVX2_INIT_H(6) AVX2_INIT_H(7)	\
+	AVX2_INIT_B(8, "0(%[iv])") AVX2_INIT_B(9, "4(%[iv])")		\
+	AVX2_INIT_B(10, "8(%[iv])") AVX2_INIT_B(11, "12(%[iv])")	\
+	"vmovdqu 0(%[c]), %%ymm0\n"					\
+	"vmovdqu %%ymm0, " AVX2_V(12) "\n"				\
+	"vmovdqu 32(%[c]), %%ymm0\n"					\
+	"vmovdqu %%ymm0, " AVX2_V(13) "\n"				\
+	AVX2_INIT_B(14, "0(%[s])") AVX2_INIT_B(15, "4(%[s])")
+
+#define	AVX2_FINI_H(i, j)						\
+	"vmovdqu " AVX2_V(i) ", %%ymm0\n"				\
+	"vpxor	" AVX2_V(j) ", %%ymm0, %%ymm0\n"			\
+	"vmovdqu %%ymm0, " #i "*32(%[h])\n"
+
+#define	AVX2_FINI							\
+	AVX2_FINI_H(0, 8) AVX2_FINI_H(1, 9) AVX2_FINI_H(2, 10)		\
+	AVX2_FINI_H(3, 11) AVX2_FINI_H(4, 12) AVX2_FINI_H(5, 13)	\
+	AVX2_FINI_H(6, 14) AVX2_FINI_H(7, 15)				\
+	"vzeroupper\n"
+
+static void
+blake3_kernel_avx2(uint32_t *h, const uint32_t *ctr, const uint32_t *msg,
+    const uint32_t s[2])
+{
+	uint32_t v[16 * 8] __attribute__((aligned(32)));
+
+	__asm__ __volatile__(
+	    "vbroadcasti128 0(%[r]), %%ymm14\n"
+	    "vbroadcasti128 16(%[r]), %%ymm15\n"
+	    AVX2_INIT
+	    BLAKE3_ROUNDS(AVX2_G2)
+	    AVX2_FINI
+	    : /* no outputs */
+	    : [v] "r" (v), [h] "r" (h), [c] "r" (ctr), [m] "r" (msg),
+	    [iv] "r" (BLAKE3_IV), [s] "r" (s), [r] "r" (blake3_rot_masks)
+	    : BLAKE3_SIMD_CLOBBERS);
+}
+
+static void
+blake3_hash_many_avx2(const uint8_t * const *inputs, size_t num_inputs,
+    size_t blocks, const uint32_t key[8], uint64_t counter,
+    boolean_t increment_counter, uint8_t flags, uint8_t flags_start,
+    uint8_t flags_end, uint8_t *out)
+{
+	blake3_hash_many_simd(inputs, num_inputs, blocks, key, counter,
+	    increment_counter, flags, flags_start, flags_end, out, 8,
+	    blake3_kernel_avx2);
+}
+
+static boolean_t
+blake3_is_avx2_supported(void)
+{
+	return (kfpu_allowed() && zfs_avx2_available());
+}
+
+const blake3_ops_t blake3_avx2_impl = {
+	.compress_in_place = blake3_compress_in_place_generic,
+	.compress_xof = blake3_compress_xof_generic,
+	.hash_many = blake3_hash_many_avx2,
+	.is_supported = blake3_is_avx2_supported,
+	.degree = 8,
+	.uses_fpu = B_TRUE,
+	.name = "avx2"
+};
+
+#endif /* HAVE_AVX2 */
+
+/*
+ * AVX-512
+ *
+ * With sixteen chains per zmm register the whole state stays in
+ * zmm0-zmm15 for all rounds, and vprord does the rotations.
+ */
+#if defined(HAVE_AVX512F)
+
+#define	AVX512_M(i)	#i "*64(%[m])"
+
+#define	AVX512_G(a, b, c, d, x, y)					\
+	"vpaddd	%%zmm" #b ", %%zmm" #a ", %%zmm" #a "\n"		\
+	"vpaddd	" AVX512_M(x) ", %%zmm" #a ", %%zmm" #a "\n"		\
+	"vpxord	%%zmm" #a ", %%zmm" #d ", %%zmm" #d "\n"		\
+	"vprord	$16, %%zmm" #d ", %%zmm" #d "\n"			\
+	"vpaddd	%%zmm" #d ", %%zmm" #c ", %%zmm" #c "\n"		\
+	"vpxord	%%zmm" #c ", %%zmm" #b ", %%zmm" #b "\n"		\
+	"vprord	$12, %%zmm" #b ", %%zmm" #b "\n"			\
+	"vpaddd	%%zmm" #b ", %%zmm" #a ", %%zmm" #a "\n"		\
+	"vpaddd	" AVX512_M(y) ", %%zmm" #a ", %%zmm" #a "\n"		\
+	"vpxord	%%zmm" #a ", %%zmm" #d ", %%zmm" #d "\n"		\
+	"vprord	$8, %%zmm" #d ", %%zmm" #d "\n"				\
+	"vpaddd	%%zmm" #d ", %%zmm" #c ", %%zmm" #c "\n"		\
+	"vpxord	%%zmm" #c ", %%zmm" #b ", %%zmm" #b "\n"		\
+	"vprord	$7, %%zmm" #b ", %%zmm" #b "\n"
+
+#define	AVX512_G2(a0, b0, c0, d0, a1, b1, c1, d1, x0, y0, x1, y1)	\
+	AVX512_G(a0, b0, c0, d0, x0, y0)				\
+	AVX512_G(a1, b1, c1, d1, x1, y1)
+
+#define	AVX512_INIT_H(i)	"vmovdqu32 " #i "*64(%[h]), %%zmm" #i "\n"
+#define	AVX512_INIT_B(i, p)	"vpbroadcastd " p ", %%zmm" #i "\n"
+
+#define	AVX512_INIT							\
+	AVX512_INIT_H(0) AVX512_INIT_H(1) AVX512_INIT_H(2)		\
+	AVX512_INIT_H(3) AVX512_INIT_H(4) AVX512_INIT_H(5)		\
+	AVX512_INIT_H(6) AVX512_INIT_H(7)				\
+	AVX512_INIT_B(8, "0(%[iv])") AVX512_INIT_B(9, "4(%[iv])")	\
+	AVX512_INIT_B(10, "8(%[iv])") AVX512_INIT_B(11, "12(%[iv])")	\
+	"vmovdqu32 0(%[c]), %%zmm12\n"					\
+	"vmovdqu32 64(%[c]), %%zmm13\n"					\
+	AVX512_INIT_B(14, "0(%[s])") AVX512_INIT_B(15, "4(%[s])")
+
+#define	AVX512_FINI_H(i, j)						\
+	"vpxord	%%zmm" #j ", %%zmm" #i ", %%zmm" #i "\n"		\
+	"vmovdqu32 %%zmm" #i ", " #i "*64(%[h])\n"
+
+#define	AVX512_FINI							\
+	AVX512_FINI_H(0, 8) AVX512_FINI_H(1, 9) AVX512_FINI_H(2, 10)	\
+	AVX512_FINI_H(3, 11) AVX512_FINI_H(4, 12) AVX512_FINI_H(5, 13)	\
+	AVX512_FINI_H(6, 14) AVX512_FINI_H(7, 15)			\
+	"vzeroupper\n"
+
+static void
+blake3_kernel_avx512(uint32_t *h, const uint32_t *ctr, const uint32_t *msg,
+    const uint32_t s[2])
+{
+	__asm__ __volatile__(
+	    AVX512_INIT
+	    BLAKE3_ROUNDS(AVX512_G2)
+	    AVX512_FINI
+	    : /* no outputs */
+	    : [h] "r" (h), [c] "r" (ctr), [m] "r" (msg),
+	    [iv] "r" (BLAKE3_IV), [s] "r" (s)
+	    : BLAKE3_SIMD_CLOBBERS);
+}
+
+static void
+blake3_hash_many_avx512(const uint8_t * const *inputs, size_t num_inputs,
+    size_t blocks, const uint32_t key[8], uint64_t counter,
+    boolean_t increment_counter, uint8_t flags, uint8_t flags_start,
+    uint8_t flags_end, uint8_t *out)
+{
+	blake3_hash_many_simd(inputs, num_inputs, blocks, key, counter,
+	    increment_counter, flags, flags_start, flags_end, out, 16,
+	    blake3_kernel_avx512);
+}
+
+static boolean_t
+blake3_is_avx512_supported(void)
+{
+	return (kfpu_allowed() && zfs_avx512f_available());
+}
+
+const blake3_ops_t blake3_avx512_impl = {
+	.compress_in_place = blake3_compress_in_place_generic,
+	.compress_xof = blake3_compress_xof_generic,
+	.hash_many = blake3_hash_many_avx512,
+	.is_supported = blake3_is_avx512_supported,
+	.degree = 16,
+	.uses_fpu = B_TRUE,
+	.name = "avx512"
+};
+
+#endif /* HAVE_AVX512F */
+#endif /* __x86_64 */
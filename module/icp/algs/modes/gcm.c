@@ -30,12 +30,74 @@
 #include <sys/byteorder.h>
 #include <modes/gcm_impl.h>
 #include <linux/simd.h>
+#include <aes/aes_impl.h>
 
 #define	GHASH(c, d, t, o) \
 	xor_block((uint8_t *)(d), (uint8_t *)(c)->gcm_ghash); \
 	(o)->mul((uint64_t *)(void *)(c)->gcm_ghash, (c)->gcm_H, \
 	(uint64_t *)(void *)(t));
 
+#ifdef CAN_USE_GCM_ASM
+#define	GCM_BLOCK_LEN	16
+
+/*
+ * The stitched routines process six blocks per iteration.
+ * aesni_gcm_decrypt() needs at least that much input to do any work,
+ * aesni_gcm_encrypt() three times as much.
+ */
+#define	GCM_AVX_MIN_DECRYPT_BYTES	(GCM_BLOCK_LEN * 6)
+#define	GCM_AVX_MIN_ENCRYPT_BYTES	(GCM_BLOCK_LEN * 6 * 3)
+
+/*
+ * Upper limit of the icp_gcm_avx_chunk_size tunable, i.e. the number of
+ * bytes processed between kfpu_begin() and kfpu_end().
+ */
+#define	GCM_AVX_MAX_CHUNK_SIZE \
+	(((128 * 1024) / GCM_AVX_MIN_DECRYPT_BYTES) * GCM_AVX_MIN_DECRYPT_BYTES)
+
+/*
+ * gcm_init_htab_avx() fills the first 12 entries, the table is sized
+ * like OpenSSL's u128 Htable[16].
+ */
+#define	GCM_HTAB_LEN	(16 * 2 * sizeof (uint64_t))
+
+/* The assembler routines load the number of rounds from this offset. */
+CTASSERT_GLOBAL(offsetof(aes_key_t, nr) == 504);
+
+static uint32_t gcm_avx_chunk_size =
+	((32 * 1024) / GCM_AVX_MIN_DECRYPT_BYTES) * GCM_AVX_MIN_DECRYPT_BYTES;
+
+#define	GCM_CHUNK_SIZE_READ	(*(volatile uint32_t *) &gcm_avx_chunk_size)
+
+extern void aes_encrypt_intel(const uint32_t rk[], int nr,
+    const uint32_t pt[4], uint32_t ct[4]);
+extern void gcm_init_htab_avx(uint64_t *Htable, const uint64_t H[2]);
+extern void gcm_ghash_avx(uint64_t ghash[2], const uint64_t *Htable,
+    const uint8_t *in, size_t len);
+extern size_t aesni_gcm_encrypt(const uint8_t *in, uint8_t *out, size_t len,
+    const void *key, uint8_t ivec[16], const uint64_t *Htable,
+    uint64_t ghash[2]);
+extern size_t aesni_gcm_decrypt(const uint8_t *in, uint8_t *out, size_t len,
+    const void *key, uint8_t ivec[16], const uint64_t *Htable,
+    uint64_t ghash[2]);
+extern void clear_fpu_regs_avx(void);
+
+#define	GHASH_AVX(c, d, l) \
+	gcm_ghash_avx((c)->gcm_ghash, (const uint64_t *)(c)->gcm_Htable, \
+	(const uint8_t *)(d), (l));
+
+static int gcm_init_avx_ctx(gcm_ctx_t *);
+static int gcm_init_avx(gcm_ctx_t *, unsigned char *, size_t,
+    unsigned char *, size_t, size_t,
+    void (*)(uint8_t *, uint8_t *), void (*)(uint8_t *, uint8_t *));
+static int gcm_mode_encrypt_contiguous_blocks_avx(gcm_ctx_t *, char *,
+    size_t, crypto_data_t *, size_t, void (*)(uint8_t *, uint8_t *));
+static int gcm_encrypt_final_avx(gcm_ctx_t *, crypto_data_t *, size_t,
+    void (*)(uint8_t *, uint8_t *));
+static int gcm_decrypt_final_avx(gcm_ctx_t *, crypto_data_t *, size_t,
+    void (*)(uint8_t *, uint8_t *));
+#endif /* CAN_USE_GCM_ASM */
+
 /*
  * Encrypt multiple blocks of data in GCM mode.  Decrypt for GCM mode
  * is done in another function.
@@ -61,6 +123,12 @@ gcm_mode_encrypt_contiguous_blocks(gcm_ctx_t *ctx, char *data, size_t length,
 	uint64_t counter;
 	uint64_t counter_mask = ntohll(0x00000000ffffffffULL);
 
+#ifdef CAN_USE_GCM_ASM
+	if (ctx->gcm_use_avx == B_TRUE)
+		return (gcm_mode_encrypt_contiguous_blocks_avx(ctx, data,
+		    length, out, block_size, xor_block));
+#endif
+
 	if (length + ctx->gcm_remainder_len < block_size) {
 		/* accumulate bytes here and return */
 		bcopy(datap,
@@ -174,6 +242,11 @@ gcm_encrypt_final(gcm_ctx_t *ctx, crypto_data_t *out, size_t block_size,
 	uint8_t *ghash, *macp = NULL;
 	int i, rv;
 
+#ifdef CAN_USE_GCM_ASM
+	if (ctx->gcm_use_avx == B_TRUE)
+		return (gcm_encrypt_final_avx(ctx, out, block_size, xor_block));
+#endif
+
 	if (out->cd_length <
 	    (ctx->gcm_remainder_len + ctx->gcm_tag_len)) {
 		return (CRYPTO_DATA_LEN_RANGE);
@@ -333,6 +406,11 @@ gcm_decrypt_final(gcm_ctx_t *ctx, crypto_data_t *out, size_t block_size,
 
 	ASSERT(ctx->gcm_processed_data_len == ctx->gcm_pt_buf_len);
 
+#ifdef CAN_USE_GCM_ASM
+	if (ctx->gcm_use_avx == B_TRUE)
+		return (gcm_decrypt_final_avx(ctx, out, block_size, xor_block));
+#endif
+
 	gops = gcm_impl_get_ops();
 	pt_len = ctx->gcm_processed_data_len - ctx->gcm_tag_len;
 	ghash = (uint8_t *)ctx->gcm_ghash;
@@ -557,6 +635,20 @@ gcm_init_ctx(gcm_ctx_t *gcm_ctx, char *param, size_t block_size,
 		goto out;
 	}
 
+#ifdef CAN_USE_GCM_ASM
+	if ((rv = gcm_init_avx_ctx(gcm_ctx)) != CRYPTO_SUCCESS)
+		goto out;
+
+	if (gcm_ctx->gcm_use_avx == B_TRUE) {
+		if (gcm_init_avx(gcm_ctx, gcm_param->pIv, gcm_param->ulIvLen,
+		    gcm_param->pAAD, gcm_param->ulAADLen, block_size,
+		    copy_block, xor_block) != 0) {
+			rv = CRYPTO_MECHANISM_PARAM_INVALID;
+		}
+		goto out;
+	}
+#endif
+
 	if (gcm_init(gcm_ctx, gcm_param->pIv, gcm_param->ulIvLen,
 	    gcm_param->pAAD, gcm_param->ulAADLen, block_size,
 	    encrypt_block, copy_block, xor_block) != 0) {
@@ -592,6 +684,20 @@ gmac_init_ctx(gcm_ctx_t *gcm_ctx, char *param, size_t block_size,
 		goto out;
 	}
 
+#ifdef CAN_USE_GCM_ASM
+	if ((rv = gcm_init_avx_ctx(gcm_ctx)) != CRYPTO_SUCCESS)
+		goto out;
+
+	if (gcm_ctx->gcm_use_avx == B_TRUE) {
+		if (gcm_init_avx(gcm_ctx, gmac_param->pIv, AES_GMAC_IV_LEN,
+		    gmac_param->pAAD, gmac_param->ulAADLen, block_size,
+		    copy_block, xor_block) != 0) {
+			rv = CRYPTO_MECHANISM_PARAM_INVALID;
+		}
+		goto out;
+	}
+#endif
+
 	if (gcm_init(gcm_ctx, gmac_param->pIv, AES_GMAC_IV_LEN,
 	    gmac_param->pAAD, gmac_param->ulAADLen, block_size,
 	    encrypt_block, copy_block, xor_block) != 0) {
@@ -650,12 +756,23 @@ static boolean_t gcm_impl_initialized = B_FALSE;
 /* Select GCM implementation */
 #define	IMPL_FASTEST	(UINT32_MAX)
 #define	IMPL_CYCLE	(UINT32_MAX-1)
+#ifdef CAN_USE_GCM_ASM
+#define	IMPL_AVX	(UINT32_MAX-2)
+#endif
 
 #define	GCM_IMPL_READ(i) (*(volatile uint32_t *) &(i))
 
 static uint32_t icp_gcm_impl = IMPL_FASTEST;
 static uint32_t user_sel_impl = IMPL_FASTEST;
 
+#ifdef CAN_USE_GCM_ASM
+/* Cached result of gcm_avx_will_work(), set by init() */
+static boolean_t gcm_avx_supported = B_FALSE;
+
+/* Set by the benchmark when the avx routines beat all mul methods */
+static boolean_t gcm_avx_is_fastest = B_FALSE;
+#endif
+
 /* Hold all supported implementations */
 static size_t gcm_supp_impl_cnt = 0;
 static gcm_impl_ops_t *gcm_supp_impl[ARRAY_SIZE(gcm_all_impl)];
@@ -687,6 +804,15 @@ gcm_impl_get_ops()
 		size_t idx = (++cycle_impl_idx) % gcm_supp_impl_cnt;
 		ops = gcm_supp_impl[idx];
 		break;
+#ifdef CAN_USE_GCM_ASM
+	case IMPL_AVX:
+		/*
+		 * Contexts set up before switching to avx and the IV
+		 * setup of the avx contexts still need the mul method.
+		 */
+		ops = &gcm_fastest_impl;
+		break;
+#endif
 	default:
 		ASSERT3U(impl, <, gcm_supp_impl_cnt);
 		ASSERT3U(gcm_supp_impl_cnt, >, 0);
@@ -700,6 +826,241 @@ gcm_impl_get_ops()
 	return (ops);
 }
 
+#ifdef CAN_USE_GCM_ASM
+/*
+ * Returns whether the stitched AES-NI/PCLMULQDQ routines can be used.
+ */
+static boolean_t
+gcm_avx_will_work(void)
+{
+	return (kfpu_allowed() && zfs_avx_available() &&
+	    zfs_aes_available() && zfs_pclmulqdq_available() &&
+	    zfs_movbe_available());
+}
+
+/*
+ * Returns whether a new context should use the avx routines according
+ * to the selected implementation.
+ */
+static boolean_t
+gcm_impl_use_avx(void)
+{
+	static boolean_t cycle_avx = B_FALSE;
+
+	if (!gcm_avx_supported || !kfpu_allowed())
+		return (B_FALSE);
+
+	switch (GCM_IMPL_READ(icp_gcm_impl)) {
+	case IMPL_AVX:
+		return (B_TRUE);
+	case IMPL_FASTEST:
+		return (gcm_avx_is_fastest);
+	case IMPL_CYCLE:
+		/* Alternate between avx and non-avx contexts */
+		cycle_avx = !cycle_avx;
+		return (cycle_avx);
+	default:
+		return (B_FALSE);
+	}
+}
+#endif
+
+#if defined(_KERNEL)
+static kstat_t *gcm_kstat;
+
+/*
+ * Measured bandwidth of each supported implementation, followed by the
+ * avx routines and the index of the fastest entry.
+ */
+static uint64_t gcm_stat_data[ARRAY_SIZE(gcm_all_impl) + 2];
+static size_t gcm_stat_cnt = 0;
+
+/*
+ * GCM kstats
+ */
+static const char *
+gcm_stat_name(size_t id)
+{
+	if (id < gcm_supp_impl_cnt)
+		return (gcm_supp_impl[id]->name);
+
+	return ("avx");
+}
+
+static int
+gcm_kstat_headers(char *buf, size_t size)
+{
+	ssize_t off = 0;
+
+	off += snprintf(buf + off, size, "%-17s", "implementation");
+	(void) snprintf(buf + off, size - off, "%-15s\n", "bandwidth");
+
+	return (0);
+}
+
+static int
+gcm_kstat_data(char *buf, size_t size, void *data)
+{
+	uint64_t *fastest_stat = &gcm_stat_data[gcm_stat_cnt];
+	uint64_t *curr_stat = (uint64_t *)data;
+	ssize_t off = 0;
+
+	if (curr_stat == fastest_stat) {
+		off += snprintf(buf + off, size - off, "%-17s", "fastest");
+		(void) snprintf(buf + off, size - off, "%-15s\n",
+		    gcm_stat_name(*fastest_stat));
+	} else {
+		ptrdiff_t id = curr_stat - gcm_stat_data;
+
+		off += snprintf(buf + off, size - off, "%-17s",
+		    gcm_stat_name(id));
+		(void) snprintf(buf + off, size - off, "%-15llu\n",
+		    (u_longlong_t)*curr_stat);
+	}
+
+	return (0);
+}
+
+static void *
+gcm_kstat_addr(kstat_t *ksp, loff_t n)
+{
+	if (n <= gcm_stat_cnt)
+		ksp->ks_private = (void *) (gcm_stat_data + n);
+	else
+		ksp->ks_private = NULL;
+
+	return (ksp->ks_private);
+}
+
+#define	GCM_BENCH_NS	(MSEC2NSEC(50))		/* 50ms */
+#define	GCM_BENCH_SIZE	(128 * 1024)		/* 128kiB */
+
+/*
+ * Encrypt and authenticate a buffer with the currently selected
+ * implementation until GCM_BENCH_NS have passed and return the
+ * bandwidth in B/s.
+ */
+static uint64_t
+gcm_benchmark_impl(void *keysched, uint8_t *pt, uint8_t *ct)
+{
+	gcm_ctx_t *ctx = kmem_alloc(sizeof (gcm_ctx_t), KM_SLEEP);
+	uint8_t iv[12] = { 0 };
+	uint8_t aad[16] = { 0 };
+	CK_AES_GCM_PARAMS param = {
+		.pIv = iv,
+		.ulIvLen = sizeof (iv),
+		.ulIvBits = CRYPTO_BYTES2BITS(sizeof (iv)),
+		.pAAD = aad,
+		.ulAADLen = sizeof (aad),
+		.ulTagBits = CRYPTO_BYTES2BITS(AES_BLOCK_LEN),
+	};
+	crypto_data_t out;
+	hrtime_t start;
+	uint64_t run_bw, run_time_ns, run_count = 0;
+
+	start = gethrtime();
+	do {
+		bzero(ctx, sizeof (gcm_ctx_t));
+		ctx->gcm_keysched = keysched;
+		ctx->gcm_kmflag = KM_SLEEP;
+
+		bzero(&out, sizeof (out));
+		out.cd_format = CRYPTO_DATA_RAW;
+		out.cd_length = GCM_BENCH_SIZE + AES_BLOCK_LEN;
+		out.cd_raw.iov_base = (char *)ct;
+		out.cd_raw.iov_len = out.cd_length;
+
+		VERIFY0(gcm_init_ctx(ctx, (char *)&param, AES_BLOCK_LEN,
+		    aes_encrypt_block, aes_copy_block, aes_xor_block));
+		VERIFY0(gcm_mode_encrypt_contiguous_blocks(ctx, (char *)pt,
+		    GCM_BENCH_SIZE, &out, AES_BLOCK_LEN, aes_encrypt_block,
+		    aes_copy_block, aes_xor_block));
+		VERIFY0(gcm_encrypt_final(ctx, &out, AES_BLOCK_LEN,
+		    aes_encrypt_block, aes_copy_block, aes_xor_block));
+#ifdef CAN_USE_GCM_ASM
+		if (ctx->gcm_Htable != NULL)
+			kmem_free(ctx->gcm_Htable, ctx->gcm_htab_len);
+#endif
+		run_count++;
+		run_time_ns = gethrtime() - start;
+	} while (run_time_ns < GCM_BENCH_NS);
+
+	kmem_free(ctx, sizeof (gcm_ctx_t));
+
+	run_bw = GCM_BENCH_SIZE * run_count * NANOSEC;
+	run_bw /= run_time_ns;	/* B/s */
+
+	return (run_bw);
+}
+
+/*
+ * Benchmark all supported implementations and the avx routines with a
+ * complete encryption, so the cost of the AES-CTR pass is included.
+ * Must be called after aes_impl_init().
+ */
+static void
+gcm_benchmark(void)
+{
+	uint64_t *fastest_stat;
+	uint64_t best_run = 0;
+	uint8_t key[AES_MAX_KEY_BYTES];
+	uint8_t *pt, *ct;
+	void *keysched;
+	size_t ks_size, i;
+
+	pt = vmem_alloc(GCM_BENCH_SIZE, KM_SLEEP);
+	ct = vmem_alloc(GCM_BENCH_SIZE + AES_BLOCK_LEN, KM_SLEEP);
+	keysched = aes_alloc_keysched(&ks_size, KM_SLEEP);
+
+	for (i = 0; i < sizeof (key); i++)
+		key[i] = i;
+	for (i = 0; i < GCM_BENCH_SIZE; i++)
+		pt[i] = i;
+	aes_init_keysched(key, AES_MAXBITS, keysched);
+
+	gcm_stat_cnt = gcm_supp_impl_cnt;
+#ifdef CAN_USE_GCM_ASM
+	if (gcm_avx_supported)
+		gcm_stat_cnt++;
+#endif
+	fastest_stat = &gcm_stat_data[gcm_stat_cnt];
+
+	for (i = 0; i < gcm_stat_cnt; i++) {
+		/* temporary set an implementation */
+#ifdef CAN_USE_GCM_ASM
+		if (i == gcm_supp_impl_cnt)
+			icp_gcm_impl = IMPL_AVX;
+		else
+#endif
+			icp_gcm_impl = i;
+
+		gcm_stat_data[i] = gcm_benchmark_impl(keysched, pt, ct);
+
+		if (gcm_stat_data[i] > best_run) {
+			best_run = gcm_stat_data[i];
+			*fastest_stat = i;
+		}
+	}
+
+	/* The fastest mul method stays in use for non-avx contexts */
+	for (i = 0, best_run = 0; i < gcm_supp_impl_cnt; i++) {
+		if (gcm_stat_data[i] > best_run) {
+			best_run = gcm_stat_data[i];
+			memcpy(&gcm_fastest_impl, gcm_supp_impl[i],
+			    sizeof (gcm_fastest_impl));
+		}
+	}
+#ifdef CAN_USE_GCM_ASM
+	gcm_avx_is_fastest = (*fastest_stat == gcm_supp_impl_cnt);
+#endif
+
+	bzero(keysched, ks_size);
+	kmem_free(keysched, ks_size);
+	vmem_free(ct, GCM_BENCH_SIZE + AES_BLOCK_LEN);
+	vmem_free(pt, GCM_BENCH_SIZE);
+}
+#endif /* _KERNEL */
+
 /*
  * Initialize all supported implementations.
  */
@@ -734,6 +1095,33 @@ gcm_impl_init(void *arg)
 		    sizeof (gcm_fastest_impl));
 	}
 
+#ifdef CAN_USE_GCM_ASM
+	gcm_avx_supported = gcm_avx_will_work();
+#endif
+
+#if defined(_KERNEL)
+	gcm_benchmark();
+
+	/* Install kstats for all implementations */
+	gcm_kstat = kstat_create("icp", 0, "gcm_bench", "misc",
+	    KSTAT_TYPE_RAW, 0, KSTAT_FLAG_VIRTUAL);
+	if (gcm_kstat != NULL) {
+		gcm_kstat->ks_data = NULL;
+		gcm_kstat->ks_ndata = UINT32_MAX;
+		kstat_set_raw_ops(gcm_kstat,
+		    gcm_kstat_headers,
+		    gcm_kstat_data,
+		    gcm_kstat_addr);
+		kstat_install(gcm_kstat);
+	}
+#elif defined(CAN_USE_GCM_ASM)
+	/*
+	 * Skip the benchmark in user space to avoid impacting libzpool
+	 * consumers.  The avx routines are assumed to be the fastest.
+	 */
+	gcm_avx_is_fastest = gcm_avx_supported;
+#endif
+
 	strcpy(gcm_fastest_impl.name, "fastest");
 
 	/* Finish initialization */
@@ -741,12 +1129,26 @@ gcm_impl_init(void *arg)
 	gcm_impl_initialized = B_TRUE;
 }
 
+void
+gcm_impl_fini(void)
+{
+#if defined(_KERNEL)
+	if (gcm_kstat != NULL) {
+		kstat_delete(gcm_kstat);
+		gcm_kstat = NULL;
+	}
+#endif
+}
+
 static const struct {
 	char *name;
 	uint32_t sel;
 } gcm_impl_opts[] = {
 		{ "cycle",	IMPL_CYCLE },
 		{ "fastest",	IMPL_FASTEST },
+#ifdef CAN_USE_GCM_ASM
+		{ "avx",	IMPL_AVX },
+#endif
 };
 
 /*
@@ -780,6 +1182,11 @@ gcm_impl_set(const char *val)
 
 	/* Check mandatory options */
 	for (i = 0; i < ARRAY_SIZE(gcm_impl_opts); i++) {
+#ifdef CAN_USE_GCM_ASM
+		/* Ignore avx implementation if it won't work. */
+		if (gcm_impl_opts[i].sel == IMPL_AVX && !gcm_avx_will_work())
+			continue;
+#endif
 		if (strcmp(req_name, gcm_impl_opts[i].name) == 0) {
 			impl = gcm_impl_opts[i].sel;
 			err = 0;
@@ -809,6 +1216,437 @@ gcm_impl_set(const char *val)
 	return (err);
 }
 
+#ifdef CAN_USE_GCM_ASM
+/*
+ * The stitched AES-NI/PCLMULQDQ routines from aesni-gcm-x86_64.S and
+ * ghash-x86_64.S.  Unlike the generic code the counter block gcm_cb is
+ * post-incremented, i.e. it always holds the counter of the next block
+ * to encrypt.  The subkey H is only used to compute gcm_Htable.  All
+ * AES operations call aes_encrypt_intel() directly, since the key
+ * schedule ops may not be called while owning the FPU.
+ */
+
+/* Clear the FPU registers since they hold sensitive internal state. */
+#define	clear_fpu_regs()	clear_fpu_regs_avx()
+
+static inline void
+gcm_incr_counter_block(gcm_ctx_t *ctx)
+{
+	uint64_t counter_mask = ntohll(0x00000000ffffffffULL);
+	uint64_t counter = ntohll(ctx->gcm_cb[1] & counter_mask);
+
+	counter = htonll(counter + 1);
+	counter &= counter_mask;
+	ctx->gcm_cb[1] = (ctx->gcm_cb[1] & ~counter_mask) | counter;
+}
+
+/*
+ * Write len bytes of output, or copy them back over the input at datap
+ * when encrypting in place.
+ */
+static int
+gcm_avx_put_output(uint8_t *src, uint8_t *datap, crypto_data_t *out,
+    size_t len)
+{
+	int rv;
+
+	if (out == NULL) {
+		if (src != datap)
+			bcopy(src, datap, len);
+		return (CRYPTO_SUCCESS);
+	}
+
+	rv = crypto_put_output_data(src, out, len);
+	if (rv == CRYPTO_SUCCESS)
+		out->cd_offset += len;
+
+	return (rv);
+}
+
+/*
+ * Decide whether the context uses the avx routines and allocate the
+ * gcm_Htable they need.
+ */
+static int
+gcm_init_avx_ctx(gcm_ctx_t *ctx)
+{
+	const aes_key_t *key = (aes_key_t *)ctx->gcm_keysched;
+
+	ctx->gcm_use_avx = gcm_impl_use_avx();
+
+	/* The avx routines expect an AES-NI compatible key schedule. */
+	if (key->ops->needs_byteswap == B_TRUE)
+		ctx->gcm_use_avx = B_FALSE;
+
+	if (ctx->gcm_use_avx == B_FALSE)
+		return (CRYPTO_SUCCESS);
+
+	ctx->gcm_Htable = kmem_alloc(GCM_HTAB_LEN, ctx->gcm_kmflag);
+	if (ctx->gcm_Htable == NULL)
+		return (CRYPTO_HOST_MEMORY);
+	ctx->gcm_htab_len = GCM_HTAB_LEN;
+
+	return (CRYPTO_SUCCESS);
+}
+
+/*
+ * Avx version of gcm_init().  Computes H and gcm_Htable, sets up the
+ * counter blocks and hashes the AAD.
+ */
+static int
+gcm_init_avx(gcm_ctx_t *ctx, unsigned char *iv, size_t iv_len,
+    unsigned char *auth_data, size_t auth_data_len, size_t block_size,
+    void (*copy_block)(uint8_t *, uint8_t *),
+    void (*xor_block)(uint8_t *, uint8_t *))
+{
+	const aes_key_t *key = (aes_key_t *)ctx->gcm_keysched;
+	uint64_t *H = ctx->gcm_H;
+	uint8_t *cb = (uint8_t *)ctx->gcm_cb;
+	uint8_t *datap = auth_data;
+	size_t chunk_size = (size_t)GCM_CHUNK_SIZE_READ;
+	size_t bleft;
+
+	ASSERT3U(block_size, ==, GCM_BLOCK_LEN);
+
+	/* encrypt zero block to get subkey H */
+	bzero(H, sizeof (ctx->gcm_H));
+	kfpu_begin();
+	aes_encrypt_intel(key->encr_ks.ks32, key->nr,
+	    (const uint32_t *)H, (uint32_t *)H);
+	clear_fpu_regs();
+	kfpu_end();
+
+	if (iv_len == 12) {
+		bcopy(iv, cb, 12);
+		cb[12] = 0;
+		cb[13] = 0;
+		cb[14] = 0;
+		cb[15] = 1;
+		/* J0 will be used again in the final */
+		copy_block(cb, (uint8_t *)ctx->gcm_J0);
+	} else {
+		/* Rare, hash the IV with the mul method. */
+		gcm_format_initial_blocks(iv, iv_len, ctx, block_size,
+		    copy_block, xor_block);
+	}
+	/* The first counter block is J0 + 1. */
+	gcm_incr_counter_block(ctx);
+
+	/* gcm_init_htab_avx() expects each half of H byte swapped. */
+	H[0] = ntohll(H[0]);
+	H[1] = ntohll(H[1]);
+	bzero(ctx->gcm_ghash, sizeof (ctx->gcm_ghash));
+
+	kfpu_begin();
+	gcm_init_htab_avx(ctx->gcm_Htable, H);
+
+	/* Hash the AAD in chunks to bound the time spent owning the FPU. */
+	for (bleft = auth_data_len; bleft >= chunk_size;
+	    bleft -= chunk_size) {
+		GHASH_AVX(ctx, datap, chunk_size);
+		datap += chunk_size;
+		clear_fpu_regs();
+		kfpu_end();
+		kfpu_begin();
+	}
+	if (bleft >= block_size) {
+		size_t len = P2ALIGN(bleft, block_size);
+
+		GHASH_AVX(ctx, datap, len);
+		datap += len;
+		bleft -= len;
+	}
+	if (bleft > 0) {
+		/* Pad the last incomplete block with zeros. */
+		uint8_t *authp = (uint8_t *)ctx->gcm_tmp;
+
+		bzero(authp, block_size);
+		bcopy(datap, authp, bleft);
+		GHASH_AVX(ctx, authp, block_size);
+	}
+	clear_fpu_regs();
+	kfpu_end();
+
+	return (CRYPTO_SUCCESS);
+}
+
+/*
+ * Avx version of gcm_mode_encrypt_contiguous_blocks().  Full chunks are
+ * handled by aesni_gcm_encrypt(), what it leaves over is processed one
+ * block at a time.
+ */
+static int
+gcm_mode_encrypt_contiguous_blocks_avx(gcm_ctx_t *ctx, char *data,
+    size_t length, crypto_data_t *out, size_t block_size,
+    void (*xor_block)(uint8_t *, uint8_t *))
+{
+	const aes_key_t *key = (aes_key_t *)ctx->gcm_keysched;
+	uint8_t *cb = (uint8_t *)ctx->gcm_cb;
+	uint8_t *tmp = (uint8_t *)ctx->gcm_tmp;
+	uint8_t *datap = (uint8_t *)data;
+	uint8_t *ct_buf = NULL;
+	size_t chunk_size = (size_t)GCM_CHUNK_SIZE_READ;
+	size_t bleft = length;
+	size_t need, done;
+	int rv = CRYPTO_SUCCESS;
+
+	ASSERT3U(block_size, ==, GCM_BLOCK_LEN);
+
+	if (length + ctx->gcm_remainder_len < block_size) {
+		/* accumulate bytes here and return */
+		bcopy(datap,
+		    (uint8_t *)ctx->gcm_remainder + ctx->gcm_remainder_len,
+		    length);
+		ctx->gcm_remainder_len += length;
+		if (ctx->gcm_copy_to == NULL)
+			ctx->gcm_copy_to = datap;
+		return (CRYPTO_SUCCESS);
+	}
+
+	/* Complete the incomplete block left over by the last call. */
+	if (ctx->gcm_remainder_len > 0) {
+		uint8_t *remainder = (uint8_t *)ctx->gcm_remainder;
+
+		need = block_size - ctx->gcm_remainder_len;
+		bcopy(datap, remainder + ctx->gcm_remainder_len, need);
+
+		kfpu_begin();
+		aes_encrypt_intel(key->encr_ks.ks32, key->nr,
+		    (const uint32_t *)cb, (uint32_t *)tmp);
+		xor_block(remainder, tmp);
+		GHASH_AVX(ctx, tmp, block_size);
+		clear_fpu_regs();
+		kfpu_end();
+		gcm_incr_counter_block(ctx);
+
+		if (out == NULL) {
+			bcopy(tmp, ctx->gcm_copy_to, ctx->gcm_remainder_len);
+			bcopy(tmp + ctx->gcm_remainder_len, datap, need);
+		} else {
+			rv = gcm_avx_put_output(tmp, NULL, out, block_size);
+			if (rv != CRYPTO_SUCCESS)
+				return (rv);
+		}
+		ctx->gcm_processed_data_len += block_size;
+		ctx->gcm_remainder_len = 0;
+		ctx->gcm_copy_to = NULL;
+		datap += need;
+		bleft -= need;
+	}
+
+	/* Encrypt to a bounce buffer unless encrypting in place. */
+	if (bleft >= GCM_AVX_MIN_ENCRYPT_BYTES) {
+		if (out != NULL) {
+			ct_buf = vmem_alloc(chunk_size, ctx->gcm_kmflag);
+			if (ct_buf == NULL)
+				return (CRYPTO_HOST_MEMORY);
+		}
+
+		/* Do the bulk encryption in chunk_size blocks. */
+		while (bleft >= GCM_AVX_MIN_ENCRYPT_BYTES) {
+			uint8_t *dst = (ct_buf != NULL) ? ct_buf : datap;
+			size_t len = MIN(bleft, chunk_size);
+
+			kfpu_begin();
+			done = aesni_gcm_encrypt(datap, dst, len, key, cb,
+			    ctx->gcm_Htable, ctx->gcm_ghash);
+			clear_fpu_regs();
+			kfpu_end();
+			if (done == 0) {
+				rv = CRYPTO_FAILED;
+				goto out;
+			}
+			rv = gcm_avx_put_output(dst, datap, out, done);
+			if (rv != CRYPTO_SUCCESS)
+				goto out;
+
+			ctx->gcm_processed_data_len += done;
+			datap += done;
+			bleft -= done;
+		}
+	}
+
+	/* Less than GCM_AVX_MIN_ENCRYPT_BYTES remain, operate on blocks. */
+	while (bleft >= block_size) {
+		kfpu_begin();
+		aes_encrypt_intel(key->encr_ks.ks32, key->nr,
+		    (const uint32_t *)cb, (uint32_t *)tmp);
+		xor_block(datap, tmp);
+		GHASH_AVX(ctx, tmp, block_size);
+		clear_fpu_regs();
+		kfpu_end();
+		gcm_incr_counter_block(ctx);
+
+		rv = gcm_avx_put_output(tmp, datap, out, block_size);
+		if (rv != CRYPTO_SUCCESS)
+			goto out;
+
+		ctx->gcm_processed_data_len += block_size;
+		datap += block_size;
+		bleft -= block_size;
+	}
+
+	/* Incomplete last block. */
+	if (bleft > 0) {
+		bcopy(datap, ctx->gcm_remainder, bleft);
+		ctx->gcm_remainder_len = bleft;
+		ctx->gcm_copy_to = datap;
+	}
+out:
+	if (ct_buf != NULL)
+		vmem_free(ct_buf, chunk_size);
+
+	return (rv);
+}
+
+/*
+ * Avx version of gcm_encrypt_final().
+ */
+static int
+gcm_encrypt_final_avx(gcm_ctx_t *ctx, crypto_data_t *out, size_t block_size,
+    void (*xor_block)(uint8_t *, uint8_t *))
+{
+	const aes_key_t *key = (aes_key_t *)ctx->gcm_keysched;
+	uint8_t *ghash = (uint8_t *)ctx->gcm_ghash;
+	uint8_t *remainder = (uint8_t *)ctx->gcm_remainder;
+	uint32_t *J0 = (uint32_t *)ctx->gcm_J0;
+	size_t rem_len = ctx->gcm_remainder_len;
+	int i, rv;
+
+	ASSERT3U(block_size, ==, GCM_BLOCK_LEN);
+
+	if (out->cd_length < (rem_len + ctx->gcm_tag_len))
+		return (CRYPTO_DATA_LEN_RANGE);
+
+	kfpu_begin();
+	if (rem_len > 0) {
+		uint8_t *tmp = (uint8_t *)ctx->gcm_tmp;
+
+		/*
+		 * Here is where we deal with data that is not a
+		 * multiple of the block size.
+		 */
+		aes_encrypt_intel(key->encr_ks.ks32, key->nr,
+		    (const uint32_t *)ctx->gcm_cb, (uint32_t *)tmp);
+
+		bzero(remainder + rem_len, block_size - rem_len);
+		for (i = 0; i < rem_len; i++)
+			remainder[i] ^= tmp[i];
+
+		/* add ciphertext to the hash */
+		GHASH_AVX(ctx, remainder, block_size);
+
+		ctx->gcm_processed_data_len += rem_len;
+	}
+
+	ctx->gcm_len_a_len_c[1] =
+	    htonll(CRYPTO_BYTES2BITS(ctx->gcm_processed_data_len));
+	GHASH_AVX(ctx, ctx->gcm_len_a_len_c, block_size);
+	aes_encrypt_intel(key->encr_ks.ks32, key->nr, J0, J0);
+	clear_fpu_regs();
+	kfpu_end();
+	xor_block((uint8_t *)J0, ghash);
+
+	if (rem_len > 0) {
+		rv = crypto_put_output_data(remainder, out, rem_len);
+		if (rv != CRYPTO_SUCCESS)
+			return (rv);
+	}
+	out->cd_offset += rem_len;
+	ctx->gcm_remainder_len = 0;
+	rv = crypto_put_output_data(ghash, out, ctx->gcm_tag_len);
+	if (rv != CRYPTO_SUCCESS)
+		return (rv);
+	out->cd_offset += ctx->gcm_tag_len;
+
+	return (CRYPTO_SUCCESS);
+}
+
+/*
+ * Avx version of gcm_decrypt_final().  The ciphertext collected in
+ * gcm_pt_buf is decrypted in place.
+ */
+static int
+gcm_decrypt_final_avx(gcm_ctx_t *ctx, crypto_data_t *out, size_t block_size,
+    void (*xor_block)(uint8_t *, uint8_t *))
+{
+	const aes_key_t *key = (aes_key_t *)ctx->gcm_keysched;
+	uint8_t *cb = (uint8_t *)ctx->gcm_cb;
+	uint8_t *tmp = (uint8_t *)ctx->gcm_tmp;
+	uint8_t *ghash = (uint8_t *)ctx->gcm_ghash;
+	uint32_t *J0 = (uint32_t *)ctx->gcm_J0;
+	size_t chunk_size = (size_t)GCM_CHUNK_SIZE_READ;
+	size_t pt_len, bleft, done;
+	uint8_t *datap;
+	int i, rv;
+
+	ASSERT3U(block_size, ==, GCM_BLOCK_LEN);
+
+	pt_len = ctx->gcm_processed_data_len - ctx->gcm_tag_len;
+	datap = ctx->gcm_pt_buf;
+	bleft = pt_len;
+
+	/* Do the bulk decryption in chunk_size blocks. */
+	while (bleft >= GCM_AVX_MIN_DECRYPT_BYTES) {
+		size_t len = MIN(bleft, chunk_size);
+
+		kfpu_begin();
+		done = aesni_gcm_decrypt(datap, datap, len, key, cb,
+		    ctx->gcm_Htable, ctx->gcm_ghash);
+		clear_fpu_regs();
+		kfpu_end();
+		if (done == 0)
+			return (CRYPTO_FAILED);
+
+		datap += done;
+		bleft -= done;
+	}
+
+	kfpu_begin();
+	/* Less than GCM_AVX_MIN_DECRYPT_BYTES remain, operate on blocks. */
+	while (bleft >= block_size) {
+		/* add ciphertext to the hash */
+		GHASH_AVX(ctx, datap, block_size);
+		aes_encrypt_intel(key->encr_ks.ks32, key->nr,
+		    (const uint32_t *)cb, (uint32_t *)tmp);
+		xor_block(tmp, datap);
+		gcm_incr_counter_block(ctx);
+
+		datap += block_size;
+		bleft -= block_size;
+	}
+	if (bleft > 0) {
+		/* Incomplete last block */
+		bzero(tmp, block_size);
+		bcopy(datap, tmp, bleft);
+		GHASH_AVX(ctx, tmp, block_size);
+		aes_encrypt_intel(key->encr_ks.ks32, key->nr,
+		    (const uint32_t *)cb, (uint32_t *)tmp);
+		for (i = 0; i < bleft; i++)
+			datap[i] ^= tmp[i];
+	}
+
+	ctx->gcm_len_a_len_c[1] = htonll(CRYPTO_BYTES2BITS(pt_len));
+	GHASH_AVX(ctx, ctx->gcm_len_a_len_c, block_size);
+	aes_encrypt_intel(key->encr_ks.ks32, key->nr, J0, J0);
+	clear_fpu_regs();
+	kfpu_end();
+	xor_block((uint8_t *)J0, ghash);
+
+	/* compare the input authentication tag with what we calculated */
+	if (bcmp(&ctx->gcm_pt_buf[pt_len], ghash, ctx->gcm_tag_len)) {
+		/* They don't match */
+		return (CRYPTO_INVALID_MAC);
+	}
+	rv = crypto_put_output_data(ctx->gcm_pt_buf, out, pt_len);
+	if (rv != CRYPTO_SUCCESS)
+		return (rv);
+	out->cd_offset += pt_len;
+
+	return (CRYPTO_SUCCESS);
+}
+#endif /* CAN_USE_GCM_ASM */
+
 #if defined(_KERNEL)
 #include <linux/mod_compat.h>
 
@@ -829,6 +1667,11 @@ icp_gcm_impl_get(char *buffer, zfs_kernel_param_t *kp)
 
 	/* list mandatory options */
 	for (i = 0; i < ARRAY_SIZE(gcm_impl_opts); i++) {
+#ifdef CAN_USE_GCM_ASM
+		/* Ignore avx implementation if it won't work. */
+		if (gcm_impl_opts[i].sel == IMPL_AVX && !gcm_avx_will_work())
+			continue;
+#endif
 		fmt = (impl == gcm_impl_opts[i].sel) ? "[%s] " : "%s ";
 		cnt += sprintf(buffer + cnt, fmt, gcm_impl_opts[i].name);
 	}
@@ -845,4 +1688,33 @@ icp_gcm_impl_get(char *buffer, zfs_kernel_param_t *kp)
 module_param_call(icp_gcm_impl, icp_gcm_impl_set, icp_gcm_impl_get,
     NULL, 0644);
 MODULE_PARM_DESC(icp_gcm_impl, "Select gcm implementation.");
+
+#ifdef CAN_USE_GCM_ASM
+static int
+icp_gcm_avx_set_chunk_size(const char *buf, zfs_kernel_param_t *kp)
+{
+	unsigned long val;
+	char val_rounded[16];
+	int error;
+
+	error = kstrtoul(buf, 0, &val);
+	if (error)
+		return (error);
+
+	/* The chunk size must be a multiple of the six block stride. */
+	val = (val / GCM_AVX_MIN_DECRYPT_BYTES) * GCM_AVX_MIN_DECRYPT_BYTES;
+	if (val < GCM_AVX_MIN_ENCRYPT_BYTES || val > GCM_AVX_MAX_CHUNK_SIZE)
+		return (-EINVAL);
+
+	(void) snprintf(val_rounded, sizeof (val_rounded), "%u",
+	    (uint32_t)val);
+
+	return (param_set_uint(val_rounded, kp));
+}
+
+module_param_call(icp_gcm_avx_chunk_size, icp_gcm_avx_set_chunk_size,
+    param_get_uint, &gcm_avx_chunk_size, 0644);
+MODULE_PARM_DESC(icp_gcm_avx_chunk_size,
+	"Bytes to process while owning the FPU in the avx gcm routines");
+#endif /* CAN_USE_GCM_ASM */
 #endif
@@ -40,6 +40,7 @@
 #define	_SHA2_IMPL
 #include <sys/sha2.h>
 #include <sha2/sha2_consts.h>
+#include <sha2/sha2_impl.h>
 
 #define	_RESTRICT_KYWD
 
@@ -52,18 +53,8 @@
 static void Encode(uint8_t *, uint32_t *, size_t);
 static void Encode64(uint8_t *, uint64_t *, size_t);
 
-/* userspace only supports the generic version */
-#if	defined(__amd64) && defined(_KERNEL)
-#define	SHA512Transform(ctx, in) SHA512TransformBlocks((ctx), (in), 1)
-#define	SHA256Transform(ctx, in) SHA256TransformBlocks((ctx), (in), 1)
-
-void SHA512TransformBlocks(SHA2_CTX *ctx, const void *in, size_t num);
-void SHA256TransformBlocks(SHA2_CTX *ctx, const void *in, size_t num);
-
-#else
 static void SHA256Transform(SHA2_CTX *, const uint8_t *);
 static void SHA512Transform(SHA2_CTX *, const uint8_t *);
-#endif	/* __amd64 && _KERNEL */
 
 static uint8_t PADDING[128] = { 0x80, /* all zeros */ };
 
@@ -143,7 +134,6 @@ static uint8_t PADDING[128] = { 0x80, /* all zeros */ };
 #endif	/* _BIG_ENDIAN */
 
 
-#if	!defined(__amd64) || !defined(_KERNEL)
 /* SHA256 Transform */
 
 static void
@@ -601,7 +591,50 @@ SHA512Transform(SHA2_CTX *ctx, const uint8_t *blk)
 	ctx->state.s64[7] += h;
 
 }
-#endif	/* !__amd64 || !_KERNEL */
+
+/*
+ * Portable implementations, used when no better one is available and
+ * whenever the FPU cannot be used.
+ */
+static void
+sha256_generic_transform(SHA2_CTX *ctx, const void *in, size_t blks)
+{
+	const uint8_t *blk = in;
+
+	for (; blks > 0; blks--, blk += 64)
+		SHA256Transform(ctx, blk);
+}
+
+static void
+sha512_generic_transform(SHA2_CTX *ctx, const void *in, size_t blks)
+{
+	const uint8_t *blk = in;
+
+	for (; blks > 0; blks--, blk += 128)
+		SHA512Transform(ctx, blk);
+}
+
+static boolean_t
+sha2_generic_will_work(void)
+{
+	return (B_TRUE);
+}
+
+const sha2_impl_ops_t sha256_generic_impl = {
+	.transform = sha256_generic_transform,
+	.transform_mb = NULL,
+	.degree = 1,
+	.is_supported = sha2_generic_will_work,
+	.name = "generic"
+};
+
+const sha2_impl_ops_t sha512_generic_impl = {
+	.transform = sha512_generic_transform,
+	.transform_mb = NULL,
+	.degree = 1,
+	.is_supported = sha2_generic_will_work,
+	.name = "generic"
+};
 
 
 /*
@@ -781,15 +814,17 @@ SHA512Init(SHA512_CTX *ctx)
 void
 SHA2Update(SHA2_CTX *ctx, const void *inptr, size_t input_len)
 {
-	uint32_t	i, buf_index, buf_len, buf_limit;
+	uint32_t	i, buf_index, buf_len, buf_limit, block_count;
 	const uint8_t	*input = inptr;
 	uint32_t	algotype = ctx->algotype;
+	const sha2_impl_ops_t *ops;
 
 	/* check for noop */
 	if (input_len == 0)
 		return;
 
 	if (algotype <= SHA256_HMAC_GEN_MECH_INFO_TYPE) {
+		ops = sha256_impl_get_ops();
 		buf_limit = 64;
 
 		/* compute number of bytes mod 64 */
@@ -802,6 +837,7 @@ SHA2Update(SHA2_CTX *ctx, const void *inptr, size_t input_len)
 		ctx->count.c32[0] += (input_len >> 29);
 
 	} else {
+		ops = sha512_impl_get_ops();
 		buf_limit = 128;
 
 		/* compute number of bytes mod 128 */
@@ -831,43 +867,16 @@ SHA2Update(SHA2_CTX *ctx, const void *inptr, size_t input_len)
 		 */
 		if (buf_index) {
 			bcopy(input, &ctx->buf_un.buf8[buf_index], buf_len);
-			if (algotype <= SHA256_HMAC_GEN_MECH_INFO_TYPE)
-				SHA256Transform(ctx, ctx->buf_un.buf8);
-			else
-				SHA512Transform(ctx, ctx->buf_un.buf8);
+			ops->transform(ctx, ctx->buf_un.buf8, 1);
 
 			i = buf_len;
 		}
 
-#if !defined(__amd64) || !defined(_KERNEL)
-		if (algotype <= SHA256_HMAC_GEN_MECH_INFO_TYPE) {
-			for (; i + buf_limit - 1 < input_len; i += buf_limit) {
-				SHA256Transform(ctx, &input[i]);
-			}
-		} else {
-			for (; i + buf_limit - 1 < input_len; i += buf_limit) {
-				SHA512Transform(ctx, &input[i]);
-			}
-		}
-
-#else
-		uint32_t block_count;
-		if (algotype <= SHA256_HMAC_GEN_MECH_INFO_TYPE) {
-			block_count = (input_len - i) >> 6;
-			if (block_count > 0) {
-				SHA256TransformBlocks(ctx, &input[i],
-				    block_count);
-				i += block_count << 6;
-			}
-		} else {
-			block_count = (input_len - i) >> 7;
-			if (block_count > 0) {
-				SHA512TransformBlocks(ctx, &input[i],
-				    block_count);
-				i += block_count << 7;
-			}
+		block_count = (input_len - i) / buf_limit;
+		if (block_count > 0) {
+			ops->transform(ctx, &input[i], block_count);
+			i += block_count * buf_limit;
 		}
-#endif	/* !__amd64 || !_KERNEL */
 
 		/*
 		 * general optimization:
@@ -887,6 +896,120 @@ SHA2Update(SHA2_CTX *ctx, const void *inptr, size_t input_len)
 	bcopy(&input[i], &ctx->buf_un.buf8[buf_index], input_len - i);
 }
 
+/*
+ * SHA2UpdateMB()
+ *
+ * purpose: continues several sha2 digest operations of the same type in
+ *          lockstep.  All contexts must have been fed the same number of
+ *          bytes so far, so that whole blocks of every context can be
+ *          handed to a multi-buffer implementation together.
+ *   input: SHA2_CTX **	: the contexts to update
+ *          void **	: the message blocks, one per context
+ *          size_t      : the length of each message block, in bytes
+ *          size_t      : the number of contexts
+ *  output: void
+ */
+
+void
+SHA2UpdateMB(SHA2_CTX *const *ctxs, const void *const *inptrs,
+    size_t input_len, size_t n)
+{
+	SHA2_CTX	*ctx[SHA2_MB_DEGREE_MAX], pad_ctx;
+	const void	*in[SHA2_MB_DEGREE_MAX];
+	const sha2_impl_ops_t *ops;
+	size_t		i, j, lanes, buf_limit, head, block_count;
+
+	if (n == 0 || input_len == 0)
+		return;
+
+	if (ctxs[0]->algotype <= SHA256_HMAC_GEN_MECH_INFO_TYPE) {
+		ops = sha256_impl_get_ops();
+		buf_limit = 64;
+		head = (ctxs[0]->count.c32[1] >> 3) & 0x3F;
+	} else {
+		ops = sha512_impl_get_ops();
+		buf_limit = 128;
+		head = (ctxs[0]->count.c64[1] >> 3) & 0x7F;
+	}
+
+	if (ops->transform_mb == NULL || n == 1) {
+		for (j = 0; j < n; j++)
+			SHA2Update(ctxs[j], inptrs[j], input_len);
+		return;
+	}
+
+	/* complete buffered partial blocks, leaving all contexts aligned */
+	if (head != 0)
+		head = MIN(buf_limit - head, input_len);
+	block_count = (input_len - head) / buf_limit;
+
+	for (j = 0; j < n; j++) {
+		ASSERT3U(ctxs[j]->algotype, ==, ctxs[0]->algotype);
+		ASSERT3U(ctxs[j]->count.c64[0], ==, ctxs[0]->count.c64[0]);
+		ASSERT(buf_limit == 64 ||
+		    ctxs[j]->count.c64[1] == ctxs[0]->count.c64[1]);
+	}
+	for (j = 0; j < n; j++)
+		SHA2Update(ctxs[j], inptrs[j], head);
+
+	if (block_count == 0)
+		goto tail;
+
+	/*
+	 * Hash the whole blocks ops->degree contexts at a time.  A trailing
+	 * group of fewer contexts is padded with a scratch context, unless a
+	 * single context remains which is hashed on its own.
+	 */
+	for (j = 0; j < n; j += lanes) {
+		lanes = MIN(n - j, ops->degree);
+
+		if (lanes == 1) {
+			ops->transform(ctxs[j], (const uint8_t *)inptrs[j] +
+			    head, block_count);
+			continue;
+		}
+
+		for (i = 0; i < ops->degree; i++) {
+			if (i < lanes) {
+				ctx[i] = ctxs[j + i];
+				in[i] = (const uint8_t *)inptrs[j + i] + head;
+			} else {
+				ctx[i] = &pad_ctx;
+				in[i] = in[lanes - 1];
+			}
+		}
+		if (lanes < ops->degree)
+			bcopy(ctx[0], &pad_ctx, sizeof (pad_ctx));
+
+		ops->transform_mb(ctx, in, block_count);
+	}
+
+	/* account for the hashed blocks like SHA2Update() would */
+	for (j = 0; j < n; j++) {
+		uint64_t bits = (uint64_t)block_count * buf_limit * 8;
+
+		if (buf_limit == 64) {
+			uint64_t count = ((uint64_t)ctxs[j]->count.c32[0] <<
+			    32 | ctxs[j]->count.c32[1]) + bits;
+			ctxs[j]->count.c32[0] = count >> 32;
+			ctxs[j]->count.c32[1] = (uint32_t)count;
+		} else {
+			if ((ctxs[j]->count.c64[1] += bits) < bits)
+				ctxs[j]->count.c64[0]++;
+		}
+	}
+
+tail:
+	/* buffer remaining input */
+	head += block_count * buf_limit;
+	for (j = 0; j < n; j++) {
+		SHA2Update(ctxs[j], (const uint8_t *)inptrs[j] + head,
+		    input_len - head);
+	}
+
+	bzero(&pad_ctx, sizeof (pad_ctx));
+}
+
 
 /*
  * SHA2Final()
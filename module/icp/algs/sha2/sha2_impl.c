@@ -0,0 +1,610 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Selection of the SHA-256 and SHA-384/512 block transform
+ * implementations.  This works like the fletcher_4 selection: on load
+ * every supported implementation is benchmarked, separately for hashing
+ * a single buffer and for hashing several independent buffers at once
+ * with SHA2UpdateMB().  The "fastest" implementation combines the best
+ * methods for both cases.
+ */
+
+#include <sys/zfs_context.h>
+#define	_SHA2_IMPL
+#include <sys/sha2.h>
+#include <sha2/sha2_impl.h>
+#include <linux/simd.h>
+
+/* The largest number of implementations of either algorithm */
+#define	SHA2_IMPL_MAX	4
+
+/* Select SHA2 implementation */
+#define	IMPL_FASTEST	(UINT32_MAX)
+#define	IMPL_CYCLE	(UINT32_MAX - 1)
+
+#define	SHA2_IMPL_READ(i) (*(volatile uint32_t *) &(i))
+
+typedef struct sha2_impl_kstat {
+	uint64_t	single;		/* bandwidth in B/s, or fastest id */
+	uint64_t	multi;		/* bandwidth in B/s, or fastest id */
+} sha2_impl_kstat_t;
+
+typedef struct sha2_impl_conf {
+	const char		*sc_name;
+	uint64_t		sc_mech;	/* mechanism benchmarked */
+	const sha2_impl_ops_t	*const *sc_all;	/* compiled in impls */
+	uint32_t		sc_all_cnt;
+	const sha2_impl_ops_t	*sc_nofpu;	/* used without the FPU */
+	const sha2_impl_ops_t	*sc_supp[SHA2_IMPL_MAX];
+	uint32_t		sc_supp_cnt;
+	sha2_impl_ops_t		sc_fastest;
+	uint32_t		sc_chosen;
+	sha2_impl_kstat_t	sc_stat[SHA2_IMPL_MAX + 1];
+	kstat_t			*sc_kstat;
+} sha2_impl_conf_t;
+
+static const sha2_impl_ops_t *const sha256_all_impl[] = {
+	&sha256_generic_impl,
+#if defined(__x86_64)
+	&sha256_x86_64_impl,
+#endif
+#if defined(__x86_64) && defined(HAVE_AVX2)
+	&sha256_avx2_impl,
+#endif
+#if defined(__x86_64) && defined(HAVE_SHA_NI)
+	&sha256_shani_impl,
+#endif
+};
+
+static const sha2_impl_ops_t *const sha512_all_impl[] = {
+	&sha512_generic_impl,
+#if defined(__x86_64)
+	&sha512_x86_64_impl,
+#endif
+#if defined(__x86_64) && defined(HAVE_AVX2)
+	&sha512_avx2_impl,
+#endif
+};
+
+CTASSERT_GLOBAL(ARRAY_SIZE(sha256_all_impl) <= SHA2_IMPL_MAX);
+CTASSERT_GLOBAL(ARRAY_SIZE(sha512_all_impl) <= SHA2_IMPL_MAX);
+
+#if defined(__x86_64)
+#define	SHA256_NOFPU_IMPL	(&sha256_x86_64_impl)
+#define	SHA512_NOFPU_IMPL	(&sha512_x86_64_impl)
+#else
+#define	SHA256_NOFPU_IMPL	(&sha256_generic_impl)
+#define	SHA512_NOFPU_IMPL	(&sha512_generic_impl)
+#endif
+
+static sha2_impl_conf_t sha256_conf = {
+	.sc_name = "sha256",
+	.sc_mech = SHA256,
+	.sc_all = sha256_all_impl,
+	.sc_all_cnt = ARRAY_SIZE(sha256_all_impl),
+	.sc_nofpu = SHA256_NOFPU_IMPL,
+	.sc_fastest = { .name = "fastest" },
+	.sc_chosen = IMPL_FASTEST,
+};
+
+static sha2_impl_conf_t sha512_conf = {
+	.sc_name = "sha512",
+	.sc_mech = SHA512,
+	.sc_all = sha512_all_impl,
+	.sc_all_cnt = ARRAY_SIZE(sha512_all_impl),
+	.sc_nofpu = SHA512_NOFPU_IMPL,
+	.sc_fastest = { .name = "fastest" },
+	.sc_chosen = IMPL_FASTEST,
+};
+
+/* Indicate that benchmark has been completed */
+static boolean_t sha2_impl_initialized = B_FALSE;
+
+static sha2_impl_conf_t *
+sha2_impl_conf(uint64_t mech)
+{
+	if (mech <= SHA256_HMAC_GEN_MECH_INFO_TYPE)
+		return (&sha256_conf);
+	else
+		return (&sha512_conf);
+}
+
+/*
+ * Returns the SHA2 operations.  Before the implementations have been
+ * initialized, or when a SIMD implementation is not allowed in the current
+ * context, then fallback to the fastest implementation not using the FPU.
+ * The benchmark selects each supported implementation in turn before the
+ * initialization is complete.
+ */
+static const sha2_impl_ops_t *
+sha2_impl_get_ops(sha2_impl_conf_t *conf)
+{
+	const sha2_impl_ops_t *ops = NULL;
+	const uint32_t impl = SHA2_IMPL_READ(conf->sc_chosen);
+
+	if (!kfpu_allowed() ||
+	    (!sha2_impl_initialized && impl >= conf->sc_supp_cnt))
+		return (conf->sc_nofpu);
+
+	switch (impl) {
+	case IMPL_FASTEST:
+		ops = &conf->sc_fastest;
+		break;
+	case IMPL_CYCLE:
+		/* Cycle through supported implementations */
+		ASSERT3U(conf->sc_supp_cnt, >, 0);
+		static uint32_t cycle_count = 0;
+		uint32_t idx = (++cycle_count) % conf->sc_supp_cnt;
+		ops = conf->sc_supp[idx];
+		break;
+	default:
+		ASSERT3U(conf->sc_supp_cnt, >, 0);
+		ASSERT3U(impl, <, conf->sc_supp_cnt);
+		ops = conf->sc_supp[impl];
+		break;
+	}
+
+	ASSERT3P(ops, !=, NULL);
+
+	return (ops);
+}
+
+const sha2_impl_ops_t *
+sha256_impl_get_ops(void)
+{
+	return (sha2_impl_get_ops(&sha256_conf));
+}
+
+const sha2_impl_ops_t *
+sha512_impl_get_ops(void)
+{
+	return (sha2_impl_get_ops(&sha512_conf));
+}
+
+static const struct {
+	char *name;
+	uint32_t sel;
+} sha2_impl_opts[] = {
+		{ "cycle",	IMPL_CYCLE },
+		{ "fastest",	IMPL_FASTEST },
+};
+
+/*
+ * Function sets desired SHA-256 or SHA-384/512 implementation, depending
+ * on mech.  Implementations other than "cycle" and "fastest" can only be
+ * chosen after init().
+ *
+ * @mech	SHA2 mechanism selecting the algorithm
+ * @val		Name of the implementation to use
+ */
+int
+sha2_impl_set(uint64_t mech, const char *val)
+{
+	sha2_impl_conf_t *conf = sha2_impl_conf(mech);
+	int err = -EINVAL;
+	uint32_t impl = SHA2_IMPL_READ(conf->sc_chosen);
+	size_t i, val_len;
+
+	val_len = strlen(val);
+	while ((val_len > 0) && !!isspace(val[val_len-1])) /* trim '\n' */
+		val_len--;
+
+	/* check mandatory options */
+	for (i = 0; i < ARRAY_SIZE(sha2_impl_opts); i++) {
+		const char *name = sha2_impl_opts[i].name;
+
+		if (val_len == strlen(name) &&
+		    strncmp(val, name, val_len) == 0) {
+			impl = sha2_impl_opts[i].sel;
+			err = 0;
+			break;
+		}
+	}
+
+	if (err != 0 && sha2_impl_initialized) {
+		/* check all supported implementations */
+		for (i = 0; i < conf->sc_supp_cnt; i++) {
+			const char *name = conf->sc_supp[i]->name;
+
+			if (val_len == strlen(name) &&
+			    strncmp(val, name, val_len) == 0) {
+				impl = i;
+				err = 0;
+				break;
+			}
+		}
+	}
+
+	if (err == 0) {
+		atomic_swap_32(&conf->sc_chosen, impl);
+		membar_producer();
+	}
+
+	return (err);
+}
+
+uint32_t
+sha2_impl_getcnt(uint64_t mech)
+{
+	return (sha2_impl_conf(mech)->sc_supp_cnt);
+}
+
+const char *
+sha2_impl_getname(uint64_t mech)
+{
+	return (sha2_impl_get_ops(sha2_impl_conf(mech))->name);
+}
+
+void
+sha2_impl_setid(uint64_t mech, uint32_t id)
+{
+	sha2_impl_conf_t *conf = sha2_impl_conf(mech);
+
+	ASSERT(id == IMPL_FASTEST || id == IMPL_CYCLE ||
+	    id < conf->sc_supp_cnt);
+
+	atomic_swap_32(&conf->sc_chosen, id);
+	membar_producer();
+}
+
+#if defined(_KERNEL)
+/*
+ * SHA2 kstats
+ */
+static int
+sha2_impl_kstat_headers(char *buf, size_t size)
+{
+	ssize_t off = 0;
+
+	off += snprintf(buf + off, size, "%-17s", "implementation");
+	off += snprintf(buf + off, size - off, "%-15s", "single");
+	(void) snprintf(buf + off, size - off, "%-15s\n", "multi");
+
+	return (0);
+}
+
+static int
+sha2_impl_kstat_data(char *buf, size_t size, void *data)
+{
+	sha2_impl_kstat_t *curr_stat = (sha2_impl_kstat_t *)data;
+	sha2_impl_conf_t *conf = &sha512_conf;
+	ssize_t off = 0;
+
+	if (curr_stat >= sha256_conf.sc_stat &&
+	    curr_stat <= &sha256_conf.sc_stat[SHA2_IMPL_MAX])
+		conf = &sha256_conf;
+
+	ptrdiff_t id = curr_stat - conf->sc_stat;
+
+	if (id == conf->sc_supp_cnt) {
+		off += snprintf(buf + off, size - off, "%-17s", "fastest");
+		off += snprintf(buf + off, size - off, "%-15s",
+		    conf->sc_supp[curr_stat->single]->name);
+		off += snprintf(buf + off, size - off, "%-15s\n",
+		    conf->sc_fastest.transform_mb != NULL ?
+		    conf->sc_supp[curr_stat->multi]->name : "-");
+	} else {
+		off += snprintf(buf + off, size - off, "%-17s",
+		    conf->sc_supp[id]->name);
+		off += snprintf(buf + off, size - off, "%-15llu",
+		    (u_longlong_t)curr_stat->single);
+		if (conf->sc_supp[id]->transform_mb != NULL) {
+			off += snprintf(buf + off, size - off, "%-15llu\n",
+			    (u_longlong_t)curr_stat->multi);
+		} else {
+			off += snprintf(buf + off, size - off, "%-15s\n", "-");
+		}
+	}
+
+	return (0);
+}
+
+static void *
+sha256_impl_kstat_addr(kstat_t *ksp, loff_t n)
+{
+	if (n <= sha256_conf.sc_supp_cnt)
+		ksp->ks_private = (void *) (sha256_conf.sc_stat + n);
+	else
+		ksp->ks_private = NULL;
+
+	return (ksp->ks_private);
+}
+
+static void *
+sha512_impl_kstat_addr(kstat_t *ksp, loff_t n)
+{
+	if (n <= sha512_conf.sc_supp_cnt)
+		ksp->ks_private = (void *) (sha512_conf.sc_stat + n);
+	else
+		ksp->ks_private = NULL;
+
+	return (ksp->ks_private);
+}
+
+#define	SHA2_BENCH_NS		(MSEC2NSEC(50))		/* 50ms */
+#define	SHA2_BENCH_SIZE		(128 * 1024)		/* 128kiB */
+
+/*
+ * Hash SHA2_BENCH_SIZE bytes with each of n contexts for SHA2_BENCH_NS,
+ * using SHA2Update() when n is 1 and SHA2UpdateMB() otherwise, and return
+ * the achieved bandwidth in B/s.
+ */
+static uint64_t
+sha2_impl_benchmark_run(sha2_impl_conf_t *conf, SHA2_CTX *ctx,
+    const uint8_t *data, uint32_t n)
+{
+	SHA2_CTX *ctxs[SHA2_MB_DEGREE_MAX];
+	const void *in[SHA2_MB_DEGREE_MAX];
+	uint8_t digest[SHA512_DIGEST_LENGTH];
+	uint64_t run_bw, run_time_ns, run_count = 0;
+	hrtime_t start;
+	uint32_t i, l;
+
+	for (i = 0; i < n; i++) {
+		ctxs[i] = &ctx[i];
+		in[i] = data;
+	}
+
+	kpreempt_disable();
+	start = gethrtime();
+	do {
+		for (l = 0; l < 16; l++, run_count++) {
+			for (i = 0; i < n; i++)
+				SHA2Init(conf->sc_mech, ctxs[i]);
+			if (n == 1)
+				SHA2Update(ctxs[0], data, SHA2_BENCH_SIZE);
+			else
+				SHA2UpdateMB(ctxs, in, SHA2_BENCH_SIZE, n);
+			for (i = 0; i < n; i++)
+				SHA2Final(digest, ctxs[i]);
+		}
+
+		run_time_ns = gethrtime() - start;
+	} while (run_time_ns < SHA2_BENCH_NS);
+	kpreempt_enable();
+
+	run_bw = (uint64_t)SHA2_BENCH_SIZE * n * run_count * NANOSEC;
+	run_bw /= run_time_ns;	/* B/s */
+
+	return (run_bw);
+}
+
+static void
+sha2_impl_benchmark_impl(sha2_impl_conf_t *conf, const uint8_t *data)
+{
+	sha2_impl_kstat_t *fastest_stat = &conf->sc_stat[conf->sc_supp_cnt];
+	SHA2_CTX *ctx;
+	uint64_t run_bw, best_single = 0, best_multi = 0;
+	uint32_t i, sel_save = SHA2_IMPL_READ(conf->sc_chosen);
+
+	ctx = kmem_alloc(SHA2_MB_DEGREE_MAX * sizeof (SHA2_CTX), KM_SLEEP);
+
+	for (i = 0; i < conf->sc_supp_cnt; i++) {
+		const sha2_impl_ops_t *ops = conf->sc_supp[i];
+
+		/* temporary set an implementation */
+		conf->sc_chosen = i;
+
+		run_bw = sha2_impl_benchmark_run(conf, ctx, data, 1);
+		conf->sc_stat[i].single = run_bw;
+		if (run_bw > best_single) {
+			best_single = run_bw;
+			fastest_stat->single = i;
+			conf->sc_fastest.transform = ops->transform;
+		}
+
+		if (ops->transform_mb == NULL)
+			continue;
+
+		run_bw = sha2_impl_benchmark_run(conf, ctx, data,
+		    ops->degree);
+		conf->sc_stat[i].multi = run_bw;
+		if (run_bw > best_multi) {
+			best_multi = run_bw;
+			fastest_stat->multi = i;
+			conf->sc_fastest.transform_mb = ops->transform_mb;
+			conf->sc_fastest.degree = ops->degree;
+		}
+	}
+
+	/* looping over the fastest single-buffer transform may be better */
+	if (best_multi <= best_single) {
+		conf->sc_fastest.transform_mb = NULL;
+		conf->sc_fastest.degree = 1;
+	}
+
+	kmem_free(ctx, SHA2_MB_DEGREE_MAX * sizeof (SHA2_CTX));
+
+	/* restore original selection */
+	atomic_swap_32(&conf->sc_chosen, sel_save);
+}
+#endif /* _KERNEL */
+
+/*
+ * Initialize and benchmark all supported implementations.
+ */
+static void
+sha2_impl_benchmark(sha2_impl_conf_t *conf)
+{
+	const sha2_impl_ops_t *curr_impl;
+	int i, c;
+
+	/* Move supported implementations into sc_supp */
+	for (i = 0, c = 0; i < conf->sc_all_cnt; i++) {
+		curr_impl = conf->sc_all[i];
+
+		if (curr_impl->is_supported())
+			conf->sc_supp[c++] = curr_impl;
+	}
+	membar_producer();	/* complete sc_supp[] init */
+	conf->sc_supp_cnt = c;	/* number of supported impl */
+
+#if defined(_KERNEL)
+	uint8_t *databuf = vmem_alloc(SHA2_BENCH_SIZE, KM_SLEEP);
+
+	for (i = 0; i < SHA2_BENCH_SIZE / sizeof (uint64_t); i++)
+		((uint64_t *)databuf)[i] = (uintptr_t)(databuf+i); /* warm-up */
+
+	sha2_impl_benchmark_impl(conf, databuf);
+
+	vmem_free(databuf, SHA2_BENCH_SIZE);
+#else
+	/*
+	 * Skip the benchmark in user space to avoid impacting libzpool
+	 * consumers (zdb, zhack, zinject, ztest).  The last implementation
+	 * is assumed to be the fastest and used by default.
+	 */
+	curr_impl = conf->sc_supp[conf->sc_supp_cnt - 1];
+	conf->sc_fastest.transform = curr_impl->transform;
+	conf->sc_fastest.transform_mb = curr_impl->transform_mb;
+	conf->sc_fastest.degree = curr_impl->degree;
+	membar_producer();
+#endif /* _KERNEL */
+}
+
+/*
+ * Initialize all supported implementations.
+ */
+/* ARGSUSED */
+void
+sha2_impl_init(void *arg)
+{
+	sha2_impl_benchmark(&sha256_conf);
+	sha2_impl_benchmark(&sha512_conf);
+
+#if defined(_KERNEL)
+	/* Install kstats for all implementations */
+	sha256_conf.sc_kstat = kstat_create("icp", 0, "sha256_bench", "misc",
+	    KSTAT_TYPE_RAW, 0, KSTAT_FLAG_VIRTUAL);
+	if (sha256_conf.sc_kstat != NULL) {
+		sha256_conf.sc_kstat->ks_data = NULL;
+		sha256_conf.sc_kstat->ks_ndata = UINT32_MAX;
+		kstat_set_raw_ops(sha256_conf.sc_kstat,
+		    sha2_impl_kstat_headers,
+		    sha2_impl_kstat_data,
+		    sha256_impl_kstat_addr);
+		kstat_install(sha256_conf.sc_kstat);
+	}
+
+	sha512_conf.sc_kstat = kstat_create("icp", 0, "sha512_bench", "misc",
+	    KSTAT_TYPE_RAW, 0, KSTAT_FLAG_VIRTUAL);
+	if (sha512_conf.sc_kstat != NULL) {
+		sha512_conf.sc_kstat->ks_data = NULL;
+		sha512_conf.sc_kstat->ks_ndata = UINT32_MAX;
+		kstat_set_raw_ops(sha512_conf.sc_kstat,
+		    sha2_impl_kstat_headers,
+		    sha2_impl_kstat_data,
+		    sha512_impl_kstat_addr);
+		kstat_install(sha512_conf.sc_kstat);
+	}
+#endif
+
+	/* Finish initialization */
+	membar_producer();
+	sha2_impl_initialized = B_TRUE;
+}
+
+void
+sha2_impl_fini(void)
+{
+	sha2_impl_initialized = B_FALSE;
+	membar_producer();
+
+#if defined(_KERNEL)
+	if (sha256_conf.sc_kstat != NULL) {
+		kstat_delete(sha256_conf.sc_kstat);
+		sha256_conf.sc_kstat = NULL;
+	}
+	if (sha512_conf.sc_kstat != NULL) {
+		kstat_delete(sha512_conf.sc_kstat);
+		sha512_conf.sc_kstat = NULL;
+	}
+#endif
+}
+
+#if defined(_KERNEL) && defined(__linux__)
+#include <linux/mod_compat.h>
+
+static int
+sha2_impl_get(sha2_impl_conf_t *conf, char *buffer)
+{
+	const uint32_t impl = SHA2_IMPL_READ(conf->sc_chosen);
+	char *fmt;
+	int i, cnt = 0;
+
+	/* list mandatory options */
+	for (i = 0; i < ARRAY_SIZE(sha2_impl_opts); i++) {
+		fmt = (impl == sha2_impl_opts[i].sel) ? "[%s] " : "%s ";
+		cnt += sprintf(buffer + cnt, fmt, sha2_impl_opts[i].name);
+	}
+
+	/* list all supported implementations */
+	for (i = 0; i < conf->sc_supp_cnt; i++) {
+		fmt = (i == impl) ? "[%s] " : "%s ";
+		cnt += sprintf(buffer + cnt, fmt, conf->sc_supp[i]->name);
+	}
+
+	return (cnt);
+}
+
+static int
+icp_sha256_impl_get(char *buffer, zfs_kernel_param_t *unused)
+{
+	return (sha2_impl_get(&sha256_conf, buffer));
+}
+
+static int
+icp_sha256_impl_set(const char *val, zfs_kernel_param_t *unused)
+{
+	return (sha2_impl_set(SHA256, val));
+}
+
+static int
+icp_sha512_impl_get(char *buffer, zfs_kernel_param_t *unused)
+{
+	return (sha2_impl_get(&sha512_conf, buffer));
+}
+
+static int
+icp_sha512_impl_set(const char *val, zfs_kernel_param_t *unused)
+{
+	return (sha2_impl_set(SHA512, val));
+}
+
+/*
+ * Choose the SHA-256 and SHA-384/512 implementations.
+ * Users can choose "cycle" to exercise all implementations, but this is
+ * for testing purpose therefore it can only be set in user space.
+ */
+module_param_call(icp_sha256_impl, icp_sha256_impl_set, icp_sha256_impl_get,
+    NULL, 0644);
+MODULE_PARM_DESC(icp_sha256_impl, "Select SHA-256 implementation.");
+
+module_param_call(icp_sha512_impl, icp_sha512_impl_set, icp_sha512_impl_get,
+    NULL, 0644);
+MODULE_PARM_DESC(icp_sha512_impl, "Select SHA-384/512 implementation.");
+
+EXPORT_SYMBOL(sha2_impl_set);
+EXPORT_SYMBOL(sha2_impl_getcnt);
+EXPORT_SYMBOL(sha2_impl_getname);
+EXPORT_SYMBOL(sha2_impl_setid);
+#endif
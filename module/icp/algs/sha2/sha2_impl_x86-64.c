@@ -0,0 +1,544 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://opensource.org/licenses/CDDL-1.0.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * SHA-256 and SHA-384/512 block transforms for x86_64.
+ *
+ * "x86_64" is the existing integer-only assembly implementation.  It does
+ * not touch the FPU and is therefore also used whenever the FPU is not
+ * available.
+ *
+ * "shani" hashes a single buffer with the SHA-NI instructions.
+ *
+ * "avx2" hashes 8 SHA-256 or 4 SHA-512 buffers at once.  As in the BLAKE3
+ * kernels the state is kept "transposed": vector i holds word i of the
+ * state of every buffer, so each lane simply runs the scalar algorithm.
+ * The message words are byte swapped and transposed in C before each
+ * block, and the rest of the message schedule is expanded in place.  A
+ * single buffer is hashed with the "x86_64" transform.
+ */
+
+#include <sys/zfs_context.h>
+#define	_SHA2_IMPL
+#include <sys/sha2.h>
+#include <sha2/sha2_impl.h>
+#include <sha2/sha2_consts.h>
+
+#if defined(__x86_64)
+
+#if defined(__linux__) || !defined(_KERNEL)
+#include <linux/simd_x86.h>
+#elif defined(__FreeBSD__)
+#include <os/freebsd/spl/sys/simd_x86.h>
+#endif
+
+/* The existing assembly implementations, see asm-x86_64/sha2 */
+extern void SHA256TransformBlocks(SHA2_CTX *ctx, const void *in, size_t num);
+extern void SHA512TransformBlocks(SHA2_CTX *ctx, const void *in, size_t num);
+
+static boolean_t
+sha2_x86_64_will_work(void)
+{
+	return (B_TRUE);
+}
+
+const sha2_impl_ops_t sha256_x86_64_impl = {
+	.transform = SHA256TransformBlocks,
+	.transform_mb = NULL,
+	.degree = 1,
+	.is_supported = sha2_x86_64_will_work,
+	.name = "x86_64"
+};
+
+const sha2_impl_ops_t sha512_x86_64_impl = {
+	.transform = SHA512TransformBlocks,
+	.transform_mb = NULL,
+	.degree = 1,
+	.is_supported = sha2_x86_64_will_work,
+	.name = "x86_64"
+};
+
+#if defined(HAVE_AVX2) || defined(HAVE_SHA_NI)
+
+/*
+ * The compiler is not allowed to use the vector registers in the kernel,
+ * in which case it also refuses to accept them as clobbers.
+ */
+#if defined(__SSE2__)
+#define	SHA2_SIMD_CLOBBERS						\
+	"xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7",	\
+	"xmm8", "xmm9", "xmm10", "xmm11", "xmm12", "xmm13", "xmm14",	\
+	"xmm15", "cc", "memory"
+#else
+#define	SHA2_SIMD_CLOBBERS	"cc", "memory"
+#endif
+
+static const uint32_t sha256_k[64] __attribute__((aligned(64))) = {
+	SHA256_CONST_0, SHA256_CONST_1, SHA256_CONST_2, SHA256_CONST_3,
+	SHA256_CONST_4, SHA256_CONST_5, SHA256_CONST_6, SHA256_CONST_7,
+	SHA256_CONST_8, SHA256_CONST_9, SHA256_CONST_10, SHA256_CONST_11,
+	SHA256_CONST_12, SHA256_CONST_13, SHA256_CONST_14, SHA256_CONST_15,
+	SHA256_CONST_16, SHA256_CONST_17, SHA256_CONST_18, SHA256_CONST_19,
+	SHA256_CONST_20, SHA256_CONST_21, SHA256_CONST_22, SHA256_CONST_23,
+	SHA256_CONST_24, SHA256_CONST_25, SHA256_CONST_26, SHA256_CONST_27,
+	SHA256_CONST_28, SHA256_CONST_29, SHA256_CONST_30, SHA256_CONST_31,
+	SHA256_CONST_32, SHA256_CONST_33, SHA256_CONST_34, SHA256_CONST_35,
+	SHA256_CONST_36, SHA256_CONST_37, SHA256_CONST_38, SHA256_CONST_39,
+	SHA256_CONST_40, SHA256_CONST_41, SHA256_CONST_42, SHA256_CONST_43,
+	SHA256_CONST_44, SHA256_CONST_45, SHA256_CONST_46, SHA256_CONST_47,
+	SHA256_CONST_48, SHA256_CONST_49, SHA256_CONST_50, SHA256_CONST_51,
+	SHA256_CONST_52, SHA256_CONST_53, SHA256_CONST_54, SHA256_CONST_55,
+	SHA256_CONST_56, SHA256_CONST_57, SHA256_CONST_58, SHA256_CONST_59,
+	SHA256_CONST_60, SHA256_CONST_61, SHA256_CONST_62, SHA256_CONST_63
+};
+
+#endif /* HAVE_AVX2 || HAVE_SHA_NI */
+
+/*
+ * AVX2
+ *
+ * The eight state vectors live in ymm0-ymm7 for the whole block; the
+ * rounds rotate the roles of the registers instead of moving them, so
+ * eight rounds form one iteration of the round loop.  ymm8-ymm11 are
+ * temporaries.  w[] holds the 64 or 80 transposed message schedule words.
+ */
+#if defined(HAVE_AVX2)
+
+#define	AVX2_Y(r)	"%%ymm" #r
+
+/*
+ * SZ selects the d(word) or q(uad word) form of the instructions, and
+ * the size of the words in bits and bytes.
+ */
+#define	AVX2_d_BITS	"32"
+#define	AVX2_q_BITS	"64"
+#define	AVX2_d_BYTES	"4"
+#define	AVX2_q_BYTES	"8"
+
+#define	AVX2_ROTR_XOR(SZ, x, r, t, n)					\
+	"vpsrl" #SZ " $" #n ", " AVX2_Y(x) ", " AVX2_Y(t) "\n"		\
+	"vpxor	" AVX2_Y(t) ", " AVX2_Y(r) ", " AVX2_Y(r) "\n"		\
+	"vpsll" #SZ " $(" AVX2_ ## SZ ## _BITS "-" #n "), " AVX2_Y(x)	\
+	    ", " AVX2_Y(t) "\n"						\
+	"vpxor	" AVX2_Y(t) ", " AVX2_Y(r) ", " AVX2_Y(r) "\n"
+
+/* r = ROTR(x, n0) ^ ROTR(x, n1) ^ ROTR(x, n2) */
+#define	AVX2_SIGMA(SZ, x, r, t, n0, n1, n2)				\
+	"vpsrl" #SZ " $" #n0 ", " AVX2_Y(x) ", " AVX2_Y(r) "\n"		\
+	"vpsll" #SZ " $(" AVX2_ ## SZ ## _BITS "-" #n0 "), " AVX2_Y(x)	\
+	    ", " AVX2_Y(t) "\n"						\
+	"vpxor	" AVX2_Y(t) ", " AVX2_Y(r) ", " AVX2_Y(r) "\n"		\
+	AVX2_ROTR_XOR(SZ, x, r, t, n1)					\
+	AVX2_ROTR_XOR(SZ, x, r, t, n2)
+
+/* r = ROTR(x, n0) ^ ROTR(x, n1) ^ SHR(x, n2) */
+#define	AVX2_SMALL_SIGMA(SZ, x, r, t, n0, n1, n2)			\
+	"vpsrl" #SZ " $" #n2 ", " AVX2_Y(x) ", " AVX2_Y(r) "\n"		\
+	AVX2_ROTR_XOR(SZ, x, r, t, n0)					\
+	AVX2_ROTR_XOR(SZ, x, r, t, n1)
+
+/* Expands the rotation counts into separate arguments */
+#define	AVX2_SIGMA_X(...)	AVX2_SIGMA(__VA_ARGS__)
+#define	AVX2_SMALL_SIGMA_X(...)	AVX2_SMALL_SIGMA(__VA_ARGS__)
+
+#define	SHA256_SIGMA0	2, 13, 22
+#define	SHA256_SIGMA1	6, 11, 25
+#define	SHA256_sigma0	7, 18, 3
+#define	SHA256_sigma1	17, 19, 10
+
+#define	SHA512_SIGMA0	28, 34, 39
+#define	SHA512_SIGMA1	14, 18, 41
+#define	SHA512_sigma0	1, 8, 7
+#define	SHA512_sigma1	19, 61, 6
+
+/*
+ * One round, computing
+ *	T1 = h + SIGMA1(e) + Ch(e, f, g) + K[i] + W[i]
+ *	d += T1
+ *	h = T1 + SIGMA0(a) + Maj(a, b, c)
+ */
+#define	AVX2_ROUND(SZ, ALG, a, b, c, d, e, f, g, h, i)			\
+	"vpbroadcast" #SZ " " #i "*" AVX2_ ## SZ ## _BYTES "(%[k]), "	\
+	    "%%ymm8\n"							\
+	"vpadd" #SZ " " #i "*32(%[w]), %%ymm8, %%ymm8\n"		\
+	"vpadd" #SZ " %%ymm8, " AVX2_Y(h) ", " AVX2_Y(h) "\n"		\
+	AVX2_SIGMA_X(SZ, e, 9, 10, SHA ## ALG ## _SIGMA1)		\
+	"vpadd" #SZ " %%ymm9, " AVX2_Y(h) ", " AVX2_Y(h) "\n"		\
+	"vpxor	" AVX2_Y(g) ", " AVX2_Y(f) ", %%ymm9\n"			\
+	"vpand	" AVX2_Y(e) ", %%ymm9, %%ymm9\n"			\
+	"vpxor	" AVX2_Y(g) ", %%ymm9, %%ymm9\n"			\
+	"vpadd" #SZ " %%ymm9, " AVX2_Y(h) ", " AVX2_Y(h) "\n"		\
+	"vpadd" #SZ " " AVX2_Y(h) ", " AVX2_Y(d) ", " AVX2_Y(d) "\n"	\
+	AVX2_SIGMA_X(SZ, a, 9, 10, SHA ## ALG ## _SIGMA0)		\
+	"vpadd" #SZ " %%ymm9, " AVX2_Y(h) ", " AVX2_Y(h) "\n"		\
+	"vpxor	" AVX2_Y(b) ", " AVX2_Y(a) ", %%ymm10\n"		\
+	"vpxor	" AVX2_Y(c) ", " AVX2_Y(b) ", %%ymm11\n"		\
+	"vpand	%%ymm11, %%ymm10, %%ymm10\n"				\
+	"vpxor	" AVX2_Y(b) ", %%ymm10, %%ymm10\n"			\
+	"vpadd" #SZ " %%ymm10, " AVX2_Y(h) ", " AVX2_Y(h) "\n"
+
+#define	AVX2_ROUNDS8(SZ, ALG)						\
+	AVX2_ROUND(SZ, ALG, 0, 1, 2, 3, 4, 5, 6, 7, 0)			\
+	AVX2_ROUND(SZ, ALG, 7, 0, 1, 2, 3, 4, 5, 6, 1)			\
+	AVX2_ROUND(SZ, ALG, 6, 7, 0, 1, 2, 3, 4, 5, 2)			\
+	AVX2_ROUND(SZ, ALG, 5, 6, 7, 0, 1, 2, 3, 4, 3)			\
+	AVX2_ROUND(SZ, ALG, 4, 5, 6, 7, 0, 1, 2, 3, 4)			\
+	AVX2_ROUND(SZ, ALG, 3, 4, 5, 6, 7, 0, 1, 2, 5)			\
+	AVX2_ROUND(SZ, ALG, 2, 3, 4, 5, 6, 7, 0, 1, 6)			\
+	AVX2_ROUND(SZ, ALG, 1, 2, 3, 4, 5, 6, 7, 0, 7)
+
+/*
+ * W[i] = sigma1(W[i-2]) + W[i-7] + sigma0(W[i-15]) + W[i-16] for the
+ * words from W[16] up to %[end].
+ */
+#define	AVX2_SCHEDULE(SZ, ALG)						\
+	"lea	16*32(%[w]), %[p]\n"					\
+	"1:\n"								\
+	"vmovdqu -15*32(%[p]), %%ymm8\n"				\
+	AVX2_SMALL_SIGMA_X(SZ, 8, 9, 10, SHA ## ALG ## _sigma0)		\
+	"vmovdqu -2*32(%[p]), %%ymm8\n"					\
+	AVX2_SMALL_SIGMA_X(SZ, 8, 11, 10, SHA ## ALG ## _sigma1)	\
+	"vpadd" #SZ " %%ymm11, %%ymm9, %%ymm9\n"			\
+	"vpadd" #SZ " -7*32(%[p]), %%ymm9, %%ymm9\n"			\
+	"vpadd" #SZ " -16*32(%[p]), %%ymm9, %%ymm9\n"			\
+	"vmovdqu %%ymm9, (%[p])\n"					\
+	"add	$32, %[p]\n"						\
+	"cmp	%[end], %[p]\n"						\
+	"jb	1b\n"
+
+#define	AVX2_LOAD_STATE(i)	"vmovdqu " #i "*32(%[s]), %%ymm" #i "\n"
+
+#define	AVX2_FINI_STATE(SZ, i)						\
+	"vpadd" #SZ " " #i "*32(%[s]), %%ymm" #i ", %%ymm" #i "\n"	\
+	"vmovdqu %%ymm" #i ", " #i "*32(%[s])\n"
+
+/*
+ * Hash one block of every lane.  The rounds are run in iterations of
+ * eight while advancing %[w] and %[k], which are restored afterwards.
+ */
+#define	AVX2_BLOCK(SZ, ALG, rounds)					\
+	AVX2_SCHEDULE(SZ, ALG)						\
+	AVX2_LOAD_STATE(0) AVX2_LOAD_STATE(1) AVX2_LOAD_STATE(2)	\
+	AVX2_LOAD_STATE(3) AVX2_LOAD_STATE(4) AVX2_LOAD_STATE(5)	\
+	AVX2_LOAD_STATE(6) AVX2_LOAD_STATE(7)				\
+	"mov	$" #rounds "/8, %[p]\n"					\
+	"2:\n"								\
+	AVX2_ROUNDS8(SZ, ALG)						\
+	"add	$8*32, %[w]\n"						\
+	"add	$8*" AVX2_ ## SZ ## _BYTES ", %[k]\n"			\
+	"dec	%[p]\n"							\
+	"jnz	2b\n"							\
+	"sub	$" #rounds "*32, %[w]\n"				\
+	"sub	$" #rounds "*" AVX2_ ## SZ ## _BYTES ", %[k]\n"		\
+	AVX2_FINI_STATE(SZ, 0) AVX2_FINI_STATE(SZ, 1)			\
+	AVX2_FINI_STATE(SZ, 2) AVX2_FINI_STATE(SZ, 3)			\
+	AVX2_FINI_STATE(SZ, 4) AVX2_FINI_STATE(SZ, 5)			\
+	AVX2_FINI_STATE(SZ, 6) AVX2_FINI_STATE(SZ, 7)			\
+	"vzeroupper\n"
+
+static void
+sha256_kernel_avx2(uint32_t *s, uint32_t *w)
+{
+	const uint32_t *k = sha256_k;
+	uint64_t p;
+
+	__asm__ __volatile__(
+	    AVX2_BLOCK(d, 256, 64)
+	    : [p] "=&r" (p), [w] "+r" (w), [k] "+r" (k)
+	    : [s] "r" (s), [end] "r" (w + 64 * 8)
+	    : SHA2_SIMD_CLOBBERS);
+}
+
+static const uint64_t sha512_k[80] __attribute__((aligned(64))) = {
+	SHA512_CONST_0, SHA512_CONST_1, SHA512_CONST_2, SHA512_CONST_3,
+	SHA512_CONST_4, SHA512_CONST_5, SHA512_CONST_6, SHA512_CONST_7,
+	SHA512_CONST_8, SHA512_CONST_9, SHA512_CONST_10, SHA512_CONST_11,
+	SHA512_CONST_12, SHA512_CONST_13, SHA512_CONST_14, SHA512_CONST_15,
+	SHA512_CONST_16, SHA512_CONST_17, SHA512_CONST_18, SHA512_CONST_19,
+	SHA512_CONST_20, SHA512_CONST_21, SHA512_CONST_22, SHA512_CONST_23,
+	SHA512_CONST_24, SHA512_CONST_25, SHA512_CONST_26, SHA512_CONST_27,
+	SHA512_CONST_28, SHA512_CONST_29, SHA512_CONST_30, SHA512_CONST_31,
+	SHA512_CONST_32, SHA512_CONST_33, SHA512_CONST_34, SHA512_CONST_35,
+	SHA512_CONST_36, SHA512_CONST_37, SHA512_CONST_38, SHA512_CONST_39,
+	SHA512_CONST_40, SHA512_CONST_41, SHA512_CONST_42, SHA512_CONST_43,
+	SHA512_CONST_44, SHA512_CONST_45, SHA512_CONST_46, SHA512_CONST_47,
+	SHA512_CONST_48, SHA512_CONST_49, SHA512_CONST_50, SHA512_CONST_51,
+	SHA512_CONST_52, SHA512_CONST_53, SHA512_CONST_54, SHA512_CONST_55,
+	SHA512_CONST_56, SHA512_CONST_57, SHA512_CONST_58, SHA512_CONST_59,
+	SHA512_CONST_60, SHA512_CONST_61, SHA512_CONST_62, SHA512_CONST_63,
+	SHA512_CONST_64, SHA512_CONST_65, SHA512_CONST_66, SHA512_CONST_67,
+	SHA512_CONST_68, SHA512_CONST_69, SHA512_CONST_70, SHA512_CONST_71,
+	SHA512_CONST_72, SHA512_CONST_73, SHA512_CONST_74, SHA512_CONST_75,
+	SHA512_CONST_76, SHA512_CONST_77, SHA512_CONST_78, SHA512_CONST_79
+};
+
+static void
+sha512_kernel_avx2(uint64_t *s, uint64_t *w)
+{
+	const uint64_t *k = sha512_k;
+	uint64_t p;
+
+	__asm__ __volatile__(
+	    AVX2_BLOCK(q, 512, 80)
+	    : [p] "=&r" (p), [w] "+r" (w), [k] "+r" (k)
+	    : [s] "r" (s), [end] "r" (w + 80 * 4)
+	    : SHA2_SIMD_CLOBBERS);
+}
+
+static void
+sha256_transform_mb_avx2(SHA2_CTX *const *ctx, const void *const *in,
+    size_t blks)
+{
+	uint32_t s[8 * 8] __attribute__((aligned(32)));
+	uint32_t w[64 * 8] __attribute__((aligned(32)));
+	size_t i, j, t;
+
+	for (i = 0; i < 8; i++) {
+		for (j = 0; j < 8; j++)
+			s[i * 8 + j] = ctx[j]->state.s32[i];
+	}
+
+	kfpu_begin();
+	for (i = 0; i < blks; i++) {
+		for (j = 0; j < 8; j++) {
+			const uint32_t *p =
+			    (const uint32_t *)in[j] + i * 16;
+
+			for (t = 0; t < 16; t++)
+				w[t * 8 + j] = BE_32(p[t]);
+		}
+		sha256_kernel_avx2(s, w);
+	}
+	kfpu_end();
+
+	for (i = 0; i < 8; i++) {
+		for (j = 0; j < 8; j++)
+			ctx[j]->state.s32[i] = s[i * 8 + j];
+	}
+}
+
+static void
+sha512_transform_mb_avx2(SHA2_CTX *const *ctx, const void *const *in,
+    size_t blks)
+{
+	uint64_t s[8 * 4] __attribute__((aligned(32)));
+	uint64_t w[80 * 4] __attribute__((aligned(32)));
+	size_t i, j, t;
+
+	for (i = 0; i < 8; i++) {
+		for (j = 0; j < 4; j++)
+			s[i * 4 + j] = ctx[j]->state.s64[i];
+	}
+
+	kfpu_begin();
+	for (i = 0; i < blks; i++) {
+		for (j = 0; j < 4; j++) {
+			const uint64_t *p =
+			    (const uint64_t *)in[j] + i * 16;
+
+			for (t = 0; t < 16; t++)
+				w[t * 4 + j] = BE_64(p[t]);
+		}
+		sha512_kernel_avx2(s, w);
+	}
+	kfpu_end();
+
+	for (i = 0; i < 8; i++) {
+		for (j = 0; j < 4; j++)
+			ctx[j]->state.s64[i] = s[i * 4 + j];
+	}
+}
+
+static boolean_t
+sha2_avx2_will_work(void)
+{
+	return (kfpu_allowed() && zfs_avx2_available());
+}
+
+const sha2_impl_ops_t sha256_avx2_impl = {
+	.transform = SHA256TransformBlocks,
+	.transform_mb = sha256_transform_mb_avx2,
+	.degree = 8,
+	.is_supported = sha2_avx2_will_work,
+	.name = "avx2"
+};
+
+const sha2_impl_ops_t sha512_avx2_impl = {
+	.transform = SHA512TransformBlocks,
+	.transform_mb = sha512_transform_mb_avx2,
+	.degree = 4,
+	.is_supported = sha2_avx2_will_work,
+	.name = "avx2"
+};
+
+#endif /* HAVE_AVX2 */
+
+/*
+ * SHA-NI
+ *
+ * sha256rnds2 performs two rounds on the state split into the ABEF and
+ * CDGH halves, taking the two message words plus constants from xmm0.
+ * The message schedule is kept in xmm3-xmm6 and expanded four words at a
+ * time with sha256msg1 and sha256msg2.  xmm7 is a temporary, xmm8 holds
+ * the byte swap mask and xmm9-xmm10 the state at the start of the block.
+ */
+#if defined(HAVE_SHA_NI)
+
+#define	SHANI_X(r)	"%%xmm" #r
+
+/* Load and byte swap message words i to i + 3 */
+#define	SHANI_LOAD(i, m0)						\
+	"movdqu	" #i "*4(%[in]), " SHANI_X(m0) "\n"			\
+	"pshufb	%%xmm8, " SHANI_X(m0) "\n"
+
+/* Rounds i and i + 1 */
+#define	SHANI_RNDS_LO(i, m0)						\
+	"movdqa	" #i "*4(%[k]), %%xmm0\n"				\
+	"paddd	" SHANI_X(m0) ", %%xmm0\n"				\
+	"sha256rnds2 %%xmm0, %%xmm1, %%xmm2\n"
+
+/* Rounds i + 2 and i + 3 */
+#define	SHANI_RNDS_HI							\
+	"punpckhqdq %%xmm0, %%xmm0\n"					\
+	"sha256rnds2 %%xmm0, %%xmm2, %%xmm1\n"
+
+/* Complete the next four message words in m1 */
+#define	SHANI_MSG2(m0, m1, m3)						\
+	"movdqa	" SHANI_X(m0) ", %%xmm7\n"				\
+	"palignr $4, " SHANI_X(m3) ", %%xmm7\n"				\
+	"paddd	%%xmm7, " SHANI_X(m1) "\n"				\
+	"sha256msg2 " SHANI_X(m0) ", " SHANI_X(m1) "\n"
+
+/* Start the message words after the next ones in m3 */
+#define	SHANI_MSG1(m0, m3)						\
+	"sha256msg1 " SHANI_X(m0) ", " SHANI_X(m3) "\n"
+
+/*
+ * Four rounds, where rounds 0-15 use the message words as loaded, rounds
+ * 4-51 start expanding words 16-63 and rounds 12-59 complete them.
+ */
+#define	SHANI_4R_LOAD(i, m0, m1, m2, m3)				\
+	SHANI_LOAD(i, m0) SHANI_RNDS_LO(i, m0) SHANI_RNDS_HI
+
+#define	SHANI_4R_LOAD_MSG1(i, m0, m1, m2, m3)				\
+	SHANI_LOAD(i, m0) SHANI_RNDS_LO(i, m0) SHANI_RNDS_HI		\
+	SHANI_MSG1(m0, m3)
+
+#define	SHANI_4R_LOAD_MSG12(i, m0, m1, m2, m3)				\
+	SHANI_LOAD(i, m0) SHANI_RNDS_LO(i, m0) SHANI_MSG2(m0, m1, m3)	\
+	SHANI_RNDS_HI SHANI_MSG1(m0, m3)
+
+#define	SHANI_4R_MSG12(i, m0, m1, m2, m3)				\
+	SHANI_RNDS_LO(i, m0) SHANI_MSG2(m0, m1, m3) SHANI_RNDS_HI	\
+	SHANI_MSG1(m0, m3)
+
+#define	SHANI_4R_MSG2(i, m0, m1, m2, m3)				\
+	SHANI_RNDS_LO(i, m0) SHANI_MSG2(m0, m1, m3) SHANI_RNDS_HI
+
+#define	SHANI_4R(i, m0, m1, m2, m3)					\
+	SHANI_RNDS_LO(i, m0) SHANI_RNDS_HI
+
+#define	SHANI_ROUNDS							\
+	SHANI_4R_LOAD(0, 3, 4, 5, 6)					\
+	SHANI_4R_LOAD_MSG1(4, 4, 5, 6, 3)				\
+	SHANI_4R_LOAD_MSG1(8, 5, 6, 3, 4)				\
+	SHANI_4R_LOAD_MSG12(12, 6, 3, 4, 5)				\
+	SHANI_4R_MSG12(16, 3, 4, 5, 6)					\
+	SHANI_4R_MSG12(20, 4, 5, 6, 3)					\
+	SHANI_4R_MSG12(24, 5, 6, 3, 4)					\
+	SHANI_4R_MSG12(28, 6, 3, 4, 5)					\
+	SHANI_4R_MSG12(32, 3, 4, 5, 6)					\
+	SHANI_4R_MSG12(36, 4, 5, 6, 3)					\
+	SHANI_4R_MSG12(40, 5, 6, 3, 4)					\
+	SHANI_4R_MSG12(44, 6, 3, 4, 5)					\
+	SHANI_4R_MSG12(48, 3, 4, 5, 6)					\
+	SHANI_4R_MSG2(52, 4, 5, 6, 3)					\
+	SHANI_4R_MSG2(56, 5, 6, 3, 4)					\
+	SHANI_4R(60, 6, 3, 4, 5)
+
+/* pshufb mask converting the big endian message words */
+static const uint8_t sha256_shani_mask[16] __attribute__((aligned(16))) = {
+	3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12
+};
+
+static void
+sha256_kernel_shani(uint32_t *s, const void *in, size_t blks)
+{
+	__asm__ __volatile__(
+	    /* A-H to ABEF in xmm1 and CDGH in xmm2 */
+	    "movdqu	0(%[s]), %%xmm1\n"
+	    "movdqu	16(%[s]), %%xmm2\n"
+	    "pshufd	$0xb1, %%xmm1, %%xmm1\n"
+	    "pshufd	$0x1b, %%xmm2, %%xmm2\n"
+	    "movdqa	%%xmm1, %%xmm7\n"
+	    "palignr $8, %%xmm2, %%xmm1\n"
+	    "pblendw $0xf0, %%xmm7, %%xmm2\n"
+	    "movdqa	0(%[mask]), %%xmm8\n"
+	    "1:\n"
+	    "movdqa	%%xmm1, %%xmm9\n"
+	    "movdqa	%%xmm2, %%xmm10\n"
+	    SHANI_ROUNDS
+	    "paddd	%%xmm9, %%xmm1\n"
+	    "paddd	%%xmm10, %%xmm2\n"
+	    "add	$64, %[in]\n"
+	    "dec	%[n]\n"
+	    "jnz	1b\n"
+	    /* and back */
+	    "pshufd	$0x1b, %%xmm1, %%xmm1\n"
+	    "pshufd	$0xb1, %%xmm2, %%xmm2\n"
+	    "movdqa	%%xmm1, %%xmm7\n"
+	    "pblendw $0xf0, %%xmm2, %%xmm1\n"
+	    "palignr $8, %%xmm7, %%xmm2\n"
+	    "movdqu	%%xmm1, 0(%[s])\n"
+	    "movdqu	%%xmm2, 16(%[s])\n"
+	    : [in] "+r" (in), [n] "+r" (blks)
+	    : [s] "r" (s), [k] "r" (sha256_k), [mask] "r" (sha256_shani_mask)
+	    : SHA2_SIMD_CLOBBERS);
+}
+
+static void
+sha256_transform_shani(SHA2_CTX *ctx, const void *in, size_t blks)
+{
+	if (blks == 0)
+		return;
+
+	kfpu_begin();
+	sha256_kernel_shani(ctx->state.s32, in, blks);
+	kfpu_end();
+}
+
+static boolean_t
+sha256_shani_will_work(void)
+{
+	return (kfpu_allowed() && zfs_shani_available() &&
+	    zfs_sse4_1_available());
+}
+
+const sha2_impl_ops_t sha256_shani_impl = {
+	.transform = sha256_transform_shani,
+	.transform_mb = NULL,
+	.degree = 1,
+	.is_supported = sha256_shani_will_work,
+	.name = "shani"
+};
+
+#endif /* HAVE_SHA_NI */
+#endif /* __x86_64 */
@@ -63,6 +63,11 @@ extern const gcm_impl_ops_t gcm_pclmulqdq_impl;
  */
 void gcm_impl_init(void *arg);
 
+/*
+ * Removes the benchmark kstat
+ */
+void gcm_impl_fini(void);
+
 /*
  * Returns optimal allowed GCM implementation
  */
@@ -34,6 +34,15 @@ extern "C" {
 #include <sys/crypto/common.h>
 #include <sys/crypto/impl.h>
 
+/*
+ * The stitched AES-GCM assembler routines need AVX, AES-NI, PCLMULQDQ and
+ * MOVBE support from the toolchain.
+ */
+#if defined(__x86_64__) && defined(HAVE_AVX) && \
+    defined(HAVE_AES) && defined(HAVE_PCLMULQDQ) && defined(HAVE_MOVBE)
+#define	CAN_USE_GCM_ASM
+#endif
+
 #define	ECB_MODE			0x00000002
 #define	CBC_MODE			0x00000004
 #define	CTR_MODE			0x00000008
@@ -194,8 +203,17 @@ typedef struct ccm_ctx {
  * gcm_len_a_len_c:	64-bit representations of the bit lengths of
  *			AAD and ciphertext.
  *
- * gcm_kmflag:		Current value of kmflag. Used only for allocating
- *			the plaintext buffer during decryption.
+ * gcm_kmflag:		Current value of kmflag. Used for allocating
+ *			the plaintext buffer during decryption and the
+ *			gcm_Htable.
+ *
+ * gcm_use_avx:		Use the stitched AES-NI/PCLMULQDQ assembler
+ *			routines for this context.
+ *
+ * gcm_Htable:		Precomputed powers of the subkey H used by the
+ *			assembler routines.
+ *
+ * gcm_htab_len:	Length of gcm_Htable.
  */
 typedef struct gcm_ctx {
 	struct common_ctx gcm_common;
@@ -209,6 +227,11 @@ typedef struct gcm_ctx {
 	uint64_t gcm_len_a_len_c[2];
 	uint8_t *gcm_pt_buf;
 	int gcm_kmflag;
+#ifdef CAN_USE_GCM_ASM
+	boolean_t gcm_use_avx;
+	uint64_t *gcm_Htable;
+	size_t gcm_htab_len;
+#endif
 } gcm_ctx_t;
 
 #define	gcm_keysched		gcm_common.cc_keysched
@@ -57,6 +57,52 @@ typedef struct sha2_hmac_ctx {
 	SHA2_CTX		hc_ocontext;	/* outer SHA2 context */
 } sha2_hmac_ctx_t;
 
+/*
+ * Methods used to define SHA2 block transform implementations
+ *
+ * @sha2_transform_f Function processes blks consecutive blocks of input
+ * @sha2_transform_mb_f Function processes blks consecutive blocks of
+ *	input for each of degree independent contexts at once
+ * @sha2_will_work_f Function tests whether method will function
+ */
+typedef void		(*sha2_transform_f)(SHA2_CTX *, const void *, size_t);
+typedef void		(*sha2_transform_mb_f)(SHA2_CTX *const *,
+    const void *const *, size_t);
+typedef boolean_t	(*sha2_will_work_f)(void);
+
+#define	SHA2_IMPL_NAME_MAX (16)
+
+/* The largest degree of any multi-buffer implementation */
+#define	SHA2_MB_DEGREE_MAX (8)
+
+typedef struct sha2_impl_ops {
+	sha2_transform_f transform;
+	sha2_transform_mb_f transform_mb;	/* NULL if not multi-buffer */
+	uint32_t degree;			/* 1 if not multi-buffer */
+	sha2_will_work_f is_supported;
+	char name[SHA2_IMPL_NAME_MAX];
+} sha2_impl_ops_t;
+
+extern const sha2_impl_ops_t sha256_generic_impl;
+extern const sha2_impl_ops_t sha512_generic_impl;
+#if defined(__x86_64)
+extern const sha2_impl_ops_t sha256_x86_64_impl;
+extern const sha2_impl_ops_t sha512_x86_64_impl;
+#endif
+#if defined(__x86_64) && defined(HAVE_AVX2)
+extern const sha2_impl_ops_t sha256_avx2_impl;
+extern const sha2_impl_ops_t sha512_avx2_impl;
+#endif
+#if defined(__x86_64) && defined(HAVE_SHA_NI)
+extern const sha2_impl_ops_t sha256_shani_impl;
+#endif
+
+/*
+ * Returns optimal allowed SHA-256 or SHA-384/512 implementation
+ */
+const sha2_impl_ops_t *sha256_impl_get_ops(void);
+const sha2_impl_ops_t *sha512_impl_get_ops(void);
+
 #ifdef	__cplusplus
 }
 #endif
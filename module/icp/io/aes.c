@@ -212,13 +212,12 @@ aes_mod_init(void)
 	 * are run in dedicated kernel threads to allow Linux 5.0+ kernels
 	 * to use SIMD operations.  If for some reason this isn't possible,
 	 * fallback to the generic implementations.  See the comment in
-	 * include/linux/simd_x86.h for additional details.  Additionally,
-	 * this has the benefit of allowing them to be run in parallel.
+	 * include/linux/simd_x86.h for additional details.  The GCM
+	 * benchmark encrypts with the selected AES implementation, so it
+	 * is run after the AES one.
 	 */
 	taskqid_t aes_id = taskq_dispatch(system_taskq, aes_impl_init,
 	    NULL, TQ_SLEEP);
-	taskqid_t gcm_id = taskq_dispatch(system_taskq, gcm_impl_init,
-	    NULL, TQ_SLEEP);
 
 	if (aes_id != TASKQID_INVALID) {
 		taskq_wait_id(system_taskq, aes_id);
@@ -226,6 +225,9 @@ aes_mod_init(void)
 		aes_impl_init(NULL);
 	}
 
+	taskqid_t gcm_id = taskq_dispatch(system_taskq, gcm_impl_init,
+	    NULL, TQ_SLEEP);
+
 	if (gcm_id != TASKQID_INVALID) {
 		taskq_wait_id(system_taskq, gcm_id);
 	} else {
@@ -259,6 +261,8 @@ aes_mod_fini(void)
 		aes_prov_handle = 0;
 	}
 
+	gcm_impl_fini();
+
 	return (mod_remove(&modlinkage));
 }
 
@@ -1082,6 +1086,15 @@ out:
 		bzero(aes_ctx.ac_keysched, aes_ctx.ac_keysched_len);
 		kmem_free(aes_ctx.ac_keysched, aes_ctx.ac_keysched_len);
 	}
+#ifdef CAN_USE_GCM_ASM
+	if (aes_ctx.ac_flags & (GCM_MODE|GMAC_MODE) &&
+	    ((gcm_ctx_t *)&aes_ctx)->gcm_Htable != NULL) {
+		gcm_ctx_t *ctx = (gcm_ctx_t *)&aes_ctx;
+
+		bzero(ctx->gcm_Htable, ctx->gcm_htab_len);
+		kmem_free(ctx->gcm_Htable, ctx->gcm_htab_len);
+	}
+#endif
 
 	return (ret);
 }
@@ -1240,6 +1253,14 @@ out:
 			vmem_free(((gcm_ctx_t *)&aes_ctx)->gcm_pt_buf,
 			    ((gcm_ctx_t *)&aes_ctx)->gcm_pt_buf_len);
 		}
+#ifdef CAN_USE_GCM_ASM
+		if (((gcm_ctx_t *)&aes_ctx)->gcm_Htable != NULL) {
+			gcm_ctx_t *ctx = (gcm_ctx_t *)&aes_ctx;
+
+			bzero(ctx->gcm_Htable, ctx->gcm_htab_len);
+			kmem_free(ctx->gcm_Htable, ctx->gcm_htab_len);
+		}
+#endif
 	}
 
 	return (ret);
@@ -216,6 +216,25 @@ sha2_mod_init(void)
 {
 	int ret;
 
+#if defined(_KERNEL)
+	/*
+	 * Determine the fastest available implementations.  Like the AES
+	 * benchmark this runs in a dedicated kernel thread so that it may
+	 * use SIMD operations, and falls back to the calling thread, where
+	 * only the implementations not using the FPU would be measured.
+	 */
+	taskqid_t id = taskq_dispatch(system_taskq, sha2_impl_init,
+	    NULL, TQ_SLEEP);
+
+	if (id != TASKQID_INVALID) {
+		taskq_wait_id(system_taskq, id);
+	} else {
+		sha2_impl_init(NULL);
+	}
+#else
+	sha2_impl_init(NULL);
+#endif
+
 	if ((ret = mod_install(&modlinkage)) != 0)
 		return (ret);
 
@@ -248,6 +267,8 @@ sha2_mod_fini(void)
 		sha2_prov_handle = 0;
 	}
 
+	sha2_impl_fini();
+
 	return (mod_remove(&modlinkage));
 }
 
@@ -933,6 +933,52 @@ abd_iterate_func2(abd_t *dabd, abd_t *sabd, size_t doff, size_t soff,
 	return (ret);
 }
 
+/*
+ * Iterate over n ABDs of the same size in lockstep, and call func on the
+ * chunks of them which are mapped at the same offset.  func is called at
+ * least once per chunk boundary of any of the ABDs.
+ */
+int
+abd_iterate_func_many(abd_t **abds, uint_t n, size_t size,
+    abd_iter_func_many_t *func, void *private)
+{
+	struct abd_iter aiters[ABD_ITER_MANY_MAX];
+	void *bufs[ABD_ITER_MANY_MAX];
+	size_t len;
+	int ret = 0;
+
+	ASSERT3U(n, <=, ABD_ITER_MANY_MAX);
+
+	for (uint_t i = 0; i < n; i++) {
+		ASSERT3U(size, <=, abds[i]->abd_size);
+		abd_iter_init(&aiters[i], abds[i]);
+	}
+
+	while (size > 0) {
+		len = size;
+		for (uint_t i = 0; i < n; i++) {
+			abd_iter_map(&aiters[i]);
+			bufs[i] = aiters[i].iter_mapaddr;
+			len = MIN(aiters[i].iter_mapsize, len);
+		}
+		ASSERT3U(len, >, 0);
+
+		ret = func(bufs, n, len, private);
+
+		for (uint_t i = 0; i < n; i++) {
+			abd_iter_unmap(&aiters[i]);
+			abd_iter_advance(&aiters[i], len);
+		}
+
+		if (ret != 0)
+			break;
+
+		size -= len;
+	}
+
+	return (ret);
+}
+
 /*ARGSUSED*/
 static int
 abd_copy_off_cb(void *dbuf, void *sbuf, size_t size, void *private)
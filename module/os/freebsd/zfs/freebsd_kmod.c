@@ -277,6 +277,7 @@ zfs__init(void)
 	zfs_ioctl_init();
 
 	tsd_create(&zfs_fsyncer_key, NULL);
+	tsd_create(&zfs_replay_eof_key, NULL);
 	tsd_create(&rrw_tsd_key, rrw_tsd_destroy);
 	tsd_create(&zfs_allow_log_key, zfs_allow_log_destroy);
 	tsd_create(&zfs_geom_probe_vdev_key, NULL);
@@ -308,6 +309,7 @@ zfs__fini(void)
 	spa_fini();
 
 	tsd_destroy(&zfs_fsyncer_key);
+	tsd_destroy(&zfs_replay_eof_key);
 	tsd_destroy(&rrw_tsd_key);
 	tsd_destroy(&zfs_allow_log_key);
 
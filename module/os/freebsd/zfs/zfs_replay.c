@@ -738,6 +738,7 @@ zfs_replay_write(void *arg1, void *arg2, boolean_t byteswap)
 	int error;
 	ssize_t resid;
 	uint64_t eod, offset, length;
+	uint64_t replay_eof = 0; /* 0 means don't change end of file */
 
 	if (byteswap)
 		byteswap_uint64_array(lr, sizeof (*lr));
@@ -765,11 +766,10 @@ zfs_replay_write(void *arg1, void *arg2, boolean_t byteswap)
 	 * write needs to be there. So we write the whole block and
 	 * reduce the eof. This needs to be done within the single dmu
 	 * transaction created within vn_rdwr -> zfs_write. So a possible
-	 * new end of file is passed through in zfsvfs->z_replay_eof
+	 * new end of file is passed through in zfs_replay_eof_key, as
+	 * writes to different files may be replayed concurrently.
 	 */
 
-	zfsvfs->z_replay_eof = 0; /* 0 means don't change end of file */
-
 	/* If it's a dmu_sync() block, write the whole block */
 	if (lr->lr_common.lrc_reclen == sizeof (lr_write_t)) {
 		uint64_t blocksize = BP_GET_LSIZE(&lr->lr_blkptr);
@@ -778,14 +778,16 @@ zfs_replay_write(void *arg1, void *arg2, boolean_t byteswap)
 			length = blocksize;
 		}
 		if (zp->z_size < eod)
-			zfsvfs->z_replay_eof = eod;
+			replay_eof = eod;
 	}
 
+	(void) tsd_set(zfs_replay_eof_key, &replay_eof);
+
 	error = vn_rdwr(UIO_WRITE, ZTOV(zp), data, length, offset,
 	    UIO_SYSSPACE, 0, RLIM64_INFINITY, kcred, &resid);
 
 	VN_RELE(ZTOV(zp));
-	zfsvfs->z_replay_eof = 0;	/* safety */
+	(void) tsd_set(zfs_replay_eof_key, NULL);
 
 	return (error);
 }
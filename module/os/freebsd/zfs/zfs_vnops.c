@@ -1114,11 +1114,16 @@ zfs_write(vnode_t *vp, uio_t *uio, int ioflag, cred_t *cr, caller_context_t *ct)
 		}
 		/*
 		 * If we are replaying and eof is non zero then force
-		 * the file size to the specified eof. Note, there's no
-		 * concurrency during replay.
+		 * the file size to the specified eof. Writes to other
+		 * files may be replayed concurrently, so the eof is
+		 * passed per-thread.
 		 */
-		if (zfsvfs->z_replay && zfsvfs->z_replay_eof != 0)
-			zp->z_size = zfsvfs->z_replay_eof;
+		if (zfsvfs->z_replay) {
+			uint64_t *replay_eof = tsd_get(zfs_replay_eof_key);
+
+			if (replay_eof != NULL && *replay_eof != 0)
+				zp->z_size = *replay_eof;
+		}
 
 		if (error == 0)
 			error = sa_bulk_update(zp->z_sa_hdl, bulk, count, tx);
@@ -577,7 +577,8 @@ abd_verify(abd_t *abd)
 	ASSERT3U(abd->abd_size, <=, SPA_MAXBLOCKSIZE);
 	ASSERT3U(abd->abd_flags, ==, abd->abd_flags & (ABD_FLAG_LINEAR |
 	    ABD_FLAG_OWNER | ABD_FLAG_META | ABD_FLAG_MULTI_ZONE |
-	    ABD_FLAG_MULTI_CHUNK | ABD_FLAG_LINEAR_PAGE));
+	    ABD_FLAG_MULTI_CHUNK | ABD_FLAG_LINEAR_PAGE |
+	    ABD_FLAG_FROM_PAGES));
 	IMPLY(abd->abd_parent != NULL, !(abd->abd_flags & ABD_FLAG_OWNER));
 	IMPLY(abd->abd_flags & ABD_FLAG_META, abd->abd_flags & ABD_FLAG_OWNER);
 	if (abd_is_linear(abd)) {
@@ -877,8 +878,8 @@ abd_get_from_buf(void *buf, size_t size)
 }
 
 /*
- * Free an ABD allocated from abd_get_offset() or abd_get_from_buf(). Will not
- * free the underlying scatterlist or buffer.
+ * Free an ABD allocated from abd_get_offset(), abd_get_from_buf() or
+ * abd_get_from_pages(). Will not free the underlying buffer or pages.
  */
 void
 abd_put(abd_t *abd)
@@ -891,6 +892,11 @@ abd_put(abd_t *abd)
 		    abd->abd_size, abd);
 	}
 
+	if (abd->abd_flags & ABD_FLAG_FROM_PAGES) {
+		vmem_free(ABD_SCATTER(abd).abd_sgl,
+		    ABD_SCATTER(abd).abd_nents * sizeof (struct scatterlist));
+	}
+
 	zfs_refcount_destroy(&abd->abd_children);
 	abd_free_struct(abd);
 }
@@ -1015,7 +1021,7 @@ abd_release_ownership_of_buf(abd_t *abd)
 }
 
 #ifndef HAVE_1ARG_KMAP_ATOMIC
-#define	NR_KM_TYPE (6)
+#define	NR_KM_TYPE (8)
 #ifdef _KERNEL
 int km_table[NR_KM_TYPE] = {
 	KM_USER0,
@@ -1024,6 +1030,8 @@ int km_table[NR_KM_TYPE] = {
 	KM_BIO_DST_IRQ,
 	KM_PTE0,
 	KM_PTE1,
+	KM_IRQ0,
+	KM_IRQ1,
 };
 #endif
 #endif
@@ -1327,6 +1335,62 @@ abd_iterate_func2(abd_t *dabd, abd_t *sabd, size_t doff, size_t soff,
 	return (ret);
 }
 
+/*
+ * Iterate over n ABDs of the same size in lockstep, and call func on the
+ * chunks of them which are mapped at the same offset.  func is called at
+ * least once per chunk boundary of any of the ABDs.
+ */
+int
+abd_iterate_func_many(abd_t **abds, uint_t n, size_t size,
+    abd_iter_func_many_t *func, void *private)
+{
+	struct abd_iter aiters[ABD_ITER_MANY_MAX];
+	void *bufs[ABD_ITER_MANY_MAX];
+	size_t len;
+	int ret = 0;
+#ifndef HAVE_1ARG_KMAP_ATOMIC
+	unsigned long flags;
+#endif
+
+	ASSERT3U(n, <=, ABD_ITER_MANY_MAX);
+
+	for (uint_t i = 0; i < n; i++) {
+		ASSERT3U(size, <=, abds[i]->abd_size);
+		abd_iter_init(&aiters[i], abds[i], i);
+	}
+
+#ifndef HAVE_1ARG_KMAP_ATOMIC
+	/* some of the kmap_atomic() slots are also used from interrupts */
+	local_irq_save(flags);
+#endif
+	while (size > 0) {
+		len = size;
+		for (uint_t i = 0; i < n; i++) {
+			abd_iter_map(&aiters[i]);
+			bufs[i] = aiters[i].iter_mapaddr;
+			len = MIN(aiters[i].iter_mapsize, len);
+		}
+		ASSERT3U(len, >, 0);
+
+		ret = func(bufs, n, len, private);
+
+		for (int i = n - 1; i >= 0; i--) {
+			abd_iter_unmap(&aiters[i]);
+			abd_iter_advance(&aiters[i], len);
+		}
+
+		if (ret != 0)
+			break;
+
+		size -= len;
+	}
+#ifndef HAVE_1ARG_KMAP_ATOMIC
+	local_irq_restore(flags);
+#endif
+
+	return (ret);
+}
+
 /*ARGSUSED*/
 static int
 abd_copy_off_cb(void *dbuf, void *sbuf, size_t size, void *private)
@@ -1591,6 +1655,43 @@ abd_scatter_bio_map_off(struct bio *bio, abd_t *abd,
 	return (io_size);
 }
 
+/*
+ * Allocate a scatter ABD structure for size bytes starting off bytes into
+ * the first of npages pages, such as user pages pinned for direct I/O.  The
+ * caller keeps the pages pinned until the ABD is freed with abd_put().
+ */
+abd_t *
+abd_get_from_pages(struct page **pages, uint_t npages, size_t off,
+    size_t size)
+{
+	struct scatterlist *sg = NULL;
+	abd_t *abd;
+	int i = 0;
+
+	ASSERT3U(npages, >, 0);
+	ASSERT3U(off, <, PAGESIZE);
+	ASSERT3U(off + size, <=, (size_t)npages << PAGE_SHIFT);
+	VERIFY3U(size, <=, SPA_MAXBLOCKSIZE);
+
+	abd = abd_alloc_struct();
+	abd->abd_flags = ABD_FLAG_FROM_PAGES;
+	abd->abd_size = size;
+	abd->abd_parent = NULL;
+	zfs_refcount_create(&abd->abd_children);
+
+	ABD_SCATTER(abd).abd_sgl = vmem_alloc(npages *
+	    sizeof (struct scatterlist), KM_SLEEP);
+	ABD_SCATTER(abd).abd_nents = npages;
+	ABD_SCATTER(abd).abd_offset = off;
+	sg_init_table(ABD_SCATTER(abd).abd_sgl, npages);
+
+	abd_for_each_sg(abd, sg, npages, i) {
+		sg_set_page(sg, pages[i], PAGESIZE, 0);
+	}
+
+	return (abd);
+}
+
 /* Tunable Parameters */
 module_param(zfs_abd_scatter_enabled, int, 0644);
 MODULE_PARM_DESC(zfs_abd_scatter_enabled,
@@ -989,6 +989,98 @@ spa_iostats_destroy(spa_t *spa)
 	mutex_destroy(&shk->lock);
 }
 
+/*
+ * ==========================================================================
+ * SPA Load Times Routines
+ * ==========================================================================
+ */
+
+/*
+ * Duration in nanoseconds of each phase of the last spa_load() of the pool,
+ * followed by their sum.
+ */
+static const char *spa_load_phase_names[SPA_LOAD_PHASES] = {
+	"open_mos",
+	"indirect_vdevs",
+	"features",
+	"special_dirs",
+	"props",
+	"aux_vdevs",
+	"vdev_metadata",
+	"dedup_tables",
+	"brt",
+	"verify_logs",
+	"verify_pool_data",
+	"claim_log_blocks",
+	"finish",
+};
+
+static int
+spa_load_times_update(kstat_t *ksp, int rw)
+{
+	spa_t *spa = ksp->ks_private;
+	kstat_named_t *kn = ksp->ks_data;
+	uint64_t total = 0;
+
+	if (rw == KSTAT_WRITE)
+		return (SET_ERROR(EACCES));
+
+	for (int i = 0; i < SPA_LOAD_PHASES; i++) {
+		kn[i].value.ui64 = spa->spa_load_phase_time[i];
+		total += spa->spa_load_phase_time[i];
+	}
+	kn[SPA_LOAD_PHASES].value.ui64 = total;
+
+	return (0);
+}
+
+static void
+spa_load_times_init(spa_t *spa)
+{
+	spa_history_kstat_t *shk = &spa->spa_stats.load_times;
+
+	mutex_init(&shk->lock, NULL, MUTEX_DEFAULT, NULL);
+
+	char *name = kmem_asprintf("zfs/%s", spa_name(spa));
+	kstat_t *ksp = kstat_create(name, 0, "load_times", "misc",
+	    KSTAT_TYPE_NAMED, SPA_LOAD_PHASES + 1, KSTAT_FLAG_VIRTUAL);
+
+	shk->kstat = ksp;
+	if (ksp) {
+		kstat_named_t *kn = kmem_zalloc(
+		    (SPA_LOAD_PHASES + 1) * sizeof (kstat_named_t), KM_SLEEP);
+
+		for (int i = 0; i < SPA_LOAD_PHASES; i++) {
+			kstat_named_init(&kn[i], spa_load_phase_names[i],
+			    KSTAT_DATA_UINT64);
+		}
+		kstat_named_init(&kn[SPA_LOAD_PHASES], "total",
+		    KSTAT_DATA_UINT64);
+
+		ksp->ks_lock = &shk->lock;
+		ksp->ks_private = spa;
+		ksp->ks_update = spa_load_times_update;
+		ksp->ks_data = kn;
+		kstat_install(ksp);
+	}
+
+	strfree(name);
+}
+
+static void
+spa_load_times_destroy(spa_t *spa)
+{
+	spa_history_kstat_t *shk = &spa->spa_stats.load_times;
+	kstat_t *ksp = shk->kstat;
+	if (ksp) {
+		kmem_free(ksp->ks_data,
+		    (SPA_LOAD_PHASES + 1) * sizeof (kstat_named_t));
+		kstat_delete(ksp);
+	}
+
+	mutex_destroy(&shk->lock);
+}
+
 void
 spa_stats_init(spa_t *spa)
 {
@@ -999,11 +1091,13 @@ spa_stats_init(spa_t *spa)
 	spa_mmp_history_init(spa);
 	spa_state_init(spa);
 	spa_iostats_init(spa);
+	spa_load_times_init(spa);
 }
 
 void
 spa_stats_destroy(spa_t *spa)
 {
+	spa_load_times_destroy(spa);
 	spa_iostats_destroy(spa);
 	spa_health_destroy(spa);
 	spa_tx_assign_destroy(spa);
@@ -1281,6 +1281,8 @@ zfsvfs_setup(zfsvfs_t *zfsvfs, boolean_t mounting)
 				zil_replay(zfsvfs->z_os, zfsvfs,
 				    zfs_replay_vector);
 				zfsvfs->z_replay = B_FALSE;
+				dataset_kstats_update_zil_replay_kstats(
+				    &zfsvfs->z_kstat, zfsvfs->z_log);
 			}
 		}
 
@@ -1294,6 +1296,7 @@ zfsvfs_setup(zfsvfs_t *zfsvfs, boolean_t mounting)
 	 */
 	mutex_enter(&zfsvfs->z_os->os_user_ptr_lock);
 	dmu_objset_set_user(zfsvfs->z_os, zfsvfs);
+	dmu_objset_set_kstats(zfsvfs->z_os, &zfsvfs->z_kstat);
 	mutex_exit(&zfsvfs->z_os->os_user_ptr_lock);
 
 	return (0);
@@ -1971,6 +1974,7 @@ zfs_umount(struct super_block *sb)
 		 */
 		mutex_enter(&os->os_user_ptr_lock);
 		dmu_objset_set_user(os, NULL);
+		dmu_objset_set_kstats(os, NULL);
 		mutex_exit(&os->os_user_ptr_lock);
 
 		/*
@@ -50,7 +50,9 @@
 #include <sys/zfs_ioctl.h>
 #include <sys/fs/zfs.h>
 #include <sys/dmu.h>
+#include <sys/dmu_impl.h>
 #include <sys/dmu_objset.h>
+#include <sys/abd.h>
 #include <sys/spa.h>
 #include <sys/txg.h>
 #include <sys/dbuf.h>
@@ -69,6 +71,7 @@
 #include <sys/zpl.h>
 #include <sys/zil.h>
 #include <sys/sa_impl.h>
+#include <sys/zfeature.h>
 
 /*
  * Programming rules.
@@ -412,6 +415,56 @@ mappedread(struct inode *ip, int nbytes, uio_t *uio)
 	}
 	return (error);
 }
+
+/*
+ * Returns true if the dataset's direct property asks for I/O on this file
+ * to bypass the ARC.  Mapped files keep using the ARC, which mappedread()
+ * and update_pages() keep coherent with the page cache.
+ */
+static boolean_t
+zfs_direct_wanted(znode_t *zp, uio_t *uio, int ioflag)
+{
+	zfs_direct_t direct = ZTOZSB(zp)->z_os->os_direct;
+
+	if (direct == ZFS_DIRECT_DISABLED || zp->z_is_mapped ||
+	    uio->uio_segflg != UIO_USERSPACE)
+		return (B_FALSE);
+
+	return (direct == ZFS_DIRECT_ALWAYS || (ioflag & O_DIRECT));
+}
+
+/*
+ * Read nbytes of a block aligned range directly into the user's pages,
+ * bypassing the ARC.  Returns EAGAIN if the range can not be read directly,
+ * in which case nothing has been read.
+ */
+static int
+zfs_read_direct(znode_t *zp, uio_t *uio, ssize_t nbytes)
+{
+	struct page **pages;
+	uint_t npages;
+	size_t off;
+	abd_t *abd;
+	int error;
+
+	if (P2PHASE(uio->uio_loffset, zp->z_blksz) != 0 ||
+	    P2PHASE(nbytes, zp->z_blksz) != 0)
+		return (SET_ERROR(EAGAIN));
+
+	if (uio_get_pages(uio, nbytes, UIO_READ, &pages, &npages, &off) != 0)
+		return (SET_ERROR(EAGAIN));
+
+	abd = abd_get_from_pages(pages, npages, off, nbytes);
+	error = dmu_read_direct_dbuf(sa_get_db(zp->z_sa_hdl),
+	    uio->uio_loffset, nbytes, abd);
+	abd_put(abd);
+	uio_put_pages(pages, npages, error == 0);
+
+	if (error == 0)
+		uioskip(uio, nbytes);
+
+	return (error);
+}
 #endif /* _KERNEL */
 
 unsigned long zfs_read_chunk_size = 1024 * 1024; /* Tunable */
@@ -500,6 +553,7 @@ zfs_read(struct inode *ip, uio_t *uio, int ioflag, cred_t *cr)
 	ASSERT(uio->uio_loffset < zp->z_size);
 	ssize_t n = MIN(uio->uio_resid, zp->z_size - uio->uio_loffset);
 	ssize_t start_resid = n;
+	boolean_t direct = zfs_direct_wanted(zp, uio, ioflag);
 
 #ifdef HAVE_UIO_ZEROCOPY
 	xuio_t *xuio = NULL;
@@ -540,8 +594,16 @@ zfs_read(struct inode *ip, uio_t *uio, int ioflag, cred_t *cr)
 		if (zp->z_is_mapped && !(ioflag & O_DIRECT)) {
 			error = mappedread(ip, nbytes, uio);
 		} else {
-			error = dmu_read_uio_dbuf(sa_get_db(zp->z_sa_hdl),
-			    uio, nbytes);
+			error = SET_ERROR(EAGAIN);
+			if (direct) {
+				error = zfs_read_direct(zp, uio, nbytes);
+				dataset_kstats_update_direct_read_kstats(
+				    &zfsvfs->z_kstat, error != EAGAIN);
+			}
+			if (error == EAGAIN) {
+				error = dmu_read_uio_dbuf(
+				    sa_get_db(zp->z_sa_hdl), uio, nbytes);
+			}
 		}
 
 		if (error) {
@@ -734,7 +796,24 @@ zfs_write(struct inode *ip, uio_t *uio, int ioflag, cred_t *cr)
 
 		arc_buf_t *abuf = NULL;
 		const iovec_t *aiov = NULL;
-		if (xuio) {
+		abd_t *dabd = NULL;
+		struct page **pages = NULL;
+		uint_t npages = 0;
+		size_t poff;
+		boolean_t direct = !xuio && zfs_direct_wanted(zp, uio, ioflag);
+
+		if (direct && n >= max_blksz && P2PHASE(woff, max_blksz) == 0 &&
+		    zp->z_blksz == max_blksz &&
+		    uio_get_pages(uio, max_blksz, UIO_WRITE, &pages, &npages,
+		    &poff) == 0) {
+			/*
+			 * This write covers a full block, and the user's
+			 * pages have been pinned so that the block can be
+			 * written from them directly, without a copy.
+			 */
+			dabd = abd_get_from_pages(pages, npages, poff,
+			    max_blksz);
+		} else if (xuio) {
 #ifdef HAVE_UIO_ZEROCOPY
 			ASSERT(i_iov < iovcnt);
 			ASSERT3U(uio->uio_segflg, !=, UIO_BVEC);
@@ -782,6 +861,10 @@ zfs_write(struct inode *ip, uio_t *uio, int ioflag, cred_t *cr)
 			dmu_tx_abort(tx);
 			if (abuf != NULL)
 				dmu_return_arcbuf(abuf);
+			if (dabd != NULL) {
+				abd_put(dabd);
+				uio_put_pages(pages, npages, B_FALSE);
+			}
 			break;
 		}
 
@@ -817,7 +900,36 @@ zfs_write(struct inode *ip, uio_t *uio, int ioflag, cred_t *cr)
 		ssize_t nbytes = MIN(n, max_blksz - P2PHASE(woff, max_blksz));
 
 		ssize_t tx_bytes;
-		if (abuf == NULL) {
+		boolean_t direct_done = B_FALSE;
+		if (dabd != NULL) {
+			/*
+			 * The block is written before the tx is committed.
+			 * EAGAIN means the block could not be written
+			 * directly, e.g. it is encrypted or dedup'd, and
+			 * is written through the ARC below instead.
+			 */
+			error = dmu_write_direct_dbuf(sa_get_db(zp->z_sa_hdl),
+			    woff, dabd, tx);
+			abd_put(dabd);
+			uio_put_pages(pages, npages, B_FALSE);
+			if (error == 0) {
+				direct_done = B_TRUE;
+			} else if (error != EAGAIN) {
+				dmu_tx_commit(tx);
+				break;
+			}
+			error = 0;
+		}
+		if (direct) {
+			dataset_kstats_update_direct_write_kstats(
+			    &zfsvfs->z_kstat, direct_done);
+		}
+
+		if (direct_done) {
+			tx_bytes = nbytes;
+			ASSERT3S(tx_bytes, ==, max_blksz);
+			uioskip(uio, tx_bytes);
+		} else if (abuf == NULL) {
 			tx_bytes = uio->uio_resid;
 			uio->uio_fault_disable = B_TRUE;
 			error = dmu_write_uio_dbuf(sa_get_db(zp->z_sa_hdl),
@@ -920,15 +1032,25 @@ zfs_write(struct inode *ip, uio_t *uio, int ioflag, cred_t *cr)
 		}
 		/*
 		 * If we are replaying and eof is non zero then force
-		 * the file size to the specified eof. Note, there's no
-		 * concurrency during replay.
+		 * the file size to the specified eof. Writes to other
+		 * files may be replayed concurrently, so the eof is
+		 * passed per-thread.
 		 */
-		if (zfsvfs->z_replay && zfsvfs->z_replay_eof != 0)
-			zp->z_size = zfsvfs->z_replay_eof;
+		if (zfsvfs->z_replay) {
+			uint64_t *replay_eof = tsd_get(zfs_replay_eof_key);
+
+			if (replay_eof != NULL && *replay_eof != 0)
+				zp->z_size = *replay_eof;
+		}
 
 		error = sa_bulk_update(zp->z_sa_hdl, bulk, count, tx);
 
-		zfs_log_write(zilog, tx, TX_WRITE, zp, woff, tx_bytes, ioflag,
+		/*
+		 * FDIRECT tells zfs_log_write() the block is already on disk
+		 * and can be logged by reference.
+		 */
+		zfs_log_write(zilog, tx, TX_WRITE, zp, woff, tx_bytes,
+		    direct_done ? (ioflag | FDIRECT) : (ioflag & ~FDIRECT),
 		    NULL, NULL);
 		dmu_tx_commit(tx);
 
@@ -969,6 +1091,295 @@ zfs_write(struct inode *ip, uio_t *uio, int ioflag, cred_t *cr)
 	return (0);
 }
 
+/*
+ * Clone a range of a file into another file, or into another range of the
+ * same file, by making the destination refer to the blocks of the source
+ * instead of copying their data.  The extra references are counted in the
+ * pool's block reference table (BRT), so either file can later be changed
+ * without affecting the other.
+ *
+ * The offsets and the length must be multiples of the source's block size,
+ * except that the range may end at the end of the source file.  The two
+ * files must use the same block size, unless the destination is no larger
+ * than one block, in which case its block size is grown to match.  On
+ * success the offsets are advanced and *lenp is set to the number of bytes
+ * cloned, which is less than requested when the source is shorter.
+ *
+ *	IN:	inip	- inode of the file to clone from.
+ *		inoffp	- offset to clone from.
+ *		outip	- inode of the file to clone into.
+ *		outoffp	- offset to clone into.
+ *		lenp	- number of bytes to clone.
+ *		cr	- credentials of caller.
+ *
+ *	RETURN:	0 on success, error code on failure.  EXDEV, EOPNOTSUPP,
+ *		EINVAL and EAGAIN mean the range could not be cloned and
+ *		should be copied instead.
+ *
+ * Cloned blocks are not logged to the ZIL.  Instead the clone waits for its
+ * txg to sync before returning, which makes it durable and keeps the range
+ * locked until the cloned blocks can be read back through the DMU.
+ *
+ * Timestamps:
+ *	outip - ctime|mtime updated if byte count > 0
+ */
+int
+zfs_clone_range(struct inode *inip, uint64_t *inoffp, struct inode *outip,
+    uint64_t *outoffp, uint64_t *lenp, cred_t *cr)
+{
+	znode_t *inzp = ITOZ(inip);
+	znode_t *outzp = ITOZ(outip);
+	zfsvfs_t *inzfsvfs = ZTOZSB(inzp);
+	zfsvfs_t *outzfsvfs = ZTOZSB(outzp);
+	objset_t *inos, *outos;
+	locked_range_t *inlr, *outlr;
+	uint64_t inoff = *inoffp, outoff = *outoffp, len = *lenp;
+	uint64_t inblksz, done = 0, txg = 0;
+	boolean_t grow = B_FALSE, waited = B_FALSE;
+	blkptr_t *bps;
+	size_t maxblocks, nbps;
+	int error = 0;
+
+	sa_bulk_attr_t bulk[4];
+	int count = 0;
+	uint64_t mtime[2], ctime[2];
+
+	ZFS_ENTER(inzfsvfs);
+	ZFS_VERIFY_ZP(inzp);
+	if (outzfsvfs != inzfsvfs) {
+		rrm_enter_read(&outzfsvfs->z_teardown_lock, FTAG);
+		if (outzfsvfs->z_unmounted) {
+			error = SET_ERROR(EIO);
+			goto out_exit;
+		}
+	}
+	if (outzp->z_sa_hdl == NULL) {
+		error = SET_ERROR(EIO);
+		goto out_exit;
+	}
+
+	inos = inzfsvfs->z_os;
+	outos = outzfsvfs->z_os;
+
+	if (dmu_objset_spa(inos) != dmu_objset_spa(outos)) {
+		error = SET_ERROR(EXDEV);
+		goto out_exit;
+	}
+	if (!spa_feature_is_enabled(dmu_objset_spa(outos),
+	    SPA_FEATURE_BLOCK_CLONING) ||
+	    inos->os_encrypted || outos->os_encrypted) {
+		error = SET_ERROR(EOPNOTSUPP);
+		goto out_exit;
+	}
+	if (zfs_is_readonly(outzfsvfs)) {
+		error = SET_ERROR(EROFS);
+		goto out_exit;
+	}
+	if (outzp->z_pflags & (ZFS_IMMUTABLE | ZFS_READONLY | ZFS_APPENDONLY)) {
+		error = SET_ERROR(EPERM);
+		goto out_exit;
+	}
+	if (inzp == outzp && inoff < outoff + len && outoff < inoff + len) {
+		error = SET_ERROR(EINVAL);
+		goto out_exit;
+	}
+	if (len == 0)
+		goto out_exit;
+
+	/*
+	 * Lock the ranges in a consistent order, so that two clones going
+	 * in opposite directions between the same files can't deadlock.
+	 * Within one file a single lock covers both ranges, since the
+	 * writer's range may be widened to the whole file.  The source size
+	 * can't change while its range is locked.
+	 */
+	if (inzp == outzp) {
+		uint64_t start = MIN(inoff, outoff);
+
+		inlr = NULL;
+		outlr = rangelock_enter(&outzp->z_rangelock, start,
+		    MAX(inoff, outoff) + len - start, RL_WRITER);
+	} else if (inzp < outzp) {
+		inlr = rangelock_enter(&inzp->z_rangelock, inoff, len,
+		    RL_READER);
+		outlr = rangelock_enter(&outzp->z_rangelock, outoff, len,
+		    RL_WRITER);
+	} else {
+		outlr = rangelock_enter(&outzp->z_rangelock, outoff, len,
+		    RL_WRITER);
+		inlr = rangelock_enter(&inzp->z_rangelock, inoff, len,
+		    RL_READER);
+	}
+
+	if (inoff >= inzp->z_size)
+		goto out_unlock;
+	len = MIN(len, inzp->z_size - inoff);
+
+	if (outoff + len > MAXOFFSET_T) {
+		error = SET_ERROR(EFBIG);
+		goto out_unlock;
+	}
+
+	/*
+	 * A destination of at most one block can take on the block size of
+	 * the source, as long as the block size is one the destination
+	 * dataset could have created itself.
+	 */
+	inblksz = inzp->z_blksz;
+	if (inblksz != outzp->z_blksz) {
+		if (inblksz < outzp->z_blksz ||
+		    outzp->z_size > outzp->z_blksz ||
+		    outlr->lr_length != UINT64_MAX ||
+		    (inzfsvfs != outzfsvfs &&
+		    inblksz > outzfsvfs->z_max_blksz)) {
+			error = SET_ERROR(EINVAL);
+			goto out_unlock;
+		}
+		grow = B_TRUE;
+	}
+
+	/*
+	 * Whole blocks are cloned, so a range ending in the middle of the
+	 * source's last block must also cover the end of the destination.
+	 * A block size which is not a power of two means a file of a single
+	 * block, which can only be cloned to the start of another.
+	 */
+	if (inoff % inblksz != 0 || outoff % inblksz != 0 ||
+	    (len % inblksz != 0 &&
+	    (inoff + len != inzp->z_size || outoff + len < outzp->z_size)) ||
+	    (!ISP2(inblksz) && outoff != 0)) {
+		error = SET_ERROR(EINVAL);
+		goto out_unlock;
+	}
+
+	SA_ADD_BULK_ATTR(bulk, count, SA_ZPL_MTIME(outzfsvfs), NULL, &mtime, 16);
+	SA_ADD_BULK_ATTR(bulk, count, SA_ZPL_CTIME(outzfsvfs), NULL, &ctime, 16);
+	SA_ADD_BULK_ATTR(bulk, count, SA_ZPL_SIZE(outzfsvfs), NULL,
+	    &outzp->z_size, 8);
+	SA_ADD_BULK_ATTR(bulk, count, SA_ZPL_FLAGS(outzfsvfs), NULL,
+	    &outzp->z_pflags, 8);
+
+	maxblocks = MAX(DMU_MAX_ACCESS / 2 / inblksz, 1);
+	bps = kmem_alloc(sizeof (blkptr_t) * maxblocks, KM_SLEEP);
+
+	while (len > 0) {
+		uint64_t size = MIN(len, maxblocks * inblksz);
+		uint64_t end_size;
+
+		if (zfs_id_overblockquota(outzfsvfs, DMU_USERUSED_OBJECT,
+		    KUID_TO_SUID(outip->i_uid)) ||
+		    zfs_id_overblockquota(outzfsvfs, DMU_GROUPUSED_OBJECT,
+		    KGID_TO_SGID(outip->i_gid)) ||
+		    (outzp->z_projid != ZFS_DEFAULT_PROJID &&
+		    zfs_id_overblockquota(outzfsvfs, DMU_PROJECTUSED_OBJECT,
+		    outzp->z_projid))) {
+			error = SET_ERROR(EDQUOT);
+			break;
+		}
+
+		/*
+		 * Blocks which are dirty on either side have no block
+		 * pointer to clone yet; let them sync once and try again.
+		 */
+		error = dmu_read_l0_bps(inos, inzp->z_id, inoff, size, bps,
+		    &nbps);
+		if (error == EAGAIN && !waited) {
+			txg_wait_synced(dmu_objset_pool(inos), 0);
+			waited = B_TRUE;
+			continue;
+		} else if (error != 0) {
+			break;
+		}
+
+		dmu_tx_t *tx = dmu_tx_create(outos);
+		dmu_tx_hold_sa(tx, outzp->z_sa_hdl, B_FALSE);
+		dmu_tx_hold_write(tx, outzp->z_id, outoff, size);
+		zfs_sa_upgrade_txholds(tx, outzp);
+		error = dmu_tx_assign(tx, TXG_WAIT);
+		if (error != 0) {
+			dmu_tx_abort(tx);
+			break;
+		}
+
+		if (grow) {
+			zfs_grow_blocksize(outzp, inblksz, tx);
+			grow = B_FALSE;
+		}
+
+		error = dmu_brt_clone(outos, outzp->z_id, outoff, size, tx,
+		    bps, nbps);
+		if (error != 0) {
+			dmu_tx_commit(tx);
+			if (error == EAGAIN && !waited) {
+				txg_wait_synced(dmu_objset_pool(outos), 0);
+				waited = B_TRUE;
+				continue;
+			}
+			break;
+		}
+
+		zfs_tstamp_update_setup(outzp, CONTENT_MODIFIED, mtime, ctime);
+
+		/*
+		 * Update the file size (zp_size) if it has changed;
+		 * account for possible concurrent updates.
+		 */
+		while ((end_size = outzp->z_size) < outoff + size) {
+			(void) atomic_cas_64(&outzp->z_size, end_size,
+			    outoff + size);
+		}
+
+		error = sa_bulk_update(outzp->z_sa_hdl, bulk, count, tx);
+
+		txg = dmu_tx_get_txg(tx);
+		dmu_tx_commit(tx);
+
+		if (error != 0)
+			break;
+
+		inoff += size;
+		outoff += size;
+		len -= size;
+		done += size;
+		waited = B_FALSE;
+	}
+
+	kmem_free(bps, sizeof (blkptr_t) * maxblocks);
+
+	if (done > 0) {
+		txg_wait_synced(dmu_objset_pool(outos), txg);
+
+		/*
+		 * Drop any cached pages of the destination, which now has
+		 * the contents of the source.
+		 */
+		if (outzp->z_is_mapped) {
+			truncate_inode_pages_range(outip->i_mapping,
+			    *outoffp, *outoffp + done - 1);
+		}
+		zfs_inode_update(outzp);
+	}
+
+out_unlock:
+	rangelock_exit(outlr);
+	if (inlr != NULL)
+		rangelock_exit(inlr);
+out_exit:
+	if (outzfsvfs != inzfsvfs)
+		rrm_exit(&outzfsvfs->z_teardown_lock, FTAG);
+	ZFS_EXIT(inzfsvfs);
+
+	/* A partial clone is successful. */
+	if (done > 0) {
+		*inoffp += done;
+		*outoffp += done;
+		error = 0;
+	}
+	*lenp = done;
+
+	return (error);
+}
+
 /*
  * Drop a reference on the passed inode asynchronously. This ensures
  * that the caller will never drop the last reference on an inode in
@@ -1098,9 +1509,14 @@ zfs_get_data(void *arg, lr_write_t *lr, char *buf, struct lwb *lwb, zio_t *zio)
 			zil_fault_io = 0;
 		}
 #endif
+		/*
+		 * The data is not needed unless the block has to be written
+		 * by dmu_sync(), which reads it if the dbuf has none; a
+		 * directly written block is already on disk.
+		 */
 		if (error == 0)
-			error = dmu_buf_hold(os, object, offset, zgd, &db,
-			    DMU_READ_NO_PREFETCH);
+			error = dmu_buf_hold_noread(os, object, offset, zgd,
+			    &db);
 
 		if (error == 0) {
 			blkptr_t *bp = &lr->lr_blkptr;
@@ -2236,6 +2652,57 @@ out:
 	return (error);
 }
 
+/*
+ * Number of directory entries past the one being returned whose dnodes
+ * zfs_readdir() prefetches, so that the stat() calls which usually follow
+ * a listing find them cached.  Zero limits the prefetch to the entries
+ * which are returned.
+ */
+int zfs_readdir_prefetch_entries = 256;
+
+/*
+ * Advance the prefetch cursor pzc until it is zfs_readdir_prefetch_entries
+ * entries ahead of the readdir cursor, and issue an asynchronous prefetch
+ * of each dnode block it passes.  Entries are usually allocated together,
+ * so consecutive ones often share a dnode block, which is only prefetched
+ * once.  Returns B_FALSE once pzc reaches the end of the directory.
+ */
+static boolean_t
+zfs_readdir_prefetch(objset_t *os, zap_cursor_t *pzc, int *aheadp,
+    uint64_t *lastblkp)
+{
+	zap_attribute_t *za;
+	uint64_t objnum, blk;
+	boolean_t more = B_TRUE;
+
+	if (*aheadp >= zfs_readdir_prefetch_entries)
+		return (B_TRUE);
+
+	za = kmem_alloc(sizeof (zap_attribute_t), KM_SLEEP);
+	while (*aheadp < zfs_readdir_prefetch_entries) {
+		if (zap_cursor_retrieve(pzc, za) != 0) {
+			more = B_FALSE;
+			break;
+		}
+
+		if (za->za_integer_length == 8 && za->za_num_integers != 0) {
+			objnum = ZFS_DIRENT_OBJ(za->za_first_integer);
+			blk = objnum >> DNODES_PER_BLOCK_SHIFT;
+			if (blk != *lastblkp) {
+				dmu_prefetch(os, objnum, 0, 0, 0,
+				    ZIO_PRIORITY_ASYNC_READ);
+				*lastblkp = blk;
+			}
+		}
+
+		zap_cursor_advance(pzc);
+		(*aheadp)++;
+	}
+	kmem_free(za, sizeof (zap_attribute_t));
+
+	return (more);
+}
+
 /*
  * Read directory entries from the given directory cursor position and emit
  * name and position for each entry.
@@ -2263,9 +2730,14 @@ zfs_readdir(struct inode *ip, zpl_dir_context_t *ctx, cred_t *cr)
 	zfsvfs_t	*zfsvfs = ITOZSB(ip);
 	objset_t	*os;
 	zap_cursor_t	zc;
+	zap_cursor_t	pzc;
 	zap_attribute_t	zap;
 	int		error;
 	uint8_t		prefetch;
+	boolean_t	prefetch_cursor = B_FALSE;
+	boolean_t	prefetch_ahead = B_FALSE;
+	int		ahead = 0;
+	uint64_t	lastblk = UINT64_MAX;
 	uint8_t		type;
 	int		done = 0;
 	uint64_t	parent;
@@ -2304,6 +2776,18 @@ zfs_readdir(struct inode *ip, zpl_dir_context_t *ctx, cred_t *cr)
 		zap_cursor_init_serialized(&zc, os, zp->z_id, offset);
 	}
 
+	/*
+	 * A second cursor runs ahead of zc to prefetch the dnodes of the
+	 * entries a following call is likely to return.
+	 */
+	if (prefetch && zfs_readdir_prefetch_entries > 0) {
+		if (offset <= 3)
+			zap_cursor_init_noprefetch(&pzc, os, zp->z_id);
+		else
+			zap_cursor_init_serialized(&pzc, os, zp->z_id, offset);
+		prefetch_cursor = prefetch_ahead = B_TRUE;
+	}
+
 	/*
 	 * Transform to file-system independent format
 	 */
@@ -2377,6 +2861,11 @@ zfs_readdir(struct inode *ip, zpl_dir_context_t *ctx, cred_t *cr)
 		 * Move to the next entry, fill in the previous offset.
 		 */
 		if (offset > 2 || (offset == 2 && !zfs_show_ctldir(zp))) {
+			if (prefetch_ahead) {
+				prefetch_ahead = zfs_readdir_prefetch(os, &pzc,
+				    &ahead, &lastblk);
+				ahead--;
+			}
 			zap_cursor_advance(&zc);
 			offset = zap_cursor_serialize(&zc);
 		} else {
@@ -2384,9 +2873,18 @@ zfs_readdir(struct inode *ip, zpl_dir_context_t *ctx, cred_t *cr)
 		}
 		ctx->pos = offset;
 	}
-	zp->z_zn_prefetch = B_FALSE; /* a lookup will re-enable pre-fetching */
+
+	/*
+	 * Keep prefetching until the listing reaches the end of the
+	 * directory, since ls -l and rsync only stat the entries after
+	 * reading all of them.  A lookup will re-enable pre-fetching.
+	 */
+	if (!done)
+		zp->z_zn_prefetch = B_FALSE;
 
 update:
+	if (prefetch_cursor)
+		zap_cursor_fini(&pzc);
 	zap_cursor_fini(&zc);
 	if (error == ENOENT)
 		error = 0;
@@ -4745,6 +5243,112 @@ zfs_seek(struct inode *ip, offset_t ooff, offset_t *noffp)
 	return ((*noffp < 0 || *noffp > MAXOFFSET_T) ? EINVAL : 0);
 }
 
+/*
+ * Read page faults into the page cache without caching the data in the
+ * ARC as well.
+ */
+int zfs_mmap_direct = 0;
+
+/*
+ * Fill pp, and the other pages of the block which holds it, directly from
+ * disk, so that the page cache ends up with the only copy of the block.
+ * dmu_read_direct_dbuf() reads the block into a buffer of its own and only
+ * copies it to the pages once its checksum was verified, so a failed read
+ * never leaves partial data in them.  Pages of the block which are already
+ * cached, or which can not be locked without waiting, are read into
+ * scratch pages and left alone.  Returns
+ * EAGAIN if the block can not be read this way, in which case pp has not
+ * been filled.
+ */
+static int
+zfs_fillpage_direct(znode_t *zp, struct page *pp)
+{
+	struct address_space *mp = ZTOI(zp)->i_mapping;
+	uint64_t blksz = zp->z_blksz;
+	loff_t i_size = i_size_read(ZTOI(zp));
+	struct page **pages;
+	boolean_t *scratch;
+	uint_t npages, i;
+	pgoff_t first;
+	abd_t *abd;
+	int error = 0;
+
+	if (!zfs_mmap_direct || !ISP2(blksz) || blksz < PAGE_SIZE)
+		return (SET_ERROR(EAGAIN));
+
+	npages = blksz >> PAGE_SHIFT;
+	first = P2ALIGN(pp->index, (pgoff_t)npages);
+	pages = kmem_alloc(npages * sizeof (struct page *), KM_SLEEP);
+	scratch = kmem_zalloc(npages * sizeof (boolean_t), KM_SLEEP);
+
+	for (i = 0; i < npages; i++) {
+		pgoff_t index = first + i;
+		struct page *cur_pp = NULL;
+
+		if (index == pp->index) {
+			pages[i] = pp;
+			continue;
+		}
+
+		if (((loff_t)index << PAGE_SHIFT) < i_size &&
+		    (cur_pp = grab_cache_page_nowait(mp, index)) != NULL &&
+		    PageUptodate(cur_pp)) {
+			unlock_page(cur_pp);
+			put_page(cur_pp);
+			cur_pp = NULL;
+		}
+
+		if (cur_pp == NULL) {
+			cur_pp = alloc_page(GFP_KERNEL);
+			if (cur_pp == NULL) {
+				error = SET_ERROR(EAGAIN);
+				npages = i;
+				break;
+			}
+			scratch[i] = B_TRUE;
+		}
+		pages[i] = cur_pp;
+	}
+
+	if (error == 0) {
+		abd = abd_get_from_pages(pages, npages, 0, blksz);
+		error = dmu_read_direct_dbuf(sa_get_db(zp->z_sa_hdl),
+		    (uint64_t)first << PAGE_SHIFT, blksz, abd);
+		abd_put(abd);
+	}
+
+	/*
+	 * The caller unlocks pp.  The other pages are left in the page cache
+	 * even if the read failed, and are then read again when faulted.
+	 */
+	for (i = 0; i < npages; i++) {
+		if (pages[i] == pp)
+			continue;
+
+		if (scratch[i]) {
+			__free_page(pages[i]);
+			continue;
+		}
+
+		if (error == 0) {
+			flush_dcache_page(pages[i]);
+			SetPageUptodate(pages[i]);
+		}
+		unlock_page(pages[i]);
+		put_page(pages[i]);
+	}
+
+	kmem_free(scratch, (blksz >> PAGE_SHIFT) * sizeof (boolean_t));
+	kmem_free(pages, (blksz >> PAGE_SHIFT) * sizeof (struct page *));
+
+	if (error == 0) {
+		dataset_kstats_update_mmap_direct_kstats(
+		    &ZTOZSB(zp)->z_kstat, blksz);
+	}
+
+	return (error);
+}
+
 /*
  * Fill pages with data from the disk.
  */
@@ -4769,6 +5373,16 @@ zfs_fillpage(struct inode *ip, struct page *pl[], int nr_pages)
 	if (io_off + io_len > i_size)
 		io_len = i_size - io_off;
 
+	if (nr_pages == 1) {
+		err = zfs_fillpage_direct(zp, pl[0]);
+		if (err != EAGAIN) {
+			/* convert checksum errors into IO errors */
+			if (err == ECKSUM)
+				err = SET_ERROR(EIO);
+			return (err);
+		}
+	}
+
 	/*
 	 * Iterate over list of pages and read each page individually.
 	 */
@@ -5265,6 +5879,12 @@ module_param(zfs_delete_blocks, ulong, 0644);
 MODULE_PARM_DESC(zfs_delete_blocks, "Delete files larger than N blocks async");
 module_param(zfs_read_chunk_size, ulong, 0644);
 MODULE_PARM_DESC(zfs_read_chunk_size, "Bytes to read per chunk");
+module_param(zfs_mmap_direct, int, 0644);
+MODULE_PARM_DESC(zfs_mmap_direct,
+	"Read page faults into the page cache without caching them in the ARC");
+module_param(zfs_readdir_prefetch_entries, int, 0644);
+MODULE_PARM_DESC(zfs_readdir_prefetch_entries,
+	"Directory entries to prefetch dnodes for ahead of readdir");
 /* END CSTYLED */
 
 #endif
@@ -630,7 +630,8 @@ zpl_mmap(struct file *filp, struct vm_area_struct *vma)
 /*
  * Populate a page with data for the Linux page cache.  This function is
  * only used to support mmap(2).  There will be an identical copy of the
- * data in the ARC which is kept up to date via .write() and .writepage().
+ * data in the ARC which is kept up to date via .write() and .writepage(),
+ * unless zfs_mmap_direct is set, see zfs_fillpage().
  *
  * Current this function relies on zpl_read_common() and the O_DIRECT
  * flag to read in a page.  This works but the more correct way is to
@@ -814,6 +815,139 @@ zpl_fallocate(struct file *filp, int mode, loff_t offset, loff_t len)
 }
 #endif /* HAVE_FILE_FALLOCATE */
 
+#if defined(HAVE_VFS_COPY_FILE_RANGE) || \
+	defined(HAVE_VFS_CLONE_FILE_RANGE) || \
+	defined(HAVE_VFS_REMAP_FILE_RANGE)
+/*
+ * Clone a range of blocks with zfs_clone_range().  Dirty pages of both
+ * files are written back first, so that the source blocks are current
+ * and nothing is later written back over the cloned range.
+ */
+static int
+zpl_clone_file_range_impl(struct file *src_file, loff_t src_off,
+    struct file *dst_file, loff_t dst_off, uint64_t *lenp)
+{
+	struct inode *src_i = file_inode(src_file);
+	struct inode *dst_i = file_inode(dst_file);
+	uint64_t src_off_u = src_off, dst_off_u = dst_off;
+	cred_t *cr = CRED();
+	fstrans_cookie_t cookie;
+	int error;
+
+	if (src_off < 0 || dst_off < 0)
+		return (-EINVAL);
+
+	if (*lenp == 0)
+		return (0);
+
+	error = filemap_write_and_wait_range(src_i->i_mapping, src_off,
+	    MIN(src_off + *lenp, LLONG_MAX) - 1);
+	if (error == 0) {
+		error = filemap_write_and_wait_range(dst_i->i_mapping,
+		    dst_off, MIN(dst_off + *lenp, LLONG_MAX) - 1);
+	}
+	if (error != 0)
+		return (error);
+
+	crhold(cr);
+	cookie = spl_fstrans_mark();
+	error = -zfs_clone_range(src_i, &src_off_u, dst_i, &dst_off_u, lenp,
+	    cr);
+	spl_fstrans_unmark(cookie);
+	crfree(cr);
+
+	ASSERT3S(error, <=, 0);
+	return (error);
+}
+#endif
+
+#ifdef HAVE_VFS_COPY_FILE_RANGE
+/*
+ * copy_file_range(2) clones the range when it can, and otherwise falls
+ * back to copying it.
+ */
+static ssize_t
+zpl_copy_file_range(struct file *src_file, loff_t src_off,
+    struct file *dst_file, loff_t dst_off, size_t len, unsigned int flags)
+{
+	uint64_t clen = len;
+	int error;
+
+	if (flags != 0)
+		return (-EINVAL);
+
+	error = zpl_clone_file_range_impl(src_file, src_off,
+	    dst_file, dst_off, &clen);
+
+	if (error == -EINVAL || error == -EXDEV || error == -EAGAIN ||
+	    error == -EOPNOTSUPP) {
+#ifdef HAVE_VFS_GENERIC_COPY_FILE_RANGE
+		return (generic_copy_file_range(src_file, src_off,
+		    dst_file, dst_off, len, flags));
+#else
+		/* Let the VFS fall back to splicing the data. */
+		return (-EOPNOTSUPP);
+#endif
+	}
+	if (error != 0)
+		return (error);
+
+	return (clen);
+}
+#endif /* HAVE_VFS_COPY_FILE_RANGE */
+
+#ifdef HAVE_VFS_REMAP_FILE_RANGE
+/*
+ * FICLONE and FICLONERANGE.  Deduplication (FIDEDUPERANGE) is not
+ * supported.
+ */
+static loff_t
+zpl_remap_file_range(struct file *src_file, loff_t src_off,
+    struct file *dst_file, loff_t dst_off, loff_t len, unsigned int flags)
+{
+	uint64_t clen;
+	int error;
+
+	if (flags & REMAP_FILE_DEDUP)
+		return (-EOPNOTSUPP);
+
+	if (flags & ~(REMAP_FILE_CAN_SHORTEN | REMAP_FILE_ADVISORY))
+		return (-EINVAL);
+
+	/* A zero length means to the end of the source. */
+	if (len == 0)
+		len = MAX(i_size_read(file_inode(src_file)) - src_off, 0);
+
+	clen = len;
+	error = zpl_clone_file_range_impl(src_file, src_off,
+	    dst_file, dst_off, &clen);
+	if (error != 0)
+		return (error);
+
+	return (clen);
+}
+#endif /* HAVE_VFS_REMAP_FILE_RANGE */
+
+#if defined(HAVE_VFS_CLONE_FILE_RANGE) && !defined(HAVE_VFS_REMAP_FILE_RANGE)
+/*
+ * FICLONE and FICLONERANGE, before 4.20.
+ */
+static int
+zpl_clone_file_range(struct file *src_file, loff_t src_off,
+    struct file *dst_file, loff_t dst_off, u64 len)
+{
+	uint64_t clen;
+
+	/* A zero length means to the end of the source. */
+	if (len == 0)
+		len = MAX(i_size_read(file_inode(src_file)) - src_off, 0);
+
+	clen = len;
+	return (zpl_clone_file_range_impl(src_file, src_off,
+	    dst_file, dst_off, &clen));
+}
+#endif /* HAVE_VFS_CLONE_FILE_RANGE && !HAVE_VFS_REMAP_FILE_RANGE */
+
 #define	ZFS_FL_USER_VISIBLE	(FS_FL_USER_VISIBLE | ZFS_PROJINHERIT_FL)
 #define	ZFS_FL_USER_MODIFIABLE	(FS_FL_USER_MODIFIABLE | ZFS_PROJINHERIT_FL)
 
@@ -1051,6 +1185,14 @@ const struct file_operations zpl_file_operations = {
 #ifdef HAVE_FILE_FALLOCATE
 	.fallocate	= zpl_fallocate,
 #endif /* HAVE_FILE_FALLOCATE */
+#ifdef HAVE_VFS_COPY_FILE_RANGE
+	.copy_file_range	= zpl_copy_file_range,
+#endif
+#if defined(HAVE_VFS_REMAP_FILE_RANGE)
+	.remap_file_range	= zpl_remap_file_range,
+#elif defined(HAVE_VFS_CLONE_FILE_RANGE)
+	.clone_file_range	= zpl_clone_file_range,
+#endif
 	.unlocked_ioctl	= zpl_ioctl,
 #ifdef CONFIG_COMPAT
 	.compat_ioctl	= zpl_compat_ioctl,
@@ -91,6 +91,9 @@
 
 #include <linux/blkdev_compat.h>
 #include <linux/task_io_accounting_ops.h>
+#ifdef HAVE_BLK_MQ
+#include <linux/blk-mq.h>
+#endif
 
 unsigned int zvol_inhibit_dev = 0;
 unsigned int zvol_major = ZVOL_MAJOR;
@@ -99,8 +102,27 @@ unsigned int zvol_request_sync = 0;
 unsigned int zvol_prefetch_bytes = (128 * 1024);
 unsigned long zvol_max_discard_blocks = 16384;
 unsigned int zvol_volmode = ZFS_VOLMODE_GEOM;
+unsigned int zvol_use_blk_mq = 0;
+unsigned int zvol_blk_mq_queues = 0;
+unsigned int zvol_blk_mq_queue_depth = 128;
+
+/*
+ * Reads of up to this many bytes which are entirely cached are completed
+ * directly from zvol_queue_rq() rather than being handed to a taskq.
+ */
+#define	ZVOL_INLINE_READ_MAX	(1024 * 1024)
 
 static taskq_t *zvol_taskq;
+#ifdef HAVE_BLK_MQ
+/*
+ * When zvol_use_blk_mq is set each zvol's request queue has one hardware
+ * context per entry of zvol_blk_mq_taskqs, and requests submitted on a
+ * hardware context are executed by the matching taskq.  This keeps
+ * submitters on different CPUs from contending on a single taskq.
+ */
+static taskq_t **zvol_blk_mq_taskqs;
+static uint_t zvol_blk_mq_nqueues;
+#endif
 static krwlock_t zvol_state_lock;
 static list_t zvol_state_list;
 
@@ -110,6 +132,44 @@ static struct hlist_head *zvol_htable;
 
 static struct ida zvol_ida;
 
+/*
+ * Per-zvol request statistics.  queue_depth is the number of requests which
+ * have been accepted from the block layer but not yet completed, and the
+ * read and write time counters accumulate the time from acceptance to
+ * completion, so the mean latency is the time divided by the request count.
+ * inline_reads and merged_bios are only updated by the blk-mq request path.
+ */
+typedef struct zvol_kstat_values {
+	kstat_named_t	zkv_queue_depth;
+	kstat_named_t	zkv_reads;
+	kstat_named_t	zkv_read_time_us;
+	kstat_named_t	zkv_writes;
+	kstat_named_t	zkv_write_time_us;
+	kstat_named_t	zkv_inline_reads;
+	kstat_named_t	zkv_merged_bios;
+} zvol_kstat_values_t;
+
+typedef struct zvol_kstats {
+	aggsum_t	zks_queue_depth;
+	aggsum_t	zks_reads;
+	aggsum_t	zks_read_time;
+	aggsum_t	zks_writes;
+	aggsum_t	zks_write_time;
+	aggsum_t	zks_inline_reads;
+	aggsum_t	zks_merged_bios;
+	kstat_t		*zks_kstat;
+} zvol_kstats_t;
+
+static zvol_kstat_values_t empty_zvol_kstats = {
+	{ "queue_depth",	KSTAT_DATA_UINT64 },
+	{ "reads",		KSTAT_DATA_UINT64 },
+	{ "read_time_us",	KSTAT_DATA_UINT64 },
+	{ "writes",		KSTAT_DATA_UINT64 },
+	{ "write_time_us",	KSTAT_DATA_UINT64 },
+	{ "inline_reads",	KSTAT_DATA_UINT64 },
+	{ "merged_bios",	KSTAT_DATA_UINT64 },
+};
+
 /*
  * The in-core state of each volume.
  */
@@ -128,6 +188,11 @@ struct zvol_state {
 	struct gendisk		*zv_disk;	/* generic disk */
 	struct request_queue	*zv_queue;	/* request queue */
 	dataset_kstats_t	zv_kstat;	/* zvol kstats */
+	zvol_kstats_t		zv_io_kstats;	/* request queue kstats */
+	boolean_t		zv_blk_mq;	/* blk-mq request queue */
+#ifdef HAVE_BLK_MQ
+	struct blk_mq_tag_set	zv_tag_set;	/* blk-mq tag set */
+#endif
 	list_node_t		zv_next;	/* next zvol_state_t linkage */
 	uint64_t		zv_hash;	/* name hash */
 	struct hlist_node	zv_hlink;	/* hash link */
@@ -717,10 +782,122 @@ zvol_log_write(zvol_state_t *zv, dmu_tx_t *tx, uint64_t offset,
 	}
 }
 
+static int
+zvol_kstats_update(kstat_t *ksp, int rw)
+{
+	zvol_kstats_t *zks = ksp->ks_private;
+	zvol_kstat_values_t *zkv = ksp->ks_data;
+
+	if (rw == KSTAT_WRITE)
+		return (EACCES);
+
+	zkv->zkv_queue_depth.value.ui64 =
+	    aggsum_value(&zks->zks_queue_depth);
+	zkv->zkv_reads.value.ui64 = aggsum_value(&zks->zks_reads);
+	zkv->zkv_read_time_us.value.ui64 =
+	    NSEC2USEC(aggsum_value(&zks->zks_read_time));
+	zkv->zkv_writes.value.ui64 = aggsum_value(&zks->zks_writes);
+	zkv->zkv_write_time_us.value.ui64 =
+	    NSEC2USEC(aggsum_value(&zks->zks_write_time));
+	zkv->zkv_inline_reads.value.ui64 =
+	    aggsum_value(&zks->zks_inline_reads);
+	zkv->zkv_merged_bios.value.ui64 =
+	    aggsum_value(&zks->zks_merged_bios);
+
+	return (0);
+}
+
+/*
+ * The request statistics of a zvol are exported as zfs/<pool>/zvol-<objset>,
+ * next to the objset-<objset> dataset kstat of the same volume.
+ */
+static void
+zvol_kstats_create(zvol_kstats_t *zks, objset_t *os)
+{
+	char kstat_module_name[KSTAT_STRLEN];
+	char kstat_name[KSTAT_STRLEN];
+
+	aggsum_init(&zks->zks_queue_depth, 0);
+	aggsum_init(&zks->zks_reads, 0);
+	aggsum_init(&zks->zks_read_time, 0);
+	aggsum_init(&zks->zks_writes, 0);
+	aggsum_init(&zks->zks_write_time, 0);
+	aggsum_init(&zks->zks_inline_reads, 0);
+	aggsum_init(&zks->zks_merged_bios, 0);
+
+	if (snprintf(kstat_module_name, sizeof (kstat_module_name), "zfs/%s",
+	    spa_name(dmu_objset_spa(os))) >= KSTAT_STRLEN)
+		return;
+	(void) snprintf(kstat_name, sizeof (kstat_name), "zvol-0x%llx",
+	    (unsigned long long)dmu_objset_id(os));
+
+	kstat_t *ksp = kstat_create(kstat_module_name, 0, kstat_name, "zvol",
+	    KSTAT_TYPE_NAMED,
+	    sizeof (empty_zvol_kstats) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+	if (ksp == NULL)
+		return;
+
+	zvol_kstat_values_t *zkv = kmem_alloc(sizeof (empty_zvol_kstats),
+	    KM_SLEEP);
+	bcopy(&empty_zvol_kstats, zkv, sizeof (empty_zvol_kstats));
+
+	ksp->ks_data = zkv;
+	ksp->ks_update = zvol_kstats_update;
+	ksp->ks_private = zks;
+	kstat_install(ksp);
+	zks->zks_kstat = ksp;
+}
+
+static void
+zvol_kstats_destroy(zvol_kstats_t *zks)
+{
+	if (zks->zks_kstat != NULL) {
+		kmem_free(zks->zks_kstat->ks_data, sizeof (empty_zvol_kstats));
+		kstat_delete(zks->zks_kstat);
+		zks->zks_kstat = NULL;
+	}
+
+	aggsum_fini(&zks->zks_queue_depth);
+	aggsum_fini(&zks->zks_reads);
+	aggsum_fini(&zks->zks_read_time);
+	aggsum_fini(&zks->zks_writes);
+	aggsum_fini(&zks->zks_write_time);
+	aggsum_fini(&zks->zks_inline_reads);
+	aggsum_fini(&zks->zks_merged_bios);
+}
+
+/*
+ * Account for a request accepted from the block layer, returning the time
+ * which must be passed to zvol_kstats_done() when it completes.
+ */
+static hrtime_t
+zvol_kstats_start(zvol_kstats_t *zks)
+{
+	aggsum_add(&zks->zks_queue_depth, 1);
+	return (gethrtime());
+}
+
+static void
+zvol_kstats_done(zvol_kstats_t *zks, int rw, hrtime_t start)
+{
+	hrtime_t delta = gethrtime() - start;
+
+	if (rw == WRITE) {
+		aggsum_add(&zks->zks_writes, 1);
+		aggsum_add(&zks->zks_write_time, delta);
+	} else {
+		aggsum_add(&zks->zks_reads, 1);
+		aggsum_add(&zks->zks_read_time, delta);
+	}
+	aggsum_add(&zks->zks_queue_depth, -1);
+}
+
 typedef struct zv_request {
 	zvol_state_t	*zv;
 	struct bio	*bio;
 	locked_range_t	*lr;
+	hrtime_t	start;
 } zv_request_t;
 
 static void
@@ -735,32 +912,19 @@ uio_from_bio(uio_t *uio, struct bio *bio)
 	uio->uio_skip = BIO_BI_SKIP(bio);
 }
 
-static void
-zvol_write(void *arg)
+/*
+ * Copy the uio into the volume, stopping at the end of the volume.  The
+ * caller holds zv_suspend_lock and a writer range lock covering the uio.
+ */
+static int
+zvol_write_uio(zvol_state_t *zv, uio_t *uio, boolean_t sync)
 {
+	uint64_t volsize = zv->zv_volsize;
 	int error = 0;
 
-	zv_request_t *zvr = arg;
-	struct bio *bio = zvr->bio;
-	uio_t uio = { { 0 }, 0 };
-	uio_from_bio(&uio, bio);
-
-	zvol_state_t *zv = zvr->zv;
-	ASSERT(zv && zv->zv_open_count > 0);
-	ASSERT(zv->zv_zilog != NULL);
-
-	ssize_t start_resid = uio.uio_resid;
-	unsigned long start_jif = jiffies;
-	blk_generic_start_io_acct(zv->zv_queue, WRITE, bio_sectors(bio),
-	    &zv->zv_disk->part0);
-
-	boolean_t sync =
-	    bio_is_fua(bio) || zv->zv_objset->os_sync == ZFS_SYNC_ALWAYS;
-
-	uint64_t volsize = zv->zv_volsize;
-	while (uio.uio_resid > 0 && uio.uio_loffset < volsize) {
-		uint64_t bytes = MIN(uio.uio_resid, DMU_MAX_ACCESS >> 1);
-		uint64_t off = uio.uio_loffset;
+	while (uio->uio_resid > 0 && uio->uio_loffset < volsize) {
+		uint64_t bytes = MIN(uio->uio_resid, DMU_MAX_ACCESS >> 1);
+		uint64_t off = uio->uio_loffset;
 		dmu_tx_t *tx = dmu_tx_create(zv->zv_objset);
 
 		if (bytes > volsize - off)	/* don't write past the end */
@@ -774,7 +938,7 @@ zvol_write(void *arg)
 			dmu_tx_abort(tx);
 			break;
 		}
-		error = dmu_write_uio_dnode(zv->zv_dn, &uio, bytes, tx);
+		error = dmu_write_uio_dnode(zv->zv_dn, uio, bytes, tx);
 		if (error == 0) {
 			zvol_log_write(zv, tx, off, bytes, sync);
 		}
@@ -783,6 +947,33 @@ zvol_write(void *arg)
 		if (error)
 			break;
 	}
+
+	return (error);
+}
+
+static void
+zvol_write(void *arg)
+{
+	int error = 0;
+
+	zv_request_t *zvr = arg;
+	struct bio *bio = zvr->bio;
+	uio_t uio = { { 0 }, 0 };
+	uio_from_bio(&uio, bio);
+
+	zvol_state_t *zv = zvr->zv;
+	ASSERT(zv && zv->zv_open_count > 0);
+	ASSERT(zv->zv_zilog != NULL);
+
+	ssize_t start_resid = uio.uio_resid;
+	unsigned long start_jif = jiffies;
+	blk_generic_start_io_acct(zv->zv_queue, WRITE, bio_sectors(bio),
+	    &zv->zv_disk->part0);
+
+	boolean_t sync =
+	    bio_is_fua(bio) || zv->zv_objset->os_sync == ZFS_SYNC_ALWAYS;
+
+	error = zvol_write_uio(zv, &uio, sync);
 	rangelock_exit(zvr->lr);
 
 	int64_t nwritten = start_resid - uio.uio_resid;
@@ -795,6 +986,7 @@ zvol_write(void *arg)
 	rw_exit(&zv->zv_suspend_lock);
 	blk_generic_end_io_acct(zv->zv_queue, WRITE, &zv->zv_disk->part0,
 	    start_jif);
+	zvol_kstats_done(&zv->zv_io_kstats, WRITE, zvr->start);
 	BIO_END_IO(bio, -error);
 	kmem_free(zvr, sizeof (zv_request_t));
 }
@@ -823,33 +1015,20 @@ zvol_log_truncate(zvol_state_t *zv, dmu_tx_t *tx, uint64_t off, uint64_t len,
 	zil_itx_assign(zilog, itx, tx);
 }
 
-static void
-zvol_discard(void *arg)
+/*
+ * Free the given range of the volume.  The caller holds zv_suspend_lock and
+ * a writer range lock covering the range.
+ */
+static int
+zvol_discard_range(zvol_state_t *zv, uint64_t start, uint64_t size,
+    boolean_t secure)
 {
-	zv_request_t *zvr = arg;
-	struct bio *bio = zvr->bio;
-	zvol_state_t *zv = zvr->zv;
-	uint64_t start = BIO_BI_SECTOR(bio) << 9;
-	uint64_t size = BIO_BI_SIZE(bio);
 	uint64_t end = start + size;
-	boolean_t sync;
-	int error = 0;
 	dmu_tx_t *tx;
-	unsigned long start_jif;
-
-	ASSERT(zv && zv->zv_open_count > 0);
-	ASSERT(zv->zv_zilog != NULL);
-
-	start_jif = jiffies;
-	blk_generic_start_io_acct(zv->zv_queue, WRITE, bio_sectors(bio),
-	    &zv->zv_disk->part0);
-
-	sync = bio_is_fua(bio) || zv->zv_objset->os_sync == ZFS_SYNC_ALWAYS;
+	int error;
 
-	if (end > zv->zv_volsize) {
-		error = SET_ERROR(EIO);
-		goto unlock;
-	}
+	if (end > zv->zv_volsize)
+		return (SET_ERROR(EIO));
 
 	/*
 	 * Align the request to volume block boundaries when a secure erase is
@@ -857,14 +1036,14 @@ zvol_discard(void *arg)
 	 * the unaligned parts which is slow (read-modify-write) and useless
 	 * since we are not freeing any space by doing so.
 	 */
-	if (!bio_is_secure_erase(bio)) {
+	if (!secure) {
 		start = P2ROUNDUP(start, zv->zv_volblocksize);
 		end = P2ALIGN(end, zv->zv_volblocksize);
 		size = end - start;
 	}
 
 	if (start >= end)
-		goto unlock;
+		return (0);
 
 	tx = dmu_tx_create(zv->zv_objset);
 	dmu_tx_mark_netfree(tx);
@@ -877,7 +1056,31 @@ zvol_discard(void *arg)
 		error = dmu_free_long_range(zv->zv_objset,
 		    ZVOL_OBJ, start, size);
 	}
-unlock:
+
+	return (error);
+}
+
+static void
+zvol_discard(void *arg)
+{
+	zv_request_t *zvr = arg;
+	struct bio *bio = zvr->bio;
+	zvol_state_t *zv = zvr->zv;
+	boolean_t sync;
+	int error;
+	unsigned long start_jif;
+
+	ASSERT(zv && zv->zv_open_count > 0);
+	ASSERT(zv->zv_zilog != NULL);
+
+	start_jif = jiffies;
+	blk_generic_start_io_acct(zv->zv_queue, WRITE, bio_sectors(bio),
+	    &zv->zv_disk->part0);
+
+	sync = bio_is_fua(bio) || zv->zv_objset->os_sync == ZFS_SYNC_ALWAYS;
+
+	error = zvol_discard_range(zv, BIO_BI_SECTOR(bio) << 9,
+	    BIO_BI_SIZE(bio), bio_is_secure_erase(bio));
 	rangelock_exit(zvr->lr);
 
 	if (error == 0 && sync)
@@ -886,10 +1089,40 @@ unlock:
 	rw_exit(&zv->zv_suspend_lock);
 	blk_generic_end_io_acct(zv->zv_queue, WRITE, &zv->zv_disk->part0,
 	    start_jif);
+	zvol_kstats_done(&zv->zv_io_kstats, WRITE, zvr->start);
 	BIO_END_IO(bio, -error);
 	kmem_free(zvr, sizeof (zv_request_t));
 }
 
+/*
+ * Copy from the volume into the uio, stopping at the end of the volume.  The
+ * caller holds zv_suspend_lock and a reader range lock covering the uio.
+ */
+static int
+zvol_read_uio(zvol_state_t *zv, uio_t *uio)
+{
+	uint64_t volsize = zv->zv_volsize;
+	int error = 0;
+
+	while (uio->uio_resid > 0 && uio->uio_loffset < volsize) {
+		uint64_t bytes = MIN(uio->uio_resid, DMU_MAX_ACCESS >> 1);
+
+		/* don't read past the end */
+		if (bytes > volsize - uio->uio_loffset)
+			bytes = volsize - uio->uio_loffset;
+
+		error = dmu_read_uio_dnode(zv->zv_dn, uio, bytes);
+		if (error) {
+			/* convert checksum errors into IO errors */
+			if (error == ECKSUM)
+				error = SET_ERROR(EIO);
+			break;
+		}
+	}
+
+	return (error);
+}
+
 static void
 zvol_read(void *arg)
 {
@@ -908,22 +1141,7 @@ zvol_read(void *arg)
 	blk_generic_start_io_acct(zv->zv_queue, READ, bio_sectors(bio),
 	    &zv->zv_disk->part0);
 
-	uint64_t volsize = zv->zv_volsize;
-	while (uio.uio_resid > 0 && uio.uio_loffset < volsize) {
-		uint64_t bytes = MIN(uio.uio_resid, DMU_MAX_ACCESS >> 1);
-
-		/* don't read past the end */
-		if (bytes > volsize - uio.uio_loffset)
-			bytes = volsize - uio.uio_loffset;
-
-		error = dmu_read_uio_dnode(zv->zv_dn, &uio, bytes);
-		if (error) {
-			/* convert checksum errors into IO errors */
-			if (error == ECKSUM)
-				error = SET_ERROR(EIO);
-			break;
-		}
-	}
+	error = zvol_read_uio(zv, &uio);
 	rangelock_exit(zvr->lr);
 
 	int64_t nread = start_resid - uio.uio_resid;
@@ -933,6 +1151,7 @@ zvol_read(void *arg)
 	rw_exit(&zv->zv_suspend_lock);
 	blk_generic_end_io_acct(zv->zv_queue, READ, &zv->zv_disk->part0,
 	    start_jif);
+	zvol_kstats_done(&zv->zv_io_kstats, READ, zvr->start);
 	BIO_END_IO(bio, -error);
 	kmem_free(zvr, sizeof (zv_request_t));
 }
@@ -1017,6 +1236,29 @@ zvol_get_data(void *arg, lr_write_t *lr, char *buf, struct lwb *lwb, zio_t *zio)
 	return (SET_ERROR(error));
 }
 
+/*
+ * Open a ZIL if this is the first time we have written to this zvol.  We
+ * protect zv->zv_zilog with zv_suspend_lock rather than zv_state_lock so
+ * that we don't need to acquire an additional lock in this path.  The
+ * caller must hold zv_suspend_lock as reader.
+ */
+static void
+zvol_ensure_zilog(zvol_state_t *zv)
+{
+	ASSERT(RW_READ_HELD(&zv->zv_suspend_lock));
+
+	if (zv->zv_zilog == NULL) {
+		rw_exit(&zv->zv_suspend_lock);
+		rw_enter(&zv->zv_suspend_lock, RW_WRITER);
+		if (zv->zv_zilog == NULL) {
+			zv->zv_zilog = zil_open(zv->zv_objset,
+			    zvol_get_data);
+			zv->zv_flags |= ZVOL_WRITTEN_TO;
+		}
+		rw_downgrade(&zv->zv_suspend_lock);
+	}
+}
+
 static MAKE_REQUEST_FN_RET
 zvol_request(struct request_queue *q, struct bio *bio)
 {
@@ -1051,23 +1293,7 @@ zvol_request(struct request_queue *q, struct bio *bio)
 		 * rangelock_enter() below.
 		 */
 		rw_enter(&zv->zv_suspend_lock, RW_READER);
-
-		/*
-		 * Open a ZIL if this is the first time we have written to this
-		 * zvol. We protect zv->zv_zilog with zv_suspend_lock rather
-		 * than zv_state_lock so that we don't need to acquire an
-		 * additional lock in this path.
-		 */
-		if (zv->zv_zilog == NULL) {
-			rw_exit(&zv->zv_suspend_lock);
-			rw_enter(&zv->zv_suspend_lock, RW_WRITER);
-			if (zv->zv_zilog == NULL) {
-				zv->zv_zilog = zil_open(zv->zv_objset,
-				    zvol_get_data);
-				zv->zv_flags |= ZVOL_WRITTEN_TO;
-			}
-			rw_downgrade(&zv->zv_suspend_lock);
-		}
+		zvol_ensure_zilog(zv);
 
 		/* bio marked as FLUSH need to flush before write */
 		if (bio_is_flush(bio))
@@ -1083,6 +1309,7 @@ zvol_request(struct request_queue *q, struct bio *bio)
 		zvr = kmem_alloc(sizeof (zv_request_t), KM_SLEEP);
 		zvr->zv = zv;
 		zvr->bio = bio;
+		zvr->start = zvol_kstats_start(&zv->zv_io_kstats);
 
 		/*
 		 * To be released in the I/O function. Since the I/O functions
@@ -1125,6 +1352,7 @@ zvol_request(struct request_queue *q, struct bio *bio)
 		zvr = kmem_alloc(sizeof (zv_request_t), KM_SLEEP);
 		zvr->zv = zv;
 		zvr->bio = bio;
+		zvr->start = zvol_kstats_start(&zv->zv_io_kstats);
 
 		rw_enter(&zv->zv_suspend_lock, RW_READER);
 
@@ -1144,6 +1372,203 @@ out:
 #endif
 }
 
+#ifdef HAVE_BLK_MQ
+/*
+ * Per-request state of the blk-mq request path.  It is allocated by the
+ * block layer along with each struct request (see zv_tag_set.cmd_size), so
+ * no allocation is needed to submit a request.
+ */
+typedef struct zv_mq_request {
+	zvol_state_t	*zvm_zv;
+	struct request	*zvm_rq;
+	locked_range_t	*zvm_lr;
+	boolean_t	zvm_sync;
+	hrtime_t	zvm_start;
+	taskq_ent_t	zvm_ent;
+} zv_mq_request_t;
+
+/*
+ * Execute a request which has been set up by zvol_queue_rq().  All of the
+ * bios which the block layer merged into the request are handled under the
+ * single range lock taken for the request, and the ZIL is committed once for
+ * the whole request.
+ */
+static void
+zvol_mq_execute(void *arg)
+{
+	zv_mq_request_t *zvm = arg;
+	struct request *rq = zvm->zvm_rq;
+	zvol_state_t *zv = zvm->zvm_zv;
+	int rw = rq_data_dir(rq);
+	int64_t nbytes = 0;
+	int error = 0;
+
+	ASSERT(zv && zv->zv_open_count > 0);
+
+	if (req_op(rq) == REQ_OP_DISCARD || req_op(rq) == REQ_OP_SECURE_ERASE) {
+		error = zvol_discard_range(zv, blk_rq_pos(rq) << 9,
+		    blk_rq_bytes(rq), req_op(rq) == REQ_OP_SECURE_ERASE);
+		rangelock_exit(zvm->zvm_lr);
+
+		if (error == 0 && zvm->zvm_sync)
+			zil_commit(zv->zv_zilog, ZVOL_OBJ);
+	} else {
+		struct bio *bio;
+
+		__rq_for_each_bio(bio, rq) {
+			uio_t uio = { { 0 }, 0 };
+			uio_from_bio(&uio, bio);
+
+			ssize_t start_resid = uio.uio_resid;
+			if (rw == WRITE)
+				error = zvol_write_uio(zv, &uio, zvm->zvm_sync);
+			else
+				error = zvol_read_uio(zv, &uio);
+			nbytes += start_resid - uio.uio_resid;
+
+			if (error != 0)
+				break;
+		}
+		rangelock_exit(zvm->zvm_lr);
+
+		if (rw == WRITE) {
+			dataset_kstats_update_write_kstats(&zv->zv_kstat,
+			    nbytes);
+			task_io_account_write(nbytes);
+			if (zvm->zvm_sync)
+				zil_commit(zv->zv_zilog, ZVOL_OBJ);
+		} else {
+			dataset_kstats_update_read_kstats(&zv->zv_kstat,
+			    nbytes);
+			task_io_account_read(nbytes);
+		}
+	}
+
+	rw_exit(&zv->zv_suspend_lock);
+	zvol_kstats_done(&zv->zv_io_kstats, rw, zvm->zvm_start);
+	blk_mq_end_request(rq, errno_to_bi_status(error));
+}
+
+/*
+ * The blk-mq counterpart of zvol_request().  As there, the range lock is
+ * taken synchronously so that overlapping requests are ordered, sync writes
+ * and discards are executed in the caller's context, and everything else is
+ * handed to the taskq of the hardware context the request was submitted on.
+ * Reads which can be satisfied entirely from cached dbufs are completed here
+ * as well, since a taskq hop would cost more than the copy itself.
+ */
+static blk_status_t
+zvol_queue_rq(struct blk_mq_hw_ctx *hctx, const struct blk_mq_queue_data *bd)
+{
+	struct request *rq = bd->rq;
+	zvol_state_t *zv = rq->q->queuedata;
+	zv_mq_request_t *zvm = blk_mq_rq_to_pdu(rq);
+	uint64_t offset = blk_rq_pos(rq) << 9;
+	uint64_t size = blk_rq_bytes(rq);
+	boolean_t do_inline = zvol_request_sync;
+	fstrans_cookie_t cookie;
+	struct bio *bio;
+
+	blk_mq_start_request(rq);
+
+	if (req_op(rq) != REQ_OP_READ && req_op(rq) != REQ_OP_WRITE &&
+	    req_op(rq) != REQ_OP_FLUSH && req_op(rq) != REQ_OP_DISCARD &&
+	    req_op(rq) != REQ_OP_SECURE_ERASE) {
+		blk_mq_end_request(rq, BLK_STS_NOTSUPP);
+		return (BLK_STS_OK);
+	}
+
+	if (req_op(rq) != REQ_OP_FLUSH && offset + size > zv->zv_volsize) {
+		printk(KERN_INFO
+		    "%s: bad access: offset=%llu, size=%lu\n",
+		    zv->zv_disk->disk_name,
+		    (long long unsigned)offset,
+		    (long unsigned)size);
+
+		blk_mq_end_request(rq, BLK_STS_IOERR);
+		return (BLK_STS_OK);
+	}
+
+	if (rq_data_dir(rq) == WRITE && unlikely(zv->zv_flags & ZVOL_RDONLY)) {
+		blk_mq_end_request(rq, errno_to_bi_status(EROFS));
+		return (BLK_STS_OK);
+	}
+
+	/*
+	 * Empty reads and writes contain no data and require no additional
+	 * handling, see the comments in zvol_request().
+	 */
+	if (size == 0 && req_op(rq) != REQ_OP_FLUSH) {
+		blk_mq_end_request(rq, BLK_STS_OK);
+		return (BLK_STS_OK);
+	}
+
+	cookie = spl_fstrans_mark();
+	rw_enter(&zv->zv_suspend_lock, RW_READER);
+
+	if (rq_data_dir(rq) == WRITE) {
+		zvol_ensure_zilog(zv);
+
+		/*
+		 * The block layer splits preflushes off into their own
+		 * REQ_OP_FLUSH requests since we advertise a write cache.
+		 */
+		if (req_op(rq) == REQ_OP_FLUSH) {
+			zil_commit(zv->zv_zilog, ZVOL_OBJ);
+			rw_exit(&zv->zv_suspend_lock);
+			spl_fstrans_unmark(cookie);
+			blk_mq_end_request(rq, BLK_STS_OK);
+			return (BLK_STS_OK);
+		}
+	}
+
+	zvm->zvm_zv = zv;
+	zvm->zvm_rq = rq;
+	zvm->zvm_start = zvol_kstats_start(&zv->zv_io_kstats);
+	__rq_for_each_bio(bio, rq) {
+		if (bio != rq->bio)
+			aggsum_add(&zv->zv_io_kstats.zks_merged_bios, 1);
+	}
+
+	if (rq_data_dir(rq) == WRITE) {
+		zvm->zvm_sync = (rq->cmd_flags & REQ_FUA) ||
+		    zv->zv_objset->os_sync == ZFS_SYNC_ALWAYS;
+		zvm->zvm_lr = rangelock_enter(&zv->zv_rangelock, offset, size,
+		    RL_WRITER);
+
+		/* See the comment on sync writes in zvol_request(). */
+		if (zvm->zvm_sync)
+			do_inline = B_TRUE;
+	} else {
+		zvm->zvm_sync = B_FALSE;
+		zvm->zvm_lr = rangelock_enter(&zv->zv_rangelock, offset, size,
+		    RL_READER);
+
+		if (!do_inline && size <= ZVOL_INLINE_READ_MAX &&
+		    dmu_dnode_range_cached(zv->zv_dn, offset, size)) {
+			aggsum_add(&zv->zv_io_kstats.zks_inline_reads, 1);
+			do_inline = B_TRUE;
+		}
+	}
+
+	if (do_inline) {
+		zvol_mq_execute(zvm);
+	} else {
+		taskq_init_ent(&zvm->zvm_ent);
+		taskq_dispatch_ent(zvol_blk_mq_taskqs[hctx->queue_num %
+		    zvol_blk_mq_nqueues], zvol_mq_execute, zvm, 0,
+		    &zvm->zvm_ent);
+	}
+
+	spl_fstrans_unmark(cookie);
+	return (BLK_STS_OK);
+}
+
+static const struct blk_mq_ops zvol_blk_mq_ops = {
+	.queue_rq	= zvol_queue_rq,
+};
+#endif /* HAVE_BLK_MQ */
+
 /*
  * The zvol_state_t's are inserted into zvol_state_list and zvol_htable.
  */
@@ -1207,6 +1632,11 @@ zvol_setup_zv(zvol_state_t *zv)
 		set_disk_ro(zv->zv_disk, 0);
 		zv->zv_flags &= ~ZVOL_RDONLY;
 	}
+
+	mutex_enter(&os->os_user_ptr_lock);
+	dmu_objset_set_kstats(os, &zv->zv_kstat);
+	mutex_exit(&os->os_user_ptr_lock);
+
 	return (0);
 }
 
@@ -1220,6 +1650,10 @@ zvol_shutdown_zv(zvol_state_t *zv)
 	ASSERT(MUTEX_HELD(&zv->zv_state_lock) &&
 	    RW_LOCK_HELD(&zv->zv_suspend_lock));
 
+	mutex_enter(&zv->zv_objset->os_user_ptr_lock);
+	dmu_objset_set_kstats(zv->zv_objset, NULL);
+	mutex_exit(&zv->zv_objset->os_user_ptr_lock);
+
 	if (zv->zv_flags & ZVOL_WRITTEN_TO) {
 		ASSERT(zv->zv_zilog != NULL);
 		zil_close(zv->zv_zilog);
@@ -1682,11 +2116,71 @@ static struct block_device_operations zvol_ops = {
  * Allocate memory for a new zvol_state_t and setup the required
  * request queue and generic disk structures for the block device.
  */
+#ifdef HAVE_BLK_MQ
+static int
+zvol_alloc_blk_mq(zvol_state_t *zv)
+{
+	struct blk_mq_tag_set *set = &zv->zv_tag_set;
+
+	set->ops = &zvol_blk_mq_ops;
+	set->nr_hw_queues = zvol_blk_mq_nqueues;
+	set->queue_depth = MIN(MAX(zvol_blk_mq_queue_depth, 1),
+	    BLK_MQ_MAX_DEPTH);
+	set->numa_node = NUMA_NO_NODE;
+	set->cmd_size = sizeof (zv_mq_request_t);
+	set->flags = BLK_MQ_F_SHOULD_MERGE | BLK_MQ_F_BLOCKING;
+	set->driver_data = zv;
+
+	if (blk_mq_alloc_tag_set(set) != 0)
+		return (SET_ERROR(ENOMEM));
+
+	zv->zv_queue = blk_mq_init_queue(set);
+	if (IS_ERR(zv->zv_queue)) {
+		blk_mq_free_tag_set(set);
+		return (SET_ERROR(ENOMEM));
+	}
+
+	/*
+	 * Unlike the bio path, merging is left enabled so that adjacent
+	 * bios are batched into a single request by the block layer.
+	 */
+	zv->zv_blk_mq = B_TRUE;
+
+	return (0);
+}
+#endif
+
+static int
+zvol_alloc_non_blk_mq(zvol_state_t *zv)
+{
+	zv->zv_queue = blk_alloc_queue(GFP_ATOMIC);
+	if (zv->zv_queue == NULL)
+		return (SET_ERROR(ENOMEM));
+
+	blk_queue_make_request(zv->zv_queue, zvol_request);
+
+	/* Disable write merging in favor of the ZIO pipeline. */
+	blk_queue_flag_set(QUEUE_FLAG_NOMERGES, zv->zv_queue);
+
+	return (0);
+}
+
+static void
+zvol_free_queue(zvol_state_t *zv)
+{
+	blk_cleanup_queue(zv->zv_queue);
+#ifdef HAVE_BLK_MQ
+	if (zv->zv_blk_mq)
+		blk_mq_free_tag_set(&zv->zv_tag_set);
+#endif
+}
+
 static zvol_state_t *
 zvol_alloc(dev_t dev, const char *name)
 {
 	zvol_state_t *zv;
 	uint64_t volmode;
+	int error;
 
 	if (dsl_prop_get_integer(name, "volmode", &volmode, NULL) != 0)
 		return (NULL);
@@ -1703,19 +2197,20 @@ zvol_alloc(dev_t dev, const char *name)
 
 	mutex_init(&zv->zv_state_lock, NULL, MUTEX_DEFAULT, NULL);
 
-	zv->zv_queue = blk_alloc_queue(GFP_ATOMIC);
-	if (zv->zv_queue == NULL)
+#ifdef HAVE_BLK_MQ
+	if (zvol_blk_mq_taskqs != NULL)
+		error = zvol_alloc_blk_mq(zv);
+	else
+#endif
+		error = zvol_alloc_non_blk_mq(zv);
+	if (error != 0)
 		goto out_kmem;
 
-	blk_queue_make_request(zv->zv_queue, zvol_request);
 	blk_queue_set_write_cache(zv->zv_queue, B_TRUE, B_TRUE);
 
 	/* Limit read-ahead to a single page to prevent over-prefetching. */
 	blk_queue_set_read_ahead(zv->zv_queue, 1);
 
-	/* Disable write merging in favor of the ZIO pipeline. */
-	blk_queue_flag_set(QUEUE_FLAG_NOMERGES, zv->zv_queue);
-
 	zv->zv_disk = alloc_disk(ZVOL_MINORS);
 	if (zv->zv_disk == NULL)
 		goto out_queue;
@@ -1759,7 +2254,7 @@ zvol_alloc(dev_t dev, const char *name)
 	return (zv);
 
 out_queue:
-	blk_cleanup_queue(zv->zv_queue);
+	zvol_free_queue(zv);
 out_kmem:
 	kmem_free(zv, sizeof (zvol_state_t));
 
@@ -1786,13 +2281,14 @@ zvol_free(void *arg)
 	zfs_rangelock_fini(&zv->zv_rangelock);
 
 	del_gendisk(zv->zv_disk);
-	blk_cleanup_queue(zv->zv_queue);
+	zvol_free_queue(zv);
 	put_disk(zv->zv_disk);
 
 	ida_simple_remove(&zvol_ida, MINOR(zv->zv_dev) >> ZVOL_MINOR_BITS);
 
 	mutex_destroy(&zv->zv_state_lock);
 	dataset_kstats_destroy(&zv->zv_kstat);
+	zvol_kstats_destroy(&zv->zv_io_kstats);
 
 	kmem_free(zv, sizeof (zvol_state_t));
 }
@@ -1889,6 +2385,9 @@ zvol_create_minor_impl(const char *name)
 	}
 	ASSERT3P(zv->zv_kstat.dk_kstats, ==, NULL);
 	dataset_kstats_create(&zv->zv_kstat, zv->zv_objset);
+	dataset_kstats_update_zil_replay_kstats(&zv->zv_kstat,
+	    dmu_objset_zil(os));
+	zvol_kstats_create(&zv->zv_io_kstats, os);
 
 	/*
 	 * When udev detects the addition of the device it will immediately
@@ -2680,6 +3179,58 @@ zvol_rename_minors(spa_t *spa, const char *name1, const char *name2,
 		taskq_wait_id(spa->spa_zvol_taskq, id);
 }
 
+#ifdef HAVE_BLK_MQ
+static void
+zvol_blk_mq_fini(void)
+{
+	for (int i = 0; i < zvol_blk_mq_nqueues; i++) {
+		if (zvol_blk_mq_taskqs[i] != NULL)
+			taskq_destroy(zvol_blk_mq_taskqs[i]);
+	}
+	kmem_free(zvol_blk_mq_taskqs,
+	    zvol_blk_mq_nqueues * sizeof (taskq_t *));
+	zvol_blk_mq_taskqs = NULL;
+	zvol_blk_mq_nqueues = 0;
+}
+
+/*
+ * Create one taskq per blk-mq hardware context.  The zvol_threads budget is
+ * divided between them, but each is allowed a few threads so that a single
+ * blocking read does not stall every other request of its context.  On
+ * failure zvols fall back to the bio based request path.
+ */
+static void
+zvol_blk_mq_init(void)
+{
+	uint_t nqueues = zvol_blk_mq_queues;
+	int threads;
+
+	if (nqueues == 0)
+		nqueues = boot_ncpus;
+	nqueues = MIN(MAX(nqueues, 1), 1024);
+	threads = MAX(MIN(MAX(zvol_threads, 1), 1024) / nqueues, 4);
+
+	zvol_blk_mq_nqueues = nqueues;
+	zvol_blk_mq_taskqs = kmem_zalloc(nqueues * sizeof (taskq_t *),
+	    KM_SLEEP);
+
+	for (int i = 0; i < nqueues; i++) {
+		char name[32];
+
+		(void) snprintf(name, sizeof (name), "%s_mq_%d",
+		    ZVOL_DRIVER, i);
+		zvol_blk_mq_taskqs[i] = taskq_create(name, threads,
+		    maxclsyspri, threads, INT_MAX, TASKQ_DYNAMIC);
+		if (zvol_blk_mq_taskqs[i] == NULL) {
+			printk(KERN_INFO "ZFS: taskq_create() failed, "
+			    "not using blk-mq for zvols\n");
+			zvol_blk_mq_fini();
+			return;
+		}
+	}
+}
+#endif
+
 int
 zvol_init(void)
 {
@@ -2717,6 +3268,11 @@ zvol_init(void)
 	blk_register_region(MKDEV(zvol_major, 0), 1UL << MINORBITS,
 	    THIS_MODULE, zvol_probe, NULL, NULL);
 
+#ifdef HAVE_BLK_MQ
+	if (zvol_use_blk_mq)
+		zvol_blk_mq_init();
+#endif
+
 	return (0);
 
 out_free:
@@ -2741,6 +3297,10 @@ zvol_fini(void)
 	kmem_free(zvol_htable, ZVOL_HT_SIZE * sizeof (struct hlist_head));
 
 	taskq_destroy(zvol_taskq);
+#ifdef HAVE_BLK_MQ
+	if (zvol_blk_mq_taskqs != NULL)
+		zvol_blk_mq_fini();
+#endif
 	list_destroy(&zvol_state_list);
 	rw_destroy(&zvol_state_lock);
 
@@ -2768,4 +3328,14 @@ MODULE_PARM_DESC(zvol_prefetch_bytes, "Prefetch N bytes at zvol start+end");
 
 module_param(zvol_volmode, uint, 0644);
 MODULE_PARM_DESC(zvol_volmode, "Default volmode property value");
+
+module_param(zvol_use_blk_mq, uint, 0444);
+MODULE_PARM_DESC(zvol_use_blk_mq, "Use the blk-mq request path for zvols");
+
+module_param(zvol_blk_mq_queues, uint, 0444);
+MODULE_PARM_DESC(zvol_blk_mq_queues,
+	"Number of blk-mq hardware queues per zvol (0 for one per CPU)");
+
+module_param(zvol_blk_mq_queue_depth, uint, 0644);
+MODULE_PARM_DESC(zvol_blk_mq_queue_depth, "Depth of each blk-mq hardware queue");
 /* END CSTYLED */
@@ -51,8 +51,10 @@
 #include <sys/uio_impl.h>
 #include <sys/sysmacros.h>
 #include <sys/strings.h>
+#include <sys/kmem.h>
 #include <linux/kmap_compat.h>
 #include <linux/uaccess.h>
+#include <linux/mm.h>
 
 /*
  * Move "n" bytes at byte address "p"; "rw" indicates the direction
@@ -275,4 +277,68 @@ uioskip(uio_t *uiop, size_t n)
 	uiop->uio_resid -= n;
 }
 EXPORT_SYMBOL(uioskip);
+
+/*
+ * Pin the user pages backing the next n bytes of the uio, which must lie
+ * within a single iovec, for direct I/O.  The uio is unmodified.  On success
+ * *pagesp holds *npagesp pages and the data starts *offp bytes into the
+ * first one.  The pages are pinned writable for a UIO_READ, which fills
+ * them.  Release them with uio_put_pages().
+ */
+int
+uio_get_pages(uio_t *uio, size_t n, enum uio_rw rw, struct page ***pagesp,
+    uint_t *npagesp, size_t *offp)
+{
+	const struct iovec *iov = uio->uio_iov;
+	struct page **pages;
+	unsigned long addr;
+	uint_t npages;
+	size_t off;
+	int pinned;
+
+	if (uio->uio_segflg != UIO_USERSPACE || uio->uio_iovcnt == 0 ||
+	    iov->iov_len - uio->uio_skip < n)
+		return (EINVAL);
+
+	addr = (unsigned long)iov->iov_base + uio->uio_skip;
+	off = addr & (PAGESIZE - 1);
+	npages = P2ROUNDUP(off + n, PAGESIZE) >> PAGE_SHIFT;
+	pages = vmem_alloc(npages * sizeof (struct page *), KM_SLEEP);
+
+	/*
+	 * FOLL_WRITE has the value of the boolean write argument this took
+	 * before gup_flags replaced it, so it is correct for either.
+	 */
+	pinned = get_user_pages_fast(addr - off, npages,
+	    rw == UIO_READ ? FOLL_WRITE : 0, pages);
+	if (pinned != npages) {
+		for (int i = 0; i < pinned; i++)
+			put_page(pages[i]);
+		vmem_free(pages, npages * sizeof (struct page *));
+		return (EFAULT);
+	}
+
+	*pagesp = pages;
+	*npagesp = npages;
+	*offp = off;
+
+	return (0);
+}
+EXPORT_SYMBOL(uio_get_pages);
+
+/*
+ * Unpin pages pinned by uio_get_pages(), marking them dirty if they were
+ * filled by a read.
+ */
+void
+uio_put_pages(struct page **pages, uint_t npages, boolean_t dirty)
+{
+	for (uint_t i = 0; i < npages; i++) {
+		if (dirty)
+			set_page_dirty_lock(pages[i]);
+		put_page(pages[i]);
+	}
+	vmem_free(pages, npages * sizeof (struct page *));
+}
+EXPORT_SYMBOL(uio_put_pages);
 #endif /* _KERNEL */
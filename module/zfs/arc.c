@@ -343,6 +343,30 @@ static boolean_t	arc_adjust_needed = B_FALSE;
  */
 int zfs_arc_evict_batch_limit = 10;
 
+/*
+ * The number of threads used to evict buffers from the sublists of an
+ * ARC state concurrently.  When zero it is sized according to the number
+ * of CPUs; a value of one evicts from a single thread.  This is only
+ * consulted when the module is loaded.
+ */
+int zfs_arc_evict_threads = 0;
+
+/*
+ * Eviction is only split across the evict threads when at least this
+ * many bytes would be evicted by each of them.
+ */
+#define	ARC_EVICT_PARALLEL_MIN	SPA_MAXBLOCKSIZE
+
+static taskq_t		*arc_evict_taskq;
+static int		arc_evict_nthreads;
+
+/*
+ * Per evict thread kstats, two for each thread: the number of bytes it
+ * has evicted and the time it has spent evicting them.
+ */
+static kstat_t		*arc_evict_ksp;
+static kstat_named_t	*arc_evict_kstats;
+
 /* number of seconds before growing cache again */
 static int arc_grow_retry = 5;
 
@@ -541,6 +565,20 @@ arc_stats_t arc_stats = {
 	{ "l2_size",			KSTAT_DATA_UINT64 },
 	{ "l2_asize",			KSTAT_DATA_UINT64 },
 	{ "l2_hdr_size",		KSTAT_DATA_UINT64 },
+	{ "l2_log_blk_writes",		KSTAT_DATA_UINT64 },
+	{ "l2_log_blk_avg_asize",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_success",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_unsupported",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_io_errors",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_dh_errors",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_cksum_lb_errors",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_lowmem",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_size",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_asize",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_bufs",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_bufs_precached",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_log_blks",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_time_ms",		KSTAT_DATA_UINT64 },
 	{ "memory_throttle_count",	KSTAT_DATA_UINT64 },
 	{ "memory_direct_count",	KSTAT_DATA_UINT64 },
 	{ "memory_indirect_count",	KSTAT_DATA_UINT64 },
@@ -582,6 +620,20 @@ arc_stats_t arc_stats = {
 #define	ARCSTAT_MAXSTAT(stat) \
 	ARCSTAT_MAX(stat##_max, arc_stats.stat.value.ui64)
 
+/*
+ * Exponential moving average of a statistic, weighting the newest
+ * value by 1/ARCSTAT_F_AVG_FACTOR.
+ */
+#define	ARCSTAT_F_AVG_FACTOR	3
+#define	ARCSTAT_F_AVG(stat, value) \
+do { \
+	uint64_t x = ARCSTAT(stat); \
+	x = x - x / ARCSTAT_F_AVG_FACTOR + \
+	    (value) / ARCSTAT_F_AVG_FACTOR; \
+	ARCSTAT(stat) = x; \
+	_NOTE(CONSTCOND) \
+} while (0)
+
 /*
  * We define a macro to allow ARC hits/misses to be easily broken down by
  * two separate conditions, giving a total of four different subtypes for
@@ -790,6 +842,7 @@ unsigned long l2arc_feed_min_ms = L2ARC_FEED_MIN_MS;	/* min interval msecs */
 int l2arc_noprefetch = B_TRUE;			/* don't cache prefetch bufs */
 int l2arc_feed_again = B_TRUE;			/* turbo warmup */
 int l2arc_norw = B_FALSE;			/* no reads during writes */
+int l2arc_rebuild_enabled = B_TRUE;		/* rebuild L2ARC on import */
 
 /*
  * L2ARC Internals
@@ -831,6 +884,9 @@ static kmutex_t l2arc_feed_thr_lock;
 static kcondvar_t l2arc_feed_thr_cv;
 static uint8_t l2arc_thread_exit;
 
+static kmutex_t l2arc_rebuild_thr_lock;
+static kcondvar_t l2arc_rebuild_thr_cv;
+
 static abd_t *arc_get_data_abd(arc_buf_hdr_t *, uint64_t, void *);
 static void *arc_get_data_buf(arc_buf_hdr_t *, uint64_t, void *);
 static void arc_get_data_impl(arc_buf_hdr_t *, uint64_t, void *);
@@ -854,6 +910,13 @@ static inline void arc_hdr_clear_flags(arc_buf_hdr_t *hdr, arc_flags_t flags);
 static boolean_t l2arc_write_eligible(uint64_t, arc_buf_hdr_t *);
 static void l2arc_read_done(zio_t *);
 
+/* Persistent L2ARC */
+static uint64_t l2arc_log_blk_overhead(uint64_t, l2arc_dev_t *);
+static boolean_t l2arc_log_blk_insert(l2arc_dev_t *, const arc_buf_hdr_t *);
+static uint64_t l2arc_log_blk_commit(l2arc_dev_t *, zio_t *);
+static void l2arc_dev_hdr_update(l2arc_dev_t *);
+static void l2arc_dev_rebuild_thread(void *);
+
 
 /*
  * We use Cityhash for this. It's fast, and has good hash properties without
@@ -3884,6 +3947,91 @@ arc_evict_state_impl(multilist_t *ml, int idx, arc_buf_hdr_t *marker,
 	return (bytes_evicted);
 }
 
+typedef struct arc_evict_arg {
+	taskq_ent_t	eva_tqent;
+	multilist_t	*eva_ml;
+	arc_buf_hdr_t	**eva_markers;
+	int		eva_thread;	/* index of this evict thread */
+	int		eva_nthreads;	/* number of evict threads */
+	int		eva_idx;	/* sublist the scan starts at */
+	uint64_t	eva_spa;
+	int64_t		eva_bytes;
+	uint64_t	eva_evicted;
+} arc_evict_arg_t;
+
+/*
+ * Evict from every eva_nthreads'th sublist, starting from the thread's
+ * own offset from eva_idx, until eva_bytes have been evicted.
+ */
+static void
+arc_evict_task(void *arg)
+{
+	arc_evict_arg_t *eva = arg;
+	int num_sublists = multilist_get_num_sublists(eva->eva_ml);
+	hrtime_t start = gethrtime();
+	uint64_t evicted = 0;
+
+	for (int i = eva->eva_thread; i < num_sublists;
+	    i += eva->eva_nthreads) {
+		int idx = (eva->eva_idx + i) % num_sublists;
+		int64_t bytes_remaining;
+
+		if (eva->eva_bytes == ARC_EVICT_ALL)
+			bytes_remaining = ARC_EVICT_ALL;
+		else if (evicted < eva->eva_bytes)
+			bytes_remaining = eva->eva_bytes - evicted;
+		else
+			break;
+
+		evicted += arc_evict_state_impl(eva->eva_ml, idx,
+		    eva->eva_markers[idx], eva->eva_spa, bytes_remaining);
+	}
+
+	eva->eva_evicted = evicted;
+
+	kstat_named_t *ksn = &arc_evict_kstats[eva->eva_thread * 2];
+	atomic_add_64(&ksn[0].value.ui64, evicted);
+	atomic_add_64(&ksn[1].value.ui64, gethrtime() - start);
+}
+
+/*
+ * Make a single pass over all the sublists of the multilist, evicting
+ * from them on the evict threads concurrently.  The bytes to evict are
+ * divided evenly between the threads.
+ */
+static uint64_t
+arc_evict_state_parallel(multilist_t *ml, arc_buf_hdr_t **markers,
+    arc_evict_arg_t *evas, int nthreads, int sublist_idx, uint64_t spa,
+    int64_t bytes)
+{
+	uint64_t evicted = 0;
+
+	for (int t = 0; t < nthreads; t++) {
+		arc_evict_arg_t *eva = &evas[t];
+
+		eva->eva_ml = ml;
+		eva->eva_markers = markers;
+		eva->eva_thread = t;
+		eva->eva_nthreads = nthreads;
+		eva->eva_idx = sublist_idx;
+		eva->eva_spa = spa;
+		eva->eva_bytes = (bytes == ARC_EVICT_ALL) ? ARC_EVICT_ALL :
+		    howmany(bytes, nthreads);
+		eva->eva_evicted = 0;
+
+		taskq_init_ent(&eva->eva_tqent);
+		taskq_dispatch_ent(arc_evict_taskq, arc_evict_task, eva, 0,
+		    &eva->eva_tqent);
+	}
+
+	taskq_wait_outstanding(arc_evict_taskq, 0);
+
+	for (int t = 0; t < nthreads; t++)
+		evicted += evas[t].eva_evicted;
+
+	return (evicted);
+}
+
 /*
  * Evict buffers from the given arc state, until we've removed the
  * specified number of bytes. Move the removed buffers to the
@@ -3905,11 +4053,26 @@ arc_evict_state(arc_state_t *state, uint64_t spa, int64_t bytes,
 	multilist_t *ml = state->arcs_list[type];
 	int num_sublists;
 	arc_buf_hdr_t **markers;
+	arc_evict_arg_t *evas = NULL;
+	int nthreads = 0;
 
 	IMPLY(bytes < 0, bytes == ARC_EVICT_ALL);
 
 	num_sublists = multilist_get_num_sublists(ml);
 
+	/*
+	 * Large evictions are spread across the evict threads, each of
+	 * which evicts from its own subset of the sublists.
+	 */
+	if (arc_evict_taskq != NULL) {
+		nthreads = MIN(arc_evict_nthreads, num_sublists);
+		if (nthreads > 1 && (bytes == ARC_EVICT_ALL ||
+		    bytes / nthreads >= ARC_EVICT_PARALLEL_MIN)) {
+			evas = kmem_zalloc(sizeof (*evas) * nthreads,
+			    KM_SLEEP);
+		}
+	}
+
 	/*
 	 * If we've tried to evict from each sublist, made some
 	 * progress, but still have not hit the target number of bytes
@@ -3962,7 +4125,15 @@ arc_evict_state(arc_state_t *state, uint64_t spa, int64_t bytes,
 		 * (e.g. index 0) would cause evictions to favor certain
 		 * sublists over others.
 		 */
-		for (int i = 0; i < num_sublists; i++) {
+		if (evas != NULL) {
+			scan_evicted = arc_evict_state_parallel(ml, markers,
+			    evas, nthreads, sublist_idx, spa,
+			    (bytes == ARC_EVICT_ALL) ? ARC_EVICT_ALL :
+			    bytes - total_evicted);
+			total_evicted += scan_evicted;
+		}
+
+		for (int i = 0; evas == NULL && i < num_sublists; i++) {
 			uint64_t bytes_remaining;
 			uint64_t bytes_evicted;
 
@@ -4016,6 +4187,8 @@ arc_evict_state(arc_state_t *state, uint64_t spa, int64_t bytes,
 		kmem_cache_free(hdr_full_cache, markers[i]);
 	}
 	kmem_free(markers, sizeof (*markers) * num_sublists);
+	if (evas != NULL)
+		kmem_free(evas, sizeof (*evas) * nthreads);
 
 	return (total_evicted);
 }
@@ -4915,7 +5088,7 @@ arc_kmem_reap_soon(void)
 	kmem_cache_t		*prev_data_cache = NULL;
 	extern kmem_cache_t	*zio_buf_cache[];
 	extern kmem_cache_t	*zio_data_buf_cache[];
-	extern kmem_cache_t	*range_seg_cache;
+	extern kmem_cache_t	*zfs_btree_leaf_cache;
 
 #ifdef _KERNEL
 	if ((aggsum_compare(&arc_meta_used, arc_meta_limit) >= 0) &&
@@ -4952,7 +5125,8 @@ arc_kmem_reap_soon(void)
 	kmem_cache_reap_now(buf_cache);
 	kmem_cache_reap_now(hdr_full_cache);
 	kmem_cache_reap_now(hdr_l2only_cache);
-	kmem_cache_reap_now(range_seg_cache);
+	kmem_cache_reap_now(zfs_btree_leaf_cache);
+	zstd_cache_reap_now();
 
 	if (zio_arena != NULL) {
 		/*
@@ -7704,6 +7878,65 @@ arc_target_bytes(void)
 	return (arc_c);
 }
 
+/*
+ * Create the evict threads.  Unless set explicitly there is one evict
+ * thread for every eight CPUs, up to sixteen threads.  With a single
+ * thread no taskq is created and eviction is done by the caller.
+ */
+static void
+arc_evict_init(void)
+{
+	if (zfs_arc_evict_threads > 0)
+		arc_evict_nthreads = zfs_arc_evict_threads;
+	else
+		arc_evict_nthreads = MIN(MAX(max_ncpus / 8, 1), 16);
+
+	arc_evict_kstats = kmem_zalloc(arc_evict_nthreads * 2 *
+	    sizeof (kstat_named_t), KM_SLEEP);
+	for (int t = 0; t < arc_evict_nthreads; t++) {
+		kstat_named_t *ksn = &arc_evict_kstats[t * 2];
+
+		(void) snprintf(ksn[0].name, KSTAT_STRLEN,
+		    "thread%d_bytes", t);
+		ksn[0].data_type = KSTAT_DATA_UINT64;
+		(void) snprintf(ksn[1].name, KSTAT_STRLEN,
+		    "thread%d_time_ns", t);
+		ksn[1].data_type = KSTAT_DATA_UINT64;
+	}
+
+	arc_evict_ksp = kstat_create("zfs", 0, "arc_evict", "misc",
+	    KSTAT_TYPE_NAMED, arc_evict_nthreads * 2, KSTAT_FLAG_VIRTUAL);
+	if (arc_evict_ksp != NULL) {
+		arc_evict_ksp->ks_data = arc_evict_kstats;
+		kstat_install(arc_evict_ksp);
+	}
+
+	if (arc_evict_nthreads > 1) {
+		arc_evict_taskq = taskq_create("arc_evict", arc_evict_nthreads,
+		    defclsyspri, arc_evict_nthreads, INT_MAX,
+		    TASKQ_PREPOPULATE);
+	}
+}
+
+static void
+arc_evict_fini(void)
+{
+	if (arc_evict_taskq != NULL) {
+		taskq_wait(arc_evict_taskq);
+		taskq_destroy(arc_evict_taskq);
+		arc_evict_taskq = NULL;
+	}
+
+	if (arc_evict_ksp != NULL) {
+		kstat_delete(arc_evict_ksp);
+		arc_evict_ksp = NULL;
+	}
+
+	kmem_free(arc_evict_kstats, arc_evict_nthreads * 2 *
+	    sizeof (kstat_named_t));
+	arc_evict_kstats = NULL;
+}
+
 void
 arc_init(void)
 {
@@ -7785,6 +8018,8 @@ arc_init(void)
 	arc_prune_taskq = taskq_create("arc_prune", max_ncpus, defclsyspri,
 	    max_ncpus, INT_MAX, TASKQ_PREPOPULATE | TASKQ_DYNAMIC);
 
+	arc_evict_init();
+
 	arc_ksp = kstat_create("zfs", 0, "arcstats", "misc", KSTAT_TYPE_NAMED,
 	    sizeof (arc_stats) / sizeof (kstat_named_t), KSTAT_FLAG_VIRTUAL);
 
@@ -7868,6 +8103,8 @@ arc_fini(void)
 	(void) zthr_cancel(arc_adjust_zthr);
 	(void) zthr_cancel(arc_reap_zthr);
 
+	arc_evict_fini();
+
 	mutex_destroy(&arc_adjust_lock);
 	cv_destroy(&arc_adjust_waiters_cv);
 
@@ -8008,6 +8245,14 @@ arc_fini(void)
  * 8. If an ARC buffer is written (and dirtied) which also exists in the
  * L2ARC, the now stale L2ARC buffer is immediately dropped.
  *
+ * 9. The L2ARC survives pool export and import. Next to the buffers it
+ * writes, l2arc_write_buffers() fills log blocks with entries describing
+ * them, and writes each full log block to the device after its buffers.
+ * When the device is added back to the pool, l2arc_rebuild() walks the
+ * chain of log blocks and recreates the L2-only buffer headers, so the
+ * L2ARC is warm right away. See the persistent L2ARC comment in arc_impl.h
+ * for the on-disk layout.
+ *
  * The performance of the L2ARC can be tweaked by a number of tunables, which
  * may be necessary for different workloads:
  *
@@ -8021,6 +8266,8 @@ arc_fini(void)
  *				since more compressed buffers are likely to
  *				be present
  *	l2arc_feed_secs		seconds between L2ARC writing
+ *	l2arc_rebuild_enabled	rebuild the L2ARC headers from the log blocks
+ *				on the cache devices when they are added
  *
  * Tunables may be removed or added as future performance improvements are
  * integrated, and also may become zpool properties.
@@ -8053,9 +8300,9 @@ l2arc_write_eligible(uint64_t spa_guid, arc_buf_hdr_t *hdr)
 }
 
 static uint64_t
-l2arc_write_size(void)
+l2arc_write_size(l2arc_dev_t *dev)
 {
-	uint64_t size;
+	uint64_t size, dev_size;
 
 	/*
 	 * Make sure our globals have meaningful values in case the user
@@ -8072,6 +8319,15 @@ l2arc_write_size(void)
 	if (arc_warm == B_FALSE)
 		size += l2arc_write_boost;
 
+	/*
+	 * The write size plus the log blocks describing it must fit well
+	 * within the device, otherwise l2arc_evict() cannot make room for
+	 * them after the write hand has wrapped around.
+	 */
+	dev_size = dev->l2ad_end - dev->l2ad_start;
+	if (size + l2arc_log_blk_overhead(size, dev) > dev_size / 4)
+		size = dev_size / 8;
+
 	return (size);
 
 }
@@ -8122,7 +8378,10 @@ l2arc_dev_get_next(void)
 	first = NULL;
 	next = l2arc_dev_last;
 	do {
-		/* loop around the list looking for a non-faulted vdev */
+		/*
+		 * Loop around the list looking for a non-faulted vdev which
+		 * is not being rebuilt.
+		 */
 		if (next == NULL) {
 			next = list_head(l2arc_dev_list);
 		} else {
@@ -8137,10 +8396,10 @@ l2arc_dev_get_next(void)
 		else if (next == first)
 			break;
 
-	} while (vdev_is_dead(next->l2ad_vdev));
+	} while (vdev_is_dead(next->l2ad_vdev) || next->l2ad_rebuild);
 
 	/* if we were unable to find any usable vdevs, return NULL */
-	if (vdev_is_dead(next->l2ad_vdev))
+	if (vdev_is_dead(next->l2ad_vdev) || next->l2ad_rebuild)
 		next = NULL;
 
 	l2arc_dev_last = next;
@@ -8571,7 +8830,11 @@ l2arc_sublist_lock(int list_num)
 /*
  * Evict buffers from the device write hand to the distance specified in
  * bytes.  This distance may span populated buffers, it may span nothing.
- * This is clearing a region on the L2ARC device ready for writing.
+ * This is clearing a region on the L2ARC device ready for writing, which
+ * includes room for the log blocks describing the buffers to be written.
+ * When the region would run past the end of the device, everything up to
+ * the end is evicted and the write hand is moved back to the start, so
+ * that a single write never wraps around.
  * If the 'all' boolean is set, every buffer is evicted.
  */
 static void
@@ -8581,22 +8844,21 @@ l2arc_evict(l2arc_dev_t *dev, uint64_t distance, boolean_t all)
 	arc_buf_hdr_t *hdr, *hdr_prev;
 	kmutex_t *hash_lock;
 	uint64_t taddr;
+	boolean_t rerun;
 
 	buflist = &dev->l2ad_buflist;
 
-	if (!all && dev->l2ad_first) {
-		/*
-		 * This is the first sweep through the device.  There is
-		 * nothing to evict.
-		 */
-		return;
-	}
+	if (!all)
+		distance += l2arc_log_blk_overhead(distance, dev);
 
-	if (dev->l2ad_hand >= (dev->l2ad_end - (2 * distance))) {
+top:
+	rerun = B_FALSE;
+	if (dev->l2ad_hand >= (dev->l2ad_end - distance)) {
 		/*
 		 * When nearing the end of the device, evict to the end
 		 * before the device write hand jumps to the start.
 		 */
+		rerun = B_TRUE;
 		taddr = dev->l2ad_end;
 	} else {
 		taddr = dev->l2ad_hand + distance;
@@ -8604,7 +8866,22 @@ l2arc_evict(l2arc_dev_t *dev, uint64_t distance, boolean_t all)
 	DTRACE_PROBE4(l2arc__evict, l2arc_dev_t *, dev, list_t *, buflist,
 	    uint64_t, taddr, boolean_t, all);
 
-top:
+	if (!all && dev->l2ad_first) {
+		/*
+		 * This is the first sweep through the device.  There is
+		 * nothing to evict.
+		 */
+		goto out;
+	}
+
+	/*
+	 * The evict hand is recorded in the device header; log blocks and
+	 * buffers between the write hand and the evict hand are no longer
+	 * valid when the L2ARC is rebuilt.
+	 */
+	dev->l2ad_evict = MAX(dev->l2ad_evict, taddr);
+
+retry:
 	mutex_enter(&dev->l2ad_mtx);
 	for (hdr = list_tail(buflist); hdr; hdr = hdr_prev) {
 		hdr_prev = list_prev(buflist, hdr);
@@ -8625,7 +8902,7 @@ top:
 			mutex_exit(&dev->l2ad_mtx);
 			mutex_enter(hash_lock);
 			mutex_exit(hash_lock);
-			goto top;
+			goto retry;
 		}
 
 		/*
@@ -8674,6 +8951,21 @@ top:
 		mutex_exit(hash_lock);
 	}
 	mutex_exit(&dev->l2ad_mtx);
+
+out:
+	if (!all && rerun) {
+		/*
+		 * Bump the device hand to the start of the device; we have
+		 * already evicted up to the end, so evict ahead of the
+		 * write hand again from there.
+		 */
+		dev->l2ad_hand = dev->l2ad_start;
+		dev->l2ad_evict = dev->l2ad_start;
+		dev->l2ad_first = B_FALSE;
+		goto top;
+	}
+
+	ASSERT(all || dev->l2ad_hand + distance < dev->l2ad_end);
 }
 
 /*
@@ -8801,8 +9093,12 @@ error:
  * The headroom_boost is an in-out parameter used to maintain headroom boost
  * state between calls to this function.
  *
+ * Every buffer written is also recorded in the device's open log block,
+ * which is written out once it fills up.
+ *
  * Returns the number of bytes actually written (which may be smaller than
- * the delta by which the device hand has changed due to alignment).
+ * the delta by which the device hand has changed due to alignment and
+ * log blocks).
  */
 static uint64_t
 l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
@@ -8816,6 +9112,15 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 
 	ASSERT3P(dev->l2ad_vdev, !=, NULL);
 
+	/*
+	 * l2arc_evict() may have moved the evict hand into space covered
+	 * by the device header's log blocks. Record that on the device
+	 * before overwriting any of it.
+	 */
+	if (dev->l2ad_dev_hdr->dh_evict != dev->l2ad_evict ||
+	    dev->l2ad_dev_hdr->dh_magic != L2ARC_DEV_HDR_MAGIC)
+		l2arc_dev_hdr_update(dev);
+
 	pio = NULL;
 	write_lsize = write_asize = write_psize = 0;
 	full = B_FALSE;
@@ -8849,6 +9154,7 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 		for (; hdr; hdr = hdr_prev) {
 			kmutex_t *hash_lock;
 			abd_t *to_write = NULL;
+			boolean_t commit;
 
 			if (arc_warm == B_FALSE)
 				hdr_prev = multilist_sublist_next(mls, hdr);
@@ -8996,9 +9302,18 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 			dev->l2ad_hand += asize;
 			vdev_space_update(dev->l2ad_vdev, asize, 0, 0);
 
+			commit = l2arc_log_blk_insert(dev, hdr);
+
 			mutex_exit(hash_lock);
 
 			(void) zio_nowait(wzio);
+
+			/*
+			 * Write the log block once it is full; it follows
+			 * the buffers it describes on the device.
+			 */
+			if (commit)
+				(void) l2arc_log_blk_commit(dev, pio);
 		}
 
 		multilist_sublist_unlock(mls);
@@ -9021,19 +9336,16 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 	ARCSTAT_INCR(arcstat_l2_lsize, write_lsize);
 	ARCSTAT_INCR(arcstat_l2_psize, write_psize);
 
-	/*
-	 * Bump device hand to the device start if it is approaching the end.
-	 * l2arc_evict() will already have evicted ahead for this case.
-	 */
-	if (dev->l2ad_hand >= (dev->l2ad_end - target_sz)) {
-		dev->l2ad_hand = dev->l2ad_start;
-		dev->l2ad_first = B_FALSE;
-	}
-
 	dev->l2ad_writing = B_TRUE;
 	(void) zio_wait(pio);
 	dev->l2ad_writing = B_FALSE;
 
+	/*
+	 * Now that the log blocks written above are on stable storage,
+	 * point the device header at the newest one.
+	 */
+	l2arc_dev_hdr_update(dev);
+
 	return (write_asize);
 }
 
@@ -9112,7 +9424,7 @@ l2arc_feed_thread(void *unused)
 
 		ARCSTAT_BUMP(arcstat_l2_feeds);
 
-		size = l2arc_write_size();
+		size = l2arc_write_size(dev);
 
 		/*
 		 * Evict L2ARC buffers that will be overwritten.
@@ -9173,11 +9485,19 @@ l2arc_add_vdev(spa_t *spa, vdev_t *vd)
 	adddev = kmem_zalloc(sizeof (l2arc_dev_t), KM_SLEEP);
 	adddev->l2ad_spa = spa;
 	adddev->l2ad_vdev = vd;
-	adddev->l2ad_start = VDEV_LABEL_START_SIZE;
+	/* the device header takes the first block after the labels */
+	adddev->l2ad_dev_hdr_asize = MAX(sizeof (l2arc_dev_hdr_phys_t),
+	    1ULL << vd->vdev_ashift);
+	adddev->l2ad_start = VDEV_LABEL_START_SIZE + adddev->l2ad_dev_hdr_asize;
 	adddev->l2ad_end = VDEV_LABEL_START_SIZE + vdev_get_min_asize(vd);
 	adddev->l2ad_hand = adddev->l2ad_start;
+	adddev->l2ad_evict = adddev->l2ad_start;
 	adddev->l2ad_first = B_TRUE;
 	adddev->l2ad_writing = B_FALSE;
+	adddev->l2ad_dev_hdr = vmem_zalloc(adddev->l2ad_dev_hdr_asize,
+	    KM_SLEEP);
+	adddev->l2ad_log_blk = vmem_zalloc(sizeof (l2arc_log_blk_phys_t),
+	    KM_SLEEP);
 	list_link_init(&adddev->l2ad_node);
 
 	mutex_init(&adddev->l2ad_mtx, NULL, MUTEX_DEFAULT, NULL);
@@ -9191,6 +9511,15 @@ l2arc_add_vdev(spa_t *spa, vdev_t *vd)
 	vdev_space_update(vd, 0, 0, adddev->l2ad_end - adddev->l2ad_hand);
 	zfs_refcount_create(&adddev->l2ad_alloc);
 
+	/*
+	 * Rebuild the headers of the buffers persisted on the device in
+	 * the background. The feed thread leaves the device alone until
+	 * the rebuild is done. Pools opened read-only (including those
+	 * being probed by tryimport) are not rebuilt.
+	 */
+	if (l2arc_rebuild_enabled && (spa_mode(spa) & FWRITE))
+		adddev->l2ad_rebuild = B_TRUE;
+
 	/*
 	 * Add device to global list
 	 */
@@ -9198,6 +9527,11 @@ l2arc_add_vdev(spa_t *spa, vdev_t *vd)
 	list_insert_head(l2arc_dev_list, adddev);
 	atomic_inc_64(&l2arc_ndev);
 	mutex_exit(&l2arc_dev_mtx);
+
+	if (adddev->l2ad_rebuild) {
+		(void) thread_create(NULL, 0, l2arc_dev_rebuild_thread,
+		    adddev, 0, &p0, TS_RUN, minclsyspri);
+	}
 }
 
 /*
@@ -9220,10 +9554,25 @@ l2arc_remove_vdev(vdev_t *vd)
 		}
 	}
 	ASSERT3P(remdev, !=, NULL);
+	mutex_exit(&l2arc_dev_mtx);
+
+	/*
+	 * Cancel a rebuild in progress and wait for it to wind down; the
+	 * rebuild thread doesn't hold the spa config lock, so this cannot
+	 * deadlock with our caller.
+	 */
+	mutex_enter(&l2arc_rebuild_thr_lock);
+	if (remdev->l2ad_rebuild) {
+		remdev->l2ad_rebuild_cancel = B_TRUE;
+		while (remdev->l2ad_rebuild)
+			cv_wait(&l2arc_rebuild_thr_cv, &l2arc_rebuild_thr_lock);
+	}
+	mutex_exit(&l2arc_rebuild_thr_lock);
 
 	/*
 	 * Remove device from global list
 	 */
+	mutex_enter(&l2arc_dev_mtx);
 	list_remove(l2arc_dev_list, remdev);
 	l2arc_dev_last = NULL;		/* may have been invalidated */
 	atomic_dec_64(&l2arc_ndev);
@@ -9236,6 +9585,8 @@ l2arc_remove_vdev(vdev_t *vd)
 	list_destroy(&remdev->l2ad_buflist);
 	mutex_destroy(&remdev->l2ad_mtx);
 	zfs_refcount_destroy(&remdev->l2ad_alloc);
+	vmem_free(remdev->l2ad_dev_hdr, remdev->l2ad_dev_hdr_asize);
+	vmem_free(remdev->l2ad_log_blk, sizeof (l2arc_log_blk_phys_t));
 	kmem_free(remdev, sizeof (l2arc_dev_t));
 }
 
@@ -9251,6 +9602,8 @@ l2arc_init(void)
 	cv_init(&l2arc_feed_thr_cv, NULL, CV_DEFAULT, NULL);
 	mutex_init(&l2arc_dev_mtx, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&l2arc_free_on_write_mtx, NULL, MUTEX_DEFAULT, NULL);
+	mutex_init(&l2arc_rebuild_thr_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&l2arc_rebuild_thr_cv, NULL, CV_DEFAULT, NULL);
 
 	l2arc_dev_list = &L2ARC_dev_list;
 	l2arc_free_on_write = &L2ARC_free_on_write;
@@ -9275,6 +9628,8 @@ l2arc_fini(void)
 	cv_destroy(&l2arc_feed_thr_cv);
 	mutex_destroy(&l2arc_dev_mtx);
 	mutex_destroy(&l2arc_free_on_write_mtx);
+	mutex_destroy(&l2arc_rebuild_thr_lock);
+	cv_destroy(&l2arc_rebuild_thr_cv);
 
 	list_destroy(l2arc_dev_list);
 	list_destroy(l2arc_free_on_write);
@@ -9304,6 +9659,563 @@ l2arc_stop(void)
 	mutex_exit(&l2arc_feed_thr_lock);
 }
 
+/*
+ * Persistent L2ARC
+ *
+ * Buffers written to a cache device are described by log entries which
+ * are gathered in log blocks and written out next to the buffers. Each
+ * log block points to the previous one, and the device header points to
+ * the newest log block. See the comment in arc_impl.h for the layout.
+ */
+
+#define	L2ARC_REBUILD_ZIO_FLAGS	(ZIO_FLAG_DONT_CACHE | ZIO_FLAG_CANFAIL | \
+	ZIO_FLAG_DONT_PROPAGATE | ZIO_FLAG_DONT_RETRY | ZIO_FLAG_SPECULATIVE)
+
+/*
+ * Returns the worst-case space taken by the log blocks needed to describe
+ * write_sz bytes worth of buffers.
+ */
+static uint64_t
+l2arc_log_blk_overhead(uint64_t write_sz, l2arc_dev_t *dev)
+{
+	uint64_t log_entries = write_sz >> SPA_MINBLOCKSHIFT;
+	uint64_t log_blocks = (log_entries + L2ARC_LOG_BLK_MAX_ENTRIES - 1) /
+	    L2ARC_LOG_BLK_MAX_ENTRIES;
+
+	return (vdev_psize_to_asize(dev->l2ad_vdev,
+	    sizeof (l2arc_log_blk_phys_t)) * log_blocks);
+}
+
+/*
+ * Records a buffer that was just written to the device in the open log
+ * block. Returns B_TRUE once the log block is full and must be committed.
+ */
+static boolean_t
+l2arc_log_blk_insert(l2arc_dev_t *dev, const arc_buf_hdr_t *hdr)
+{
+	l2arc_log_blk_phys_t *lb = dev->l2ad_log_blk;
+	l2arc_log_ent_phys_t *le;
+
+	ASSERT(HDR_HAS_L2HDR(hdr));
+	ASSERT3S(dev->l2ad_log_ent_idx, <, L2ARC_LOG_BLK_MAX_ENTRIES);
+
+	if (dev->l2ad_log_ent_idx == 0)
+		dev->l2ad_log_blk_payload_start = hdr->b_l2hdr.b_daddr;
+
+	le = &lb->lb_entries[dev->l2ad_log_ent_idx++];
+	bzero(le, sizeof (*le));
+	le->le_dva = hdr->b_dva;
+	le->le_birth = hdr->b_birth;
+	le->le_daddr = hdr->b_l2hdr.b_daddr;
+	L2BLK_SET_LSIZE(le->le_prop, HDR_GET_LSIZE(hdr));
+	L2BLK_SET_PSIZE(le->le_prop, HDR_GET_PSIZE(hdr));
+	L2BLK_SET_COMPRESS(le->le_prop, HDR_GET_COMPRESS(hdr));
+	L2BLK_SET_TYPE(le->le_prop, hdr->b_type);
+	L2BLK_SET_PROTECTED(le->le_prop, !!HDR_PROTECTED(hdr));
+	L2BLK_SET_PREFETCH(le->le_prop, !!HDR_PREFETCH(hdr));
+
+	return (dev->l2ad_log_ent_idx == L2ARC_LOG_BLK_MAX_ENTRIES);
+}
+
+/*
+ * Writes out the full open log block at the device write hand as a child
+ * of the L2ARC write zio, and makes it the newest log block in the device
+ * header. The header itself is written once the write zio completes.
+ * Returns the allocated size of the log block.
+ */
+static uint64_t
+l2arc_log_blk_commit(l2arc_dev_t *dev, zio_t *pio)
+{
+	l2arc_log_blk_phys_t *lb = dev->l2ad_log_blk;
+	l2arc_dev_hdr_phys_t *l2dhdr = dev->l2ad_dev_hdr;
+	l2arc_log_blkptr_t lbp;
+	enum zio_compress compress = ZIO_COMPRESS_LZ4;
+	uint64_t psize, asize;
+	abd_t *abd;
+	void *tmp;
+
+	ASSERT3S(dev->l2ad_log_ent_idx, ==, L2ARC_LOG_BLK_MAX_ENTRIES);
+
+	lb->lb_magic = L2ARC_LOG_BLK_MAGIC;
+	lb->lb_prev_lbp = l2dhdr->dh_start_lbp;
+
+	tmp = zio_buf_alloc(sizeof (*lb));
+	abd = abd_get_from_buf(lb, sizeof (*lb));
+	psize = zio_compress_data(compress, abd, tmp, sizeof (*lb));
+	abd_put(abd);
+	if (psize == 0 || psize >= sizeof (*lb)) {
+		compress = ZIO_COMPRESS_OFF;
+		psize = sizeof (*lb);
+		bcopy(lb, tmp, psize);
+	}
+	asize = vdev_psize_to_asize(dev->l2ad_vdev,
+	    P2ROUNDUP(psize, SPA_MINBLOCKSIZE));
+	ASSERT3U(asize, <=, sizeof (*lb));
+	ASSERT3U(dev->l2ad_hand + asize, <=, dev->l2ad_end);
+	if (psize < asize)
+		bzero((char *)tmp + psize, asize - psize);
+	psize = P2ROUNDUP(psize, SPA_MINBLOCKSIZE);
+
+	bzero(&lbp, sizeof (lbp));
+	lbp.lbp_daddr = dev->l2ad_hand;
+	lbp.lbp_payload_start = dev->l2ad_log_blk_payload_start;
+	L2BLK_SET_LSIZE(lbp.lbp_prop, sizeof (*lb));
+	L2BLK_SET_PSIZE(lbp.lbp_prop, psize);
+	L2BLK_SET_COMPRESS(lbp.lbp_prop, compress);
+	L2BLK_SET_CHECKSUM(lbp.lbp_prop, ZIO_CHECKSUM_FLETCHER_4);
+	fletcher_4_native(tmp, asize, NULL, &lbp.lbp_cksum);
+
+	abd = abd_alloc_for_io(asize, B_TRUE);
+	abd_copy_from_buf(abd, tmp, asize);
+	zio_buf_free(tmp, sizeof (*lb));
+
+	(void) zio_nowait(zio_write_phys(pio, dev->l2ad_vdev, lbp.lbp_daddr,
+	    asize, abd, ZIO_CHECKSUM_OFF, NULL, NULL,
+	    ZIO_PRIORITY_ASYNC_WRITE, ZIO_FLAG_CANFAIL, B_FALSE));
+
+	/* l2arc_write_done() frees the buffer once the write completes */
+	l2arc_free_abd_on_write(abd, asize, ARC_BUFC_METADATA);
+
+	l2dhdr->dh_start_lbp = lbp;
+	dev->l2ad_hand += asize;
+	dev->l2ad_log_ent_idx = 0;
+
+	ARCSTAT_BUMP(arcstat_l2_log_blk_writes);
+	ARCSTAT_F_AVG(arcstat_l2_log_blk_avg_asize, asize);
+
+	return (asize);
+}
+
+/*
+ * Writes the device header describing the current state of the device:
+ * its evict hand and the newest log block on it.
+ */
+static void
+l2arc_dev_hdr_update(l2arc_dev_t *dev)
+{
+	l2arc_dev_hdr_phys_t *l2dhdr = dev->l2ad_dev_hdr;
+	uint64_t l2dhdr_asize = dev->l2ad_dev_hdr_asize;
+	vdev_t *vd = dev->l2ad_vdev;
+	abd_t *abd;
+	int err;
+
+	l2dhdr->dh_magic = L2ARC_DEV_HDR_MAGIC;
+	l2dhdr->dh_version = L2ARC_PERSISTENT_VERSION;
+	l2dhdr->dh_spa_guid = spa_guid(dev->l2ad_spa);
+	l2dhdr->dh_vdev_guid = vd->vdev_guid;
+	l2dhdr->dh_log_entries = L2ARC_LOG_BLK_MAX_ENTRIES;
+	l2dhdr->dh_evict = dev->l2ad_evict;
+	l2dhdr->dh_flags = 0;
+	if (dev->l2ad_first)
+		l2dhdr->dh_flags |= L2ARC_DEV_HDR_EVICT_FIRST;
+	l2dhdr->dh_start = dev->l2ad_start;
+	l2dhdr->dh_end = dev->l2ad_end;
+
+	abd = abd_get_from_buf(l2dhdr, l2dhdr_asize);
+	err = zio_wait(zio_write_phys(NULL, vd, VDEV_LABEL_START_SIZE,
+	    l2dhdr_asize, abd, ZIO_CHECKSUM_LABEL, NULL, NULL,
+	    ZIO_PRIORITY_ASYNC_WRITE, ZIO_FLAG_CANFAIL, B_FALSE));
+	abd_put(abd);
+
+	if (err != 0) {
+		zfs_dbgmsg("L2ARC device header update failed for "
+		    "vdev %llu, err %d", (u_longlong_t)vd->vdev_guid, err);
+	}
+}
+
+/*
+ * Reads the device header into dev->l2ad_dev_hdr and checks that it was
+ * written for this device in this pool, with the same geometry.
+ */
+static int
+l2arc_dev_hdr_read(l2arc_dev_t *dev)
+{
+	l2arc_dev_hdr_phys_t *l2dhdr = dev->l2ad_dev_hdr;
+	uint64_t l2dhdr_asize = dev->l2ad_dev_hdr_asize;
+	vdev_t *vd = dev->l2ad_vdev;
+	abd_t *abd;
+	int err;
+
+	abd = abd_alloc_for_io(l2dhdr_asize, B_TRUE);
+	err = zio_wait(zio_read_phys(NULL, vd, VDEV_LABEL_START_SIZE,
+	    l2dhdr_asize, abd, ZIO_CHECKSUM_LABEL, NULL, NULL,
+	    ZIO_PRIORITY_SYNC_READ, L2ARC_REBUILD_ZIO_FLAGS, B_FALSE));
+	abd_copy_to_buf(l2dhdr, abd, l2dhdr_asize);
+	abd_free(abd);
+
+	/* A device which was never used as a persistent L2ARC */
+	if (l2dhdr->dh_magic != L2ARC_DEV_HDR_MAGIC)
+		return (SET_ERROR(ENOENT));
+
+	if (err != 0) {
+		ARCSTAT_BUMP(arcstat_l2_rebuild_dh_errors);
+		zfs_dbgmsg("L2ARC device header read failed for "
+		    "vdev %llu, err %d", (u_longlong_t)vd->vdev_guid, err);
+		return (err);
+	}
+
+	if (l2dhdr->dh_version != L2ARC_PERSISTENT_VERSION ||
+	    l2dhdr->dh_log_entries != L2ARC_LOG_BLK_MAX_ENTRIES) {
+		ARCSTAT_BUMP(arcstat_l2_rebuild_unsupported);
+		return (SET_ERROR(ENOTSUP));
+	}
+
+	/*
+	 * The device may have been used by another pool, or have been
+	 * resized since, in which case its contents are of no use.
+	 */
+	if (l2dhdr->dh_spa_guid != spa_guid(dev->l2ad_spa) ||
+	    l2dhdr->dh_vdev_guid != vd->vdev_guid ||
+	    l2dhdr->dh_start != dev->l2ad_start ||
+	    l2dhdr->dh_end != dev->l2ad_end ||
+	    l2dhdr->dh_evict < dev->l2ad_start ||
+	    l2dhdr->dh_evict > dev->l2ad_end)
+		return (SET_ERROR(ESTALE));
+
+	return (0);
+}
+
+/*
+ * Distance going backwards from the write hand to addr, wrapping around
+ * the device. The most recently written data is closest to the hand.
+ */
+static uint64_t
+l2arc_hand_distance(l2arc_dev_t *dev, uint64_t addr)
+{
+	uint64_t size = dev->l2ad_end - dev->l2ad_start;
+
+	return ((dev->l2ad_hand + size - addr) % size);
+}
+
+/*
+ * Checks that a log block pointer is sane, and that neither the log block
+ * nor the buffers it describes have been overwritten. Valid data lies
+ * between the evict hand and the write hand. Walking the chain from the
+ * newest log block, each log block must also lie further back from the
+ * write hand than its successor's payload, min_dist, which guarantees
+ * that the walk terminates.
+ */
+static boolean_t
+l2arc_log_blkptr_valid(l2arc_dev_t *dev, const l2arc_log_blkptr_t *lbp,
+    uint64_t min_dist)
+{
+	uint64_t psize = L2BLK_GET_PSIZE(lbp->lbp_prop);
+	uint64_t asize, end, start_dist, end_dist;
+
+	if (L2BLK_GET_LSIZE(lbp->lbp_prop) != sizeof (l2arc_log_blk_phys_t) ||
+	    psize == 0 || psize > sizeof (l2arc_log_blk_phys_t))
+		return (B_FALSE);
+
+	asize = vdev_psize_to_asize(dev->l2ad_vdev, psize);
+	end = lbp->lbp_daddr + asize;
+	if (lbp->lbp_daddr < dev->l2ad_start || end > dev->l2ad_end ||
+	    lbp->lbp_payload_start < dev->l2ad_start ||
+	    lbp->lbp_payload_start >= dev->l2ad_end)
+		return (B_FALSE);
+
+	start_dist = l2arc_hand_distance(dev, lbp->lbp_payload_start);
+	end_dist = l2arc_hand_distance(dev, end);
+
+	return (end_dist >= min_dist && start_dist > end_dist &&
+	    start_dist <= l2arc_hand_distance(dev, dev->l2ad_evict));
+}
+
+/*
+ * Starts reading a log block. The returned zio is waited on, and the
+ * buffer consumed, by l2arc_log_blk_read().
+ */
+static zio_t *
+l2arc_log_blk_fetch(l2arc_dev_t *dev, const l2arc_log_blkptr_t *lbp,
+    abd_t **abdp)
+{
+	vdev_t *vd = dev->l2ad_vdev;
+	uint64_t asize = vdev_psize_to_asize(vd,
+	    L2BLK_GET_PSIZE(lbp->lbp_prop));
+	zio_t *pio;
+
+	*abdp = abd_alloc_for_io(asize, B_TRUE);
+	pio = zio_root(vd->vdev_spa, NULL, NULL, L2ARC_REBUILD_ZIO_FLAGS);
+	(void) zio_nowait(zio_read_phys(pio, vd, lbp->lbp_daddr, asize,
+	    *abdp, ZIO_CHECKSUM_OFF, NULL, NULL, ZIO_PRIORITY_ASYNC_READ,
+	    L2ARC_REBUILD_ZIO_FLAGS, B_FALSE));
+
+	return (pio);
+}
+
+/*
+ * Waits for a log block read started by l2arc_log_blk_fetch(), verifies
+ * it and decompresses it into lb.
+ */
+static int
+l2arc_log_blk_read(l2arc_dev_t *dev, const l2arc_log_blkptr_t *lbp,
+    zio_t *zio, abd_t *abd, l2arc_log_blk_phys_t *lb)
+{
+	uint64_t psize = L2BLK_GET_PSIZE(lbp->lbp_prop);
+	uint64_t asize = vdev_psize_to_asize(dev->l2ad_vdev, psize);
+	zio_cksum_t cksum;
+	void *tmp;
+	int err;
+
+	err = zio_wait(zio);
+	if (err != 0) {
+		ARCSTAT_BUMP(arcstat_l2_rebuild_io_errors);
+		abd_free(abd);
+		return (err);
+	}
+
+	tmp = abd_borrow_buf_copy(abd, asize);
+	fletcher_4_native(tmp, asize, NULL, &cksum);
+	if (L2BLK_GET_CHECKSUM(lbp->lbp_prop) != ZIO_CHECKSUM_FLETCHER_4 ||
+	    !ZIO_CHECKSUM_EQUAL(cksum, lbp->lbp_cksum)) {
+		ARCSTAT_BUMP(arcstat_l2_rebuild_cksum_lb_errors);
+		err = SET_ERROR(ECKSUM);
+	} else {
+		switch (L2BLK_GET_COMPRESS(lbp->lbp_prop)) {
+		case ZIO_COMPRESS_OFF:
+			if (psize != sizeof (*lb))
+				err = SET_ERROR(EINVAL);
+			else
+				bcopy(tmp, lb, sizeof (*lb));
+			break;
+		case ZIO_COMPRESS_LZ4:
+			if (zio_decompress_data_buf(ZIO_COMPRESS_LZ4, tmp, lb,
+			    psize, sizeof (*lb)) != 0)
+				err = SET_ERROR(EINVAL);
+			break;
+		default:
+			err = SET_ERROR(EINVAL);
+			break;
+		}
+		if (err == 0 && lb->lb_magic != L2ARC_LOG_BLK_MAGIC)
+			err = SET_ERROR(EINVAL);
+		if (err != 0)
+			ARCSTAT_BUMP(arcstat_l2_rebuild_cksum_lb_errors);
+	}
+	abd_return_buf(abd, tmp, asize);
+	abd_free(abd);
+
+	return (err);
+}
+
+/*
+ * Recreates the L2-only header of a buffer described by a log entry,
+ * unless the buffer is already in the ARC.
+ */
+static void
+l2arc_hdr_restore(const l2arc_log_ent_phys_t *le, l2arc_dev_t *dev)
+{
+	arc_buf_hdr_t *hdr, *exists;
+	kmutex_t *hash_lock;
+	arc_buf_contents_t type = L2BLK_GET_TYPE(le->le_prop);
+	uint64_t lsize = L2BLK_GET_LSIZE(le->le_prop);
+	uint64_t psize = L2BLK_GET_PSIZE(le->le_prop);
+	uint64_t compress = L2BLK_GET_COMPRESS(le->le_prop);
+	uint64_t asize;
+
+	/* The log block checksum verified; this guards against bugs. */
+	if ((type != ARC_BUFC_DATA && type != ARC_BUFC_METADATA) ||
+	    compress >= ZIO_COMPRESS_FUNCTIONS || psize == 0 ||
+	    psize > lsize || DVA_IS_EMPTY(&le->le_dva) || le->le_birth == 0)
+		return;
+	asize = vdev_psize_to_asize(dev->l2ad_vdev, psize);
+	if (le->le_daddr < dev->l2ad_start ||
+	    le->le_daddr + asize > dev->l2ad_end)
+		return;
+
+	hdr = kmem_cache_alloc(hdr_l2only_cache, KM_SLEEP);
+	hdr->b_flags = 0;
+	HDR_SET_LSIZE(hdr, lsize);
+	HDR_SET_PSIZE(hdr, psize);
+	hdr->b_type = type;
+	arc_hdr_set_flags(hdr, arc_bufc_to_flags(type) | ARC_FLAG_HAS_L2HDR);
+	arc_hdr_set_compress(hdr, compress);
+	if (L2BLK_GET_PROTECTED(le->le_prop))
+		arc_hdr_set_flags(hdr, ARC_FLAG_PROTECTED);
+	if (L2BLK_GET_PREFETCH(le->le_prop))
+		arc_hdr_set_flags(hdr, ARC_FLAG_PREFETCH);
+	hdr->b_l2hdr.b_dev = dev;
+	hdr->b_l2hdr.b_daddr = le->le_daddr;
+	hdr->b_l2hdr.b_hits = 0;
+	hdr->b_spa = spa_load_guid(dev->l2ad_spa);
+	hdr->b_birth = le->le_birth;
+	hdr->b_dva = le->le_dva;
+
+	/*
+	 * Account for the buffer before it becomes visible; if it turns
+	 * out to be cached already, arc_hdr_destroy() undoes all of this.
+	 */
+	ARCSTAT_INCR(arcstat_l2_lsize, lsize);
+	ARCSTAT_INCR(arcstat_l2_psize, psize);
+	vdev_space_update(dev->l2ad_vdev, asize, 0, 0);
+
+	/*
+	 * Log blocks are restored newest first, and their entries in
+	 * reverse, so appending keeps the buffer list ordered from the
+	 * most recently written buffer at the head to the oldest one.
+	 */
+	mutex_enter(&dev->l2ad_mtx);
+	list_insert_tail(&dev->l2ad_buflist, hdr);
+	(void) zfs_refcount_add_many(&dev->l2ad_alloc, arc_hdr_size(hdr), hdr);
+	mutex_exit(&dev->l2ad_mtx);
+
+	exists = buf_hash_insert(hdr, &hash_lock);
+	if (exists != NULL) {
+		arc_hdr_destroy(hdr);
+		ARCSTAT_BUMP(arcstat_l2_rebuild_bufs_precached);
+	} else {
+		ARCSTAT_BUMP(arcstat_l2_rebuild_bufs);
+		ARCSTAT_INCR(arcstat_l2_rebuild_size, lsize);
+		ARCSTAT_INCR(arcstat_l2_rebuild_asize, asize);
+	}
+	mutex_exit(hash_lock);
+}
+
+/*
+ * Restores the buffers of a log block, newest first.
+ */
+static void
+l2arc_log_blk_restore(l2arc_dev_t *dev, const l2arc_log_blk_phys_t *lb)
+{
+	for (int i = L2ARC_LOG_BLK_MAX_ENTRIES - 1; i >= 0; i--)
+		l2arc_hdr_restore(&lb->lb_entries[i], dev);
+
+	ARCSTAT_BUMP(arcstat_l2_rebuild_log_blks);
+}
+
+/*
+ * Resets a device to its state before anything was written to it.
+ */
+static void
+l2arc_dev_reset(l2arc_dev_t *dev)
+{
+	bzero(dev->l2ad_dev_hdr, dev->l2ad_dev_hdr_asize);
+	dev->l2ad_hand = dev->l2ad_start;
+	dev->l2ad_evict = dev->l2ad_start;
+	dev->l2ad_first = B_TRUE;
+}
+
+/*
+ * Rebuilds the L2ARC from a cache device: reads its device header, then
+ * walks the chain of log blocks from the newest one, restoring the
+ * buffers each describes. The next log block is read while the current
+ * one is being restored. The walk stops at the first log block that is
+ * no longer valid, when the system runs low on memory, or when the
+ * device is being removed.
+ */
+static int
+l2arc_rebuild(l2arc_dev_t *dev)
+{
+	vdev_t *vd = dev->l2ad_vdev;
+	l2arc_log_blk_phys_t *lb;
+	l2arc_log_blkptr_t lbp, next_lbp;
+	zio_t *this_io, *next_io = NULL;
+	abd_t *this_abd, *next_abd = NULL;
+	int err;
+
+	err = l2arc_dev_hdr_read(dev);
+	if (err != 0) {
+		l2arc_dev_reset(dev);
+		return (err);
+	}
+
+	/*
+	 * Pick up where we left off: the write hand follows the newest
+	 * log block, and buffers written after it are lost.
+	 */
+	lbp = dev->l2ad_dev_hdr->dh_start_lbp;
+	dev->l2ad_evict = dev->l2ad_dev_hdr->dh_evict;
+	dev->l2ad_first = !!(dev->l2ad_dev_hdr->dh_flags &
+	    L2ARC_DEV_HDR_EVICT_FIRST);
+	dev->l2ad_hand = lbp.lbp_daddr +
+	    vdev_psize_to_asize(vd, L2BLK_GET_PSIZE(lbp.lbp_prop));
+	if (!l2arc_log_blkptr_valid(dev, &lbp, 0)) {
+		l2arc_dev_reset(dev);
+		return (0);
+	}
+
+	lb = vmem_alloc(sizeof (*lb), KM_SLEEP);
+	this_io = l2arc_log_blk_fetch(dev, &lbp, &this_abd);
+	for (;;) {
+		err = l2arc_log_blk_read(dev, &lbp, this_io, this_abd, lb);
+		if (err != 0)
+			break;
+
+		next_lbp = lb->lb_prev_lbp;
+		if (l2arc_log_blkptr_valid(dev, &next_lbp,
+		    l2arc_hand_distance(dev, lbp.lbp_payload_start)))
+			next_io = l2arc_log_blk_fetch(dev, &next_lbp,
+			    &next_abd);
+
+		if (dev->l2ad_rebuild_cancel) {
+			err = SET_ERROR(ECANCELED);
+			break;
+		}
+
+		/*
+		 * Don't add to memory pressure; whatever isn't restored
+		 * will be overwritten in due course.
+		 */
+		if (arc_reclaim_needed()) {
+			ARCSTAT_BUMP(arcstat_l2_rebuild_lowmem);
+			err = SET_ERROR(ENOMEM);
+			break;
+		}
+
+		l2arc_log_blk_restore(dev, lb);
+
+		if (next_io == NULL)
+			break;
+		lbp = next_lbp;
+		this_io = next_io;
+		this_abd = next_abd;
+		next_io = NULL;
+	}
+
+	if (next_io != NULL) {
+		(void) zio_wait(next_io);
+		abd_free(next_abd);
+	}
+	vmem_free(lb, sizeof (*lb));
+
+	if (err == 0)
+		ARCSTAT_BUMP(arcstat_l2_rebuild_success);
+
+	return (err);
+}
+
+/*
+ * Asynchronous L2ARC rebuild, started by l2arc_add_vdev().
+ */
+static void
+l2arc_dev_rebuild_thread(void *arg)
+{
+	l2arc_dev_t *dev = arg;
+	uint64_t guid = dev->l2ad_vdev->vdev_guid;
+	hrtime_t start = gethrtime();
+	fstrans_cookie_t cookie;
+	uint64_t elapsed;
+	int err;
+
+	VERIFY(dev->l2ad_rebuild);
+
+	cookie = spl_fstrans_mark();
+	err = l2arc_rebuild(dev);
+	spl_fstrans_unmark(cookie);
+
+	elapsed = NSEC2MSEC(gethrtime() - start);
+	ARCSTAT_INCR(arcstat_l2_rebuild_time_ms, elapsed);
+	zfs_dbgmsg("L2ARC rebuild of vdev %llu finished in %llu ms, err %d",
+	    (u_longlong_t)guid, (u_longlong_t)elapsed, err);
+
+	/* the device may be freed as soon as we drop the lock */
+	mutex_enter(&l2arc_rebuild_thr_lock);
+	dev->l2ad_rebuild = B_FALSE;
+	cv_broadcast(&l2arc_rebuild_thr_cv);
+	mutex_exit(&l2arc_rebuild_thr_lock);
+
+	thread_exit();
+}
+
 #if defined(_KERNEL)
 EXPORT_SYMBOL(arc_buf_size);
 EXPORT_SYMBOL(arc_write);
@@ -9380,6 +10292,9 @@ ZFS_MODULE_PARAM(zfs_l2arc, l2arc_, feed_again, UINT, ZMOD_RW, "Turbo L2ARC warm
 
 ZFS_MODULE_PARAM(zfs_l2arc, l2arc_, norw, UINT, ZMOD_RW, "No reads during writes");
 
+ZFS_MODULE_PARAM(zfs_l2arc, l2arc_, rebuild_enabled, UINT, ZMOD_RW,
+	"Rebuild the L2ARC when importing a pool");
+
 ZFS_MODULE_PARAM(zfs_arc, zfs_arc_, lotsfree_percent, UINT, ZMOD_RW,
 	"System free memory I/O throttle in bytes");
 
@@ -9393,5 +10308,8 @@ ZFS_MODULE_PARAM(zfs_arc, zfs_arc_, dnode_limit_percent, UQUAD, ZMOD_RW,
 
 ZFS_MODULE_PARAM(zfs_arc, zfs_arc_, dnode_reduce_percent, UQUAD, ZMOD_RW,
 	"Percentage of excess dnodes to try to unpin");
+
+ZFS_MODULE_PARAM(zfs_arc, zfs_arc_, evict_threads, UINT, ZMOD_RD,
+	"Number of threads to use for ARC eviction");
 /* END CSTYLED */
 #endif
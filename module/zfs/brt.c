@@ -0,0 +1,781 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/spa.h>
+#include <sys/spa_impl.h>
+#include <sys/vdev_impl.h>
+#include <sys/zio.h>
+#include <sys/brt.h>
+#include <sys/zap.h>
+#include <sys/dmu_tx.h>
+#include <sys/dsl_pool.h>
+#include <sys/zfeature.h>
+
+/*
+ * Block Reference Table (BRT)
+ *
+ * Block cloning lets a range of a file be copied by pointing the
+ * destination at the existing blocks of the source, instead of reading
+ * and rewriting the data.  Such a block is then referenced by more than
+ * one block pointer, and it must not be freed until the last of them
+ * goes away.  Unlike dedup, the block pointers are not marked in any way;
+ * instead the pool keeps a table, keyed by the vdev and offset of the
+ * first DVA, of the blocks which have additional references.
+ *
+ * The table is a single ZAP object in the MOS.  Each entry holds the
+ * number of references in addition to the original one.  When a block is
+ * freed (see zio_free_sync()) and it has an entry, the count is
+ * decremented and the free is skipped; only a block with no entry is
+ * really freed.
+ *
+ * Looking up every freed block in the ZAP would be expensive, so for each
+ * vdev we keep the number of entries in each BRT_RANGESIZE region in
+ * memory (and on disk, so it does not have to be rebuilt at import).  If
+ * the region of a block has no entries, the block was never cloned.  Only
+ * level 0 blocks of non-metadata objects can be cloned, which also means
+ * that the frees of MOS blocks done by brt_sync() never come back here.
+ *
+ * Clones are made in open context, while frees are processed in syncing
+ * context.  New references are therefore first collected in a per-txg
+ * pending tree, and are applied to the table at the start of spa_sync(),
+ * before any block of that txg can be freed.  The updated entries are
+ * kept in brt_tree until they are written out by brt_sync().
+ *
+ * For each vdev we also keep the space of the blocks which have entries
+ * (counted once each) and the space which their additional references
+ * would otherwise have taken.  These are the pool's bcloneused and
+ * bclonesaved properties, and the pool's available space is increased by
+ * the latter (see brt_get_dspace()), in the same way as for dedup.
+ */
+
+static kmem_cache_t *brt_entry_cache;
+
+static int brt_zap_leaf_blockshift = 12;
+static int brt_zap_indirect_blockshift = 12;
+
+static int
+brt_entry_compare(const void *x1, const void *x2)
+{
+	const brt_entry_t *bre1 = x1;
+	const brt_entry_t *bre2 = x2;
+
+	int cmp = AVL_CMP(bre1->bre_vdev, bre2->bre_vdev);
+	if (likely(cmp))
+		return (cmp);
+
+	return (AVL_CMP(bre1->bre_offset, bre2->bre_offset));
+}
+
+static boolean_t
+brt_bp_is_cloneable(const blkptr_t *bp)
+{
+	return (!BP_IS_HOLE(bp) && !BP_IS_EMBEDDED(bp) &&
+	    BP_GET_LEVEL(bp) == 0 && !DMU_OT_IS_METADATA(BP_GET_TYPE(bp)));
+}
+
+static void
+brt_entry_fill(brt_entry_t *bre, const blkptr_t *bp)
+{
+	bre->bre_vdev = DVA_GET_VDEV(&bp->blk_dva[0]);
+	bre->bre_offset = DVA_GET_OFFSET(&bp->blk_dva[0]);
+}
+
+static brt_entry_t *
+brt_entry_alloc(const brt_entry_t *bre_search)
+{
+	brt_entry_t *bre = kmem_cache_alloc(brt_entry_cache, KM_SLEEP);
+
+	bre->bre_vdev = bre_search->bre_vdev;
+	bre->bre_offset = bre_search->bre_offset;
+	bre->bre_refcount = 0;
+	bre->bre_ondisk = B_FALSE;
+	BP_ZERO(&bre->bre_bp);
+
+	return (bre);
+}
+
+static void
+brt_tree_free(avl_tree_t *tree)
+{
+	brt_entry_t *bre;
+	void *cookie = NULL;
+
+	while ((bre = avl_destroy_nodes(tree, &cookie)) != NULL)
+		kmem_cache_free(brt_entry_cache, bre);
+}
+
+/*
+ * Return the state of the given vdev, allocating it when 'alloc' is set.
+ */
+static brt_vdev_t *
+brt_vdev(brt_t *brt, uint64_t vdevid, boolean_t alloc)
+{
+	ASSERT(RW_LOCK_HELD(&brt->brt_lock));
+
+	if (vdevid >= brt->brt_nvdevs) {
+		if (!alloc)
+			return (NULL);
+
+		ASSERT(RW_WRITE_HELD(&brt->brt_lock));
+		uint64_t nvdevs = vdevid + 1;
+		brt_vdev_t **vdevs = kmem_zalloc(nvdevs *
+		    sizeof (brt_vdev_t *), KM_SLEEP);
+		if (brt->brt_nvdevs != 0) {
+			bcopy(brt->brt_vdevs, vdevs,
+			    brt->brt_nvdevs * sizeof (brt_vdev_t *));
+			kmem_free(brt->brt_vdevs,
+			    brt->brt_nvdevs * sizeof (brt_vdev_t *));
+		}
+		brt->brt_vdevs = vdevs;
+		brt->brt_nvdevs = nvdevs;
+	}
+
+	brt_vdev_t *bv = brt->brt_vdevs[vdevid];
+	if (bv == NULL && alloc) {
+		ASSERT(RW_WRITE_HELD(&brt->brt_lock));
+		bv = kmem_zalloc(sizeof (brt_vdev_t), KM_SLEEP);
+		bv->bv_vdevid = vdevid;
+		bv->bv_dirty_start = UINT64_MAX;
+		brt->brt_vdevs[vdevid] = bv;
+	}
+
+	return (bv);
+}
+
+static void
+brt_vdev_grow(brt_vdev_t *bv, uint64_t nregions)
+{
+	if (nregions <= bv->bv_nregions)
+		return;
+
+	uint16_t *entcount = kmem_zalloc(nregions * sizeof (uint16_t),
+	    KM_SLEEP);
+	if (bv->bv_nregions != 0) {
+		bcopy(bv->bv_entcount, entcount,
+		    bv->bv_nregions * sizeof (uint16_t));
+		kmem_free(bv->bv_entcount,
+		    bv->bv_nregions * sizeof (uint16_t));
+	}
+	bv->bv_entcount = entcount;
+	bv->bv_nregions = nregions;
+}
+
+/*
+ * Adjust the entry count of the region holding the given offset.
+ */
+static void
+brt_vdev_entcount_adjust(brt_t *brt, uint64_t vdevid, uint64_t offset,
+    int delta)
+{
+	brt_vdev_t *bv = brt_vdev(brt, vdevid, B_TRUE);
+	uint64_t idx = offset >> BRT_RANGESIZE_SHIFT;
+
+	brt_vdev_grow(bv, idx + 1);
+
+	ASSERT(delta > 0 || bv->bv_entcount[idx] > 0);
+	ASSERT(delta < 0 || bv->bv_entcount[idx] < UINT16_MAX);
+	bv->bv_entcount[idx] += delta;
+
+	bv->bv_dirty_start = MIN(bv->bv_dirty_start, idx);
+	bv->bv_dirty_end = MAX(bv->bv_dirty_end, idx + 1);
+
+	brt->brt_nentries += delta;
+}
+
+static void
+brt_vdev_space_adjust(brt_t *brt, uint64_t vdevid, int64_t used,
+    int64_t saved)
+{
+	brt_vdev_t *bv = brt_vdev(brt, vdevid, B_TRUE);
+
+	ASSERT(used >= 0 || bv->bv_phys.bvp_usedspace >= -used);
+	ASSERT(saved >= 0 || bv->bv_phys.bvp_savedspace >= -saved);
+	bv->bv_phys.bvp_usedspace += used;
+	bv->bv_phys.bvp_savedspace += saved;
+	bv->bv_dirty = B_TRUE;
+}
+
+/*
+ * Find the in-core entry for the given block, reading it in from the BRT
+ * object if needed.  Returns NULL if the block has no entry.
+ */
+static brt_entry_t *
+brt_entry_lookup(brt_t *brt, const brt_entry_t *bre_search)
+{
+	objset_t *mos = brt->brt_spa->spa_meta_objset;
+	brt_entry_t *bre;
+	avl_index_t where;
+	uint64_t refcount;
+
+	ASSERT(RW_WRITE_HELD(&brt->brt_lock));
+
+	bre = avl_find(&brt->brt_tree, bre_search, &where);
+	if (bre != NULL)
+		return (bre);
+
+	if (brt->brt_object == 0)
+		return (NULL);
+
+	brt_vdev_t *bv = brt_vdev(brt, bre_search->bre_vdev, B_FALSE);
+	uint64_t idx = bre_search->bre_offset >> BRT_RANGESIZE_SHIFT;
+	if (bv == NULL || idx >= bv->bv_nregions || bv->bv_entcount[idx] == 0)
+		return (NULL);
+
+	int error = zap_lookup_uint64(mos, brt->brt_object,
+	    &bre_search->bre_vdev, 2, sizeof (uint64_t), 1, &refcount);
+	if (error == ENOENT)
+		return (NULL);
+	VERIFY0(error);
+	ASSERT3U(refcount, >, 0);
+
+	bre = brt_entry_alloc(bre_search);
+	bre->bre_refcount = refcount;
+	bre->bre_ondisk = B_TRUE;
+	avl_insert(&brt->brt_tree, bre, where);
+
+	return (bre);
+}
+
+/*
+ * Cheap check for whether the given block may have been cloned.  A false
+ * return is authoritative; a true one must be confirmed with
+ * brt_entry_decref() or brt_entry_get_refcount().
+ */
+boolean_t
+brt_maybe_exists(spa_t *spa, const blkptr_t *bp)
+{
+	brt_t *brt = spa->spa_brt;
+	boolean_t exists = B_FALSE;
+
+	if (brt == NULL || !brt_bp_is_cloneable(bp))
+		return (B_FALSE);
+
+	uint64_t vdevid = DVA_GET_VDEV(&bp->blk_dva[0]);
+	uint64_t idx = DVA_GET_OFFSET(&bp->blk_dva[0]) >> BRT_RANGESIZE_SHIFT;
+
+	rw_enter(&brt->brt_lock, RW_READER);
+	if (brt->brt_nentries != 0) {
+		brt_vdev_t *bv = brt_vdev(brt, vdevid, B_FALSE);
+		exists = (bv != NULL && idx < bv->bv_nregions &&
+		    bv->bv_entcount[idx] != 0);
+	}
+	rw_exit(&brt->brt_lock);
+
+	return (exists);
+}
+
+/*
+ * Called when a block pointer is freed.  If the block has additional
+ * references, drop one of them and return B_TRUE, in which case the
+ * block must not be freed.  zdb also uses this, on a read-only pool, to
+ * count each cloned block only once.
+ */
+boolean_t
+brt_entry_decref(spa_t *spa, const blkptr_t *bp)
+{
+	brt_t *brt = spa->spa_brt;
+	brt_entry_t bre_search, *bre;
+	boolean_t shared = B_FALSE;
+
+	ASSERT(dsl_pool_sync_context(spa_get_dsl(spa)) || !spa_writeable(spa));
+
+	brt_entry_fill(&bre_search, bp);
+
+	rw_enter(&brt->brt_lock, RW_WRITER);
+	bre = brt_entry_lookup(brt, &bre_search);
+	if (bre != NULL && bre->bre_refcount > 0) {
+		int64_t dsize = bp_get_dsize_sync(spa, bp);
+
+		bre->bre_refcount--;
+		if (bre->bre_refcount == 0) {
+			brt_vdev_entcount_adjust(brt, bre->bre_vdev,
+			    bre->bre_offset, -1);
+		}
+		brt_vdev_space_adjust(brt, bre->bre_vdev,
+		    bre->bre_refcount == 0 ? -dsize : 0, -dsize);
+		shared = B_TRUE;
+	}
+	rw_exit(&brt->brt_lock);
+
+	return (shared);
+}
+
+/*
+ * Return the number of additional references to the given block.  This
+ * is only used by zdb, so it does not bother to cache the entry.
+ */
+uint64_t
+brt_entry_get_refcount(spa_t *spa, const blkptr_t *bp)
+{
+	brt_t *brt = spa->spa_brt;
+	brt_entry_t bre_search, *bre;
+	uint64_t refcount = 0;
+
+	if (!brt_maybe_exists(spa, bp))
+		return (0);
+
+	brt_entry_fill(&bre_search, bp);
+
+	rw_enter(&brt->brt_lock, RW_READER);
+	bre = avl_find(&brt->brt_tree, &bre_search, NULL);
+	if (bre != NULL) {
+		refcount = bre->bre_refcount;
+	} else if (brt->brt_object != 0) {
+		int error = zap_lookup_uint64(spa->spa_meta_objset,
+		    brt->brt_object, &bre_search.bre_vdev, 2,
+		    sizeof (uint64_t), 1, &refcount);
+		if (error != 0) {
+			ASSERT3U(error, ==, ENOENT);
+			refcount = 0;
+		}
+	}
+	rw_exit(&brt->brt_lock);
+
+	return (refcount);
+}
+
+static void
+brt_get_space(spa_t *spa, uint64_t *usedp, uint64_t *savedp)
+{
+	brt_t *brt = spa->spa_brt;
+	uint64_t used = 0, saved = 0;
+
+	if (brt != NULL) {
+		rw_enter(&brt->brt_lock, RW_READER);
+		for (uint64_t i = 0; i < brt->brt_nvdevs; i++) {
+			brt_vdev_t *bv = brt->brt_vdevs[i];
+
+			if (bv != NULL) {
+				used += bv->bv_phys.bvp_usedspace;
+				saved += bv->bv_phys.bvp_savedspace;
+			}
+		}
+		rw_exit(&brt->brt_lock);
+	}
+
+	*usedp = used;
+	*savedp = saved;
+}
+
+/*
+ * The space saved by cloning, which is added to the pool's available
+ * space by spa_update_dspace().
+ */
+uint64_t
+brt_get_dspace(spa_t *spa)
+{
+	return (brt_get_saved(spa));
+}
+
+/*
+ * The space of the blocks which have been cloned, each counted once.
+ */
+uint64_t
+brt_get_used(spa_t *spa)
+{
+	uint64_t used, saved;
+
+	brt_get_space(spa, &used, &saved);
+	return (used);
+}
+
+/*
+ * The space which the additional references to cloned blocks would take
+ * if they had been copied.
+ */
+uint64_t
+brt_get_saved(spa_t *spa)
+{
+	uint64_t used, saved;
+
+	brt_get_space(spa, &used, &saved);
+	return (saved);
+}
+
+/*
+ * The ratio of the space referenced through cloned blocks to the space
+ * they use, times 100, as for ddt_get_pool_dedup_ratio().
+ */
+uint64_t
+brt_get_ratio(spa_t *spa)
+{
+	uint64_t used, saved;
+
+	brt_get_space(spa, &used, &saved);
+	if (used == 0)
+		return (100);
+
+	return ((used + saved) * 100 / used);
+}
+
+/*
+ * Record a new reference to the given block, made in open context by
+ * dmu_brt_clone().  It is added to the table when the txg syncs.
+ */
+void
+brt_pending_add(spa_t *spa, const blkptr_t *bp, dmu_tx_t *tx)
+{
+	brt_t *brt = spa->spa_brt;
+	uint64_t txg = dmu_tx_get_txg(tx);
+	brt_entry_t bre_search, *bre;
+	avl_index_t where;
+
+	ASSERT(brt_bp_is_cloneable(bp));
+
+	brt_entry_fill(&bre_search, bp);
+
+	mutex_enter(&brt->brt_pending_lock[txg & TXG_MASK]);
+	avl_tree_t *tree = &brt->brt_pending_tree[txg & TXG_MASK];
+	bre = avl_find(tree, &bre_search, &where);
+	if (bre == NULL) {
+		bre = brt_entry_alloc(&bre_search);
+		bre->bre_bp = *bp;
+		avl_insert(tree, bre, where);
+	}
+	bre->bre_refcount++;
+	mutex_exit(&brt->brt_pending_lock[txg & TXG_MASK]);
+}
+
+/*
+ * Move the references added in the given txg into the table.  This must
+ * be done before any block of the txg is freed.
+ */
+void
+brt_pending_apply(spa_t *spa, uint64_t txg)
+{
+	brt_t *brt = spa->spa_brt;
+	avl_tree_t *pending = &brt->brt_pending_tree[txg & TXG_MASK];
+	brt_entry_t *pbre, *bre;
+	void *cookie = NULL;
+	avl_index_t where;
+
+	/*
+	 * Nothing can be added to the tree of the syncing txg.
+	 */
+	if (avl_is_empty(pending))
+		return;
+
+	rw_enter(&brt->brt_lock, RW_WRITER);
+	while ((pbre = avl_destroy_nodes(pending, &cookie)) != NULL) {
+		bre = brt_entry_lookup(brt, pbre);
+		if (bre == NULL) {
+			VERIFY3P(avl_find(&brt->brt_tree, pbre, &where),
+			    ==, NULL);
+			bre = brt_entry_alloc(pbre);
+			avl_insert(&brt->brt_tree, bre, where);
+		}
+		int64_t dsize = bp_get_dsize_sync(spa, &pbre->bre_bp);
+
+		if (bre->bre_refcount == 0) {
+			brt_vdev_entcount_adjust(brt, bre->bre_vdev,
+			    bre->bre_offset, 1);
+		}
+		brt_vdev_space_adjust(brt, bre->bre_vdev,
+		    bre->bre_refcount == 0 ? dsize : 0,
+		    pbre->bre_refcount * dsize);
+		bre->bre_refcount += pbre->bre_refcount;
+
+		kmem_cache_free(brt_entry_cache, pbre);
+	}
+	rw_exit(&brt->brt_lock);
+}
+
+static void
+brt_vdev_name(uint64_t vdevid, char *name, size_t len)
+{
+	(void) snprintf(name, len, DMU_POOL_BRT_VDEV, (u_longlong_t)vdevid);
+}
+
+static void
+brt_vdev_sync(brt_t *brt, brt_vdev_t *bv, dmu_tx_t *tx)
+{
+	objset_t *mos = brt->brt_spa->spa_meta_objset;
+	brt_vdev_phys_t *bvp = &bv->bv_phys;
+	char name[32];
+
+	if (bv->bv_dirty_start >= bv->bv_dirty_end && !bv->bv_dirty)
+		return;
+
+	brt_vdev_name(bv->bv_vdevid, name, sizeof (name));
+
+	if (bvp->bvp_object == 0) {
+		bvp->bvp_object = dmu_object_alloc(mos,
+		    DMU_OTN_UINT16_METADATA, SPA_OLD_MAXBLOCKSIZE,
+		    DMU_OT_NONE, 0, tx);
+		VERIFY0(zap_add(mos, DMU_POOL_DIRECTORY_OBJECT, name,
+		    sizeof (uint64_t), sizeof (brt_vdev_phys_t) /
+		    sizeof (uint64_t), bvp, tx));
+	}
+
+	if (bv->bv_dirty_start < bv->bv_dirty_end) {
+		dmu_write(mos, bvp->bvp_object,
+		    bv->bv_dirty_start * sizeof (uint16_t),
+		    (bv->bv_dirty_end - bv->bv_dirty_start) *
+		    sizeof (uint16_t), &bv->bv_entcount[bv->bv_dirty_start],
+		    tx);
+	}
+	bvp->bvp_nregions = bv->bv_nregions;
+
+	VERIFY0(zap_update(mos, DMU_POOL_DIRECTORY_OBJECT, name,
+	    sizeof (uint64_t), sizeof (brt_vdev_phys_t) / sizeof (uint64_t),
+	    bvp, tx));
+
+	bv->bv_dirty_start = UINT64_MAX;
+	bv->bv_dirty_end = 0;
+	bv->bv_dirty = B_FALSE;
+}
+
+static void
+brt_destroy(brt_t *brt, dmu_tx_t *tx)
+{
+	objset_t *mos = brt->brt_spa->spa_meta_objset;
+	char name[32];
+
+	ASSERT0(brt->brt_nentries);
+
+	for (uint64_t i = 0; i < brt->brt_nvdevs; i++) {
+		brt_vdev_t *bv = brt->brt_vdevs[i];
+
+		if (bv == NULL)
+			continue;
+
+		ASSERT0(bv->bv_phys.bvp_usedspace);
+		ASSERT0(bv->bv_phys.bvp_savedspace);
+		if (bv->bv_phys.bvp_object != 0) {
+			brt_vdev_name(bv->bv_vdevid, name, sizeof (name));
+			VERIFY0(zap_remove(mos, DMU_POOL_DIRECTORY_OBJECT,
+			    name, tx));
+			VERIFY0(dmu_object_free(mos, bv->bv_phys.bvp_object,
+			    tx));
+		}
+		bzero(&bv->bv_phys, sizeof (brt_vdev_phys_t));
+		bv->bv_dirty_start = UINT64_MAX;
+		bv->bv_dirty_end = 0;
+		bv->bv_dirty = B_FALSE;
+	}
+
+	if (brt->brt_object != 0) {
+		VERIFY0(zap_remove(mos, DMU_POOL_DIRECTORY_OBJECT,
+		    DMU_POOL_BRT, tx));
+		VERIFY0(zap_destroy(mos, brt->brt_object, tx));
+		brt->brt_object = 0;
+		spa_feature_decr(brt->brt_spa, SPA_FEATURE_BLOCK_CLONING, tx);
+	}
+}
+
+/*
+ * Write the entries modified in this sync pass to the BRT object, and
+ * the region counts to the per-vdev objects.  The BRT is destroyed, and
+ * the feature deactivated, once it no longer has any entries.
+ */
+void
+brt_sync(spa_t *spa, uint64_t txg)
+{
+	brt_t *brt = spa->spa_brt;
+	objset_t *mos = spa->spa_meta_objset;
+	brt_entry_t *bre;
+	void *cookie = NULL;
+	dmu_tx_t *tx;
+
+	rw_enter(&brt->brt_lock, RW_WRITER);
+
+	if (avl_is_empty(&brt->brt_tree)) {
+		rw_exit(&brt->brt_lock);
+		return;
+	}
+
+	tx = dmu_tx_create_assigned(spa->spa_dsl_pool, txg);
+
+	if (brt->brt_nentries == 0) {
+		brt_tree_free(&brt->brt_tree);
+		brt_destroy(brt, tx);
+		dmu_tx_commit(tx);
+		rw_exit(&brt->brt_lock);
+		return;
+	}
+
+	if (brt->brt_object == 0) {
+		brt->brt_object = zap_create_flags(mos, 0,
+		    ZAP_FLAG_HASH64 | ZAP_FLAG_UINT64_KEY,
+		    DMU_OTN_ZAP_METADATA, brt_zap_leaf_blockshift,
+		    brt_zap_indirect_blockshift, DMU_OT_NONE, 0, tx);
+		VERIFY0(zap_add(mos, DMU_POOL_DIRECTORY_OBJECT, DMU_POOL_BRT,
+		    sizeof (uint64_t), 1, &brt->brt_object, tx));
+		spa_feature_incr(spa, SPA_FEATURE_BLOCK_CLONING, tx);
+	}
+
+	while ((bre = avl_destroy_nodes(&brt->brt_tree, &cookie)) != NULL) {
+		if (bre->bre_refcount != 0) {
+			VERIFY0(zap_update_uint64(mos, brt->brt_object,
+			    &bre->bre_vdev, 2, sizeof (uint64_t), 1,
+			    &bre->bre_refcount, tx));
+		} else if (bre->bre_ondisk) {
+			VERIFY0(zap_remove_uint64(mos, brt->brt_object,
+			    &bre->bre_vdev, 2, tx));
+		}
+		kmem_cache_free(brt_entry_cache, bre);
+	}
+
+	for (uint64_t i = 0; i < brt->brt_nvdevs; i++) {
+		if (brt->brt_vdevs[i] != NULL)
+			brt_vdev_sync(brt, brt->brt_vdevs[i], tx);
+	}
+
+	dmu_tx_commit(tx);
+	rw_exit(&brt->brt_lock);
+}
+
+void
+brt_create(spa_t *spa)
+{
+	brt_t *brt = kmem_zalloc(sizeof (brt_t), KM_SLEEP);
+
+	brt->brt_spa = spa;
+	rw_init(&brt->brt_lock, NULL, RW_DEFAULT, NULL);
+	avl_create(&brt->brt_tree, brt_entry_compare, sizeof (brt_entry_t),
+	    offsetof(brt_entry_t, bre_node));
+	for (int t = 0; t < TXG_SIZE; t++) {
+		mutex_init(&brt->brt_pending_lock[t], NULL, MUTEX_DEFAULT,
+		    NULL);
+		avl_create(&brt->brt_pending_tree[t], brt_entry_compare,
+		    sizeof (brt_entry_t), offsetof(brt_entry_t, bre_node));
+	}
+
+	spa->spa_brt = brt;
+}
+
+static int
+brt_vdev_load(brt_t *brt, uint64_t vdevid)
+{
+	objset_t *mos = brt->brt_spa->spa_meta_objset;
+	brt_vdev_phys_t bvp;
+	char name[32];
+	int error;
+
+	brt_vdev_name(vdevid, name, sizeof (name));
+	error = zap_lookup(mos, DMU_POOL_DIRECTORY_OBJECT, name,
+	    sizeof (uint64_t), sizeof (brt_vdev_phys_t) / sizeof (uint64_t),
+	    &bvp);
+	if (error != 0)
+		return (error == ENOENT ? 0 : error);
+
+	brt_vdev_t *bv = brt_vdev(brt, vdevid, B_TRUE);
+	bv->bv_phys = bvp;
+	brt_vdev_grow(bv, bvp.bvp_nregions);
+
+	error = dmu_read(mos, bvp.bvp_object, 0,
+	    bvp.bvp_nregions * sizeof (uint16_t), bv->bv_entcount,
+	    DMU_READ_PREFETCH);
+	if (error != 0)
+		return (error);
+
+	for (uint64_t i = 0; i < bv->bv_nregions; i++)
+		brt->brt_nentries += bv->bv_entcount[i];
+
+	return (0);
+}
+
+int
+brt_load(spa_t *spa)
+{
+	vdev_t *rvd = spa->spa_root_vdev;
+	brt_t *brt;
+	int error;
+
+	brt_create(spa);
+	brt = spa->spa_brt;
+
+	error = zap_lookup(spa->spa_meta_objset, DMU_POOL_DIRECTORY_OBJECT,
+	    DMU_POOL_BRT, sizeof (uint64_t), 1, &brt->brt_object);
+	if (error != 0)
+		return (error == ENOENT ? 0 : error);
+
+	rw_enter(&brt->brt_lock, RW_WRITER);
+	for (uint64_t c = 0; c < rvd->vdev_children; c++) {
+		error = brt_vdev_load(brt, c);
+		if (error != 0)
+			break;
+	}
+	rw_exit(&brt->brt_lock);
+
+	return (error);
+}
+
+void
+brt_unload(spa_t *spa)
+{
+	brt_t *brt = spa->spa_brt;
+
+	if (brt == NULL)
+		return;
+
+	brt_tree_free(&brt->brt_tree);
+	avl_destroy(&brt->brt_tree);
+	for (int t = 0; t < TXG_SIZE; t++) {
+		brt_tree_free(&brt->brt_pending_tree[t]);
+		avl_destroy(&brt->brt_pending_tree[t]);
+		mutex_destroy(&brt->brt_pending_lock[t]);
+	}
+
+	for (uint64_t i = 0; i < brt->brt_nvdevs; i++) {
+		brt_vdev_t *bv = brt->brt_vdevs[i];
+
+		if (bv == NULL)
+			continue;
+		if (bv->bv_nregions != 0) {
+			kmem_free(bv->bv_entcount,
+			    bv->bv_nregions * sizeof (uint16_t));
+		}
+		kmem_free(bv, sizeof (brt_vdev_t));
+	}
+	if (brt->brt_nvdevs != 0) {
+		kmem_free(brt->brt_vdevs,
+		    brt->brt_nvdevs * sizeof (brt_vdev_t *));
+	}
+
+	rw_destroy(&brt->brt_lock);
+	kmem_free(brt, sizeof (brt_t));
+	spa->spa_brt = NULL;
+}
+
+void
+brt_init(void)
+{
+	brt_entry_cache = kmem_cache_create("brt_entry_cache",
+	    sizeof (brt_entry_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
+}
+
+void
+brt_fini(void)
+{
+	kmem_cache_destroy(brt_entry_cache);
+}
+
+#if defined(_KERNEL)
+EXPORT_SYMBOL(brt_maybe_exists);
+EXPORT_SYMBOL(brt_entry_get_refcount);
+EXPORT_SYMBOL(brt_get_dspace);
+EXPORT_SYMBOL(brt_get_used);
+EXPORT_SYMBOL(brt_get_saved);
+EXPORT_SYMBOL(brt_get_ratio);
+EXPORT_SYMBOL(brt_pending_add);
+#endif
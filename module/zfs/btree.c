@@ -0,0 +1,935 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include	<sys/btree.h>
+#include	<sys/zfs_context.h>
+
+kmem_cache_t *zfs_btree_leaf_cache;
+
+/*
+ * Control the extent of the verification that occurs when zfs_btree_verify is
+ * called. Primarily used for debugging when extending the btree logic and
+ * functionality.
+ */
+uint_t zfs_btree_verify_intensity = 0;
+
+/* A bcopy() that allows the source and destination to overlap. */
+#define	bmov(src, dst, size)	memmove((dst), (src), (size))
+
+#define	BTREE_CORE_SIZE(tree)	(offsetof(zfs_btree_core_t, btc_elems) + \
+	BTREE_CORE_ELEMS * (tree)->bt_elem_size)
+
+void
+zfs_btree_init(void)
+{
+	zfs_btree_leaf_cache = kmem_cache_create("zfs_btree_leaf_cache",
+	    BTREE_LEAF_SIZE, 0, NULL, NULL, NULL, NULL, NULL, 0);
+}
+
+void
+zfs_btree_fini(void)
+{
+	kmem_cache_destroy(zfs_btree_leaf_cache);
+}
+
+void
+zfs_btree_create(zfs_btree_t *tree, int (*compar) (const void *, const void *),
+    size_t size)
+{
+	/*
+	 * We need at least four elements in a leaf so that splitting and
+	 * rebalancing always leave a non-empty node on either side.
+	 */
+	ASSERT3U(size, <=, BTREE_LEAF_ESIZE / 4);
+
+	bzero(tree, sizeof (*tree));
+	tree->bt_compar = compar;
+	tree->bt_elem_size = size;
+	tree->bt_leaf_cap = BTREE_LEAF_ESIZE / size;
+	tree->bt_height = -1;
+	tree->bt_root = NULL;
+}
+
+static inline uint8_t *
+bt_elems(zfs_btree_hdr_t *hdr)
+{
+	if (hdr->bth_core)
+		return (((zfs_btree_core_t *)hdr)->btc_elems);
+	return (((zfs_btree_leaf_t *)hdr)->btl_elems);
+}
+
+static inline zfs_btree_hdr_t **
+bt_children(zfs_btree_hdr_t *hdr)
+{
+	ASSERT(hdr->bth_core);
+	return (((zfs_btree_core_t *)hdr)->btc_children);
+}
+
+static inline void *
+bt_elem(zfs_btree_t *tree, zfs_btree_hdr_t *hdr, uint32_t idx)
+{
+	return (bt_elems(hdr) + idx * tree->bt_elem_size);
+}
+
+static inline uint32_t
+bt_capacity(zfs_btree_t *tree, zfs_btree_hdr_t *hdr)
+{
+	return (hdr->bth_core ? BTREE_CORE_ELEMS : tree->bt_leaf_cap);
+}
+
+static zfs_btree_hdr_t *
+zfs_btree_node_alloc(zfs_btree_t *tree, boolean_t core)
+{
+	zfs_btree_hdr_t *hdr;
+
+	if (core) {
+		hdr = kmem_alloc(BTREE_CORE_SIZE(tree), KM_SLEEP);
+		tree->bt_num_cores++;
+	} else {
+		hdr = kmem_cache_alloc(zfs_btree_leaf_cache, KM_SLEEP);
+	}
+	hdr->bth_parent = NULL;
+	hdr->bth_core = core;
+	hdr->bth_count = 0;
+	tree->bt_num_nodes++;
+
+	return (hdr);
+}
+
+static void
+zfs_btree_node_free(zfs_btree_t *tree, zfs_btree_hdr_t *hdr)
+{
+	ASSERT3U(tree->bt_num_nodes, >, 0);
+	tree->bt_num_nodes--;
+	if (hdr->bth_core) {
+		ASSERT3U(tree->bt_num_cores, >, 0);
+		tree->bt_num_cores--;
+		kmem_free(hdr, BTREE_CORE_SIZE(tree));
+	} else {
+		kmem_cache_free(zfs_btree_leaf_cache, hdr);
+	}
+}
+
+/*
+ * Find value in the array of elements provided. Uses a simple binary search.
+ */
+static void *
+zfs_btree_find_in_buf(zfs_btree_t *tree, uint8_t *buf, uint32_t nelems,
+    const void *value, zfs_btree_index_t *where)
+{
+	uint32_t max = nelems;
+	uint32_t min = 0;
+
+	while (max > min) {
+		uint32_t idx = (min + max) / 2;
+		uint8_t *cur = buf + idx * tree->bt_elem_size;
+		int comp = tree->bt_compar(cur, value);
+		if (comp < 0) {
+			min = idx + 1;
+		} else if (comp > 0) {
+			max = idx;
+		} else {
+			where->bti_offset = idx;
+			where->bti_before = B_FALSE;
+			return (cur);
+		}
+	}
+
+	where->bti_offset = max;
+	where->bti_before = B_TRUE;
+	return (NULL);
+}
+
+/*
+ * Find the given value in the tree. where may be passed as null to use as a
+ * membership test or if the btree is being used as a map.
+ */
+void *
+zfs_btree_find(zfs_btree_t *tree, const void *value, zfs_btree_index_t *where)
+{
+	zfs_btree_index_t idx;
+	zfs_btree_hdr_t *hdr = tree->bt_root;
+	void *d;
+
+	if (tree->bt_height == -1) {
+		if (where != NULL) {
+			where->bti_node = NULL;
+			where->bti_offset = 0;
+			where->bti_before = B_TRUE;
+		}
+		ASSERT0(tree->bt_num_elems);
+		return (NULL);
+	}
+
+	/*
+	 * Iterate down the tree, finding which child the value should be in
+	 * by comparing with the separators. A miss always ends up in a leaf.
+	 */
+	for (int64_t level = 0; level < tree->bt_height; level++) {
+		zfs_btree_core_t *node = (zfs_btree_core_t *)hdr;
+
+		ASSERT(hdr->bth_core);
+		d = zfs_btree_find_in_buf(tree, node->btc_elems,
+		    hdr->bth_count, value, &idx);
+		if (d != NULL) {
+			if (where != NULL) {
+				*where = idx;
+				where->bti_node = hdr;
+			}
+			return (d);
+		}
+		hdr = node->btc_children[idx.bti_offset];
+	}
+
+	ASSERT(!hdr->bth_core);
+	d = zfs_btree_find_in_buf(tree, bt_elems(hdr), hdr->bth_count, value,
+	    &idx);
+	if (where != NULL) {
+		*where = idx;
+		where->bti_node = hdr;
+	}
+	return (d);
+}
+
+/*
+ * Find the index of the given child in its parent's children array.
+ */
+static uint32_t
+zfs_btree_find_parent_idx(zfs_btree_hdr_t *hdr)
+{
+	zfs_btree_core_t *parent = hdr->bth_parent;
+
+	ASSERT3P(parent, !=, NULL);
+	for (uint32_t i = 0; i <= parent->btc_hdr.bth_count; i++) {
+		if (parent->btc_children[i] == hdr)
+			return (i);
+	}
+	panic("btree node %p not found in its parent %p", (void *)hdr,
+	    (void *)parent);
+	return (0);
+}
+
+/*
+ * Returns true if the node is the last (or, with first set, the first)
+ * node at its level of the tree.
+ */
+static boolean_t
+zfs_btree_is_edge(zfs_btree_hdr_t *hdr, boolean_t first)
+{
+	for (; hdr->bth_parent != NULL; hdr = &hdr->bth_parent->btc_hdr) {
+		zfs_btree_core_t *parent = hdr->bth_parent;
+		uint32_t edge = first ? 0 : parent->btc_hdr.bth_count;
+		if (parent->btc_children[edge] != hdr)
+			return (B_FALSE);
+	}
+	return (B_TRUE);
+}
+
+/*
+ * Insert the value into position idx of the array of n elements in buf,
+ * leaving the first keep elements of the result in buf and moving the rest
+ * to the start of dst.
+ */
+static void
+bt_split_insert(uint8_t *buf, uint32_t n, size_t size, uint32_t idx,
+    const void *value, uint32_t keep, uint8_t *dst)
+{
+	ASSERT3U(idx, <=, n);
+	ASSERT3U(keep, <=, n);
+
+	if (idx < keep) {
+		bcopy(buf + (keep - 1) * size, dst, (n - keep + 1) * size);
+		bmov(buf + idx * size, buf + (idx + 1) * size,
+		    (keep - 1 - idx) * size);
+		bcopy(value, buf + idx * size, size);
+	} else {
+		uint32_t off = idx - keep;
+		bcopy(buf + keep * size, dst, off * size);
+		bcopy(value, dst + off * size, size);
+		bcopy(buf + idx * size, dst + (off + 1) * size,
+		    (n - idx) * size);
+	}
+}
+
+/*
+ * Decide how many elements stay in a full node of capacity cap that is
+ * being split to insert an element at position idx. The element at the
+ * returned offset of the combined array becomes the separator in the
+ * parent. Appending to the last node of a level, or prepending to the first
+ * one, leaves the old node full so that trees built in order stay dense.
+ */
+static uint32_t
+zfs_btree_split_point(zfs_btree_hdr_t *hdr, uint32_t cap, uint32_t idx)
+{
+	if (idx == cap && zfs_btree_is_edge(hdr, B_FALSE))
+		return (cap - 1);
+	if (idx == 0 && zfs_btree_is_edge(hdr, B_TRUE))
+		return (1);
+	return ((cap + 1) / 2);
+}
+
+/*
+ * Insert the separator in buf and the new node new_node into the parent of
+ * old_node, directly after old_node. Splits the parent if it is full,
+ * reusing buf for the separator that is pushed up a level.
+ */
+static void
+zfs_btree_insert_into_parent(zfs_btree_t *tree, zfs_btree_hdr_t *old_node,
+    zfs_btree_hdr_t *new_node, void *buf)
+{
+	size_t size = tree->bt_elem_size;
+	zfs_btree_core_t *parent = old_node->bth_parent;
+
+	if (parent == NULL) {
+		/*
+		 * The old node was the root, so the tree grows a level.
+		 */
+		ASSERT3P(old_node, ==, tree->bt_root);
+		zfs_btree_hdr_t *root = zfs_btree_node_alloc(tree, B_TRUE);
+		zfs_btree_core_t *core = (zfs_btree_core_t *)root;
+
+		core->btc_children[0] = old_node;
+		core->btc_children[1] = new_node;
+		bcopy(buf, core->btc_elems, size);
+		root->bth_count = 1;
+		old_node->bth_parent = core;
+		new_node->bth_parent = core;
+		tree->bt_root = root;
+		tree->bt_height++;
+		return;
+	}
+
+	zfs_btree_hdr_t *par_hdr = &parent->btc_hdr;
+	uint32_t count = par_hdr->bth_count;
+	uint32_t idx = zfs_btree_find_parent_idx(old_node);
+
+	new_node->bth_parent = parent;
+	if (count < BTREE_CORE_ELEMS) {
+		bmov(parent->btc_elems + idx * size,
+		    parent->btc_elems + (idx + 1) * size, (count - idx) * size);
+		bcopy(buf, parent->btc_elems + idx * size, size);
+		bmov(&parent->btc_children[idx + 1],
+		    &parent->btc_children[idx + 2],
+		    (count - idx) * sizeof (zfs_btree_hdr_t *));
+		parent->btc_children[idx + 1] = new_node;
+		par_hdr->bth_count++;
+		return;
+	}
+
+	/*
+	 * The parent is full, so split it. The left half keeps "keep"
+	 * elements and keep + 1 children, the element after them is pushed
+	 * up to the grandparent, and everything else moves to the new node.
+	 */
+	uint32_t keep = zfs_btree_split_point(par_hdr, BTREE_CORE_ELEMS, idx);
+	zfs_btree_hdr_t *sib_hdr = zfs_btree_node_alloc(tree, B_TRUE);
+	zfs_btree_core_t *sibling = (zfs_btree_core_t *)sib_hdr;
+
+	bt_split_insert(parent->btc_elems, count, size, idx, buf, keep + 1,
+	    sibling->btc_elems);
+	bt_split_insert((uint8_t *)parent->btc_children, count + 1,
+	    sizeof (zfs_btree_hdr_t *), idx + 1, &new_node, keep + 1,
+	    (uint8_t *)sibling->btc_children);
+	bcopy(parent->btc_elems + keep * size, buf, size);
+	par_hdr->bth_count = keep;
+	sib_hdr->bth_count = count - keep;
+
+	for (uint32_t i = 0; i <= sib_hdr->bth_count; i++)
+		sibling->btc_children[i]->bth_parent = sibling;
+
+	zfs_btree_insert_into_parent(tree, par_hdr, sib_hdr, buf);
+}
+
+void
+zfs_btree_add_idx(zfs_btree_t *tree, const void *value,
+    const zfs_btree_index_t *where)
+{
+	size_t size = tree->bt_elem_size;
+	zfs_btree_hdr_t *hdr = where->bti_node;
+	uint32_t idx = where->bti_offset;
+
+	tree->bt_num_elems++;
+
+	if (tree->bt_height == -1) {
+		ASSERT3P(hdr, ==, NULL);
+		ASSERT3P(tree->bt_root, ==, NULL);
+		hdr = zfs_btree_node_alloc(tree, B_FALSE);
+		bcopy(value, bt_elems(hdr), size);
+		hdr->bth_count = 1;
+		tree->bt_root = hdr;
+		tree->bt_height = 0;
+		return;
+	}
+
+	/*
+	 * Insertions are always into leaves, since a failed search always
+	 * ends in a leaf.
+	 */
+	ASSERT(where->bti_before);
+	ASSERT(!hdr->bth_core);
+	ASSERT3U(idx, <=, hdr->bth_count);
+
+	uint32_t count = hdr->bth_count;
+	uint8_t *elems = bt_elems(hdr);
+
+	if (count < tree->bt_leaf_cap) {
+		bmov(elems + idx * size, elems + (idx + 1) * size,
+		    (count - idx) * size);
+		bcopy(value, elems + idx * size, size);
+		hdr->bth_count++;
+		return;
+	}
+
+	/*
+	 * The leaf is full, so split it. The separator is held in a
+	 * temporary buffer while it is pushed up the tree.
+	 */
+	uint32_t keep = zfs_btree_split_point(hdr, count, idx);
+	zfs_btree_hdr_t *new_hdr = zfs_btree_node_alloc(tree, B_FALSE);
+	void *buf = kmem_alloc(size, KM_SLEEP);
+
+	bt_split_insert(elems, count, size, idx, value, keep + 1,
+	    bt_elems(new_hdr));
+	bcopy(elems + keep * size, buf, size);
+	hdr->bth_count = keep;
+	new_hdr->bth_count = count - keep;
+
+	zfs_btree_insert_into_parent(tree, hdr, new_hdr, buf);
+	kmem_free(buf, size);
+}
+
+void
+zfs_btree_add(zfs_btree_t *tree, const void *node)
+{
+	zfs_btree_index_t where = {0};
+
+	VERIFY3P(zfs_btree_find(tree, node, &where), ==, NULL);
+	zfs_btree_add_idx(tree, node, &where);
+}
+
+/*
+ * Descend from the given node to the first or last leaf below it.
+ */
+static zfs_btree_hdr_t *
+zfs_btree_descend(zfs_btree_hdr_t *hdr, boolean_t first)
+{
+	while (hdr->bth_core) {
+		zfs_btree_core_t *node = (zfs_btree_core_t *)hdr;
+		hdr = node->btc_children[first ? 0 : hdr->bth_count];
+	}
+	return (hdr);
+}
+
+void *
+zfs_btree_first(zfs_btree_t *tree, zfs_btree_index_t *where)
+{
+	if (tree->bt_height == -1) {
+		ASSERT0(tree->bt_num_elems);
+		return (NULL);
+	}
+
+	zfs_btree_hdr_t *leaf = zfs_btree_descend(tree->bt_root, B_TRUE);
+	ASSERT3U(leaf->bth_count, >, 0);
+	if (where != NULL) {
+		where->bti_node = leaf;
+		where->bti_offset = 0;
+		where->bti_before = B_FALSE;
+	}
+	return (bt_elem(tree, leaf, 0));
+}
+
+void *
+zfs_btree_last(zfs_btree_t *tree, zfs_btree_index_t *where)
+{
+	if (tree->bt_height == -1) {
+		ASSERT0(tree->bt_num_elems);
+		return (NULL);
+	}
+
+	zfs_btree_hdr_t *leaf = zfs_btree_descend(tree->bt_root, B_FALSE);
+	ASSERT3U(leaf->bth_count, >, 0);
+	if (where != NULL) {
+		where->bti_node = leaf;
+		where->bti_offset = leaf->bth_count - 1;
+		where->bti_before = B_FALSE;
+	}
+	return (bt_elem(tree, leaf, leaf->bth_count - 1));
+}
+
+/*
+ * Return the element after the given location, which may be the location
+ * of an element or a position between two elements of a leaf.
+ */
+void *
+zfs_btree_next(zfs_btree_t *tree, const zfs_btree_index_t *idx,
+    zfs_btree_index_t *out_idx)
+{
+	zfs_btree_hdr_t *hdr = idx->bti_node;
+	uint32_t offset = idx->bti_offset;
+	boolean_t before = idx->bti_before;
+
+	if (hdr == NULL) {
+		ASSERT3S(tree->bt_height, ==, -1);
+		return (NULL);
+	}
+
+	if (hdr->bth_core) {
+		/*
+		 * The next element of a core node is the first element of
+		 * the subtree to its right.
+		 */
+		if (before) {
+			ASSERT3U(offset, <, hdr->bth_count);
+			out_idx->bti_node = hdr;
+			out_idx->bti_offset = offset;
+			out_idx->bti_before = B_FALSE;
+			return (bt_elem(tree, hdr, offset));
+		}
+		hdr = zfs_btree_descend(bt_children(hdr)[offset + 1], B_TRUE);
+		out_idx->bti_node = hdr;
+		out_idx->bti_offset = 0;
+		out_idx->bti_before = B_FALSE;
+		return (bt_elem(tree, hdr, 0));
+	}
+
+	uint32_t new_off = before ? offset : offset + 1;
+	if (new_off < hdr->bth_count) {
+		out_idx->bti_node = hdr;
+		out_idx->bti_offset = new_off;
+		out_idx->bti_before = B_FALSE;
+		return (bt_elem(tree, hdr, new_off));
+	}
+
+	/*
+	 * We've run off the end of the leaf; the next element is the
+	 * separator to the right of the first ancestor that we reached
+	 * through a child other than its last.
+	 */
+	for (zfs_btree_hdr_t *prev = hdr; prev->bth_parent != NULL;
+	    prev = &prev->bth_parent->btc_hdr) {
+		zfs_btree_hdr_t *parent = &prev->bth_parent->btc_hdr;
+		uint32_t i = zfs_btree_find_parent_idx(prev);
+		if (i < parent->bth_count) {
+			out_idx->bti_node = parent;
+			out_idx->bti_offset = i;
+			out_idx->bti_before = B_FALSE;
+			return (bt_elem(tree, parent, i));
+		}
+	}
+	return (NULL);
+}
+
+/*
+ * Return the element before the given location, which may be the location
+ * of an element or a position between two elements of a leaf.
+ */
+void *
+zfs_btree_prev(zfs_btree_t *tree, const zfs_btree_index_t *idx,
+    zfs_btree_index_t *out_idx)
+{
+	zfs_btree_hdr_t *hdr = idx->bti_node;
+	uint32_t offset = idx->bti_offset;
+
+	if (hdr == NULL) {
+		ASSERT3S(tree->bt_height, ==, -1);
+		return (NULL);
+	}
+
+	if (hdr->bth_core) {
+		/*
+		 * The previous element of a core node is the last element of
+		 * the subtree to its left.
+		 */
+		ASSERT(!idx->bti_before);
+		hdr = zfs_btree_descend(bt_children(hdr)[offset], B_FALSE);
+		out_idx->bti_node = hdr;
+		out_idx->bti_offset = hdr->bth_count - 1;
+		out_idx->bti_before = B_FALSE;
+		return (bt_elem(tree, hdr, hdr->bth_count - 1));
+	}
+
+	if (offset != 0) {
+		out_idx->bti_node = hdr;
+		out_idx->bti_offset = offset - 1;
+		out_idx->bti_before = B_FALSE;
+		return (bt_elem(tree, hdr, offset - 1));
+	}
+
+	for (zfs_btree_hdr_t *prev = hdr; prev->bth_parent != NULL;
+	    prev = &prev->bth_parent->btc_hdr) {
+		zfs_btree_hdr_t *parent = &prev->bth_parent->btc_hdr;
+		uint32_t i = zfs_btree_find_parent_idx(prev);
+		if (i > 0) {
+			out_idx->bti_node = parent;
+			out_idx->bti_offset = i - 1;
+			out_idx->bti_before = B_FALSE;
+			return (bt_elem(tree, parent, i - 1));
+		}
+	}
+	return (NULL);
+}
+
+void *
+zfs_btree_get(zfs_btree_t *tree, zfs_btree_index_t *idx)
+{
+	ASSERT(!idx->bti_before);
+	ASSERT3U(idx->bti_offset, <, idx->bti_node->bth_count);
+	return (bt_elem(tree, idx->bti_node, idx->bti_offset));
+}
+
+/*
+ * Move the separator at sep in the parent and the first n - 1 elements of
+ * right (along with their children) onto the end of left, replacing the
+ * separator with the next element of right.
+ */
+static void
+bt_shift_left(zfs_btree_t *tree, zfs_btree_core_t *parent, uint32_t sep,
+    zfs_btree_hdr_t *left, zfs_btree_hdr_t *right, uint32_t n)
+{
+	size_t size = tree->bt_elem_size;
+	uint8_t *l_elems = bt_elems(left);
+	uint8_t *r_elems = bt_elems(right);
+	uint8_t *sep_elem = parent->btc_elems + sep * size;
+
+	ASSERT3U(n, >, 0);
+	ASSERT3U(n, <, right->bth_count);
+
+	bcopy(sep_elem, l_elems + left->bth_count * size, size);
+	bcopy(r_elems, l_elems + (left->bth_count + 1) * size,
+	    (n - 1) * size);
+	bcopy(r_elems + (n - 1) * size, sep_elem, size);
+	bmov(r_elems + n * size, r_elems, (right->bth_count - n) * size);
+
+	if (left->bth_core) {
+		zfs_btree_hdr_t **l_child = bt_children(left);
+		zfs_btree_hdr_t **r_child = bt_children(right);
+
+		for (uint32_t i = 0; i < n; i++) {
+			l_child[left->bth_count + 1 + i] = r_child[i];
+			r_child[i]->bth_parent = (zfs_btree_core_t *)left;
+		}
+		bmov(&r_child[n], &r_child[0],
+		    (right->bth_count + 1 - n) * sizeof (zfs_btree_hdr_t *));
+	}
+
+	left->bth_count += n;
+	right->bth_count -= n;
+}
+
+/*
+ * Move the separator at sep in the parent and the last n - 1 elements of
+ * left (along with their children) onto the start of right, replacing the
+ * separator with the preceding element of left.
+ */
+static void
+bt_shift_right(zfs_btree_t *tree, zfs_btree_core_t *parent, uint32_t sep,
+    zfs_btree_hdr_t *left, zfs_btree_hdr_t *right, uint32_t n)
+{
+	size_t size = tree->bt_elem_size;
+	uint8_t *l_elems = bt_elems(left);
+	uint8_t *r_elems = bt_elems(right);
+	uint8_t *sep_elem = parent->btc_elems + sep * size;
+	uint32_t l_count = left->bth_count;
+
+	ASSERT3U(n, >, 0);
+	ASSERT3U(n, <, l_count);
+
+	bmov(r_elems, r_elems + n * size, right->bth_count * size);
+	bcopy(sep_elem, r_elems + (n - 1) * size, size);
+	bcopy(l_elems + (l_count - n + 1) * size, r_elems, (n - 1) * size);
+	bcopy(l_elems + (l_count - n) * size, sep_elem, size);
+
+	if (left->bth_core) {
+		zfs_btree_hdr_t **l_child = bt_children(left);
+		zfs_btree_hdr_t **r_child = bt_children(right);
+
+		bmov(&r_child[0], &r_child[n],
+		    (right->bth_count + 1) * sizeof (zfs_btree_hdr_t *));
+		for (uint32_t i = 0; i < n; i++) {
+			r_child[i] = l_child[l_count - n + 1 + i];
+			r_child[i]->bth_parent = (zfs_btree_core_t *)right;
+		}
+	}
+
+	left->bth_count -= n;
+	right->bth_count += n;
+}
+
+/*
+ * Merge right and the separator at sep into left, and remove both from
+ * the parent.
+ */
+static void
+bt_merge(zfs_btree_t *tree, zfs_btree_core_t *parent, uint32_t sep,
+    zfs_btree_hdr_t *left, zfs_btree_hdr_t *right)
+{
+	size_t size = tree->bt_elem_size;
+	zfs_btree_hdr_t *par_hdr = &parent->btc_hdr;
+	uint8_t *l_elems = bt_elems(left);
+
+	ASSERT3P(parent->btc_children[sep], ==, left);
+	ASSERT3P(parent->btc_children[sep + 1], ==, right);
+
+	bcopy(parent->btc_elems + sep * size,
+	    l_elems + left->bth_count * size, size);
+	bcopy(bt_elems(right), l_elems + (left->bth_count + 1) * size,
+	    right->bth_count * size);
+	if (left->bth_core) {
+		zfs_btree_hdr_t **l_child = bt_children(left);
+		zfs_btree_hdr_t **r_child = bt_children(right);
+
+		for (uint32_t i = 0; i <= right->bth_count; i++) {
+			l_child[left->bth_count + 1 + i] = r_child[i];
+			r_child[i]->bth_parent = (zfs_btree_core_t *)left;
+		}
+	}
+	left->bth_count += right->bth_count + 1;
+
+	bmov(parent->btc_elems + (sep + 1) * size,
+	    parent->btc_elems + sep * size,
+	    (par_hdr->bth_count - sep - 1) * size);
+	bmov(&parent->btc_children[sep + 2], &parent->btc_children[sep + 1],
+	    (par_hdr->bth_count - sep - 1) * sizeof (zfs_btree_hdr_t *));
+	par_hdr->bth_count--;
+
+	zfs_btree_node_free(tree, right);
+}
+
+/*
+ * Restore the fill invariants after an element has been removed from the
+ * given node, walking up the tree as parents lose separators.
+ */
+static void
+zfs_btree_rebalance(zfs_btree_t *tree, zfs_btree_hdr_t *hdr)
+{
+	for (;;) {
+		zfs_btree_core_t *parent = hdr->bth_parent;
+
+		if (parent == NULL) {
+			ASSERT3P(hdr, ==, tree->bt_root);
+			if (hdr->bth_count != 0)
+				return;
+			/*
+			 * An empty root leaf means the tree is empty; an
+			 * empty root core node is replaced by its only child.
+			 */
+			if (hdr->bth_core) {
+				zfs_btree_hdr_t *child = bt_children(hdr)[0];
+				child->bth_parent = NULL;
+				tree->bt_root = child;
+			} else {
+				tree->bt_root = NULL;
+			}
+			tree->bt_height--;
+			zfs_btree_node_free(tree, hdr);
+			return;
+		}
+
+		uint32_t cap = bt_capacity(tree, hdr);
+		if (hdr->bth_count >= cap / 2)
+			return;
+
+		/*
+		 * Pair the node with its left sibling if it has one, or its
+		 * right sibling otherwise. If the two nodes and the separator
+		 * between them fit in one node, merge them; otherwise even out
+		 * their element counts.
+		 */
+		uint32_t idx = zfs_btree_find_parent_idx(hdr);
+		uint32_t sep = (idx > 0) ? idx - 1 : idx;
+		zfs_btree_hdr_t *left = parent->btc_children[sep];
+		zfs_btree_hdr_t *right = parent->btc_children[sep + 1];
+		uint32_t total = left->bth_count + right->bth_count;
+
+		if (total + 1 <= cap) {
+			bt_merge(tree, parent, sep, left, right);
+			hdr = &parent->btc_hdr;
+			continue;
+		}
+
+		uint32_t target = total / 2;
+		if (left->bth_count < target) {
+			bt_shift_left(tree, parent, sep, left, right,
+			    target - left->bth_count);
+		} else if (left->bth_count > target) {
+			bt_shift_right(tree, parent, sep, left, right,
+			    left->bth_count - target);
+		}
+		return;
+	}
+}
+
+void
+zfs_btree_remove_idx(zfs_btree_t *tree, zfs_btree_index_t *where)
+{
+	size_t size = tree->bt_elem_size;
+	zfs_btree_hdr_t *hdr = where->bti_node;
+	uint32_t idx = where->bti_offset;
+
+	ASSERT(!where->bti_before);
+	ASSERT3U(idx, <, hdr->bth_count);
+	tree->bt_num_elems--;
+
+	if (hdr->bth_core) {
+		/*
+		 * Replace the element with its in-order predecessor, which
+		 * is the last element in the rightmost leaf of the subtree
+		 * to its left, and remove that element from its leaf.
+		 */
+		zfs_btree_hdr_t *leaf =
+		    zfs_btree_descend(bt_children(hdr)[idx], B_FALSE);
+		bcopy(bt_elem(tree, leaf, leaf->bth_count - 1),
+		    bt_elem(tree, hdr, idx), size);
+		hdr = leaf;
+		idx = leaf->bth_count - 1;
+	}
+
+	uint8_t *elems = bt_elems(hdr);
+	bmov(elems + (idx + 1) * size, elems + idx * size,
+	    (hdr->bth_count - idx - 1) * size);
+	hdr->bth_count--;
+
+	zfs_btree_rebalance(tree, hdr);
+}
+
+void
+zfs_btree_remove(zfs_btree_t *tree, const void *value)
+{
+	zfs_btree_index_t where = {0};
+
+	VERIFY3P(zfs_btree_find(tree, value, &where), !=, NULL);
+	zfs_btree_remove_idx(tree, &where);
+}
+
+ulong_t
+zfs_btree_numnodes(zfs_btree_t *tree)
+{
+	return (tree->bt_num_elems);
+}
+
+uint64_t
+zfs_btree_memory(zfs_btree_t *tree)
+{
+	return ((tree->bt_num_nodes - tree->bt_num_cores) * BTREE_LEAF_SIZE +
+	    tree->bt_num_cores * BTREE_CORE_SIZE(tree));
+}
+
+static void
+zfs_btree_clear_helper(zfs_btree_t *tree, zfs_btree_hdr_t *hdr)
+{
+	if (hdr->bth_core) {
+		zfs_btree_core_t *node = (zfs_btree_core_t *)hdr;
+		for (uint32_t i = 0; i <= hdr->bth_count; i++)
+			zfs_btree_clear_helper(tree, node->btc_children[i]);
+	}
+	zfs_btree_node_free(tree, hdr);
+}
+
+void
+zfs_btree_clear(zfs_btree_t *tree)
+{
+	if (tree->bt_root != NULL)
+		zfs_btree_clear_helper(tree, tree->bt_root);
+
+	ASSERT0(tree->bt_num_nodes);
+	ASSERT0(tree->bt_num_cores);
+	tree->bt_root = NULL;
+	tree->bt_height = -1;
+	tree->bt_num_elems = 0;
+}
+
+void
+zfs_btree_destroy(zfs_btree_t *tree)
+{
+	ASSERT0(tree->bt_num_elems);
+	ASSERT3P(tree->bt_root, ==, NULL);
+}
+
+/*
+ * Verify the subtree rooted at hdr, returning the number of elements in it.
+ * lo and hi, when not NULL, bound every element of the subtree.
+ */
+static uint64_t
+zfs_btree_verify_helper(zfs_btree_t *tree, zfs_btree_hdr_t *hdr,
+    int64_t height, const void *lo, const void *hi, uint64_t *nodes)
+{
+	uint32_t count = hdr->bth_count;
+	uint64_t elems = count;
+
+	(*nodes)++;
+	VERIFY3U(count, <=, bt_capacity(tree, hdr));
+	VERIFY(hdr == tree->bt_root || count > 0);
+	VERIFY3S(hdr->bth_core, ==, (height > 0));
+
+	for (uint32_t i = 0; i < count; i++) {
+		void *cur = bt_elem(tree, hdr, i);
+		if (i > 0)
+			VERIFY3S(tree->bt_compar(bt_elem(tree, hdr, i - 1),
+			    cur), ==, -1);
+		if (zfs_btree_verify_intensity < 2)
+			continue;
+		if (lo != NULL)
+			VERIFY3S(tree->bt_compar(lo, cur), ==, -1);
+		if (hi != NULL)
+			VERIFY3S(tree->bt_compar(cur, hi), ==, -1);
+	}
+
+	if (!hdr->bth_core)
+		return (elems);
+
+	zfs_btree_hdr_t **children = bt_children(hdr);
+	for (uint32_t i = 0; i <= count; i++) {
+		VERIFY3P(children[i]->bth_parent, ==, hdr);
+		elems += zfs_btree_verify_helper(tree, children[i], height - 1,
+		    i == 0 ? lo : bt_elem(tree, hdr, i - 1),
+		    i == count ? hi : bt_elem(tree, hdr, i), nodes);
+	}
+	return (elems);
+}
+
+void
+zfs_btree_verify(zfs_btree_t *tree)
+{
+	uint64_t nodes = 0;
+
+	if (zfs_btree_verify_intensity == 0)
+		return;
+
+	if (tree->bt_height == -1) {
+		VERIFY3P(tree->bt_root, ==, NULL);
+		VERIFY0(tree->bt_num_elems);
+		VERIFY0(tree->bt_num_nodes);
+		return;
+	}
+
+	VERIFY3P(tree->bt_root->bth_parent, ==, NULL);
+	VERIFY3U(zfs_btree_verify_helper(tree, tree->bt_root,
+	    tree->bt_height, NULL, NULL, &nodes), ==, tree->bt_num_elems);
+	VERIFY3U(nodes, ==, tree->bt_num_nodes);
+}
+
+#if defined(_KERNEL)
+/* BEGIN CSTYLED */
+ZFS_MODULE_PARAM(zfs, zfs_, btree_verify_intensity, UINT, ZMOD_RW,
+	"Enable btree verification. Levels above 1 also check that every "
+	"element is bounded by its ancestors' separators");
+/* END CSTYLED */
+#endif
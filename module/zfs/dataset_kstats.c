@@ -28,6 +28,7 @@
 #include <sys/dmu_objset.h>
 #include <sys/dsl_dataset.h>
 #include <sys/spa.h>
+#include <sys/zil_impl.h>
 
 static dataset_kstat_values_t empty_dataset_kstats = {
 	{ "dataset_name",	KSTAT_DATA_STRING },
@@ -37,6 +38,16 @@ static dataset_kstat_values_t empty_dataset_kstats = {
 	{ "nread",	KSTAT_DATA_UINT64 },
 	{ "nunlinks",	KSTAT_DATA_UINT64 },
 	{ "nunlinked",	KSTAT_DATA_UINT64 },
+	{ "zil_replay_records",	KSTAT_DATA_UINT64 },
+	{ "zil_replay_blocks",	KSTAT_DATA_UINT64 },
+	{ "zil_replay_time_us",	KSTAT_DATA_UINT64 },
+	{ "write_limit_delays",	KSTAT_DATA_UINT64 },
+	{ "write_limit_delay_us",	KSTAT_DATA_UINT64 },
+	{ "direct_writes",	KSTAT_DATA_UINT64 },
+	{ "direct_write_fallbacks",	KSTAT_DATA_UINT64 },
+	{ "direct_reads",	KSTAT_DATA_UINT64 },
+	{ "direct_read_fallbacks",	KSTAT_DATA_UINT64 },
+	{ "mmap_direct_bytes",	KSTAT_DATA_UINT64 },
 };
 
 static int
@@ -61,6 +72,20 @@ dataset_kstats_update(kstat_t *ksp, int rw)
 	    aggsum_value(&dk->dk_aggsums.das_nunlinks);
 	dkv->dkv_nunlinked.value.ui64 =
 	    aggsum_value(&dk->dk_aggsums.das_nunlinked);
+	dkv->dkv_write_limit_delays.value.ui64 =
+	    aggsum_value(&dk->dk_aggsums.das_write_limit_delays);
+	dkv->dkv_write_limit_delay_us.value.ui64 =
+	    aggsum_value(&dk->dk_aggsums.das_write_limit_delay_us);
+	dkv->dkv_direct_writes.value.ui64 =
+	    aggsum_value(&dk->dk_aggsums.das_direct_writes);
+	dkv->dkv_direct_write_fallbacks.value.ui64 =
+	    aggsum_value(&dk->dk_aggsums.das_direct_write_fallbacks);
+	dkv->dkv_direct_reads.value.ui64 =
+	    aggsum_value(&dk->dk_aggsums.das_direct_reads);
+	dkv->dkv_direct_read_fallbacks.value.ui64 =
+	    aggsum_value(&dk->dk_aggsums.das_direct_read_fallbacks);
+	dkv->dkv_mmap_direct_bytes.value.ui64 =
+	    aggsum_value(&dk->dk_aggsums.das_mmap_direct_bytes);
 
 	return (0);
 }
@@ -145,6 +170,13 @@ dataset_kstats_create(dataset_kstats_t *dk, objset_t *objset)
 	aggsum_init(&dk->dk_aggsums.das_nread, 0);
 	aggsum_init(&dk->dk_aggsums.das_nunlinks, 0);
 	aggsum_init(&dk->dk_aggsums.das_nunlinked, 0);
+	aggsum_init(&dk->dk_aggsums.das_write_limit_delays, 0);
+	aggsum_init(&dk->dk_aggsums.das_write_limit_delay_us, 0);
+	aggsum_init(&dk->dk_aggsums.das_direct_writes, 0);
+	aggsum_init(&dk->dk_aggsums.das_direct_write_fallbacks, 0);
+	aggsum_init(&dk->dk_aggsums.das_direct_reads, 0);
+	aggsum_init(&dk->dk_aggsums.das_direct_read_fallbacks, 0);
+	aggsum_init(&dk->dk_aggsums.das_mmap_direct_bytes, 0);
 }
 
 void
@@ -167,6 +199,13 @@ dataset_kstats_destroy(dataset_kstats_t *dk)
 	aggsum_fini(&dk->dk_aggsums.das_nread);
 	aggsum_fini(&dk->dk_aggsums.das_nunlinks);
 	aggsum_fini(&dk->dk_aggsums.das_nunlinked);
+	aggsum_fini(&dk->dk_aggsums.das_write_limit_delays);
+	aggsum_fini(&dk->dk_aggsums.das_write_limit_delay_us);
+	aggsum_fini(&dk->dk_aggsums.das_direct_writes);
+	aggsum_fini(&dk->dk_aggsums.das_direct_write_fallbacks);
+	aggsum_fini(&dk->dk_aggsums.das_direct_reads);
+	aggsum_fini(&dk->dk_aggsums.das_direct_read_fallbacks);
+	aggsum_fini(&dk->dk_aggsums.das_mmap_direct_bytes);
 }
 
 void
@@ -212,3 +251,65 @@ dataset_kstats_update_nunlinked_kstat(dataset_kstats_t *dk, int64_t delta)
 
 	aggsum_add(&dk->dk_aggsums.das_nunlinked, delta);
 }
+
+void
+dataset_kstats_update_zil_replay_kstats(dataset_kstats_t *dk, zilog_t *zilog)
+{
+	if (dk->dk_kstats == NULL)
+		return;
+
+	dataset_kstat_values_t *dkv = dk->dk_kstats->ks_data;
+	dkv->dkv_zil_replay_records.value.ui64 = zilog->zl_replay_records;
+	dkv->dkv_zil_replay_blocks.value.ui64 = zilog->zl_replay_blks;
+	dkv->dkv_zil_replay_time_us.value.ui64 =
+	    NSEC2USEC(zilog->zl_replay_duration);
+}
+
+void
+dataset_kstats_update_write_limit_kstats(dataset_kstats_t *dk, hrtime_t delay)
+{
+	ASSERT3S(delay, >=, 0);
+
+	if (dk->dk_kstats == NULL)
+		return;
+
+	aggsum_add(&dk->dk_aggsums.das_write_limit_delays, 1);
+	aggsum_add(&dk->dk_aggsums.das_write_limit_delay_us, NSEC2USEC(delay));
+}
+
+void
+dataset_kstats_update_direct_write_kstats(dataset_kstats_t *dk,
+    boolean_t direct)
+{
+	if (dk->dk_kstats == NULL)
+		return;
+
+	if (direct)
+		aggsum_add(&dk->dk_aggsums.das_direct_writes, 1);
+	else
+		aggsum_add(&dk->dk_aggsums.das_direct_write_fallbacks, 1);
+}
+
+void
+dataset_kstats_update_direct_read_kstats(dataset_kstats_t *dk,
+    boolean_t direct)
+{
+	if (dk->dk_kstats == NULL)
+		return;
+
+	if (direct)
+		aggsum_add(&dk->dk_aggsums.das_direct_reads, 1);
+	else
+		aggsum_add(&dk->dk_aggsums.das_direct_read_fallbacks, 1);
+}
+
+void
+dataset_kstats_update_mmap_direct_kstats(dataset_kstats_t *dk, int64_t nbytes)
+{
+	ASSERT3S(nbytes, >=, 0);
+
+	if (dk->dk_kstats == NULL)
+		return;
+
+	aggsum_add(&dk->dk_aggsums.das_mmap_direct_bytes, nbytes);
+}
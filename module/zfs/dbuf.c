@@ -1252,6 +1252,26 @@ dmu_buf_unlock_parent(dmu_buf_impl_t *db, db_lock_type_t type, void *tag)
 		rrw_exit(&dmu_objset_ds(db->db_objset)->ds_bp_rwlock, tag);
 }
 
+/*
+ * Return the block pointer a read of this dbuf must use.  A block written
+ * by dmu_write_direct_dbuf() is only reachable through its dirty record
+ * until the txg which dirtied it has synced.  The caller must hold db_mtx
+ * and the parent lock (see dmu_buf_lock_parent()).
+ */
+blkptr_t *
+dbuf_read_bp(dmu_buf_impl_t *db)
+{
+	dbuf_dirty_record_t *dr = db->db_last_dirty;
+
+	ASSERT(MUTEX_HELD(&db->db_mtx));
+
+	if (db->db_level == 0 && db->db_blkid != DMU_BONUS_BLKID &&
+	    dr != NULL && dr->dt.dl.dr_diowrite)
+		return (&dr->dt.dl.dr_overridden_by);
+
+	return (db->db_blkptr);
+}
+
 static void
 dbuf_read_done(zio_t *zio, const zbookmark_phys_t *zb, const blkptr_t *bp,
     arc_buf_t *buf, void *vdb)
@@ -1360,6 +1380,7 @@ dbuf_read_impl(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags,
 	zbookmark_phys_t zb;
 	uint32_t aflags = ARC_FLAG_NOWAIT;
 	int err, zio_flags = 0;
+	blkptr_t *bpp, bp;
 
 	DB_DNODE_ENTER(db);
 	dn = DB_DNODE(db);
@@ -1405,9 +1426,10 @@ dbuf_read_impl(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags,
 	 * processes the delete record and clears the bp while we are waiting
 	 * for the dn_mtx (resulting in a "no" from block_freed).
 	 */
-	if (db->db_blkptr == NULL || BP_IS_HOLE(db->db_blkptr) ||
+	bpp = dbuf_read_bp(db);
+	if (bpp == NULL || BP_IS_HOLE(bpp) ||
 	    (db->db_level == 0 && (dnode_block_freed(dn, db->db_blkid) ||
-	    BP_IS_HOLE(db->db_blkptr)))) {
+	    BP_IS_HOLE(bpp)))) {
 		arc_buf_contents_t type = DBUF_GET_BUFC_TYPE(db);
 
 		dbuf_set_data(db, arc_alloc_buf(db->db_objset->os_spa, db, type,
@@ -1446,7 +1468,7 @@ dbuf_read_impl(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags,
 	 * will never happen under normal conditions, but can be useful for
 	 * debugging purposes.
 	 */
-	if (BP_IS_REDACTED(db->db_blkptr)) {
+	if (BP_IS_REDACTED(bpp)) {
 		ASSERT(dsl_dataset_feature_is_active(
 		    db->db_objset->os_dsl_dataset,
 		    SPA_FEATURE_REDACTED_DATASETS));
@@ -1463,7 +1485,7 @@ dbuf_read_impl(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags,
 	 * All bps of an encrypted os should have the encryption bit set.
 	 * If this is not true it indicates tampering and we report an error.
 	 */
-	if (db->db_objset->os_encrypted && !BP_USES_CRYPT(db->db_blkptr)) {
+	if (db->db_objset->os_encrypted && !BP_USES_CRYPT(bpp)) {
 		spa_log_error(db->db_objset->os_spa, &zb);
 		zfs_panic_recover("unencrypted block in encrypted "
 		    "object set %llu", dmu_objset_id(db->db_objset));
@@ -1483,6 +1505,17 @@ dbuf_read_impl(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags,
 
 	DB_DNODE_EXIT(db);
 
+	/*
+	 * The zio layer will copy the provided blkptr later, but we need to
+	 * do this now so that we can release the parent's rwlock. We have to
+	 * do that now so that if dbuf_read_done is called synchronously (on
+	 * an l1 cache hit) we don't acquire the db_mtx while holding the
+	 * parent's rwlock, which would be a lock ordering violation.  A
+	 * direct write's bp lives in its dirty record, which is protected by
+	 * db_mtx, so the copy is taken before that is dropped.
+	 */
+	bp = *bpp;
+
 	db->db_state = DB_READ;
 	mutex_exit(&db->db_mtx);
 
@@ -1494,16 +1527,8 @@ dbuf_read_impl(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags,
 	zio_flags = (flags & DB_RF_CANFAIL) ?
 	    ZIO_FLAG_CANFAIL : ZIO_FLAG_MUSTSUCCEED;
 
-	if ((flags & DB_RF_NO_DECRYPT) && BP_IS_PROTECTED(db->db_blkptr))
+	if ((flags & DB_RF_NO_DECRYPT) && BP_IS_PROTECTED(&bp))
 		zio_flags |= ZIO_FLAG_RAW;
-	/*
-	 * The zio layer will copy the provided blkptr later, but we need to
-	 * do this now so that we can release the parent's rwlock. We have to
-	 * do that now so that if dbuf_read_done is called synchronously (on
-	 * an l1 cache hit) we don't acquire the db_mtx while holding the
-	 * parent's rwlock, which would be a lock ordering violation.
-	 */
-	blkptr_t bp = *db->db_blkptr;
 	dmu_buf_unlock_parent(db, dblt, tag);
 	(void) arc_read(zio, db->db_objset->os_spa, &bp,
 	    dbuf_read_done, db, ZIO_PRIORITY_SYNC_READ, zio_flags,
@@ -1600,8 +1625,18 @@ dbuf_read(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags)
 	 */
 	ASSERT(!zfs_refcount_is_zero(&db->db_holds));
 
-	if (db->db_state == DB_NOFILL)
+	/*
+	 * A block being written directly can be read back once the write
+	 * completes.
+	 */
+	mutex_enter(&db->db_mtx);
+	while (db->db_state == DB_NOFILL && db->db_direct_write)
+		cv_wait(&db->db_changed, &db->db_mtx);
+	if (db->db_state == DB_NOFILL) {
+		mutex_exit(&db->db_mtx);
 		return (SET_ERROR(EIO));
+	}
+	mutex_exit(&db->db_mtx);
 
 	DB_DNODE_ENTER(db);
 	dn = DB_DNODE(db);
@@ -1653,8 +1688,9 @@ dbuf_read(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags)
 
 		db_lock_type_t dblt = dmu_buf_lock_parent(db, RW_READER, FTAG);
 
-		if (zio == NULL &&
-		    db->db_blkptr != NULL && !BP_IS_HOLE(db->db_blkptr)) {
+		blkptr_t *bpp = dbuf_read_bp(db);
+
+		if (zio == NULL && bpp != NULL && !BP_IS_HOLE(bpp)) {
 			zio = zio_root(spa, NULL, NULL, ZIO_FLAG_CANFAIL);
 			need_wait = B_TRUE;
 		}
@@ -1771,6 +1807,8 @@ dbuf_unoverride(dbuf_dirty_record_t *dr)
 
 	dr->dt.dl.dr_override_state = DR_NOT_OVERRIDDEN;
 	dr->dt.dl.dr_nopwrite = B_FALSE;
+	dr->dt.dl.dr_brtwrite = B_FALSE;
+	dr->dt.dl.dr_diowrite = B_FALSE;
 	dr->dt.dl.dr_has_raw_params = B_FALSE;
 
 	/*
@@ -1779,9 +1817,11 @@ dbuf_unoverride(dbuf_dirty_record_t *dr)
 	 * modifying the buffer, so they will immediately do
 	 * another (redundant) arc_release().  Therefore, leave
 	 * the buf thawed to save the effort of freezing &
-	 * immediately re-thawing it.
+	 * immediately re-thawing it.  Cloned and directly written blocks
+	 * have no buffer.
 	 */
-	arc_release(dr->dt.dl.dr_data, db);
+	if (dr->dt.dl.dr_data != NULL)
+		arc_release(dr->dt.dl.dr_data, db);
 }
 
 /*
@@ -1959,6 +1999,17 @@ dbuf_redirty(dbuf_dirty_record_t *dr)
 	ASSERT(MUTEX_HELD(&db->db_mtx));
 
 	if (db->db_level == 0 && db->db_blkid != DMU_BONUS_BLKID) {
+		/*
+		 * A direct write left this record without a buffer.  The
+		 * caller has since read or filled one, which now becomes
+		 * the dirty data.
+		 */
+		if (dr->dt.dl.dr_data == NULL && db->db_state != DB_NOFILL) {
+			ASSERT(dr->dt.dl.dr_diowrite);
+			arc_release(db->db_buf, db);
+			dr->dt.dl.dr_data = db->db_buf;
+		}
+
 		/*
 		 * If this buffer has already been written out,
 		 * we now need to reset its state.
@@ -2338,13 +2389,28 @@ dbuf_undirty(dmu_buf_impl_t *db, dmu_tx_t *tx)
 	}
 	DB_DNODE_EXIT(db);
 
-	if (db->db_state != DB_NOFILL) {
+	if (dr->dt.dl.dr_diowrite) {
+		/*
+		 * Free the directly written block.  Any buffer the dbuf
+		 * has was read from that block and is not the dirty data.
+		 */
+		ASSERT3P(dr->dt.dl.dr_data, ==, NULL);
+		dbuf_unoverride(dr);
+	} else if (db->db_state != DB_NOFILL) {
 		dbuf_unoverride(dr);
 
 		ASSERT(db->db_buf != NULL);
 		ASSERT(dr->dt.dl.dr_data != NULL);
 		if (dr->dt.dl.dr_data != db->db_buf)
 			arc_buf_destroy(dr->dt.dl.dr_data, db);
+	} else if (dr->dt.dl.dr_brtwrite) {
+		/*
+		 * Give back the reference taken on the cloned block.  The
+		 * free is processed after the pending BRT entry is applied.
+		 */
+		dbuf_unoverride(dr);
+		if (db->db_last_dirty == NULL)
+			db->db_state = DB_UNCACHED;
 	}
 
 	kmem_free(dr, sizeof (dbuf_dirty_record_t));
@@ -2353,7 +2419,8 @@ dbuf_undirty(dmu_buf_impl_t *db, dmu_tx_t *tx)
 	db->db_dirtycnt -= 1;
 
 	if (zfs_refcount_remove(&db->db_holds, (void *)(uintptr_t)txg) == 0) {
-		ASSERT(db->db_state == DB_NOFILL || arc_released(db->db_buf));
+		ASSERT(db->db_state == DB_NOFILL || db->db_buf == NULL ||
+		    arc_released(db->db_buf));
 		dbuf_destroy(db);
 		return (B_TRUE);
 	}
@@ -2588,6 +2655,158 @@ dmu_buf_redact(dmu_buf_t *dbuf, dmu_tx_t *tx)
 	dbuf_override_impl(db, &bp, tx);
 }
 
+/*
+ * Make the block refer to an existing block pointer, which was read from
+ * another (or the same) object by dmu_read_l0_bps().  The caller must hold
+ * the only hold on the dbuf, which must not be dirty, and is responsible
+ * for adding the block to the BRT.
+ */
+void
+dmu_buf_write_clone(dmu_buf_t *dbuf, const blkptr_t *bp, dmu_tx_t *tx)
+{
+	dmu_buf_impl_t *db = (dmu_buf_impl_t *)dbuf;
+	struct dirty_leaf *dl;
+	dmu_object_type_t type;
+
+	ASSERT0(db->db_level);
+	ASSERT(db->db_blkid != DMU_BONUS_BLKID);
+
+	DB_DNODE_ENTER(db);
+	type = DB_DNODE(db)->dn_type;
+	DB_DNODE_EXIT(db);
+
+	mutex_enter(&db->db_mtx);
+	ASSERT3P(db->db_last_dirty, ==, NULL);
+	if (db->db_state == DB_CACHED) {
+		arc_release(db->db_buf, db);
+		arc_buf_destroy(db->db_buf, db);
+		db->db_buf = NULL;
+		dbuf_clear_data(db);
+	}
+	ASSERT(db->db_state == DB_UNCACHED || db->db_state == DB_NOFILL);
+	db->db_state = DB_NOFILL;
+	mutex_exit(&db->db_mtx);
+
+	dmu_buf_will_fill(dbuf, tx);
+
+	ASSERT3U(db->db_last_dirty->dr_txg, ==, tx->tx_txg);
+	dl = &db->db_last_dirty->dt.dl;
+	if (BP_IS_HOLE(bp)) {
+		blkptr_t hole = { { { {0} } } };
+
+		/* As zio_write_compress() does for an all-zero block. */
+		if (spa_feature_is_active(db->db_objset->os_spa,
+		    SPA_FEATURE_HOLE_BIRTH)) {
+			BP_SET_LSIZE(&hole, db->db.db_size);
+			BP_SET_TYPE(&hole, type);
+			BP_SET_LEVEL(&hole, 0);
+			BP_SET_BIRTH(&hole, tx->tx_txg, 0);
+		}
+		dl->dr_overridden_by = hole;
+	} else if (BP_IS_EMBEDDED(bp)) {
+		dl->dr_overridden_by = *bp;
+		dl->dr_overridden_by.blk_birth = tx->tx_txg;
+	} else {
+		dl->dr_overridden_by = *bp;
+		BP_SET_BIRTH(&dl->dr_overridden_by, tx->tx_txg,
+		    BP_PHYSICAL_BIRTH(bp));
+	}
+	dl->dr_brtwrite = B_TRUE;
+	dl->dr_override_state = DR_OVERRIDDEN;
+}
+
+/*
+ * Prepare a dbuf to be written directly from the caller's memory by
+ * dmu_write_direct_dbuf().  The caller must hold the only hold on the
+ * dbuf, and no dirty record may have a buffer of its own; only earlier
+ * direct writes may be pending.  Returns EAGAIN if the block cannot be
+ * written directly right now.
+ */
+int
+dmu_buf_will_write_direct(dmu_buf_t *dbuf, dmu_tx_t *tx)
+{
+	dmu_buf_impl_t *db = (dmu_buf_impl_t *)dbuf;
+	dbuf_dirty_record_t *dr;
+
+	ASSERT0(db->db_level);
+	ASSERT(db->db_blkid != DMU_BONUS_BLKID);
+	ASSERT(tx->tx_txg != 0);
+
+	mutex_enter(&db->db_mtx);
+	if ((db->db_state != DB_UNCACHED && db->db_state != DB_CACHED) ||
+	    zfs_refcount_count(&db->db_holds) != 1 + db->db_dirtycnt) {
+		mutex_exit(&db->db_mtx);
+		return (SET_ERROR(EAGAIN));
+	}
+	for (dr = db->db_last_dirty; dr != NULL; dr = dr->dr_next) {
+		if (dr->dt.dl.dr_data != NULL) {
+			mutex_exit(&db->db_mtx);
+			return (SET_ERROR(EAGAIN));
+		}
+		ASSERT(dr->dt.dl.dr_diowrite);
+	}
+
+	/* Any cached copy is about to be stale. */
+	if (db->db_state == DB_CACHED) {
+		arc_release(db->db_buf, db);
+		arc_buf_destroy(db->db_buf, db);
+		db->db_buf = NULL;
+		dbuf_clear_data(db);
+	}
+	db->db_state = DB_NOFILL;
+	db->db_direct_write = B_TRUE;
+
+	/*
+	 * A direct write earlier in this txg keeps its block until the new
+	 * one is written, so that a failure leaves it in place.
+	 */
+	dr = db->db_last_dirty;
+	if (dr != NULL && dr->dr_txg == tx->tx_txg) {
+		mutex_exit(&db->db_mtx);
+		return (0);
+	}
+	mutex_exit(&db->db_mtx);
+
+	dmu_buf_will_fill(dbuf, tx);
+
+	return (0);
+}
+
+/*
+ * Complete a direct write started by dmu_buf_will_write_direct().  On
+ * success the dirty record is overridden by the block which was written,
+ * and the dbuf is read back from that block until the txg syncs.  On
+ * failure the block is left as it was before the write.
+ */
+void
+dmu_buf_write_direct_done(dmu_buf_t *dbuf, const blkptr_t *bp, int copies,
+    int error, dmu_tx_t *tx)
+{
+	dmu_buf_impl_t *db = (dmu_buf_impl_t *)dbuf;
+	dbuf_dirty_record_t *dr;
+
+	mutex_enter(&db->db_mtx);
+	dr = db->db_last_dirty;
+	ASSERT3U(db->db_state, ==, DB_NOFILL);
+	ASSERT(db->db_direct_write);
+	ASSERT3U(dr->dr_txg, ==, tx->tx_txg);
+	ASSERT3P(dr->dt.dl.dr_data, ==, NULL);
+
+	if (error == 0) {
+		dbuf_unoverride(dr);
+		dr->dt.dl.dr_overridden_by = *bp;
+		dr->dt.dl.dr_override_state = DR_OVERRIDDEN;
+		dr->dt.dl.dr_copies = copies;
+		dr->dt.dl.dr_diowrite = B_TRUE;
+	} else if (!dr->dt.dl.dr_diowrite) {
+		(void) dbuf_undirty(db, tx);
+	}
+	db->db_state = DB_UNCACHED;
+	db->db_direct_write = B_FALSE;
+	cv_broadcast(&db->db_changed);
+	mutex_exit(&db->db_mtx);
+}
+
 /*
  * Directly assign a provided arc buf to a given dbuf if it's not referenced
  * by anybody except our caller. Otherwise copy arcbuf's contents to dbuf.
@@ -2898,6 +3117,7 @@ dbuf_create(dnode_t *dn, uint8_t level, uint64_t blkid,
 	db->db_user_immediate_evict = FALSE;
 	db->db_freed_in_flight = FALSE;
 	db->db_pending_evict = FALSE;
+	db->db_direct_write = FALSE;
 
 	if (blkid == DMU_BONUS_BLKID) {
 		ASSERT3P(parent, ==, dn->dn_dbuf);
@@ -3982,8 +4202,12 @@ dbuf_sync_leaf(dbuf_dirty_record_t *dr, dmu_tx_t *tx)
 	 * To be synced, we must be dirtied.  But we
 	 * might have been freed after the dirty.
 	 */
-	if (db->db_state == DB_UNCACHED) {
-		/* This buffer has been freed since it was dirtied */
+	if (db->db_state == DB_UNCACHED || db->db_state == DB_READ) {
+		/*
+		 * This buffer has been freed since it was dirtied, or was
+		 * written directly and may be being read back.
+		 */
+		ASSERT(db->db_state == DB_UNCACHED || dr->dt.dl.dr_diowrite);
 		ASSERT(db->db.db_data == NULL);
 	} else if (db->db_state == DB_FILL) {
 		/* This buffer was freed and is now being re-filled */
@@ -4402,8 +4626,15 @@ dbuf_write_done(zio_t *zio, arc_buf_t *buf, void *vdb)
 		ASSERT(db->db_blkid != DMU_BONUS_BLKID);
 		ASSERT(dr->dt.dl.dr_override_state == DR_NOT_OVERRIDDEN);
 		if (db->db_state != DB_NOFILL) {
-			if (dr->dt.dl.dr_data != db->db_buf)
+			if (dr->dt.dl.dr_data != NULL &&
+			    dr->dt.dl.dr_data != db->db_buf)
 				arc_buf_destroy(dr->dt.dl.dr_data, db);
+		} else if (dr->dt.dl.dr_brtwrite && db->db_last_dirty == NULL) {
+			/*
+			 * The cloned block is now on disk, so let the dbuf
+			 * be read from it again.
+			 */
+			db->db_state = DB_UNCACHED;
 		}
 	} else {
 		dnode_t *dn;
@@ -4465,7 +4696,8 @@ dbuf_write_override_done(zio_t *zio)
 	if (!BP_EQUAL(zio->io_bp, obp)) {
 		if (!BP_IS_HOLE(obp))
 			dsl_free(spa_get_dsl(zio->io_spa), zio->io_txg, obp);
-		arc_release(dr->dt.dl.dr_data, db);
+		if (dr->dt.dl.dr_data != NULL)
+			arc_release(dr->dt.dl.dr_data, db);
 	}
 	mutex_exit(&db->db_mtx);
 
@@ -4632,7 +4864,12 @@ dbuf_write(dbuf_dirty_record_t *dr, arc_buf_t *data, dmu_tx_t *tx)
 
 	if (db->db_blkid == DMU_SPILL_BLKID)
 		wp_flag = WP_SPILL;
-	wp_flag |= (db->db_state == DB_NOFILL) ? WP_NOFILL : 0;
+	/*
+	 * A directly written block has no data for the dedup path to use.
+	 */
+	if (db->db_state == DB_NOFILL ||
+	    (db->db_level == 0 && dr->dt.dl.dr_diowrite))
+		wp_flag |= WP_NOFILL;
 
 	dmu_write_policy(os, dn, db->db_level, wp_flag, &zp);
 	DB_DNODE_EXIT(db);
@@ -4662,7 +4899,8 @@ dbuf_write(dbuf_dirty_record_t *dr, arc_buf_t *data, dmu_tx_t *tx)
 		mutex_enter(&db->db_mtx);
 		dr->dt.dl.dr_override_state = DR_NOT_OVERRIDDEN;
 		zio_write_override(dr->dr_zio, &dr->dt.dl.dr_overridden_by,
-		    dr->dt.dl.dr_copies, dr->dt.dl.dr_nopwrite);
+		    dr->dt.dl.dr_copies, dr->dt.dl.dr_nopwrite,
+		    dr->dt.dl.dr_brtwrite);
 		mutex_exit(&db->db_mtx);
 	} else if (db->db_state == DB_NOFILL) {
 		ASSERT(zp.zp_checksum == ZIO_CHECKSUM_OFF ||
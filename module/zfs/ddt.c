@@ -37,15 +37,46 @@
 #include <sys/zio_compress.h>
 #include <sys/dsl_scan.h>
 #include <sys/abd.h>
+#include <sys/zfeature.h>
 
 static kmem_cache_t *ddt_cache;
 static kmem_cache_t *ddt_entry_cache;
+static kmem_cache_t *ddt_log_entry_cache;
+
+static int ddt_key_compare(const ddt_key_t *, const ddt_key_t *);
 
 /*
  * Enable/disable prefetching of dedup-ed blocks which are going to be freed.
  */
 int zfs_dedup_prefetch = 0;
 
+/*
+ * When the ddt_log feature is enabled, the DDT updates of each txg are
+ * appended to an on-disk log and kept in memory, rather than being written
+ * to the DDT objects right away.  Once the previously logged entries have
+ * all been written back ("flushed"), the active log becomes the flushing
+ * log if it holds at least zfs_dedup_log_flush_entries_min entries, is more
+ * than zfs_dedup_log_txg_max txgs old, or the logs of a table take up more
+ * than zfs_dedup_log_mem_max bytes of memory (0 means 1% of physical
+ * memory).  The flushing log is written to the DDT objects in key order
+ * over about zfs_dedup_log_flush_txgs txgs, but no fewer than
+ * zfs_dedup_log_flush_entries_min entries are flushed per txg.
+ */
+int zfs_dedup_log_flush_entries_min = 1000;
+int zfs_dedup_log_flush_txgs = 10;
+int zfs_dedup_log_txg_max = 100;
+unsigned long zfs_dedup_log_mem_max = 0;
+
+/*
+ * Prefetch the DDT objects when the pool is imported, so that the first
+ * dedup-ed writes and frees don't each wait on a random read.  At most a
+ * quarter of the ARC target size is prefetched.
+ */
+int zfs_dedup_load_prefetch = 1;
+
+/* Number of log records read at a time when loading a log */
+#define	DDT_LOG_RECORDS_PER_IO	1024
+
 static const ddt_ops_t *ddt_ops[DDT_TYPES] = {
 	&ddt_zap_ops,
 };
@@ -625,11 +656,14 @@ ddt_init(void)
 	    sizeof (ddt_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
 	ddt_entry_cache = kmem_cache_create("ddt_entry_cache",
 	    sizeof (ddt_entry_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
+	ddt_log_entry_cache = kmem_cache_create("ddt_log_entry_cache",
+	    sizeof (ddt_log_entry_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
 }
 
 void
 ddt_fini(void)
 {
+	kmem_cache_destroy(ddt_log_entry_cache);
 	kmem_cache_destroy(ddt_entry_cache);
 	kmem_cache_destroy(ddt_cache);
 }
@@ -672,10 +706,401 @@ ddt_remove(ddt_t *ddt, ddt_entry_t *dde)
 	ddt_free(dde);
 }
 
+/*
+ * The DDT log.  Each DDT has an active log, which receives the entries
+ * updated by the syncing txg, and a flushing log whose entries are being
+ * written back to the DDT objects.  A key is held by at most one of the
+ * in-core logs, and an entry found in a log supersedes any copy of it in
+ * the DDT objects.
+ */
+static boolean_t
+ddt_log_enabled(ddt_t *ddt)
+{
+	return (spa_feature_is_enabled(ddt->ddt_spa, SPA_FEATURE_DDT_LOG));
+}
+
+static void
+ddt_log_name(ddt_t *ddt, ddt_log_t *ddl, char *name)
+{
+	(void) sprintf(name, DMU_POOL_DDT_LOG,
+	    zio_checksum_table[ddt->ddt_checksum].ci_name,
+	    ddl == ddt->ddt_log_active ? "active" : "flushing");
+}
+
+static boolean_t
+ddt_log_empty(ddt_t *ddt)
+{
+	return (ddt->ddt_log_active->ddl_phys.dlp_object == 0 &&
+	    ddt->ddt_log_flushing->ddl_phys.dlp_object == 0);
+}
+
+static boolean_t
+ddt_log_mem_exceeded(ddt_t *ddt)
+{
+	uint64_t limit = zfs_dedup_log_mem_max;
+
+	if (limit == 0)
+		limit = (physmem * PAGESIZE) / 100;
+
+	return ((avl_numnodes(&ddt->ddt_log_active->ddl_tree) +
+	    avl_numnodes(&ddt->ddt_log_flushing->ddl_tree)) *
+	    sizeof (ddt_log_entry_t) > limit);
+}
+
+static ddt_log_entry_t *
+ddt_log_find(ddt_t *ddt, const ddt_key_t *ddk, ddt_log_t **ddlp)
+{
+	ddt_log_entry_t dle_search, *dle;
+
+	ASSERT(MUTEX_HELD(&ddt->ddt_lock));
+
+	dle_search.dle_rec.dlr_key = *ddk;
+
+	for (int l = 0; l < DDT_LOGS; l++) {
+		ddt_log_t *ddl = &ddt->ddt_log[l];
+
+		dle = avl_find(&ddl->ddl_tree, &dle_search, NULL);
+		if (dle != NULL) {
+			if (ddlp != NULL)
+				*ddlp = ddl;
+			return (dle);
+		}
+	}
+
+	return (NULL);
+}
+
+/*
+ * Fill in an entry from its log record.  Returns B_FALSE if the log
+ * records the entry as freed.
+ */
+static boolean_t
+ddt_log_entry_fill(const ddt_log_entry_t *dle, ddt_entry_t *dde)
+{
+	const ddt_log_record_t *dlr = &dle->dle_rec;
+
+	bcopy(dlr->dlr_phys, dde->dde_phys, sizeof (dde->dde_phys));
+	dde->dde_type = dlr->dlr_type;
+	dde->dde_class = dlr->dlr_class;
+	dde->dde_disk_type = dlr->dlr_disk_type;
+	dde->dde_disk_class = dlr->dlr_disk_class;
+
+	return (dlr->dlr_type != DDT_TYPES);
+}
+
+/*
+ * Insert or replace an entry in a log, superseding any copy of it held
+ * by another log.
+ */
+static void
+ddt_log_insert(ddt_t *ddt, ddt_log_t *ddl, const ddt_log_record_t *dlr)
+{
+	ddt_log_entry_t *dle;
+	ddt_log_t *oddl;
+	avl_index_t where;
+
+	ASSERT(MUTEX_HELD(&ddt->ddt_lock));
+
+	dle = ddt_log_find(ddt, &dlr->dlr_key, &oddl);
+	if (dle != NULL && oddl != ddl) {
+		avl_remove(&oddl->ddl_tree, dle);
+		avl_add(&ddl->ddl_tree, dle);
+	} else if (dle == NULL) {
+		dle = kmem_cache_alloc(ddt_log_entry_cache, KM_SLEEP);
+		dle->dle_rec.dlr_key = dlr->dlr_key;
+		VERIFY3P(avl_find(&ddl->ddl_tree, dle, &where), ==, NULL);
+		avl_insert(&ddl->ddl_tree, dle, where);
+	}
+
+	dle->dle_rec = *dlr;
+}
+
+static void
+ddt_log_free(ddt_log_t *ddl)
+{
+	ddt_log_entry_t *dle;
+	void *cookie = NULL;
+
+	while ((dle = avl_destroy_nodes(&ddl->ddl_tree, &cookie)) != NULL)
+		kmem_cache_free(ddt_log_entry_cache, dle);
+}
+
+static int
+ddt_log_load_one(ddt_t *ddt, ddt_log_t *ddl)
+{
+	objset_t *os = ddt->ddt_os;
+	ddt_log_phys_t *dlp = &ddl->ddl_phys;
+	uint64_t nrecords, chunk;
+	ddt_log_record_t *buf;
+	char name[DDT_NAMELEN];
+	int error;
+
+	ddt_log_name(ddt, ddl, name);
+
+	error = zap_lookup(os, DMU_POOL_DIRECTORY_OBJECT, name,
+	    sizeof (uint64_t), sizeof (ddt_log_phys_t) / sizeof (uint64_t),
+	    dlp);
+	if (error != 0) {
+		bzero(dlp, sizeof (ddt_log_phys_t));
+		return (error == ENOENT ? 0 : error);
+	}
+
+	ASSERT0(dlp->dlp_length % sizeof (ddt_log_record_t));
+	nrecords = dlp->dlp_length / sizeof (ddt_log_record_t);
+	buf = vmem_alloc(DDT_LOG_RECORDS_PER_IO * sizeof (ddt_log_record_t),
+	    KM_SLEEP);
+
+	for (uint64_t r = 0; r < nrecords; r += chunk) {
+		chunk = MIN(nrecords - r, DDT_LOG_RECORDS_PER_IO);
+		error = dmu_read(os, dlp->dlp_object,
+		    r * sizeof (ddt_log_record_t),
+		    chunk * sizeof (ddt_log_record_t), buf, DMU_READ_PREFETCH);
+		if (error != 0)
+			break;
+
+		mutex_enter(&ddt->ddt_lock);
+		for (uint64_t i = 0; i < chunk; i++) {
+			ddt_log_record_t *dlr = &buf[i];
+			ddt_log_t *oddl;
+
+			/*
+			 * Skip the entries of the flushing log which have
+			 * already been written to the DDT objects, as well as
+			 * those superseded by the active log.
+			 */
+			if (ddl == ddt->ddt_log_flushing &&
+			    (((dlp->dlp_flags & DDL_FLAG_CHECKPOINT) &&
+			    ddt_key_compare(&dlr->dlr_key,
+			    &dlp->dlp_checkpoint) <= 0) ||
+			    (ddt_log_find(ddt, &dlr->dlr_key, &oddl) != NULL &&
+			    oddl != ddl)))
+				continue;
+
+			ddt_log_insert(ddt, ddl, dlr);
+		}
+		mutex_exit(&ddt->ddt_lock);
+	}
+
+	vmem_free(buf, DDT_LOG_RECORDS_PER_IO * sizeof (ddt_log_record_t));
+
+	return (error);
+}
+
+/*
+ * Load the DDT logs.  The active log is loaded first, as its entries
+ * supersede those of the flushing log.
+ */
+static int
+ddt_log_load(ddt_t *ddt)
+{
+	int error;
+
+	error = ddt_log_load_one(ddt, ddt->ddt_log_active);
+	if (error == 0)
+		error = ddt_log_load_one(ddt, ddt->ddt_log_flushing);
+
+	return (error);
+}
+
+static void
+ddt_log_update_phys(ddt_t *ddt, ddt_log_t *ddl, dmu_tx_t *tx)
+{
+	char name[DDT_NAMELEN];
+
+	ddt_log_name(ddt, ddl, name);
+
+	VERIFY0(zap_update(ddt->ddt_os, DMU_POOL_DIRECTORY_OBJECT, name,
+	    sizeof (uint64_t), sizeof (ddt_log_phys_t) / sizeof (uint64_t),
+	    &ddl->ddl_phys, tx));
+}
+
+static void
+ddt_log_destroy(ddt_t *ddt, ddt_log_t *ddl, dmu_tx_t *tx)
+{
+	char name[DDT_NAMELEN];
+
+	ASSERT0(avl_numnodes(&ddl->ddl_tree));
+	ASSERT(ddl->ddl_phys.dlp_object != 0);
+
+	ddt_log_name(ddt, ddl, name);
+
+	VERIFY0(zap_remove(ddt->ddt_os, DMU_POOL_DIRECTORY_OBJECT, name, tx));
+	VERIFY0(dmu_object_free(ddt->ddt_os, ddl->ddl_phys.dlp_object, tx));
+	spa_feature_decr(ddt->ddt_spa, SPA_FEATURE_DDT_LOG, tx);
+
+	bzero(&ddl->ddl_phys, sizeof (ddt_log_phys_t));
+}
+
+/*
+ * Append the records of this sync pass to the active log, creating it
+ * if needed.  The in-core log has already been updated.
+ */
+static void
+ddt_log_append(ddt_t *ddt, ddt_log_record_t *buf, uint64_t n, dmu_tx_t *tx)
+{
+	ddt_log_t *ddl = ddt->ddt_log_active;
+	ddt_log_phys_t *dlp = &ddl->ddl_phys;
+	objset_t *os = ddt->ddt_os;
+	char name[DDT_NAMELEN];
+
+	if (dlp->dlp_object == 0) {
+		dlp->dlp_object = dmu_object_alloc(os,
+		    DMU_OTN_UINT64_METADATA, SPA_OLD_MAXBLOCKSIZE,
+		    DMU_OT_NONE, 0, tx);
+		dlp->dlp_length = 0;
+		dlp->dlp_first_txg = dmu_tx_get_txg(tx);
+		spa_feature_incr(ddt->ddt_spa, SPA_FEATURE_DDT_LOG, tx);
+
+		ddt_log_name(ddt, ddl, name);
+		VERIFY0(zap_add(os, DMU_POOL_DIRECTORY_OBJECT, name,
+		    sizeof (uint64_t), sizeof (ddt_log_phys_t) /
+		    sizeof (uint64_t), dlp, tx));
+	}
+
+	dmu_write(os, dlp->dlp_object, dlp->dlp_length,
+	    n * sizeof (ddt_log_record_t), buf, tx);
+	dlp->dlp_length += n * sizeof (ddt_log_record_t);
+
+	ddt_log_update_phys(ddt, ddl, tx);
+}
+
+/*
+ * Write back the next portion of the flushing log to the DDT objects, in
+ * key order.  The last key written is recorded so that the remainder of
+ * the log can be picked up again after an import.
+ */
+static uint64_t
+ddt_log_flush(ddt_t *ddt, dmu_tx_t *tx)
+{
+	ddt_log_t *ddl = ddt->ddt_log_flushing;
+	ddt_log_phys_t *dlp = &ddl->ddl_phys;
+	ddt_log_entry_t *dle;
+	ddt_entry_t *dde;
+	uint64_t count, flushed = 0;
+
+	count = avl_numnodes(&ddl->ddl_tree);
+	if (count == 0)
+		return (0);
+
+	/*
+	 * Writing an entry back could move it behind the cursor of a scan
+	 * walking the DDT, so the flushing log is held until the walk is
+	 * done.  This also keeps the ddt_log feature active, and so any
+	 * bookmark in the log, for as long as the walk needs it.
+	 */
+	if (dsl_scan_walking_ddt(ddt->ddt_spa->spa_dsl_pool))
+		return (0);
+
+	if (!ddt_log_mem_exceeded(ddt)) {
+		count = MAX(zfs_dedup_log_flush_entries_min,
+		    howmany(count, MAX(zfs_dedup_log_flush_txgs, 1)));
+	}
+
+	dde = kmem_cache_alloc(ddt_entry_cache, KM_SLEEP);
+
+	mutex_enter(&ddt->ddt_lock);
+	while (flushed < count && (dle = avl_first(&ddl->ddl_tree)) != NULL) {
+		ddt_log_record_t *dlr = &dle->dle_rec;
+
+		/*
+		 * The DDT objects are updated without holding the DDT lock;
+		 * the entry is only removed from the log once its final
+		 * location has been written, so lookups never miss it.
+		 */
+		mutex_exit(&ddt->ddt_lock);
+
+		dde->dde_key = dlr->dlr_key;
+		(void) ddt_log_entry_fill(dle, dde);
+
+		if (dlr->dlr_disk_type != DDT_TYPES &&
+		    (dlr->dlr_disk_type != dlr->dlr_type ||
+		    dlr->dlr_disk_class != dlr->dlr_class)) {
+			VERIFY0(ddt_object_remove(ddt, dlr->dlr_disk_type,
+			    dlr->dlr_disk_class, dde, tx));
+		}
+		if (dlr->dlr_type != DDT_TYPES) {
+			if (!ddt_object_exists(ddt, dlr->dlr_type,
+			    dlr->dlr_class)) {
+				ddt_object_create(ddt, dlr->dlr_type,
+				    dlr->dlr_class, tx);
+			}
+			VERIFY0(ddt_object_update(ddt, dlr->dlr_type,
+			    dlr->dlr_class, dde, tx));
+		}
+
+		dlp->dlp_checkpoint = dlr->dlr_key;
+		dlp->dlp_flags |= DDL_FLAG_CHECKPOINT;
+
+		mutex_enter(&ddt->ddt_lock);
+		avl_remove(&ddl->ddl_tree, dle);
+		kmem_cache_free(ddt_log_entry_cache, dle);
+		flushed++;
+	}
+	mutex_exit(&ddt->ddt_lock);
+
+	kmem_cache_free(ddt_entry_cache, dde);
+
+	ddt_log_update_phys(ddt, ddl, tx);
+
+	return (flushed);
+}
+
+/*
+ * Flush the flushing log and, once it is empty, destroy it and promote
+ * the active log in its place.  Returns B_TRUE if the DDT objects or the
+ * logs were changed.
+ */
+static boolean_t
+ddt_log_sync(ddt_t *ddt, dmu_tx_t *tx)
+{
+	ddt_log_t *active = ddt->ddt_log_active;
+	ddt_log_t *flushing = ddt->ddt_log_flushing;
+	uint64_t txg = dmu_tx_get_txg(tx);
+	char name[DDT_NAMELEN];
+	boolean_t changed;
+
+	changed = (ddt_log_flush(ddt, tx) != 0);
+
+	if (avl_numnodes(&flushing->ddl_tree) != 0)
+		return (changed);
+
+	if (flushing->ddl_phys.dlp_object != 0) {
+		ddt_log_destroy(ddt, flushing, tx);
+		changed = B_TRUE;
+	}
+
+	if (active->ddl_phys.dlp_object == 0)
+		return (changed);
+
+	if (avl_numnodes(&active->ddl_tree) <
+	    (ulong_t)zfs_dedup_log_flush_entries_min &&
+	    txg - active->ddl_phys.dlp_first_txg <
+	    (uint64_t)zfs_dedup_log_txg_max &&
+	    !ddt_log_mem_exceeded(ddt))
+		return (changed);
+
+	ddt_log_name(ddt, active, name);
+	VERIFY0(zap_remove(ddt->ddt_os, DMU_POOL_DIRECTORY_OBJECT, name, tx));
+
+	mutex_enter(&ddt->ddt_lock);
+	ddt->ddt_log_active = flushing;
+	ddt->ddt_log_flushing = active;
+	mutex_exit(&ddt->ddt_lock);
+
+	ASSERT0(active->ddl_phys.dlp_flags & DDL_FLAG_CHECKPOINT);
+	ddt_log_name(ddt, active, name);
+	VERIFY0(zap_add(ddt->ddt_os, DMU_POOL_DIRECTORY_OBJECT, name,
+	    sizeof (uint64_t), sizeof (ddt_log_phys_t) / sizeof (uint64_t),
+	    &active->ddl_phys, tx));
+
+	return (B_TRUE);
+}
+
 ddt_entry_t *
 ddt_lookup(ddt_t *ddt, const blkptr_t *bp, boolean_t add)
 {
 	ddt_entry_t *dde, dde_search;
+	ddt_log_entry_t *dle;
 	enum ddt_type type;
 	enum ddt_class class;
 	avl_index_t where;
@@ -699,6 +1124,18 @@ ddt_lookup(ddt_t *ddt, const blkptr_t *bp, boolean_t add)
 	if (dde->dde_loaded)
 		return (dde);
 
+	/*
+	 * A logged entry is more recent than any copy in the DDT objects,
+	 * and is already in memory.
+	 */
+	dle = ddt_log_find(ddt, &dde->dde_key, NULL);
+	if (dle != NULL) {
+		if (ddt_log_entry_fill(dle, dde))
+			ddt_stat_update(ddt, dde, -1ULL);
+		dde->dde_loaded = B_TRUE;
+		return (dde);
+	}
+
 	dde->dde_loading = B_TRUE;
 
 	ddt_exit(ddt);
@@ -724,6 +1161,8 @@ ddt_lookup(ddt_t *ddt, const blkptr_t *bp, boolean_t add)
 
 	dde->dde_type = type;	/* will be DDT_TYPES if no entry found */
 	dde->dde_class = class;	/* will be DDT_CLASSES if no entry found */
+	dde->dde_disk_type = type;
+	dde->dde_disk_class = class;
 	dde->dde_loaded = B_TRUE;
 	dde->dde_loading = B_FALSE;
 
@@ -768,13 +1207,11 @@ typedef struct ddt_key_cmp {
 	uint16_t	u16[DDT_KEY_CMP_LEN];
 } ddt_key_cmp_t;
 
-int
-ddt_entry_compare(const void *x1, const void *x2)
+static int
+ddt_key_compare(const ddt_key_t *ddk1, const ddt_key_t *ddk2)
 {
-	const ddt_entry_t *dde1 = x1;
-	const ddt_entry_t *dde2 = x2;
-	const ddt_key_cmp_t *k1 = (const ddt_key_cmp_t *)&dde1->dde_key;
-	const ddt_key_cmp_t *k2 = (const ddt_key_cmp_t *)&dde2->dde_key;
+	const ddt_key_cmp_t *k1 = (const ddt_key_cmp_t *)ddk1;
+	const ddt_key_cmp_t *k2 = (const ddt_key_cmp_t *)ddk2;
 	int32_t cmp = 0;
 
 	for (int i = 0; i < DDT_KEY_CMP_LEN; i++) {
@@ -786,6 +1223,25 @@ ddt_entry_compare(const void *x1, const void *x2)
 	return (AVL_ISIGN(cmp));
 }
 
+int
+ddt_entry_compare(const void *x1, const void *x2)
+{
+	const ddt_entry_t *dde1 = x1;
+	const ddt_entry_t *dde2 = x2;
+
+	return (ddt_key_compare(&dde1->dde_key, &dde2->dde_key));
+}
+
+static int
+ddt_log_entry_compare(const void *x1, const void *x2)
+{
+	const ddt_log_entry_t *dle1 = x1;
+	const ddt_log_entry_t *dle2 = x2;
+
+	return (ddt_key_compare(&dle1->dle_rec.dlr_key,
+	    &dle2->dle_rec.dlr_key));
+}
+
 static ddt_t *
 ddt_table_alloc(spa_t *spa, enum zio_checksum c)
 {
@@ -799,6 +1255,13 @@ ddt_table_alloc(spa_t *spa, enum zio_checksum c)
 	    sizeof (ddt_entry_t), offsetof(ddt_entry_t, dde_node));
 	avl_create(&ddt->ddt_repair_tree, ddt_entry_compare,
 	    sizeof (ddt_entry_t), offsetof(ddt_entry_t, dde_node));
+	for (int l = 0; l < DDT_LOGS; l++) {
+		avl_create(&ddt->ddt_log[l].ddl_tree, ddt_log_entry_compare,
+		    sizeof (ddt_log_entry_t),
+		    offsetof(ddt_log_entry_t, dle_node));
+	}
+	ddt->ddt_log_active = &ddt->ddt_log[DDT_LOG_ACTIVE];
+	ddt->ddt_log_flushing = &ddt->ddt_log[DDT_LOG_FLUSHING];
 	ddt->ddt_checksum = c;
 	ddt->ddt_spa = spa;
 	ddt->ddt_os = spa->spa_meta_objset;
@@ -813,6 +1276,10 @@ ddt_table_free(ddt_t *ddt)
 	ASSERT(avl_numnodes(&ddt->ddt_repair_tree) == 0);
 	avl_destroy(&ddt->ddt_tree);
 	avl_destroy(&ddt->ddt_repair_tree);
+	for (int l = 0; l < DDT_LOGS; l++) {
+		ddt_log_free(&ddt->ddt_log[l]);
+		avl_destroy(&ddt->ddt_log[l].ddl_tree);
+	}
 	mutex_destroy(&ddt->ddt_lock);
 	kmem_cache_free(ddt_cache, ddt);
 }
@@ -826,6 +1293,38 @@ ddt_create(spa_t *spa)
 		spa->spa_ddt[c] = ddt_table_alloc(spa, c);
 }
 
+/*
+ * Prefetch the DDT objects of every table, up to a quarter of the ARC.
+ */
+static void
+ddt_load_prefetch(spa_t *spa)
+{
+	uint64_t budget = arc_target_bytes() / 4;
+
+	for (enum ddt_class class = 0; class < DDT_CLASSES; class++) {
+		for (enum zio_checksum c = 0; c < ZIO_CHECKSUM_FUNCTIONS; c++) {
+			ddt_t *ddt = spa->spa_ddt[c];
+			for (enum ddt_type type = 0; type < DDT_TYPES;
+			    type++) {
+				dmu_object_info_t doi;
+				uint64_t len;
+
+				if (budget == 0)
+					return;
+				if (ddt_object_info(ddt, type, class,
+				    &doi) != 0)
+					continue;
+
+				len = MIN(doi.doi_max_offset, budget);
+				budget -= len;
+				dmu_prefetch(ddt->ddt_os,
+				    ddt->ddt_object[type][class], 0, 0, len,
+				    ZIO_PRIORITY_ASYNC_READ);
+			}
+		}
+	}
+}
+
 int
 ddt_load(spa_t *spa)
 {
@@ -851,6 +1350,10 @@ ddt_load(spa_t *spa)
 			}
 		}
 
+		error = ddt_log_load(ddt);
+		if (error != 0)
+			return (error);
+
 		/*
 		 * Seed the cached histograms.
 		 */
@@ -859,6 +1362,9 @@ ddt_load(spa_t *spa)
 		spa->spa_dedup_dspace = ~0ULL;
 	}
 
+	if (zfs_dedup_load_prefetch)
+		ddt_load_prefetch(spa);
+
 	return (0);
 }
 
@@ -878,6 +1384,7 @@ ddt_class_contains(spa_t *spa, enum ddt_class max_class, const blkptr_t *bp)
 {
 	ddt_t *ddt;
 	ddt_entry_t *dde;
+	ddt_log_entry_t *dle;
 
 	if (!BP_GET_DEDUP(bp))
 		return (B_FALSE);
@@ -890,6 +1397,16 @@ ddt_class_contains(spa_t *spa, enum ddt_class max_class, const blkptr_t *bp)
 
 	ddt_key_fill(&(dde->dde_key), bp);
 
+	ddt_enter(ddt);
+	dle = ddt_log_find(ddt, &dde->dde_key, NULL);
+	if (dle != NULL) {
+		boolean_t contains = (dle->dle_rec.dlr_class <= max_class);
+		ddt_exit(ddt);
+		kmem_cache_free(ddt_entry_cache, dde);
+		return (contains);
+	}
+	ddt_exit(ddt);
+
 	for (enum ddt_type type = 0; type < DDT_TYPES; type++) {
 		for (enum ddt_class class = 0; class <= max_class; class++) {
 			if (ddt_object_lookup(ddt, type, class, dde) == 0) {
@@ -908,11 +1425,23 @@ ddt_repair_start(ddt_t *ddt, const blkptr_t *bp)
 {
 	ddt_key_t ddk;
 	ddt_entry_t *dde;
+	ddt_log_entry_t *dle;
 
 	ddt_key_fill(&ddk, bp);
 
 	dde = ddt_alloc(&ddk);
 
+	ddt_enter(ddt);
+	dle = ddt_log_find(ddt, &ddk, NULL);
+	if (dle != NULL) {
+		if (!ddt_log_entry_fill(dle, dde) ||
+		    dde->dde_class == DDT_CLASS_UNIQUE)
+			bzero(dde->dde_phys, sizeof (dde->dde_phys));
+		ddt_exit(ddt);
+		return (dde);
+	}
+	ddt_exit(ddt);
+
 	for (enum ddt_type type = 0; type < DDT_TYPES; type++) {
 		for (enum ddt_class class = 0; class < DDT_CLASSES; class++) {
 			/*
@@ -1007,8 +1536,14 @@ ddt_repair_table(ddt_t *ddt, zio_t *rio)
 	ddt_exit(ddt);
 }
 
-static void
-ddt_sync_entry(ddt_t *ddt, ddt_entry_t *dde, dmu_tx_t *tx, uint64_t txg)
+/*
+ * Write out an entry.  When logging, the DDT objects are left untouched
+ * and the entry's log record is filled in instead; returns B_TRUE if the
+ * record needs to be appended to the log.
+ */
+static boolean_t
+ddt_sync_entry(ddt_t *ddt, ddt_entry_t *dde, dmu_tx_t *tx, uint64_t txg,
+    ddt_log_record_t *dlr)
 {
 	dsl_pool_t *dp = ddt->ddt_spa->spa_dsl_pool;
 	ddt_phys_t *ddp = dde->dde_phys;
@@ -1018,10 +1553,17 @@ ddt_sync_entry(ddt_t *ddt, ddt_entry_t *dde, dmu_tx_t *tx, uint64_t txg)
 	enum ddt_class oclass = dde->dde_class;
 	enum ddt_class nclass;
 	uint64_t total_refcnt = 0;
+	boolean_t logged = B_FALSE;
 
 	ASSERT(dde->dde_loaded);
 	ASSERT(!dde->dde_loading);
 
+	if (dlr != NULL) {
+		ddt_enter(ddt);
+		logged = (ddt_log_find(ddt, ddk, NULL) != NULL);
+		ddt_exit(ddt);
+	}
+
 	for (int p = 0; p < DDT_PHYS_TYPES; p++, ddp++) {
 		ASSERT(dde->dde_lead_zio[p] == NULL);
 		if (ddp->ddp_phys_birth == 0) {
@@ -1048,7 +1590,7 @@ ddt_sync_entry(ddt_t *ddt, ddt_entry_t *dde, dmu_tx_t *tx, uint64_t txg)
 	else
 		nclass = DDT_CLASS_UNIQUE;
 
-	if (otype != DDT_TYPES &&
+	if (dlr == NULL && otype != DDT_TYPES &&
 	    (otype != ntype || oclass != nclass || total_refcnt == 0)) {
 		VERIFY(ddt_object_remove(ddt, otype, oclass, dde, tx) == 0);
 		ASSERT(ddt_object_lookup(ddt, otype, oclass, dde) == ENOENT);
@@ -1060,20 +1602,49 @@ ddt_sync_entry(ddt_t *ddt, ddt_entry_t *dde, dmu_tx_t *tx, uint64_t txg)
 		ddt_stat_update(ddt, dde, 0);
 		if (!ddt_object_exists(ddt, ntype, nclass))
 			ddt_object_create(ddt, ntype, nclass, tx);
-		VERIFY(ddt_object_update(ddt, ntype, nclass, dde, tx) == 0);
+		if (dlr == NULL) {
+			VERIFY(ddt_object_update(ddt, ntype, nclass, dde,
+			    tx) == 0);
+		}
 
 		/*
 		 * If the class changes, the order that we scan this bp
 		 * changes.  If it decreases, we could miss it, so
 		 * scan it right now.  (This covers both class changing
 		 * while we are doing ddt_walk(), and when we are
-		 * traversing.)
+		 * traversing.)  An entry moving from the DDT objects
+		 * into the log may likewise be passed over by a walk
+		 * of its class which is already under way.
 		 */
-		if (nclass < oclass) {
+		if (nclass < oclass ||
+		    (dlr != NULL && !logged && nclass == oclass)) {
 			dsl_scan_ddt_entry(dp->dp_scan,
 			    ddt->ddt_checksum, dde, tx);
 		}
+	} else {
+		dde->dde_type = DDT_TYPES;
+		dde->dde_class = DDT_CLASSES;
 	}
+
+	if (dlr == NULL)
+		return (B_FALSE);
+
+	/*
+	 * Entries which were never written out need no record, unless
+	 * they supersede an earlier one.
+	 */
+	if (otype == DDT_TYPES && total_refcnt == 0 && !logged)
+		return (B_FALSE);
+
+	bzero(dlr, sizeof (ddt_log_record_t));
+	dlr->dlr_key = *ddk;
+	bcopy(dde->dde_phys, dlr->dlr_phys, sizeof (dlr->dlr_phys));
+	dlr->dlr_type = dde->dde_type;
+	dlr->dlr_class = dde->dde_class;
+	dlr->dlr_disk_type = dde->dde_disk_type;
+	dlr->dlr_disk_class = dde->dde_disk_class;
+
+	return (B_TRUE);
 }
 
 static void
@@ -1081,9 +1652,16 @@ ddt_sync_table(ddt_t *ddt, dmu_tx_t *tx, uint64_t txg)
 {
 	spa_t *spa = ddt->ddt_spa;
 	ddt_entry_t *dde;
+	ddt_log_record_t *buf = NULL;
+	uint64_t nentries = avl_numnodes(&ddt->ddt_tree);
+	uint64_t n = 0;
 	void *cookie = NULL;
 
-	if (avl_numnodes(&ddt->ddt_tree) == 0)
+	/*
+	 * Logged entries are written back during the first pass only, as
+	 * doing so dirties more of the MOS.
+	 */
+	if (nentries == 0 && (ddt_log_empty(ddt) || spa_sync_pass(spa) > 1))
 		return;
 
 	ASSERT(spa->spa_uberblock.ub_version >= SPA_VERSION_DEDUP);
@@ -1094,11 +1672,35 @@ ddt_sync_table(ddt_t *ddt, dmu_tx_t *tx, uint64_t txg)
 		    DMU_POOL_DDT_STATS, tx);
 	}
 
+	if (nentries != 0 && ddt_log_enabled(ddt))
+		buf = vmem_alloc(nentries * sizeof (ddt_log_record_t),
+		    KM_SLEEP);
+
 	while ((dde = avl_destroy_nodes(&ddt->ddt_tree, &cookie)) != NULL) {
-		ddt_sync_entry(ddt, dde, tx, txg);
+		ddt_log_record_t *dlr = (buf != NULL) ? &buf[n] : NULL;
+
+		if (ddt_sync_entry(ddt, dde, tx, txg, dlr)) {
+			ddt_enter(ddt);
+			ddt_log_insert(ddt, ddt->ddt_log_active, dlr);
+			ddt_exit(ddt);
+			n++;
+		}
 		ddt_free(dde);
 	}
 
+	if (n != 0)
+		ddt_log_append(ddt, buf, n, tx);
+	if (buf != NULL)
+		vmem_free(buf, nentries * sizeof (ddt_log_record_t));
+
+	/*
+	 * The dirty entries have been moved to the active log above, so
+	 * that none of them are written back with stale contents.
+	 */
+	if (!ddt_log_empty(ddt) && spa_sync_pass(spa) == 1 &&
+	    !ddt_log_sync(ddt, tx) && nentries == 0)
+		return;
+
 	for (enum ddt_type type = 0; type < DDT_TYPES; type++) {
 		uint64_t add, count = 0;
 		for (enum ddt_class class = 0; class < DDT_CLASSES; class++) {
@@ -1109,8 +1711,13 @@ ddt_sync_table(ddt_t *ddt, dmu_tx_t *tx, uint64_t txg)
 				count += add;
 			}
 		}
+		/*
+		 * The DDT objects hold the histograms of logged entries too,
+		 * so are kept for as long as there is a log.
+		 */
 		for (enum ddt_class class = 0; class < DDT_CLASSES; class++) {
-			if (count == 0 && ddt_object_exists(ddt, type, class))
+			if (count == 0 && ddt_log_empty(ddt) &&
+			    ddt_object_exists(ddt, type, class))
 				ddt_object_destroy(ddt, type, class, tx);
 		}
 	}
@@ -1157,6 +1764,90 @@ ddt_sync(spa_t *spa, uint64_t txg)
 	dmu_tx_commit(tx);
 }
 
+/*
+ * Walk the logged entries of a class in key order.  The bookmark only has
+ * room for the first word of the last key visited, so the full key is kept
+ * in the ddt and the walk resumes past it.  Should the two disagree, as
+ * when a walk is resumed after an import, the walk restarts at the first
+ * key sharing that word; visiting an entry twice is harmless.
+ */
+static int
+ddt_log_walk(ddt_t *ddt, enum ddt_class class, uint64_t *walk,
+    ddt_entry_t *dde)
+{
+	ddt_log_entry_t dle_search, *dle, *next = NULL;
+	avl_index_t where;
+	boolean_t resume;
+
+	ddt_enter(ddt);
+
+	resume = (ddt->ddt_log_walk_key.ddk_cksum.zc_word[0] == *walk);
+	if (resume) {
+		dle_search.dle_rec.dlr_key = ddt->ddt_log_walk_key;
+	} else {
+		bzero(&dle_search.dle_rec.dlr_key, sizeof (ddt_key_t));
+		dle_search.dle_rec.dlr_key.ddk_cksum.zc_word[0] = *walk;
+	}
+
+	for (int l = 0; l < DDT_LOGS; l++) {
+		avl_tree_t *t = &ddt->ddt_log[l].ddl_tree;
+
+		dle = avl_find(t, &dle_search, &where);
+		if (dle == NULL)
+			dle = avl_nearest(t, where, AVL_AFTER);
+		else if (resume)
+			dle = AVL_NEXT(t, dle);
+
+		while (dle != NULL && dle->dle_rec.dlr_class != class)
+			dle = AVL_NEXT(t, dle);
+
+		if (dle != NULL &&
+		    (next == NULL || ddt_log_entry_compare(dle, next) < 0))
+			next = dle;
+	}
+
+	if (next != NULL) {
+		dde->dde_key = next->dle_rec.dlr_key;
+		(void) ddt_log_entry_fill(next, dde);
+		ddt->ddt_log_walk_key = dde->dde_key;
+		*walk = dde->dde_key.ddk_cksum.zc_word[0];
+	} else {
+		bzero(&ddt->ddt_log_walk_key, sizeof (ddt_key_t));
+	}
+	ddt_exit(ddt);
+
+	return (next != NULL ? 0 : SET_ERROR(ENOENT));
+}
+
+/*
+ * Walk the entries of a DDT object, skipping those superseded by the log;
+ * they are visited by ddt_log_walk() instead.
+ */
+static int
+ddt_object_walk_unlogged(ddt_t *ddt, enum ddt_type type, enum ddt_class class,
+    uint64_t *walk, ddt_entry_t *dde)
+{
+	int error;
+
+	if (!ddt_object_exists(ddt, type, class))
+		return (SET_ERROR(ENOENT));
+
+	for (;;) {
+		boolean_t logged;
+
+		error = ddt_object_walk(ddt, type, class, walk, dde);
+		if (error != 0)
+			return (error);
+
+		ddt_enter(ddt);
+		logged = (ddt_log_find(ddt, &dde->dde_key, NULL) != NULL);
+		ddt_exit(ddt);
+
+		if (!logged)
+			return (0);
+	}
+}
+
 int
 ddt_walk(spa_t *spa, ddt_bookmark_t *ddb, ddt_entry_t *dde)
 {
@@ -1165,22 +1856,29 @@ ddt_walk(spa_t *spa, ddt_bookmark_t *ddb, ddt_entry_t *dde)
 			do {
 				ddt_t *ddt = spa->spa_ddt[ddb->ddb_checksum];
 				int error = ENOENT;
-				if (ddt_object_exists(ddt, ddb->ddb_type,
-				    ddb->ddb_class)) {
-					error = ddt_object_walk(ddt,
+				if (ddb->ddb_type != DDB_TYPE_LOG) {
+					error = ddt_object_walk_unlogged(ddt,
 					    ddb->ddb_type, ddb->ddb_class,
 					    &ddb->ddb_cursor, dde);
+				} else if (spa_feature_is_active(spa,
+				    SPA_FEATURE_DDT_LOG)) {
+					error = ddt_log_walk(ddt,
+					    ddb->ddb_class, &ddb->ddb_cursor,
+					    dde);
 				}
-				dde->dde_type = ddb->ddb_type;
-				dde->dde_class = ddb->ddb_class;
-				if (error == 0)
+				if (error == 0) {
+					dde->dde_type = (ddb->ddb_type ==
+					    DDB_TYPE_LOG) ? DDT_TYPE_CURRENT :
+					    ddb->ddb_type;
+					dde->dde_class = ddb->ddb_class;
 					return (0);
+				}
 				if (error != ENOENT)
 					return (error);
 				ddb->ddb_cursor = 0;
 			} while (++ddb->ddb_checksum < ZIO_CHECKSUM_FUNCTIONS);
 			ddb->ddb_checksum = 0;
-		} while (++ddb->ddb_type < DDT_TYPES);
+		} while (++ddb->ddb_type < DDB_TYPES);
 		ddb->ddb_type = 0;
 	} while (++ddb->ddb_class < DDT_CLASSES);
 
@@ -1190,4 +1888,19 @@ ddt_walk(spa_t *spa, ddt_bookmark_t *ddb, ddt_entry_t *dde)
 #if defined(_KERNEL)
 ZFS_MODULE_PARAM(zfs, zfs_, dedup_prefetch, UINT, ZMOD_RW,
 	"Enable prefetching dedup-ed blks");
+
+ZFS_MODULE_PARAM(zfs, zfs_, dedup_log_flush_entries_min, UINT, ZMOD_RW,
+	"Min number of log entries to flush each transaction group");
+
+ZFS_MODULE_PARAM(zfs, zfs_, dedup_log_flush_txgs, UINT, ZMOD_RW,
+	"Number of transaction groups over which to flush the dedup log");
+
+ZFS_MODULE_PARAM(zfs, zfs_, dedup_log_txg_max, UINT, ZMOD_RW,
+	"Max transaction groups before the dedup log is flushed");
+
+ZFS_MODULE_PARAM(zfs, zfs_, dedup_log_mem_max, UQUAD, ZMOD_RW,
+	"Max memory used by the dedup log (0 = 1% of memory)");
+
+ZFS_MODULE_PARAM(zfs, zfs_, dedup_load_prefetch, UINT, ZMOD_RW,
+	"Prefetch the dedup table when importing a pool");
 #endif
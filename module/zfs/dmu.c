@@ -49,6 +49,8 @@
 #include <sys/sa.h>
 #include <sys/zfeature.h>
 #include <sys/abd.h>
+#include <sys/brt.h>
+#include <sys/vdev_impl.h>
 #ifdef __linux__
 #include <sys/trace_dmu.h>
 #endif
@@ -708,6 +710,45 @@ dmu_prefetch(objset_t *os, uint64_t object, int64_t level, uint64_t offset,
 	dnode_rele(dn, FTAG);
 }
 
+/*
+ * Returns B_TRUE if every level-0 block backing the given range has a cached
+ * dbuf, meaning that a read of the range can be satisfied without waiting on
+ * any I/O.  The answer is only a hint since the dbufs may be evicted as soon
+ * as this returns, so callers must still be prepared for the read to block.
+ */
+boolean_t
+dmu_dnode_range_cached(dnode_t *dn, uint64_t offset, uint64_t len)
+{
+	boolean_t cached = B_TRUE;
+	uint64_t start, end;
+
+	if (len == 0)
+		return (B_TRUE);
+
+	rw_enter(&dn->dn_struct_rwlock, RW_READER);
+	if (dn->dn_datablkshift != 0) {
+		start = dbuf_whichblock(dn, 0, offset);
+		end = dbuf_whichblock(dn, 0, offset + len - 1);
+	} else {
+		start = end = 0;
+	}
+
+	for (uint64_t blkid = start; blkid <= end && cached; blkid++) {
+		dmu_buf_impl_t *db = dbuf_find(dn->dn_objset, dn->dn_object,
+		    0, blkid);
+		if (db == NULL) {
+			cached = B_FALSE;
+			break;
+		}
+		/* dbuf_find() returns with db_mtx held */
+		cached = (db->db_state == DB_CACHED);
+		mutex_exit(&db->db_mtx);
+	}
+	rw_exit(&dn->dn_struct_rwlock);
+
+	return (cached);
+}
+
 /*
  * Get the next "chunk" of file data to free.  We traverse the file from
  * the end so that the file gets shorter over time (if we crashes in the
@@ -1162,6 +1203,147 @@ dmu_redact(objset_t *os, uint64_t object, uint64_t offset, uint64_t size,
 	dmu_buf_rele_array(dbp, numbufs, FTAG);
 }
 
+/*
+ * Return the level 0 block pointers of the given block aligned range, so
+ * that the blocks can be cloned with dmu_brt_clone().  Fails with EAGAIN
+ * if any of the blocks has changes which have not been synced yet, and
+ * with EOPNOTSUPP if any of the blocks can't be cloned.
+ */
+int
+dmu_read_l0_bps(objset_t *os, uint64_t object, uint64_t offset,
+    uint64_t length, blkptr_t *bps, size_t *nbpsp)
+{
+	spa_t *spa = dmu_objset_spa(os);
+	dmu_buf_t **dbp;
+	dnode_t *dn;
+	int numbufs, error = 0;
+
+	error = dnode_hold(os, object, FTAG, &dn);
+	if (error != 0)
+		return (error);
+
+	error = dmu_buf_hold_array_by_dnode(dn, offset, length, B_FALSE, FTAG,
+	    &numbufs, &dbp, DMU_READ_NO_PREFETCH);
+	if (error != 0) {
+		dnode_rele(dn, FTAG);
+		return (error);
+	}
+
+	spa_config_enter(spa, SCL_VDEV, FTAG, RW_READER);
+	for (int i = 0; i < numbufs && error == 0; i++) {
+		dmu_buf_impl_t *db = (dmu_buf_impl_t *)dbp[i];
+		blkptr_t *bp = &bps[i];
+
+		/*
+		 * The block pointer of a dirty or freed block is not known
+		 * until the txg has synced.
+		 */
+		mutex_enter(&db->db_mtx);
+		if (db->db_last_dirty != NULL ||
+		    dnode_block_freed(dn, db->db_blkid)) {
+			mutex_exit(&db->db_mtx);
+			error = SET_ERROR(EAGAIN);
+			break;
+		}
+		db_lock_type_t dblt = dmu_buf_lock_parent(db, RW_READER, FTAG);
+		if (db->db_blkptr != NULL)
+			*bp = *db->db_blkptr;
+		else
+			BP_ZERO(bp);
+		dmu_buf_unlock_parent(db, dblt, FTAG);
+		mutex_exit(&db->db_mtx);
+
+		if (BP_IS_HOLE(bp) || BP_IS_EMBEDDED(bp))
+			continue;
+
+		/*
+		 * Deduplicated blocks are already reference counted by the
+		 * DDT, and metadata and encrypted blocks are tied to the
+		 * object they belong to.
+		 */
+		if (BP_GET_DEDUP(bp) || BP_IS_METADATA(bp) ||
+		    BP_IS_PROTECTED(bp)) {
+			error = SET_ERROR(EOPNOTSUPP);
+			break;
+		}
+
+		/*
+		 * Blocks on a vdev which is being removed will be remapped,
+		 * which the BRT can't follow.
+		 */
+		for (int d = 0; d < BP_GET_NDVAS(bp); d++) {
+			vdev_t *vd = vdev_lookup_top(spa,
+			    DVA_GET_VDEV(&bp->blk_dva[d]));
+
+			if (vd == NULL || vd->vdev_removing ||
+			    vd->vdev_ops == &vdev_indirect_ops) {
+				error = SET_ERROR(EOPNOTSUPP);
+				break;
+			}
+		}
+	}
+	spa_config_exit(spa, SCL_VDEV, FTAG);
+
+	if (error == 0)
+		*nbpsp = numbufs;
+
+	dmu_buf_rele_array(dbp, numbufs, FTAG);
+	dnode_rele(dn, FTAG);
+
+	return (error);
+}
+
+/*
+ * Make the given block aligned range refer to the blocks returned by
+ * dmu_read_l0_bps(), and add the blocks to the BRT.  Fails with EAGAIN,
+ * without changing anything, if any of the blocks is dirty or in use.
+ */
+int
+dmu_brt_clone(objset_t *os, uint64_t object, uint64_t offset, uint64_t length,
+    dmu_tx_t *tx, const blkptr_t *bps, size_t nbps)
+{
+	spa_t *spa = dmu_objset_spa(os);
+	dmu_buf_t **dbp;
+	int numbufs, error = 0;
+
+	error = dmu_buf_hold_array(os, object, offset, length, B_FALSE, FTAG,
+	    &numbufs, &dbp);
+	if (error != 0)
+		return (error);
+
+	if (numbufs != nbps)
+		error = SET_ERROR(EINVAL);
+
+	for (int i = 0; i < numbufs && error == 0; i++) {
+		dmu_buf_impl_t *db = (dmu_buf_impl_t *)dbp[i];
+		const blkptr_t *bp = &bps[i];
+
+		if (!BP_IS_HOLE(bp) && BP_GET_LSIZE(bp) != db->db.db_size) {
+			error = SET_ERROR(EINVAL);
+			break;
+		}
+
+		mutex_enter(&db->db_mtx);
+		if (db->db_last_dirty != NULL ||
+		    zfs_refcount_count(&db->db_holds) > 1 ||
+		    db->db_state == DB_READ || db->db_state == DB_FILL)
+			error = SET_ERROR(EAGAIN);
+		mutex_exit(&db->db_mtx);
+	}
+
+	for (int i = 0; i < numbufs && error == 0; i++) {
+		const blkptr_t *bp = &bps[i];
+
+		dmu_buf_write_clone(dbp[i], bp, tx);
+		if (!BP_IS_HOLE(bp) && !BP_IS_EMBEDDED(bp))
+			brt_pending_add(spa, bp, tx);
+	}
+
+	dmu_buf_rele_array(dbp, numbufs, FTAG);
+
+	return (error);
+}
+
 /*
  * DMU support for xuio
  */
@@ -1790,6 +1972,18 @@ dmu_sync_late_arrival(zio_t *pio, objset_t *os, dmu_sync_cb_t *done, zgd_t *zgd,
 {
 	dmu_sync_arg_t *dsa;
 	dmu_tx_t *tx;
+	int err;
+
+	/*
+	 * The caller may hold the dbuf without having read it, so that
+	 * directly written blocks are not read back in the common case.
+	 */
+	if (zgd->zgd_db->db_data == NULL) {
+		err = dbuf_read((dmu_buf_impl_t *)zgd->zgd_db, NULL,
+		    DB_RF_CANFAIL | DB_RF_NOPREFETCH);
+		if (err != 0)
+			return (err);
+	}
 
 	tx = dmu_tx_create(os);
 	dmu_tx_hold_space(tx, zgd->zgd_db->db_size);
@@ -1938,6 +2132,19 @@ dmu_sync(zio_t *pio, uint64_t txg, dmu_sync_cb_t *done, zgd_t *zgd)
 
 	ASSERT(dr->dr_next == NULL || dr->dr_next->dr_txg < txg);
 
+	if (dr->dt.dl.dr_diowrite) {
+		/*
+		 * The block was written by dmu_write_direct_dbuf(), so its
+		 * bp is already known and there is nothing left to write.
+		 */
+		ASSERT3U(dr->dt.dl.dr_override_state, ==, DR_OVERRIDDEN);
+		*zgd->zgd_bp = dr->dt.dl.dr_overridden_by;
+		mutex_exit(&db->db_mtx);
+		zil_lwb_add_block(zgd->zgd_lwb, zgd->zgd_bp);
+		done(zgd, 0);
+		return (0);
+	}
+
 	if (db->db_blkptr != NULL) {
 		/*
 		 * We need to fill in zgd_bp with the current blkptr so that
@@ -2235,6 +2442,7 @@ dmu_write_policy(objset_t *os, dnode_t *dn, int level, int wp, zio_prop_t *zp)
 	zp->zp_dedup = dedup;
 	zp->zp_dedup_verify = dedup && dedup_verify;
 	zp->zp_nopwrite = nopwrite;
+	zp->zp_brtwrite = B_FALSE;
 	zp->zp_encrypt = encrypt;
 	zp->zp_byteorder = ZFS_HOST_BYTEORDER;
 	bzero(zp->zp_salt, ZIO_DATA_SALT_LEN);
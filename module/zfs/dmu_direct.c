@@ -0,0 +1,282 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/dmu.h>
+#include <sys/dmu_impl.h>
+#include <sys/dmu_objset.h>
+#include <sys/dbuf.h>
+#include <sys/dnode.h>
+#include <sys/spa.h>
+#include <sys/zio.h>
+#include <sys/zio_checksum.h>
+#include <sys/abd.h>
+
+/*
+ * Direct I/O
+ *
+ * A direct write hands the caller's buffer, usually the user's own pinned
+ * pages, to the zio pipeline without copying it into the ARC.  Checksum
+ * and compression are computed from the buffer in place.  The block is
+ * written in open context, as dmu_sync() does, and its bp then overrides
+ * the dbuf's dirty record, so the txg sync only has to update the indirect
+ * block.  Until then the dbuf is read back through that bp (see
+ * dbuf_read_bp()), and dmu_sync() hands it to the ZIL as is.
+ *
+ * A direct read copies blocks which are cached in a dbuf, and reads the
+ * others from disk into a private buffer, bypassing the ARC.  The block is
+ * only copied to the caller's buffer once its checksum was verified: the
+ * user may modify their pages while the read is in flight, which must not
+ * fail the checksum, or be written over a good copy by self-healing.
+ *
+ * Only whole level 0 blocks are read or written directly.  Both functions
+ * return EAGAIN when the request or the dataset does not allow it, and the
+ * caller falls back to buffered I/O.
+ */
+
+/*
+ * Verify the checksum of each directly written block which was stored
+ * uncompressed, and so was written straight from the caller's buffer.  The
+ * user may have modified the pages while the write was in flight.
+ */
+int zfs_direct_write_verify = 1;
+
+static void
+dmu_write_direct_ready(zio_t *zio)
+{
+	dmu_buf_t *db = zio->io_private;
+	blkptr_t *bp = zio->io_bp;
+
+	if (zio->io_error == 0) {
+		if (BP_IS_HOLE(bp)) {
+			/*
+			 * A block of zeros may compress to a hole, but the
+			 * block size still needs to be known for replay.
+			 */
+			BP_SET_LSIZE(bp, db->db_size);
+		} else if (!BP_IS_EMBEDDED(bp)) {
+			ASSERT(BP_GET_LEVEL(bp) == 0);
+			BP_SET_FILL(bp, 1);
+		}
+	}
+}
+
+/*
+ * Write the block at offset, which must be block aligned, directly from
+ * data, which must be exactly one block long.
+ */
+int
+dmu_write_direct_dbuf(dmu_buf_t *zdb, uint64_t offset, abd_t *data,
+    dmu_tx_t *tx)
+{
+	dmu_buf_impl_t *zdbp = (dmu_buf_impl_t *)zdb;
+	uint64_t txg = dmu_tx_get_txg(tx);
+	zbookmark_phys_t zb;
+	zio_prop_t zp;
+	dmu_buf_t *db;
+	objset_t *os;
+	dnode_t *dn;
+	blkptr_t bp;
+	int err;
+
+	DB_DNODE_ENTER(zdbp);
+	dn = DB_DNODE(zdbp);
+	os = dn->dn_objset;
+
+	/*
+	 * Encrypted blocks are encrypted from the ARC, and a dedup'd block
+	 * must be looked up in the DDT when the txg syncs, with its data.
+	 */
+	if (dn->dn_datablkshift == 0 || P2PHASE(offset, dn->dn_datablksz) ||
+	    data->abd_size != dn->dn_datablksz || os->os_encrypted ||
+	    os->os_dedup_checksum != ZIO_CHECKSUM_OFF) {
+		DB_DNODE_EXIT(zdbp);
+		return (SET_ERROR(EAGAIN));
+	}
+
+	err = dmu_buf_hold_noread_by_dnode(dn, offset, FTAG, &db);
+	if (err != 0) {
+		DB_DNODE_EXIT(zdbp);
+		return (err);
+	}
+
+	err = dmu_buf_will_write_direct(db, tx);
+	if (err != 0) {
+		dmu_buf_rele(db, FTAG);
+		DB_DNODE_EXIT(zdbp);
+		return (err);
+	}
+
+	dmu_write_policy(os, dn, 0, WP_DMU_SYNC, &zp);
+	zp.zp_nopwrite = B_FALSE;
+	SET_BOOKMARK(&zb, dmu_objset_id(os), dn->dn_object, 0,
+	    ((dmu_buf_impl_t *)db)->db_blkid);
+	BP_ZERO(&bp);
+
+	err = zio_wait(zio_write(NULL, os->os_spa, txg, &bp, data,
+	    db->db_size, db->db_size, &zp, dmu_write_direct_ready, NULL, NULL,
+	    NULL, db, ZIO_PRIORITY_SYNC_WRITE, ZIO_FLAG_CANFAIL, &zb));
+
+	if (err == 0 && zfs_direct_write_verify && !BP_IS_HOLE(&bp) &&
+	    !BP_IS_EMBEDDED(&bp) && !BP_IS_GANG(&bp) &&
+	    BP_GET_COMPRESS(&bp) == ZIO_COMPRESS_OFF &&
+	    BP_GET_CHECKSUM(&bp) != ZIO_CHECKSUM_OFF &&
+	    zio_checksum_error_impl(os->os_spa, &bp, BP_GET_CHECKSUM(&bp),
+	    data, BP_GET_PSIZE(&bp), 0, NULL) != 0) {
+		zio_free(os->os_spa, txg, &bp);
+		err = SET_ERROR(EIO);
+	}
+
+	dmu_buf_write_direct_done(db, &bp, zp.zp_copies, err, tx);
+	dmu_buf_rele(db, FTAG);
+	DB_DNODE_EXIT(zdbp);
+
+	return (err);
+}
+
+static void
+dmu_read_direct_done(zio_t *zio)
+{
+	abd_t *data = zio->io_private;
+
+	if (zio->io_error == 0)
+		abd_copy(data, zio->io_abd, zio->io_size);
+	abd_put(data);
+	abd_free(zio->io_abd);
+}
+
+/*
+ * Read the block at offset into data at off, either by copying its dbuf or
+ * by issuing a read under rio.
+ */
+static int
+dmu_read_direct_block(dnode_t *dn, zio_t *rio, uint64_t offset, abd_t *data,
+    uint64_t off)
+{
+	uint64_t blksz = dn->dn_datablksz;
+	dmu_buf_impl_t *db;
+	db_lock_type_t dblt;
+	zbookmark_phys_t zb;
+	blkptr_t *bpp, bp;
+	int err;
+
+	err = dmu_buf_hold_noread_by_dnode(dn, offset, FTAG,
+	    (dmu_buf_t **)&db);
+	if (err != 0)
+		return (err);
+
+	mutex_enter(&db->db_mtx);
+	while (db->db_state == DB_READ || db->db_state == DB_FILL)
+		cv_wait(&db->db_changed, &db->db_mtx);
+
+	if (db->db_state == DB_UNCACHED) {
+		dblt = dmu_buf_lock_parent(db, RW_READER, FTAG);
+		bpp = dbuf_read_bp(db);
+		if (bpp == NULL || BP_IS_HOLE(bpp) ||
+		    dnode_block_freed(dn, db->db_blkid)) {
+			dmu_buf_unlock_parent(db, dblt, FTAG);
+			mutex_exit(&db->db_mtx);
+			abd_zero_off(data, off, blksz);
+			dbuf_rele(db, FTAG);
+			return (0);
+		}
+
+		/*
+		 * Embedded, encrypted and redacted blocks are left to
+		 * dbuf_read() below.
+		 */
+		if (!BP_IS_EMBEDDED(bpp) && !BP_IS_PROTECTED(bpp) &&
+		    !BP_IS_REDACTED(bpp) && !dn->dn_objset->os_encrypted) {
+			bp = *bpp;
+			dmu_buf_unlock_parent(db, dblt, FTAG);
+			mutex_exit(&db->db_mtx);
+
+			SET_BOOKMARK(&zb, dmu_objset_id(dn->dn_objset),
+			    dn->dn_object, 0, db->db_blkid);
+			zio_nowait(zio_read(rio, dn->dn_objset->os_spa, &bp,
+			    abd_alloc_for_io(blksz, B_FALSE), blksz,
+			    dmu_read_direct_done,
+			    abd_get_offset_size(data, off, blksz),
+			    ZIO_PRIORITY_SYNC_READ, ZIO_FLAG_CANFAIL, &zb));
+			dbuf_rele(db, FTAG);
+			return (0);
+		}
+		dmu_buf_unlock_parent(db, dblt, FTAG);
+	}
+	mutex_exit(&db->db_mtx);
+
+	err = dbuf_read(db, NULL, DB_RF_CANFAIL | DB_RF_NOPREFETCH);
+	if (err == 0)
+		abd_copy_from_buf_off(data, db->db.db_data, off, blksz);
+	dbuf_rele(db, FTAG);
+
+	return (err);
+}
+
+/*
+ * Read size bytes at offset into data.  Both offset and size must be
+ * multiples of the block size.
+ */
+int
+dmu_read_direct_dbuf(dmu_buf_t *zdb, uint64_t offset, uint64_t size,
+    abd_t *data)
+{
+	dmu_buf_impl_t *zdbp = (dmu_buf_impl_t *)zdb;
+	uint64_t blksz, off;
+	dnode_t *dn;
+	zio_t *rio;
+	int err = 0;
+
+	DB_DNODE_ENTER(zdbp);
+	dn = DB_DNODE(zdbp);
+	blksz = dn->dn_datablksz;
+
+	if (dn->dn_datablkshift == 0 || P2PHASE(offset, blksz) ||
+	    P2PHASE(size, blksz) || size == 0 || data->abd_size < size) {
+		DB_DNODE_EXIT(zdbp);
+		return (SET_ERROR(EAGAIN));
+	}
+
+	rio = zio_root(dn->dn_objset->os_spa, NULL, NULL, ZIO_FLAG_CANFAIL);
+	for (off = 0; off < size && err == 0; off += blksz)
+		err = dmu_read_direct_block(dn, rio, offset + off, data, off);
+
+	/*
+	 * The root zio must be waited on even if issuing a read failed.
+	 */
+	if (err == 0)
+		err = zio_wait(rio);
+	else
+		(void) zio_wait(rio);
+	DB_DNODE_EXIT(zdbp);
+
+	return (err);
+}
+
+#if defined(_KERNEL)
+EXPORT_SYMBOL(dmu_write_direct_dbuf);
+EXPORT_SYMBOL(dmu_read_direct_dbuf);
+
+/* BEGIN CSTYLED */
+ZFS_MODULE_PARAM(zfs, zfs_, direct_write_verify, UINT, ZMOD_RW,
+	"Verify the checksum of uncompressed direct writes");
+/* END CSTYLED */
+#endif
@@ -77,6 +77,12 @@ krwlock_t os_lock;
  */
 int dmu_find_threads = 0;
 
+/*
+ * The number of milliseconds of writes a dataset's write_limit and
+ * write_ops_limit allow it to burst ahead of its configured rate.
+ */
+int zfs_write_limit_burst_ms = 100;
+
 /*
  * Backfill lower metadnode objects after this many have been freed.
  * Backfilling negatively impacts object creation rates, so only do it
@@ -273,6 +279,20 @@ sync_changed_cb(void *arg, uint64_t newval)
 		zil_set_sync(os->os_zil, newval);
 }
 
+static void
+direct_changed_cb(void *arg, uint64_t newval)
+{
+	objset_t *os = arg;
+
+	/*
+	 * Inheritance and range checking should have been done by now.
+	 */
+	ASSERT(newval == ZFS_DIRECT_DISABLED || newval == ZFS_DIRECT_STANDARD ||
+	    newval == ZFS_DIRECT_ALWAYS);
+
+	os->os_direct = newval;
+}
+
 static void
 redundant_metadata_changed_cb(void *arg, uint64_t newval)
 {
@@ -329,6 +349,28 @@ smallblk_changed_cb(void *arg, uint64_t newval)
 	os->os_zpl_special_smallblock = newval;
 }
 
+static void
+write_limit_changed_cb(void *arg, uint64_t newval)
+{
+	objset_t *os = arg;
+
+	mutex_enter(&os->os_throttle_lock);
+	os->os_write_limit = newval;
+	os->os_write_limit_tat = 0;
+	mutex_exit(&os->os_throttle_lock);
+}
+
+static void
+write_ops_limit_changed_cb(void *arg, uint64_t newval)
+{
+	objset_t *os = arg;
+
+	mutex_enter(&os->os_throttle_lock);
+	os->os_write_ops_limit = newval;
+	os->os_write_ops_limit_tat = 0;
+	mutex_exit(&os->os_throttle_lock);
+}
+
 static void
 logbias_changed_cb(void *arg, uint64_t newval)
 {
@@ -429,6 +471,7 @@ dmu_objset_open_impl(spa_t *spa, dsl_dataset_t *ds, blkptr_t *bp,
 	os->os_dsl_dataset = ds;
 	os->os_spa = spa;
 	os->os_rootbp = bp;
+	mutex_init(&os->os_throttle_lock, NULL, MUTEX_DEFAULT, NULL);
 	if (!BP_IS_HOLE(os->os_rootbp)) {
 		arc_flags_t aflags = ARC_FLAG_WAIT;
 		zbookmark_phys_t zb;
@@ -525,6 +568,11 @@ dmu_objset_open_impl(spa_t *spa, dsl_dataset_t *ds, blkptr_t *bp,
 			    zfs_prop_to_name(ZFS_PROP_SECONDARYCACHE),
 			    secondary_cache_changed_cb, os);
 		}
+		if (err == 0) {
+			err = dsl_prop_register(ds,
+			    zfs_prop_to_name(ZFS_PROP_DIRECT),
+			    direct_changed_cb, os);
+		}
 		if (!ds->ds_is_snapshot) {
 			if (err == 0) {
 				err = dsl_prop_register(ds,
@@ -578,11 +626,22 @@ dmu_objset_open_impl(spa_t *spa, dsl_dataset_t *ds, blkptr_t *bp,
 				    ZFS_PROP_SPECIAL_SMALL_BLOCKS),
 				    smallblk_changed_cb, os);
 			}
+			if (err == 0) {
+				err = dsl_prop_register(ds,
+				    zfs_prop_to_name(ZFS_PROP_WRITE_LIMIT),
+				    write_limit_changed_cb, os);
+			}
+			if (err == 0) {
+				err = dsl_prop_register(ds,
+				    zfs_prop_to_name(ZFS_PROP_WRITE_OPS_LIMIT),
+				    write_ops_limit_changed_cb, os);
+			}
 		}
 		if (needlock)
 			dsl_pool_config_exit(dmu_objset_pool(os), FTAG);
 		if (err != 0) {
 			arc_buf_destroy(os->os_phys_buf, &os->os_phys_buf);
+			mutex_destroy(&os->os_throttle_lock);
 			kmem_free(os, sizeof (objset_t));
 			return (err);
 		}
@@ -596,6 +655,7 @@ dmu_objset_open_impl(spa_t *spa, dsl_dataset_t *ds, blkptr_t *bp,
 		os->os_dedup_verify = B_FALSE;
 		os->os_logbias = ZFS_LOGBIAS_LATENCY;
 		os->os_sync = ZFS_SYNC_STANDARD;
+		os->os_direct = ZFS_DIRECT_DISABLED;
 		os->os_primary_cache = ZFS_CACHE_ALL;
 		os->os_secondary_cache = ZFS_CACHE_ALL;
 		os->os_dnodesize = DNODE_MIN_SIZE;
@@ -989,6 +1049,7 @@ dmu_objset_evict_done(objset_t *os)
 	mutex_destroy(&os->os_obj_lock);
 	mutex_destroy(&os->os_user_ptr_lock);
 	mutex_destroy(&os->os_upgrade_lock);
+	mutex_destroy(&os->os_throttle_lock);
 	for (int i = 0; i < TXG_SIZE; i++) {
 		multilist_destroy(os->os_dirty_dnodes[i]);
 	}
@@ -2897,6 +2958,56 @@ dmu_objset_get_user(objset_t *os)
 	return (os->os_user_ptr);
 }
 
+/*
+ * Set the dataset kstats which the DMU updates on behalf of the objset's
+ * user, e.g. when a transaction is delayed by the dataset's write limits.
+ */
+void
+dmu_objset_set_kstats(objset_t *os, struct dataset_kstats *dk)
+{
+	ASSERT(MUTEX_HELD(&os->os_user_ptr_lock));
+	os->os_dataset_kstats = dk;
+}
+
+/*
+ * Charge a transaction writing the given number of bytes against the
+ * dataset's write_limit and write_ops_limit, and return the time at which
+ * the limits permit it to be assigned, or 0 if it need not wait.
+ *
+ * Each limit is enforced with the generic cell rate algorithm, a token
+ * bucket expressed as the theoretical arrival time (TAT) of the next
+ * transaction.  A transaction advances the TAT by the time its cost takes
+ * at the limited rate, and must wait until the TAT it observed is no more
+ * than zfs_write_limit_burst_ms in the future.  Charging at admission
+ * means concurrent writers queue behind each other in order rather than
+ * racing for the same tokens.
+ */
+hrtime_t
+dmu_objset_throttle(objset_t *os, uint64_t bytes)
+{
+	hrtime_t burst = MSEC2NSEC(zfs_write_limit_burst_ms);
+	hrtime_t now, tat, wakeup = 0;
+	uint64_t limit;
+
+	now = gethrtime();
+
+	mutex_enter(&os->os_throttle_lock);
+	if ((limit = os->os_write_limit) != 0) {
+		tat = MAX(os->os_write_limit_tat, now);
+		wakeup = MAX(wakeup, tat - burst);
+		os->os_write_limit_tat = tat + (bytes / limit) * NANOSEC +
+		    (bytes % limit) * NANOSEC / limit;
+	}
+	if ((limit = os->os_write_ops_limit) != 0) {
+		tat = MAX(os->os_write_ops_limit_tat, now);
+		wakeup = MAX(wakeup, tat - burst);
+		os->os_write_ops_limit_tat = tat + NANOSEC / limit;
+	}
+	mutex_exit(&os->os_throttle_lock);
+
+	return (wakeup > now ? wakeup : 0);
+}
+
 /*
  * Determine name of filesystem, given name of snapshot.
  * buf must be at least ZFS_MAX_DATASET_NAME_LEN bytes
@@ -2975,4 +3086,7 @@ EXPORT_SYMBOL(dmu_objset_projectquota_enabled);
 EXPORT_SYMBOL(dmu_objset_projectquota_present);
 EXPORT_SYMBOL(dmu_objset_projectquota_upgradable);
 EXPORT_SYMBOL(dmu_objset_id_quota_upgrade);
+
+ZFS_MODULE_PARAM(zfs, zfs_, write_limit_burst_ms, UINT, ZMOD_RW,
+	"Milliseconds of writes a dataset's write limits allow as a burst");
 #endif
@@ -65,6 +65,20 @@
 int zfs_recv_queue_length = SPA_MAXBLOCKSIZE;
 int zfs_recv_queue_ff = 20;
 
+/*
+ * Number of threads committing the records of a single receive.  Records
+ * which only touch one object are sharded across them by dnode block; see
+ * receive_dispatch_record().  1 or less commits every record from the
+ * single receive_writer_thread.
+ */
+int zfs_recv_writer_threads = 4;
+
+/*
+ * Limit in bytes on the run of DRR_WRITE records to the same object that
+ * a writer thread commits in a single tx.
+ */
+int zfs_recv_write_batch_size = 1024 * 1024;
+
 static char *dmu_recv_tag = "dmu_recv_tag";
 const char *recv_clone_name = "%recv";
 
@@ -83,8 +97,37 @@ struct receive_record_arg {
 	uint64_t bytes_read; /* bytes read from stream when record created */
 	boolean_t eos_marker; /* Marks the end of the stream */
 	bqueue_node_t node;
+	list_node_t writer_node; /* on a receive_writer_t's rw_records */
+	/* Set while a writer thread owns the record of a resumable receive */
+	struct receive_inflight *inflight;
 };
 
+/*
+ * A record of a resumable receive handed to a writer thread.  These are
+ * kept in stream order, and the resume state is only advanced past
+ * records which are known to be committed in the txg it is saved in.
+ */
+typedef struct receive_inflight {
+	list_node_t ri_node;
+	uint64_t ri_bytes_read;
+	uint64_t ri_txg; /* last txg the record may be committed in, or 0 */
+	boolean_t ri_resume; /* ri_object and ri_offset are a resume point */
+	uint64_t ri_object;
+	uint64_t ri_offset;
+} receive_inflight_t;
+
+typedef struct receive_writer {
+	struct receive_writer_arg *rw_rwa;
+	int rw_id;
+	list_t rw_records; /* records sharded to this thread, in order */
+	kcondvar_t rw_cv;
+	boolean_t rw_exit;
+	boolean_t rw_exited;
+	uint64_t rw_nrecords;
+	uint64_t rw_nbytes;
+	hrtime_t rw_busy; /* time spent committing records */
+} receive_writer_t;
+
 struct receive_writer_arg {
 	objset_t *os;
 	boolean_t byteswap;
@@ -117,6 +160,16 @@ struct receive_writer_arg {
 	uint8_t or_iv[ZIO_DATA_IV_LEN];
 	uint8_t or_mac[ZIO_DATA_MAC_LEN];
 	boolean_t or_byteorder;
+
+	/* Writer threads; none if every record is committed in order */
+	int num_writers;
+	receive_writer_t *writers;
+	kmutex_t writer_lock; /* protects writers and the fields below */
+	kcondvar_t writer_cv;
+	uint64_t writer_pending; /* records owned by writer threads */
+	uint64_t writer_bytes; /* bytes of those records */
+	list_t inflight; /* receive_inflight_t, in stream order */
+	uint64_t retired_txg; /* highest txg which retired inflight records */
 };
 
 typedef struct guid_map_entry {
@@ -508,14 +561,18 @@ recv_begin_check_feature_flags_impl(uint64_t featureflags, spa_t *spa)
 		return (SET_ERROR(ENOTSUP));
 
 	/*
-	 * LZ4 compressed, embedded, mooched, large blocks, and large_dnodes
-	 * in the stream can only be used if those pool features are enabled
-	 * because we don't attempt to decompress / un-embed / un-mooch /
-	 * split up the blocks / dnodes during the receive process.
+	 * LZ4 compressed, ZSTD compressed, embedded, mooched, large blocks,
+	 * and large_dnodes in the stream can only be used if those pool
+	 * features are enabled because we don't attempt to decompress /
+	 * un-embed / un-mooch / split up the blocks / dnodes during the
+	 * receive process.
 	 */
 	if ((featureflags & DMU_BACKUP_FEATURE_LZ4) &&
 	    !spa_feature_is_enabled(spa, SPA_FEATURE_LZ4_COMPRESS))
 		return (SET_ERROR(ENOTSUP));
+	if ((featureflags & DMU_BACKUP_FEATURE_ZSTD) &&
+	    !spa_feature_is_enabled(spa, SPA_FEATURE_ZSTD_COMPRESS))
+		return (SET_ERROR(ENOTSUP));
 	if ((featureflags & DMU_BACKUP_FEATURE_EMBED_DATA) &&
 	    !spa_feature_is_enabled(spa, SPA_FEATURE_EMBEDDED_DATA))
 		return (SET_ERROR(ENOTSUP));
@@ -1320,8 +1377,8 @@ deduce_nblkptr(dmu_object_type_t bonus_type, uint64_t bonus_size)
 }
 
 static void
-save_resume_state(struct receive_writer_arg *rwa,
-    uint64_t object, uint64_t offset, dmu_tx_t *tx)
+save_resume_state_impl(struct receive_writer_arg *rwa,
+    uint64_t object, uint64_t offset, uint64_t bytes_read, dmu_tx_t *tx)
 {
 	int txgoff = dmu_tx_get_txg(tx) & TXG_MASK;
 
@@ -1332,7 +1389,7 @@ save_resume_state(struct receive_writer_arg *rwa,
 	 * We use ds_resume_bytes[] != 0 to indicate that we need to
 	 * update this on disk, so it must not be 0.
 	 */
-	ASSERT(rwa->bytes_read != 0);
+	ASSERT(bytes_read != 0);
 
 	/*
 	 * We only resume from write records, which have a valid
@@ -1348,12 +1405,83 @@ save_resume_state(struct receive_writer_arg *rwa,
 	ASSERT3U(object, >=, rwa->os->os_dsl_dataset->ds_resume_object[txgoff]);
 	ASSERT(object != rwa->os->os_dsl_dataset->ds_resume_object[txgoff] ||
 	    offset >= rwa->os->os_dsl_dataset->ds_resume_offset[txgoff]);
-	ASSERT3U(rwa->bytes_read, >=,
+	ASSERT3U(bytes_read, >=,
 	    rwa->os->os_dsl_dataset->ds_resume_bytes[txgoff]);
 
 	rwa->os->os_dsl_dataset->ds_resume_object[txgoff] = object;
 	rwa->os->os_dsl_dataset->ds_resume_offset[txgoff] = offset;
-	rwa->os->os_dsl_dataset->ds_resume_bytes[txgoff] = rwa->bytes_read;
+	rwa->os->os_dsl_dataset->ds_resume_bytes[txgoff] = bytes_read;
+}
+
+/*
+ * Mark a record owned by a writer thread as committed in txg or earlier.
+ * If tx is non-NULL, retire the records at the head of the stream which
+ * are all committed in tx's txg or earlier, and advance the resume state
+ * past them.
+ *
+ * Records may have been retired by a tx in a later txg than tx's, which
+ * was assigned first.  The resume state of tx's txg would then cover
+ * records which are not committed until that later txg, so it is only
+ * saved if no later txg has retired any records.
+ */
+static void
+receive_inflight_done(struct receive_writer_arg *rwa, receive_inflight_t *ri,
+    uint64_t txg, dmu_tx_t *tx)
+{
+	receive_inflight_t *last = NULL;
+
+	mutex_enter(&rwa->writer_lock);
+	ri->ri_txg = txg;
+	while (tx != NULL && (ri = list_head(&rwa->inflight)) != NULL &&
+	    ri->ri_txg != 0 && ri->ri_txg <= txg) {
+		list_remove(&rwa->inflight, ri);
+		rwa->retired_txg = MAX(rwa->retired_txg, txg);
+		if (!ri->ri_resume) {
+			kmem_free(ri, sizeof (*ri));
+			continue;
+		}
+		if (last != NULL)
+			kmem_free(last, sizeof (*last));
+		last = ri;
+	}
+	if (last != NULL) {
+		if (txg >= rwa->retired_txg) {
+			save_resume_state_impl(rwa, last->ri_object,
+			    last->ri_offset, last->ri_bytes_read, tx);
+		}
+		kmem_free(last, sizeof (*last));
+	}
+	mutex_exit(&rwa->writer_lock);
+}
+
+static void
+save_resume_state(struct receive_writer_arg *rwa,
+    struct receive_record_arg *rrd, uint64_t object, uint64_t offset,
+    dmu_tx_t *tx)
+{
+	receive_inflight_t *ri = rrd->inflight;
+
+	if (ri == NULL) {
+		/*
+		 * A record committed by this thread follows every record
+		 * handed to the writer threads, so it may only move the
+		 * resume state once all of them have been retired.
+		 */
+		mutex_enter(&rwa->writer_lock);
+		if (list_is_empty(&rwa->inflight) &&
+		    dmu_tx_get_txg(tx) >= rwa->retired_txg) {
+			save_resume_state_impl(rwa, object, offset,
+			    rrd->bytes_read, tx);
+		}
+		mutex_exit(&rwa->writer_lock);
+		return;
+	}
+
+	rrd->inflight = NULL;
+	ri->ri_resume = B_TRUE;
+	ri->ri_object = object;
+	ri->ri_offset = offset;
+	receive_inflight_done(rwa, ri, dmu_tx_get_txg(tx), tx);
 }
 
 noinline static int
@@ -1417,9 +1545,6 @@ receive_object(struct receive_writer_arg *rwa, struct drr_object *drro,
 	if (err != 0 && err != ENOENT && err != EEXIST)
 		return (SET_ERROR(EINVAL));
 
-	if (drro->drr_object > rwa->max_object)
-		rwa->max_object = drro->drr_object;
-
 	/*
 	 * If we are losing blkptrs or changing the block size this must
 	 * be a new file instance.  We must clear out the previous file
@@ -1726,35 +1851,48 @@ receive_freeobjects(struct receive_writer_arg *rwa,
 	return (0);
 }
 
-noinline static int
-receive_write(struct receive_writer_arg *rwa, struct drr_write *drrw,
-    arc_buf_t *abuf)
+static int
+receive_write_check(struct receive_writer_arg *rwa, struct drr_write *drrw)
 {
-	int err;
-	dmu_tx_t *tx;
-	dnode_t *dn;
-
 	if (drrw->drr_offset + drrw->drr_logical_size < drrw->drr_offset ||
 	    !DMU_OT_IS_VALID(drrw->drr_type))
 		return (SET_ERROR(EINVAL));
 
-	/*
-	 * For resuming to work, records must be in increasing order
-	 * by (object, offset).
-	 */
-	if (drrw->drr_object < rwa->last_object ||
-	    (drrw->drr_object == rwa->last_object &&
-	    drrw->drr_offset < rwa->last_offset)) {
+	if (dmu_object_info(rwa->os, drrw->drr_object, NULL) != 0)
 		return (SET_ERROR(EINVAL));
+
+	return (0);
+}
+
+/*
+ * Assign the record's payload to the object.  On success, the arc_buf is
+ * consumed.
+ */
+static int
+receive_write_impl(struct receive_writer_arg *rwa, struct drr_write *drrw,
+    arc_buf_t *abuf, dnode_t *dn, dmu_tx_t *tx)
+{
+	if (rwa->byteswap && !arc_is_encrypted(abuf) &&
+	    arc_get_compression(abuf) == ZIO_COMPRESS_OFF) {
+		dmu_object_byteswap_t byteswap =
+		    DMU_OT_BYTESWAP(drrw->drr_type);
+		dmu_ot_byteswap[byteswap].ob_func(abuf->b_data,
+		    DRR_WRITE_PAYLOAD_SIZE(drrw));
 	}
-	rwa->last_object = drrw->drr_object;
-	rwa->last_offset = drrw->drr_offset;
 
-	if (rwa->last_object > rwa->max_object)
-		rwa->max_object = rwa->last_object;
+	return (dmu_assign_arcbuf_by_dnode(dn, drrw->drr_offset, abuf, tx));
+}
 
-	if (dmu_object_info(rwa->os, drrw->drr_object, NULL) != 0)
-		return (SET_ERROR(EINVAL));
+noinline static int
+receive_write(struct receive_writer_arg *rwa, struct receive_record_arg *rrd)
+{
+	struct drr_write *drrw = &rrd->header.drr_u.drr_write;
+	int err;
+	dmu_tx_t *tx;
+	dnode_t *dn;
+
+	if ((err = receive_write_check(rwa, drrw)) != 0)
+		return (err);
 
 	tx = dmu_tx_create(rwa->os);
 	dmu_tx_hold_write(tx, drrw->drr_object,
@@ -1765,17 +1903,9 @@ receive_write(struct receive_writer_arg *rwa, struct drr_write *drrw,
 		return (err);
 	}
 
-	if (rwa->byteswap && !arc_is_encrypted(abuf) &&
-	    arc_get_compression(abuf) == ZIO_COMPRESS_OFF) {
-		dmu_object_byteswap_t byteswap =
-		    DMU_OT_BYTESWAP(drrw->drr_type);
-		dmu_ot_byteswap[byteswap].ob_func(abuf->b_data,
-		    DRR_WRITE_PAYLOAD_SIZE(drrw));
-	}
-
 	/* use the bonus buf to look up the dnode in dmu_assign_arcbuf */
 	VERIFY0(dnode_hold(rwa->os, drrw->drr_object, FTAG, &dn));
-	err = dmu_assign_arcbuf_by_dnode(dn, drrw->drr_offset, abuf, tx);
+	err = receive_write_impl(rwa, drrw, rrd->arc_buf, dn, tx);
 	if (err != 0) {
 		dnode_rele(dn, FTAG);
 		dmu_tx_commit(tx);
@@ -1789,12 +1919,77 @@ receive_write(struct receive_writer_arg *rwa, struct drr_write *drrw,
 	 * to the next record), so that we can verify that we are
 	 * resuming from the correct location.
 	 */
-	save_resume_state(rwa, drrw->drr_object, drrw->drr_offset, tx);
+	save_resume_state(rwa, rrd, drrw->drr_object, drrw->drr_offset, tx);
 	dmu_tx_commit(tx);
 
 	return (0);
 }
 
+/*
+ * Commit a run of DRR_WRITE records to the same object, gathered by a
+ * writer thread, in a single tx.  The arc_bufs of the records are consumed
+ * or returned.
+ */
+static int
+receive_write_batch(struct receive_writer_arg *rwa, list_t *batch)
+{
+	struct receive_record_arg *rrd;
+	uint64_t object;
+	dmu_tx_t *tx;
+	dnode_t *dn;
+	int err = 0;
+
+	rrd = list_head(batch);
+	object = rrd->header.drr_u.drr_write.drr_object;
+
+	tx = dmu_tx_create(rwa->os);
+	for (; rrd != NULL; rrd = list_next(batch, rrd)) {
+		struct drr_write *drrw = &rrd->header.drr_u.drr_write;
+
+		ASSERT3U(drrw->drr_object, ==, object);
+		if ((err = receive_write_check(rwa, drrw)) != 0) {
+			dmu_tx_abort(tx);
+			goto out;
+		}
+		dmu_tx_hold_write(tx, object,
+		    drrw->drr_offset, drrw->drr_logical_size);
+	}
+	err = dmu_tx_assign(tx, TXG_WAIT);
+	if (err != 0) {
+		dmu_tx_abort(tx);
+		goto out;
+	}
+
+	VERIFY0(dnode_hold(rwa->os, object, FTAG, &dn));
+	for (rrd = list_head(batch); rrd != NULL; rrd = list_next(batch, rrd)) {
+		err = receive_write_impl(rwa, &rrd->header.drr_u.drr_write,
+		    rrd->arc_buf, dn, tx);
+		if (err != 0)
+			break;
+		rrd->arc_buf = NULL;
+	}
+	dnode_rele(dn, FTAG);
+
+	if (err == 0) {
+		/* See comment in receive_write. */
+		for (rrd = list_head(batch); rrd != NULL;
+		    rrd = list_next(batch, rrd)) {
+			save_resume_state(rwa, rrd, object,
+			    rrd->header.drr_u.drr_write.drr_offset, tx);
+		}
+	}
+	dmu_tx_commit(tx);
+
+out:
+	for (rrd = list_head(batch); rrd != NULL; rrd = list_next(batch, rrd)) {
+		if (rrd->arc_buf != NULL)
+			dmu_return_arcbuf(rrd->arc_buf);
+		rrd->arc_buf = NULL;
+		rrd->payload = NULL;
+	}
+	return (err);
+}
+
 /*
  * Handle a DRR_WRITE_BYREF record.  This record is used in dedup'ed
  * streams to refer to a copy of the data that is already on the
@@ -1804,8 +1999,9 @@ receive_write(struct receive_writer_arg *rwa, struct drr_write *drrw,
  */
 noinline static int
 receive_write_byref(struct receive_writer_arg *rwa,
-    struct drr_write_byref *drrwbr)
+    struct receive_record_arg *rrd)
 {
+	struct drr_write_byref *drrwbr = &rrd->header.drr_u.drr_write_byref;
 	dmu_tx_t *tx;
 	int err;
 	guid_map_entry_t gmesrch;
@@ -1834,9 +2030,6 @@ receive_write_byref(struct receive_writer_arg *rwa,
 		ref_os = rwa->os;
 	}
 
-	if (drrwbr->drr_object > rwa->max_object)
-		rwa->max_object = drrwbr->drr_object;
-
 	if (rwa->raw)
 		flags |= DMU_READ_NO_DECRYPT;
 
@@ -1865,16 +2058,18 @@ receive_write_byref(struct receive_writer_arg *rwa,
 	}
 	dmu_buf_rele(dbp, FTAG);
 
-	/* See comment in restore_write. */
-	save_resume_state(rwa, drrwbr->drr_object, drrwbr->drr_offset, tx);
+	/* See comment in receive_write. */
+	save_resume_state(rwa, rrd, drrwbr->drr_object, drrwbr->drr_offset, tx);
 	dmu_tx_commit(tx);
 	return (0);
 }
 
 static int
 receive_write_embedded(struct receive_writer_arg *rwa,
-    struct drr_write_embedded *drrwe, void *data)
+    struct receive_record_arg *rrd)
 {
+	struct drr_write_embedded *drrwe =
+	    &rrd->header.drr_u.drr_write_embedded;
 	dmu_tx_t *tx;
 	int err;
 
@@ -1891,9 +2086,6 @@ receive_write_embedded(struct receive_writer_arg *rwa,
 	if (rwa->raw)
 		return (SET_ERROR(EINVAL));
 
-	if (drrwe->drr_object > rwa->max_object)
-		rwa->max_object = drrwe->drr_object;
-
 	tx = dmu_tx_create(rwa->os);
 
 	dmu_tx_hold_write(tx, drrwe->drr_object,
@@ -1905,12 +2097,12 @@ receive_write_embedded(struct receive_writer_arg *rwa,
 	}
 
 	dmu_write_embedded(rwa->os, drrwe->drr_object,
-	    drrwe->drr_offset, data, drrwe->drr_etype,
+	    drrwe->drr_offset, rrd->payload, drrwe->drr_etype,
 	    drrwe->drr_compression, drrwe->drr_lsize, drrwe->drr_psize,
 	    rwa->byteswap ^ ZFS_HOST_BYTEORDER, tx);
 
-	/* See comment in restore_write. */
-	save_resume_state(rwa, drrwe->drr_object, drrwe->drr_offset, tx);
+	/* See comment in receive_write. */
+	save_resume_state(rwa, rrd, drrwe->drr_object, drrwe->drr_offset, tx);
 	dmu_tx_commit(tx);
 	return (0);
 }
@@ -1948,9 +2140,6 @@ receive_spill(struct receive_writer_arg *rwa, struct drr_spill *drrs,
 	if (dmu_object_info(rwa->os, drrs->drr_object, NULL) != 0)
 		return (SET_ERROR(EINVAL));
 
-	if (drrs->drr_object > rwa->max_object)
-		rwa->max_object = drrs->drr_object;
-
 	VERIFY0(dmu_bonus_hold(rwa->os, drrs->drr_object, FTAG, &db));
 	if ((err = dmu_spill_hold_by_bonus(db, DMU_READ_NO_DECRYPT, FTAG,
 	    &db_spill)) != 0) {
@@ -2011,9 +2200,6 @@ receive_free(struct receive_writer_arg *rwa, struct drr_free *drrf)
 	if (dmu_object_info(rwa->os, drrf->drr_object, NULL) != 0)
 		return (SET_ERROR(EINVAL));
 
-	if (drrf->drr_object > rwa->max_object)
-		rwa->max_object = drrf->drr_object;
-
 	err = dmu_free_long_range(rwa->os, drrf->drr_object,
 	    drrf->drr_offset, drrf->drr_length);
 
@@ -2050,9 +2236,6 @@ receive_object_range(struct receive_writer_arg *rwa,
 	    !rwa->raw)
 		return (SET_ERROR(EINVAL));
 
-	if (drror->drr_firstobj > rwa->max_object)
-		rwa->max_object = drror->drr_firstobj;
-
 	/*
 	 * The DRR_OBJECT_RANGE handling must be deferred to receive_object()
 	 * so that the block of dnodes is not written out when it's empty,
@@ -2506,10 +2689,6 @@ receive_process_record(struct receive_writer_arg *rwa,
 {
 	int err;
 
-	/* Processing in order, therefore bytes_read should be increasing. */
-	ASSERT3U(rrd->bytes_read, >=, rwa->bytes_read);
-	rwa->bytes_read = rrd->bytes_read;
-
 	switch (rrd->header.drr_type) {
 	case DRR_OBJECT:
 	{
@@ -2528,8 +2707,7 @@ receive_process_record(struct receive_writer_arg *rwa,
 	}
 	case DRR_WRITE:
 	{
-		struct drr_write *drrw = &rrd->header.drr_u.drr_write;
-		err = receive_write(rwa, drrw, rrd->arc_buf);
+		err = receive_write(rwa, rrd);
 		/* if receive_write() is successful, it consumes the arc_buf */
 		if (err != 0)
 			dmu_return_arcbuf(rrd->arc_buf);
@@ -2539,16 +2717,12 @@ receive_process_record(struct receive_writer_arg *rwa,
 	}
 	case DRR_WRITE_BYREF:
 	{
-		struct drr_write_byref *drrwbr =
-		    &rrd->header.drr_u.drr_write_byref;
-		err = receive_write_byref(rwa, drrwbr);
+		err = receive_write_byref(rwa, rrd);
 		break;
 	}
 	case DRR_WRITE_EMBEDDED:
 	{
-		struct drr_write_embedded *drrwe =
-		    &rrd->header.drr_u.drr_write_embedded;
-		err = receive_write_embedded(rwa, drrwe, rrd->payload);
+		err = receive_write_embedded(rwa, rrd);
 		kmem_free(rrd->payload, rrd->payload_size);
 		rrd->payload = NULL;
 		break;
@@ -2593,8 +2767,394 @@ receive_process_record(struct receive_writer_arg *rwa,
 }
 
 /*
- * dmu_recv_stream's worker thread; pull records off the queue, and then call
- * receive_process_record  When we're done, signal the main thread and exit.
+ * Free a record which will not be processed, along with its payload.
+ */
+static void
+receive_free_record(struct receive_record_arg *rrd)
+{
+	if (rrd->arc_buf != NULL) {
+		dmu_return_arcbuf(rrd->arc_buf);
+		rrd->arc_buf = NULL;
+		rrd->payload = NULL;
+	} else if (rrd->payload != NULL) {
+		kmem_free(rrd->payload, rrd->payload_size);
+		rrd->payload = NULL;
+	}
+	kmem_free(rrd, sizeof (*rrd));
+}
+
+static void
+receive_set_error(struct receive_writer_arg *rwa, int err)
+{
+	mutex_enter(&rwa->writer_lock);
+	if (rwa->err == 0)
+		rwa->err = err;
+	mutex_exit(&rwa->writer_lock);
+}
+
+/*
+ * Return the object a record refers to, if any.  If the record only
+ * modifies that object, return B_TRUE in *shardp: it can be committed
+ * by a writer thread, concurrently with records for other objects.
+ */
+static boolean_t
+receive_record_object(struct receive_record_arg *rrd, uint64_t *objp,
+    boolean_t *shardp)
+{
+	*shardp = B_TRUE;
+
+	switch (rrd->header.drr_type) {
+	case DRR_OBJECT:
+		*objp = rrd->header.drr_u.drr_object.drr_object;
+		return (B_TRUE);
+	case DRR_WRITE:
+		*objp = rrd->header.drr_u.drr_write.drr_object;
+		return (B_TRUE);
+	case DRR_WRITE_EMBEDDED:
+		*objp = rrd->header.drr_u.drr_write_embedded.drr_object;
+		return (B_TRUE);
+	case DRR_SPILL:
+		*objp = rrd->header.drr_u.drr_spill.drr_object;
+		return (B_TRUE);
+	case DRR_FREE:
+		*objp = rrd->header.drr_u.drr_free.drr_object;
+		return (B_TRUE);
+	case DRR_REDACT:
+		*objp = rrd->header.drr_u.drr_redact.drr_object;
+		return (B_TRUE);
+	case DRR_WRITE_BYREF:
+		/* may read data written earlier by another writer thread */
+		*shardp = B_FALSE;
+		*objp = rrd->header.drr_u.drr_write_byref.drr_object;
+		return (B_TRUE);
+	case DRR_OBJECT_RANGE:
+		/* sets up the encryption parameters of later records */
+		*shardp = B_FALSE;
+		*objp = rrd->header.drr_u.drr_object_range.drr_firstobj;
+		return (B_TRUE);
+	default:
+		*shardp = B_FALSE;
+		return (B_FALSE);
+	}
+}
+
+/*
+ * Pull the next records to commit off a writer thread's queue: either a
+ * single record, or a run of DRR_WRITE records to the same object which
+ * will be committed in one tx.
+ */
+static void
+receive_writer_gather(receive_writer_t *rw, list_t *batch)
+{
+	struct receive_record_arg *rrd = list_remove_head(&rw->rw_records);
+	uint64_t object = rrd->header.drr_u.drr_write.drr_object;
+	uint64_t size = rrd->payload_size;
+
+	list_insert_tail(batch, rrd);
+	if (rrd->header.drr_type != DRR_WRITE)
+		return;
+
+	while ((rrd = list_head(&rw->rw_records)) != NULL &&
+	    rrd->header.drr_type == DRR_WRITE &&
+	    rrd->header.drr_u.drr_write.drr_object == object &&
+	    size + rrd->payload_size <= zfs_recv_write_batch_size) {
+		size += rrd->payload_size;
+		list_remove(&rw->rw_records, rrd);
+		list_insert_tail(batch, rrd);
+	}
+}
+
+static int
+receive_writer_process(struct receive_writer_arg *rwa, list_t *batch)
+{
+	struct receive_record_arg *rrd = list_head(batch);
+	dsl_pool_t *dp = dmu_objset_pool(rwa->os);
+	int err;
+
+	if (rrd->header.drr_type == DRR_WRITE) {
+		err = receive_write_batch(rwa, batch);
+	} else {
+		ASSERT3P(list_next(batch, rrd), ==, NULL);
+		err = receive_process_record(rwa, rrd);
+	}
+
+	/*
+	 * Records which did not save a resume state were committed in the
+	 * open txg or earlier.
+	 */
+	while ((rrd = list_remove_head(batch)) != NULL) {
+		if (err == 0 && rrd->inflight != NULL) {
+			receive_inflight_done(rwa, rrd->inflight,
+			    dp->dp_tx.tx_open_txg, NULL);
+			rrd->inflight = NULL;
+		}
+		receive_free_record(rrd);
+	}
+	return (err);
+}
+
+/*
+ * A writer thread; commit the records sharded to it, in order.  Once any
+ * record of the receive fails, the remaining ones are discarded.
+ */
+static void
+receive_writer_shard_thread(void *arg)
+{
+	receive_writer_t *rw = arg;
+	struct receive_writer_arg *rwa = rw->rw_rwa;
+	struct receive_record_arg *rrd;
+	fstrans_cookie_t cookie = spl_fstrans_mark();
+	list_t batch;
+
+	list_create(&batch, sizeof (struct receive_record_arg),
+	    offsetof(struct receive_record_arg, writer_node));
+
+	mutex_enter(&rwa->writer_lock);
+	for (;;) {
+		uint64_t nrecords = 0, nbytes = 0;
+		hrtime_t start;
+		int err;
+
+		while (list_is_empty(&rw->rw_records) && !rw->rw_exit)
+			cv_wait(&rw->rw_cv, &rwa->writer_lock);
+		if (list_is_empty(&rw->rw_records))
+			break;
+
+		receive_writer_gather(rw, &batch);
+		for (rrd = list_head(&batch); rrd != NULL;
+		    rrd = list_next(&batch, rrd)) {
+			nrecords++;
+			nbytes += sizeof (*rrd) + rrd->payload_size;
+		}
+		err = rwa->err;
+		mutex_exit(&rwa->writer_lock);
+
+		start = gethrtime();
+		if (err == 0) {
+			err = receive_writer_process(rwa, &batch);
+		} else {
+			while ((rrd = list_remove_head(&batch)) != NULL)
+				receive_free_record(rrd);
+			err = 0;
+		}
+
+		mutex_enter(&rwa->writer_lock);
+		if (err != 0 && rwa->err == 0)
+			rwa->err = err;
+		rw->rw_nrecords += nrecords;
+		rw->rw_nbytes += nbytes;
+		rw->rw_busy += gethrtime() - start;
+		rwa->writer_pending -= nrecords;
+		rwa->writer_bytes -= nbytes;
+		cv_broadcast(&rwa->writer_cv);
+	}
+	rw->rw_exited = B_TRUE;
+	cv_broadcast(&rwa->writer_cv);
+	mutex_exit(&rwa->writer_lock);
+
+	list_destroy(&batch);
+	spl_fstrans_unmark(cookie);
+	thread_exit();
+}
+
+/*
+ * Wait for the writer threads to commit every record handed to them, and
+ * return the error of the receive, if any.
+ */
+static int
+receive_writers_drain(struct receive_writer_arg *rwa)
+{
+	receive_inflight_t *ri;
+	int err;
+
+	mutex_enter(&rwa->writer_lock);
+	while (rwa->writer_pending != 0)
+		cv_wait(&rwa->writer_cv, &rwa->writer_lock);
+
+	/*
+	 * The records at the head of the stream were committed in the open
+	 * txg or earlier, so any resume state saved from now on may cover
+	 * them.  A record which failed or was discarded stays on the list,
+	 * and keeps the resume state from moving past it.
+	 */
+	while ((ri = list_head(&rwa->inflight)) != NULL && ri->ri_txg != 0) {
+		list_remove(&rwa->inflight, ri);
+		kmem_free(ri, sizeof (*ri));
+	}
+	err = rwa->err;
+	mutex_exit(&rwa->writer_lock);
+
+	return (err);
+}
+
+static void
+receive_writers_init(struct receive_writer_arg *rwa)
+{
+	mutex_init(&rwa->writer_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&rwa->writer_cv, NULL, CV_DEFAULT, NULL);
+	list_create(&rwa->inflight, sizeof (receive_inflight_t),
+	    offsetof(receive_inflight_t, ri_node));
+
+	if (zfs_recv_writer_threads <= 1)
+		return;
+
+	rwa->num_writers = zfs_recv_writer_threads;
+	rwa->writers = kmem_zalloc(rwa->num_writers *
+	    sizeof (receive_writer_t), KM_SLEEP);
+	for (int i = 0; i < rwa->num_writers; i++) {
+		receive_writer_t *rw = &rwa->writers[i];
+
+		rw->rw_rwa = rwa;
+		rw->rw_id = i;
+		list_create(&rw->rw_records, sizeof (struct receive_record_arg),
+		    offsetof(struct receive_record_arg, writer_node));
+		cv_init(&rw->rw_cv, NULL, CV_DEFAULT, NULL);
+		(void) thread_create(NULL, 0, receive_writer_shard_thread, rw,
+		    0, curproc, TS_RUN, minclsyspri);
+	}
+}
+
+/*
+ * Stop the writer threads once they have committed every record, and log
+ * how much each of them committed.
+ */
+static void
+receive_writers_stop(struct receive_writer_arg *rwa)
+{
+	mutex_enter(&rwa->writer_lock);
+	for (int i = 0; i < rwa->num_writers; i++) {
+		rwa->writers[i].rw_exit = B_TRUE;
+		cv_signal(&rwa->writers[i].rw_cv);
+	}
+	for (int i = 0; i < rwa->num_writers; i++) {
+		while (!rwa->writers[i].rw_exited)
+			cv_wait(&rwa->writer_cv, &rwa->writer_lock);
+	}
+	mutex_exit(&rwa->writer_lock);
+
+	for (int i = 0; i < rwa->num_writers; i++) {
+		receive_writer_t *rw = &rwa->writers[i];
+		uint64_t msecs = MAX(NSEC2MSEC(rw->rw_busy), 1);
+
+		zfs_dbgmsg("receive into objset %llu writer %d: %llu records, "
+		    "%llu bytes, %llu ms busy (%llu KiB/s)",
+		    (u_longlong_t)dmu_objset_id(rwa->os), rw->rw_id,
+		    (u_longlong_t)rw->rw_nrecords, (u_longlong_t)rw->rw_nbytes,
+		    (u_longlong_t)NSEC2MSEC(rw->rw_busy),
+		    (u_longlong_t)(rw->rw_nbytes * 1000 / 1024 / msecs));
+	}
+}
+
+static void
+receive_writers_fini(struct receive_writer_arg *rwa)
+{
+	receive_inflight_t *ri;
+
+	for (int i = 0; i < rwa->num_writers; i++) {
+		receive_writer_t *rw = &rwa->writers[i];
+
+		ASSERT(list_is_empty(&rw->rw_records));
+		list_destroy(&rw->rw_records);
+		cv_destroy(&rw->rw_cv);
+	}
+	if (rwa->writers != NULL) {
+		kmem_free(rwa->writers,
+		    rwa->num_writers * sizeof (receive_writer_t));
+	}
+
+	/* left behind if the receive failed */
+	while ((ri = list_remove_head(&rwa->inflight)) != NULL)
+		kmem_free(ri, sizeof (*ri));
+	list_destroy(&rwa->inflight);
+	cv_destroy(&rwa->writer_cv);
+	mutex_destroy(&rwa->writer_lock);
+}
+
+/*
+ * Hand a record to the writer thread owning its dnode block, or commit it
+ * from this thread once the writer threads have drained.  Records for the
+ * same object, and for the objects sharing a multi-slot dnode or the
+ * encryption parameters of a DRR_OBJECT_RANGE, all land on the same writer
+ * thread in stream order, since neither spans a dnode block.
+ */
+static int
+receive_dispatch_record(struct receive_writer_arg *rwa,
+    struct receive_record_arg *rrd)
+{
+	receive_writer_t *rw;
+	uint64_t object, size;
+	boolean_t shard;
+	int err;
+
+	/* Processing in order, therefore bytes_read should be increasing. */
+	ASSERT3U(rrd->bytes_read, >=, rwa->bytes_read);
+	rwa->bytes_read = rrd->bytes_read;
+
+	if (receive_record_object(rrd, &object, &shard) &&
+	    object > rwa->max_object)
+		rwa->max_object = object;
+
+	/*
+	 * For resuming to work, records must be in increasing order
+	 * by (object, offset).
+	 */
+	if (rrd->header.drr_type == DRR_WRITE) {
+		struct drr_write *drrw = &rrd->header.drr_u.drr_write;
+
+		if (drrw->drr_object < rwa->last_object ||
+		    (drrw->drr_object == rwa->last_object &&
+		    drrw->drr_offset < rwa->last_offset)) {
+			receive_free_record(rrd);
+			return (SET_ERROR(EINVAL));
+		}
+		rwa->last_object = drrw->drr_object;
+		rwa->last_offset = drrw->drr_offset;
+	}
+
+	if (rwa->num_writers == 0 || !shard) {
+		if (rwa->num_writers != 0 &&
+		    (err = receive_writers_drain(rwa)) != 0) {
+			receive_free_record(rrd);
+			return (err);
+		}
+		err = receive_process_record(rwa, rrd);
+		kmem_free(rrd, sizeof (*rrd));
+		return (err);
+	}
+
+	rw = &rwa->writers[(object >> DNODES_PER_BLOCK_SHIFT) %
+	    rwa->num_writers];
+	size = sizeof (*rrd) + rrd->payload_size;
+
+	mutex_enter(&rwa->writer_lock);
+	while (rwa->err == 0 && rwa->writer_pending != 0 &&
+	    rwa->writer_bytes + size > zfs_recv_queue_length)
+		cv_wait(&rwa->writer_cv, &rwa->writer_lock);
+	if ((err = rwa->err) != 0) {
+		mutex_exit(&rwa->writer_lock);
+		receive_free_record(rrd);
+		return (err);
+	}
+	if (rwa->resumable) {
+		receive_inflight_t *ri = kmem_zalloc(sizeof (*ri), KM_SLEEP);
+
+		ri->ri_bytes_read = rrd->bytes_read;
+		list_insert_tail(&rwa->inflight, ri);
+		rrd->inflight = ri;
+	}
+	rwa->writer_pending++;
+	rwa->writer_bytes += size;
+	list_insert_tail(&rw->rw_records, rrd);
+	cv_signal(&rw->rw_cv);
+	mutex_exit(&rwa->writer_lock);
+
+	return (0);
+}
+
+/*
+ * dmu_recv_stream's worker thread; pull records off the queue, and then
+ * commit them, or hand them to the writer threads.  When we're done,
+ * signal the main thread and exit.
  */
 static void
 receive_writer_thread(void *arg)
@@ -2611,18 +3171,15 @@ receive_writer_thread(void *arg)
 		 * can exit.
 		 */
 		if (rwa->err == 0) {
-			rwa->err = receive_process_record(rwa, rrd);
-		} else if (rrd->arc_buf != NULL) {
-			dmu_return_arcbuf(rrd->arc_buf);
-			rrd->arc_buf = NULL;
-			rrd->payload = NULL;
-		} else if (rrd->payload != NULL) {
-			kmem_free(rrd->payload, rrd->payload_size);
-			rrd->payload = NULL;
+			int err = receive_dispatch_record(rwa, rrd);
+			if (err != 0)
+				receive_set_error(rwa, err);
+		} else {
+			receive_free_record(rrd);
 		}
-		kmem_free(rrd, sizeof (*rrd));
 	}
 	kmem_free(rrd, sizeof (*rrd));
+	receive_writers_stop(rwa);
 	mutex_enter(&rwa->mutex);
 	rwa->done = B_TRUE;
 	cv_signal(&rwa->cv);
@@ -2784,6 +3341,7 @@ dmu_recv_stream(dmu_recv_cookie_t *drc, int cleanup_fd,
 	rwa->raw = drc->drc_raw;
 	rwa->spill = drc->drc_spill;
 	rwa->os->os_raw_receive = drc->drc_raw;
+	receive_writers_init(rwa);
 
 	(void) thread_create(NULL, 0, receive_writer_thread, rwa, 0, curproc,
 	    TS_RUN, minclsyspri);
@@ -2867,6 +3425,7 @@ dmu_recv_stream(dmu_recv_cookie_t *drc, int cleanup_fd,
 		}
 	}
 
+	receive_writers_fini(rwa);
 	cv_destroy(&rwa->cv);
 	mutex_destroy(&rwa->mutex);
 	bqueue_destroy(&rwa->q);
@@ -3241,4 +3800,12 @@ MODULE_PARM_DESC(zfs_recv_queue_length, "Maximum receive queue length");
 
 module_param(zfs_recv_queue_ff, int, 0644);
 MODULE_PARM_DESC(zfs_recv_queue_ff, "Receive queue fill fraction");
+
+module_param(zfs_recv_writer_threads, int, 0644);
+MODULE_PARM_DESC(zfs_recv_writer_threads,
+	"Number of threads committing received records");
+
+module_param(zfs_recv_write_batch_size, int, 0644);
+MODULE_PARM_DESC(zfs_recv_write_batch_size,
+	"Maximum bytes of writes to one object committed in a single tx");
 #endif
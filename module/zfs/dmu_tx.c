@@ -37,6 +37,7 @@
 #include <sys/sa.h>
 #include <sys/sa_impl.h>
 #include <sys/zfs_context.h>
+#include <sys/dataset_kstats.h>
 #ifdef __linux__
 #include <sys/trace_dmu.h>
 #endif
@@ -57,6 +58,7 @@ dmu_tx_stats_t dmu_tx_stats = {
 	{ "dmu_tx_dirty_over_max",	KSTAT_DATA_UINT64 },
 	{ "dmu_tx_dirty_frees_delay",	KSTAT_DATA_UINT64 },
 	{ "dmu_tx_quota",		KSTAT_DATA_UINT64 },
+	{ "dmu_tx_write_limit",		KSTAT_DATA_UINT64 },
 };
 
 static kstat_t *dmu_tx_ksp;
@@ -818,6 +820,30 @@ dmu_tx_delay(dmu_tx_t *tx, uint64_t dirty)
 	zfs_sleep_until(wakeup);
 }
 
+/*
+ * Charge the transaction against its dataset's write_limit and
+ * write_ops_limit properties, if set, and note when it may be assigned.
+ * A transaction is charged once, however many times it tries to assign.
+ */
+static void
+dmu_tx_throttle(dmu_tx_t *tx)
+{
+	objset_t *os = tx->tx_objset;
+	uint64_t towrite = 0;
+
+	tx->tx_throttled = B_TRUE;
+
+	if (os == NULL ||
+	    (os->os_write_limit == 0 && os->os_write_ops_limit == 0))
+		return;
+
+	for (dmu_tx_hold_t *txh = list_head(&tx->tx_holds); txh != NULL;
+	    txh = list_next(&tx->tx_holds, txh))
+		towrite += zfs_refcount_count(&txh->txh_space_towrite);
+
+	tx->tx_throttle_wakeup = dmu_objset_throttle(os, towrite);
+}
+
 /*
  * This routine attempts to assign the transaction to a transaction group.
  * To do so, we must determine if there is sufficient free space on disk.
@@ -888,6 +914,15 @@ dmu_tx_try_assign(dmu_tx_t *tx, uint64_t txg_how)
 		return (SET_ERROR(ERESTART));
 	}
 
+	if (!tx->tx_throttled && !(txg_how & TXG_NOTHROTTLE))
+		dmu_tx_throttle(tx);
+
+	if (tx->tx_throttle_wakeup != 0) {
+		tx->tx_wait_throttle = B_TRUE;
+		DMU_TX_STAT_BUMP(dmu_tx_write_limit);
+		return (SET_ERROR(ERESTART));
+	}
+
 	if (!tx->tx_dirty_delayed &&
 	    dsl_pool_need_dirty_delay(tx->tx_pool)) {
 		tx->tx_wait_dirty = B_TRUE;
@@ -1059,7 +1094,25 @@ dmu_tx_wait(dmu_tx_t *tx)
 
 	before = gethrtime();
 
-	if (tx->tx_wait_dirty) {
+	if (tx->tx_wait_throttle) {
+		objset_t *os = tx->tx_objset;
+
+		/*
+		 * dmu_tx_try_assign() has determined that the dataset is
+		 * writing faster than its write limits allow.
+		 */
+		zfs_sleep_until(tx->tx_throttle_wakeup);
+
+		mutex_enter(&os->os_user_ptr_lock);
+		if (os->os_dataset_kstats != NULL) {
+			dataset_kstats_update_write_limit_kstats(
+			    os->os_dataset_kstats, gethrtime() - before);
+		}
+		mutex_exit(&os->os_user_ptr_lock);
+
+		tx->tx_wait_throttle = B_FALSE;
+		tx->tx_throttle_wakeup = 0;
+	} else if (tx->tx_wait_dirty) {
 		uint64_t dirty;
 
 		/*
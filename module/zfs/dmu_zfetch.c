@@ -54,21 +54,31 @@ unsigned int	zfetch_max_distance = 8 * 1024 * 1024;
 unsigned int	zfetch_max_idistance = 64 * 1024 * 1024;
 /* max number of bytes in an array_read in which we allow prefetching (1MB) */
 unsigned long	zfetch_array_rd_sz = 1024 * 1024;
+/* max bytes between accesses of a strided stream (default 64MB) */
+unsigned int	zfetch_max_stride = 64 * 1024 * 1024;
 
 typedef struct zfetch_stats {
 	kstat_named_t zfetchstat_hits;
 	kstat_named_t zfetchstat_misses;
 	kstat_named_t zfetchstat_max_streams;
+	kstat_named_t zfetchstat_stride_streams;
+	kstat_named_t zfetchstat_stride_hits;
+	kstat_named_t zfetchstat_stride_misses;
 } zfetch_stats_t;
 
 static zfetch_stats_t zfetch_stats = {
 	{ "hits",			KSTAT_DATA_UINT64 },
 	{ "misses",			KSTAT_DATA_UINT64 },
 	{ "max_streams",		KSTAT_DATA_UINT64 },
+	{ "stride_streams",		KSTAT_DATA_UINT64 },
+	{ "stride_hits",		KSTAT_DATA_UINT64 },
+	{ "stride_misses",		KSTAT_DATA_UINT64 },
 };
 
 #define	ZFETCHSTAT_BUMP(stat) \
 	atomic_inc_64(&zfetch_stats.stat.value.ui64);
+#define	ZFETCHSTAT_INCR(stat, val) \
+	atomic_add_64(&zfetch_stats.stat.value.ui64, (val));
 
 kstat_t		*zfetch_ksp;
 
@@ -106,6 +116,9 @@ dmu_zfetch_init(zfetch_t *zf, dnode_t *dno)
 		return;
 
 	zf->zf_dnode = dno;
+	for (int i = 0; i < ZFETCH_HISTORY; i++)
+		zf->zf_hist[i] = UINT64_MAX;
+	zf->zf_hist_next = 0;
 
 	list_create(&zf->zf_stream, sizeof (zstream_t),
 	    offsetof(zstream_t, zs_node));
@@ -145,12 +158,13 @@ dmu_zfetch_fini(zfetch_t *zf)
 
 /*
  * If there aren't too many streams already, create a new stream.
- * The "blkid" argument is the next block that we expect this stream to access.
+ * The "blkid" argument is the next block that we expect this stream to access
+ * and "stride" is the stream's stride, or zero for a sequential stream.
  * While we're here, clean up old streams (which haven't been
  * accessed for at least zfetch_min_sec_reap seconds).
  */
 static void
-dmu_zfetch_stream_create(zfetch_t *zf, uint64_t blkid)
+dmu_zfetch_stream_create(zfetch_t *zf, uint64_t blkid, int64_t stride)
 {
 	zstream_t *zs_next;
 	int numstreams = 0;
@@ -190,12 +204,156 @@ dmu_zfetch_stream_create(zfetch_t *zf, uint64_t blkid)
 	zs->zs_blkid = blkid;
 	zs->zs_pf_blkid = blkid;
 	zs->zs_ipf_blkid = blkid;
+	zs->zs_stride = stride;
 	zs->zs_atime = gethrtime();
 	mutex_init(&zs->zs_lock, NULL, MUTEX_DEFAULT, NULL);
 
+	if (stride != 0)
+		ZFETCHSTAT_BUMP(zfetchstat_stride_streams);
+
 	list_insert_head(&zf->zf_stream, zs);
 }
 
+/*
+ * Look for a constant stride in the recently unmatched accesses.  When
+ * some earlier access, this one, and an access one stride before that
+ * earlier one have all been seen, return the stride in blocks.  Forward
+ * sequential access is left to the sequential streams.  Otherwise the
+ * access is remembered and zero is returned.
+ */
+static int64_t
+dmu_zfetch_stride_detect(zfetch_t *zf, uint64_t blkid, uint64_t nblks)
+{
+	int64_t max_stride = zfetch_max_stride >> zf->zf_dnode->dn_datablkshift;
+
+	ASSERT(RW_WRITE_HELD(&zf->zf_rwlock));
+
+	/* Prefer the shortest stride by starting from the newest access. */
+	for (int n = 1; n <= ZFETCH_HISTORY; n++) {
+		int i = (zf->zf_hist_next + ZFETCH_HISTORY - n) %
+		    ZFETCH_HISTORY;
+		uint64_t prev = zf->zf_hist[i];
+		int64_t stride = (int64_t)(blkid - prev);
+
+		if (prev == UINT64_MAX || stride == 0 ||
+		    (stride > 0 && stride <= (int64_t)nblks) ||
+		    ABS(stride) > max_stride)
+			continue;
+
+		for (int j = 0; j < ZFETCH_HISTORY; j++) {
+			if (j == i || zf->zf_hist[j] == UINT64_MAX ||
+			    (int64_t)(prev - zf->zf_hist[j]) != stride)
+				continue;
+
+			/* Forget the history so the pattern is used once */
+			for (int k = 0; k < ZFETCH_HISTORY; k++)
+				zf->zf_hist[k] = UINT64_MAX;
+			return (stride);
+		}
+	}
+
+	zf->zf_hist[zf->zf_hist_next] = blkid;
+	zf->zf_hist_next = (zf->zf_hist_next + 1) % ZFETCH_HISTORY;
+
+	return (0);
+}
+
+/*
+ * Return the number of predicted accesses of a strided stream which were
+ * skipped to arrive at blkid, or -1 if blkid is not one of the accesses
+ * the stream expects next or has already prefetched.
+ */
+static int64_t
+dmu_zfetch_stride_match(zstream_t *zs, uint64_t blkid)
+{
+	int64_t delta = (int64_t)(blkid - zs->zs_blkid);
+	int64_t ahead = (int64_t)(zs->zs_pf_blkid - zs->zs_blkid) /
+	    zs->zs_stride;
+
+	if (delta % zs->zs_stride != 0)
+		return (-1);
+	if (delta / zs->zs_stride < 0 || delta / zs->zs_stride > ahead)
+		return (-1);
+
+	return (delta / zs->zs_stride);
+}
+
+/*
+ * Issue prefetches for an access which matched strided stream "zs".  The
+ * stream's zs_lock is held on entry; it, zf_rwlock and (unless have_lock)
+ * dn_struct_rwlock are dropped before returning.
+ *
+ * As for sequential streams the number of accesses prefetched ahead of
+ * the reader doubles on each hit, up to zfetch_max_distance bytes.  That
+ * limit is scaled by the stream's hit rate, so a stream whose predictions
+ * are frequently skipped, wasting the blocks prefetched for them, does not
+ * prefetch as far ahead.
+ */
+static void
+dmu_zfetch_stride(zfetch_t *zf, zstream_t *zs, uint64_t blkid, uint64_t nblks,
+    boolean_t fetch_data, boolean_t have_lock)
+{
+	dnode_t *dn = zf->zf_dnode;
+	int64_t stride = zs->zs_stride;
+	int64_t skipped = dmu_zfetch_stride_match(zs, blkid);
+	int64_t done, want, max_ahead;
+	int epbs = dn->dn_indblkshift - SPA_BLKPTRSHIFT;
+
+	ASSERT(MUTEX_HELD(&zs->zs_lock));
+	ASSERT3S(skipped, >=, 0);
+
+	zs->zs_hits++;
+	zs->zs_misses += skipped;
+
+	/*
+	 * "done" accesses starting with this one have already been
+	 * prefetched; prefetch through the first "want" of them.
+	 */
+	done = (int64_t)(zs->zs_pf_blkid - blkid) / stride;
+	max_ahead = (zfetch_max_distance >> dn->dn_datablkshift) / nblks;
+	max_ahead = max_ahead * zs->zs_hits / (zs->zs_hits + zs->zs_misses);
+	want = MIN(MAX(2 * done + 1, 2), MAX(max_ahead, 1) + 1);
+
+	/* Reverse streams stop at the start of the object. */
+	if (stride < 0)
+		want = MIN(want, (int64_t)blkid / -stride + 1);
+
+	int64_t first = MAX(done, 1);
+	if (want > first)
+		zs->zs_pf_blkid = blkid + want * stride;
+
+	zs->zs_atime = gethrtime();
+	zs->zs_blkid = blkid + stride;
+	mutex_exit(&zs->zs_lock);
+	rw_exit(&zf->zf_rwlock);
+
+	for (int64_t i = first; i < want; i++) {
+		uint64_t pf_blkid = blkid + i * stride;
+
+		if (fetch_data) {
+			for (uint64_t j = 0; j < nblks; j++) {
+				dbuf_prefetch(dn, 0, pf_blkid + j,
+				    ZIO_PRIORITY_ASYNC_READ,
+				    ARC_FLAG_PREDICTIVE_PREFETCH);
+			}
+		} else {
+			for (uint64_t iblk = pf_blkid >> epbs;
+			    iblk <= (pf_blkid + nblks - 1) >> epbs; iblk++) {
+				dbuf_prefetch(dn, 1, iblk,
+				    ZIO_PRIORITY_ASYNC_READ,
+				    ARC_FLAG_PREDICTIVE_PREFETCH);
+			}
+		}
+	}
+	if (!have_lock)
+		rw_exit(&dn->dn_struct_rwlock);
+
+	ZFETCHSTAT_BUMP(zfetchstat_hits);
+	ZFETCHSTAT_BUMP(zfetchstat_stride_hits);
+	if (skipped > 0)
+		ZFETCHSTAT_INCR(zfetchstat_stride_misses, skipped);
+}
+
 /*
  * This is the predictive prefetch entry point.  It associates dnode access
  * specified with blkid and nblks arguments with prefetch stream, predicts
@@ -244,11 +402,20 @@ retry:
 	/*
 	 * Find matching prefetch stream.  Depending on whether the accesses
 	 * are block-aligned, first block of the new access may either follow
-	 * the last block of the previous access, or be equal to it.
+	 * the last block of the previous access, or be equal to it.  Strided
+	 * streams match an access at any of their predicted locations.
 	 */
 	for (zs = list_head(&zf->zf_stream); zs != NULL;
 	    zs = list_next(&zf->zf_stream, zs)) {
-		if (blkid == zs->zs_blkid || blkid + 1 == zs->zs_blkid) {
+		if (zs->zs_stride != 0) {
+			if (dmu_zfetch_stride_match(zs, blkid) < 0)
+				continue;
+			mutex_enter(&zs->zs_lock);
+			/* Re-check now that the stream cannot change. */
+			if (dmu_zfetch_stride_match(zs, blkid) >= 0)
+				break;
+			mutex_exit(&zs->zs_lock);
+		} else if (blkid == zs->zs_blkid || blkid + 1 == zs->zs_blkid) {
 			mutex_enter(&zs->zs_lock);
 			/*
 			 * zs_blkid could have changed before we
@@ -289,13 +456,29 @@ retry:
 			goto retry;
 		}
 
-		dmu_zfetch_stream_create(zf, end_of_access_blkid);
+		/*
+		 * Accesses which repeatedly advance by the same distance
+		 * (or step backwards) start a strided stream instead.
+		 */
+		int64_t stride = dmu_zfetch_stride_detect(zf, blkid, nblks);
+		if (stride == 0) {
+			dmu_zfetch_stream_create(zf, end_of_access_blkid, 0);
+		} else if (stride > 0 || blkid >= -stride) {
+			dmu_zfetch_stream_create(zf, blkid + stride, stride);
+		}
 		rw_exit(&zf->zf_rwlock);
 		if (!have_lock)
 			rw_exit(&zf->zf_dnode->dn_struct_rwlock);
 		return;
 	}
 
+	if (zs->zs_stride != 0) {
+		dmu_zfetch_stride(zf, zs, blkid, nblks, fetch_data, have_lock);
+		return;
+	}
+
+	zs->zs_hits++;
+
 	/*
 	 * This access was to a block that we issued a prefetch for on
 	 * behalf of this stream. Issue further prefetches for this stream.
@@ -388,6 +571,9 @@ ZFS_MODULE_PARAM(zfs_prefetch, zfetch_, min_sec_reap, UINT, ZMOD_RW, "Min time b
 ZFS_MODULE_PARAM(zfs_prefetch, zfetch_, max_distance, UINT, ZMOD_RW,
 	"Max bytes to prefetch per stream (default 8MB)");
 
+ZFS_MODULE_PARAM(zfs_prefetch, zfetch_, max_stride, UINT, ZMOD_RW,
+	"Max bytes between accesses of a strided prefetch stream");
+
 ZFS_MODULE_PARAM(zfs_prefetch, zfetch_, array_rd_sz, UQUAD, ZMOD_RW, "Number of bytes in a array_read");
 /* END CSTYLED */
 #endif
@@ -1344,6 +1344,17 @@ dsl_pool_config_held_writer(dsl_pool_t *dp)
 	return (RRW_WRITE_HELD(&dp->dp_config_rwlock));
 }
 
+/*
+ * Returns true if a thread is waiting to take the config lock as writer.
+ * Long running readers can use this to drop the lock early, rather than
+ * holding up a sync task.  The answer may be stale by the time it is used.
+ */
+boolean_t
+dsl_pool_config_writer_wanted(dsl_pool_t *dp)
+{
+	return (dp->dp_config_rwlock.rr_writer_wanted);
+}
+
 #if defined(_KERNEL)
 EXPORT_SYMBOL(dsl_pool_config_enter);
 EXPORT_SYMBOL(dsl_pool_config_exit);
@@ -28,6 +28,7 @@
  */
 #include <sys/zfs_context.h>
 #include <sys/zio.h>
+#include <sys/zio_checksum.h>
 #include <sys/sha2.h>
 #include <sys/abd.h>
 #ifdef __linux__
@@ -107,3 +108,84 @@ abd_checksum_SHA512_byteswap(abd_t *abd, uint64_t size,
 	zcp->zc_word[2] = BSWAP_64(tmp.zc_word[2]);
 	zcp->zc_word[3] = BSWAP_64(tmp.zc_word[3]);
 }
+
+static int
+sha_incremental_many(void **bufs, uint_t n, size_t size, void *arg)
+{
+	SHA2UpdateMB(arg, (const void *const *)bufs, size, n);
+	return (0);
+}
+
+/*
+ * Checksum n buffers of the same size in lockstep, which allows a
+ * multi-buffer SHA2 implementation to hash several of them in a single
+ * SIMD pass.  The results are in the byte order produced by SHA2Final().
+ */
+static void
+abd_checksum_SHA2_many(uint64_t mech, abd_t **abds, uint64_t size,
+    zio_cksum_t *zcps, uint_t n)
+{
+	SHA2_CTX ctx[ZIO_CHECKSUM_MANY_MAX];
+	SHA2_CTX *ctxs[ZIO_CHECKSUM_MANY_MAX];
+
+	ASSERT3U(n, <=, ZIO_CHECKSUM_MANY_MAX);
+	ASSERT3U(n, <=, ABD_ITER_MANY_MAX);
+
+	for (uint_t i = 0; i < n; i++) {
+		ctxs[i] = &ctx[i];
+		SHA2Init(mech, ctxs[i]);
+	}
+
+	(void) abd_iterate_func_many(abds, n, size, sha_incremental_many,
+	    ctxs);
+
+	for (uint_t i = 0; i < n; i++)
+		SHA2Final(&zcps[i], ctxs[i]);
+}
+
+void
+abd_checksum_SHA256_many(abd_t **abds, uint64_t size,
+    const void *ctx_template, zio_cksum_t *zcps, uint_t n)
+{
+#ifdef __linux__
+	if (qat_checksum_use_accel(size)) {
+		for (uint_t i = 0; i < n; i++)
+			abd_checksum_SHA256(abds[i], size, ctx_template,
+			    &zcps[i]);
+		return;
+	}
+#endif
+
+	abd_checksum_SHA2_many(SHA256, abds, size, zcps, n);
+
+	/* See abd_checksum_SHA256() */
+	for (uint_t i = 0; i < n; i++) {
+		zcps[i].zc_word[0] = BE_64(zcps[i].zc_word[0]);
+		zcps[i].zc_word[1] = BE_64(zcps[i].zc_word[1]);
+		zcps[i].zc_word[2] = BE_64(zcps[i].zc_word[2]);
+		zcps[i].zc_word[3] = BE_64(zcps[i].zc_word[3]);
+	}
+}
+
+/*ARGSUSED*/
+void
+abd_checksum_SHA512_native_many(abd_t **abds, uint64_t size,
+    const void *ctx_template, zio_cksum_t *zcps, uint_t n)
+{
+	abd_checksum_SHA2_many(SHA512_256, abds, size, zcps, n);
+}
+
+/*ARGSUSED*/
+void
+abd_checksum_SHA512_byteswap_many(abd_t **abds, uint64_t size,
+    const void *ctx_template, zio_cksum_t *zcps, uint_t n)
+{
+	abd_checksum_SHA2_many(SHA512_256, abds, size, zcps, n);
+
+	for (uint_t i = 0; i < n; i++) {
+		zcps[i].zc_word[0] = BSWAP_64(zcps[i].zc_word[0]);
+		zcps[i].zc_word[1] = BSWAP_64(zcps[i].zc_word[1]);
+		zcps[i].zc_word[2] = BSWAP_64(zcps[i].zc_word[2]);
+		zcps[i].zc_word[3] = BSWAP_64(zcps[i].zc_word[3]);
+	}
+}
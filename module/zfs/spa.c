@@ -52,12 +52,15 @@
 #include <sys/zap.h>
 #include <sys/zil.h>
 #include <sys/ddt.h>
+#include <sys/brt.h>
 #include <sys/vdev_impl.h>
+#include <sys/vdev_draid.h>
 #include <sys/vdev_removal.h>
 #include <sys/vdev_indirect_mapping.h>
 #include <sys/vdev_indirect_births.h>
 #include <sys/vdev_initialize.h>
 #include <sys/vdev_trim.h>
+#include <sys/vdev_rebuild.h>
 #include <sys/vdev_disk.h>
 #include <sys/metaslab.h>
 #include <sys/metaslab_impl.h>
@@ -304,6 +307,12 @@ spa_prop_get_config(spa_t *spa, nvlist_t **nvp)
 
 		spa_prop_add_list(*nvp, ZPOOL_PROP_DEDUPRATIO, NULL,
 		    ddt_get_pool_dedup_ratio(spa), src);
+		spa_prop_add_list(*nvp, ZPOOL_PROP_BCLONEUSED, NULL,
+		    brt_get_used(spa), src);
+		spa_prop_add_list(*nvp, ZPOOL_PROP_BCLONESAVED, NULL,
+		    brt_get_saved(spa), src);
+		spa_prop_add_list(*nvp, ZPOOL_PROP_BCLONERATIO, NULL,
+		    brt_get_ratio(spa), src);
 
 		spa_prop_add_list(*nvp, ZPOOL_PROP_HEALTH, NULL,
 		    rvd->vdev_state, src);
@@ -1216,6 +1225,13 @@ spa_activate(spa_t *spa, int mode)
 		spa_create_zio_taskqs(spa);
 	}
 
+	spa->spa_zio_batch = kmem_zalloc(max_ncpus * sizeof (spa_zio_batch_t),
+	    KM_SLEEP);
+	for (int i = 0; i < max_ncpus; i++) {
+		mutex_init(&spa->spa_zio_batch[i].szb_lock, NULL,
+		    MUTEX_DEFAULT, NULL);
+	}
+
 	for (size_t i = 0; i < TXG_SIZE; i++) {
 		spa->spa_txg_zio[i] = zio_root(spa, NULL, NULL,
 		    ZIO_FLAG_CANFAIL);
@@ -1317,6 +1333,14 @@ spa_deactivate(spa_t *spa)
 		}
 	}
 
+	/* Every dispatched write batch has run by now. */
+	for (int i = 0; i < max_ncpus; i++) {
+		ASSERT3P(spa->spa_zio_batch[i].szb_open, ==, NULL);
+		mutex_destroy(&spa->spa_zio_batch[i].szb_lock);
+	}
+	kmem_free(spa->spa_zio_batch, max_ncpus * sizeof (spa_zio_batch_t));
+	spa->spa_zio_batch = NULL;
+
 	for (size_t i = 0; i < TXG_SIZE; i++) {
 		ASSERT3P(spa->spa_txg_zio[i], !=, NULL);
 		VERIFY0(zio_wait(spa->spa_txg_zio[i]));
@@ -1512,6 +1536,7 @@ spa_unload(spa_t *spa)
 		vdev_initialize_stop_all(root_vdev, VDEV_INITIALIZE_ACTIVE);
 		vdev_trim_stop_all(root_vdev, VDEV_TRIM_ACTIVE);
 		vdev_autotrim_stop_all(spa);
+		vdev_rebuild_stop_all(spa);
 	}
 
 	/*
@@ -1585,6 +1610,7 @@ spa_unload(spa_t *spa)
 	}
 
 	ddt_unload(spa);
+	brt_unload(spa);
 	spa_unload_log_sm_metadata(spa);
 
 	/*
@@ -3803,7 +3829,7 @@ spa_ld_load_vdev_metadata(spa_t *spa)
 	 * Propagate the leaf DTLs we just loaded all the way up the vdev tree.
 	 */
 	spa_config_enter(spa, SCL_ALL, FTAG, RW_WRITER);
-	vdev_dtl_reassess(rvd, 0, 0, B_FALSE);
+	vdev_dtl_reassess(rvd, 0, 0, B_FALSE, B_FALSE);
 	spa_config_exit(spa, SCL_ALL, FTAG);
 
 	return (0);
@@ -3824,6 +3850,21 @@ spa_ld_load_dedup_tables(spa_t *spa)
 	return (0);
 }
 
+static int
+spa_ld_load_brt(spa_t *spa)
+{
+	int error = 0;
+	vdev_t *rvd = spa->spa_root_vdev;
+
+	error = brt_load(spa);
+	if (error != 0) {
+		spa_load_failed(spa, "brt_load failed [error=%d]", error);
+		return (spa_vdev_err(rvd, VDEV_AUX_CORRUPT_DATA, EIO));
+	}
+
+	return (0);
+}
+
 static int
 spa_ld_verify_logs(spa_t *spa, spa_import_type_t type, char **ereport)
 {
@@ -4185,6 +4226,19 @@ spa_ld_mos_with_trusted_config(spa_t *spa, spa_import_type_t type,
 	return (0);
 }
 
+/*
+ * Charge the time elapsed since *start to a phase of spa_load_impl(), as
+ * reported by the pool's load_times kstat, and restart the clock.
+ */
+static void
+spa_load_phase_done(spa_t *spa, spa_load_phase_t phase, hrtime_t *start)
+{
+	hrtime_t now = gethrtime();
+
+	spa->spa_load_phase_time[phase] += now - *start;
+	*start = now;
+}
+
 /*
  * Load an existing storage pool, using the config provided. This config
  * describes which vdevs are part of the pool and is later validated against
@@ -4199,13 +4253,16 @@ spa_load_impl(spa_t *spa, spa_import_type_t type, char **ereport)
 	boolean_t checkpoint_rewind =
 	    (spa->spa_import_flags & ZFS_IMPORT_CHECKPOINT);
 	boolean_t update_config_cache = B_FALSE;
+	hrtime_t start = gethrtime();
 
 	ASSERT(MUTEX_HELD(&spa_namespace_lock));
 	ASSERT(spa->spa_config_source != SPA_CONFIG_SRC_NONE);
 
+	bzero(spa->spa_load_phase_time, sizeof (spa->spa_load_phase_time));
 	spa_load_note(spa, "LOADING");
 
 	error = spa_ld_mos_with_trusted_config(spa, type, &update_config_cache);
+	spa_load_phase_done(spa, SPA_LOAD_PHASE_OPEN_MOS, &start);
 	if (error != 0)
 		return (error);
 
@@ -4229,6 +4286,7 @@ spa_load_impl(spa_t *spa, spa_import_type_t type, char **ereport)
 		 * uberblock to the labels, making the rewind permanent.
 		 */
 		error = spa_ld_checkpoint_rewind(spa);
+		spa_load_phase_done(spa, SPA_LOAD_PHASE_OPEN_MOS, &start);
 		if (error != 0)
 			return (error);
 
@@ -4239,6 +4297,7 @@ spa_load_impl(spa_t *spa, spa_import_type_t type, char **ereport)
 		spa_ld_prepare_for_reload(spa);
 		spa_load_note(spa, "LOADING checkpointed uberblock");
 		error = spa_ld_mos_with_trusted_config(spa, type, NULL);
+		spa_load_phase_done(spa, SPA_LOAD_PHASE_OPEN_MOS, &start);
 		if (error != 0)
 			return (error);
 	}
@@ -4247,6 +4306,7 @@ spa_load_impl(spa_t *spa, spa_import_type_t type, char **ereport)
 	 * Retrieve the checkpoint txg if the pool has a checkpoint.
 	 */
 	error = spa_ld_read_checkpoint_txg(spa);
+	spa_load_phase_done(spa, SPA_LOAD_PHASE_OPEN_MOS, &start);
 	if (error != 0)
 		return (error);
 
@@ -4259,6 +4319,7 @@ spa_load_impl(spa_t *spa, spa_import_type_t type, char **ereport)
 	 * we have loaded their mappings.
 	 */
 	error = spa_ld_open_indirect_vdev_metadata(spa);
+	spa_load_phase_done(spa, SPA_LOAD_PHASE_INDIRECT_VDEVS, &start);
 	if (error != 0)
 		return (error);
 
@@ -4267,6 +4328,7 @@ spa_load_impl(spa_t *spa, spa_import_type_t type, char **ereport)
 	 * they are all supported.
 	 */
 	error = spa_ld_check_features(spa, &missing_feat_write);
+	spa_load_phase_done(spa, SPA_LOAD_PHASE_FEATURES, &start);
 	if (error != 0)
 		return (error);
 
@@ -4275,6 +4337,7 @@ spa_load_impl(spa_t *spa, spa_import_type_t type, char **ereport)
 	 * layer.
 	 */
 	error = spa_ld_load_special_directories(spa);
+	spa_load_phase_done(spa, SPA_LOAD_PHASE_SPECIAL_DIRS, &start);
 	if (error != 0)
 		return (error);
 
@@ -4282,6 +4345,7 @@ spa_load_impl(spa_t *spa, spa_import_type_t type, char **ereport)
 	 * Retrieve pool properties from the MOS.
 	 */
 	error = spa_ld_get_props(spa);
+	spa_load_phase_done(spa, SPA_LOAD_PHASE_PROPS, &start);
 	if (error != 0)
 		return (error);
 
@@ -4290,6 +4354,7 @@ spa_load_impl(spa_t *spa, spa_import_type_t type, char **ereport)
 	 * and open them.
 	 */
 	error = spa_ld_open_aux_vdevs(spa, type);
+	spa_load_phase_done(spa, SPA_LOAD_PHASE_AUX_VDEVS, &start);
 	if (error != 0)
 		return (error);
 
@@ -4298,10 +4363,17 @@ spa_load_impl(spa_t *spa, spa_import_type_t type, char **ereport)
 	 * should be autoreplaced.
 	 */
 	error = spa_ld_load_vdev_metadata(spa);
+	spa_load_phase_done(spa, SPA_LOAD_PHASE_VDEV_METADATA, &start);
 	if (error != 0)
 		return (error);
 
 	error = spa_ld_load_dedup_tables(spa);
+	spa_load_phase_done(spa, SPA_LOAD_PHASE_DEDUP_TABLES, &start);
+	if (error != 0)
+		return (error);
+
+	error = spa_ld_load_brt(spa);
+	spa_load_phase_done(spa, SPA_LOAD_PHASE_BRT, &start);
 	if (error != 0)
 		return (error);
 
@@ -4310,6 +4382,7 @@ spa_load_impl(spa_t *spa, spa_import_type_t type, char **ereport)
 	 * when we claim log blocks later.
 	 */
 	error = spa_ld_verify_logs(spa, type, ereport);
+	spa_load_phase_done(spa, SPA_LOAD_PHASE_VERIFY_LOGS, &start);
 	if (error != 0)
 		return (error);
 
@@ -4331,6 +4404,7 @@ spa_load_impl(spa_t *spa, spa_import_type_t type, char **ereport)
 	 * which can take a very long time.
 	 */
 	error = spa_ld_verify_pool_data(spa);
+	spa_load_phase_done(spa, SPA_LOAD_PHASE_VERIFY_POOL_DATA, &start);
 	if (error != 0)
 		return (error);
 
@@ -4382,6 +4456,7 @@ spa_load_impl(spa_t *spa, spa_import_type_t type, char **ereport)
 		 * performed above.
 		 */
 		txg_wait_synced(spa->spa_dsl_pool, spa->spa_claim_max_txg);
+		spa_load_phase_done(spa, SPA_LOAD_PHASE_CLAIM, &start);
 
 		/*
 		 * Check if we need to request an update of the config. On the
@@ -4428,7 +4503,9 @@ spa_load_impl(spa_t *spa, spa_import_type_t type, char **ereport)
 		vdev_initialize_restart(spa->spa_root_vdev);
 		vdev_trim_restart(spa->spa_root_vdev);
 		vdev_autotrim_restart(spa);
+		vdev_rebuild_restart(spa);
 		spa_config_exit(spa, SCL_CONFIG, FTAG);
+		spa_load_phase_done(spa, SPA_LOAD_PHASE_FINISH, &start);
 	}
 
 	spa_import_progress_remove(spa_guid(spa));
@@ -5192,6 +5269,7 @@ spa_create(const char *pool, nvlist_t *nvroot, nvlist_t *props,
 	uint64_t version, obj;
 	boolean_t has_features;
 	boolean_t has_encryption;
+	boolean_t has_draid;
 	spa_feature_t feat;
 	char *feat_name;
 	char *poolname;
@@ -5236,6 +5314,7 @@ spa_create(const char *pool, nvlist_t *nvroot, nvlist_t *props,
 
 	has_features = B_FALSE;
 	has_encryption = B_FALSE;
+	has_draid = B_FALSE;
 	for (nvpair_t *elem = nvlist_next_nvpair(props, NULL);
 	    elem != NULL; elem = nvlist_next_nvpair(props, elem)) {
 		if (zpool_prop_feature(nvpair_name(elem))) {
@@ -5245,6 +5324,8 @@ spa_create(const char *pool, nvlist_t *nvroot, nvlist_t *props,
 			VERIFY0(zfeature_lookup_name(feat_name, &feat));
 			if (feat == SPA_FEATURE_ENCRYPTION)
 				has_encryption = B_TRUE;
+			if (feat == SPA_FEATURE_DRAID)
+				has_draid = B_TRUE;
 		}
 	}
 
@@ -5299,10 +5380,23 @@ spa_create(const char *pool, nvlist_t *nvroot, nvlist_t *props,
 	if (error == 0 && !zfs_allocatable_devs(nvroot))
 		error = SET_ERROR(EINVAL);
 
+	/* dRAID vdevs require the feature to be enabled at creation */
+	for (int c = 0; error == 0 && c < rvd->vdev_children; c++) {
+		if (rvd->vdev_child[c]->vdev_ops == &vdev_draid_ops &&
+		    !has_draid)
+			error = SET_ERROR(ENOTSUP);
+	}
+
 	if (error == 0 &&
 	    (error = vdev_create(rvd, txg, B_FALSE)) == 0 &&
 	    (error = spa_validate_aux(spa, nvroot, txg,
 	    VDEV_ALLOC_ADD)) == 0) {
+		/*
+		 * Add the distributed spares provided by any dRAID vdevs to
+		 * the list of spares.
+		 */
+		vdev_draid_spare_create(nvroot, rvd, 0);
+
 		/*
 		 * instantiate the metaslab groups (this will dirty the vdevs)
 		 * we can no longer error exit past this point
@@ -5365,6 +5459,11 @@ spa_create(const char *pool, nvlist_t *nvroot, nvlist_t *props,
 	 */
 	ddt_create(spa);
 
+	/*
+	 * Create BRT (block reference table).
+	 */
+	brt_create(spa);
+
 	spa_update_dspace(spa);
 
 	tx = dmu_tx_create_assigned(dp, txg);
@@ -5854,9 +5953,9 @@ spa_export_common(char *pool, int new_state, nvlist_t **oldconfig,
 
 		/*
 		 * We're about to export or destroy this pool. Make sure
-		 * we stop all initialization and trim activity here before
-		 * we set the spa_final_txg. This will ensure that all
-		 * dirty data resulting from the initialization is
+		 * we stop all initialization, rebuild, and trim activity
+		 * here before we set the spa_final_txg. This will ensure
+		 * that all dirty data resulting from the initialization is
 		 * committed to disk before we unload the pool.
 		 */
 		if (spa->spa_root_vdev != NULL) {
@@ -5864,6 +5963,7 @@ spa_export_common(char *pool, int new_state, nvlist_t **oldconfig,
 			vdev_initialize_stop_all(rvd, VDEV_INITIALIZE_ACTIVE);
 			vdev_trim_stop_all(rvd, VDEV_TRIM_ACTIVE);
 			vdev_autotrim_stop_all(spa);
+			vdev_rebuild_stop_all(spa);
 		}
 
 		/*
@@ -6009,8 +6109,9 @@ spa_vdev_add(spa_t *spa, nvlist_t *nvroot)
 			    tvd->vdev_ashift != spa->spa_max_ashift) {
 				return (spa_vdev_exit(spa, vd, txg, EINVAL));
 			}
-			/* Fail if top level vdev is raidz */
-			if (tvd->vdev_ops == &vdev_raidz_ops) {
+			/* Fail if top level vdev is raidz or a dRAID */
+			if (tvd->vdev_ops == &vdev_raidz_ops ||
+			    tvd->vdev_ops == &vdev_draid_ops) {
 				return (spa_vdev_exit(spa, vd, txg, EINVAL));
 			}
 			/*
@@ -6030,6 +6131,16 @@ spa_vdev_add(spa_t *spa, nvlist_t *nvroot)
 		}
 	}
 
+	/*
+	 * Add the distributed spares provided by any new dRAID vdevs to the
+	 * list of spares.  They are named after the top-level vdev ids which
+	 * will be assigned below.
+	 */
+	vdev_draid_spare_create(nvroot, vd, rvd->vdev_children);
+	if (nvlist_lookup_nvlist_array(nvroot, ZPOOL_CONFIG_SPARES, &spares,
+	    &nspares) != 0)
+		nspares = 0;
+
 	for (int c = 0; c < vd->vdev_children; c++) {
 		tvd = vd->vdev_child[c];
 		vdev_remove_child(vd, tvd);
@@ -6087,12 +6198,17 @@ spa_vdev_add(spa_t *spa, nvlist_t *nvroot)
  * extra rules: you can't attach to it after it's been created, and upon
  * completion of resilvering, the first disk (the one being replaced)
  * is automatically detached.
+ *
+ * If 'rebuild' is specified, then sequential reconstruction (a.ka. rebuild)
+ * should be performed instead of traditional healing reconstruction.  From
+ * an administrators perspective these are both resilver operations.
  */
 int
-spa_vdev_attach(spa_t *spa, uint64_t guid, nvlist_t *nvroot, int replacing)
+spa_vdev_attach(spa_t *spa, uint64_t guid, nvlist_t *nvroot, int replacing,
+    int rebuild)
 {
 	uint64_t txg, dtl_max_txg;
-	ASSERTV(vdev_t *rvd = spa->spa_root_vdev);
+	vdev_t *rvd = spa->spa_root_vdev;
 	vdev_t *oldvd, *newvd, *newrootvd, *pvd, *tvd;
 	vdev_ops_t *pvops;
 	char *oldvdpath, *newvdpath;
@@ -6121,6 +6237,28 @@ spa_vdev_attach(spa_t *spa, uint64_t guid, nvlist_t *nvroot, int replacing)
 	if (!oldvd->vdev_ops->vdev_op_leaf)
 		return (spa_vdev_exit(spa, NULL, txg, ENOTSUP));
 
+	if (rebuild) {
+		/*
+		 * Sequential rebuild relies on the per top-level vdev zap to
+		 * persist its progress, and is only supported for mirrors and
+		 * dRAID.  Every interior vdev above oldvd must be a mirror,
+		 * replacing, spare, or dRAID vdev.  Their children can either
+		 * be copied verbatim or reconstructed from full stripes.
+		 */
+		if (oldvd->vdev_top->vdev_top_zap == 0)
+			return (spa_vdev_exit(spa, NULL, txg, ENOTSUP));
+
+		for (pvd = oldvd->vdev_parent; pvd != rvd;
+		    pvd = pvd->vdev_parent) {
+			if (pvd->vdev_ops != &vdev_mirror_ops &&
+			    pvd->vdev_ops != &vdev_replacing_ops &&
+			    pvd->vdev_ops != &vdev_spare_ops &&
+			    pvd->vdev_ops != &vdev_draid_ops)
+				return (spa_vdev_exit(spa, NULL, txg,
+				    ENOTSUP));
+		}
+	}
+
 	pvd = oldvd->vdev_parent;
 
 	if ((error = spa_config_parse(spa, &newrootvd, nvroot, NULL, 0,
@@ -6135,6 +6273,14 @@ spa_vdev_attach(spa_t *spa, uint64_t guid, nvlist_t *nvroot, int replacing)
 	if (!newvd->vdev_ops->vdev_op_leaf)
 		return (spa_vdev_exit(spa, newrootvd, txg, EINVAL));
 
+	/*
+	 * A dRAID distributed spare may only replace a child of the dRAID
+	 * vdev which provides its capacity.
+	 */
+	if (newvd->vdev_ops == &vdev_draid_spare_ops &&
+	    (!replacing || !vdev_draid_spare_is_for(newvd, oldvd->vdev_top)))
+		return (spa_vdev_exit(spa, newrootvd, txg, ENOTSUP));
+
 	if ((error = vdev_create(newrootvd, txg, replacing)) != 0)
 		return (spa_vdev_exit(spa, newrootvd, txg, error));
 
@@ -6215,8 +6361,11 @@ spa_vdev_attach(spa_t *spa, uint64_t guid, nvlist_t *nvroot, int replacing)
 		}
 	}
 
-	/* mark the device being resilvered */
-	newvd->vdev_resilver_txg = txg;
+	/* mark the device being resilvered or rebuilt */
+	if (rebuild)
+		newvd->vdev_rebuild_txg = txg;
+	else
+		newvd->vdev_resilver_txg = txg;
 
 	/*
 	 * If the parent is not a mirror, or if we're replacing, insert the new
@@ -6273,16 +6422,26 @@ spa_vdev_attach(spa_t *spa, uint64_t guid, nvlist_t *nvroot, int replacing)
 	vdev_dirty(tvd, VDD_DTL, newvd, txg);
 
 	/*
-	 * Schedule the resilver to restart in the future. We do this to
-	 * ensure that dmu_sync-ed blocks have been stitched into the
-	 * respective datasets. We do not do this if resilvers have been
-	 * deferred.
+	 * When rebuilding the rebuild is started by the async thread once
+	 * the config has been committed, since it requires an assigned
+	 * transaction.  Healing resilvers scan the pool and require no
+	 * special handling.
 	 */
-	if (dsl_scan_resilvering(spa_get_dsl(spa)) &&
-	    spa_feature_is_enabled(spa, SPA_FEATURE_RESILVER_DEFER))
-		vdev_set_deferred_resilver(spa, newvd);
-	else
-		dsl_resilver_restart(spa->spa_dsl_pool, dtl_max_txg);
+	if (rebuild) {
+		spa_async_request(spa, SPA_ASYNC_REBUILD);
+	} else {
+		/*
+		 * Schedule the resilver to restart in the future. We do
+		 * this to ensure that dmu_sync-ed blocks have been stitched
+		 * into the respective datasets. We do not do this if
+		 * resilvers have been deferred.
+		 */
+		if (dsl_scan_resilvering(spa_get_dsl(spa)) &&
+		    spa_feature_is_enabled(spa, SPA_FEATURE_RESILVER_DEFER))
+			vdev_set_deferred_resilver(spa, newvd);
+		else
+			dsl_resilver_restart(spa->spa_dsl_pool, dtl_max_txg);
+	}
 
 	if (spa->spa_bootfs)
 		spa_event_notify(spa, newvd, NULL, ESC_ZFS_BOOTFS_VDEV_ATTACH);
@@ -6295,10 +6454,11 @@ spa_vdev_attach(spa_t *spa, uint64_t guid, nvlist_t *nvroot, int replacing)
 	(void) spa_vdev_exit(spa, newrootvd, dtl_max_txg, 0);
 
 	spa_history_log_internal(spa, "vdev attach", NULL,
-	    "%s vdev=%s %s vdev=%s",
+	    "%s vdev=%s %s vdev=%s (%s)",
 	    replacing && newvd_isspare ? "spare in" :
 	    replacing ? "replace" : "attach", newvdpath,
-	    replacing ? "for" : "to", oldvdpath);
+	    replacing ? "for" : "to", oldvdpath,
+	    rebuild ? "sequential" : "healing");
 
 	spa_strfree(oldvdpath);
 	spa_strfree(newvdpath);
@@ -6325,7 +6485,7 @@ spa_vdev_detach(spa_t *spa, uint64_t guid, uint64_t pguid, int replace_done)
 
 	ASSERT(spa_writeable(spa));
 
-	txg = spa_vdev_enter(spa);
+	txg = spa_vdev_detach_enter(spa, guid);
 
 	vd = spa_lookup_by_guid(spa, guid, B_FALSE);
 
@@ -7360,6 +7520,19 @@ spa_scan(spa_t *spa, pool_scan_func_t func)
 	if (func >= POOL_SCAN_FUNCS || func == POOL_SCAN_NONE)
 		return (SET_ERROR(ENOTSUP));
 
+	/*
+	 * Sequential rebuilds are only started by spa_vdev_attach().
+	 */
+	if (func == POOL_SCAN_REBUILD)
+		return (SET_ERROR(ENOTSUP));
+
+	/*
+	 * A scrub or healing resilver cannot run concurrently with a
+	 * sequential rebuild.  One is started once the rebuild completes.
+	 */
+	if (vdev_rebuild_active(spa->spa_root_vdev))
+		return (SET_ERROR(EBUSY));
+
 	if (func == POOL_SCAN_RESILVER &&
 	    !spa_feature_is_enabled(spa, SPA_FEATURE_RESILVER_DEFER))
 		return (SET_ERROR(ENOTSUP));
@@ -7515,14 +7688,53 @@ spa_async_thread(void *arg)
 	if (tasks & SPA_ASYNC_RESILVER_DONE)
 		spa_vdev_resilver_done(spa);
 
+	/*
+	 * Start or restart any sequential rebuilds requested by
+	 * spa_vdev_attach(), or pending from before the pool was imported.
+	 * A running scrub is canceled since it would duplicate the work.
+	 */
+	if (tasks & (SPA_ASYNC_REBUILD | SPA_ASYNC_RESILVER)) {
+		vdev_t *rvd = spa->spa_root_vdev;
+
+		mutex_enter(&spa_namespace_lock);
+		spa_config_enter(spa, SCL_CONFIG, FTAG, RW_READER);
+		for (uint64_t i = 0; i < rvd->vdev_children; i++)
+			vdev_rebuild(rvd->vdev_child[i]);
+		vdev_rebuild_restart(spa);
+		spa_config_exit(spa, SCL_CONFIG, FTAG);
+		mutex_exit(&spa_namespace_lock);
+
+		if (vdev_rebuild_active(rvd) && dsl_scan_scrubbing(dp))
+			(void) dsl_scan_cancel(dp);
+	}
+
 	/*
 	 * Kick off a resilver.
 	 */
 	if (tasks & SPA_ASYNC_RESILVER &&
+	    !vdev_rebuild_active(spa->spa_root_vdev) &&
 	    (!dsl_scan_resilvering(dp) ||
 	    !spa_feature_is_enabled(dp->dp_spa, SPA_FEATURE_RESILVER_DEFER)))
 		dsl_resilver_restart(dp, 0);
 
+	/*
+	 * A sequential rebuild has finished.  Detach any replaced devices
+	 * and, once no rebuilds remain, verify the rebuilt data with a
+	 * scrub (or resilver any DTLs which could not be rebuilt).
+	 */
+	if (tasks & SPA_ASYNC_REBUILD_DONE) {
+		spa_vdev_resilver_done(spa);
+
+		if (!vdev_rebuild_active(spa->spa_root_vdev)) {
+			if (zfs_rebuild_scrub_enabled) {
+				(void) dsl_scan(dp, POOL_SCAN_SCRUB);
+			} else if (vdev_resilver_needed(spa->spa_root_vdev,
+			    NULL, NULL)) {
+				spa_async_request(spa, SPA_ASYNC_RESILVER);
+			}
+		}
+	}
+
 	if (tasks & SPA_ASYNC_INITIALIZE_RESTART) {
 		mutex_enter(&spa_namespace_lock);
 		spa_config_enter(spa, SCL_CONFIG, FTAG, RW_READER);
@@ -8307,6 +8519,7 @@ spa_sync_iterate_to_convergence(spa_t *spa, dmu_tx_t *tx)
 		}
 
 		ddt_sync(spa, txg);
+		brt_sync(spa, txg);
 		dsl_scan_sync(dp, tx);
 		svr_sync(spa, tx);
 		spa_sync_upgrades(spa, tx);
@@ -8499,6 +8712,12 @@ spa_sync(spa_t *spa, uint64_t txg)
 		}
 	}
 
+	/*
+	 * Add the blocks cloned in this txg to the BRT before anything
+	 * is freed, so that frees of the clones find their entries.
+	 */
+	brt_pending_apply(spa, txg);
+
 	spa_sync_adjust_vdev_max_queue_depth(spa);
 
 	spa_sync_condense_indirect(spa, tx);
@@ -38,6 +38,7 @@
 #include <sys/dmu_tx.h>
 #include <sys/dsl_dir.h>
 #include <sys/vdev_impl.h>
+#include <sys/vdev_draid.h>
 #include <sys/uberblock_impl.h>
 #include <sys/metaslab.h>
 #include <sys/metaslab_impl.h>
@@ -193,6 +194,8 @@ vdev_dbgmsg_print_tree(vdev_t *vd, int indent)
 static vdev_ops_t *vdev_ops_table[] = {
 	&vdev_root_ops,
 	&vdev_raidz_ops,
+	&vdev_draid_ops,
+	&vdev_draid_spare_ops,
 	&vdev_mirror_ops,
 	&vdev_replacing_ops,
 	&vdev_spare_ops,
@@ -221,7 +224,7 @@ vdev_getops(const char *type)
 
 /* ARGSUSED */
 void
-vdev_default_xlate(vdev_t *vd, const range_seg_t *in, range_seg_t *res)
+vdev_default_xlate(vdev_t *vd, const range_seg64_t *in, range_seg64_t *res)
 {
 	res->rs_start = in->rs_start;
 	res->rs_end = in->rs_end;
@@ -297,6 +300,13 @@ vdev_get_min_asize(vdev_t *vd)
 		return ((pvd->vdev_min_asize + pvd->vdev_children - 1) /
 		    pvd->vdev_children);
 
+	/*
+	 * Each child of a dRAID vdev must provide enough rows to hold its
+	 * share of the redundancy groups.
+	 */
+	if (pvd->vdev_ops == &vdev_draid_ops)
+		return (vdev_draid_min_asize(pvd));
+
 	return (pvd->vdev_min_asize);
 }
 
@@ -533,7 +543,8 @@ vdev_alloc_common(spa_t *spa, uint_t id, uint64_t guid, vdev_ops_t *ops)
 
 	rw_init(&vd->vdev_indirect_rwlock, NULL, RW_DEFAULT, NULL);
 	mutex_init(&vd->vdev_obsolete_lock, NULL, MUTEX_DEFAULT, NULL);
-	vd->vdev_obsolete_segments = range_tree_create(NULL, NULL);
+	vd->vdev_obsolete_segments = range_tree_create(NULL, RANGE_SEG64, NULL,
+	    0, 0);
 
 	/*
 	 * Initialize rate limit structs for events.  We rate limit ZIO delay
@@ -565,8 +576,15 @@ vdev_alloc_common(spa_t *spa, uint_t id, uint64_t guid, vdev_ops_t *ops)
 	cv_init(&vd->vdev_autotrim_cv, NULL, CV_DEFAULT, NULL);
 	cv_init(&vd->vdev_trim_io_cv, NULL, CV_DEFAULT, NULL);
 
+	mutex_init(&vd->vdev_rebuild_lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_init(&vd->vdev_rebuild_config.vr_io_lock, NULL,
+	    MUTEX_DEFAULT, NULL);
+	cv_init(&vd->vdev_rebuild_cv, NULL, CV_DEFAULT, NULL);
+	cv_init(&vd->vdev_rebuild_config.vr_io_cv, NULL, CV_DEFAULT, NULL);
+
 	for (int t = 0; t < DTL_TYPES; t++) {
-		vd->vdev_dtl[t] = range_tree_create(NULL, NULL);
+		vd->vdev_dtl[t] = range_tree_create(NULL, RANGE_SEG64, NULL, 0,
+		    0);
 	}
 	txg_list_create(&vd->vdev_ms_list, spa,
 	    offsetof(struct metaslab, ms_txg_node));
@@ -593,6 +611,7 @@ vdev_alloc(spa_t *spa, vdev_t **vdp, nvlist_t *nv, vdev_t *parent, uint_t id,
 	uint64_t guid = 0, islog, nparity;
 	vdev_t *vd;
 	vdev_indirect_config_t *vic;
+	vdev_draid_config_t *vdc = NULL;
 	char *tmp = NULL;
 	int rc;
 	vdev_alloc_bias_t alloc_bias = VDEV_BIAS_NONE;
@@ -678,6 +697,21 @@ vdev_alloc(spa_t *spa, vdev_t **vdp, nvlist_t *nv, vdev_t *parent, uint_t id,
 			 */
 			nparity = 1;
 		}
+	} else if (ops == &vdev_draid_ops) {
+		/*
+		 * dRAID vdevs are always top-level and must specify their
+		 * parity and layout.  They may not be used as log devices.
+		 */
+		if (!top_level || nvlist_lookup_uint64(nv,
+		    ZPOOL_CONFIG_NPARITY, &nparity) != 0)
+			return (SET_ERROR(EINVAL));
+
+		if (islog)
+			return (SET_ERROR(ENOTSUP));
+
+		rc = vdev_draid_config_create(nv, nparity, &vdc);
+		if (rc != 0)
+			return (rc);
 	} else {
 		nparity = 0;
 	}
@@ -702,11 +736,21 @@ vdev_alloc(spa_t *spa, vdev_t **vdp, nvlist_t *nv, vdev_t *parent, uint_t id,
 		}
 	}
 
+	/* spa_vdev_add() expects feature to be enabled */
+	if (ops == &vdev_draid_ops && alloctype == VDEV_ALLOC_ADD &&
+	    spa->spa_load_state != SPA_LOAD_CREATE &&
+	    !spa_feature_is_enabled(spa, SPA_FEATURE_DRAID)) {
+		vdev_draid_config_destroy(vdc);
+		return (SET_ERROR(ENOTSUP));
+	}
+
 	vd = vdev_alloc_common(spa, id, guid, ops);
 	vic = &vd->vdev_indirect_config;
 
 	vd->vdev_islog = islog;
 	vd->vdev_nparity = nparity;
+	if (ops == &vdev_draid_ops)
+		vd->vdev_tsd = vdc;
 	if (top_level && alloc_bias != VDEV_BIAS_NONE)
 		vd->vdev_alloc_bias = alloc_bias;
 
@@ -837,6 +881,9 @@ vdev_alloc(spa_t *spa, vdev_t **vdp, nvlist_t *nv, vdev_t *parent, uint_t id,
 		(void) nvlist_lookup_uint64(nv, ZPOOL_CONFIG_RESILVER_TXG,
 		    &vd->vdev_resilver_txg);
 
+		(void) nvlist_lookup_uint64(nv, ZPOOL_CONFIG_REBUILD_TXG,
+		    &vd->vdev_rebuild_txg);
+
 		if (nvlist_exists(nv, ZPOOL_CONFIG_RESILVER_DEFER))
 			vdev_set_deferred_resilver(spa, vd);
 
@@ -950,6 +997,11 @@ vdev_free(vdev_t *vd)
 	vdev_queue_fini(vd);
 	vdev_cache_fini(vd);
 
+	if (vd->vdev_ops == &vdev_draid_ops) {
+		vdev_draid_config_destroy(vd->vdev_tsd);
+		vd->vdev_tsd = NULL;
+	}
+
 	if (vd->vdev_path)
 		spa_strfree(vd->vdev_path);
 	if (vd->vdev_devid)
@@ -1011,6 +1063,11 @@ vdev_free(vdev_t *vd)
 	cv_destroy(&vd->vdev_autotrim_cv);
 	cv_destroy(&vd->vdev_trim_io_cv);
 
+	mutex_destroy(&vd->vdev_rebuild_lock);
+	mutex_destroy(&vd->vdev_rebuild_config.vr_io_lock);
+	cv_destroy(&vd->vdev_rebuild_cv);
+	cv_destroy(&vd->vdev_rebuild_config.vr_io_cv);
+
 	zfs_ratelimit_fini(&vd->vdev_delay_rl);
 	zfs_ratelimit_fini(&vd->vdev_checksum_rl);
 
@@ -1061,6 +1118,19 @@ vdev_top_transfer(vdev_t *svd, vdev_t *tvd)
 	tvd->vdev_alloc_bias = svd->vdev_alloc_bias;
 	svd->vdev_alloc_bias = VDEV_BIAS_NONE;
 
+	/*
+	 * The rebuild state lives in the top-level ZAP and moves with it.
+	 * Any rebuild thread must have been stopped by the caller.
+	 */
+	ASSERT3P(svd->vdev_rebuild_thread, ==, NULL);
+	ASSERT3P(tvd->vdev_rebuild_thread, ==, NULL);
+	tvd->vdev_rebuild_config.vr_rebuild_phys =
+	    svd->vdev_rebuild_config.vr_rebuild_phys;
+	tvd->vdev_rebuild_config.vr_prev_scan_time_ms =
+	    svd->vdev_rebuild_config.vr_prev_scan_time_ms;
+	bzero(&svd->vdev_rebuild_config.vr_rebuild_phys,
+	    sizeof (vdev_rebuild_phys_t));
+
 	tvd->vdev_stat.vs_alloc = svd->vdev_stat.vs_alloc;
 	tvd->vdev_stat.vs_space = svd->vdev_stat.vs_space;
 	tvd->vdev_stat.vs_dspace = svd->vdev_stat.vs_dspace;
@@ -1284,7 +1354,8 @@ vdev_metaslab_init(vdev_t *vd, uint64_t txg)
 	uint64_t oldc = vd->vdev_ms_count;
 	uint64_t newc = vd->vdev_asize >> vd->vdev_ms_shift;
 	metaslab_t **mspp;
-	int error;
+	uint64_t *objects = NULL;
+	int error = 0;
 	boolean_t expanding = (oldc != 0);
 
 	ASSERT(txg == 0 || spa_config_held(spa, SCL_ALLOC, RW_WRITER));
@@ -1308,24 +1379,40 @@ vdev_metaslab_init(vdev_t *vd, uint64_t txg)
 
 	vd->vdev_ms = mspp;
 	vd->vdev_ms_count = newc;
+
+	/*
+	 * vdev_ms_array may be 0 if we are creating the "fake"
+	 * metaslabs for an indirect vdev for zdb's leak detection.
+	 * See zdb_leak_init().
+	 *
+	 * Otherwise read the space map object numbers of all new metaslabs
+	 * at once and prefetch their dnodes, so that opening the space maps
+	 * below doesn't wait for one synchronous MOS read per metaslab.
+	 */
+	if (txg == 0 && vd->vdev_ms_array != 0 && newc > oldc) {
+		objects = vmem_alloc((newc - oldc) * sizeof (uint64_t),
+		    KM_SLEEP);
+		error = dmu_read(mos, vd->vdev_ms_array,
+		    oldc * sizeof (uint64_t), (newc - oldc) * sizeof (uint64_t),
+		    objects, DMU_READ_PREFETCH);
+		if (error != 0) {
+			vdev_dbgmsg(vd, "unable to read the metaslab "
+			    "array [error=%d]", error);
+			vmem_free(objects, (newc - oldc) * sizeof (uint64_t));
+			return (error);
+		}
+
+		for (m = oldc; m < newc; m++) {
+			dmu_prefetch(mos, objects[m - oldc], 0, 0, 0,
+			    ZIO_PRIORITY_SYNC_READ);
+		}
+	}
+
 	for (m = oldc; m < newc; m++) {
 		uint64_t object = 0;
 
-		/*
-		 * vdev_ms_array may be 0 if we are creating the "fake"
-		 * metaslabs for an indirect vdev for zdb's leak detection.
-		 * See zdb_leak_init().
-		 */
-		if (txg == 0 && vd->vdev_ms_array != 0) {
-			error = dmu_read(mos, vd->vdev_ms_array,
-			    m * sizeof (uint64_t), sizeof (uint64_t), &object,
-			    DMU_READ_PREFETCH);
-			if (error != 0) {
-				vdev_dbgmsg(vd, "unable to read the metaslab "
-				    "array [error=%d]", error);
-				return (error);
-			}
-		}
+		if (objects != NULL)
+			object = objects[m - oldc];
 
 #ifndef _KERNEL
 		/*
@@ -1343,10 +1430,15 @@ vdev_metaslab_init(vdev_t *vd, uint64_t txg)
 		if (error != 0) {
 			vdev_dbgmsg(vd, "metaslab_init failed [error=%d]",
 			    error);
-			return (error);
+			break;
 		}
 	}
 
+	if (objects != NULL)
+		vmem_free(objects, (newc - oldc) * sizeof (uint64_t));
+	if (error != 0)
+		return (error);
+
 	if (txg == 0)
 		spa_config_enter(spa, SCL_ALLOC, FTAG, RW_WRITER);
 
@@ -1365,9 +1457,11 @@ vdev_metaslab_init(vdev_t *vd, uint64_t txg)
 	/*
 	 * Regardless whether this vdev was just added or it is being
 	 * expanded, the metaslab count has changed. Recalculate the
-	 * block limit.
+	 * block limit.  When loading the pool, vdev_load() does so once
+	 * all top-level vdevs, which are loaded in parallel, are done.
 	 */
-	spa_log_sm_set_blocklimit(spa);
+	if (txg != 0)
+		spa_log_sm_set_blocklimit(spa);
 
 	return (0);
 }
@@ -1726,6 +1820,12 @@ vdev_open(vdev_t *vd)
 
 	vd->vdev_removed = B_FALSE;
 
+	/*
+	 * The rotational state of a leaf is only known once it is open.
+	 */
+	if (vd->vdev_ops->vdev_op_leaf)
+		vdev_queue_update_fast(vd);
+
 	/*
 	 * Recheck the faulted flag now that we have confirmed that
 	 * the vdev is accessible.  If we're faulted, bail.
@@ -2405,8 +2505,21 @@ vdev_metaslab_set_size(vdev_t *vd)
 			ms_shift = highbit64(asize / zfs_vdev_ms_count_limit);
 	}
 
+	/*
+	 * Each dRAID metaslab is a single redundancy group which must be
+	 * able to hold the largest possible block.
+	 */
+	if (vd->vdev_ops == &vdev_draid_ops) {
+		ms_shift = MAX(ms_shift,
+		    highbit64(vdev_psize_to_asize(vd, SPA_MAXBLOCKSIZE) - 1));
+	}
+
 	vd->vdev_ms_shift = ms_shift;
 	ASSERT3U(vd->vdev_ms_shift, >=, SPA_MAXBLOCKSHIFT);
+
+	/* The allocatable size of a dRAID vdev depends on the ms_shift. */
+	if (vd->vdev_ops == &vdev_draid_ops)
+		vdev_draid_set_asize(vd);
 }
 
 /*
@@ -2580,14 +2693,11 @@ vdev_dtl_need_resilver(vdev_t *vd, uint64_t offset, size_t psize)
 static uint64_t
 vdev_dtl_min(vdev_t *vd)
 {
-	range_seg_t *rs;
-
 	ASSERT(MUTEX_HELD(&vd->vdev_dtl_lock));
 	ASSERT3U(range_tree_space(vd->vdev_dtl[DTL_MISSING]), !=, 0);
 	ASSERT0(vd->vdev_children);
 
-	rs = avl_first(&vd->vdev_dtl[DTL_MISSING]->rt_root);
-	return (rs->rs_start - 1);
+	return (range_tree_min(vd->vdev_dtl[DTL_MISSING]) - 1);
 }
 
 /*
@@ -2596,14 +2706,11 @@ vdev_dtl_min(vdev_t *vd)
 static uint64_t
 vdev_dtl_max(vdev_t *vd)
 {
-	range_seg_t *rs;
-
 	ASSERT(MUTEX_HELD(&vd->vdev_dtl_lock));
 	ASSERT3U(range_tree_space(vd->vdev_dtl[DTL_MISSING]), !=, 0);
 	ASSERT0(vd->vdev_children);
 
-	rs = avl_last(&vd->vdev_dtl[DTL_MISSING]->rt_root);
-	return (rs->rs_end);
+	return (range_tree_max(vd->vdev_dtl[DTL_MISSING]));
 }
 
 /*
@@ -2615,12 +2722,8 @@ vdev_dtl_max(vdev_t *vd)
  * excise the DTLs.
  */
 static boolean_t
-vdev_dtl_should_excise(vdev_t *vd)
+vdev_dtl_should_excise(vdev_t *vd, boolean_t rebuild_done)
 {
-	spa_t *spa = vd->vdev_spa;
-	dsl_scan_t *scn = spa->spa_dsl_pool->dp_scan;
-
-	ASSERT0(scn->scn_phys.scn_errors);
 	ASSERT0(vd->vdev_children);
 
 	if (vd->vdev_state < VDEV_STATE_DEGRADED)
@@ -2629,23 +2732,52 @@ vdev_dtl_should_excise(vdev_t *vd)
 	if (vd->vdev_resilver_deferred)
 		return (B_FALSE);
 
-	if (vd->vdev_resilver_txg == 0 ||
-	    range_tree_is_empty(vd->vdev_dtl[DTL_MISSING]))
+	if (range_tree_is_empty(vd->vdev_dtl[DTL_MISSING]))
 		return (B_TRUE);
 
-	/*
-	 * When a resilver is initiated the scan will assign the scn_max_txg
-	 * value to the highest txg value that exists in all DTLs. If this
-	 * device's max DTL is not part of this scan (i.e. it is not in
-	 * the range (scn_min_txg, scn_max_txg] then it is not eligible
-	 * for excision.
-	 */
-	if (vdev_dtl_max(vd) <= scn->scn_phys.scn_max_txg) {
-		ASSERT3U(scn->scn_phys.scn_min_txg, <=, vdev_dtl_min(vd));
-		ASSERT3U(scn->scn_phys.scn_min_txg, <, vd->vdev_resilver_txg);
-		ASSERT3U(vd->vdev_resilver_txg, <=, scn->scn_phys.scn_max_txg);
-		return (B_TRUE);
+	if (rebuild_done) {
+		vdev_rebuild_t *vr = &vd->vdev_top->vdev_rebuild_config;
+		vdev_rebuild_phys_t *vrp = &vr->vr_rebuild_phys;
+
+		/* Rebuild not initiated by attach */
+		if (vd->vdev_rebuild_txg == 0)
+			return (B_TRUE);
+
+		/*
+		 * When a rebuild completes without error then all missing data
+		 * up to the rebuild max txg has been reconstructed and the DTL
+		 * is eligible for excision.
+		 */
+		if (vrp->vrp_rebuild_state == VDEV_REBUILD_COMPLETE &&
+		    vdev_dtl_max(vd) <= vrp->vrp_max_txg) {
+			ASSERT3U(vrp->vrp_min_txg, <=, vdev_dtl_min(vd));
+			ASSERT3U(vrp->vrp_min_txg, <, vd->vdev_rebuild_txg);
+			ASSERT3U(vd->vdev_rebuild_txg, <=, vrp->vrp_max_txg);
+			return (B_TRUE);
+		}
+	} else {
+		dsl_scan_t *scn = vd->vdev_spa->spa_dsl_pool->dp_scan;
+		dsl_scan_phys_t *scnp = &scn->scn_phys;
+
+		/* Resilver not initiated by attach */
+		if (vd->vdev_resilver_txg == 0)
+			return (B_TRUE);
+
+		/*
+		 * When a resilver is initiated the scan will assign the
+		 * scn_max_txg value to the highest txg value that exists
+		 * in all DTLs. If this device's max DTL is not part of this
+		 * scan (i.e. it is not in the range (scn_min_txg, scn_max_txg]
+		 * then it is not eligible for excision.
+		 */
+		if (vdev_dtl_max(vd) <= scnp->scn_max_txg) {
+			ASSERT3U(scnp->scn_min_txg, <=, vdev_dtl_min(vd));
+			ASSERT3U(scnp->scn_min_txg, <, vd->vdev_resilver_txg);
+			ASSERT3U(vd->vdev_resilver_txg, <=, scnp->scn_max_txg);
+			return (B_TRUE);
+		}
 	}
+
 	return (B_FALSE);
 }
 
@@ -2654,7 +2786,8 @@ vdev_dtl_should_excise(vdev_t *vd)
  * write operations will be issued to the pool.
  */
 void
-vdev_dtl_reassess(vdev_t *vd, uint64_t txg, uint64_t scrub_txg, int scrub_done)
+vdev_dtl_reassess(vdev_t *vd, uint64_t txg, uint64_t scrub_txg,
+    boolean_t scrub_done, boolean_t rebuild_done)
 {
 	spa_t *spa = vd->vdev_spa;
 	avl_tree_t reftree;
@@ -2664,7 +2797,7 @@ vdev_dtl_reassess(vdev_t *vd, uint64_t txg, uint64_t scrub_txg, int scrub_done)
 
 	for (int c = 0; c < vd->vdev_children; c++)
 		vdev_dtl_reassess(vd->vdev_child[c], txg,
-		    scrub_txg, scrub_done);
+		    scrub_txg, scrub_done, rebuild_done);
 
 	if (vd == spa->spa_root_vdev || !vdev_is_concrete(vd) || vd->vdev_aux)
 		return;
@@ -2672,24 +2805,36 @@ vdev_dtl_reassess(vdev_t *vd, uint64_t txg, uint64_t scrub_txg, int scrub_done)
 	if (vd->vdev_ops->vdev_op_leaf) {
 		dsl_scan_t *scn = spa->spa_dsl_pool->dp_scan;
 
+		vdev_rebuild_t *vr = &vd->vdev_top->vdev_rebuild_config;
+		boolean_t check_excise = B_FALSE;
+
 		mutex_enter(&vd->vdev_dtl_lock);
 
 		/*
-		 * If requested, pretend the scan completed cleanly.
+		 * If requested, pretend the scan or rebuild completed cleanly.
 		 */
-		if (zfs_scan_ignore_errors && scn)
-			scn->scn_phys.scn_errors = 0;
+		if (zfs_scan_ignore_errors) {
+			if (scn != NULL)
+				scn->scn_phys.scn_errors = 0;
+			if (rebuild_done)
+				vr->vr_rebuild_phys.vrp_errors = 0;
+		}
 
 		/*
-		 * If we've completed a scan cleanly then determine
+		 * If we've completed a scan or rebuild cleanly then determine
 		 * if this vdev should remove any DTLs. We only want to
 		 * excise regions on vdevs that were available during
 		 * the entire duration of this scan.
 		 */
-		if (scrub_txg != 0 &&
-		    (spa->spa_scrub_started ||
-		    (scn != NULL && scn->scn_phys.scn_errors == 0)) &&
-		    vdev_dtl_should_excise(vd)) {
+		if (rebuild_done) {
+			check_excise = (vr->vr_rebuild_phys.vrp_errors == 0);
+		} else {
+			check_excise = (spa->spa_scrub_started ||
+			    (scn != NULL && scn->scn_phys.scn_errors == 0));
+		}
+
+		if (scrub_txg != 0 && check_excise &&
+		    vdev_dtl_should_excise(vd, rebuild_done)) {
 			/*
 			 * We completed a scrub up to scrub_txg.  If we
 			 * did it without rebooting, then the scrub dtl
@@ -2730,15 +2875,20 @@ vdev_dtl_reassess(vdev_t *vd, uint64_t txg, uint64_t scrub_txg, int scrub_done)
 			    range_tree_add, vd->vdev_dtl[DTL_OUTAGE]);
 
 		/*
-		 * If the vdev was resilvering and no longer has any
-		 * DTLs then reset its resilvering flag and dirty
+		 * If the vdev was resilvering or rebuilding and no longer
+		 * has any DTLs then reset the appropriate flag and dirty
 		 * the top level so that we persist the change.
 		 */
-		if (txg != 0 && vd->vdev_resilver_txg != 0 &&
+		if (txg != 0 &&
 		    range_tree_is_empty(vd->vdev_dtl[DTL_MISSING]) &&
 		    range_tree_is_empty(vd->vdev_dtl[DTL_OUTAGE])) {
-			vd->vdev_resilver_txg = 0;
-			vdev_config_dirty(vd->vdev_top);
+			if (vd->vdev_rebuild_txg != 0) {
+				vd->vdev_rebuild_txg = 0;
+				vdev_config_dirty(vd->vdev_top);
+			} else if (vd->vdev_resilver_txg != 0) {
+				vd->vdev_resilver_txg = 0;
+				vdev_config_dirty(vd->vdev_top);
+			}
 		}
 
 		mutex_exit(&vd->vdev_dtl_lock);
@@ -2868,6 +3018,10 @@ vdev_construct_zaps(vdev_t *vd, dmu_tx_t *tx)
 			vd->vdev_top_zap = vdev_create_link_zap(vd, tx);
 			if (vd->vdev_alloc_bias != VDEV_BIAS_NONE)
 				vdev_zap_allocation_data(vd, tx);
+			if (vd->vdev_ops == &vdev_draid_ops) {
+				spa_feature_incr(vd->vdev_spa,
+				    SPA_FEATURE_DRAID, tx);
+			}
 		}
 	}
 
@@ -2924,7 +3078,7 @@ vdev_dtl_sync(vdev_t *vd, uint64_t txg)
 		ASSERT(vd->vdev_dtl_sm != NULL);
 	}
 
-	rtsync = range_tree_create(NULL, NULL);
+	rtsync = range_tree_create(NULL, RANGE_SEG64, NULL, 0, 0);
 
 	mutex_enter(&vd->vdev_dtl_lock);
 	range_tree_walk(rt, range_tree_add, rtsync);
@@ -2974,10 +3128,10 @@ vdev_dtl_required(vdev_t *vd)
 	 * If not, we can safely offline/detach/remove the device.
 	 */
 	vd->vdev_cant_read = B_TRUE;
-	vdev_dtl_reassess(tvd, 0, 0, B_FALSE);
+	vdev_dtl_reassess(tvd, 0, 0, B_FALSE, B_FALSE);
 	required = !vdev_dtl_empty(tvd, DTL_OUTAGE);
 	vd->vdev_cant_read = cant_read;
-	vdev_dtl_reassess(tvd, 0, 0, B_FALSE);
+	vdev_dtl_reassess(tvd, 0, 0, B_FALSE, B_FALSE);
 
 	if (!required && zio_injection_enabled)
 		required = !!zio_handle_device_injection(vd, NULL, ECHILD);
@@ -3050,21 +3204,58 @@ vdev_checkpoint_sm_object(vdev_t *vd, uint64_t *sm_obj)
 	return (error);
 }
 
+static void
+vdev_load_child(void *arg)
+{
+	vdev_t *vd = arg;
+
+	vd->vdev_load_error = vdev_load(vd);
+}
+
 int
 vdev_load(vdev_t *vd)
 {
+	int children = vd->vdev_children;
 	int error = 0;
+	taskq_t *tq = NULL;
+
+	/*
+	 * Load the top-level vdevs in parallel; most of the time goes to
+	 * reading their metaslab space maps and DTLs.  As in
+	 * vdev_open_children(), vdevs backed by zvols are loaded by this
+	 * thread.
+	 */
+	if (vd == vd->vdev_spa->spa_root_vdev && children > 1) {
+		tq = taskq_create("vdev_load", children, minclsyspri,
+		    children, children, TASKQ_PREPOPULATE);
+	}
 
 	/*
 	 * Recursively load all children.
 	 */
-	for (int c = 0; c < vd->vdev_children; c++) {
-		error = vdev_load(vd->vdev_child[c]);
-		if (error != 0) {
-			return (error);
+	for (int c = 0; c < children; c++) {
+		vdev_t *cvd = vd->vdev_child[c];
+
+		if (tq == NULL || vdev_uses_zvols(cvd)) {
+			cvd->vdev_load_error = vdev_load(cvd);
+		} else {
+			VERIFY(taskq_dispatch(tq, vdev_load_child,
+			    cvd, TQ_SLEEP) != TASKQID_INVALID);
 		}
 	}
 
+	if (tq != NULL)
+		taskq_destroy(tq);
+
+	for (int c = 0; c < children; c++) {
+		error = vd->vdev_child[c]->vdev_load_error;
+		if (error != 0)
+			return (error);
+	}
+
+	if (vd == vd->vdev_spa->spa_root_vdev)
+		spa_log_sm_set_blocklimit(vd->vdev_spa);
+
 	vdev_set_deflate_ratio(vd);
 
 	/*
@@ -3082,6 +3273,20 @@ vdev_load(vdev_t *vd)
 		}
 	}
 
+	/*
+	 * Load any rebuild state from the top-level vdev zap.
+	 */
+	if (vd == vd->vdev_top && vdev_is_concrete(vd)) {
+		error = vdev_rebuild_load(vd);
+		if (error) {
+			vdev_set_state(vd, B_FALSE, VDEV_STATE_CANT_OPEN,
+			    VDEV_AUX_CORRUPT_DATA);
+			vdev_dbgmsg(vd, "vdev_load: vdev_rebuild_load "
+			    "failed [error=%d]", error);
+			return (error);
+		}
+	}
+
 	/*
 	 * If this is a top-level vdev, initialize its metaslabs.
 	 */
@@ -3133,8 +3338,9 @@ vdev_load(vdev_t *vd)
 			 */
 			vd->vdev_stat.vs_checkpoint_space =
 			    -space_map_allocated(vd->vdev_checkpoint_sm);
-			vd->vdev_spa->spa_checkpoint_info.sci_dspace +=
-			    vd->vdev_stat.vs_checkpoint_space;
+			atomic_add_64(
+			    &vd->vdev_spa->spa_checkpoint_info.sci_dspace,
+			    vd->vdev_stat.vs_checkpoint_space);
 		} else if (error != 0) {
 			vdev_dbgmsg(vd, "vdev_load: failed to retrieve "
 			    "checkpoint space map object from vdev ZAP "
@@ -3960,6 +4166,12 @@ vdev_get_stats_ex_impl(vdev_t *vd, vdev_stat_t *vs, vdev_stat_ex_t *vsx)
 			    vd->vdev_queue.vq_class[t].vqc_active;
 			vsx->vsx_pend_queue[t] = avl_numnodes(
 			    &vd->vdev_queue.vq_class[t].vqc_queued_tree);
+
+			/* i/os of the fast queue mode are only counted */
+			vsx->vsx_active_queue[t] +=
+			    vd->vdev_queue.vq_fast_active[t];
+			vsx->vsx_pend_queue[t] +=
+			    vd->vdev_queue.vq_fast_queued[t];
 		}
 	}
 }
@@ -4115,6 +4327,22 @@ vdev_stat_update(zio_t *zio, uint64_t psize)
 				vs->vs_scan_processed += psize;
 			}
 
+			/*
+			 * Repair is the result of a rebuild issued by
+			 * vdev_rebuild_thread().  Rebuild repair writes
+			 * inherit ZIO_FLAG_RESILVER but not SCAN_THREAD.
+			 */
+			if ((flags & ZIO_FLAG_RESILVER) &&
+			    !(flags & ZIO_FLAG_SCAN_THREAD)) {
+				if (vd->vdev_ops->vdev_op_leaf) {
+					vdev_rebuild_t *vr =
+					    &vd->vdev_top->vdev_rebuild_config;
+					atomic_add_64(&vr->vr_rebuild_phys.
+					    vrp_bytes_rebuilt, psize);
+				}
+				vs->vs_scan_processed += psize;
+			}
+
 			if (flags & ZIO_FLAG_SELF_HEAL)
 				vs->vs_self_healed += psize;
 		}
@@ -4181,6 +4409,19 @@ vdev_stat_update(zio_t *zio, uint64_t psize)
 	if (zio->io_vd == NULL && (zio->io_flags & ZIO_FLAG_DONT_PROPAGATE))
 		return;
 
+	/*
+	 * A failed rebuild repair write leaves the new leaf without a
+	 * valid copy, so count it against the rebuild to prevent its
+	 * DTL from being excised when the rebuild completes.
+	 */
+	if (type == ZIO_TYPE_WRITE && (flags & ZIO_FLAG_IO_REPAIR) &&
+	    (flags & ZIO_FLAG_RESILVER) && !(flags & ZIO_FLAG_SCAN_THREAD) &&
+	    vd->vdev_ops->vdev_op_leaf) {
+		vdev_rebuild_t *vr = &vd->vdev_top->vdev_rebuild_config;
+
+		atomic_inc_64(&vr->vr_rebuild_phys.vrp_errors);
+	}
+
 	if (spa->spa_load_state == SPA_LOAD_NONE &&
 	    type == ZIO_TYPE_WRITE && txg != 0 &&
 	    (!(flags & ZIO_FLAG_IO_REPAIR) ||
@@ -4763,6 +5004,8 @@ vdev_deadman(vdev_t *vd, char *tag)
 				zio_deadman(fio, tag);
 		}
 		mutex_exit(&vq->vq_lock);
+
+		vdev_queue_fast_deadman(vd, tag);
 	}
 }
 
@@ -4790,7 +5033,8 @@ vdev_set_deferred_resilver(spa_t *spa, vdev_t *vd)
  * translation function to do the real conversion.
  */
 void
-vdev_xlate(vdev_t *vd, const range_seg_t *logical_rs, range_seg_t *physical_rs)
+vdev_xlate(vdev_t *vd, const range_seg64_t *logical_rs,
+    range_seg64_t *physical_rs)
 {
 	/*
 	 * Walk up the vdev tree
@@ -4817,7 +5061,7 @@ vdev_xlate(vdev_t *vd, const range_seg_t *logical_rs, range_seg_t *physical_rs)
 	 * range into its physical components by calling the
 	 * vdev specific translate function.
 	 */
-	range_seg_t intermediate = { { { 0, 0 } } };
+	range_seg64_t intermediate = { 0 };
 	pvd->vdev_ops->vdev_op_xlate(vd, physical_rs, &intermediate);
 
 	physical_rs->rs_start = intermediate.rs_start;
@@ -0,0 +1,1025 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/spa.h>
+#include <sys/spa_impl.h>
+#include <sys/vdev_impl.h>
+#include <sys/vdev_draid.h>
+#include <sys/vdev_raidz.h>
+#include <sys/vdev_raidz_impl.h>
+#include <sys/zio.h>
+#include <sys/abd.h>
+#include <sys/fs/zfs.h>
+
+/*
+ * dRAID is a distributed spare implementation for ZFS.  A dRAID vdev is
+ * comprised of multiple raidz redundancy groups which are spread over the
+ * dRAID children.  To ensure an even distribution, and avoid hot spots, a
+ * permutation mapping is applied to the order of the dRAID children.
+ * This mixing effectively distributes the parity columns evenly over all
+ * of the disks in the dRAID.
+ *
+ * This is beneficial because it means when resilvering all of the disks
+ * can participate thereby increasing the available IOPs and bandwidth.
+ * Furthermore, by reserving a small fraction of each child's capacity
+ * dRAID can provide "distributed spare" capacity.  These spares can be
+ * swapped in for a failed disk and then sequentially rebuilt using all
+ * of the surviving disks, rather than being limited by the write
+ * bandwidth of a single replacement disk.
+ *
+ * The layout is described by the following parameters:
+ *
+ *   children  - The total number of child vdevs (at most 255).
+ *   nspares   - The number of distributed spares.
+ *   ndisks    - children - nspares, the disks holding data and parity.
+ *   width     - ndata + nparity, the columns in a redundancy group.
+ *
+ * Each metaslab of a dRAID vdev is exactly one redundancy group.  Its
+ * space is divided into 'width' columns of 'rows' sectors each, where
+ * rows = (metaslab size / sector size) / width.  Every allocation is a
+ * multiple of 'width' sectors, so blocks always begin on a row boundary
+ * and occupy full stripes; short data columns are zero padded on disk.
+ * This fixed stripe width is what allows a dRAID vdev to be rebuilt
+ * sequentially, see vdev_rebuild.c.
+ *
+ * Redundancy groups are packed onto the children in "slices".  A slice
+ * contains ngroups = lcm(width, ndisks) / width groups laid out back to
+ * back over ndisks columns, which takes slicerows = lcm / ndisks group
+ * rows.  Each slice uses one of VDEV_DRAID_NPERMS permutations of the
+ * children: positions [0, ndisks) receive the groups while the last
+ * nspares positions are the distributed spare capacity for the slice.
+ *
+ * The permutations are generated from a fixed seed and the number of
+ * children.  They are part of the on-disk format and must never change.
+ */
+
+/*
+ * Returns the next value from a 64-bit splitmix generator.  It is used to
+ * shuffle the permutations and must always produce the same sequence.
+ */
+static uint64_t
+vdev_draid_rand(uint64_t *s)
+{
+	uint64_t z = (*s += 0x9e3779b97f4a7c15ULL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+	return (z ^ (z >> 31));
+}
+
+static uint64_t
+vdev_draid_gcd(uint64_t a, uint64_t b)
+{
+	while (b != 0) {
+		uint64_t t = a % b;
+		a = b;
+		b = t;
+	}
+
+	return (a);
+}
+
+/*
+ * Generate the permutations, and their inverses, with a Fisher-Yates
+ * shuffle of the child indices.
+ */
+static void
+vdev_draid_generate_perms(vdev_draid_config_t *vdc)
+{
+	uint64_t children = vdc->vdc_children;
+	uint64_t seed = VDEV_DRAID_SEED ^ children;
+
+	for (uint64_t p = 0; p < vdc->vdc_nperms; p++) {
+		uint8_t *perm = &vdc->vdc_perms[p * children];
+		uint8_t *invperm = &vdc->vdc_invperms[p * children];
+
+		for (uint64_t i = 0; i < children; i++)
+			perm[i] = i;
+
+		for (uint64_t i = children - 1; i > 0; i--) {
+			uint64_t j = vdev_draid_rand(&seed) % (i + 1);
+			uint8_t tmp = perm[i];
+
+			perm[i] = perm[j];
+			perm[j] = tmp;
+		}
+
+		for (uint64_t i = 0; i < children; i++)
+			invperm[perm[i]] = i;
+	}
+}
+
+/*
+ * Validate the dRAID layout described by the vdev's config nvlist and
+ * construct the in-core configuration for it.
+ */
+int
+vdev_draid_config_create(nvlist_t *nv, uint64_t nparity,
+    vdev_draid_config_t **vdcp)
+{
+	vdev_draid_config_t *vdc;
+	nvlist_t **child;
+	uint_t children;
+	uint64_t ndata, nspares, ndisks, width, lcm;
+
+	if (nvlist_lookup_nvlist_array(nv, ZPOOL_CONFIG_CHILDREN,
+	    &child, &children) != 0 ||
+	    nvlist_lookup_uint64(nv, ZPOOL_CONFIG_DRAID_NDATA, &ndata) != 0 ||
+	    nvlist_lookup_uint64(nv, ZPOOL_CONFIG_DRAID_NSPARES,
+	    &nspares) != 0)
+		return (SET_ERROR(EINVAL));
+
+	if (nparity == 0 || nparity > VDEV_DRAID_MAXPARITY || ndata == 0 ||
+	    children > VDEV_DRAID_MAX_CHILDREN || nspares >= children)
+		return (SET_ERROR(EINVAL));
+
+	ndisks = children - nspares;
+	width = ndata + nparity;
+	if (width > ndisks)
+		return (SET_ERROR(EINVAL));
+
+	lcm = width / vdev_draid_gcd(width, ndisks) * ndisks;
+
+	vdc = kmem_zalloc(sizeof (vdev_draid_config_t), KM_SLEEP);
+	vdc->vdc_ndata = ndata;
+	vdc->vdc_nparity = nparity;
+	vdc->vdc_nspares = nspares;
+	vdc->vdc_children = children;
+	vdc->vdc_ndisks = ndisks;
+	vdc->vdc_groupwidth = width;
+	vdc->vdc_ngroups = lcm / width;
+	vdc->vdc_slicerows = lcm / ndisks;
+	vdc->vdc_nperms = VDEV_DRAID_NPERMS;
+	vdc->vdc_perms = kmem_alloc(vdc->vdc_nperms * children, KM_SLEEP);
+	vdc->vdc_invperms = kmem_alloc(vdc->vdc_nperms * children, KM_SLEEP);
+
+	vdev_draid_generate_perms(vdc);
+
+	*vdcp = vdc;
+
+	return (0);
+}
+
+void
+vdev_draid_config_destroy(vdev_draid_config_t *vdc)
+{
+	kmem_free(vdc->vdc_perms, vdc->vdc_nperms * vdc->vdc_children);
+	kmem_free(vdc->vdc_invperms, vdc->vdc_nperms * vdc->vdc_children);
+	kmem_free(vdc, sizeof (vdev_draid_config_t));
+}
+
+/*
+ * Add the dRAID specific layout to the vdev's config nvlist.  The parity
+ * is stored as ZPOOL_CONFIG_NPARITY by vdev_config_generate().
+ */
+void
+vdev_draid_config_generate(vdev_t *vd, nvlist_t *nv)
+{
+	vdev_draid_config_t *vdc = vd->vdev_tsd;
+
+	ASSERT3P(vd->vdev_ops, ==, &vdev_draid_ops);
+
+	fnvlist_add_uint64(nv, ZPOOL_CONFIG_DRAID_NDATA, vdc->vdc_ndata);
+	fnvlist_add_uint64(nv, ZPOOL_CONFIG_DRAID_NSPARES, vdc->vdc_nspares);
+}
+
+static uint8_t *
+vdev_draid_perm(vdev_draid_config_t *vdc, uint64_t slice)
+{
+	return (&vdc->vdc_perms[(slice % vdc->vdc_nperms) *
+	    vdc->vdc_children]);
+}
+
+static uint8_t *
+vdev_draid_invperm(vdev_draid_config_t *vdc, uint64_t slice)
+{
+	return (&vdc->vdc_invperms[(slice % vdc->vdc_nperms) *
+	    vdc->vdc_children]);
+}
+
+/*
+ * Returns the number of rows, in sectors, in each column of a redundancy
+ * group.  This depends on the metaslab size which must be known.
+ */
+static uint64_t
+vdev_draid_group_rows(vdev_t *vd)
+{
+	vdev_draid_config_t *vdc = vd->vdev_tsd;
+
+	ASSERT3U(vd->vdev_ms_shift, >, vd->vdev_ashift);
+
+	return ((1ULL << (vd->vdev_ms_shift - vd->vdev_ashift)) /
+	    vdc->vdc_groupwidth);
+}
+
+/*
+ * Returns the child which stores column 'col' of redundancy group 'group'
+ * and sets '*rowp' to the group row on that child where the column begins.
+ * Group rows are 'vdev_draid_group_rows()' sectors long.
+ */
+static uint64_t
+vdev_draid_group_child(vdev_draid_config_t *vdc, uint64_t group,
+    uint64_t col, uint64_t *rowp)
+{
+	uint64_t slice = group / vdc->vdc_ngroups;
+	uint64_t pos = (group % vdc->vdc_ngroups) * vdc->vdc_groupwidth + col;
+
+	ASSERT3U(col, <, vdc->vdc_groupwidth);
+
+	*rowp = slice * vdc->vdc_slicerows + pos / vdc->vdc_ndisks;
+
+	return (vdev_draid_perm(vdc, slice)[pos % vdc->vdc_ndisks]);
+}
+
+/*
+ * Returns the number of redundancy groups which fit when every child
+ * provides 'rows' group rows.  Groups in a partial slice are only counted
+ * when all of their columns fit.
+ */
+static uint64_t
+vdev_draid_rows_to_groups(vdev_draid_config_t *vdc, uint64_t rows)
+{
+	return ((rows / vdc->vdc_slicerows) * vdc->vdc_ngroups +
+	    (rows % vdc->vdc_slicerows) * vdc->vdc_ndisks /
+	    vdc->vdc_groupwidth);
+}
+
+/*
+ * Returns the number of group rows every child must provide to store
+ * 'groups' redundancy groups.
+ */
+static uint64_t
+vdev_draid_groups_to_rows(vdev_draid_config_t *vdc, uint64_t groups)
+{
+	return ((groups / vdc->vdc_ngroups) * vdc->vdc_slicerows +
+	    howmany((groups % vdc->vdc_ngroups) * vdc->vdc_groupwidth,
+	    vdc->vdc_ndisks));
+}
+
+/*
+ * Convert the size of the smallest child to the allocatable size of the
+ * dRAID vdev.  Until the metaslab size has been decided an estimate which
+ * ignores the unusable tail of each group is returned, it is replaced with
+ * the exact size by vdev_draid_set_asize().
+ */
+static uint64_t
+vdev_draid_child_to_asize(vdev_t *vd, uint64_t csize, uint64_t ashift)
+{
+	vdev_draid_config_t *vdc = vd->vdev_tsd;
+	uint64_t sectors = csize >> ashift;
+
+	if (vd->vdev_ms_shift == 0)
+		return ((sectors * vdc->vdc_ndisks) << ashift);
+
+	uint64_t rows = (1ULL << (vd->vdev_ms_shift - ashift)) /
+	    vdc->vdc_groupwidth;
+
+	return (vdev_draid_rows_to_groups(vdc, sectors / rows) <<
+	    vd->vdev_ms_shift);
+}
+
+/*
+ * Returns the minimum size each child of the dRAID vdev must provide.
+ */
+uint64_t
+vdev_draid_min_asize(vdev_t *vd)
+{
+	vdev_draid_config_t *vdc = vd->vdev_tsd;
+
+	ASSERT3P(vd->vdev_ops, ==, &vdev_draid_ops);
+
+	if (vd->vdev_ms_shift == 0) {
+		return (P2ROUNDUP(howmany(vd->vdev_min_asize, vdc->vdc_ndisks),
+		    1ULL << vd->vdev_ashift));
+	}
+
+	uint64_t groups = vd->vdev_min_asize >> vd->vdev_ms_shift;
+
+	return ((vdev_draid_groups_to_rows(vdc, groups) *
+	    vdev_draid_group_rows(vd)) << vd->vdev_ashift);
+}
+
+/*
+ * Compute the allocatable size from the smallest and largest children.
+ */
+static void
+vdev_draid_calculate_asize(vdev_t *vd, uint64_t ashift, uint64_t *asize,
+    uint64_t *max_asize)
+{
+	uint64_t csize = 0, max_csize = 0;
+
+	for (uint64_t c = 0; c < vd->vdev_children; c++) {
+		vdev_t *cvd = vd->vdev_child[c];
+
+		if (cvd->vdev_open_error != 0)
+			continue;
+
+		csize = MIN(csize - 1, cvd->vdev_asize - 1) + 1;
+		max_csize = MIN(max_csize - 1, cvd->vdev_max_asize - 1) + 1;
+	}
+
+	*asize = vdev_draid_child_to_asize(vd, csize, ashift);
+	*max_asize = vdev_draid_child_to_asize(vd, max_csize, ashift);
+}
+
+/*
+ * Called once the metaslab size has been decided to replace the estimated
+ * allocatable size with the number of whole redundancy groups which fit.
+ */
+void
+vdev_draid_set_asize(vdev_t *vd)
+{
+	uint64_t asize, max_asize;
+
+	ASSERT3P(vd->vdev_ops, ==, &vdev_draid_ops);
+	ASSERT3U(vd->vdev_ms_shift, !=, 0);
+
+	vdev_draid_calculate_asize(vd, vd->vdev_ashift, &asize, &max_asize);
+
+	vd->vdev_asize = asize;
+	vd->vdev_max_asize = max_asize;
+	vdev_set_min_asize(vd);
+}
+
+static int
+vdev_draid_open(vdev_t *vd, uint64_t *asize, uint64_t *max_asize,
+    uint64_t *ashift, uint64_t *pshift)
+{
+	vdev_draid_config_t *vdc = vd->vdev_tsd;
+	uint64_t nparity = vd->vdev_nparity;
+	int lasterror = 0;
+	int numerrors = 0;
+
+	ASSERT(nparity > 0);
+
+	if (vdc == NULL || vdc->vdc_nparity != nparity ||
+	    vdc->vdc_children != vd->vdev_children) {
+		vd->vdev_stat.vs_aux = VDEV_AUX_BAD_LABEL;
+		return (SET_ERROR(EINVAL));
+	}
+
+	vdev_open_children(vd);
+
+	for (uint64_t c = 0; c < vd->vdev_children; c++) {
+		vdev_t *cvd = vd->vdev_child[c];
+
+		if (cvd->vdev_open_error != 0) {
+			lasterror = cvd->vdev_open_error;
+			numerrors++;
+			continue;
+		}
+
+		*ashift = MAX(*ashift, cvd->vdev_ashift);
+		*pshift = MAX(*pshift, cvd->vdev_physical_ashift);
+	}
+
+	vdev_draid_calculate_asize(vd, MAX(*ashift, vd->vdev_ashift),
+	    asize, max_asize);
+
+	if (numerrors > nparity) {
+		vd->vdev_stat.vs_aux = VDEV_AUX_NO_REPLICAS;
+		return (lasterror);
+	}
+
+	return (0);
+}
+
+static void
+vdev_draid_close(vdev_t *vd)
+{
+	for (uint64_t c = 0; c < vd->vdev_children; c++)
+		vdev_close(vd->vdev_child[c]);
+}
+
+/*
+ * Every allocation is rounded up to a whole number of rows, which means
+ * a multiple of the group width in sectors.
+ */
+static uint64_t
+vdev_draid_asize(vdev_t *vd, uint64_t psize)
+{
+	vdev_draid_config_t *vdc = vd->vdev_tsd;
+	uint64_t ashift = vd->vdev_top->vdev_ashift;
+	uint64_t rows = ((psize - 1) >> ashift) / vdc->vdc_ndata + 1;
+
+	return ((rows * vdc->vdc_groupwidth) << ashift);
+}
+
+/*
+ * Divide the I/O over the columns of its redundancy group.  The returned
+ * map has the same layout as a raidz map so the raidz parity generation,
+ * reconstruction, and completion code can be shared.
+ */
+static raidz_map_t *
+vdev_draid_map_alloc(zio_t *zio)
+{
+	vdev_t *vd = zio->io_vd;
+	vdev_draid_config_t *vdc = vd->vdev_tsd;
+	uint64_t ashift = vd->vdev_top->vdev_ashift;
+	uint64_t nparity = vdc->vdc_nparity;
+	uint64_t width = vdc->vdc_groupwidth;
+	uint64_t group = zio->io_offset >> vd->vdev_ms_shift;
+	uint64_t rows = vdev_draid_group_rows(vd);
+	/* The starting sector of the block within its group. */
+	uint64_t b = (zio->io_offset - (group << vd->vdev_ms_shift)) >> ashift;
+	/* The zio's size in units of the vdev's minimum sector size. */
+	uint64_t s = zio->io_size >> ashift;
+	uint64_t q, r, bc, acols, off;
+	raidz_map_t *rm;
+	int c;
+
+	q = s / vdc->vdc_ndata;
+	r = s - q * vdc->vdc_ndata;
+	bc = (r == 0 ? 0 : r + nparity);
+	acols = (q == 0 ? bc : width);
+
+	ASSERT0(b % width);
+	ASSERT3U(b / width + q + (r != 0), <=, rows);
+
+	rm = kmem_alloc(offsetof(raidz_map_t, rm_col[width]), KM_SLEEP);
+
+	rm->rm_cols = acols;
+	rm->rm_scols = width;
+	rm->rm_bigcols = bc;
+	rm->rm_skipstart = bc;
+	rm->rm_missingdata = 0;
+	rm->rm_missingparity = 0;
+	rm->rm_firstdatacol = nparity;
+	rm->rm_abd_copy = NULL;
+	rm->rm_reports = 0;
+	rm->rm_freed = 0;
+	rm->rm_ecksuminjected = 0;
+	rm->rm_nskip = 0;
+	rm->rm_asize = ((q + (r != 0)) * width) << ashift;
+
+	for (c = 0; c < width; c++) {
+		raidz_col_t *rc = &rm->rm_col[c];
+		uint64_t row;
+
+		rc->rc_devidx = vdev_draid_group_child(vdc, group, c, &row);
+		rc->rc_offset = (row * rows + b / width) << ashift;
+		rc->rc_abd = NULL;
+		rc->rc_gdata = NULL;
+		rc->rc_error = 0;
+		rc->rc_tried = 0;
+		rc->rc_skipped = 0;
+
+		if (c >= acols)
+			rc->rc_size = 0;
+		else if (c < bc)
+			rc->rc_size = (q + 1) << ashift;
+		else
+			rc->rc_size = q << ashift;
+	}
+
+	for (c = 0; c < rm->rm_firstdatacol; c++)
+		rm->rm_col[c].rc_abd =
+		    abd_alloc_linear(rm->rm_col[c].rc_size, B_FALSE);
+
+	off = 0;
+	for (; c < acols; c++) {
+		rm->rm_col[c].rc_abd = abd_get_offset_size(zio->io_abd, off,
+		    rm->rm_col[c].rc_size);
+		off += rm->rm_col[c].rc_size;
+	}
+	ASSERT3U(off, ==, zio->io_size);
+
+	zio->io_vsd = rm;
+	zio->io_vsd_ops = &vdev_raidz_vsd_ops;
+
+	/* init RAIDZ parity ops */
+	rm->rm_ops = vdev_raidz_math_get_ops();
+
+	return (rm);
+}
+
+static void
+vdev_draid_pad_done(zio_t *zio)
+{
+	abd_free(zio->io_private);
+}
+
+/*
+ * Write a zero filled sector to every data column which is shorter than
+ * the parity columns.  Keeping every row on disk a complete stripe allows
+ * ranges of blocks to be reconstructed without their block pointers.
+ */
+static void
+vdev_draid_pad_write(zio_t *zio, raidz_map_t *rm, boolean_t repair)
+{
+	vdev_t *vd = zio->io_vd;
+	uint64_t ashift = vd->vdev_top->vdev_ashift;
+	uint64_t psize = 1ULL << ashift;
+
+	for (int c = rm->rm_firstdatacol; c < rm->rm_scols; c++) {
+		raidz_col_t *rc = &rm->rm_col[c];
+		vdev_t *cvd = vd->vdev_child[rc->rc_devidx];
+
+		if (rc->rc_size == rm->rm_col[0].rc_size)
+			continue;
+
+		ASSERT3U(rc->rc_size + psize, ==, rm->rm_col[0].rc_size);
+
+		if (repair && rc->rc_error == 0 &&
+		    !vdev_dtl_contains(cvd, DTL_MISSING, zio->io_txg, 1))
+			continue;
+
+		abd_t *pad = abd_alloc_linear(psize, B_FALSE);
+		abd_zero(pad, psize);
+
+		zio_nowait(zio_vdev_child_io(zio, NULL, cvd,
+		    rc->rc_offset + rc->rc_size, pad, psize, ZIO_TYPE_WRITE,
+		    repair ? ZIO_PRIORITY_ASYNC_WRITE : zio->io_priority,
+		    repair ? ZIO_FLAG_IO_REPAIR : 0, vdev_draid_pad_done, pad));
+	}
+}
+
+static void
+vdev_draid_io_start(zio_t *zio)
+{
+	raidz_map_t *rm = vdev_draid_map_alloc(zio);
+
+	if (zio->io_type == ZIO_TYPE_WRITE)
+		vdev_draid_pad_write(zio, rm, B_FALSE);
+
+	vdev_raidz_io_start_map(zio, rm);
+}
+
+/*
+ * Complete the I/O like raidz.  When resilvering, also rewrite the zero
+ * padding on any children which are missing it.
+ */
+static void
+vdev_draid_io_done(zio_t *zio)
+{
+	raidz_map_t *rm = zio->io_vsd;
+
+	vdev_raidz_io_done(zio);
+
+	if (zio->io_type == ZIO_TYPE_READ && zio->io_error == 0 &&
+	    (zio->io_flags & ZIO_FLAG_RESILVER) &&
+	    spa_writeable(zio->io_spa))
+		vdev_draid_pad_write(zio, rm, B_TRUE);
+}
+
+/*
+ * A block only needs to be resilvered when one of the children in its
+ * redundancy group has a dirty DTL.
+ */
+static boolean_t
+vdev_draid_need_resilver(vdev_t *vd, uint64_t offset, size_t psize)
+{
+	vdev_draid_config_t *vdc = vd->vdev_tsd;
+	uint64_t group = offset >> vd->vdev_ms_shift;
+
+	for (uint64_t c = 0; c < vdc->vdc_groupwidth; c++) {
+		uint64_t row;
+		vdev_t *cvd = vd->vdev_child[vdev_draid_group_child(vdc,
+		    group, c, &row)];
+
+		if (!vdev_dtl_empty(cvd, DTL_PARTIAL))
+			return (B_TRUE);
+	}
+
+	return (B_FALSE);
+}
+
+/*
+ * Translate a range within a redundancy group to the range of the child
+ * storing part of it.  An empty range is returned when the child does
+ * not store any columns of the group.
+ */
+static void
+vdev_draid_xlate(vdev_t *cvd, const range_seg64_t *in, range_seg64_t *res)
+{
+	vdev_t *vd = cvd->vdev_parent;
+	vdev_draid_config_t *vdc = vd->vdev_tsd;
+	uint64_t ashift = vd->vdev_top->vdev_ashift;
+	uint64_t rows = vdev_draid_group_rows(vd);
+	uint64_t width = vdc->vdc_groupwidth;
+	uint64_t group = in->rs_start >> vd->vdev_ms_shift;
+	uint64_t base = group << vd->vdev_ms_shift;
+	uint64_t col, row = 0;
+
+	ASSERT3P(vd->vdev_ops, ==, &vdev_draid_ops);
+	ASSERT3U(in->rs_end, <=, base + (1ULL << vd->vdev_ms_shift));
+
+	/* make sure the offsets are block-aligned */
+	ASSERT0(in->rs_start % (1 << ashift));
+	ASSERT0(in->rs_end % (1 << ashift));
+	uint64_t b_start = (in->rs_start - base) >> ashift;
+	uint64_t b_end = (in->rs_end - base) >> ashift;
+
+	for (col = 0; col < width; col++) {
+		if (vdev_draid_group_child(vdc, group, col, &row) ==
+		    cvd->vdev_id)
+			break;
+	}
+
+	if (col == width) {
+		res->rs_start = res->rs_end = (row * rows) << ashift;
+		return;
+	}
+
+	uint64_t start_row = 0;
+	if (b_start > col) /* avoid underflow */
+		start_row = ((b_start - col - 1) / width) + 1;
+
+	uint64_t end_row = 0;
+	if (b_end > col)
+		end_row = ((b_end - col - 1) / width) + 1;
+
+	start_row = MIN(start_row, rows);
+	end_row = MIN(end_row, rows);
+
+	res->rs_start = (row * rows + start_row) << ashift;
+	res->rs_end = (row * rows + end_row) << ashift;
+
+	ASSERT3U(res->rs_end - res->rs_start, <=, in->rs_end - in->rs_start);
+}
+
+vdev_ops_t vdev_draid_ops = {
+	.vdev_op_open = vdev_draid_open,
+	.vdev_op_close = vdev_draid_close,
+	.vdev_op_asize = vdev_draid_asize,
+	.vdev_op_io_start = vdev_draid_io_start,
+	.vdev_op_io_done = vdev_draid_io_done,
+	.vdev_op_state_change = vdev_raidz_state_change,
+	.vdev_op_need_resilver = vdev_draid_need_resilver,
+	.vdev_op_hold = NULL,
+	.vdev_op_rele = NULL,
+	.vdev_op_remap = NULL,
+	.vdev_op_xlate = vdev_draid_xlate,
+	.vdev_op_type = VDEV_TYPE_DRAID,	/* name of this vdev type */
+	.vdev_op_leaf = B_FALSE			/* not a leaf vdev */
+};
+
+/*
+ * A distributed spare is a virtual leaf vdev which is named
+ * "dcraid<parity>-<top-level vdev id>-<spare id>".  It stores the columns
+ * of the child it replaces in the spare positions of each slice.
+ */
+typedef struct vdev_draid_spare {
+	uint64_t	vds_top_id;		/* dRAID top-level vdev id */
+	uint64_t	vds_spare_id;		/* spare id within the dRAID */
+} vdev_draid_spare_t;
+
+static int
+vdev_draid_spare_parse(const char *path, uint64_t *nparity,
+    uint64_t *top_id, uint64_t *spare_id)
+{
+	char buf[64];
+	u_longlong_t p, t, s;
+
+	if (path == NULL || sscanf(path, VDEV_TYPE_DRAID "%llu-%llu-%llu",
+	    &p, &t, &s) != 3)
+		return (SET_ERROR(EINVAL));
+
+	/* Reject names with leading zeros or trailing characters. */
+	(void) snprintf(buf, sizeof (buf), "%s%llu-%llu-%llu",
+	    VDEV_TYPE_DRAID, p, t, s);
+	if (strcmp(buf, path) != 0)
+		return (SET_ERROR(EINVAL));
+
+	*nparity = p;
+	*top_id = t;
+	*spare_id = s;
+
+	return (0);
+}
+
+/*
+ * Returns the dRAID top-level vdev which provides the named distributed
+ * spare, or NULL if there is no such spare in the pool.
+ */
+static vdev_t *
+vdev_draid_spare_get_top(vdev_t *vd, uint64_t *spare_id)
+{
+	vdev_t *rvd = vd->vdev_spa->spa_root_vdev;
+	uint64_t nparity, top_id;
+	vdev_t *tvd;
+
+	if (vdev_draid_spare_parse(vd->vdev_path, &nparity, &top_id,
+	    spare_id) != 0 || top_id >= rvd->vdev_children)
+		return (NULL);
+
+	tvd = rvd->vdev_child[top_id];
+	if (tvd->vdev_ops != &vdev_draid_ops || tvd->vdev_nparity != nparity ||
+	    *spare_id >= ((vdev_draid_config_t *)tvd->vdev_tsd)->vdc_nspares)
+		return (NULL);
+
+	return (tvd);
+}
+
+/*
+ * Returns B_TRUE when the distributed spare 'vd' provides spare capacity
+ * for the dRAID top-level vdev 'tvd'.
+ */
+boolean_t
+vdev_draid_spare_is_for(vdev_t *vd, vdev_t *tvd)
+{
+	uint64_t spare_id;
+
+	ASSERT3P(vd->vdev_ops, ==, &vdev_draid_spare_ops);
+
+	return (vdev_draid_spare_get_top(vd, &spare_id) == tvd);
+}
+
+static int
+vdev_draid_spare_open(vdev_t *vd, uint64_t *psize, uint64_t *max_psize,
+    uint64_t *ashift, uint64_t *pshift)
+{
+	vdev_draid_spare_t *vds;
+	uint64_t spare_id;
+	vdev_t *tvd;
+
+	if ((tvd = vdev_draid_spare_get_top(vd, &spare_id)) == NULL) {
+		vd->vdev_stat.vs_aux = VDEV_AUX_OPEN_FAILED;
+		return (SET_ERROR(ENXIO));
+	}
+
+	if (vd->vdev_tsd == NULL) {
+		vd->vdev_tsd = kmem_zalloc(sizeof (vdev_draid_spare_t),
+		    KM_SLEEP);
+	}
+
+	vds = vd->vdev_tsd;
+	vds->vds_top_id = tvd->vdev_id;
+	vds->vds_spare_id = spare_id;
+
+	/*
+	 * The spare provides exactly the space required by each child of
+	 * the dRAID vdev, labels are emulated.
+	 */
+	*psize = P2ROUNDUP(vdev_draid_min_asize(tvd), sizeof (vdev_label_t)) +
+	    VDEV_LABEL_START_SIZE + VDEV_LABEL_END_SIZE;
+	*max_psize = *psize;
+	*ashift = tvd->vdev_ashift;
+	*pshift = tvd->vdev_physical_ashift;
+
+	return (0);
+}
+
+static void
+vdev_draid_spare_close(vdev_t *vd)
+{
+	if (vd->vdev_tsd != NULL) {
+		kmem_free(vd->vdev_tsd, sizeof (vdev_draid_spare_t));
+		vd->vdev_tsd = NULL;
+	}
+}
+
+static void
+vdev_draid_spare_child_done(zio_t *zio)
+{
+	zio_t *pio = zio->io_private;
+
+	if (zio->io_error != 0) {
+		mutex_enter(&pio->io_lock);
+		pio->io_error = zio_worst_error(pio->io_error, zio->io_error);
+		mutex_exit(&pio->io_lock);
+	}
+
+	abd_put(zio->io_abd);
+}
+
+/*
+ * Issue the I/O to the children holding the spare positions of each slice
+ * it covers.  An I/O may span slices when it has been aggregated.
+ */
+static int
+vdev_draid_spare_io_issue(zio_t *zio)
+{
+	vdev_t *vd = zio->io_vd;
+	vdev_draid_spare_t *vds = vd->vdev_tsd;
+	vdev_t *tvd = vd->vdev_top;
+	vdev_t *cvd;
+
+	if (vds == NULL || tvd->vdev_ops != &vdev_draid_ops ||
+	    tvd->vdev_id != vds->vds_top_id)
+		return (SET_ERROR(ENXIO));
+
+	/* Find the child of the dRAID vdev which this spare replaces. */
+	for (cvd = vd; cvd->vdev_parent != tvd; cvd = cvd->vdev_parent) {
+		if (cvd->vdev_parent == NULL)
+			return (SET_ERROR(ENXIO));
+	}
+
+	vdev_draid_config_t *vdc = tvd->vdev_tsd;
+	uint64_t slice_size = (vdc->vdc_slicerows *
+	    vdev_draid_group_rows(tvd)) << tvd->vdev_ashift;
+	uint64_t offset = zio->io_offset - VDEV_LABEL_START_SIZE;
+	uint64_t done = 0;
+
+	while (done < zio->io_size) {
+		uint64_t slice = (offset + done) / slice_size;
+		uint64_t size = MIN(zio->io_size - done,
+		    slice_size - (offset + done) % slice_size);
+		uint64_t pos = vdev_draid_invperm(vdc, slice)[cvd->vdev_id];
+
+		/* The replaced child only holds spare space in this slice. */
+		if (pos >= vdc->vdc_ndisks)
+			return (SET_ERROR(ENXIO));
+
+		vdev_t *svd = tvd->vdev_child[vdev_draid_perm(vdc, slice)[
+		    vdc->vdc_ndisks + vds->vds_spare_id]];
+
+		zio_nowait(zio_vdev_child_io(zio, NULL, svd, offset + done,
+		    abd_get_offset_size(zio->io_abd, done, size), size,
+		    zio->io_type, zio->io_priority, 0,
+		    vdev_draid_spare_child_done, zio));
+
+		done += size;
+	}
+
+	return (0);
+}
+
+static void
+vdev_draid_spare_io_start(zio_t *zio)
+{
+	vdev_t *vd = zio->io_vd;
+
+	switch (zio->io_type) {
+	case ZIO_TYPE_IOCTL:
+	case ZIO_TYPE_TRIM:
+		zio->io_error = 0;
+		break;
+
+	case ZIO_TYPE_READ:
+	case ZIO_TYPE_WRITE:
+		/*
+		 * The labels are emulated, see vdev_draid_read_config_spare().
+		 * Label writes are discarded and reads return zeros.
+		 */
+		if (zio->io_offset < VDEV_LABEL_START_SIZE ||
+		    zio->io_offset >= vd->vdev_psize - VDEV_LABEL_END_SIZE) {
+			if (zio->io_type == ZIO_TYPE_READ)
+				abd_zero(zio->io_abd, zio->io_size);
+			zio->io_error = 0;
+			break;
+		}
+
+		zio->io_error = vdev_draid_spare_io_issue(zio);
+		break;
+
+	default:
+		zio->io_error = SET_ERROR(ENOTSUP);
+		break;
+	}
+
+	zio_execute(zio);
+}
+
+/* ARGSUSED */
+static void
+vdev_draid_spare_io_done(zio_t *zio)
+{
+}
+
+vdev_ops_t vdev_draid_spare_ops = {
+	.vdev_op_open = vdev_draid_spare_open,
+	.vdev_op_close = vdev_draid_spare_close,
+	.vdev_op_asize = vdev_default_asize,
+	.vdev_op_io_start = vdev_draid_spare_io_start,
+	.vdev_op_io_done = vdev_draid_spare_io_done,
+	.vdev_op_state_change = NULL,
+	.vdev_op_need_resilver = NULL,
+	.vdev_op_hold = NULL,
+	.vdev_op_rele = NULL,
+	.vdev_op_remap = NULL,
+	.vdev_op_xlate = vdev_default_xlate,
+	.vdev_op_type = VDEV_TYPE_DRAID_SPARE,	/* name of this vdev type */
+	.vdev_op_leaf = B_TRUE			/* leaf vdev */
+};
+
+/*
+ * Distributed spares have no on-disk label, instead one is generated
+ * from the pool configuration.  The guid of the spare is taken from the
+ * pool's list of spares so an attached spare can be matched to it.
+ */
+nvlist_t *
+vdev_draid_read_config_spare(vdev_t *vd)
+{
+	spa_t *spa = vd->vdev_spa;
+	spa_aux_vdev_t *sav = &spa->spa_spares;
+	boolean_t active = (vd->vdev_top != NULL && vd->vdev_top != vd);
+	uint64_t guid = vd->vdev_guid;
+	nvlist_t *nv;
+
+	ASSERT3P(vd->vdev_ops, ==, &vdev_draid_spare_ops);
+
+	for (int i = 0; sav->sav_vdevs != NULL && i < sav->sav_count; i++) {
+		vdev_t *svd = sav->sav_vdevs[i];
+
+		if (svd != NULL && svd->vdev_ops == &vdev_draid_spare_ops &&
+		    strcmp(svd->vdev_path, vd->vdev_path) == 0) {
+			guid = svd->vdev_guid;
+			break;
+		}
+	}
+
+	nv = fnvlist_alloc();
+	fnvlist_add_uint64(nv, ZPOOL_CONFIG_IS_SPARE, 1);
+	fnvlist_add_uint64(nv, ZPOOL_CONFIG_CREATE_TXG, vd->vdev_crtxg);
+	fnvlist_add_uint64(nv, ZPOOL_CONFIG_VERSION, spa_version(spa));
+	fnvlist_add_string(nv, ZPOOL_CONFIG_POOL_NAME, spa_name(spa));
+	fnvlist_add_uint64(nv, ZPOOL_CONFIG_POOL_GUID, spa_guid(spa));
+	fnvlist_add_uint64(nv, ZPOOL_CONFIG_POOL_TXG, spa->spa_config_txg);
+	fnvlist_add_uint64(nv, ZPOOL_CONFIG_GUID, guid);
+	if (active) {
+		fnvlist_add_uint64(nv, ZPOOL_CONFIG_TOP_GUID,
+		    vd->vdev_top->vdev_guid);
+	}
+	fnvlist_add_uint64(nv, ZPOOL_CONFIG_POOL_STATE,
+	    active ? POOL_STATE_ACTIVE : POOL_STATE_SPARE);
+
+	return (nv);
+}
+
+/*
+ * Append the distributed spares of the new dRAID children of 'vd' to the
+ * list of spares in 'nvroot'.  The children will be assigned top-level
+ * vdev ids starting from 'next_vdev_id'.
+ */
+void
+vdev_draid_spare_create(nvlist_t *nvroot, vdev_t *vd, uint64_t next_vdev_id)
+{
+	nvlist_t **spares, **new_spares;
+	uint_t nspares;
+	uint64_t ndraid_spares = 0;
+	uint64_t n;
+
+	for (uint64_t c = 0; c < vd->vdev_children; c++) {
+		vdev_t *cvd = vd->vdev_child[c];
+
+		if (cvd->vdev_ops == &vdev_draid_ops) {
+			vdev_draid_config_t *vdc = cvd->vdev_tsd;
+			ndraid_spares += vdc->vdc_nspares;
+		}
+	}
+
+	if (ndraid_spares == 0)
+		return;
+
+	if (nvlist_lookup_nvlist_array(nvroot, ZPOOL_CONFIG_SPARES,
+	    &spares, &nspares) != 0)
+		nspares = 0;
+
+	new_spares = kmem_alloc((nspares + ndraid_spares) *
+	    sizeof (nvlist_t *), KM_SLEEP);
+
+	for (n = 0; n < nspares; n++)
+		new_spares[n] = fnvlist_dup(spares[n]);
+
+	for (uint64_t c = 0; c < vd->vdev_children; c++) {
+		vdev_t *cvd = vd->vdev_child[c];
+
+		if (cvd->vdev_ops != &vdev_draid_ops)
+			continue;
+
+		vdev_draid_config_t *vdc = cvd->vdev_tsd;
+		for (uint64_t s = 0; s < vdc->vdc_nspares; s++) {
+			char path[64];
+			nvlist_t *nv = fnvlist_alloc();
+
+			(void) snprintf(path, sizeof (path), "%s%llu-%llu-%llu",
+			    VDEV_TYPE_DRAID, (u_longlong_t)cvd->vdev_nparity,
+			    (u_longlong_t)(next_vdev_id + c), (u_longlong_t)s);
+
+			fnvlist_add_string(nv, ZPOOL_CONFIG_TYPE,
+			    VDEV_TYPE_DRAID_SPARE);
+			fnvlist_add_string(nv, ZPOOL_CONFIG_PATH, path);
+			fnvlist_add_uint64(nv, ZPOOL_CONFIG_GUID,
+			    spa_generate_guid(vd->vdev_spa));
+			new_spares[n++] = nv;
+		}
+	}
+
+	ASSERT3U(n, ==, nspares + ndraid_spares);
+	fnvlist_add_nvlist_array(nvroot, ZPOOL_CONFIG_SPARES, new_spares, n);
+
+	for (uint64_t i = 0; i < n; i++)
+		nvlist_free(new_spares[i]);
+	kmem_free(new_spares, (nspares + ndraid_spares) * sizeof (nvlist_t *));
+}
@@ -117,6 +117,20 @@
  * maximum percentage, this indicates that the rate of incoming data is
  * greater than the rate that the backend storage can handle. In this case, we
  * must further throttle incoming writes (see dmu_tx_delay() for details).
+ *
+ * Fast Queue Mode
+ *
+ * Non-rotational devices gain little from LBA ordering or aggregation, yet
+ * at very high IOPS the vq_lock taken for every queued and completed i/o
+ * becomes a point of contention.  When zfs_vdev_queue_fast_non_rotating is
+ * set, non-rotational leaf vdevs instead use per-CPU FIFO submission lists
+ * and per-class atomic counters of queued and active i/os.  The same
+ * min_active/max_active rules described above are applied to select the
+ * class to issue from, but no vdev-wide lock is taken, i/os are never
+ * aggregated and each class is dispatched in FIFO rather than LBA order.
+ * When no i/os are waiting and the class has not reached its limit, a new
+ * i/o is issued directly without being placed on a list.  The mode of a
+ * vdev is selected when it is opened.
  */
 
 /*
@@ -212,6 +226,12 @@ int zfs_vdev_def_queue_depth = 32;
  */
 int zfs_vdev_aggregate_trim = 0;
 
+/*
+ * Use the lockless fast queue mode for non-rotational leaf vdevs.  Changes
+ * take effect the next time a vdev is opened.
+ */
+int zfs_vdev_queue_fast_non_rotating = 1;
+
 int
 vdev_queue_offset_compare(const void *x1, const void *x2)
 {
@@ -450,53 +470,86 @@ vdev_queue_fini(vdev_t *vd)
 	avl_destroy(vdev_queue_type_tree(vq, ZIO_TYPE_WRITE));
 	avl_destroy(vdev_queue_type_tree(vq, ZIO_TYPE_TRIM));
 
+	if (vq->vq_fast_lists != NULL) {
+		ASSERT0(vq->vq_fast_nqueued);
+		ASSERT0(vq->vq_fast_nactive);
+
+		for (uint_t i = 0; i < vq->vq_fast_nlists; i++) {
+			vdev_queue_fast_list_t *vqfl = &vq->vq_fast_lists[i];
+
+			for (zio_priority_t p = 0;
+			    p < ZIO_PRIORITY_NUM_QUEUEABLE; p++)
+				list_destroy(&vqfl->vqfl_queued[p]);
+			list_destroy(&vqfl->vqfl_active);
+			mutex_destroy(&vqfl->vqfl_lock);
+		}
+		kmem_free(vq->vq_fast_lists,
+		    vq->vq_fast_nlists * sizeof (vdev_queue_fast_list_t));
+		vq->vq_fast_lists = NULL;
+	}
+
 	mutex_destroy(&vq->vq_lock);
 }
 
-static void
-vdev_queue_io_add(vdev_queue_t *vq, zio_t *zio)
+/*
+ * Select the queue mode for a leaf vdev after it has been opened.  The
+ * fast mode is used for non-rotational devices when enabled.  The mode
+ * is only changed while no i/os are queued or active, which vdev_open()
+ * guarantees by holding SCL_ZIO as writer.
+ */
+void
+vdev_queue_update_fast(vdev_t *vd)
 {
-	spa_t *spa = zio->io_spa;
-	spa_history_kstat_t *shk = &spa->spa_stats.io_history;
+	vdev_queue_t *vq = &vd->vdev_queue;
+	boolean_t fast = (vd->vdev_ops->vdev_op_leaf && vd->vdev_nonrot &&
+	    zfs_vdev_queue_fast_non_rotating != 0);
 
-	ASSERT3U(zio->io_priority, <, ZIO_PRIORITY_NUM_QUEUEABLE);
-	avl_add(vdev_queue_class_tree(vq, zio->io_priority), zio);
-	avl_add(vdev_queue_type_tree(vq, zio->io_type), zio);
+	if (fast == vq->vq_fast || vq->vq_fast_nqueued != 0 ||
+	    vq->vq_fast_nactive != 0 || avl_numnodes(&vq->vq_active_tree) != 0)
+		return;
 
-	if (shk->kstat != NULL) {
-		mutex_enter(&shk->lock);
-		kstat_waitq_enter(shk->kstat->ks_data);
-		mutex_exit(&shk->lock);
+	if (fast && vq->vq_fast_lists == NULL) {
+		vq->vq_fast_nlists = MAX(boot_ncpus, 1);
+		vq->vq_fast_lists = kmem_zalloc(vq->vq_fast_nlists *
+		    sizeof (vdev_queue_fast_list_t), KM_SLEEP);
+
+		for (uint_t i = 0; i < vq->vq_fast_nlists; i++) {
+			vdev_queue_fast_list_t *vqfl = &vq->vq_fast_lists[i];
+
+			mutex_init(&vqfl->vqfl_lock, NULL, MUTEX_DEFAULT, NULL);
+			for (zio_priority_t p = 0;
+			    p < ZIO_PRIORITY_NUM_QUEUEABLE; p++) {
+				list_create(&vqfl->vqfl_queued[p],
+				    sizeof (zio_t),
+				    offsetof(struct zio, io_queue_link));
+			}
+			list_create(&vqfl->vqfl_active, sizeof (zio_t),
+			    offsetof(struct zio, io_queue_link));
+		}
 	}
+
+	vq->vq_fast = fast;
 }
 
 static void
-vdev_queue_io_remove(vdev_queue_t *vq, zio_t *zio)
+vdev_queue_kstat_waitq(zio_t *zio, boolean_t enter)
 {
-	spa_t *spa = zio->io_spa;
-	spa_history_kstat_t *shk = &spa->spa_stats.io_history;
-
-	ASSERT3U(zio->io_priority, <, ZIO_PRIORITY_NUM_QUEUEABLE);
-	avl_remove(vdev_queue_class_tree(vq, zio->io_priority), zio);
-	avl_remove(vdev_queue_type_tree(vq, zio->io_type), zio);
+	spa_history_kstat_t *shk = &zio->io_spa->spa_stats.io_history;
 
 	if (shk->kstat != NULL) {
 		mutex_enter(&shk->lock);
-		kstat_waitq_exit(shk->kstat->ks_data);
+		if (enter)
+			kstat_waitq_enter(shk->kstat->ks_data);
+		else
+			kstat_waitq_exit(shk->kstat->ks_data);
 		mutex_exit(&shk->lock);
 	}
 }
 
 static void
-vdev_queue_pending_add(vdev_queue_t *vq, zio_t *zio)
+vdev_queue_kstat_runq_enter(zio_t *zio)
 {
-	spa_t *spa = zio->io_spa;
-	spa_history_kstat_t *shk = &spa->spa_stats.io_history;
-
-	ASSERT(MUTEX_HELD(&vq->vq_lock));
-	ASSERT3U(zio->io_priority, <, ZIO_PRIORITY_NUM_QUEUEABLE);
-	vq->vq_class[zio->io_priority].vqc_active++;
-	avl_add(&vq->vq_active_tree, zio);
+	spa_history_kstat_t *shk = &zio->io_spa->spa_stats.io_history;
 
 	if (shk->kstat != NULL) {
 		mutex_enter(&shk->lock);
@@ -506,15 +559,9 @@ vdev_queue_pending_add(vdev_queue_t *vq, zio_t *zio)
 }
 
 static void
-vdev_queue_pending_remove(vdev_queue_t *vq, zio_t *zio)
+vdev_queue_kstat_runq_exit(zio_t *zio)
 {
-	spa_t *spa = zio->io_spa;
-	spa_history_kstat_t *shk = &spa->spa_stats.io_history;
-
-	ASSERT(MUTEX_HELD(&vq->vq_lock));
-	ASSERT3U(zio->io_priority, <, ZIO_PRIORITY_NUM_QUEUEABLE);
-	vq->vq_class[zio->io_priority].vqc_active--;
-	avl_remove(&vq->vq_active_tree, zio);
+	spa_history_kstat_t *shk = &zio->io_spa->spa_stats.io_history;
 
 	if (shk->kstat != NULL) {
 		kstat_io_t *ksio = shk->kstat->ks_data;
@@ -532,6 +579,316 @@ vdev_queue_pending_remove(vdev_queue_t *vq, zio_t *zio)
 	}
 }
 
+static void
+vdev_queue_io_add(vdev_queue_t *vq, zio_t *zio)
+{
+	ASSERT3U(zio->io_priority, <, ZIO_PRIORITY_NUM_QUEUEABLE);
+	avl_add(vdev_queue_class_tree(vq, zio->io_priority), zio);
+	avl_add(vdev_queue_type_tree(vq, zio->io_type), zio);
+
+	vdev_queue_kstat_waitq(zio, B_TRUE);
+}
+
+static void
+vdev_queue_io_remove(vdev_queue_t *vq, zio_t *zio)
+{
+	ASSERT3U(zio->io_priority, <, ZIO_PRIORITY_NUM_QUEUEABLE);
+	avl_remove(vdev_queue_class_tree(vq, zio->io_priority), zio);
+	avl_remove(vdev_queue_type_tree(vq, zio->io_type), zio);
+
+	vdev_queue_kstat_waitq(zio, B_FALSE);
+}
+
+static void
+vdev_queue_pending_add(vdev_queue_t *vq, zio_t *zio)
+{
+	ASSERT(MUTEX_HELD(&vq->vq_lock));
+	ASSERT3U(zio->io_priority, <, ZIO_PRIORITY_NUM_QUEUEABLE);
+	vq->vq_class[zio->io_priority].vqc_active++;
+	avl_add(&vq->vq_active_tree, zio);
+
+	vdev_queue_kstat_runq_enter(zio);
+}
+
+static void
+vdev_queue_pending_remove(vdev_queue_t *vq, zio_t *zio)
+{
+	ASSERT(MUTEX_HELD(&vq->vq_lock));
+	ASSERT3U(zio->io_priority, <, ZIO_PRIORITY_NUM_QUEUEABLE);
+	vq->vq_class[zio->io_priority].vqc_active--;
+	avl_remove(&vq->vq_active_tree, zio);
+
+	vdev_queue_kstat_runq_exit(zio);
+}
+
+/*
+ * Fast queue mode.  The class counters are only ever modified with atomic
+ * operations which return the new value, these are fully ordered and
+ * guarantee that an i/o added to a submission list is either seen by a
+ * completing i/o or itself observes the slot released by that completion.
+ */
+static zio_priority_t
+vdev_queue_fast_class_to_issue(vdev_queue_t *vq, uint32_t *limit)
+{
+	spa_t *spa = vq->vq_vdev->vdev_spa;
+	zio_priority_t p;
+
+	if (vq->vq_fast_nactive >= zfs_vdev_max_active)
+		return (ZIO_PRIORITY_NUM_QUEUEABLE);
+
+	/* find a queue that has not reached its minimum # outstanding i/os */
+	for (p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++) {
+		*limit = vdev_queue_class_min_active(p);
+		if (vq->vq_fast_queued[p] > 0 &&
+		    vq->vq_fast_active[p] < *limit)
+			return (p);
+	}
+
+	/* then look for one that has not reached its maximum */
+	for (p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++) {
+		*limit = vdev_queue_class_max_active(spa, p);
+		if (vq->vq_fast_queued[p] > 0 &&
+		    vq->vq_fast_active[p] < *limit)
+			return (p);
+	}
+
+	return (ZIO_PRIORITY_NUM_QUEUEABLE);
+}
+
+/*
+ * Reserve an active slot for class 'p' provided fewer than 'limit' i/os
+ * of the class and fewer than zfs_vdev_max_active i/os in total are active.
+ */
+static boolean_t
+vdev_queue_fast_reserve(vdev_queue_t *vq, zio_priority_t p, uint32_t limit)
+{
+	uint32_t active;
+
+	do {
+		active = vq->vq_fast_active[p];
+		if (active >= limit)
+			return (B_FALSE);
+	} while (atomic_cas_32(&vq->vq_fast_active[p], active,
+	    active + 1) != active);
+
+	if (atomic_inc_32_nv(&vq->vq_fast_nactive) > zfs_vdev_max_active) {
+		atomic_dec_32(&vq->vq_fast_nactive);
+		atomic_dec_32(&vq->vq_fast_active[p]);
+		return (B_FALSE);
+	}
+
+	return (B_TRUE);
+}
+
+static void
+vdev_queue_fast_release(vdev_queue_t *vq, zio_priority_t p)
+{
+	ASSERT3U(vq->vq_fast_active[p], >, 0);
+	ASSERT3U(vq->vq_fast_nactive, >, 0);
+	(void) atomic_dec_32_nv(&vq->vq_fast_active[p]);
+	(void) atomic_dec_32_nv(&vq->vq_fast_nactive);
+}
+
+static void
+vdev_queue_fast_add(vdev_queue_t *vq, zio_t *zio)
+{
+	uint_t idx = CPU_SEQID % vq->vq_fast_nlists;
+	vdev_queue_fast_list_t *vqfl = &vq->vq_fast_lists[idx];
+	zio_priority_t p = zio->io_priority;
+
+	vdev_queue_kstat_waitq(zio, B_TRUE);
+
+	mutex_enter(&vqfl->vqfl_lock);
+	ASSERT0(zio->io_queue_list);
+	zio->io_queue_list = idx + 1;
+	list_insert_tail(&vqfl->vqfl_queued[p], zio);
+	(void) atomic_inc_32_nv(&vq->vq_fast_queued[p]);
+	(void) atomic_inc_32_nv(&vq->vq_fast_nqueued);
+	mutex_exit(&vqfl->vqfl_lock);
+}
+
+/*
+ * Remove the oldest queued i/o of class 'p' from the first non-empty
+ * submission list.  The search starts from a rotating index so no CPU's
+ * list is starved.  Returns NULL if another thread raced us to it.
+ */
+static zio_t *
+vdev_queue_fast_remove(vdev_queue_t *vq, zio_priority_t p)
+{
+	uint_t start = atomic_inc_32_nv(&vq->vq_fast_rotor);
+
+	for (uint_t i = 0; i < vq->vq_fast_nlists; i++) {
+		vdev_queue_fast_list_t *vqfl =
+		    &vq->vq_fast_lists[(start + i) % vq->vq_fast_nlists];
+		zio_t *zio;
+
+		/* unlocked check, the list is rechecked under the lock */
+		if (list_is_empty(&vqfl->vqfl_queued[p]))
+			continue;
+
+		mutex_enter(&vqfl->vqfl_lock);
+		zio = list_remove_head(&vqfl->vqfl_queued[p]);
+		if (zio != NULL) {
+			ASSERT3U(zio->io_priority, ==, p);
+			zio->io_queue_list = 0;
+			(void) atomic_dec_32_nv(&vq->vq_fast_queued[p]);
+			(void) atomic_dec_32_nv(&vq->vq_fast_nqueued);
+		}
+		mutex_exit(&vqfl->vqfl_lock);
+
+		if (zio != NULL) {
+			vdev_queue_kstat_waitq(zio, B_FALSE);
+			return (zio);
+		}
+	}
+
+	return (NULL);
+}
+
+/*
+ * Track an issued i/o on the current CPU's list, so the deadman can find
+ * it.  The i/o is no longer on a submission list, which share its link.
+ */
+static void
+vdev_queue_fast_pending_add(vdev_queue_t *vq, zio_t *zio)
+{
+	uint_t idx = CPU_SEQID % vq->vq_fast_nlists;
+	vdev_queue_fast_list_t *vqfl = &vq->vq_fast_lists[idx];
+
+	mutex_enter(&vqfl->vqfl_lock);
+	ASSERT0(zio->io_queue_list);
+	ASSERT0(zio->io_queue_active);
+	zio->io_queue_active = idx + 1;
+	list_insert_tail(&vqfl->vqfl_active, zio);
+	mutex_exit(&vqfl->vqfl_lock);
+
+	vq->vq_last_offset = zio->io_offset + zio->io_size;
+	vdev_queue_kstat_runq_enter(zio);
+}
+
+static void
+vdev_queue_fast_pending_remove(vdev_queue_t *vq, zio_t *zio)
+{
+	vdev_queue_fast_list_t *vqfl;
+
+	ASSERT3U(zio->io_queue_active, >, 0);
+	vqfl = &vq->vq_fast_lists[zio->io_queue_active - 1];
+
+	mutex_enter(&vqfl->vqfl_lock);
+	list_remove(&vqfl->vqfl_active, zio);
+	zio->io_queue_active = 0;
+	mutex_exit(&vqfl->vqfl_lock);
+
+	vdev_queue_kstat_runq_exit(zio);
+}
+
+static zio_t *
+vdev_queue_fast_io_to_issue(vdev_queue_t *vq)
+{
+	zio_priority_t p;
+	uint32_t limit;
+	zio_t *zio;
+
+	for (;;) {
+		p = vdev_queue_fast_class_to_issue(vq, &limit);
+		if (p == ZIO_PRIORITY_NUM_QUEUEABLE)
+			return (NULL);
+
+		if (!vdev_queue_fast_reserve(vq, p, limit))
+			continue;
+
+		zio = vdev_queue_fast_remove(vq, p);
+		if (zio != NULL)
+			break;
+
+		/* Raced with another thread; release the slot and retry. */
+		vdev_queue_fast_release(vq, p);
+	}
+
+	vdev_queue_fast_pending_add(vq, zio);
+
+	return (zio);
+}
+
+static zio_t *
+vdev_queue_fast_io(vdev_queue_t *vq, zio_t *zio)
+{
+	zio_priority_t p = zio->io_priority;
+
+	/*
+	 * Optional i/os only exist to aid aggregation which is never
+	 * performed in this mode, they can be discarded immediately.
+	 */
+	if (zio->io_flags & ZIO_FLAG_NODATA) {
+		zio_vdev_io_bypass(zio);
+		zio_execute(zio);
+		return (NULL);
+	}
+
+	zio->io_timestamp = gethrtime();
+
+	/*
+	 * With nothing waiting this is the only candidate for issue; do so
+	 * immediately if its class and the vdev have not reached their limit.
+	 */
+	if (vq->vq_fast_nqueued == 0 && vdev_queue_fast_reserve(vq, p,
+	    MAX(vdev_queue_class_min_active(p),
+	    vdev_queue_class_max_active(zio->io_spa, p)))) {
+		vdev_queue_fast_pending_add(vq, zio);
+		return (zio);
+	}
+
+	vdev_queue_fast_add(vq, zio);
+
+	return (vdev_queue_fast_io_to_issue(vq));
+}
+
+static void
+vdev_queue_fast_io_done(vdev_queue_t *vq, zio_t *zio)
+{
+	hrtime_t now = gethrtime();
+	zio_t *nio;
+
+	vdev_queue_fast_pending_remove(vq, zio);
+	vdev_queue_fast_release(vq, zio->io_priority);
+
+	zio->io_delta = now - zio->io_timestamp;
+	vq->vq_io_complete_ts = now;
+	vq->vq_io_delta_ts = now - zio->io_timestamp;
+
+	while ((nio = vdev_queue_fast_io_to_issue(vq)) != NULL) {
+		zio_vdev_io_reissue(nio);
+		zio_execute(nio);
+	}
+}
+
+static void
+vdev_queue_fast_change_io_priority(vdev_queue_t *vq, zio_t *zio,
+    zio_priority_t priority)
+{
+	uint_t idx = zio->io_queue_list;
+	vdev_queue_fast_list_t *vqfl;
+
+	/*
+	 * Only a zio waiting on a submission list can be reprioritized.
+	 * It is queued on list 'idx - 1' for as long as io_queue_list is
+	 * unchanged while holding that list's lock.
+	 */
+	if (idx == 0)
+		return;
+
+	vqfl = &vq->vq_fast_lists[idx - 1];
+	mutex_enter(&vqfl->vqfl_lock);
+	if (zio->io_queue_list == idx && zio->io_priority != priority) {
+		list_remove(&vqfl->vqfl_queued[zio->io_priority], zio);
+		(void) atomic_dec_32_nv(&vq->vq_fast_queued[zio->io_priority]);
+		zio->io_priority = priority;
+		list_insert_tail(&vqfl->vqfl_queued[priority], zio);
+		(void) atomic_inc_32_nv(&vq->vq_fast_queued[priority]);
+	}
+	mutex_exit(&vqfl->vqfl_lock);
+}
+
 static void
 vdev_queue_agg_io_done(zio_t *aio)
 {
@@ -838,6 +1195,9 @@ vdev_queue_io(zio_t *zio)
 
 	zio->io_flags |= ZIO_FLAG_DONT_CACHE | ZIO_FLAG_DONT_QUEUE;
 
+	if (vq->vq_fast)
+		return (vdev_queue_fast_io(vq, zio));
+
 	mutex_enter(&vq->vq_lock);
 	zio->io_timestamp = gethrtime();
 	vdev_queue_io_add(vq, zio);
@@ -861,6 +1221,11 @@ vdev_queue_io_done(zio_t *zio)
 	vdev_queue_t *vq = &zio->io_vd->vdev_queue;
 	zio_t *nio;
 
+	if (vq->vq_fast) {
+		vdev_queue_fast_io_done(vq, zio);
+		return;
+	}
+
 	mutex_enter(&vq->vq_lock);
 
 	vdev_queue_pending_remove(vq, zio);
@@ -913,6 +1278,11 @@ vdev_queue_change_io_priority(zio_t *zio, zio_priority_t priority)
 			priority = ZIO_PRIORITY_ASYNC_WRITE;
 	}
 
+	if (vq->vq_fast) {
+		vdev_queue_fast_change_io_priority(vq, zio, priority);
+		return;
+	}
+
 	mutex_enter(&vq->vq_lock);
 
 	/*
@@ -943,6 +1313,9 @@ vdev_queue_change_io_priority(zio_t *zio, zio_priority_t priority)
 int
 vdev_queue_length(vdev_t *vd)
 {
+	if (vd->vdev_queue.vq_fast)
+		return (vd->vdev_queue.vq_fast_nactive);
+
 	return (avl_numnodes(&vd->vdev_queue.vq_active_tree));
 }
 
@@ -952,6 +1325,50 @@ vdev_queue_last_offset(vdev_t *vd)
 	return (vd->vdev_queue.vq_last_offset);
 }
 
+/*
+ * The fast queue mode counterpart of the vq_active_tree walk in
+ * vdev_deadman(); invoke the deadman logic for the oldest i/o issued from
+ * any CPU if it has been outstanding for longer than spa_deadman_synctime.
+ */
+void
+vdev_queue_fast_deadman(vdev_t *vd, char *tag)
+{
+	vdev_queue_t *vq = &vd->vdev_queue;
+	vdev_queue_fast_list_t *ovqfl = NULL;
+	hrtime_t oldest = 0;
+	zio_t *fio;
+
+	if (vq->vq_fast_lists == NULL || vq->vq_fast_nactive == 0)
+		return;
+
+	zfs_dbgmsg("slow vdev: %s has %u active IOs", vd->vdev_path,
+	    vq->vq_fast_nactive);
+
+	for (uint_t i = 0; i < vq->vq_fast_nlists; i++) {
+		vdev_queue_fast_list_t *vqfl = &vq->vq_fast_lists[i];
+
+		mutex_enter(&vqfl->vqfl_lock);
+		fio = list_head(&vqfl->vqfl_active);
+		if (fio != NULL &&
+		    (ovqfl == NULL || fio->io_timestamp < oldest)) {
+			ovqfl = vqfl;
+			oldest = fio->io_timestamp;
+		}
+		mutex_exit(&vqfl->vqfl_lock);
+	}
+
+	if (ovqfl == NULL)
+		return;
+
+	/* The i/o may have completed since; look at the list head again. */
+	mutex_enter(&ovqfl->vqfl_lock);
+	fio = list_head(&ovqfl->vqfl_active);
+	if (fio != NULL && gethrtime() - fio->io_timestamp >
+	    spa_deadman_synctime(vd->vdev_spa))
+		zio_deadman(fio, tag);
+	mutex_exit(&ovqfl->vqfl_lock);
+}
+
 #if defined(_KERNEL)
 ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, aggregation_limit, UINT, ZMOD_RW,
 	"Max vdev I/O aggregation size");
@@ -1027,4 +1444,7 @@ ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, trim_min_active, UINT, ZMOD_RW,
 
 ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, queue_depth_pct, UINT, ZMOD_RW,
 	"Queue depth percentage for each top-level vdev");
+
+ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, queue_fast_non_rotating, UINT, ZMOD_RW,
+	"Use lockless per-CPU queues for non-rotating leaf vdevs");
 #endif
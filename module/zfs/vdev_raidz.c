@@ -321,7 +321,7 @@ vdev_raidz_cksum_report(zio_t *zio, zio_cksum_report_t *zcr, void *arg)
 	ASSERT3U(offset, ==, size);
 }
 
-static const zio_vsd_ops_t vdev_raidz_vsd_ops = {
+const zio_vsd_ops_t vdev_raidz_vsd_ops = {
 	.vsd_free = vdev_raidz_map_free_vsd,
 	.vsd_cksum_report = vdev_raidz_cksum_report
 };
@@ -1640,10 +1640,10 @@ vdev_raidz_io_verify(zio_t *zio, raidz_map_t *rm, int col)
 	vdev_t *vd = zio->io_vd;
 	vdev_t *tvd = vd->vdev_top;
 
-	range_seg_t logical_rs, physical_rs;
+	range_seg64_t logical_rs, physical_rs;
 	logical_rs.rs_start = zio->io_offset;
 	logical_rs.rs_end = logical_rs.rs_start +
-	    vdev_raidz_asize(zio->io_vd, zio->io_size);
+	    vdev_psize_to_asize(zio->io_vd, zio->io_size);
 
 	raidz_col_t *rc = &rm->rm_col[col];
 	vdev_t *cvd = vd->vdev_child[rc->rc_devidx];
@@ -1669,6 +1669,9 @@ vdev_raidz_io_verify(zio_t *zio, raidz_map_t *rm, int col)
 /*
  * Start an IO operation on a RAIDZ VDev
  *
+ * The raidz map describing the I/O is constructed by the caller, which
+ * allows dRAID to share this code with its own column layout.
+ *
  * Outline:
  * - For write operations:
  *   1. Generate the parity data
@@ -1683,19 +1686,16 @@ vdev_raidz_io_verify(zio_t *zio, raidz_map_t *rm, int col)
  *      vdevs have had errors, then create zio read operations to the parity
  *      columns' VDevs as well.
  */
-static void
-vdev_raidz_io_start(zio_t *zio)
+void
+vdev_raidz_io_start_map(zio_t *zio, raidz_map_t *rm)
 {
 	vdev_t *vd = zio->io_vd;
 	vdev_t *tvd = vd->vdev_top;
 	vdev_t *cvd;
-	raidz_map_t *rm;
 	raidz_col_t *rc;
 	int c, i;
 
-	rm = vdev_raidz_map_alloc(zio, tvd->vdev_ashift, vd->vdev_children,
-	    vd->vdev_nparity);
-
+	ASSERT3P(zio->io_vsd, ==, rm);
 	ASSERT3U(rm->rm_asize, ==, vdev_psize_to_asize(vd, zio->io_size));
 
 	if (zio->io_type == ZIO_TYPE_WRITE) {
@@ -1739,6 +1739,16 @@ vdev_raidz_io_start(zio_t *zio)
 
 	ASSERT(zio->io_type == ZIO_TYPE_READ);
 
+	/*
+	 * A sequential rebuild reads without a checksum, so stale data on a
+	 * partially resilvered child (e.g. a spare beneath it) would not be
+	 * detected.  Treat any child with a partial DTL as missing instead.
+	 */
+	vdev_dtl_type_t dtl = DTL_MISSING;
+	if ((zio->io_flags & ZIO_FLAG_RESILVER) && zio->io_bp != NULL &&
+	    BP_GET_CHECKSUM(zio->io_bp) == ZIO_CHECKSUM_OFF)
+		dtl = DTL_PARTIAL;
+
 	/*
 	 * Iterate over the columns in reverse order so that we hit the parity
 	 * last -- any errors along the way will force us to read the parity.
@@ -1756,7 +1766,7 @@ vdev_raidz_io_start(zio_t *zio)
 			rc->rc_skipped = 1;
 			continue;
 		}
-		if (vdev_dtl_contains(cvd, DTL_MISSING, zio->io_txg, 1)) {
+		if (vdev_dtl_contains(cvd, dtl, zio->io_txg, 1)) {
 			if (c >= rm->rm_firstdatacol)
 				rm->rm_missingdata++;
 			else
@@ -1777,6 +1787,17 @@ vdev_raidz_io_start(zio_t *zio)
 	zio_execute(zio);
 }
 
+static void
+vdev_raidz_io_start(zio_t *zio)
+{
+	vdev_t *vd = zio->io_vd;
+	raidz_map_t *rm;
+
+	rm = vdev_raidz_map_alloc(zio, vd->vdev_top->vdev_ashift,
+	    vd->vdev_children, vd->vdev_nparity);
+
+	vdev_raidz_io_start_map(zio, rm);
+}
 
 /*
  * Report a checksum error for a child of a RAID-Z device.
@@ -2055,7 +2076,7 @@ done:
  *   3. If there were unexpected errors or this is a resilver operation,
  *      rewrite the vdevs that had errors.
  */
-static void
+void
 vdev_raidz_io_done(zio_t *zio)
 {
 	vdev_t *vd = zio->io_vd;
@@ -2323,7 +2344,7 @@ done:
 	}
 }
 
-static void
+void
 vdev_raidz_state_change(vdev_t *vd, int faulted, int degraded)
 {
 	if (faulted > vd->vdev_nparity)
@@ -2374,7 +2395,7 @@ vdev_raidz_need_resilver(vdev_t *vd, uint64_t offset, size_t psize)
 }
 
 static void
-vdev_raidz_xlate(vdev_t *cvd, const range_seg_t *in, range_seg_t *res)
+vdev_raidz_xlate(vdev_t *cvd, const range_seg64_t *in, range_seg64_t *res)
 {
 	vdev_t *raidvd = cvd->vdev_parent;
 	ASSERT(raidvd->vdev_ops == &vdev_raidz_ops);
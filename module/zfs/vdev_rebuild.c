@@ -0,0 +1,1098 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/vdev_impl.h>
+#include <sys/vdev_draid.h>
+#include <sys/dsl_scan.h>
+#include <sys/spa_impl.h>
+#include <sys/metaslab_impl.h>
+#include <sys/vdev_rebuild.h>
+#include <sys/zio.h>
+#include <sys/dmu_tx.h>
+#include <sys/arc.h>
+#include <sys/zap.h>
+
+/*
+ * This file contains the sequential reconstruction implementation for
+ * resilvering.  This form of resilvering is internally referred to as device
+ * rebuild to avoid conflating it with the traditional healing reconstruction
+ * performed by the dsl scan code.
+ *
+ * When replacing a device, or scrubbing the pool, ZFS has historically used
+ * a process called resilvering which is a form of healing reconstruction.
+ * This approach has the advantage that as blocks are read from disk their
+ * checksums can be immediately verified and the data repaired.  Unfortunately,
+ * it also results in a random IO pattern to the disk even when extra care
+ * is taken to sequentialize the IO as much as possible.  This substantially
+ * increases the time required to resilver the pool and restore redundancy.
+ *
+ * For mirrored and dRAID devices it's possible to implement an alternate
+ * sequential reconstruction strategy when resilvering.  Sequential
+ * reconstruction behaves like a traditional RAID rebuild and reconstructs
+ * a device in LBA order without verifying the checksum.  After this phase
+ * completes a second scrub phase is started to verify all of the checksums.
+ * This two phase process will take longer than the healing reconstruction
+ * described above.  However, it has that advantage that after the
+ * reconstruction first phase completes redundancy has been restored.  At
+ * this point the pool can incur another device failure without risking data
+ * loss.
+ *
+ * There are a few noteworthy limitations and other advantages of resilvering
+ * sequentially which should be considered.
+ *
+ * - Sequential reconstruction is not possible on RAIDZ due to its
+ *   variable stripe width.  Note dRAID uses a fixed stripe width which
+ *   avoids this issue, but comes at the expense of some usable capacity.
+ *
+ * - Block checksums are not verified during sequential reconstruction.
+ *   Similar to traditional RAID the parity/mirror data is reconstructed
+ *   but cannot be immediately double checked.  For this reason when the
+ *   last active resilver completes the pool is automatically scrubbed
+ *   by default.
+ *
+ * - Deferred resilvers using sequential reconstruction are not currently
+ *   supported.  When adding another vdev to an active top-level resilver
+ *   it must be restarted.
+ *
+ * - Since the allocated space maps are walked, rather than the block pointers,
+ *   each top-level vdev is rebuilt independently and its progress tracked in
+ *   its top-level ZAP.  Progress is reported through the pool scan status as
+ *   a POOL_SCAN_REBUILD.
+ *
+ * - Since the block pointers are not walked the data being rebuilt is not
+ *   known and the reads are issued with a synthetic, checksum-less block
+ *   pointer.  The mirror vdev then writes the data it read to any child
+ *   whose DTL indicates it is missing data.  See vdev_mirror_io_done().
+ *   A dRAID vdev reads full stripes, reconstructs the columns of children
+ *   missing data from parity and rewrites them.  See vdev_draid_io_done().
+ */
+
+/*
+ * Maximum size of a rebuild read.  Larger segments are broken up into
+ * chunks of at most this size.
+ */
+unsigned long zfs_rebuild_max_segment = 1024 * 1024;
+
+/*
+ * Maximum number of bytes of rebuild reads outstanding per leaf vdev of
+ * the top-level vdev being rebuilt.
+ */
+unsigned long zfs_rebuild_vdev_limit = 32 << 20;
+
+/*
+ * Automatically start a pool scrub when the last active sequential resilver
+ * completes in order to verify the checksums of all blocks which have been
+ * resilvered.  This option is enabled by default and is strongly recommended.
+ */
+int zfs_rebuild_scrub_enabled = 1;
+
+/*
+ * For vdev_rebuild_initiate_sync() and vdev_rebuild_reset_sync().
+ */
+static void vdev_rebuild_thread(void *arg);
+
+/*
+ * Returns the newest txg at which any leaf under the top-level vdev was
+ * attached for a sequential rebuild and still has missing data, or zero
+ * when no leaf requires a rebuild.
+ */
+static uint64_t
+vdev_rebuild_max_txg(vdev_t *vd)
+{
+	uint64_t txg = 0;
+
+	if (vd->vdev_ops->vdev_op_leaf) {
+		if (vd->vdev_rebuild_txg != 0 &&
+		    !vdev_dtl_empty(vd, DTL_MISSING))
+			txg = vd->vdev_rebuild_txg;
+		return (txg);
+	}
+
+	for (uint64_t i = 0; i < vd->vdev_children; i++)
+		txg = MAX(txg, vdev_rebuild_max_txg(vd->vdev_child[i]));
+
+	return (txg);
+}
+
+/*
+ * Determine if a rebuild should be stopped.  Either because the top-level
+ * vdev can no longer be written, it is being removed, or because the
+ * rebuild has been asked to exit, be canceled, or be restarted.
+ */
+static boolean_t
+vdev_rebuild_should_stop(vdev_t *vd)
+{
+	return (!vdev_writeable(vd) || vd->vdev_removing ||
+	    vd->vdev_rebuild_exit_wanted ||
+	    vd->vdev_rebuild_cancel_wanted ||
+	    vd->vdev_rebuild_reset_wanted);
+}
+
+/*
+ * Determine if the rebuild should be canceled.  This happens when all of
+ * the children with missing data have been detached.
+ */
+static boolean_t
+vdev_rebuild_should_cancel(vdev_t *vd)
+{
+	return (vdev_rebuild_max_txg(vd) == 0);
+}
+
+/*
+ * The sync task for updating the on-disk state of a rebuild.  This is
+ * scheduled by vdev_rebuild_range().
+ */
+static void
+vdev_rebuild_update_sync(void *arg, dmu_tx_t *tx)
+{
+	int vdev_id = (uintptr_t)arg;
+	spa_t *spa = dmu_tx_pool(tx)->dp_spa;
+	vdev_t *vd = vdev_lookup_top(spa, vdev_id);
+	vdev_rebuild_t *vr = &vd->vdev_rebuild_config;
+	vdev_rebuild_phys_t *vrp = &vr->vr_rebuild_phys;
+	uint64_t txg = dmu_tx_get_txg(tx);
+
+	mutex_enter(&vd->vdev_rebuild_lock);
+
+	if (vr->vr_scan_offset[txg & TXG_MASK] > 0) {
+		vrp->vrp_last_offset = vr->vr_scan_offset[txg & TXG_MASK];
+		vr->vr_scan_offset[txg & TXG_MASK] = 0;
+	}
+
+	vrp->vrp_scan_time_ms = vr->vr_prev_scan_time_ms +
+	    NSEC2MSEC(gethrtime() - vr->vr_pass_start_time);
+
+	VERIFY0(zap_update(vd->vdev_spa->spa_meta_objset, vd->vdev_top_zap,
+	    VDEV_TOP_ZAP_VDEV_REBUILD_PHYS, sizeof (uint64_t),
+	    REBUILD_PHYS_ENTRIES, vrp, tx));
+
+	mutex_exit(&vd->vdev_rebuild_lock);
+}
+
+/*
+ * Reset the rebuild state for a new pass starting in this txg and start
+ * the rebuild thread.  Shared by the initiate and reset sync tasks.
+ */
+static void
+vdev_rebuild_start_sync(vdev_t *vd, dmu_tx_t *tx)
+{
+	vdev_rebuild_t *vr = &vd->vdev_rebuild_config;
+	vdev_rebuild_phys_t *vrp = &vr->vr_rebuild_phys;
+
+	ASSERT(MUTEX_HELD(&vd->vdev_rebuild_lock));
+	ASSERT(vd->vdev_rebuilding);
+	ASSERT3P(vd->vdev_rebuild_thread, ==, NULL);
+
+	vrp->vrp_rebuild_state = VDEV_REBUILD_ACTIVE;
+	vrp->vrp_last_offset = 0;
+	vrp->vrp_min_txg = 0;
+	vrp->vrp_max_txg = dmu_tx_get_txg(tx);
+	vrp->vrp_bytes_scanned = 0;
+	vrp->vrp_bytes_issued = 0;
+	vrp->vrp_bytes_rebuilt = 0;
+	vrp->vrp_bytes_est = 0;
+	vrp->vrp_scan_time_ms = 0;
+	vr->vr_prev_scan_time_ms = 0;
+	vd->vdev_rebuild_reset_wanted = B_FALSE;
+
+	VERIFY0(zap_update(vd->vdev_spa->spa_meta_objset, vd->vdev_top_zap,
+	    VDEV_TOP_ZAP_VDEV_REBUILD_PHYS, sizeof (uint64_t),
+	    REBUILD_PHYS_ENTRIES, vrp, tx));
+
+	vd->vdev_rebuild_thread = thread_create(NULL, 0,
+	    vdev_rebuild_thread, vd, 0, &p0, TS_RUN, maxclsyspri);
+}
+
+/*
+ * Initialize the on-disk state for a new rebuild and start the rebuild
+ * thread.  This is scheduled by vdev_rebuild_initiate().
+ */
+static void
+vdev_rebuild_initiate_sync(void *arg, dmu_tx_t *tx)
+{
+	int vdev_id = (uintptr_t)arg;
+	spa_t *spa = dmu_tx_pool(tx)->dp_spa;
+	vdev_t *vd = vdev_lookup_top(spa, vdev_id);
+	vdev_rebuild_t *vr = &vd->vdev_rebuild_config;
+	vdev_rebuild_phys_t *vrp = &vr->vr_rebuild_phys;
+
+	mutex_enter(&vd->vdev_rebuild_lock);
+
+	bzero(vrp, sizeof (uint64_t) * REBUILD_PHYS_ENTRIES);
+	vrp->vrp_start_time = gethrestime_sec();
+	vdev_rebuild_start_sync(vd, tx);
+
+	spa_history_log_internal(spa, "rebuild", tx,
+	    "vdev_id=%llu vdev_guid=%llu started",
+	    (u_longlong_t)vd->vdev_id, (u_longlong_t)vd->vdev_guid);
+
+	mutex_exit(&vd->vdev_rebuild_lock);
+}
+
+/*
+ * Restart a rebuild from the beginning because another child, which was
+ * not covered by vrp_max_txg, was attached while it was running.  The
+ * original start time is kept.
+ */
+static void
+vdev_rebuild_reset_sync(void *arg, dmu_tx_t *tx)
+{
+	int vdev_id = (uintptr_t)arg;
+	spa_t *spa = dmu_tx_pool(tx)->dp_spa;
+	vdev_t *vd = vdev_lookup_top(spa, vdev_id);
+
+	mutex_enter(&vd->vdev_rebuild_lock);
+
+	ASSERT3U(vd->vdev_rebuild_config.vr_rebuild_phys.vrp_rebuild_state,
+	    ==, VDEV_REBUILD_ACTIVE);
+	vdev_rebuild_start_sync(vd, tx);
+
+	spa_history_log_internal(spa, "rebuild", tx,
+	    "vdev_id=%llu vdev_guid=%llu reset",
+	    (u_longlong_t)vd->vdev_id, (u_longlong_t)vd->vdev_guid);
+
+	mutex_exit(&vd->vdev_rebuild_lock);
+}
+
+/*
+ * The rebuild was canceled because none of the children which were missing
+ * data remain attached.  This is scheduled by vdev_rebuild_thread().
+ */
+static void
+vdev_rebuild_cancel_sync(void *arg, dmu_tx_t *tx)
+{
+	int vdev_id = (uintptr_t)arg;
+	spa_t *spa = dmu_tx_pool(tx)->dp_spa;
+	vdev_t *vd = vdev_lookup_top(spa, vdev_id);
+	vdev_rebuild_t *vr = &vd->vdev_rebuild_config;
+	vdev_rebuild_phys_t *vrp = &vr->vr_rebuild_phys;
+
+	mutex_enter(&vd->vdev_rebuild_lock);
+
+	vrp->vrp_rebuild_state = VDEV_REBUILD_CANCELED;
+	vrp->vrp_end_time = gethrestime_sec();
+	VERIFY0(zap_update(spa->spa_meta_objset, vd->vdev_top_zap,
+	    VDEV_TOP_ZAP_VDEV_REBUILD_PHYS, sizeof (uint64_t),
+	    REBUILD_PHYS_ENTRIES, vrp, tx));
+
+	spa_history_log_internal(spa, "rebuild", tx,
+	    "vdev_id=%llu vdev_guid=%llu canceled",
+	    (u_longlong_t)vd->vdev_id, (u_longlong_t)vd->vdev_guid);
+
+	vd->vdev_rebuild_cancel_wanted = B_FALSE;
+	vd->vdev_rebuilding = B_FALSE;
+	cv_broadcast(&vd->vdev_rebuild_cv);
+
+	mutex_exit(&vd->vdev_rebuild_lock);
+}
+
+/*
+ * The sync task for completing a rebuild.  The DTLs of the rebuilt children
+ * are excised up to vrp_max_txg and the remaining post-rebuild work (the
+ * replacing vdev detach and the verification scrub) is handed off to the
+ * async thread.  This is scheduled by vdev_rebuild_thread().
+ */
+static void
+vdev_rebuild_complete_sync(void *arg, dmu_tx_t *tx)
+{
+	int vdev_id = (uintptr_t)arg;
+	spa_t *spa = dmu_tx_pool(tx)->dp_spa;
+	vdev_t *vd = vdev_lookup_top(spa, vdev_id);
+	vdev_rebuild_t *vr = &vd->vdev_rebuild_config;
+	vdev_rebuild_phys_t *vrp = &vr->vr_rebuild_phys;
+
+	mutex_enter(&vd->vdev_rebuild_lock);
+
+	/*
+	 * A child may have been attached after the rebuild thread finished
+	 * issuing I/O but before this sync task ran.  Since it was not covered
+	 * by this pass the rebuild must be restarted.
+	 */
+	if (vd->vdev_rebuild_reset_wanted) {
+		mutex_exit(&vd->vdev_rebuild_lock);
+		vdev_rebuild_reset_sync(arg, tx);
+		return;
+	}
+
+	vrp->vrp_rebuild_state = VDEV_REBUILD_COMPLETE;
+	vrp->vrp_end_time = gethrestime_sec();
+	VERIFY0(zap_update(spa->spa_meta_objset, vd->vdev_top_zap,
+	    VDEV_TOP_ZAP_VDEV_REBUILD_PHYS, sizeof (uint64_t),
+	    REBUILD_PHYS_ENTRIES, vrp, tx));
+
+	spa_history_log_internal(spa, "rebuild", tx,
+	    "vdev_id=%llu vdev_guid=%llu complete",
+	    (u_longlong_t)vd->vdev_id, (u_longlong_t)vd->vdev_guid);
+	vdev_dbgmsg(vd, "rebuilt %llu bytes with %llu errors",
+	    (u_longlong_t)vrp->vrp_bytes_rebuilt,
+	    (u_longlong_t)vrp->vrp_errors);
+
+	vd->vdev_rebuilding = B_FALSE;
+	cv_broadcast(&vd->vdev_rebuild_cv);
+	mutex_exit(&vd->vdev_rebuild_lock);
+
+	/*
+	 * Unlike a resilver the entire allocated space was copied, so every
+	 * DTL range up to vrp_max_txg has been rebuilt unless there were
+	 * errors.  See vdev_dtl_should_excise().
+	 */
+	vdev_dtl_reassess(vd, tx->tx_txg, vrp->vrp_max_txg, B_FALSE, B_TRUE);
+
+	spa_async_request(spa, SPA_ASYNC_REBUILD_DONE);
+	spa_event_notify(spa, vd, NULL, ESC_ZFS_RESILVER_FINISH);
+}
+
+/*
+ * Update the estimated total number of bytes to be rebuilt.  This is the
+ * bytes already scanned plus the space allocated in the metaslabs which
+ * have yet to be scanned.
+ */
+static void
+vdev_rebuild_update_bytes_est(vdev_t *vd, uint64_t ms_id)
+{
+	vdev_rebuild_t *vr = &vd->vdev_rebuild_config;
+	vdev_rebuild_phys_t *vrp = &vr->vr_rebuild_phys;
+	uint64_t bytes_est = vrp->vrp_bytes_scanned;
+
+	ASSERT(MUTEX_HELD(&vd->vdev_rebuild_lock));
+
+	for (uint64_t i = ms_id; i < vd->vdev_ms_count; i++) {
+		metaslab_t *msp = vd->vdev_ms[i];
+
+		mutex_enter(&msp->ms_lock);
+		bytes_est += metaslab_allocated_space(msp);
+		mutex_exit(&msp->ms_lock);
+	}
+
+	vrp->vrp_bytes_est = bytes_est;
+}
+
+static void
+vdev_rebuild_cb(zio_t *zio)
+{
+	vdev_rebuild_t *vr = zio->io_private;
+	vdev_rebuild_phys_t *vrp = &vr->vr_rebuild_phys;
+	vdev_t *vd = vr->vr_top_vdev;
+
+	mutex_enter(&vr->vr_io_lock);
+	if (zio->io_error == ENXIO && !vdev_writeable(vd)) {
+		/*
+		 * The I/O failed because the top-level vdev was unavailable.
+		 * Roll back to the last completed offset so the rebuild
+		 * resumes from the correct location.  (This works because
+		 * spa_sync waits on spa_txg_zio before it runs sync tasks.)
+		 */
+		uint64_t *off = &vr->vr_scan_offset[zio->io_txg & TXG_MASK];
+		*off = MIN(*off, zio->io_offset);
+	} else if (zio->io_error) {
+		atomic_inc_64(&vrp->vrp_errors);
+	}
+
+	abd_free(zio->io_abd);
+
+	ASSERT3U(vr->vr_bytes_inflight, >=, zio->io_size);
+	vr->vr_bytes_inflight -= zio->io_size;
+	cv_broadcast(&vr->vr_io_cv);
+	mutex_exit(&vr->vr_io_lock);
+
+	spa_config_exit(vd->vdev_spa, SCL_STATE_ALL, vd);
+}
+
+/*
+ * Rebuild the data in this range by constructing a special block pointer.
+ * The mirror vdev reads a good copy from a child which is not missing the
+ * data, then writes it to every child whose DTL indicates it is missing.
+ * A dRAID vdev instead reads the full stripes in the range and rewrites
+ * the columns it reconstructs from parity.
+ * The checksum is disabled since it is not known, and verification is
+ * left to the scrub which follows the rebuild.
+ */
+static int
+vdev_rebuild_range(vdev_rebuild_t *vr, uint64_t start, uint64_t size)
+{
+	vdev_t *vd = vr->vr_top_vdev;
+	spa_t *spa = vd->vdev_spa;
+
+	ASSERT(vd->vdev_ops == &vdev_mirror_ops ||
+	    vd->vdev_ops == &vdev_replacing_ops ||
+	    vd->vdev_ops == &vdev_spare_ops ||
+	    vd->vdev_ops == &vdev_draid_ops);
+
+	/*
+	 * A dRAID range is a whole number of full stripes, only the data
+	 * columns are read into the buffer.
+	 */
+	uint64_t psize = size;
+	if (vd->vdev_ops == &vdev_draid_ops) {
+		vdev_draid_config_t *vdc = vd->vdev_tsd;
+		psize = size / vdc->vdc_groupwidth * vdc->vdc_ndata;
+	}
+
+	vr->vr_pass_bytes_scanned += size;
+	vr->vr_rebuild_phys.vrp_bytes_scanned += size;
+
+	mutex_enter(&vr->vr_io_lock);
+
+	/* Limit in flight rebuild I/Os */
+	while (vr->vr_bytes_inflight >= vr->vr_bytes_inflight_max)
+		cv_wait(&vr->vr_io_cv, &vr->vr_io_lock);
+
+	vr->vr_bytes_inflight += psize;
+	mutex_exit(&vr->vr_io_lock);
+
+	dmu_tx_t *tx = dmu_tx_create_dd(spa_get_dsl(spa)->dp_mos_dir);
+	VERIFY0(dmu_tx_assign(tx, TXG_WAIT));
+	uint64_t txg = dmu_tx_get_txg(tx);
+
+	spa_config_enter(spa, SCL_STATE_ALL, vd, RW_READER);
+	mutex_enter(&vd->vdev_rebuild_lock);
+
+	/* This is the first I/O for this txg. */
+	if (vr->vr_scan_offset[txg & TXG_MASK] == 0) {
+		vr->vr_scan_offset[txg & TXG_MASK] = start;
+		dsl_sync_task_nowait(spa_get_dsl(spa),
+		    vdev_rebuild_update_sync,
+		    (void *)(uintptr_t)vd->vdev_id, 2,
+		    ZFS_SPACE_CHECK_RESERVED, tx);
+	}
+
+	/* When exiting write out our progress. */
+	if (vdev_rebuild_should_stop(vd)) {
+		mutex_enter(&vr->vr_io_lock);
+		vr->vr_bytes_inflight -= psize;
+		mutex_exit(&vr->vr_io_lock);
+		spa_config_exit(vd->vdev_spa, SCL_STATE_ALL, vd);
+		mutex_exit(&vd->vdev_rebuild_lock);
+		dmu_tx_commit(tx);
+		return (SET_ERROR(EINTR));
+	}
+	mutex_exit(&vd->vdev_rebuild_lock);
+
+	vr->vr_scan_offset[txg & TXG_MASK] = start + size;
+
+	blkptr_t blk, *bp = &blk;
+	BP_ZERO(bp);
+
+	DVA_SET_VDEV(&bp->blk_dva[0], vd->vdev_id);
+	DVA_SET_OFFSET(&bp->blk_dva[0], start);
+	DVA_SET_GANG(&bp->blk_dva[0], 0);
+	DVA_SET_ASIZE(&bp->blk_dva[0], size);
+
+	BP_SET_BIRTH(bp, TXG_INITIAL, TXG_INITIAL);
+	BP_SET_LSIZE(bp, psize);
+	BP_SET_PSIZE(bp, psize);
+	BP_SET_COMPRESS(bp, ZIO_COMPRESS_OFF);
+	BP_SET_CHECKSUM(bp, ZIO_CHECKSUM_OFF);
+	BP_SET_TYPE(bp, DMU_OT_NONE);
+	BP_SET_LEVEL(bp, 0);
+	BP_SET_DEDUP(bp, 0);
+	BP_SET_BYTEORDER(bp, ZFS_HOST_BYTEORDER);
+
+	vr->vr_pass_bytes_issued += size;
+	vr->vr_rebuild_phys.vrp_bytes_issued += size;
+
+	zio_nowait(zio_read(spa->spa_txg_zio[txg & TXG_MASK], spa, bp,
+	    abd_alloc(psize, B_FALSE), psize, vdev_rebuild_cb, vr,
+	    ZIO_PRIORITY_SCRUB, ZIO_FLAG_RAW | ZIO_FLAG_CANFAIL |
+	    ZIO_FLAG_RESILVER, NULL));
+	/* vdev_rebuild_cb releases SCL_STATE_ALL */
+
+	dmu_tx_commit(tx);
+
+	return (0);
+}
+
+/*
+ * Issues rebuild I/Os for all ranges in the vr_scan_tree, splitting them
+ * into chunks of at most zfs_rebuild_max_segment bytes.
+ */
+static int
+vdev_rebuild_ranges(vdev_rebuild_t *vr)
+{
+	vdev_t *vd = vr->vr_top_vdev;
+	range_tree_t *rt = vr->vr_scan_tree;
+	zfs_btree_t *t = &rt->rt_root;
+	zfs_btree_index_t idx;
+	uint64_t max_segment = MIN(MAX(zfs_rebuild_max_segment,
+	    1ULL << vd->vdev_ashift), SPA_MAXBLOCKSIZE);
+	int error;
+
+	max_segment = P2ALIGN(max_segment, 1ULL << vd->vdev_ashift);
+
+	/* dRAID must be rebuilt in whole stripes of its redundancy groups */
+	if (vd->vdev_ops == &vdev_draid_ops) {
+		vdev_draid_config_t *vdc = vd->vdev_tsd;
+		uint64_t stripe = vdc->vdc_groupwidth << vd->vdev_ashift;
+
+		max_segment = MAX(max_segment / stripe, 1) * stripe;
+	}
+
+	for (range_seg_t *rs = zfs_btree_first(t, &idx); rs != NULL;
+	    rs = zfs_btree_next(t, &idx, &idx)) {
+		uint64_t start = rs_get_start(rs, rt);
+		uint64_t size = rs_get_end(rs, rt) - start;
+
+		/*
+		 * zfs_scan_suspend_progress can be set to disable rebuild
+		 * progress for testing.  See comment in dsl_scan_sync().
+		 */
+		while (zfs_scan_suspend_progress &&
+		    !vdev_rebuild_should_stop(vd)) {
+			delay(hz);
+		}
+
+		while (size > 0) {
+			uint64_t chunk_size = MIN(size, max_segment);
+
+			error = vdev_rebuild_range(vr, start, chunk_size);
+			if (error != 0)
+				return (error);
+
+			size -= chunk_size;
+			start += chunk_size;
+		}
+	}
+
+	return (0);
+}
+
+/*
+ * The rebuild thread walks the metaslabs of the top-level vdev in order
+ * and issues rebuild I/O for every allocated range in its space map.
+ */
+static void
+vdev_rebuild_thread(void *arg)
+{
+	vdev_t *vd = arg;
+	spa_t *spa = vd->vdev_spa;
+	dsl_pool_t *dp = spa_get_dsl(spa);
+	int error = 0;
+
+	spa_config_enter(spa, SCL_CONFIG, FTAG, RW_READER);
+	mutex_enter(&vd->vdev_rebuild_lock);
+
+	ASSERT3P(vd, ==, vd->vdev_top);
+	ASSERT3P(vd->vdev_rebuild_thread, !=, NULL);
+	ASSERT(vd->vdev_rebuilding);
+	ASSERT3B(vd->vdev_rebuild_cancel_wanted, ==, B_FALSE);
+
+	vdev_rebuild_t *vr = &vd->vdev_rebuild_config;
+	vdev_rebuild_phys_t *vrp = &vr->vr_rebuild_phys;
+	vr->vr_top_vdev = vd;
+	vr->vr_scan_tree = range_tree_create(NULL, RANGE_SEG64, NULL, 0, 0);
+	vr->vr_bytes_inflight = 0;
+	vr->vr_bytes_inflight_max = MAX(1ULL << 20,
+	    zfs_rebuild_vdev_limit * vd->vdev_children);
+
+	vr->vr_pass_start_time = gethrtime();
+	vr->vr_pass_bytes_scanned = 0;
+	vr->vr_pass_bytes_issued = 0;
+
+	uint64_t update_est_time = gethrtime();
+	vdev_rebuild_update_bytes_est(vd,
+	    vrp->vrp_last_offset >> vd->vdev_ms_shift);
+
+	mutex_exit(&vd->vdev_rebuild_lock);
+
+	/*
+	 * Systematically walk the metaslabs and issue rebuild I/Os for
+	 * all ranges in the allocated space map.
+	 */
+	for (uint64_t i = 0; i < vd->vdev_ms_count; i++) {
+		metaslab_t *msp = vd->vdev_ms[i];
+
+		/*
+		 * Detaching children from the vdev tree may eliminate the
+		 * need for the rebuild, in which case it should be canceled.
+		 * The vdev_rebuild_cancel_wanted flag is set until the sync
+		 * task completes, which may be after the thread exits.
+		 */
+		if (vdev_rebuild_should_cancel(vd)) {
+			mutex_enter(&vd->vdev_rebuild_lock);
+			vd->vdev_rebuild_cancel_wanted = B_TRUE;
+			mutex_exit(&vd->vdev_rebuild_lock);
+			error = EINTR;
+			break;
+		}
+
+		/* Skip metaslabs which have already been rebuilt. */
+		if (msp->ms_start + msp->ms_size <= vrp->vrp_last_offset)
+			continue;
+
+		/*
+		 * Skip metaslabs which don't need to be rebuilt.  For dRAID
+		 * these are the redundancy groups which are not stored on
+		 * any of the children being rebuilt.
+		 */
+		if (!vdev_dtl_need_resilver(vd, msp->ms_start, msp->ms_size))
+			continue;
+
+		ASSERT0(range_tree_space(vr->vr_scan_tree));
+
+		/* Disable any new allocations to this metaslab */
+		spa_config_exit(spa, SCL_CONFIG, FTAG);
+		metaslab_disable(msp);
+
+		mutex_enter(&msp->ms_sync_lock);
+		mutex_enter(&msp->ms_lock);
+
+		/*
+		 * If there are outstanding allocations wait for them to be
+		 * synced.  This is needed to ensure all allocated ranges are
+		 * on disk and therefore will be rebuilt.
+		 */
+		for (int j = 0; j < TXG_SIZE; j++) {
+			if (range_tree_space(msp->ms_allocating[j])) {
+				mutex_exit(&msp->ms_lock);
+				mutex_exit(&msp->ms_sync_lock);
+				txg_wait_synced(dp, 0);
+				mutex_enter(&msp->ms_sync_lock);
+				mutex_enter(&msp->ms_lock);
+				break;
+			}
+		}
+
+		/*
+		 * When a metaslab has been allocated from, read its allocated
+		 * ranges from the space map object into the vr_scan_tree.
+		 * Then add the unflushed allocations and remove the unflushed
+		 * frees.  This is the minimum range to be rebuilt.
+		 */
+		if (msp->ms_sm != NULL) {
+			VERIFY0(space_map_load(msp->ms_sm,
+			    vr->vr_scan_tree, SM_ALLOC));
+
+			range_tree_walk(msp->ms_unflushed_allocs,
+			    range_tree_add, vr->vr_scan_tree);
+			range_tree_walk(msp->ms_unflushed_frees,
+			    range_tree_remove, vr->vr_scan_tree);
+
+			/*
+			 * Remove ranges which have already been rebuilt based
+			 * on the last offset.  This can happen when restarting
+			 * a scan after exporting and re-importing the pool.
+			 */
+			range_tree_clear(vr->vr_scan_tree, 0,
+			    vrp->vrp_last_offset);
+		}
+
+		mutex_exit(&msp->ms_lock);
+		mutex_exit(&msp->ms_sync_lock);
+
+		/*
+		 * To provide an accurate estimate re-calculate the estimated
+		 * size every 5 minutes to account for recent allocations and
+		 * frees made to space maps which have not yet been rebuilt.
+		 */
+		if (gethrtime() > update_est_time + SEC2NSEC(300)) {
+			update_est_time = gethrtime();
+			mutex_enter(&vd->vdev_rebuild_lock);
+			vdev_rebuild_update_bytes_est(vd, i);
+			mutex_exit(&vd->vdev_rebuild_lock);
+		}
+
+		/*
+		 * Walk the allocated space map and issue the rebuild I/O.
+		 */
+		error = vdev_rebuild_ranges(vr);
+		range_tree_vacate(vr->vr_scan_tree, NULL, NULL);
+
+		metaslab_enable(msp, B_FALSE);
+		spa_config_enter(spa, SCL_CONFIG, FTAG, RW_READER);
+
+		if (error != 0)
+			break;
+	}
+
+	range_tree_destroy(vr->vr_scan_tree);
+	vr->vr_scan_tree = NULL;
+	spa_config_exit(spa, SCL_CONFIG, FTAG);
+
+	/* Wait for any remaining rebuild I/O to complete */
+	mutex_enter(&vr->vr_io_lock);
+	while (vr->vr_bytes_inflight > 0)
+		cv_wait(&vr->vr_io_cv, &vr->vr_io_lock);
+	mutex_exit(&vr->vr_io_lock);
+
+	dmu_tx_t *tx = dmu_tx_create_dd(dp->dp_mos_dir);
+	VERIFY0(dmu_tx_assign(tx, TXG_WAIT));
+
+	mutex_enter(&vd->vdev_rebuild_lock);
+	if (vd->vdev_rebuild_exit_wanted || !vdev_writeable(vd) ||
+	    vd->vdev_removing) {
+		/*
+		 * The rebuild operation should be suspended.  This may occur
+		 * when detaching a child vdev or when exporting the pool.  The
+		 * rebuild is left in the active state so it will be resumed.
+		 */
+		ASSERT3U(vrp->vrp_rebuild_state, ==, VDEV_REBUILD_ACTIVE);
+		vd->vdev_rebuilding = B_FALSE;
+	} else if (vd->vdev_rebuild_cancel_wanted) {
+		/*
+		 * The rebuild operation was canceled.  This will occur when
+		 * every child which was missing data was detached.
+		 */
+		dsl_sync_task_nowait(dp, vdev_rebuild_cancel_sync,
+		    (void *)(uintptr_t)vd->vdev_id, 0,
+		    ZFS_SPACE_CHECK_NONE, tx);
+	} else if (vd->vdev_rebuild_reset_wanted) {
+		/*
+		 * Reset the running rebuild without canceling and restarting
+		 * it.  This will occur when a new device is attached and must
+		 * participate in the rebuild.
+		 */
+		dsl_sync_task_nowait(dp, vdev_rebuild_reset_sync,
+		    (void *)(uintptr_t)vd->vdev_id, 0,
+		    ZFS_SPACE_CHECK_NONE, tx);
+	} else {
+		/*
+		 * After a successful rebuild clear the DTLs of all ranges
+		 * which were missing when the rebuild was started.  These
+		 * ranges must have been rebuilt as a consequence of rebuilding
+		 * all allocated space.  Note that unlike a scrub or resilver
+		 * the rebuild operation will reconstruct data only referenced
+		 * by a pool checkpoint.  See the dsl_scan_done() comments.
+		 */
+		ASSERT0(error);
+		dsl_sync_task_nowait(dp, vdev_rebuild_complete_sync,
+		    (void *)(uintptr_t)vd->vdev_id, 0,
+		    ZFS_SPACE_CHECK_NONE, tx);
+	}
+
+	vr->vr_prev_scan_time_ms = vrp->vrp_scan_time_ms;
+	vd->vdev_rebuild_thread = NULL;
+	cv_broadcast(&vd->vdev_rebuild_cv);
+	mutex_exit(&vd->vdev_rebuild_lock);
+
+	dmu_tx_commit(tx);
+}
+
+/*
+ * Returns B_TRUE if any top-level vdev rebuild is active, or if the given
+ * top-level vdev has an active rebuild.  A suspended rebuild is considered
+ * active since it will be resumed when the pool is next imported.
+ */
+boolean_t
+vdev_rebuild_active(vdev_t *vd)
+{
+	spa_t *spa = vd->vdev_spa;
+	boolean_t ret = B_FALSE;
+
+	if (vd == spa->spa_root_vdev) {
+		for (uint64_t i = 0; i < vd->vdev_children; i++) {
+			ret = vdev_rebuild_active(vd->vdev_child[i]);
+			if (ret)
+				return (ret);
+		}
+	} else if (vd->vdev_top_zap != 0) {
+		vdev_rebuild_t *vr = &vd->vdev_rebuild_config;
+		vdev_rebuild_phys_t *vrp = &vr->vr_rebuild_phys;
+
+		mutex_enter(&vd->vdev_rebuild_lock);
+		ret = (vd->vdev_rebuilding ||
+		    vrp->vrp_rebuild_state == VDEV_REBUILD_ACTIVE);
+		mutex_exit(&vd->vdev_rebuild_lock);
+	}
+
+	return (ret);
+}
+
+/*
+ * Load the rebuild state from the top-level vdev zap.  A missing or
+ * damaged VDEV_TOP_ZAP_VDEV_REBUILD_PHYS should not prevent a pool from
+ * being imported; the rebuild state is cleared allowing a new resilver
+ * or rebuild to be started.
+ */
+int
+vdev_rebuild_load(vdev_t *vd)
+{
+	vdev_rebuild_t *vr = &vd->vdev_rebuild_config;
+	vdev_rebuild_phys_t *vrp = &vr->vr_rebuild_phys;
+	spa_t *spa = vd->vdev_spa;
+	int err = 0;
+
+	mutex_enter(&vd->vdev_rebuild_lock);
+	vd->vdev_rebuilding = B_FALSE;
+
+	if (vd->vdev_top_zap == 0) {
+		bzero(vrp, sizeof (uint64_t) * REBUILD_PHYS_ENTRIES);
+		mutex_exit(&vd->vdev_rebuild_lock);
+		return (0);
+	}
+
+	err = zap_lookup(spa->spa_meta_objset, vd->vdev_top_zap,
+	    VDEV_TOP_ZAP_VDEV_REBUILD_PHYS, sizeof (uint64_t),
+	    REBUILD_PHYS_ENTRIES, vrp);
+
+	if (err == ENOENT || err == EOVERFLOW || err == ECKSUM) {
+		bzero(vrp, sizeof (uint64_t) * REBUILD_PHYS_ENTRIES);
+		err = 0;
+	}
+
+	vr->vr_prev_scan_time_ms = vrp->vrp_scan_time_ms;
+	vr->vr_top_vdev = vd;
+
+	mutex_exit(&vd->vdev_rebuild_lock);
+
+	return (err);
+}
+
+/*
+ * Start a sequential rebuild of the top-level vdev for any children which
+ * were attached for a rebuild after the last rebuild pass began.  If a
+ * rebuild is already running it is restarted so the new children are
+ * included.  This is called by the async thread on behalf of
+ * spa_vdev_attach() since a txg must be assigned.
+ */
+void
+vdev_rebuild(vdev_t *vd)
+{
+	spa_t *spa = vd->vdev_spa;
+	vdev_rebuild_t *vr = &vd->vdev_rebuild_config;
+	vdev_rebuild_phys_t *vrp = &vr->vr_rebuild_phys;
+
+	ASSERT(MUTEX_HELD(&spa_namespace_lock));
+	ASSERT(spa_config_held(spa, SCL_CONFIG, RW_READER));
+	ASSERT3P(vd, ==, vd->vdev_top);
+
+	if (!vdev_is_concrete(vd) || vd->vdev_top_zap == 0 ||
+	    vd->vdev_removing || !vdev_writeable(vd))
+		return;
+
+	uint64_t txg = vdev_rebuild_max_txg(vd);
+
+	dmu_tx_t *tx = dmu_tx_create_dd(spa_get_dsl(spa)->dp_mos_dir);
+	VERIFY0(dmu_tx_assign(tx, TXG_WAIT));
+
+	mutex_enter(&vd->vdev_rebuild_lock);
+	if (txg == 0 || txg <= vrp->vrp_max_txg) {
+		/* Every child missing data is covered by the last pass. */
+		mutex_exit(&vd->vdev_rebuild_lock);
+		dmu_tx_commit(tx);
+		return;
+	}
+
+	if (vd->vdev_rebuilding) {
+		/* Restart the running (or pending) rebuild. */
+		vd->vdev_rebuild_reset_wanted = B_TRUE;
+		mutex_exit(&vd->vdev_rebuild_lock);
+		dmu_tx_commit(tx);
+		return;
+	}
+
+	vd->vdev_rebuilding = B_TRUE;
+	dsl_sync_task_nowait(spa_get_dsl(spa), vdev_rebuild_initiate_sync,
+	    (void *)(uintptr_t)vd->vdev_id, 0, ZFS_SPACE_CHECK_NONE, tx);
+	mutex_exit(&vd->vdev_rebuild_lock);
+
+	dmu_tx_commit(tx);
+
+	spa_event_notify(spa, vd, NULL, ESC_ZFS_RESILVER_START);
+}
+
+static void
+vdev_rebuild_restart_impl(vdev_t *vd)
+{
+	vdev_rebuild_t *vr = &vd->vdev_rebuild_config;
+	vdev_rebuild_phys_t *vrp = &vr->vr_rebuild_phys;
+
+	mutex_enter(&vd->vdev_rebuild_lock);
+	if (vrp->vrp_rebuild_state == VDEV_REBUILD_ACTIVE &&
+	    vdev_writeable(vd) && !vd->vdev_removing &&
+	    !vd->vdev_rebuilding) {
+		ASSERT3P(vd->vdev_rebuild_thread, ==, NULL);
+		vd->vdev_rebuilding = B_TRUE;
+		vd->vdev_rebuild_thread = thread_create(NULL, 0,
+		    vdev_rebuild_thread, vd, 0, &p0, TS_RUN, maxclsyspri);
+	}
+	mutex_exit(&vd->vdev_rebuild_lock);
+}
+
+/*
+ * Resume any rebuilds which were suspended, either because the pool was
+ * exported or because a child of the top-level vdev was detached.
+ */
+void
+vdev_rebuild_restart(spa_t *spa)
+{
+	vdev_t *rvd = spa->spa_root_vdev;
+
+	ASSERT(MUTEX_HELD(&spa_namespace_lock));
+
+	for (uint64_t i = 0; i < rvd->vdev_children; i++) {
+		vdev_t *tvd = rvd->vdev_child[i];
+
+		if (vdev_is_concrete(tvd) && tvd->vdev_top_zap != 0)
+			vdev_rebuild_restart_impl(tvd);
+	}
+}
+
+/*
+ * Stop and wait for the rebuild thread of the top-level vdev to exit.  The
+ * rebuild is left in the active state so it may be resumed later.  The
+ * caller must not be holding the spa config lock, since the rebuild thread
+ * may try to enter it as a reader before exiting.
+ */
+void
+vdev_rebuild_stop_wait(vdev_t *vd)
+{
+	spa_t *spa = vd->vdev_spa;
+
+	ASSERT(MUTEX_HELD(&spa_namespace_lock));
+	ASSERT(!spa_config_held(spa, SCL_CONFIG | SCL_STATE, RW_WRITER));
+
+	if (vd != vd->vdev_top || !vdev_is_concrete(vd))
+		return;
+
+	mutex_enter(&vd->vdev_rebuild_lock);
+	vd->vdev_rebuild_exit_wanted = B_TRUE;
+	while (vd->vdev_rebuilding) {
+		if (vd->vdev_rebuild_thread != NULL) {
+			cv_wait(&vd->vdev_rebuild_cv, &vd->vdev_rebuild_lock);
+		} else if (spa->spa_sync_on) {
+			/*
+			 * A sync task which will start, restart, or finish
+			 * the rebuild is pending; let it run.
+			 */
+			mutex_exit(&vd->vdev_rebuild_lock);
+			txg_wait_synced(spa_get_dsl(spa), 0);
+			mutex_enter(&vd->vdev_rebuild_lock);
+		} else {
+			break;
+		}
+	}
+	vd->vdev_rebuild_exit_wanted = B_FALSE;
+	mutex_exit(&vd->vdev_rebuild_lock);
+}
+
+/*
+ * Stop all rebuild operations but leave them in the active state so they
+ * will be resumed when the pool is imported.
+ */
+void
+vdev_rebuild_stop_all(spa_t *spa)
+{
+	vdev_t *rvd = spa->spa_root_vdev;
+
+	ASSERT(MUTEX_HELD(&spa_namespace_lock));
+
+	for (uint64_t i = 0; i < rvd->vdev_children; i++)
+		vdev_rebuild_stop_wait(rvd->vdev_child[i]);
+}
+
+/*
+ * Return the combined progress of the active rebuilds, or of the most
+ * recently finished rebuild, in the form of pool scan statistics.
+ */
+int
+vdev_rebuild_get_stats(vdev_t *rvd, pool_scan_stat_t *ps)
+{
+	vdev_t *last = NULL;
+	boolean_t active = B_FALSE;
+
+	ASSERT3P(rvd, ==, rvd->vdev_spa->spa_root_vdev);
+
+	bzero(ps, sizeof (pool_scan_stat_t));
+	ps->pss_func = POOL_SCAN_REBUILD;
+
+	for (uint64_t i = 0; i < rvd->vdev_children; i++) {
+		vdev_t *tvd = rvd->vdev_child[i];
+		vdev_rebuild_t *vr = &tvd->vdev_rebuild_config;
+		vdev_rebuild_phys_t *vrp = &vr->vr_rebuild_phys;
+
+		if (tvd->vdev_top_zap == 0)
+			continue;
+
+		mutex_enter(&tvd->vdev_rebuild_lock);
+		if (vrp->vrp_rebuild_state == VDEV_REBUILD_ACTIVE) {
+			uint64_t pass_start = gethrestime_sec();
+
+			if (tvd->vdev_rebuilding) {
+				pass_start -= NSEC2SEC(gethrtime() -
+				    vr->vr_pass_start_time);
+			}
+
+			if (!active || vrp->vrp_start_time < ps->pss_start_time)
+				ps->pss_start_time = vrp->vrp_start_time;
+			if (!active || pass_start < ps->pss_pass_start)
+				ps->pss_pass_start = pass_start;
+
+			ps->pss_state = DSS_SCANNING;
+			ps->pss_to_examine += vrp->vrp_bytes_est;
+			ps->pss_examined += vrp->vrp_bytes_scanned;
+			ps->pss_issued += vrp->vrp_bytes_issued;
+			ps->pss_processed += vrp->vrp_bytes_rebuilt;
+			ps->pss_errors += vrp->vrp_errors;
+			if (tvd->vdev_rebuilding) {
+				ps->pss_pass_exam += vr->vr_pass_bytes_scanned;
+				ps->pss_pass_issued +=
+				    vr->vr_pass_bytes_issued;
+			}
+			active = B_TRUE;
+		} else if (vrp->vrp_rebuild_state != VDEV_REBUILD_NONE &&
+		    (last == NULL || vrp->vrp_end_time >
+		    last->vdev_rebuild_config.vr_rebuild_phys.vrp_end_time)) {
+			last = tvd;
+		}
+		mutex_exit(&tvd->vdev_rebuild_lock);
+	}
+
+	if (active)
+		return (0);
+
+	if (last == NULL)
+		return (SET_ERROR(ENOENT));
+
+	mutex_enter(&last->vdev_rebuild_lock);
+	vdev_rebuild_phys_t *vrp = &last->vdev_rebuild_config.vr_rebuild_phys;
+	ps->pss_state = (vrp->vrp_rebuild_state == VDEV_REBUILD_COMPLETE) ?
+	    DSS_FINISHED : DSS_CANCELED;
+	ps->pss_start_time = vrp->vrp_start_time;
+	ps->pss_end_time = vrp->vrp_end_time;
+	ps->pss_to_examine = vrp->vrp_bytes_est;
+	ps->pss_examined = vrp->vrp_bytes_scanned;
+	ps->pss_issued = vrp->vrp_bytes_issued;
+	ps->pss_processed = vrp->vrp_bytes_rebuilt;
+	ps->pss_errors = vrp->vrp_errors;
+	mutex_exit(&last->vdev_rebuild_lock);
+
+	return (0);
+}
+
+#if defined(_KERNEL)
+EXPORT_SYMBOL(vdev_rebuild);
+EXPORT_SYMBOL(vdev_rebuild_active);
+EXPORT_SYMBOL(vdev_rebuild_restart);
+EXPORT_SYMBOL(vdev_rebuild_stop_wait);
+EXPORT_SYMBOL(vdev_rebuild_stop_all);
+EXPORT_SYMBOL(vdev_rebuild_get_stats);
+
+/* CSTYLED */
+ZFS_MODULE_PARAM(zfs, zfs_, rebuild_max_segment, UQUAD, ZMOD_RW,
+	"Max segment size in bytes of rebuild reads");
+
+/* CSTYLED */
+ZFS_MODULE_PARAM(zfs, zfs_, rebuild_vdev_limit, UQUAD, ZMOD_RW,
+	"Max bytes in flight per leaf vdev for sequential resilvers");
+
+ZFS_MODULE_PARAM(zfs, zfs_, rebuild_scrub_enabled, UINT, ZMOD_RW,
+	"Automatically scrub after sequential resilver completes");
+#endif
@@ -108,6 +108,7 @@ fzap_upgrade(zap_t *zap, dmu_tx_t *tx, zap_flags_t flags)
 	zap->zap_dbu.dbu_evict_func_async = NULL;
 
 	mutex_init(&zap->zap_f.zap_num_entries_mtx, 0, MUTEX_DEFAULT, 0);
+	mutex_init(&zap->zap_f.zap_split_mtx, 0, MUTEX_DEFAULT, 0);
 	zap->zap_f.zap_block_shift = highbit64(zap->zap_dbuf->db_size) - 1;
 
 	zap_phys_t *zp = zap_f_phys(zap);
@@ -407,7 +408,8 @@ zap_increment_num_entries(zap_t *zap, int delta, dmu_tx_t *tx)
 static uint64_t
 zap_allocate_blocks(zap_t *zap, int nblocks)
 {
-	ASSERT(RW_WRITE_HELD(&zap->zap_rwlock));
+	ASSERT(RW_WRITE_HELD(&zap->zap_rwlock) ||
+	    MUTEX_HELD(&zap->zap_f.zap_split_mtx));
 	uint64_t newblk = zap_f_phys(zap)->zap_freeblk;
 	zap_f_phys(zap)->zap_freeblk += nblocks;
 	return (newblk);
@@ -427,11 +429,14 @@ zap_create_leaf(zap_t *zap, dmu_tx_t *tx)
 {
 	zap_leaf_t *l = kmem_zalloc(sizeof (zap_leaf_t), KM_SLEEP);
 
-	ASSERT(RW_WRITE_HELD(&zap->zap_rwlock));
+	ASSERT(RW_LOCK_HELD(&zap->zap_rwlock));
 
 	rw_init(&l->l_rwlock, NULL, RW_NOLOCKDEP, NULL);
 	rw_enter(&l->l_rwlock, RW_WRITER);
+	mutex_enter(&zap->zap_f.zap_split_mtx);
 	l->l_blkid = zap_allocate_blocks(zap, 1);
+	zap_f_phys(zap)->zap_num_leafs++;
+	mutex_exit(&zap->zap_f.zap_split_mtx);
 	l->l_dbuf = NULL;
 
 	VERIFY0(dmu_buf_hold(zap->zap_objset, zap->zap_object,
@@ -443,8 +448,6 @@ zap_create_leaf(zap_t *zap, dmu_tx_t *tx)
 
 	zap_leaf_init(l, zap->zap_normflags != 0);
 
-	zap_f_phys(zap)->zap_num_leafs++;
-
 	return (l);
 }
 
@@ -587,7 +590,8 @@ static int
 zap_set_idx_to_blk(zap_t *zap, uint64_t idx, uint64_t blk, dmu_tx_t *tx)
 {
 	ASSERT(tx != NULL);
-	ASSERT(RW_WRITE_HELD(&zap->zap_rwlock));
+	ASSERT(RW_WRITE_HELD(&zap->zap_rwlock) ||
+	    MUTEX_HELD(&zap->zap_f.zap_split_mtx));
 
 	if (zap_f_phys(zap)->zap_ptrtbl.zt_blk == 0) {
 		ZAP_EMBEDDED_PTRTBL_ENT(zap, idx) = blk;
@@ -601,7 +605,7 @@ zap_set_idx_to_blk(zap_t *zap, uint64_t idx, uint64_t blk, dmu_tx_t *tx)
 static int
 zap_deref_leaf(zap_t *zap, uint64_t h, dmu_tx_t *tx, krw_t lt, zap_leaf_t **lp)
 {
-	uint64_t blk;
+	uint64_t blk, lastblk = 0;
 
 	ASSERT(zap->zap_dbuf == NULL ||
 	    zap_f_phys(zap) == zap->zap_dbuf->db_data);
@@ -613,16 +617,32 @@ zap_deref_leaf(zap_t *zap, uint64_t h, dmu_tx_t *tx, krw_t lt, zap_leaf_t **lp)
 		return (SET_ERROR(EIO));
 	}
 
-	uint64_t idx = ZAP_HASH_IDX(h, zap_f_phys(zap)->zap_ptrtbl.zt_shift);
-	int err = zap_idx_to_blk(zap, idx, &blk);
-	if (err != 0)
-		return (err);
-	err = zap_get_leaf_byblk(zap, blk, tx, lt, lp);
+	for (;;) {
+		uint64_t idx = ZAP_HASH_IDX(h,
+		    zap_f_phys(zap)->zap_ptrtbl.zt_shift);
+		int err = zap_idx_to_blk(zap, idx, &blk);
+		if (err != 0)
+			return (err);
+		err = zap_get_leaf_byblk(zap, blk, tx, lt, lp);
+		if (err != 0)
+			return (err);
 
-	ASSERT(err ||
-	    ZAP_HASH_IDX(h, zap_leaf_phys(*lp)->l_hdr.lh_prefix_len) ==
-	    zap_leaf_phys(*lp)->l_hdr.lh_prefix);
-	return (err);
+		if (ZAP_HASH_IDX(h, zap_leaf_phys(*lp)->l_hdr.lh_prefix_len) ==
+		    zap_leaf_phys(*lp)->l_hdr.lh_prefix)
+			return (0);
+
+		/*
+		 * The leaf split after we loaded its block pointer, see
+		 * zap_expand_leaf().  The pointers were updated before the
+		 * leaf was unlocked, so look again.  Finding the same leaf
+		 * again means the pointer table is damaged.
+		 */
+		zap_put_leaf(*lp);
+		*lp = NULL;
+		if (blk == lastblk || RW_WRITE_HELD(&zap->zap_rwlock))
+			return (SET_ERROR(EIO));
+		lastblk = blk;
+	}
 }
 
 static int
@@ -640,9 +660,8 @@ zap_expand_leaf(zap_name_t *zn, zap_leaf_t *l,
 	ASSERT3U(ZAP_HASH_IDX(hash, old_prefix_len), ==,
 	    zap_leaf_phys(l)->l_hdr.lh_prefix);
 
-	if (zap_tryupgradedir(zap, tx) == 0 ||
-	    old_prefix_len == zap_f_phys(zap)->zap_ptrtbl.zt_shift) {
-		/* We failed to upgrade, or need to grow the pointer table */
+	if (old_prefix_len == zap_f_phys(zap)->zap_ptrtbl.zt_shift) {
+		/* We need to grow the pointer table */
 		objset_t *os = zap->zap_objset;
 		uint64_t object = zap->zap_object;
 
@@ -672,11 +691,23 @@ zap_expand_leaf(zap_name_t *zn, zap_leaf_t *l,
 			return (0);
 		}
 	}
-	ASSERT(RW_WRITE_HELD(&zap->zap_rwlock));
+	ASSERT(RW_LOCK_HELD(&zap->zap_rwlock));
 	ASSERT3U(old_prefix_len, <, zap_f_phys(zap)->zap_ptrtbl.zt_shift);
 	ASSERT3U(ZAP_HASH_IDX(hash, old_prefix_len), ==,
 	    zap_leaf_phys(l)->l_hdr.lh_prefix);
 
+	/*
+	 * The pointer table is big enough, so the split does not need the
+	 * zap_rwlock as writer, which would stall every other add, remove and
+	 * lookup in the directory.  The leaf's own lock keeps it from being
+	 * used while it splits, zap_split_mtx serializes the changes to the
+	 * header and pointer table, and zap_deref_leaf() copes with readers
+	 * which loaded the old pointers.  Growing the pointer table still
+	 * takes the zap_rwlock as writer.
+	 */
+	if (!RW_WRITE_HELD(&zap->zap_rwlock))
+		dmu_buf_will_dirty(zap->zap_dbuf, tx);
+
 	int prefix_diff = zap_f_phys(zap)->zap_ptrtbl.zt_shift -
 	    (old_prefix_len + 1);
 	uint64_t sibling =
@@ -695,10 +726,12 @@ zap_expand_leaf(zap_name_t *zn, zap_leaf_t *l,
 	zap_leaf_split(l, nl, zap->zap_normflags != 0);
 
 	/* set sibling pointers */
+	mutex_enter(&zap->zap_f.zap_split_mtx);
 	for (int i = 0; i < (1ULL << prefix_diff); i++) {
 		err = zap_set_idx_to_blk(zap, sibling + i, nl->l_blkid, tx);
 		ASSERT0(err); /* we checked for i/o errors above */
 	}
+	mutex_exit(&zap->zap_f.zap_split_mtx);
 
 	ASSERT3U(zap_leaf_phys(l)->l_hdr.lh_prefix_len, >, 0);
 
@@ -728,9 +761,16 @@ zap_put_leaf_maybe_grow_ptrtbl(zap_name_t *zn, zap_leaf_t *l,
 	if (leaffull || zap_f_phys(zap)->zap_ptrtbl.zt_nextblk) {
 		/*
 		 * We are in the middle of growing the pointer table, or
-		 * this leaf will soon make us grow it.
+		 * this leaf will soon make us grow it.  Unless the leaf is
+		 * full, only continue growing it if the lock can be upgraded
+		 * without waiting, so that a table which is being copied
+		 * does not make every add queue up for the lock as writer.
+		 * zap_expand_leaf() finishes the copy when it has to.
 		 */
 		if (zap_tryupgradedir(zap, tx) == 0) {
+			if (!leaffull)
+				return;
+
 			objset_t *os = zap->zap_objset;
 			uint64_t zapobj = zap->zap_object;
 
@@ -1234,23 +1274,25 @@ fzap_cursor_retrieve(zap_t *zap, zap_cursor_t *zc, zap_attribute_t *za)
 		    ZIO_PRIORITY_ASYNC_READ);
 	}
 
-	if (zc->zc_leaf &&
-	    (ZAP_HASH_IDX(zc->zc_hash,
-	    zap_leaf_phys(zc->zc_leaf)->l_hdr.lh_prefix_len) !=
-	    zap_leaf_phys(zc->zc_leaf)->l_hdr.lh_prefix)) {
+again:
+	/*
+	 * The cached leaf may have split since it was last used, so check
+	 * that it still holds zc_hash once it is locked.
+	 */
+	if (zc->zc_leaf != NULL) {
 		rw_enter(&zc->zc_leaf->l_rwlock, RW_READER);
-		zap_put_leaf(zc->zc_leaf);
-		zc->zc_leaf = NULL;
+		if (ZAP_HASH_IDX(zc->zc_hash,
+		    zap_leaf_phys(zc->zc_leaf)->l_hdr.lh_prefix_len) !=
+		    zap_leaf_phys(zc->zc_leaf)->l_hdr.lh_prefix) {
+			zap_put_leaf(zc->zc_leaf);
+			zc->zc_leaf = NULL;
+		}
 	}
-
-again:
 	if (zc->zc_leaf == NULL) {
 		err = zap_deref_leaf(zap, zc->zc_hash, NULL, RW_READER,
 		    &zc->zc_leaf);
 		if (err != 0)
 			return (err);
-	} else {
-		rw_enter(&zc->zc_leaf->l_rwlock, RW_READER);
 	}
 	l = zc->zc_leaf;
 
@@ -250,6 +250,7 @@ extern void zfs_init(void);
 extern void zfs_fini(void);
 
 uint_t zfs_fsyncer_key;
+uint_t zfs_replay_eof_key;
 extern uint_t rrw_tsd_key;
 uint_t zfs_allow_log_key;
 
@@ -2027,6 +2028,7 @@ zfs_ioc_vdev_attach(zfs_cmd_t *zc)
 {
 	spa_t *spa;
 	int replacing = zc->zc_cookie;
+	int rebuild = zc->zc_simple;
 	nvlist_t *config;
 	int error;
 
@@ -2035,7 +2037,8 @@ zfs_ioc_vdev_attach(zfs_cmd_t *zc)
 
 	if ((error = get_nvlist(zc->zc_nvlist_conf, zc->zc_nvlist_conf_size,
 	    zc->zc_iflags, &config)) == 0) {
-		error = spa_vdev_attach(spa, zc->zc_guid, config, replacing);
+		error = spa_vdev_attach(spa, zc->zc_guid, config, replacing,
+		    rebuild);
 		nvlist_free(config);
 	}
 
@@ -2445,6 +2448,253 @@ zfs_ioc_snapshot_list_next(zfs_cmd_t *zc)
 	return (error);
 }
 
+/*
+ * Returns true if the properties named in filter, or all properties if
+ * there is no filter, include any which are not computed by
+ * dmu_objset_stats() and so must be looked up with dsl_prop_get_all().
+ */
+static boolean_t
+zfs_list_needs_dsl_props(nvlist_t *filter)
+{
+	if (filter == NULL)
+		return (B_TRUE);
+
+	for (nvpair_t *pair = nvlist_next_nvpair(filter, NULL);
+	    pair != NULL; pair = nvlist_next_nvpair(filter, pair)) {
+		zfs_prop_t prop = zfs_name_to_prop(nvpair_name(pair));
+
+		if (prop == ZPROP_INVAL || !zfs_prop_readonly(prop) ||
+		    zfs_prop_setonce(prop))
+			return (B_TRUE);
+	}
+
+	return (B_FALSE);
+}
+
+/*
+ * Gather the stats and the properties named in filter, or all of them, of
+ * one dataset for zfs_ioc_list_batch().
+ */
+static int
+zfs_list_batch_entry(dsl_dataset_t *ds, nvlist_t *filter, boolean_t simple,
+    nvlist_t **entryp)
+{
+	dmu_objset_stats_t stats;
+	nvlist_t *entry, *nv;
+	objset_t *os;
+	int error;
+
+	if (simple) {
+		*entryp = fnvlist_alloc();
+		return (0);
+	}
+
+	if ((error = dmu_objset_from_ds(ds, &os)) != 0)
+		return (error);
+
+	dmu_objset_fast_stat(os, &stats);
+
+	if (zfs_list_needs_dsl_props(filter)) {
+		if ((error = dsl_prop_get_all(os, &nv)) != 0)
+			return (error);
+	} else {
+		nv = fnvlist_alloc();
+	}
+	dmu_objset_stats(os, nv);
+
+	/* See the comment in zfs_ioc_objset_stats_impl() */
+	if (!stats.dds_inconsistent && dmu_objset_type(os) == DMU_OST_ZVOL &&
+	    (error = zvol_get_stats(os, nv)) != 0) {
+		nvlist_free(nv);
+		return (error);
+	}
+
+	if (filter != NULL) {
+		nvpair_t *pair, *next;
+
+		for (pair = nvlist_next_nvpair(nv, NULL); pair != NULL;
+		    pair = next) {
+			next = nvlist_next_nvpair(nv, pair);
+			if (!nvlist_exists(filter, nvpair_name(pair)))
+				fnvlist_remove_nvpair(nv, pair);
+		}
+	}
+
+	entry = fnvlist_alloc();
+	fnvlist_add_uint8_array(entry, ZFS_LIST_STATS, (uint8_t *)&stats,
+	    sizeof (stats));
+	fnvlist_add_nvlist(entry, ZFS_LIST_PROPS, nv);
+	nvlist_free(nv);
+	*entryp = entry;
+
+	return (0);
+}
+
+/*
+ * List the child datasets, or the snapshots, of fsname in batches.  This
+ * returns many datasets per call, with only the requested properties, where
+ * ZFS_IOC_DATASET_LIST_NEXT and ZFS_IOC_SNAPSHOT_LIST_NEXT return one with
+ * all of its properties.  The pool's config lock is held for the whole
+ * batch, but a batch ends early if a sync task is waiting for the lock.
+ *
+ * innvl: {
+ *     (optional) "list_snapshots" -> list snapshots instead of children
+ *     (optional) "list_cursor" -> cursor returned by the previous call
+ *     (optional) "list_count" -> maximum number of datasets (uint64)
+ *     (optional) "list_props" -> { property 1, property 2, ... }
+ *     (optional) "list_simple" -> return only the datasets' names
+ *     (optional) "snap_iter_min_txg" -> minimum snapshot createtxg
+ *     (optional) "snap_iter_max_txg" -> maximum snapshot createtxg
+ * }
+ *
+ * Without "list_props" all properties are returned.
+ *
+ * outnvl: {
+ *     "list_cursor" -> cursor to pass to the next call (uint64)
+ *     (optional) "list_done" -> there are no more datasets to list
+ *     "list_datasets" -> {
+ *         dataset name 1 -> {
+ *             "list_stats" -> dmu_objset_stats_t (uint8 array)
+ *             "list_props" -> { property 1, property 2, ... }
+ *         },
+ *         ...
+ *     }
+ * }
+ *
+ * The datasets are in the order they are found, and "list_simple" leaves
+ * their nvlists empty.
+ */
+static const zfs_ioc_key_t zfs_keys_list_batch[] = {
+	{ZFS_LIST_SNAPSHOTS,	DATA_TYPE_BOOLEAN,	ZK_OPTIONAL},
+	{ZFS_LIST_CURSOR,	DATA_TYPE_UINT64,	ZK_OPTIONAL},
+	{ZFS_LIST_COUNT,	DATA_TYPE_UINT64,	ZK_OPTIONAL},
+	{ZFS_LIST_PROPS,	DATA_TYPE_NVLIST,	ZK_OPTIONAL},
+	{ZFS_LIST_SIMPLE,	DATA_TYPE_BOOLEAN,	ZK_OPTIONAL},
+	{SNAP_ITER_MIN_TXG,	DATA_TYPE_UINT64,	ZK_OPTIONAL},
+	{SNAP_ITER_MAX_TXG,	DATA_TYPE_UINT64,	ZK_OPTIONAL},
+};
+
+static int
+zfs_ioc_list_batch(const char *fsname, nvlist_t *innvl, nvlist_t *outnvl)
+{
+	boolean_t snapshots = nvlist_exists(innvl, ZFS_LIST_SNAPSHOTS);
+	boolean_t simple = nvlist_exists(innvl, ZFS_LIST_SIMPLE);
+	uint64_t cursor = 0, count = ZFS_LIST_BATCH_MAX;
+	uint64_t min_txg = 0, max_txg = 0;
+	char name[ZFS_MAX_DATASET_NAME_LEN];
+	nvlist_t *filter = NULL, *datasets;
+	size_t namelen, size = 0;
+	dsl_pool_t *dp;
+	objset_t *os;
+	uint64_t n = 0, scanned = 0;
+	int error;
+
+	(void) nvlist_lookup_uint64(innvl, ZFS_LIST_CURSOR, &cursor);
+	(void) nvlist_lookup_uint64(innvl, ZFS_LIST_COUNT, &count);
+	(void) nvlist_lookup_nvlist(innvl, ZFS_LIST_PROPS, &filter);
+	(void) nvlist_lookup_uint64(innvl, SNAP_ITER_MIN_TXG, &min_txg);
+	(void) nvlist_lookup_uint64(innvl, SNAP_ITER_MAX_TXG, &max_txg);
+
+	if (count == 0)
+		return (SET_ERROR(EINVAL));
+	count = MIN(count, ZFS_LIST_BATCH_MAX);
+
+	if ((error = dmu_objset_hold(fsname, FTAG, &os)) != 0)
+		return (error);
+	dp = dmu_objset_pool(os);
+
+	/*
+	 * Snapshots have neither children nor snapshots, and a dataset name
+	 * of maximum length cannot have any either.
+	 */
+	(void) strlcpy(name, fsname, sizeof (name));
+	if (dmu_objset_is_snapshot(os) ||
+	    strlcat(name, snapshots ? "@" : "/", sizeof (name)) >=
+	    sizeof (name))
+		error = SET_ERROR(ENOENT);
+	namelen = strlen(name);
+
+	datasets = fnvlist_alloc();
+	while (error == 0 && n < count && size < ZFS_LIST_BATCH_BYTES) {
+		dsl_dataset_t *ds;
+		nvlist_t *entry;
+		uint64_t obj;
+
+		if (scanned > 0 && dsl_pool_config_writer_wanted(dp))
+			break;
+
+		if (issig(JUSTLOOKING) && issig(FORREAL)) {
+			error = SET_ERROR(EINTR);
+			break;
+		}
+
+		/*
+		 * ENOENT from the list functions ends the iteration.  Any
+		 * other ENOENT is a race with destroy, so skip the dataset.
+		 */
+		name[namelen] = '\0';
+		if (snapshots) {
+			error = dmu_snapshot_list_next(os,
+			    sizeof (name) - namelen, name + namelen, &obj,
+			    &cursor, NULL);
+			if (error != 0)
+				break;
+			scanned++;
+			error = dsl_dataset_hold_obj(dp, obj, FTAG, &ds);
+		} else {
+			error = dmu_dir_list_next(os,
+			    sizeof (name) - namelen, name + namelen, NULL,
+			    &cursor);
+			if (error != 0)
+				break;
+			scanned++;
+			if (zfs_dataset_name_hidden(name))
+				continue;
+			error = dsl_dataset_hold(dp, name, FTAG, &ds);
+		}
+		if (error == ENOENT) {
+			error = 0;
+			continue;
+		} else if (error != 0) {
+			break;
+		}
+
+		if (snapshots &&
+		    ((min_txg != 0 && dsl_get_creationtxg(ds) < min_txg) ||
+		    (max_txg != 0 && dsl_get_creationtxg(ds) > max_txg))) {
+			dsl_dataset_rele(ds, FTAG);
+			continue;
+		}
+
+		error = zfs_list_batch_entry(ds, filter, simple, &entry);
+		dsl_dataset_rele(ds, FTAG);
+		if (error == ENOENT) {
+			error = 0;
+			continue;
+		} else if (error != 0) {
+			break;
+		}
+
+		size += strlen(name) + fnvlist_size(entry);
+		fnvlist_add_nvlist(datasets, name, entry);
+		fnvlist_free(entry);
+		n++;
+	}
+	dmu_objset_rele(os, FTAG);
+
+	if (error == ENOENT) {
+		fnvlist_add_boolean(outnvl, ZFS_LIST_DONE);
+		error = 0;
+	}
+	if (error == 0) {
+		fnvlist_add_uint64(outnvl, ZFS_LIST_CURSOR, cursor);
+		fnvlist_add_nvlist(outnvl, ZFS_LIST_DATASETS, datasets);
+	}
+	fnvlist_free(datasets);
+
+	return (error);
+}
+
 static int
 zfs_prop_set_userquota(const char *dsname, nvpair_t *pair)
 {
@@ -4442,6 +4692,20 @@ zfs_check_settable(const char *dsname, nvpair_t *pair, cred_t *cr)
 				spa_close(spa, FTAG);
 			}
 
+			if (ZIO_COMPRESS_IS_ZSTD(intval)) {
+				spa_t *spa;
+
+				if ((err = spa_open(dsname, &spa, FTAG)) != 0)
+					return (err);
+
+				if (!spa_feature_is_enabled(spa,
+				    SPA_FEATURE_ZSTD_COMPRESS)) {
+					spa_close(spa, FTAG);
+					return (SET_ERROR(ENOTSUP));
+				}
+				spa_close(spa, FTAG);
+			}
+
 			/*
 			 * If this is a bootable dataset then
 			 * verify that the compression algorithm
@@ -7063,6 +7327,11 @@ zfs_ioctl_init(void)
 	    POOL_CHECK_SUSPENDED, B_FALSE, B_FALSE, zfs_keys_get_bookmark_props,
 	    ARRAY_SIZE(zfs_keys_get_bookmark_props));
 
+	zfs_ioctl_register("list_batch", ZFS_IOC_LIST_BATCH,
+	    zfs_ioc_list_batch, zfs_secpolicy_read, DATASET_NAME,
+	    POOL_CHECK_SUSPENDED, B_FALSE, B_FALSE, zfs_keys_list_batch,
+	    ARRAY_SIZE(zfs_keys_list_batch));
+
 	zfs_ioctl_register("destroy_bookmarks", ZFS_IOC_DESTROY_BOOKMARKS,
 	    zfs_ioc_destroy_bookmarks, zfs_secpolicy_destroy_bookmarks,
 	    POOL_NAME,
@@ -7885,6 +8154,7 @@ _init(void)
 		goto out;
 
 	tsd_create(&zfs_fsyncer_key, NULL);
+	tsd_create(&zfs_replay_eof_key, NULL);
 	tsd_create(&rrw_tsd_key, rrw_tsd_destroy);
 	tsd_create(&zfs_allow_log_key, zfs_allow_log_destroy);
 
@@ -7920,6 +8190,7 @@ _fini(void)
 	zvol_fini();
 
 	tsd_destroy(&zfs_fsyncer_key);
+	tsd_destroy(&zfs_replay_eof_key);
 	tsd_destroy(&rrw_tsd_key);
 	tsd_destroy(&zfs_allow_log_key);
 
@@ -513,6 +513,15 @@ zfs_log_write(zilog_t *zilog, dmu_tx_t *tx, int txtype,
 		return;
 	}
 
+#ifdef FDIRECT
+	/*
+	 * A direct write has already written its blocks, which need only
+	 * be referenced by the log.
+	 */
+	if (ioflag & FDIRECT)
+		write_state = WR_INDIRECT;
+	else
+#endif
 	if (zilog->zl_logbias == ZFS_LOGBIAS_THROUGHPUT)
 		write_state = WR_INDIRECT;
 	else if (!spa_has_slogs(zilog->zl_spa) &&
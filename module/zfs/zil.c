@@ -120,6 +120,23 @@ static kstat_t *zil_ksp;
  */
 int zil_replay_disable = 0;
 
+/*
+ * Number of lanes used to replay the out-of-order records (writes,
+ * truncates, setattrs and ACL changes) of a single dataset's intent log
+ * concurrently.  Records are assigned to a lane by object number, so
+ * records for the same object are always replayed in log order.  All
+ * other record types act as barriers and are replayed by the mounting
+ * thread once every lane has drained.  A value of 1 or less replays the
+ * whole log serially.
+ */
+int zil_replay_threads = 8;
+
+/*
+ * Limit on the bytes of log records (including the data of indirect
+ * writes) queued on the replay lanes of a single dataset.
+ */
+unsigned long zil_replay_max_inflight = 64 * 1024 * 1024;
+
 /*
  * Disable the DKIOCFLUSHWRITECACHE commands that are normally sent to
  * the disk(s) by the ZIL after an LWB write has completed. Setting this
@@ -137,6 +154,7 @@ unsigned long zil_slog_bulk = 768 * 1024;
 
 static kmem_cache_t *zil_lwb_cache;
 static kmem_cache_t *zil_zcw_cache;
+static taskq_t *zil_replay_taskq;
 
 #define	LWB_EMPTY(lwb) ((BP_GET_LSIZE(&lwb->lwb_blk) - \
     sizeof (zil_chain_t)) == (lwb->lwb_sz - lwb->lwb_nused))
@@ -3133,11 +3151,21 @@ zil_init(void)
 		zil_ksp->ks_data = &zil_stats;
 		kstat_install(zil_ksp);
 	}
+
+	/*
+	 * Shared by all datasets, so that datasets which are mounted in
+	 * parallel also replay their logs concurrently.
+	 */
+	zil_replay_taskq = taskq_create("zil_replay", MAX(max_ncpus, 8),
+	    defclsyspri, 1, INT_MAX, TASKQ_DYNAMIC);
 }
 
 void
 zil_fini(void)
 {
+	taskq_destroy(zil_replay_taskq);
+	zil_replay_taskq = NULL;
+
 	kmem_cache_destroy(zil_zcw_cache);
 	kmem_cache_destroy(zil_lwb_cache);
 
@@ -3470,11 +3498,39 @@ zil_resume(void *cookie)
 	dsl_dataset_rele(dmu_objset_ds(os), suspend_tag);
 }
 
+/*
+ * An out-of-order log record queued on a replay lane.  The private copy
+ * of the record is followed by room for the data of an indirect write,
+ * which is read in by the lane rather than by the log parser.
+ */
+typedef struct zil_replay_rec {
+	list_node_t	zrr_node;
+	lr_t		zrr_lrc;	/* native-endian header, for errors */
+	uint64_t	zrr_size;	/* allocated size of zrr_buf */
+	char		*zrr_buf;
+} zil_replay_rec_t;
+
+typedef struct zil_replay_lane {
+	struct zil_replay_arg *zrl_zr;
+	list_t		zrl_recs;	/* queued records, in log order */
+	boolean_t	zrl_active;	/* task dispatched for this lane */
+	taskq_ent_t	zrl_tqent;
+} zil_replay_lane_t;
+
 typedef struct zil_replay_arg {
 	zil_replay_func_t **zr_replay;
 	void		*zr_arg;
 	boolean_t	zr_byteswap;
 	char		*zr_lr;
+	zilog_t		*zr_zilog;
+	uint_t		zr_nlanes;	/* 0 when replaying serially */
+	zil_replay_lane_t *zr_lanes;
+	kmutex_t	zr_lock;	/* protects lanes and fields below */
+	kcondvar_t	zr_cv;
+	uint64_t	zr_inflight;	/* bytes queued on the lanes */
+	uint64_t	zr_pending;	/* records queued on the lanes */
+	uint_t		zr_active;	/* lanes with a dispatched task */
+	int		zr_error;	/* first error hit by a lane */
 } zil_replay_arg_t;
 
 static int
@@ -3482,7 +3538,12 @@ zil_replay_error(zilog_t *zilog, lr_t *lr, int error)
 {
 	char name[ZFS_MAX_DATASET_NAME_LEN];
 
-	zilog->zl_replaying_seq--;	/* didn't actually replay this one */
+	/*
+	 * Records replayed by a lane never advance the replay sequence
+	 * (see zil_replay_enqueue()), so there is nothing to back out.
+	 */
+	if (zilog->zl_replaying_seq != 0)
+		zilog->zl_replaying_seq--; /* didn't actually replay this one */
 
 	dmu_objset_name(zilog->zl_os, name);
 
@@ -3495,51 +3556,23 @@ zil_replay_error(zilog_t *zilog, lr_t *lr, int error)
 	return (error);
 }
 
+/*
+ * Replay a log record which has already been copied to buf.  The copy is
+ * still in native byte order; lr is the native-endian record header.
+ */
 static int
-zil_replay_log_record(zilog_t *zilog, lr_t *lr, void *zra, uint64_t claim_txg)
+zil_replay_exec(zilog_t *zilog, zil_replay_arg_t *zr, lr_t *lr, char *buf)
 {
-	zil_replay_arg_t *zr = zra;
-	const zil_header_t *zh = zilog->zl_header;
 	uint64_t reclen = lr->lrc_reclen;
-	uint64_t txtype = lr->lrc_txtype;
-	int error = 0;
-
-	zilog->zl_replaying_seq = lr->lrc_seq;
-
-	if (lr->lrc_seq <= zh->zh_replay_seq)	/* already replayed */
-		return (0);
-
-	if (lr->lrc_txg < claim_txg)		/* already committed */
-		return (0);
-
-	/* Strip case-insensitive bit, still present in log record */
-	txtype &= ~TX_CI;
-
-	if (txtype == 0 || txtype >= TX_MAX_TYPE)
-		return (zil_replay_error(zilog, lr, EINVAL));
-
-	/*
-	 * If this record type can be logged out of order, the object
-	 * (lr_foid) may no longer exist.  That's legitimate, not an error.
-	 */
-	if (TX_OOO(txtype)) {
-		error = dmu_object_info(zilog->zl_os,
-		    LR_FOID_GET_OBJ(((lr_ooo_t *)lr)->lr_foid), NULL);
-		if (error == ENOENT || error == EEXIST)
-			return (0);
-	}
-
-	/*
-	 * Make a copy of the data so we can revise and extend it.
-	 */
-	bcopy(lr, zr->zr_lr, reclen);
+	uint64_t txtype = lr->lrc_txtype & ~TX_CI;
+	int error;
 
 	/*
 	 * If this is a TX_WRITE with a blkptr, suck in the data.
 	 */
 	if (txtype == TX_WRITE && reclen == sizeof (lr_write_t)) {
-		error = zil_read_log_data(zilog, (lr_write_t *)lr,
-		    zr->zr_lr + reclen);
+		error = zil_read_log_data(zilog, (lr_write_t *)buf,
+		    buf + reclen);
 		if (error != 0)
 			return (zil_replay_error(zilog, lr, error));
 	}
@@ -3552,7 +3585,7 @@ zil_replay_log_record(zilog_t *zilog, lr_t *lr, void *zra, uint64_t claim_txg)
 	 * the lr was byteswapped, undo it before invoking the replay vector.
 	 */
 	if (zr->zr_byteswap)
-		byteswap_uint64_array(zr->zr_lr, reclen);
+		byteswap_uint64_array(buf, reclen);
 
 	/*
 	 * We must now do two things atomically: replay this log record,
@@ -3560,7 +3593,7 @@ zil_replay_log_record(zilog_t *zilog, lr_t *lr, void *zra, uint64_t claim_txg)
 	 * we did so. At the end of each replay function the sequence number
 	 * is updated if we are in replay mode.
 	 */
-	error = zr->zr_replay[txtype](zr->zr_arg, zr->zr_lr, zr->zr_byteswap);
+	error = zr->zr_replay[txtype](zr->zr_arg, buf, zr->zr_byteswap);
 	if (error != 0) {
 		/*
 		 * The DMU's dnode layer doesn't see removes until the txg
@@ -3570,13 +3603,184 @@ zil_replay_log_record(zilog_t *zilog, lr_t *lr, void *zra, uint64_t claim_txg)
 		 * specify B_FALSE for byteswap now, so we don't do it twice.
 		 */
 		txg_wait_synced(spa_get_dsl(zilog->zl_spa), 0);
-		error = zr->zr_replay[txtype](zr->zr_arg, zr->zr_lr, B_FALSE);
+		error = zr->zr_replay[txtype](zr->zr_arg, buf, B_FALSE);
 		if (error != 0)
 			return (zil_replay_error(zilog, lr, error));
 	}
 	return (0);
 }
 
+/*
+ * Replay the records queued on a lane until it is empty.  Once a lane has
+ * failed, or any other lane has, the remaining records are discarded.
+ */
+static void
+zil_replay_lane_task(void *arg)
+{
+	zil_replay_lane_t *zrl = arg;
+	zil_replay_arg_t *zr = zrl->zrl_zr;
+	zil_replay_rec_t *zrr;
+
+	mutex_enter(&zr->zr_lock);
+	while ((zrr = list_remove_head(&zrl->zrl_recs)) != NULL) {
+		int error = zr->zr_error;
+		uint64_t size = zrr->zrr_size;
+
+		mutex_exit(&zr->zr_lock);
+		if (error == 0) {
+			error = zil_replay_exec(zr->zr_zilog, zr,
+			    &zrr->zrr_lrc, zrr->zrr_buf);
+		}
+		vmem_free(zrr->zrr_buf, size);
+		kmem_free(zrr, sizeof (*zrr));
+		mutex_enter(&zr->zr_lock);
+
+		if (error != 0 && zr->zr_error == 0)
+			zr->zr_error = error;
+		zr->zr_inflight -= size;
+		zr->zr_pending--;
+		cv_broadcast(&zr->zr_cv);
+	}
+	zrl->zrl_active = B_FALSE;
+	zr->zr_active--;
+	cv_broadcast(&zr->zr_cv);
+	mutex_exit(&zr->zr_lock);
+}
+
+/*
+ * Queue an out-of-order record on the lane owning its object.  Records
+ * replayed by a lane leave the replay sequence alone: zh_replay_seq is
+ * only advanced by the barrier records replayed after every lane has
+ * drained, whose txg can be no earlier than that of any lane record
+ * preceding them.  If we crash before the next barrier syncs, the lane
+ * records since the previous one are simply replayed again, in order,
+ * which is safe as out-of-order records are idempotent.
+ */
+static int
+zil_replay_enqueue(zilog_t *zilog, zil_replay_arg_t *zr, lr_t *lr,
+    uint64_t txtype)
+{
+	uint64_t obj = LR_FOID_GET_OBJ(((lr_ooo_t *)lr)->lr_foid);
+	zil_replay_lane_t *zrl = &zr->zr_lanes[obj % zr->zr_nlanes];
+	uint64_t reclen = lr->lrc_reclen;
+	uint64_t size = reclen;
+	int error;
+
+	if (txtype == TX_WRITE && reclen == sizeof (lr_write_t)) {
+		lr_write_t *lrw = (lr_write_t *)lr;
+		size += MAX(BP_GET_LSIZE(&lrw->lr_blkptr), lrw->lr_length);
+	}
+
+	zilog->zl_replaying_seq = 0;
+
+	mutex_enter(&zr->zr_lock);
+	while (zr->zr_error == 0 && zr->zr_pending != 0 &&
+	    zr->zr_inflight + size > zil_replay_max_inflight)
+		cv_wait(&zr->zr_cv, &zr->zr_lock);
+	if ((error = zr->zr_error) != 0) {
+		mutex_exit(&zr->zr_lock);
+		return (error);
+	}
+	zr->zr_inflight += size;
+	zr->zr_pending++;
+	mutex_exit(&zr->zr_lock);
+
+	zil_replay_rec_t *zrr = kmem_alloc(sizeof (*zrr), KM_SLEEP);
+	zrr->zrr_lrc = *lr;
+	zrr->zrr_size = size;
+	zrr->zrr_buf = vmem_alloc(size, KM_SLEEP);
+	bcopy(lr, zrr->zrr_buf, reclen);
+
+	mutex_enter(&zr->zr_lock);
+	list_insert_tail(&zrl->zrl_recs, zrr);
+	if (!zrl->zrl_active) {
+		zrl->zrl_active = B_TRUE;
+		zr->zr_active++;
+		taskq_dispatch_ent(zil_replay_taskq, zil_replay_lane_task,
+		    zrl, 0, &zrl->zrl_tqent);
+	}
+	mutex_exit(&zr->zr_lock);
+
+	return (0);
+}
+
+/*
+ * Wait for every record queued on the lanes to be replayed, and return
+ * the first error any of them hit.
+ */
+static int
+zil_replay_drain(zil_replay_arg_t *zr)
+{
+	int error;
+
+	if (zr->zr_nlanes == 0)
+		return (0);
+
+	mutex_enter(&zr->zr_lock);
+	while (zr->zr_pending != 0 || zr->zr_active != 0)
+		cv_wait(&zr->zr_cv, &zr->zr_lock);
+	error = zr->zr_error;
+	mutex_exit(&zr->zr_lock);
+
+	return (error);
+}
+
+static int
+zil_replay_log_record(zilog_t *zilog, lr_t *lr, void *zra, uint64_t claim_txg)
+{
+	zil_replay_arg_t *zr = zra;
+	const zil_header_t *zh = zilog->zl_header;
+	uint64_t reclen = lr->lrc_reclen;
+	uint64_t txtype = lr->lrc_txtype;
+	int error = 0;
+
+	if (lr->lrc_seq <= zh->zh_replay_seq)	/* already replayed */
+		return (0);
+
+	if (lr->lrc_txg < claim_txg)		/* already committed */
+		return (0);
+
+	/* Strip case-insensitive bit, still present in log record */
+	txtype &= ~TX_CI;
+
+	/*
+	 * Anything but an out-of-order record may depend on any record
+	 * before it (e.g. a create or rename in the same directory), so it
+	 * is a barrier: wait for the lanes to drain, then replay it here.
+	 */
+	if (zr->zr_nlanes == 0 || !TX_OOO(txtype)) {
+		if ((error = zil_replay_drain(zr)) != 0)
+			return (error);
+		zilog->zl_replaying_seq = lr->lrc_seq;
+	}
+
+	if (txtype == 0 || txtype >= TX_MAX_TYPE)
+		return (zil_replay_error(zilog, lr, EINVAL));
+
+	/*
+	 * If this record type can be logged out of order, the object
+	 * (lr_foid) may no longer exist.  That's legitimate, not an error.
+	 */
+	if (TX_OOO(txtype)) {
+		error = dmu_object_info(zilog->zl_os,
+		    LR_FOID_GET_OBJ(((lr_ooo_t *)lr)->lr_foid), NULL);
+		if (error == ENOENT || error == EEXIST)
+			return (0);
+	}
+
+	zilog->zl_replay_records++;
+
+	if (zr->zr_nlanes != 0 && TX_OOO(txtype))
+		return (zil_replay_enqueue(zilog, zr, lr, txtype));
+
+	/*
+	 * Make a copy of the data so we can revise and extend it.
+	 */
+	bcopy(lr, zr->zr_lr, reclen);
+
+	return (zil_replay_exec(zilog, zr, lr, zr->zr_lr));
+}
+
 /* ARGSUSED */
 static int
 zil_incr_blks(zilog_t *zilog, blkptr_t *bp, void *arg, uint64_t claim_txg)
@@ -3595,32 +3799,71 @@ zil_replay(objset_t *os, void *arg, zil_replay_func_t *replay_func[TX_MAX_TYPE])
 	zilog_t *zilog = dmu_objset_zil(os);
 	const zil_header_t *zh = zilog->zl_header;
 	zil_replay_arg_t zr;
+	char name[ZFS_MAX_DATASET_NAME_LEN];
+	hrtime_t start;
 
 	if ((zh->zh_flags & ZIL_REPLAY_NEEDED) == 0) {
 		zil_destroy(zilog, B_TRUE);
 		return;
 	}
 
+	bzero(&zr, sizeof (zr));
 	zr.zr_replay = replay_func;
 	zr.zr_arg = arg;
 	zr.zr_byteswap = BP_SHOULD_BYTESWAP(&zh->zh_log);
 	zr.zr_lr = vmem_alloc(2 * SPA_MAXBLOCKSIZE, KM_SLEEP);
+	zr.zr_zilog = zilog;
+	if (zil_replay_threads > 1) {
+		zr.zr_nlanes = zil_replay_threads;
+		zr.zr_lanes = kmem_zalloc(zr.zr_nlanes *
+		    sizeof (zil_replay_lane_t), KM_SLEEP);
+		for (uint_t i = 0; i < zr.zr_nlanes; i++) {
+			zil_replay_lane_t *zrl = &zr.zr_lanes[i];
+
+			zrl->zrl_zr = &zr;
+			list_create(&zrl->zrl_recs, sizeof (zil_replay_rec_t),
+			    offsetof(zil_replay_rec_t, zrr_node));
+			taskq_init_ent(&zrl->zrl_tqent);
+		}
+		mutex_init(&zr.zr_lock, NULL, MUTEX_DEFAULT, NULL);
+		cv_init(&zr.zr_cv, NULL, CV_DEFAULT, NULL);
+	}
 
 	/*
 	 * Wait for in-progress removes to sync before starting replay.
 	 */
 	txg_wait_synced(zilog->zl_dmu_pool, 0);
 
+	start = gethrtime();
 	zilog->zl_replay = B_TRUE;
 	zilog->zl_replay_time = ddi_get_lbolt();
 	ASSERT(zilog->zl_replay_blks == 0);
+	ASSERT(zilog->zl_replay_records == 0);
 	(void) zil_parse(zilog, zil_incr_blks, zil_replay_log_record, &zr,
 	    zh->zh_claim_txg, B_TRUE);
 	vmem_free(zr.zr_lr, 2 * SPA_MAXBLOCKSIZE);
 
+	if (zr.zr_nlanes != 0) {
+		(void) zil_replay_drain(&zr);
+		for (uint_t i = 0; i < zr.zr_nlanes; i++)
+			list_destroy(&zr.zr_lanes[i].zrl_recs);
+		kmem_free(zr.zr_lanes,
+		    zr.zr_nlanes * sizeof (zil_replay_lane_t));
+		mutex_destroy(&zr.zr_lock);
+		cv_destroy(&zr.zr_cv);
+	}
+
 	zil_destroy(zilog, B_FALSE);
 	txg_wait_synced(zilog->zl_dmu_pool, zilog->zl_destroy_txg);
 	zilog->zl_replay = B_FALSE;
+	zilog->zl_replay_duration = gethrtime() - start;
+
+	dmu_objset_name(os, name);
+	zfs_dbgmsg("replayed %llu records in %llu log blocks of %s "
+	    "in %llu ms using %u lanes", (u_longlong_t)zilog->zl_replay_records,
+	    (u_longlong_t)zilog->zl_replay_blks, name,
+	    (u_longlong_t)NSEC2MSEC(zilog->zl_replay_duration),
+	    MAX(zr.zr_nlanes, 1));
 }
 
 boolean_t
@@ -3631,8 +3874,11 @@ zil_replaying(zilog_t *zilog, dmu_tx_t *tx)
 
 	if (zilog->zl_replay) {
 		dsl_dataset_dirty(dmu_objset_ds(zilog->zl_os), tx);
-		zilog->zl_replayed_seq[dmu_tx_get_txg(tx) & TXG_MASK] =
-		    zilog->zl_replaying_seq;
+		/* zero while records are replayed by lanes */
+		if (zilog->zl_replaying_seq != 0) {
+			zilog->zl_replayed_seq[dmu_tx_get_txg(tx) & TXG_MASK] =
+			    zilog->zl_replaying_seq;
+		}
 		return (B_TRUE);
 	}
 
@@ -3685,6 +3931,12 @@ ZFS_MODULE_PARAM(zfs, zfs_, commit_timeout_pct, UINT, ZMOD_RW,
 ZFS_MODULE_PARAM(zfs_zil, zil_, replay_disable, UINT, ZMOD_RW,
     "Disable intent logging replay");
 
+ZFS_MODULE_PARAM(zfs_zil, zil_, replay_threads, UINT, ZMOD_RW,
+    "Number of lanes replaying a dataset's intent log concurrently");
+
+ZFS_MODULE_PARAM(zfs_zil, zil_, replay_max_inflight, UQUAD, ZMOD_RW,
+    "Limit in bytes of log records queued for concurrent replay");
+
 ZFS_MODULE_PARAM(zfs_zil, zil_, nocacheflush, UINT, ZMOD_RW,
     "Disable ZIL cache flushes");
 
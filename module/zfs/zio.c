@@ -39,6 +39,7 @@
 #include <sys/dmu_objset.h>
 #include <sys/arc.h>
 #include <sys/ddt.h>
+#include <sys/brt.h>
 #include <sys/blkptr.h>
 #include <sys/zfeature.h>
 #include <sys/dsl_scan.h>
@@ -68,6 +69,30 @@ const char *zio_type_name[ZIO_TYPES] = {
 int zio_dva_throttle_enabled = B_TRUE;
 int zio_deadman_log_all = B_FALSE;
 
+/*
+ * Maximum number of asynchronous writes issued together, see
+ * zio_issue_async().  Values below 2 disable batching.
+ */
+int zio_write_batch_size = 8;
+
+/*
+ * A batch of asynchronous writes run back to back by one issue taskq
+ * thread.  zb_cksum_zios collects the zios whose checksum generation was
+ * deferred while the batch ran, and is only used by that thread.
+ */
+#define	ZIO_WRITE_BATCH_MAX	32
+
+typedef struct zio_batch {
+	spa_zio_batch_t	*zb_slot;	/* per-CPU slot it was opened in */
+	uint_t		zb_count;	/* protected by zb_slot->szb_lock */
+	zio_t		*zb_zios[ZIO_WRITE_BATCH_MAX];
+	uint_t		zb_cksum_count;
+	zio_t		*zb_cksum_zios[ZIO_WRITE_BATCH_MAX];
+	taskq_ent_t	zb_tqent;
+} zio_batch_t;
+
+static uint_t zio_batch_tsd_key;
+
 /*
  * ==========================================================================
  * I/O kmem caches
@@ -75,6 +100,7 @@ int zio_deadman_log_all = B_FALSE;
  */
 kmem_cache_t *zio_cache;
 kmem_cache_t *zio_link_cache;
+kmem_cache_t *zio_batch_cache;
 kmem_cache_t *zio_buf_cache[SPA_MAXBLOCKSIZE >> SPA_MINBLOCKSHIFT];
 kmem_cache_t *zio_data_buf_cache[SPA_MAXBLOCKSIZE >> SPA_MINBLOCKSHIFT];
 #if defined(ZFS_DEBUG) && !defined(_KERNEL)
@@ -147,6 +173,9 @@ zio_init(void)
 	    sizeof (zio_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
 	zio_link_cache = kmem_cache_create("zio_link_cache",
 	    sizeof (zio_link_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
+	zio_batch_cache = kmem_cache_create("zio_batch_cache",
+	    sizeof (zio_batch_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
+	tsd_create(&zio_batch_tsd_key, NULL);
 
 	/*
 	 * For small buffers, we want a cache for each multiple of
@@ -229,6 +258,7 @@ zio_init(void)
 	zio_inject_init();
 
 	lz4_init();
+	zstd_init();
 }
 
 void
@@ -267,11 +297,14 @@ zio_fini(void)
 		zio_data_buf_cache[c] = NULL;
 	}
 
+	tsd_destroy(&zio_batch_tsd_key);
+	kmem_cache_destroy(zio_batch_cache);
 	kmem_cache_destroy(zio_link_cache);
 	kmem_cache_destroy(zio_cache);
 
 	zio_inject_fini();
 
+	zstd_fini();
 	lz4_fini();
 }
 
@@ -1090,7 +1123,8 @@ zio_rewrite(zio_t *pio, spa_t *spa, uint64_t txg, blkptr_t *bp, abd_t *data,
 }
 
 void
-zio_write_override(zio_t *zio, blkptr_t *bp, int copies, boolean_t nopwrite)
+zio_write_override(zio_t *zio, blkptr_t *bp, int copies, boolean_t nopwrite,
+    boolean_t brtwrite)
 {
 	ASSERT(zio->io_type == ZIO_TYPE_WRITE);
 	ASSERT(zio->io_child_type == ZIO_CHILD_LOGICAL);
@@ -1100,10 +1134,13 @@ zio_write_override(zio_t *zio, blkptr_t *bp, int copies, boolean_t nopwrite)
 	/*
 	 * We must reset the io_prop to match the values that existed
 	 * when the bp was first written by dmu_sync() keeping in mind
-	 * that nopwrite and dedup are mutually exclusive.
+	 * that nopwrite and dedup are mutually exclusive.  A cloned bp
+	 * (brtwrite) is used as is and is never deduplicated.
 	 */
-	zio->io_prop.zp_dedup = nopwrite ? B_FALSE : zio->io_prop.zp_dedup;
+	zio->io_prop.zp_dedup = (nopwrite || brtwrite) ? B_FALSE :
+	    zio->io_prop.zp_dedup;
 	zio->io_prop.zp_nopwrite = nopwrite;
+	zio->io_prop.zp_brtwrite = brtwrite;
 	zio->io_prop.zp_copies = copies;
 	zio->io_bp_override = bp;
 }
@@ -1157,6 +1194,13 @@ zio_free_sync(zio_t *pio, spa_t *spa, uint64_t txg, const blkptr_t *bp,
 	if (BP_IS_EMBEDDED(bp))
 		return (zio_null(pio, spa, NULL, NULL, NULL, 0));
 
+	/*
+	 * If the block has been cloned, this free only drops one of its
+	 * references in the BRT.
+	 */
+	if (brt_maybe_exists(spa, bp) && brt_entry_decref(spa, bp))
+		return (zio_null(pio, spa, NULL, NULL, NULL, 0));
+
 	metaslab_check_free(spa, bp);
 	arc_freed(spa, bp);
 	dsl_scan_freed(spa, bp);
@@ -1509,6 +1553,13 @@ zio_write_bp_init(zio_t *zio)
 		if (BP_IS_EMBEDDED(bp))
 			return (zio);
 
+		/*
+		 * A cloned block already exists on disk and its reference
+		 * has been added to the BRT, so there is nothing to write.
+		 */
+		if (zp->zp_brtwrite)
+			return (zio);
+
 		/*
 		 * If we've been overridden and nopwrite is set then
 		 * set the flag accordingly to indicate that a nopwrite
@@ -1824,10 +1875,105 @@ zio_taskq_member(zio_t *zio, zio_taskq_type_t q)
 	return (B_FALSE);
 }
 
+/*
+ * Only ordinary asynchronous writes, which would be dispatched to the
+ * z_wr_iss taskq, are batched.  Synchronous writes keep their own dispatch
+ * (to the high priority taskq when there is one) so their latency does not
+ * depend on other I/O.
+ */
+static boolean_t
+zio_write_batchable(zio_t *zio)
+{
+	return (zio_write_batch_size > 1 &&
+	    zio->io_type == ZIO_TYPE_WRITE &&
+	    zio->io_priority == ZIO_PRIORITY_ASYNC_WRITE &&
+	    !(zio->io_flags & (ZIO_FLAG_CONFIG_WRITER | ZIO_FLAG_PROBE)) &&
+	    (zio->io_vd == NULL || !zio->io_vd->vdev_aux));
+}
+
+/*
+ * Run every zio of a batch up to its checksum stage, generate the deferred
+ * checksums with zio_checksum_compute_many(), then resume those zios.
+ */
+static void
+zio_write_batch_execute(void *arg)
+{
+	zio_batch_t *zb = arg;
+	spa_zio_batch_t *szb = zb->zb_slot;
+
+	/* Stop new zios from joining now that the batch is running. */
+	mutex_enter(&szb->szb_lock);
+	if (szb->szb_open == zb)
+		szb->szb_open = NULL;
+	mutex_exit(&szb->szb_lock);
+
+	VERIFY0(tsd_set(zio_batch_tsd_key, zb));
+	for (uint_t i = 0; i < zb->zb_count; i++)
+		zio_execute(zb->zb_zios[i]);
+	VERIFY0(tsd_set(zio_batch_tsd_key, NULL));
+
+	if (zb->zb_cksum_count != 0) {
+		zio_checksum_compute_many(zb->zb_cksum_zios,
+		    zb->zb_cksum_count);
+		for (uint_t i = 0; i < zb->zb_cksum_count; i++)
+			zio_execute(zb->zb_cksum_zios[i]);
+	}
+
+	kmem_cache_free(zio_batch_cache, zb);
+}
+
+/*
+ * Add a write to this CPU's open batch.  A new batch is dispatched as soon
+ * as its first zio arrives and then accepts further zios until it is full
+ * or a taskq thread starts running it, so a batched zio never waits longer
+ * for the issue taskq than it would have with a dispatch of its own.
+ */
+static void
+zio_write_batch_add(zio_t *zio)
+{
+	spa_t *spa = zio->io_spa;
+	spa_zio_batch_t *szb = &spa->spa_zio_batch[CPU_SEQID];
+	uint_t size = MIN(zio_write_batch_size, ZIO_WRITE_BATCH_MAX);
+	zio_batch_t *zb;
+
+	mutex_enter(&szb->szb_lock);
+	zb = szb->szb_open;
+	if (zb != NULL && zb->zb_count < size) {
+		zb->zb_zios[zb->zb_count++] = zio;
+		mutex_exit(&szb->szb_lock);
+		return;
+	}
+
+	/*
+	 * Don't sleep for memory while holding the slot; dispatching the
+	 * zio on its own is always a safe fallback.
+	 */
+	zb = kmem_cache_alloc(zio_batch_cache, KM_NOSLEEP);
+	if (zb == NULL) {
+		mutex_exit(&szb->szb_lock);
+		zio_taskq_dispatch(zio, ZIO_TASKQ_ISSUE, B_FALSE);
+		return;
+	}
+
+	zb->zb_slot = szb;
+	zb->zb_zios[0] = zio;
+	zb->zb_count = 1;
+	zb->zb_cksum_count = 0;
+	taskq_init_ent(&zb->zb_tqent);
+	szb->szb_open = zb;
+
+	spa_taskq_dispatch_ent(spa, ZIO_TYPE_WRITE, ZIO_TASKQ_ISSUE,
+	    zio_write_batch_execute, zb, 0, &zb->zb_tqent);
+	mutex_exit(&szb->szb_lock);
+}
+
 static zio_t *
 zio_issue_async(zio_t *zio)
 {
-	zio_taskq_dispatch(zio, ZIO_TASKQ_ISSUE, B_FALSE);
+	if (zio_write_batchable(zio))
+		zio_write_batch_add(zio);
+	else
+		zio_taskq_dispatch(zio, ZIO_TASKQ_ISSUE, B_FALSE);
 
 	return (NULL);
 }
@@ -4166,6 +4312,7 @@ zio_checksum_generate(zio_t *zio)
 {
 	blkptr_t *bp = zio->io_bp;
 	enum zio_checksum checksum;
+	zio_batch_t *zb;
 
 	if (bp == NULL) {
 		/*
@@ -4187,6 +4334,17 @@ zio_checksum_generate(zio_t *zio)
 		}
 	}
 
+	/*
+	 * Within zio_write_batch_execute(), leave the checksum to be
+	 * generated together with the rest of the batch.
+	 */
+	if (zio_checksum_batchable(zio, checksum) &&
+	    (zb = tsd_get(zio_batch_tsd_key)) != NULL &&
+	    zb->zb_cksum_count < ZIO_WRITE_BATCH_MAX) {
+		zb->zb_cksum_zios[zb->zb_cksum_count++] = zio;
+		return (NULL);
+	}
+
 	zio_checksum_compute(zio, checksum, zio->io_abd, zio->io_size);
 
 	return (zio);
@@ -4967,4 +5125,7 @@ ZFS_MODULE_PARAM(zfs_zio, zio_, dva_throttle_enabled, UINT, ZMOD_RW,
 
 ZFS_MODULE_PARAM(zfs_zio, zio_, deadman_log_all, UINT, ZMOD_RW,
 	"Log all slow ZIOs, not just those with vdevs");
+
+ZFS_MODULE_PARAM(zfs_zio, zio_, write_batch_size, UINT, ZMOD_RW,
+	"Max asynchronous writes issued and checksummed together");
 #endif
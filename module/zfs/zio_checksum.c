@@ -179,14 +179,17 @@ zio_checksum_info_t zio_checksum_table[ZIO_CHECKSUM_FUNCTIONS] = {
 	    NULL, NULL, ZCHECKSUM_FLAG_METADATA, "fletcher4"},
 	{{abd_checksum_SHA256,		abd_checksum_SHA256},
 	    NULL, NULL, ZCHECKSUM_FLAG_METADATA | ZCHECKSUM_FLAG_DEDUP |
-	    ZCHECKSUM_FLAG_NOPWRITE, "sha256"},
+	    ZCHECKSUM_FLAG_NOPWRITE, "sha256",
+	    {abd_checksum_SHA256_many,	abd_checksum_SHA256_many}},
 	{{abd_fletcher_4_native,	abd_fletcher_4_byteswap},
 	    NULL, NULL, ZCHECKSUM_FLAG_EMBEDDED, "zilog2"},
 	{{abd_checksum_off,		abd_checksum_off},
 	    NULL, NULL, 0, "noparity"},
 	{{abd_checksum_SHA512_native,	abd_checksum_SHA512_byteswap},
 	    NULL, NULL, ZCHECKSUM_FLAG_METADATA | ZCHECKSUM_FLAG_DEDUP |
-	    ZCHECKSUM_FLAG_NOPWRITE, "sha512"},
+	    ZCHECKSUM_FLAG_NOPWRITE, "sha512",
+	    {abd_checksum_SHA512_native_many,
+	    abd_checksum_SHA512_byteswap_many}},
 	{{abd_checksum_skein_native,	abd_checksum_skein_byteswap},
 	    abd_checksum_skein_tmpl_init, abd_checksum_skein_tmpl_free,
 	    ZCHECKSUM_FLAG_METADATA | ZCHECKSUM_FLAG_DEDUP |
@@ -196,7 +199,13 @@ zio_checksum_info_t zio_checksum_table[ZIO_CHECKSUM_FUNCTIONS] = {
 	    abd_checksum_edonr_tmpl_init, abd_checksum_edonr_tmpl_free,
 	    ZCHECKSUM_FLAG_METADATA | ZCHECKSUM_FLAG_SALTED |
 	    ZCHECKSUM_FLAG_NOPWRITE, "edonr"},
+#else
+	{{NULL, NULL}, NULL, NULL, 0, NULL},
 #endif
+	{{abd_checksum_blake3_native,	abd_checksum_blake3_byteswap},
+	    abd_checksum_blake3_tmpl_init, abd_checksum_blake3_tmpl_free,
+	    ZCHECKSUM_FLAG_METADATA | ZCHECKSUM_FLAG_DEDUP |
+	    ZCHECKSUM_FLAG_SALTED | ZCHECKSUM_FLAG_NOPWRITE, "blake3"},
 };
 
 /*
@@ -215,6 +224,8 @@ zio_checksum_to_feature(enum zio_checksum cksum)
 		return (SPA_FEATURE_SKEIN);
 	case ZIO_CHECKSUM_EDONR:
 		return (SPA_FEATURE_EDONR);
+	case ZIO_CHECKSUM_BLAKE3:
+		return (SPA_FEATURE_BLAKE3);
 	default:
 		return (SPA_FEATURE_NONE);
 	}
@@ -404,6 +415,73 @@ zio_checksum_compute(zio_t *zio, enum zio_checksum checksum,
 	}
 }
 
+/*
+ * Returns B_TRUE if the checksum of this zio's block may be generated by
+ * zio_checksum_compute_many() instead of zio_checksum_compute().  That is
+ * the case for plain block pointers whose checksum provides a multi-buffer
+ * function; embedded and encrypted checksums are always computed singly.
+ */
+boolean_t
+zio_checksum_batchable(zio_t *zio, enum zio_checksum checksum)
+{
+	zio_checksum_info_t *ci = &zio_checksum_table[checksum];
+
+	ASSERT((uint_t)checksum < ZIO_CHECKSUM_FUNCTIONS);
+
+	return (zio->io_bp != NULL && ci->ci_func_many[0] != NULL &&
+	    !(ci->ci_flags & ZCHECKSUM_FLAG_EMBEDDED) &&
+	    !BP_USES_CRYPT(zio->io_bp));
+}
+
+/*
+ * Generate the checksums of n batchable zios.  Blocks sharing a checksum
+ * function and size are handed to its multi-buffer function together, up
+ * to ZIO_CHECKSUM_MANY_MAX at a time.
+ */
+
+void
+zio_checksum_compute_many(zio_t **zios, uint_t n)
+{
+	zio_t *group[ZIO_CHECKSUM_MANY_MAX];
+	abd_t *abds[ZIO_CHECKSUM_MANY_MAX];
+	zio_cksum_t zcps[ZIO_CHECKSUM_MANY_MAX];
+	uint64_t done = 0;
+
+	ASSERT3U(n, <=, 64);
+
+	for (uint_t i = 0; i < n; i++) {
+		zio_t *zio = zios[i];
+		spa_t *spa = zio->io_spa;
+		enum zio_checksum checksum = BP_GET_CHECKSUM(zio->io_bp);
+		zio_checksum_info_t *ci = &zio_checksum_table[checksum];
+		uint_t cnt = 0;
+
+		if (done & (1ULL << i))
+			continue;
+
+		ASSERT(zio_checksum_batchable(zio, checksum));
+		zio_checksum_template_init(checksum, spa);
+
+		for (uint_t j = i; j < n && cnt < ZIO_CHECKSUM_MANY_MAX; j++) {
+			if ((done & (1ULL << j)) ||
+			    BP_GET_CHECKSUM(zios[j]->io_bp) != checksum ||
+			    zios[j]->io_size != zio->io_size)
+				continue;
+
+			group[cnt] = zios[j];
+			abds[cnt] = zios[j]->io_abd;
+			cnt++;
+			done |= 1ULL << j;
+		}
+
+		ci->ci_func_many[0](abds, zio->io_size,
+		    spa->spa_cksum_tmpls[checksum], zcps, cnt);
+
+		for (uint_t j = 0; j < cnt; j++)
+			group[j]->io_bp->blk_cksum = zcps[j];
+	}
+}
+
 int
 zio_checksum_error_impl(spa_t *spa, const blkptr_t *bp,
     enum zio_checksum checksum, abd_t *abd, uint64_t size, uint64_t offset,
@@ -62,9 +62,58 @@ zio_compress_info_t zio_compress_table[ZIO_COMPRESS_FUNCTIONS] = {
 	{"gzip-8",		8,	gzip_compress,	gzip_decompress},
 	{"gzip-9",		9,	gzip_compress,	gzip_decompress},
 	{"zle",			64,	zle_compress,	zle_decompress},
-	{"lz4",			0,	lz4_compress_zfs, lz4_decompress_zfs}
+	{"lz4",			0,	lz4_compress_zfs, lz4_decompress_zfs},
+	{"zstd-1",		1,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-2",		2,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-3",		3,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-4",		4,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-5",		5,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-6",		6,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-7",		7,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-8",		8,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-9",		9,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-10",		10,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-11",		11,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-12",		12,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-13",		13,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-14",		14,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-15",		15,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-16",		16,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-17",		17,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-18",		18,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-19",		19,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-fast-1",		-1,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-fast-2",		-2,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-fast-3",		-3,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-fast-4",		-4,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-fast-5",		-5,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-fast-6",		-6,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-fast-7",		-7,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-fast-8",		-8,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-fast-9",		-9,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-fast-10",	-10,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-fast-20",	-20,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-fast-30",	-30,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-fast-40",	-40,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-fast-50",	-50,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-fast-60",	-60,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-fast-70",	-70,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-fast-80",	-80,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-fast-90",	-90,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-fast-100",	-100,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-fast-500",	-500,	zstd_compress_zfs, zstd_decompress_zfs},
+	{"zstd-fast-1000",	-1000,	zstd_compress_zfs, zstd_decompress_zfs}
 };
 
+spa_feature_t
+zio_compress_to_feature(enum zio_compress comp)
+{
+	if (ZIO_COMPRESS_IS_ZSTD(comp))
+		return (SPA_FEATURE_ZSTD_COMPRESS);
+
+	return (SPA_FEATURE_NONE);
+}
+
 enum zio_compress
 zio_compress_select(spa_t *spa, enum zio_compress child,
     enum zio_compress parent)
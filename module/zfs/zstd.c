@@ -0,0 +1,2535 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Zstandard compression for ZFS.
+ *
+ * This is a self-contained implementation of the Zstandard frame format
+ * (RFC 8878).  The decoder understands every construct the format allows
+ * apart from dictionaries, so blocks written by any conforming zstd encoder
+ * can be read back.  The encoder is a hash-chain LZ77 match finder feeding
+ * Huffman-coded literals and FSE-coded sequences; compression levels select
+ * the match finder strategy and search depth, and the "fast" levels trade
+ * ratio for speed by skipping ahead faster through incompressible data.
+ *
+ * Like lz4, the exact compressed size is stored big-endian in the first four
+ * bytes of the buffer, because the allocated size is rounded up to the
+ * vdev's ashift.
+ *
+ * Compression needs a sizable context (hash and chain tables plus the
+ * per-block sequence store), so contexts come from a kmem cache and each
+ * CPU keeps one cached context for each direction.  Callers try the slot of
+ * the CPU they are running on and fall back to the kmem cache when it is
+ * busy, so no allocation is made in the common case.
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/zio_compress.h>
+#include <sys/kstat.h>
+
+/*
+ * Format constants.
+ */
+#define	ZSTD_MAGIC		0xFD2FB528U
+#define	ZSTD_FRAMEHDR_MIN	6
+#define	ZSTD_BLOCKSIZE_MAX	(128 * 1024)
+#define	ZSTD_BLOCKHDR_SIZE	3
+
+#define	ZSTD_BLOCK_RAW		0
+#define	ZSTD_BLOCK_RLE		1
+#define	ZSTD_BLOCK_COMPRESSED	2
+
+#define	ZSTD_LIT_RAW		0
+#define	ZSTD_LIT_RLE		1
+#define	ZSTD_LIT_COMPRESSED	2
+#define	ZSTD_LIT_TREELESS	3
+
+#define	ZSTD_MODE_PREDEFINED	0
+#define	ZSTD_MODE_RLE		1
+#define	ZSTD_MODE_FSE		2
+#define	ZSTD_MODE_REPEAT	3
+
+#define	ZSTD_LL_MAXSV		35
+#define	ZSTD_ML_MAXSV		52
+#define	ZSTD_OF_MAXSV		31
+#define	ZSTD_LL_MAXLOG		9
+#define	ZSTD_ML_MAXLOG		9
+#define	ZSTD_OF_MAXLOG		8
+#define	ZSTD_LL_DEFLOG		6
+#define	ZSTD_ML_DEFLOG		6
+#define	ZSTD_OF_DEFLOG		5
+#define	ZSTD_FSE_MINLOG		5
+#define	ZSTD_FSE_MAXLOG		9
+#define	ZSTD_FSE_MAXSV		255
+
+#define	ZSTD_HUF_MAXBITS	11
+#define	ZSTD_HUF_MAXSV		255
+#define	ZSTD_HUFW_MAXLOG	6
+
+#define	ZSTD_MINMATCH		4
+#define	ZSTD_SEQ_MAX		(ZSTD_BLOCKSIZE_MAX / ZSTD_MINMATCH + 1)
+#define	ZSTD_HASHLOG_MAX	17
+#define	ZSTD_CHAINLOG_MAX	17
+
+/* Indexes of the three sequence streams. */
+#define	ZSTD_LL			0
+#define	ZSTD_OF			1
+#define	ZSTD_ML			2
+
+static const uint32_t zstd_ll_base[ZSTD_LL_MAXSV + 1] = {
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+	16, 18, 20, 22, 24, 28, 32, 40, 48, 64, 128, 256, 512, 1024, 2048,
+	4096, 8192, 16384, 32768, 65536
+};
+
+static const uint8_t zstd_ll_bits[ZSTD_LL_MAXSV + 1] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	1, 1, 1, 1, 2, 2, 3, 3, 4, 6, 7, 8, 9, 10, 11,
+	12, 13, 14, 15, 16
+};
+
+static const uint32_t zstd_ml_base[ZSTD_ML_MAXSV + 1] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18,
+	19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34,
+	35, 37, 39, 41, 43, 47, 51, 59, 67, 83, 99, 131, 259, 515, 1027,
+	2051, 4099, 8195, 16387, 32771, 65539
+};
+
+static const uint8_t zstd_ml_bits[ZSTD_ML_MAXSV + 1] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	1, 1, 1, 1, 2, 2, 3, 3, 4, 4, 5, 7, 8, 9, 10,
+	11, 12, 13, 14, 15, 16
+};
+
+static const int16_t zstd_ll_defnorm[ZSTD_LL_MAXSV + 1] = {
+	4, 3, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1,
+	2, 2, 2, 2, 2, 2, 2, 2, 2, 3, 2, 1, 1, 1, 1, 1,
+	-1, -1, -1, -1
+};
+
+static const int16_t zstd_ml_defnorm[ZSTD_ML_MAXSV + 1] = {
+	1, 4, 3, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, -1, -1,
+	-1, -1, -1, -1, -1
+};
+
+static const int16_t zstd_of_defnorm[28 + 1] = {
+	1, 1, 1, 1, 1, 1, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, -1, -1, -1, -1, -1
+};
+
+/*
+ * Per-stream description of the sequence codes: the largest symbol, the
+ * largest table log, and the predefined distribution.
+ */
+typedef struct zstd_seqdesc {
+	uint_t		sd_maxsv;
+	uint_t		sd_maxlog;
+	uint_t		sd_deflog;
+	uint_t		sd_defmaxsv;
+	const int16_t	*sd_defnorm;
+} zstd_seqdesc_t;
+
+static const zstd_seqdesc_t zstd_seqdesc[3] = {
+	{ ZSTD_LL_MAXSV, ZSTD_LL_MAXLOG, ZSTD_LL_DEFLOG, ZSTD_LL_MAXSV,
+	    zstd_ll_defnorm },
+	{ ZSTD_OF_MAXSV, ZSTD_OF_MAXLOG, ZSTD_OF_DEFLOG, 28,
+	    zstd_of_defnorm },
+	{ ZSTD_ML_MAXSV, ZSTD_ML_MAXLOG, ZSTD_ML_DEFLOG, ZSTD_ML_MAXSV,
+	    zstd_ml_defnorm },
+};
+
+/*
+ * Compression level parameters.  Levels 1 and 2 use a single hash table
+ * and greedy parsing; higher levels walk a hash chain and look one or two
+ * positions ahead for a better match.  Negative ("fast") levels use the
+ * single hash table and skip ahead more aggressively after each miss.
+ */
+typedef enum zstd_strategy {
+	ZSTD_STRAT_FAST,
+	ZSTD_STRAT_GREEDY,
+	ZSTD_STRAT_LAZY,
+	ZSTD_STRAT_LAZY2
+} zstd_strategy_t;
+
+typedef struct zstd_params {
+	zstd_strategy_t	zp_strategy;
+	uint8_t		zp_hashlog;
+	uint8_t		zp_chainlog;
+	uint8_t		zp_searchlog;
+	uint16_t	zp_target;
+	uint16_t	zp_accel;
+} zstd_params_t;
+
+static const zstd_params_t zstd_level_params[ZIO_ZSTD_LEVEL_MAX + 1] = {
+	{ ZSTD_STRAT_FAST,	16, 0, 0, 0, 1 },	/* unused */
+	{ ZSTD_STRAT_FAST,	16, 0, 0, 0, 1 },	/* 1 */
+	{ ZSTD_STRAT_FAST,	17, 0, 0, 0, 1 },	/* 2 */
+	{ ZSTD_STRAT_GREEDY,	17, 16, 1, 16, 1 },	/* 3 */
+	{ ZSTD_STRAT_GREEDY,	17, 16, 2, 24, 1 },	/* 4 */
+	{ ZSTD_STRAT_LAZY,	17, 17, 2, 32, 1 },	/* 5 */
+	{ ZSTD_STRAT_LAZY,	17, 17, 3, 32, 1 },	/* 6 */
+	{ ZSTD_STRAT_LAZY,	17, 17, 4, 48, 1 },	/* 7 */
+	{ ZSTD_STRAT_LAZY2,	17, 17, 4, 64, 1 },	/* 8 */
+	{ ZSTD_STRAT_LAZY2,	17, 17, 5, 64, 1 },	/* 9 */
+	{ ZSTD_STRAT_LAZY2,	17, 17, 5, 96, 1 },	/* 10 */
+	{ ZSTD_STRAT_LAZY2,	17, 17, 6, 128, 1 },	/* 11 */
+	{ ZSTD_STRAT_LAZY2,	17, 17, 6, 192, 1 },	/* 12 */
+	{ ZSTD_STRAT_LAZY2,	17, 17, 7, 256, 1 },	/* 13 */
+	{ ZSTD_STRAT_LAZY2,	17, 17, 7, 384, 1 },	/* 14 */
+	{ ZSTD_STRAT_LAZY2,	17, 17, 8, 512, 1 },	/* 15 */
+	{ ZSTD_STRAT_LAZY2,	17, 17, 8, 1024, 1 },	/* 16 */
+	{ ZSTD_STRAT_LAZY2,	17, 17, 9, 1024, 1 },	/* 17 */
+	{ ZSTD_STRAT_LAZY2,	17, 17, 10, 2048, 1 },	/* 18 */
+	{ ZSTD_STRAT_LAZY2,	17, 17, 11, 4096, 1 },	/* 19 */
+};
+
+/*
+ * FSE decoding table entry.
+ */
+typedef struct zstd_fse_dentry {
+	uint16_t	fd_newstate;
+	uint8_t		fd_symbol;
+	uint8_t		fd_nbbits;
+} zstd_fse_dentry_t;
+
+/*
+ * FSE encoding table: the state table plus the symbol transformation table.
+ */
+typedef struct zstd_fse_ctable {
+	uint_t		fc_log;
+	uint16_t	fc_state[1 << ZSTD_FSE_MAXLOG];
+	int32_t		fc_findstate[ZSTD_ML_MAXSV + 1];
+	uint32_t	fc_nbbits[ZSTD_ML_MAXSV + 1];
+} zstd_fse_ctable_t;
+
+typedef struct zstd_huf_dentry {
+	uint8_t		hd_symbol;
+	uint8_t		hd_nbbits;
+} zstd_huf_dentry_t;
+
+/*
+ * Decompression context.  The Huffman and FSE tables survive from one block
+ * to the next within a frame, since later blocks may reuse them.
+ */
+typedef struct zstd_dctx {
+	uint8_t			dc_lit[ZSTD_BLOCKSIZE_MAX + 8];
+	zstd_huf_dentry_t	dc_huf[1 << ZSTD_HUF_MAXBITS];
+	uint_t			dc_huf_log;
+	boolean_t		dc_huf_valid;
+	zstd_fse_dentry_t	dc_fse[3][1 << ZSTD_FSE_MAXLOG];
+	uint_t			dc_fse_log[3];
+	boolean_t		dc_fse_valid[3];
+	uint32_t		dc_rep[3];
+	int16_t			dc_norm[ZSTD_FSE_MAXSV + 1];
+	uint8_t			dc_symbols[1 << ZSTD_FSE_MAXLOG];
+	uint8_t			dc_weights[ZSTD_HUF_MAXSV + 1];
+} zstd_dctx_t;
+
+/*
+ * Compression context.
+ */
+typedef struct zstd_cctx {
+	uint32_t		cc_htab[1 << ZSTD_HASHLOG_MAX];
+	uint32_t		cc_chain[1 << ZSTD_CHAINLOG_MAX];
+	uint8_t			cc_lit[ZSTD_BLOCKSIZE_MAX];
+	uint32_t		cc_seq_ll[ZSTD_SEQ_MAX];
+	uint32_t		cc_seq_ml[ZSTD_SEQ_MAX];
+	uint32_t		cc_seq_ov[ZSTD_SEQ_MAX];
+	uint8_t			cc_code[3][ZSTD_SEQ_MAX];
+	zstd_fse_ctable_t	cc_ct[3];
+	int16_t			cc_norm[ZSTD_FSE_MAXSV + 1];
+	uint8_t			cc_symbols[1 << ZSTD_FSE_MAXLOG];
+	uint32_t		cc_count[ZSTD_HUF_MAXSV + 1];
+	uint8_t			cc_huf_nbbits[ZSTD_HUF_MAXSV + 1];
+	uint16_t		cc_huf_code[ZSTD_HUF_MAXSV + 1];
+	uint32_t		cc_huf_node[2 * (ZSTD_HUF_MAXSV + 1)];
+	uint16_t		cc_huf_parent[2 * (ZSTD_HUF_MAXSV + 1)];
+	uint8_t			cc_huf_sym[ZSTD_HUF_MAXSV + 1];
+	uint8_t			cc_weights[ZSTD_HUF_MAXSV + 1];
+	uint8_t			cc_vweights[ZSTD_HUF_MAXSV + 1];
+	uint_t			cc_hashlog;
+	uint_t			cc_chainlog;
+	uint32_t		cc_next;
+	size_t			cc_nseq;
+	size_t			cc_nlit;
+	uint32_t		cc_rep[3];
+} zstd_cctx_t;
+
+/*
+ * Statistics.
+ */
+typedef struct zstd_stats {
+	kstat_named_t	zstdstat_compress;
+	kstat_named_t	zstdstat_compress_fail;
+	kstat_named_t	zstdstat_decompress;
+	kstat_named_t	zstdstat_decompress_fail;
+	kstat_named_t	zstdstat_cache_miss;
+	kstat_named_t	zstdstat_cache_reap;
+} zstd_stats_t;
+
+static zstd_stats_t zstd_stats = {
+	{ "compress",			KSTAT_DATA_UINT64 },
+	{ "compress_fail",		KSTAT_DATA_UINT64 },
+	{ "decompress",			KSTAT_DATA_UINT64 },
+	{ "decompress_fail",		KSTAT_DATA_UINT64 },
+	{ "cache_miss",			KSTAT_DATA_UINT64 },
+	{ "cache_reap",			KSTAT_DATA_UINT64 },
+};
+
+#define	ZSTDSTAT_BUMP(stat)	\
+	atomic_inc_64(&zstd_stats.stat.value.ui64)
+
+static kstat_t *zstd_ksp;
+
+/*
+ * ==========================================================================
+ * Helpers
+ * ==========================================================================
+ */
+
+/* Index of the highest set bit; v must be non-zero. */
+static inline uint_t
+zstd_highbit(uint32_t v)
+{
+	return (31 - __builtin_clz(v));
+}
+
+static inline uint16_t
+zstd_read_le16(const uint8_t *p)
+{
+	return ((uint16_t)p[0] | ((uint16_t)p[1] << 8));
+}
+
+static inline uint32_t
+zstd_read_le24(const uint8_t *p)
+{
+	return ((uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+	    ((uint32_t)p[2] << 16));
+}
+
+static inline uint32_t
+zstd_read_le32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+	    ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+}
+
+static inline uint64_t
+zstd_read_le64(const uint8_t *p)
+{
+	return ((uint64_t)zstd_read_le32(p) |
+	    ((uint64_t)zstd_read_le32(p + 4) << 32));
+}
+
+static inline void
+zstd_write_le(uint8_t *p, uint64_t v, uint_t nbytes)
+{
+	for (uint_t i = 0; i < nbytes; i++)
+		p[i] = (uint8_t)(v >> (8 * i));
+}
+
+/* Native-endian unaligned loads for the match finder. */
+static inline uint32_t
+zstd_read32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof (v));
+	return (v);
+}
+
+static inline uint64_t
+zstd_read64(const uint8_t *p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof (v));
+	return (v);
+}
+
+/* Length of the common prefix of ip and match, bounded by iend. */
+static inline size_t
+zstd_count(const uint8_t *ip, const uint8_t *match, const uint8_t *iend)
+{
+	const uint8_t *start = ip;
+
+	while (ip + sizeof (uint64_t) <= iend) {
+		uint64_t diff = zstd_read64(ip) ^ zstd_read64(match);
+		if (diff != 0) {
+#if defined(_BIG_ENDIAN)
+			return ((ip - start) + (__builtin_clzll(diff) >> 3));
+#else
+			return ((ip - start) + (__builtin_ctzll(diff) >> 3));
+#endif
+		}
+		ip += sizeof (uint64_t);
+		match += sizeof (uint64_t);
+	}
+	while (ip < iend && *ip == *match) {
+		ip++;
+		match++;
+	}
+	return (ip - start);
+}
+
+/*
+ * Apply the repeat offset rules to an offset value as stored in a sequence
+ * and return the actual match offset.  The encoder uses this too, so both
+ * sides always agree on the repeat offset history.
+ */
+static inline uint32_t
+zstd_rep_update(uint32_t *rep, uint32_t ov, uint32_t ll)
+{
+	uint32_t off;
+
+	if (ov > 3) {
+		off = ov - 3;
+	} else {
+		uint_t idx = ov - 1 + (ll == 0);
+
+		if (idx == 0)
+			return (rep[0]);
+		off = (idx == 3) ? rep[0] - 1 : rep[idx];
+		if (idx == 1) {
+			rep[1] = rep[0];
+			rep[0] = off;
+			return (off);
+		}
+	}
+	rep[2] = rep[1];
+	rep[1] = rep[0];
+	rep[0] = off;
+	return (off);
+}
+
+/*
+ * ==========================================================================
+ * Bit streams
+ * ==========================================================================
+ */
+
+/*
+ * Forward bit writer.  Entropy coded streams are written front to back and
+ * read back to front, terminated by a single marker bit.
+ */
+typedef struct zstd_bitw {
+	uint8_t		*bw_ptr;
+	uint8_t		*bw_start;
+	uint8_t		*bw_end;
+	uint64_t	bw_bits;
+	uint_t		bw_nbits;
+	boolean_t	bw_overflow;
+} zstd_bitw_t;
+
+static void
+zstd_bitw_init(zstd_bitw_t *bw, uint8_t *dst, size_t cap)
+{
+	bw->bw_ptr = bw->bw_start = dst;
+	bw->bw_end = dst + cap;
+	bw->bw_bits = 0;
+	bw->bw_nbits = 0;
+	bw->bw_overflow = B_FALSE;
+}
+
+static inline void
+zstd_bitw_add(zstd_bitw_t *bw, uint64_t val, uint_t nbits)
+{
+	ASSERT3U(nbits, <=, 32);
+	bw->bw_bits |= (val & ((1ULL << nbits) - 1)) << bw->bw_nbits;
+	bw->bw_nbits += nbits;
+	if (bw->bw_nbits < 32)
+		return;
+
+	if (bw->bw_ptr + 4 > bw->bw_end) {
+		bw->bw_overflow = B_TRUE;
+		bw->bw_ptr = bw->bw_start;
+	}
+	zstd_write_le(bw->bw_ptr, bw->bw_bits, 4);
+	bw->bw_ptr += 4;
+	bw->bw_bits >>= 32;
+	bw->bw_nbits -= 32;
+}
+
+/* Returns the stream size, or 0 if it did not fit. */
+static size_t
+zstd_bitw_close(zstd_bitw_t *bw)
+{
+	zstd_bitw_add(bw, 1, 1);
+	while (bw->bw_nbits > 0) {
+		if (bw->bw_ptr >= bw->bw_end) {
+			bw->bw_overflow = B_TRUE;
+			break;
+		}
+		*bw->bw_ptr++ = (uint8_t)bw->bw_bits;
+		bw->bw_bits >>= 8;
+		bw->bw_nbits = (bw->bw_nbits > 8) ? bw->bw_nbits - 8 : 0;
+	}
+	if (bw->bw_overflow)
+		return (0);
+	return (bw->bw_ptr - bw->bw_start);
+}
+
+/*
+ * Backward bit reader.  br_pos is the number of bits not yet consumed; it
+ * goes negative when a reader consumes more bits than the stream holds,
+ * in which case the missing bits read as zero.
+ */
+typedef struct zstd_bitr {
+	const uint8_t	*br_start;
+	size_t		br_size;
+	int64_t		br_pos;
+} zstd_bitr_t;
+
+static int
+zstd_bitr_init(zstd_bitr_t *br, const uint8_t *src, size_t size)
+{
+	if (size == 0 || src[size - 1] == 0)
+		return (-1);
+	br->br_start = src;
+	br->br_size = size;
+	br->br_pos = (int64_t)(size - 1) * 8 + zstd_highbit(src[size - 1]);
+	return (0);
+}
+
+static inline uint32_t
+zstd_bitr_get(const zstd_bitr_t *br, int64_t pos, uint_t nbits)
+{
+	size_t byte = pos >> 3;
+	uint_t shift = pos & 7;
+	uint64_t v;
+
+	if (byte + 8 <= br->br_size) {
+		v = zstd_read_le64(br->br_start + byte);
+	} else {
+		v = 0;
+		for (uint_t i = 0; byte + i < br->br_size; i++)
+			v |= (uint64_t)br->br_start[byte + i] << (8 * i);
+	}
+	return ((uint32_t)((v >> shift) & ((1ULL << nbits) - 1)));
+}
+
+static inline uint32_t
+zstd_bitr_peek(const zstd_bitr_t *br, uint_t nbits)
+{
+	int64_t pos = br->br_pos - nbits;
+
+	if (nbits == 0 || pos + nbits <= 0)
+		return (0);
+	if (pos >= 0)
+		return (zstd_bitr_get(br, pos, nbits));
+	return (zstd_bitr_get(br, 0, nbits + pos) << (-pos));
+}
+
+static inline uint32_t
+zstd_bitr_read(zstd_bitr_t *br, uint_t nbits)
+{
+	uint32_t v = zstd_bitr_peek(br, nbits);
+	br->br_pos -= nbits;
+	return (v);
+}
+
+/*
+ * ==========================================================================
+ * FSE tables
+ * ==========================================================================
+ */
+
+/*
+ * Spread the symbols of a normalized distribution over the state table.
+ * Low probability (-1) symbols go at the top of the table.  Returns -1 if
+ * the distribution does not fill the table exactly.
+ */
+static int
+zstd_fse_spread(uint8_t *symbols, const int16_t *norm, uint_t maxsv,
+    uint_t log)
+{
+	uint32_t size = 1U << log;
+	uint32_t mask = size - 1;
+	uint32_t step = (size >> 1) + (size >> 3) + 3;
+	uint32_t high = size - 1;
+	uint32_t pos = 0;
+
+	for (uint_t s = 0; s <= maxsv; s++) {
+		if (norm[s] == -1)
+			symbols[high--] = s;
+	}
+	for (uint_t s = 0; s <= maxsv; s++) {
+		for (int i = 0; i < norm[s]; i++) {
+			symbols[pos] = s;
+			do {
+				pos = (pos + step) & mask;
+			} while (pos > high);
+		}
+	}
+	return (pos == 0 ? 0 : -1);
+}
+
+static int
+zstd_fse_build_dtable(zstd_fse_dentry_t *dt, uint8_t *symbols,
+    const int16_t *norm, uint_t maxsv, uint_t log)
+{
+	uint16_t next[ZSTD_FSE_MAXSV + 1];
+	uint32_t size = 1U << log;
+
+	if (zstd_fse_spread(symbols, norm, maxsv, log) != 0)
+		return (-1);
+
+	for (uint_t s = 0; s <= maxsv; s++)
+		next[s] = (norm[s] == -1) ? 1 : norm[s];
+
+	for (uint32_t u = 0; u < size; u++) {
+		uint8_t s = symbols[u];
+		uint32_t ns = next[s]++;
+		uint_t nbbits = log - zstd_highbit(ns);
+
+		dt[u].fd_symbol = s;
+		dt[u].fd_nbbits = nbbits;
+		dt[u].fd_newstate = (ns << nbbits) - size;
+	}
+	return (0);
+}
+
+static void
+zstd_fse_build_dtable_rle(zstd_fse_dentry_t *dt, uint8_t symbol)
+{
+	dt[0].fd_symbol = symbol;
+	dt[0].fd_nbbits = 0;
+	dt[0].fd_newstate = 0;
+}
+
+/*
+ * 32 bits starting at bit position pos
+ * of a forward little-endian bit stream, zero filled past the end.
+ */
+static uint32_t
+zstd_ncount_bits(const uint8_t *src, size_t srclen, size_t pos)
+{
+	size_t byte = pos >> 3;
+	uint64_t v = 0;
+
+	for (uint_t i = 0; i < 5 && byte + i < srclen; i++)
+		v |= (uint64_t)src[byte + i] << (8 * i);
+	return ((uint32_t)(v >> (pos & 7)));
+}
+
+/*
+ * Parse a normalized distribution header.  Returns the number of bytes
+ * consumed, or -1 on error.
+ */
+static int
+zstd_fse_read_ncount(int16_t *norm, uint_t *maxsvp, uint_t *logp,
+    uint_t maxlog, const uint8_t *src, size_t srclen)
+{
+	size_t bitpos = 0;
+	int remaining, threshold, nbbits;
+	uint_t sym = 0, maxsv = *maxsvp;
+	boolean_t prev0 = B_FALSE;
+	uint_t log;
+
+	if (srclen < 1)
+		return (-1);
+	log = (src[0] & 0xf) + ZSTD_FSE_MINLOG;
+	if (log > maxlog)
+		return (-1);
+	bitpos = 4;
+	remaining = (1 << log) + 1;
+	threshold = 1 << log;
+	nbbits = log + 1;
+
+	while (remaining > 1) {
+		if (sym > maxsv)
+			return (-1);
+		if (prev0) {
+			uint32_t rep;
+
+			do {
+				if (bitpos + 2 > srclen * 8)
+					return (-1);
+				rep = zstd_ncount_bits(src, srclen, bitpos) & 3;
+				bitpos += 2;
+				for (uint32_t i = 0; i < rep; i++) {
+					if (sym > maxsv)
+						return (-1);
+					norm[sym++] = 0;
+				}
+			} while (rep == 3);
+			if (sym > maxsv)
+				return (-1);
+		}
+
+		int max = (2 * threshold - 1) - remaining;
+		int count;
+		uint32_t bits;
+
+		if (bitpos + nbbits - 1 > srclen * 8)
+			return (-1);
+		bits = zstd_ncount_bits(src, srclen, bitpos);
+		if ((int)(bits & (threshold - 1)) < max) {
+			count = bits & (threshold - 1);
+			bitpos += nbbits - 1;
+		} else {
+			if (bitpos + nbbits > srclen * 8)
+				return (-1);
+			count = bits & (2 * threshold - 1);
+			if (count >= threshold)
+				count -= max;
+			bitpos += nbbits;
+		}
+		count--;
+		remaining -= (count < 0) ? -count : count;
+		norm[sym++] = count;
+		prev0 = (count == 0);
+		if (remaining < 1)
+			return (-1);
+		while (remaining < threshold) {
+			nbbits--;
+			threshold >>= 1;
+		}
+	}
+	if (remaining != 1 || sym == 0)
+		return (-1);
+
+	*maxsvp = sym - 1;
+	*logp = log;
+	return ((bitpos + 7) >> 3);
+}
+
+/*
+ * ==========================================================================
+ * Decompression
+ * ==========================================================================
+ */
+
+/*
+ * Decode the Huffman weights of a tree description whose weights were
+ * FSE compressed.  Returns the number of weights, or -1 on error.
+ */
+static int
+zstd_huf_decode_fse_weights(int16_t *norm, uint8_t *symbols, uint8_t *weights,
+    const uint8_t *src, size_t srclen)
+{
+	zstd_fse_dentry_t dt[1 << ZSTD_HUFW_MAXLOG];
+	uint_t maxsv = ZSTD_HUF_MAXBITS + 1, log;
+	uint32_t st1, st2;
+	zstd_bitr_t br;
+	int hdr, n = 0;
+
+	hdr = zstd_fse_read_ncount(norm, &maxsv, &log, ZSTD_HUFW_MAXLOG,
+	    src, srclen);
+	if (hdr < 0 || zstd_fse_build_dtable(dt, symbols, norm, maxsv,
+	    log) != 0)
+		return (-1);
+	if (zstd_bitr_init(&br, src + hdr, srclen - hdr) != 0)
+		return (-1);
+
+	st1 = zstd_bitr_read(&br, log);
+	st2 = zstd_bitr_read(&br, log);
+	if (br.br_pos < 0)
+		return (-1);
+
+	/*
+	 * The two states take turns; the stream ends when a state update
+	 * runs past the start of the bit stream, after which the other
+	 * state still holds one final symbol.
+	 */
+	for (;;) {
+		if (n + 2 > ZSTD_HUF_MAXSV)
+			return (-1);
+		weights[n++] = dt[st1].fd_symbol;
+		st1 = dt[st1].fd_newstate +
+		    zstd_bitr_read(&br, dt[st1].fd_nbbits);
+		if (br.br_pos < 0) {
+			weights[n++] = dt[st2].fd_symbol;
+			break;
+		}
+		weights[n++] = dt[st2].fd_symbol;
+		st2 = dt[st2].fd_newstate +
+		    zstd_bitr_read(&br, dt[st2].fd_nbbits);
+		if (br.br_pos < 0) {
+			if (n + 1 > ZSTD_HUF_MAXSV)
+				return (-1);
+			weights[n++] = dt[st1].fd_symbol;
+			break;
+		}
+	}
+	return (n);
+}
+
+/*
+ * Read a Huffman tree description and build the decoding table.  Returns
+ * the size of the description, or -1 on error.
+ */
+static int
+zstd_huf_read_table(zstd_dctx_t *dc, const uint8_t *src, size_t srclen)
+{
+	uint8_t *weights = dc->dc_weights;
+	uint32_t total = 0, rest, pos;
+	uint_t log, hdr;
+	int nw, size;
+
+	if (srclen < 1)
+		return (-1);
+	hdr = src[0];
+	if (hdr >= 128) {
+		nw = hdr - 127;
+		size = 1 + (nw + 1) / 2;
+		if (size > srclen)
+			return (-1);
+		for (int i = 0; i < nw; i++) {
+			uint8_t b = src[1 + i / 2];
+			weights[i] = (i & 1) ? (b & 0xf) : (b >> 4);
+		}
+	} else {
+		size = 1 + hdr;
+		if (size > srclen)
+			return (-1);
+		nw = zstd_huf_decode_fse_weights(dc->dc_norm, dc->dc_symbols,
+		    weights, src + 1, hdr);
+		if (nw < 0)
+			return (-1);
+	}
+
+	for (int i = 0; i < nw; i++) {
+		if (weights[i] > ZSTD_HUF_MAXBITS)
+			return (-1);
+		if (weights[i] != 0)
+			total += 1U << (weights[i] - 1);
+	}
+	if (total == 0)
+		return (-1);
+	log = zstd_highbit(total) + 1;
+	if (log > ZSTD_HUF_MAXBITS)
+		return (-1);
+	rest = (1U << log) - total;
+	if ((rest & (rest - 1)) != 0)
+		return (-1);
+	weights[nw++] = zstd_highbit(rest) + 1;
+
+	/*
+	 * Lay the symbols out by increasing weight, each one filling
+	 * 2^(weight - 1) consecutive entries.
+	 */
+	pos = 0;
+	for (uint_t w = 1; w <= log; w++) {
+		for (int s = 0; s < nw; s++) {
+			if (weights[s] != w)
+				continue;
+			uint32_t len = 1U << (w - 1);
+			for (uint32_t i = 0; i < len; i++) {
+				dc->dc_huf[pos + i].hd_symbol = s;
+				dc->dc_huf[pos + i].hd_nbbits = log + 1 - w;
+			}
+			pos += len;
+		}
+	}
+	ASSERT3U(pos, ==, 1U << log);
+	dc->dc_huf_log = log;
+	dc->dc_huf_valid = B_TRUE;
+	return (size);
+}
+
+static int
+zstd_huf_decode_stream(const zstd_dctx_t *dc, uint8_t *dst, size_t dstlen,
+    const uint8_t *src, size_t srclen)
+{
+	const zstd_huf_dentry_t *dt = dc->dc_huf;
+	uint_t log = dc->dc_huf_log;
+	zstd_bitr_t br;
+
+	if (zstd_bitr_init(&br, src, srclen) != 0)
+		return (-1);
+	for (size_t i = 0; i < dstlen; i++) {
+		const zstd_huf_dentry_t *e = &dt[zstd_bitr_peek(&br, log)];
+		dst[i] = e->hd_symbol;
+		br.br_pos -= e->hd_nbbits;
+	}
+	return (br.br_pos == 0 ? 0 : -1);
+}
+
+/*
+ * Decode the literals section of a compressed block.  On success the
+ * literals are left at *litp and the size of the section is returned.
+ */
+static int
+zstd_decode_literals(zstd_dctx_t *dc, const uint8_t *src, size_t srclen,
+    const uint8_t **litp, size_t *nlitp)
+{
+	uint_t type, sf;
+	size_t regen, csize, hsize;
+	boolean_t four;
+
+	if (srclen < 1)
+		return (-1);
+	type = src[0] & 3;
+	sf = (src[0] >> 2) & 3;
+
+	if (type == ZSTD_LIT_RAW || type == ZSTD_LIT_RLE) {
+		switch (sf) {
+		case 0:
+		case 2:
+			hsize = 1;
+			regen = src[0] >> 3;
+			break;
+		case 1:
+			hsize = 2;
+			if (srclen < hsize)
+				return (-1);
+			regen = zstd_read_le16(src) >> 4;
+			break;
+		default:
+			hsize = 3;
+			if (srclen < hsize)
+				return (-1);
+			regen = zstd_read_le24(src) >> 4;
+			break;
+		}
+		if (regen > ZSTD_BLOCKSIZE_MAX)
+			return (-1);
+		*nlitp = regen;
+		if (type == ZSTD_LIT_RAW) {
+			if (hsize + regen > srclen)
+				return (-1);
+			*litp = src + hsize;
+			return (hsize + regen);
+		}
+		if (hsize + 1 > srclen)
+			return (-1);
+		memset(dc->dc_lit, src[hsize], regen);
+		*litp = dc->dc_lit;
+		return (hsize + 1);
+	}
+
+	switch (sf) {
+	case 0:
+	case 1:
+		hsize = 3;
+		if (srclen < hsize)
+			return (-1);
+		regen = (zstd_read_le24(src) >> 4) & 0x3ff;
+		csize = (zstd_read_le24(src) >> 14) & 0x3ff;
+		four = (sf == 1);
+		break;
+	case 2:
+		hsize = 4;
+		if (srclen < hsize)
+			return (-1);
+		regen = (zstd_read_le32(src) >> 4) & 0x3fff;
+		csize = zstd_read_le32(src) >> 18;
+		four = B_TRUE;
+		break;
+	default:
+		hsize = 5;
+		if (srclen < hsize)
+			return (-1);
+		regen = (zstd_read_le32(src) >> 4) & 0x3ffff;
+		csize = (zstd_read_le32(src) >> 22) |
+		    ((size_t)src[4] << 10);
+		four = B_TRUE;
+		break;
+	}
+	if (regen > ZSTD_BLOCKSIZE_MAX || hsize + csize > srclen)
+		return (-1);
+
+	const uint8_t *ip = src + hsize;
+	size_t left = csize;
+
+	if (type == ZSTD_LIT_COMPRESSED) {
+		int tsize = zstd_huf_read_table(dc, ip, left);
+		if (tsize < 0)
+			return (-1);
+		ip += tsize;
+		left -= tsize;
+	} else if (!dc->dc_huf_valid) {
+		return (-1);
+	}
+
+	if (!four) {
+		if (zstd_huf_decode_stream(dc, dc->dc_lit, regen,
+		    ip, left) != 0)
+			return (-1);
+	} else {
+		size_t seg = (regen + 3) / 4;
+		size_t ssize[4];
+
+		if (left < 6 || regen < 3 * seg)
+			return (-1);
+		ssize[0] = zstd_read_le16(ip);
+		ssize[1] = zstd_read_le16(ip + 2);
+		ssize[2] = zstd_read_le16(ip + 4);
+		ip += 6;
+		left -= 6;
+		if (ssize[0] + ssize[1] + ssize[2] > left)
+			return (-1);
+		ssize[3] = left - ssize[0] - ssize[1] - ssize[2];
+
+		for (int i = 0; i < 4; i++) {
+			size_t n = (i < 3) ? seg : regen - 3 * seg;
+			if (zstd_huf_decode_stream(dc, dc->dc_lit + i * seg,
+			    n, ip, ssize[i]) != 0)
+				return (-1);
+			ip += ssize[i];
+		}
+	}
+
+	*litp = dc->dc_lit;
+	*nlitp = regen;
+	return (hsize + csize);
+}
+
+/*
+ * Set up the decoding table of one sequence stream.  Returns the number of
+ * bytes of table description consumed, or -1 on error.
+ */
+static int
+zstd_decode_seq_table(zstd_dctx_t *dc, int which, uint_t mode,
+    const uint8_t *src, size_t srclen)
+{
+	const zstd_seqdesc_t *sd = &zstd_seqdesc[which];
+	zstd_fse_dentry_t *dt = dc->dc_fse[which];
+	uint_t maxsv, log;
+	int size;
+
+	switch (mode) {
+	case ZSTD_MODE_PREDEFINED:
+		if (zstd_fse_build_dtable(dt, dc->dc_symbols, sd->sd_defnorm,
+		    sd->sd_defmaxsv, sd->sd_deflog) != 0)
+			return (-1);
+		dc->dc_fse_log[which] = sd->sd_deflog;
+		size = 0;
+		break;
+	case ZSTD_MODE_RLE:
+		if (srclen < 1 || src[0] > sd->sd_maxsv)
+			return (-1);
+		zstd_fse_build_dtable_rle(dt, src[0]);
+		dc->dc_fse_log[which] = 0;
+		size = 1;
+		break;
+	case ZSTD_MODE_FSE:
+		maxsv = sd->sd_maxsv;
+		size = zstd_fse_read_ncount(dc->dc_norm, &maxsv, &log,
+		    sd->sd_maxlog, src, srclen);
+		if (size < 0 || zstd_fse_build_dtable(dt, dc->dc_symbols,
+		    dc->dc_norm, maxsv, log) != 0)
+			return (-1);
+		dc->dc_fse_log[which] = log;
+		break;
+	default:
+		if (!dc->dc_fse_valid[which])
+			return (-1);
+		return (0);
+	}
+	dc->dc_fse_valid[which] = B_TRUE;
+	return (size);
+}
+
+/*
+ * Decode one compressed block into op, which has room up to oend.  ostart
+ * is the beginning of the frame's output, the limit for match offsets.
+ * Returns the number of bytes produced, or -1 on error.
+ */
+static int64_t
+zstd_decode_block(zstd_dctx_t *dc, const uint8_t *src, size_t srclen,
+    uint8_t *ostart, uint8_t *op, uint8_t *oend)
+{
+	uint8_t *const obase = op;
+	const uint8_t *lit, *litend;
+	size_t nlit, nseq;
+	const uint8_t *ip, *iend = src + srclen;
+	int size;
+
+	size = zstd_decode_literals(dc, src, srclen, &lit, &nlit);
+	if (size < 0)
+		return (-1);
+	litend = lit + nlit;
+	ip = src + size;
+
+	if (ip >= iend)
+		return (-1);
+	nseq = *ip++;
+	if (nseq >= 128) {
+		if (nseq == 255) {
+			if (ip + 2 > iend)
+				return (-1);
+			nseq = zstd_read_le16(ip) + 0x7F00;
+			ip += 2;
+		} else {
+			if (ip + 1 > iend)
+				return (-1);
+			nseq = ((nseq - 128) << 8) + *ip++;
+		}
+	}
+
+	if (nseq != 0) {
+		uint_t modes, mode[3];
+		uint32_t st[3];
+		zstd_bitr_t br;
+
+		if (ip >= iend)
+			return (-1);
+		modes = *ip++;
+		if ((modes & 3) != 0)
+			return (-1);
+		mode[ZSTD_LL] = modes >> 6;
+		mode[ZSTD_OF] = (modes >> 4) & 3;
+		mode[ZSTD_ML] = (modes >> 2) & 3;
+		for (int i = 0; i < 3; i++) {
+			size = zstd_decode_seq_table(dc, i, mode[i], ip,
+			    iend - ip);
+			if (size < 0)
+				return (-1);
+			ip += size;
+		}
+
+		if (zstd_bitr_init(&br, ip, iend - ip) != 0)
+			return (-1);
+		st[ZSTD_LL] = zstd_bitr_read(&br, dc->dc_fse_log[ZSTD_LL]);
+		st[ZSTD_OF] = zstd_bitr_read(&br, dc->dc_fse_log[ZSTD_OF]);
+		st[ZSTD_ML] = zstd_bitr_read(&br, dc->dc_fse_log[ZSTD_ML]);
+
+		for (size_t n = 0; n < nseq; n++) {
+			const zstd_fse_dentry_t *ll = &dc->dc_fse[ZSTD_LL][
+			    st[ZSTD_LL]];
+			const zstd_fse_dentry_t *of = &dc->dc_fse[ZSTD_OF][
+			    st[ZSTD_OF]];
+			const zstd_fse_dentry_t *ml = &dc->dc_fse[ZSTD_ML][
+			    st[ZSTD_ML]];
+			uint32_t ov, mlen, llen, off;
+
+			if (of->fd_symbol > ZSTD_OF_MAXSV)
+				return (-1);
+			ov = (1U << of->fd_symbol) +
+			    zstd_bitr_read(&br, of->fd_symbol);
+			mlen = zstd_ml_base[ml->fd_symbol] +
+			    zstd_bitr_read(&br, zstd_ml_bits[ml->fd_symbol]);
+			llen = zstd_ll_base[ll->fd_symbol] +
+			    zstd_bitr_read(&br, zstd_ll_bits[ll->fd_symbol]);
+
+			if (n + 1 < nseq) {
+				st[ZSTD_LL] = ll->fd_newstate +
+				    zstd_bitr_read(&br, ll->fd_nbbits);
+				st[ZSTD_ML] = ml->fd_newstate +
+				    zstd_bitr_read(&br, ml->fd_nbbits);
+				st[ZSTD_OF] = of->fd_newstate +
+				    zstd_bitr_read(&br, of->fd_nbbits);
+			}
+			if (br.br_pos < 0)
+				return (-1);
+
+			off = zstd_rep_update(dc->dc_rep, ov, llen);
+
+			if (llen > litend - lit || llen > oend - op)
+				return (-1);
+			memcpy(op, lit, llen);
+			op += llen;
+			lit += llen;
+
+			if (off == 0 || off > op - ostart || mlen > oend - op)
+				return (-1);
+			const uint8_t *match = op - off;
+			if (off >= mlen) {
+				memcpy(op, match, mlen);
+				op += mlen;
+			} else {
+				for (uint32_t i = 0; i < mlen; i++)
+					*op++ = *match++;
+			}
+		}
+		if (br.br_pos != 0)
+			return (-1);
+	} else if (ip != iend) {
+		return (-1);
+	}
+
+	if (litend - lit > oend - op)
+		return (-1);
+	memcpy(op, lit, litend - lit);
+	op += litend - lit;
+
+	if (op - obase > ZSTD_BLOCKSIZE_MAX)
+		return (-1);
+	return (op - obase);
+}
+
+/*
+ * Decompress a single frame.  Returns the number of bytes produced, or -1
+ * on error.
+ */
+static int64_t
+zstd_decompress_frame(zstd_dctx_t *dc, const uint8_t *src, size_t srclen,
+    uint8_t *dst, size_t dstlen)
+{
+	const uint8_t *ip = src, *iend = src + srclen;
+	uint8_t *op = dst, *oend = dst + dstlen;
+	uint_t fhd, fcs_flag, did_flag;
+	boolean_t single, checksum;
+	uint64_t fcs = 0;
+	boolean_t has_fcs;
+	static const uint8_t did_size[4] = { 0, 1, 2, 4 };
+	static const uint8_t fcs_size[4] = { 1, 2, 4, 8 };
+
+	if (srclen < ZSTD_FRAMEHDR_MIN || zstd_read_le32(ip) != ZSTD_MAGIC)
+		return (-1);
+	ip += 4;
+	fhd = *ip++;
+	fcs_flag = fhd >> 6;
+	single = (fhd >> 5) & 1;
+	checksum = (fhd >> 2) & 1;
+	did_flag = fhd & 3;
+	if (fhd & (1 << 3))
+		return (-1);
+
+	if (!single)
+		ip++;	/* window descriptor; the whole output is the window */
+
+	if (ip + did_size[did_flag] > iend)
+		return (-1);
+	for (uint_t i = 0; i < did_size[did_flag]; i++) {
+		/* Dictionaries are not supported. */
+		if (ip[i] != 0)
+			return (-1);
+	}
+	ip += did_size[did_flag];
+
+	has_fcs = (fcs_flag != 0 || single);
+	if (has_fcs) {
+		uint_t n = fcs_size[fcs_flag];
+		if (ip + n > iend)
+			return (-1);
+		for (uint_t i = 0; i < n; i++)
+			fcs |= (uint64_t)ip[i] << (8 * i);
+		if (n == 2)
+			fcs += 256;
+		ip += n;
+		if (fcs > dstlen)
+			return (-1);
+	}
+
+	dc->dc_huf_valid = B_FALSE;
+	dc->dc_fse_valid[0] = dc->dc_fse_valid[1] =
+	    dc->dc_fse_valid[2] = B_FALSE;
+	dc->dc_rep[0] = 1;
+	dc->dc_rep[1] = 4;
+	dc->dc_rep[2] = 8;
+
+	for (;;) {
+		uint32_t bh;
+		uint_t type;
+		size_t bsize;
+		boolean_t last;
+
+		if (ip + ZSTD_BLOCKHDR_SIZE > iend)
+			return (-1);
+		bh = zstd_read_le24(ip);
+		ip += ZSTD_BLOCKHDR_SIZE;
+		last = bh & 1;
+		type = (bh >> 1) & 3;
+		bsize = bh >> 3;
+		if (bsize > ZSTD_BLOCKSIZE_MAX)
+			return (-1);
+
+		switch (type) {
+		case ZSTD_BLOCK_RAW:
+			if (bsize > iend - ip || bsize > oend - op)
+				return (-1);
+			memcpy(op, ip, bsize);
+			ip += bsize;
+			op += bsize;
+			break;
+		case ZSTD_BLOCK_RLE:
+			if (ip + 1 > iend || bsize > oend - op)
+				return (-1);
+			memset(op, *ip, bsize);
+			ip++;
+			op += bsize;
+			break;
+		case ZSTD_BLOCK_COMPRESSED: {
+			int64_t n;
+
+			if (bsize > iend - ip)
+				return (-1);
+			n = zstd_decode_block(dc, ip, bsize, dst, op, oend);
+			if (n < 0)
+				return (-1);
+			ip += bsize;
+			op += n;
+			break;
+		}
+		default:
+			return (-1);
+		}
+		if (last)
+			break;
+	}
+
+	/* The content checksum is redundant with the block checksum. */
+	if (checksum && ip + 4 > iend)
+		return (-1);
+	if (has_fcs && op - dst != fcs)
+		return (-1);
+	return (op - dst);
+}
+
+/*
+ * ==========================================================================
+ * Entropy coding
+ * ==========================================================================
+ */
+
+static uint_t
+zstd_fse_optimal_log(uint_t maxlog, size_t nsrc, uint_t maxsv)
+{
+	uint_t minsrc = zstd_highbit(nsrc) + 1;
+	uint_t minsym = zstd_highbit(MAX(maxsv, 1)) + 2;
+	uint_t minbits = MIN(minsrc, minsym);
+	uint_t log = maxlog;
+
+	if (nsrc > 4 && zstd_highbit(nsrc - 1) - 2 < log)
+		log = zstd_highbit(nsrc - 1) - 2;
+	if (minbits > log)
+		log = minbits;
+	return (MAX(MIN(log, maxlog), ZSTD_FSE_MINLOG));
+}
+
+/*
+ * Scale a histogram to a distribution summing to 1 << log.  Every symbol
+ * that occurs keeps a probability of at least one state.
+ */
+static void
+zstd_fse_normalize(int16_t *norm, uint_t log, const uint32_t *count,
+    size_t total, uint_t maxsv)
+{
+	int32_t size = 1 << log, sum = 0;
+	uint_t largest = 0;
+
+	for (uint_t s = 0; s <= maxsv; s++) {
+		if (count[s] == 0) {
+			norm[s] = 0;
+			continue;
+		}
+		int32_t n = (int32_t)(((uint64_t)count[s] * size +
+		    total / 2) / total);
+		if (n < 1)
+			n = 1;
+		norm[s] = n;
+		sum += n;
+		if (n > norm[largest])
+			largest = s;
+	}
+	if (sum < size)
+		norm[largest] += size - sum;
+	while (sum > size) {
+		uint_t big = 0;
+		for (uint_t s = 1; s <= maxsv; s++) {
+			if (norm[s] > norm[big])
+				big = s;
+		}
+		ASSERT3S(norm[big], >, 1);
+		norm[big]--;
+		sum--;
+	}
+}
+
+/*
+ * Write a normalized distribution header.  Returns its size, or 0 if it
+ * did not fit in cap bytes.
+ */
+static size_t
+zstd_fse_write_ncount(uint8_t *dst, size_t cap, const int16_t *norm,
+    uint_t maxsv, uint_t log)
+{
+	uint8_t *op = dst, *oend = dst + cap;
+	int remaining = (1 << log) + 1;
+	int threshold = 1 << log;
+	int nbbits = log + 1;
+	uint64_t bits = log - ZSTD_FSE_MINLOG;
+	uint_t nb = 4, s = 0;
+	boolean_t prev0 = B_FALSE;
+
+#define	NCOUNT_FLUSH()						\
+	while (nb >= 8) {					\
+		if (op >= oend)					\
+			return (0);				\
+		*op++ = (uint8_t)bits;				\
+		bits >>= 8;					\
+		nb -= 8;					\
+	}
+
+	while (s <= maxsv && remaining > 1) {
+		if (prev0) {
+			uint_t start = s;
+
+			while (norm[s] == 0)
+				s++;
+			while (s >= start + 24) {
+				start += 24;
+				bits |= 0xFFFFULL << nb;
+				nb += 16;
+				NCOUNT_FLUSH();
+			}
+			while (s >= start + 3) {
+				start += 3;
+				bits |= 3ULL << nb;
+				nb += 2;
+			}
+			bits |= (uint64_t)(s - start) << nb;
+			nb += 2;
+			NCOUNT_FLUSH();
+		}
+
+		int count = norm[s++];
+		int max = (2 * threshold - 1) - remaining;
+
+		remaining -= (count < 0) ? -count : count;
+		count++;
+		if (count >= threshold)
+			count += max;
+		bits |= (uint64_t)count << nb;
+		nb += nbbits;
+		nb -= (count < max);
+		prev0 = (count == 1);
+		while (remaining < threshold) {
+			nbbits--;
+			threshold >>= 1;
+		}
+		NCOUNT_FLUSH();
+	}
+	if (nb > 0) {
+		if (op >= oend)
+			return (0);
+		*op++ = (uint8_t)bits;
+	}
+#undef	NCOUNT_FLUSH
+	ASSERT3S(remaining, ==, 1);
+	return (op - dst);
+}
+
+static void
+zstd_fse_build_ctable(zstd_fse_ctable_t *ct, uint8_t *symbols,
+    const int16_t *norm, uint_t maxsv, uint_t log)
+{
+	uint32_t size = 1U << log;
+	uint32_t cumul[ZSTD_ML_MAXSV + 2];
+	int32_t total = 0;
+
+	VERIFY0(zstd_fse_spread(symbols, norm, maxsv, log));
+
+	cumul[0] = 0;
+	for (uint_t s = 0; s <= maxsv; s++)
+		cumul[s + 1] = cumul[s] + ((norm[s] == -1) ? 1 : norm[s]);
+	for (uint32_t u = 0; u < size; u++)
+		ct->fc_state[cumul[symbols[u]]++] = size + u;
+
+	for (uint_t s = 0; s <= maxsv; s++) {
+		switch (norm[s]) {
+		case 0:
+			ct->fc_nbbits[s] = ((log + 1) << 16) - size;
+			ct->fc_findstate[s] = 0;
+			break;
+		case -1:
+		case 1:
+			ct->fc_nbbits[s] = (log << 16) - size;
+			ct->fc_findstate[s] = total - 1;
+			total++;
+			break;
+		default: {
+			uint_t maxout = log - zstd_highbit(norm[s] - 1);
+			uint32_t minstate = (uint32_t)norm[s] << maxout;
+
+			ct->fc_nbbits[s] = (maxout << 16) - minstate;
+			ct->fc_findstate[s] = total - norm[s];
+			total += norm[s];
+			break;
+		}
+		}
+	}
+	ct->fc_log = log;
+}
+
+static inline uint32_t
+zstd_fse_init_state(const zstd_fse_ctable_t *ct, uint_t s)
+{
+	uint32_t nbout = (ct->fc_nbbits[s] + (1 << 15)) >> 16;
+	uint32_t v = (nbout << 16) - ct->fc_nbbits[s];
+
+	return (ct->fc_state[(v >> nbout) + ct->fc_findstate[s]]);
+}
+
+static inline void
+zstd_fse_encode(zstd_bitw_t *bw, const zstd_fse_ctable_t *ct,
+    uint32_t *state, uint_t s)
+{
+	uint32_t nbout = (*state + ct->fc_nbbits[s]) >> 16;
+
+	zstd_bitw_add(bw, *state, nbout);
+	*state = ct->fc_state[(*state >> nbout) + ct->fc_findstate[s]];
+}
+
+/* Approximate log2(x) in 1/256ths of a bit. */
+static uint32_t
+zstd_log2_frac(uint32_t x)
+{
+	uint_t hb = zstd_highbit(x);
+
+	return ((hb << 8) + ((((uint64_t)x << 8) >> hb) & 0xff));
+}
+
+/* Estimated cost, in 1/256ths of a bit, of coding a histogram. */
+static uint64_t
+zstd_fse_cost(const uint32_t *count, uint_t maxsv, const int16_t *norm,
+    uint_t normmax, uint_t log)
+{
+	uint64_t cost = 0;
+
+	for (uint_t s = 0; s <= maxsv; s++) {
+		if (count[s] == 0)
+			continue;
+		if (s > normmax || norm[s] == 0)
+			return (UINT64_MAX);
+		uint32_t n = (norm[s] == -1) ? 1 : norm[s];
+		cost += (uint64_t)count[s] *
+		    ((log << 8) - zstd_log2_frac(n));
+	}
+	return (cost);
+}
+
+/*
+ * Compute Huffman code lengths for a histogram, limited to
+ * ZSTD_HUF_MAXBITS.  Returns the table log (longest code length).
+ */
+static uint_t
+zstd_huf_build(zstd_cctx_t *cc, uint32_t *count, uint_t maxsv)
+{
+	uint32_t *node = cc->cc_huf_node;
+	uint16_t *parent = cc->cc_huf_parent;
+	uint8_t *sym = cc->cc_huf_sym;
+	uint8_t *nbbits = cc->cc_huf_nbbits;
+	uint_t n = 0, maxbits;
+
+	for (uint_t s = 0; s <= maxsv; s++) {
+		if (count[s] == 0)
+			continue;
+		/* Insertion sort by increasing count. */
+		uint_t i = n++;
+		while (i > 0 && count[sym[i - 1]] > count[s]) {
+			sym[i] = sym[i - 1];
+			i--;
+		}
+		sym[i] = s;
+	}
+	ASSERT3U(n, >=, 2);
+
+	for (;;) {
+		uint_t leaf = 0, inner = n, next = n;
+
+		for (uint_t i = 0; i < n; i++)
+			node[i] = count[sym[i]];
+
+		/*
+		 * Two-queue construction: leaves are sorted, and internal
+		 * nodes are created in non-decreasing weight order.
+		 */
+		while (next < 2 * n - 1) {
+			uint_t pick[2];
+			for (int k = 0; k < 2; k++) {
+				if (leaf < n && (inner >= next ||
+				    node[leaf] <= node[inner]))
+					pick[k] = leaf++;
+				else
+					pick[k] = inner++;
+			}
+			node[next] = node[pick[0]] + node[pick[1]];
+			parent[pick[0]] = parent[pick[1]] = next;
+			next++;
+		}
+
+		/* Depths, from the root down. */
+		node[2 * n - 2] = 0;
+		maxbits = 0;
+		for (int i = 2 * n - 3; i >= 0; i--) {
+			node[i] = node[parent[i]] + 1;
+			if (i < n && node[i] > maxbits)
+				maxbits = node[i];
+		}
+		if (maxbits <= ZSTD_HUF_MAXBITS)
+			break;
+
+		/* Flatten the distribution and try again. */
+		for (uint_t i = 0; i < n; i++)
+			count[sym[i]] = (count[sym[i]] >> 1) | 1;
+	}
+
+	memset(nbbits, 0, maxsv + 1);
+	for (uint_t i = 0; i < n; i++)
+		nbbits[sym[i]] = node[i];
+	return (maxbits);
+}
+
+/*
+ * Write the Huffman tree description for the current code lengths.
+ * Returns its size, or 0 if it could not be represented in cap bytes.
+ */
+static size_t
+zstd_huf_write_table(zstd_cctx_t *cc, uint8_t *dst, size_t cap,
+    uint_t maxsv, uint_t log)
+{
+	uint8_t *w = cc->cc_weights;
+	size_t best = 0;
+
+	for (uint_t s = 0; s <= maxsv; s++) {
+		w[s] = (cc->cc_huf_nbbits[s] == 0) ? 0 :
+		    log + 1 - cc->cc_huf_nbbits[s];
+	}
+
+	/* FSE compressed weights, for all maxsv leading symbols. */
+	if (maxsv >= 2 && cap > 1) {
+		uint32_t count[ZSTD_HUF_MAXBITS + 1] = { 0 };
+		uint_t wmax = 0, flog;
+		zstd_fse_ctable_t *ct = &cc->cc_ct[0];
+		zstd_bitw_t bw;
+		uint32_t st1, st2;
+		size_t hsize, ssize;
+		int i = maxsv;
+		boolean_t single = B_FALSE;
+
+		for (uint_t s = 0; s < maxsv; s++) {
+			count[w[s]]++;
+			if (w[s] > wmax)
+				wmax = w[s];
+			if (count[w[s]] == maxsv)
+				single = B_TRUE;
+		}
+		flog = zstd_fse_optimal_log(ZSTD_HUFW_MAXLOG, maxsv, wmax);
+		if (!single && wmax > 0) {
+			zstd_fse_normalize(cc->cc_norm, flog, count, maxsv,
+			    wmax);
+			hsize = zstd_fse_write_ncount(dst + 1, MIN(cap - 1,
+			    127), cc->cc_norm, wmax, flog);
+		} else {
+			hsize = 0;
+		}
+		if (hsize != 0) {
+			zstd_fse_build_ctable(ct, cc->cc_symbols, cc->cc_norm,
+			    wmax, flog);
+			zstd_bitw_init(&bw, dst + 1 + hsize,
+			    MIN(cap - 1, 127) - hsize);
+			if (i & 1) {
+				st1 = zstd_fse_init_state(ct, w[--i]);
+				st2 = zstd_fse_init_state(ct, w[--i]);
+				zstd_fse_encode(&bw, ct, &st1, w[--i]);
+			} else {
+				st2 = zstd_fse_init_state(ct, w[--i]);
+				st1 = zstd_fse_init_state(ct, w[--i]);
+			}
+			while (i > 0) {
+				zstd_fse_encode(&bw, ct, &st2, w[--i]);
+				zstd_fse_encode(&bw, ct, &st1, w[--i]);
+			}
+			zstd_bitw_add(&bw, st2, flog);
+			zstd_bitw_add(&bw, st1, flog);
+			ssize = zstd_bitw_close(&bw);
+
+			/*
+			 * The end of an FSE weight stream is implicit, so make
+			 * sure the decoder will find exactly our weights.
+			 */
+			if (ssize != 0 && hsize + ssize < 128) {
+				dst[0] = hsize + ssize;
+				if (zstd_huf_decode_fse_weights(cc->cc_norm,
+				    cc->cc_symbols, cc->cc_vweights, dst + 1,
+				    hsize + ssize) == (int)maxsv &&
+				    memcmp(cc->cc_vweights, w, maxsv) == 0)
+					best = 1 + hsize + ssize;
+			}
+		}
+	}
+
+	/* Direct 4-bit weights. */
+	if (maxsv <= 128) {
+		size_t dsize = 1 + (maxsv + 1) / 2;
+
+		if (dsize <= cap && (best == 0 || dsize < best)) {
+			dst[0] = 127 + maxsv;
+			for (uint_t s = 0; s < maxsv; s += 2) {
+				dst[1 + s / 2] = (w[s] << 4) |
+				    ((s + 1 < maxsv) ? w[s + 1] : 0);
+			}
+			best = dsize;
+		}
+	}
+	return (best);
+}
+
+static size_t
+zstd_huf_encode_stream(const zstd_cctx_t *cc, uint8_t *dst, size_t cap,
+    const uint8_t *src, size_t len)
+{
+	zstd_bitw_t bw;
+
+	zstd_bitw_init(&bw, dst, cap);
+	for (size_t i = len; i > 0; i--) {
+		uint8_t s = src[i - 1];
+		zstd_bitw_add(&bw, cc->cc_huf_code[s], cc->cc_huf_nbbits[s]);
+	}
+	return (zstd_bitw_close(&bw));
+}
+
+static size_t
+zstd_lit_header_raw(uint8_t *dst, uint_t type, size_t n)
+{
+	if (n < 32) {
+		dst[0] = type | (n << 3);
+		return (1);
+	} else if (n < 4096) {
+		zstd_write_le(dst, type | (1 << 2) | (n << 4), 2);
+		return (2);
+	}
+	zstd_write_le(dst, type | (3 << 2) | (n << 4), 3);
+	return (3);
+}
+
+/*
+ * Write the literals section of a block.  Returns its size, or 0 if it
+ * does not fit.
+ */
+static size_t
+zstd_encode_literals(zstd_cctx_t *cc, uint8_t *dst, size_t cap)
+{
+	const uint8_t *lit = cc->cc_lit;
+	size_t nlit = cc->cc_nlit;
+	uint32_t *count = cc->cc_count;
+	uint_t maxsv = 0, log;
+	size_t hsize, tsize, csize;
+	uint8_t *op;
+
+	if (cap < 5 + 1)
+		return (0);
+
+	memset(count, 0, sizeof (cc->cc_count));
+	for (size_t i = 0; i < nlit; i++)
+		count[lit[i]]++;
+	for (uint_t s = 0; s <= ZSTD_HUF_MAXSV; s++) {
+		if (count[s] != 0)
+			maxsv = s;
+	}
+
+	if (nlit > 0 && count[lit[0]] == nlit) {
+		hsize = zstd_lit_header_raw(dst, ZSTD_LIT_RLE, nlit);
+		dst[hsize] = lit[0];
+		return (hsize + 1);
+	}
+
+	if (nlit >= 64) {
+		log = zstd_huf_build(cc, count, maxsv);
+
+		/* Canonical codes, assigned by increasing weight. */
+		uint32_t pos = 0;
+		for (uint_t w = 1; w <= log; w++) {
+			uint_t bits = log + 1 - w;
+			for (uint_t s = 0; s <= maxsv; s++) {
+				if (cc->cc_huf_nbbits[s] != bits)
+					continue;
+				cc->cc_huf_code[s] = pos >> (w - 1);
+				pos += 1U << (w - 1);
+			}
+		}
+		ASSERT3U(pos, ==, 1U << log);
+
+		boolean_t four = (nlit > 1023);
+		hsize = (nlit < 1024) ? 3 : (nlit < 16384) ? 4 : 5;
+		op = dst + hsize;
+		tsize = zstd_huf_write_table(cc, op, MIN(cap - hsize, nlit),
+		    maxsv, log);
+		if (tsize == 0)
+			goto raw;
+		op += tsize;
+
+		size_t limit = MIN(cap, nlit + hsize);
+		if (!four) {
+			csize = zstd_huf_encode_stream(cc, op,
+			    limit - (op - dst), lit, nlit);
+			if (csize == 0)
+				goto raw;
+			op += csize;
+		} else {
+			size_t seg = (nlit + 3) / 4;
+			uint8_t *jump = op;
+
+			if (limit < (op - dst) + 6)
+				goto raw;
+			op += 6;
+			for (int i = 0; i < 4; i++) {
+				size_t n = (i < 3) ? seg : nlit - 3 * seg;
+				csize = zstd_huf_encode_stream(cc, op,
+				    limit - (op - dst), lit + i * seg, n);
+				if (csize == 0 || csize > UINT16_MAX)
+					goto raw;
+				if (i < 3)
+					zstd_write_le(jump + 2 * i, csize, 2);
+				op += csize;
+			}
+		}
+
+		csize = op - dst - hsize;
+		if (hsize == 3 && csize >= 1024)
+			goto raw;
+		if (hsize == 4 && csize >= 16384)
+			goto raw;
+		/*
+		 * Both sizes share the header: 10 bits each in 3 bytes, 14 in
+		 * 4 bytes and 18 in 5 bytes.
+		 */
+		uint_t sf = four ? hsize - 2 : 0;
+		uint_t sizebits = hsize * 4 - 2;
+		zstd_write_le(dst, ZSTD_LIT_COMPRESSED | (sf << 2) |
+		    ((uint64_t)nlit << 4) | ((uint64_t)csize << (4 + sizebits)),
+		    hsize);
+		return (op - dst);
+	}
+
+raw:
+	hsize = zstd_lit_header_raw(dst, ZSTD_LIT_RAW, nlit);
+	if (hsize + nlit > cap)
+		return (0);
+	memcpy(dst + hsize, lit, nlit);
+	return (hsize + nlit);
+}
+
+static inline uint_t
+zstd_ll_code(uint32_t ll)
+{
+	static const uint8_t code[64] = {
+		0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+		16, 16, 17, 17, 18, 18, 19, 19, 20, 20, 20, 20, 21, 21, 21, 21,
+		22, 22, 22, 22, 22, 22, 22, 22, 23, 23, 23, 23, 23, 23, 23, 23,
+		24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24
+	};
+
+	return ((ll > 63) ? zstd_highbit(ll) + 19 : code[ll]);
+}
+
+static inline uint_t
+zstd_ml_code(uint32_t ml)
+{
+	static const uint8_t code[128] = {
+		0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+		16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31,
+		32, 32, 33, 33, 34, 34, 35, 35, 36, 36, 36, 36, 37, 37, 37, 37,
+		38, 38, 38, 38, 38, 38, 38, 38, 39, 39, 39, 39, 39, 39, 39, 39,
+		40, 40, 40, 40, 40, 40, 40, 40, 40, 40, 40, 40, 40, 40, 40, 40,
+		41, 41, 41, 41, 41, 41, 41, 41, 41, 41, 41, 41, 41, 41, 41, 41,
+		42, 42, 42, 42, 42, 42, 42, 42, 42, 42, 42, 42, 42, 42, 42, 42,
+		42, 42, 42, 42, 42, 42, 42, 42, 42, 42, 42, 42, 42, 42, 42, 42
+	};
+	uint32_t mlbase = ml - 3;
+
+	return ((mlbase > 127) ? zstd_highbit(mlbase) + 36 : code[mlbase]);
+}
+
+/*
+ * The decoder reads the initial states as LL, OF, ML and updates them as
+ * LL, ML, OF after each sequence, so the encoder goes the other way round.
+ */
+static const int zstd_enc_order[3] = { ZSTD_OF, ZSTD_ML, ZSTD_LL };
+static const int zstd_flush_order[3] = { ZSTD_ML, ZSTD_OF, ZSTD_LL };
+
+/*
+ * Write the sequences section of a block.  Returns its size, or 0 if it
+ * does not fit.
+ */
+static size_t
+zstd_encode_sequences(zstd_cctx_t *cc, uint8_t *dst, size_t cap)
+{
+	size_t nseq = cc->cc_nseq;
+	uint8_t *op = dst, *oend = dst + cap;
+	uint_t mode[3];
+	uint32_t st[3];
+	zstd_bitw_t bw;
+	size_t size;
+
+	if (cap < 4)
+		return (0);
+	if (nseq < 128) {
+		*op++ = nseq;
+	} else if (nseq < 0x7F00) {
+		*op++ = (nseq >> 8) + 128;
+		*op++ = nseq & 0xff;
+	} else {
+		*op++ = 255;
+		zstd_write_le(op, nseq - 0x7F00, 2);
+		op += 2;
+	}
+	if (nseq == 0)
+		return (op - dst);
+
+	for (size_t n = 0; n < nseq; n++) {
+		cc->cc_code[ZSTD_LL][n] = zstd_ll_code(cc->cc_seq_ll[n]);
+		cc->cc_code[ZSTD_ML][n] = zstd_ml_code(cc->cc_seq_ml[n]);
+		cc->cc_code[ZSTD_OF][n] = zstd_highbit(cc->cc_seq_ov[n]);
+	}
+
+	uint8_t *modep = op++;
+	for (int i = 0; i < 3; i++) {
+		const zstd_seqdesc_t *sd = &zstd_seqdesc[i];
+		uint32_t *count = cc->cc_count;
+		uint_t maxsv = 0, log;
+		uint64_t defcost, cost;
+
+		memset(count, 0, (sd->sd_maxsv + 1) * sizeof (uint32_t));
+		for (size_t n = 0; n < nseq; n++)
+			count[cc->cc_code[i][n]]++;
+		for (uint_t s = 0; s <= sd->sd_maxsv; s++) {
+			if (count[s] != 0)
+				maxsv = s;
+		}
+
+		if (count[maxsv] == nseq) {
+			if (op >= oend)
+				return (0);
+			*op++ = maxsv;
+			mode[i] = ZSTD_MODE_RLE;
+			continue;
+		}
+
+		defcost = zstd_fse_cost(count, maxsv, sd->sd_defnorm,
+		    sd->sd_defmaxsv, sd->sd_deflog);
+		log = zstd_fse_optimal_log(sd->sd_maxlog, nseq, maxsv);
+		zstd_fse_normalize(cc->cc_norm, log, count, nseq, maxsv);
+		cost = zstd_fse_cost(count, maxsv, cc->cc_norm, maxsv, log);
+
+		if ((nseq > 8 || defcost == UINT64_MAX) && cost < defcost) {
+			size = zstd_fse_write_ncount(op, oend - op,
+			    cc->cc_norm, maxsv, log);
+			if (size == 0)
+				return (0);
+			if (defcost == UINT64_MAX ||
+			    cost + (size << 11) < defcost) {
+				op += size;
+				zstd_fse_build_ctable(&cc->cc_ct[i],
+				    cc->cc_symbols, cc->cc_norm, maxsv, log);
+				mode[i] = ZSTD_MODE_FSE;
+				continue;
+			}
+		}
+		if (defcost == UINT64_MAX)
+			return (0);
+		zstd_fse_build_ctable(&cc->cc_ct[i], cc->cc_symbols,
+		    sd->sd_defnorm, sd->sd_defmaxsv, sd->sd_deflog);
+		mode[i] = ZSTD_MODE_PREDEFINED;
+	}
+	*modep = (mode[ZSTD_LL] << 6) | (mode[ZSTD_OF] << 4) |
+	    (mode[ZSTD_ML] << 2);
+
+	/*
+	 * Sequences are coded last to first, so that the decoder sees them
+	 * in order.  Streams in RLE mode carry no state bits.
+	 */
+	zstd_bitw_init(&bw, op, oend - op);
+	for (size_t n = nseq; n > 0; n--) {
+		size_t k = n - 1;
+		uint_t llc = cc->cc_code[ZSTD_LL][k];
+		uint_t mlc = cc->cc_code[ZSTD_ML][k];
+		uint_t ofc = cc->cc_code[ZSTD_OF][k];
+
+		/* State updates in the reverse of the decoder's order. */
+		for (int j = 0; j < 3; j++) {
+			int i = zstd_enc_order[j];
+			const zstd_fse_ctable_t *ct = &cc->cc_ct[i];
+			uint_t code = cc->cc_code[i][k];
+
+			if (mode[i] == ZSTD_MODE_RLE)
+				continue;
+			if (k == nseq - 1)
+				st[i] = zstd_fse_init_state(ct, code);
+			else
+				zstd_fse_encode(&bw, ct, &st[i], code);
+		}
+		zstd_bitw_add(&bw, cc->cc_seq_ll[k] - zstd_ll_base[llc],
+		    zstd_ll_bits[llc]);
+		zstd_bitw_add(&bw, cc->cc_seq_ml[k] - zstd_ml_base[mlc],
+		    zstd_ml_bits[mlc]);
+		zstd_bitw_add(&bw, cc->cc_seq_ov[k], ofc);
+	}
+	for (int j = 0; j < 3; j++) {
+		int i = zstd_flush_order[j];
+
+		if (mode[i] != ZSTD_MODE_RLE)
+			zstd_bitw_add(&bw, st[i], cc->cc_ct[i].fc_log);
+	}
+	size = zstd_bitw_close(&bw);
+	if (size == 0)
+		return (0);
+	return (op - dst + size);
+}
+
+/*
+ * ==========================================================================
+ * Match finding
+ * ==========================================================================
+ */
+
+static inline uint32_t
+zstd_hash(const uint8_t *p, uint_t log)
+{
+	return ((zstd_read32(p) * 2654435761U) >> (32 - log));
+}
+
+static inline void
+zstd_store_seq(zstd_cctx_t *cc, const uint8_t *anchor, size_t ll,
+    uint32_t off, size_t ml)
+{
+	uint32_t *rep = cc->cc_rep;
+	uint32_t ov;
+
+	ASSERT3U(cc->cc_nseq, <, ZSTD_SEQ_MAX);
+	memcpy(cc->cc_lit + cc->cc_nlit, anchor, ll);
+	cc->cc_nlit += ll;
+
+	if (ll != 0) {
+		ov = (off == rep[0]) ? 1 : (off == rep[1]) ? 2 :
+		    (off == rep[2]) ? 3 : off + 3;
+	} else {
+		ov = (off == rep[1]) ? 1 : (off == rep[2]) ? 2 :
+		    (off == rep[0] - 1) ? 3 : off + 3;
+	}
+	VERIFY3U(zstd_rep_update(rep, ov, ll), ==, off);
+
+	cc->cc_seq_ll[cc->cc_nseq] = ll;
+	cc->cc_seq_ml[cc->cc_nseq] = ml;
+	cc->cc_seq_ov[cc->cc_nseq] = ov;
+	cc->cc_nseq++;
+}
+
+/*
+ * Greedy single hash table parser for the fastest levels.
+ */
+static void
+zstd_parse_fast(zstd_cctx_t *cc, const zstd_params_t *zp,
+    const uint8_t *base, const uint8_t *istart, const uint8_t *iend)
+{
+	const uint8_t *ip = istart, *anchor = istart;
+	const uint8_t *ilimit = iend - 8;
+	uint_t hlog = cc->cc_hashlog;
+	uint32_t *htab = cc->cc_htab;
+
+	if (ip == base)
+		ip++;
+
+	while (ip < ilimit) {
+		uint32_t h = zstd_hash(ip, hlog);
+		uint32_t cur = ip - base;
+		uint32_t cand = htab[h];
+		uint32_t rep0 = cc->cc_rep[0];
+		size_t ml;
+		uint32_t off;
+
+		htab[h] = cur;
+
+		if (ip > anchor && rep0 <= cur &&
+		    zstd_read32(ip) == zstd_read32(ip - rep0)) {
+			off = rep0;
+			ml = zstd_count(ip + 4, ip + 4 - rep0, iend) + 4;
+		} else if (cand < cur &&
+		    zstd_read32(base + cand) == zstd_read32(ip)) {
+			const uint8_t *match = base + cand;
+
+			off = cur - cand;
+			ml = zstd_count(ip + 4, match + 4, iend) + 4;
+			while (ip > anchor && match > base &&
+			    ip[-1] == match[-1]) {
+				ip--;
+				match--;
+				ml++;
+			}
+		} else {
+			ip += 1 + ((ip - anchor) >> 6) + (zp->zp_accel - 1);
+			continue;
+		}
+
+		zstd_store_seq(cc, anchor, ip - anchor, off, ml);
+		ip += ml;
+		anchor = ip;
+		if (ip < ilimit)
+			htab[zstd_hash(ip - 2, hlog)] = ip - 2 - base;
+	}
+
+	memcpy(cc->cc_lit + cc->cc_nlit, anchor, iend - anchor);
+	cc->cc_nlit += iend - anchor;
+}
+
+/*
+ * Insert all positions up to ip into the hash chains.
+ */
+static inline void
+zstd_chain_insert(zstd_cctx_t *cc, const uint8_t *base, const uint8_t *ip)
+{
+	uint32_t target = ip - base;
+	uint32_t cmask = (1U << cc->cc_chainlog) - 1;
+	uint_t hlog = cc->cc_hashlog;
+
+	for (uint32_t idx = cc->cc_next; idx < target; idx++) {
+		uint32_t h = zstd_hash(base + idx, hlog);
+		cc->cc_chain[idx & cmask] = cc->cc_htab[h];
+		cc->cc_htab[h] = idx;
+	}
+	if (target > cc->cc_next)
+		cc->cc_next = target;
+}
+
+/*
+ * Find the longest match at ip among the chain candidates.  Returns the
+ * match length (0 if none) and sets *offp.
+ */
+static size_t
+zstd_chain_search(zstd_cctx_t *cc, const zstd_params_t *zp,
+    const uint8_t *base, const uint8_t *ip, const uint8_t *iend,
+    uint32_t *offp)
+{
+	uint32_t cur = ip - base;
+	uint32_t cmask = (1U << cc->cc_chainlog) - 1;
+	uint32_t low = (cur > cmask) ? cur - cmask : 0;
+	uint32_t cand, attempts = 1U << zp->zp_searchlog;
+	size_t best = 0;
+
+	zstd_chain_insert(cc, base, ip);
+	cand = cc->cc_htab[zstd_hash(ip, cc->cc_hashlog)];
+
+	while (attempts-- > 0 && cand >= low && cand < cur) {
+		const uint8_t *match = base + cand;
+
+		if (match[best] == ip[best] &&
+		    zstd_read32(match) == zstd_read32(ip)) {
+			size_t ml = zstd_count(ip + 4, match + 4, iend) + 4;
+			if (ml > best) {
+				best = ml;
+				*offp = cur - cand;
+				if (ml >= zp->zp_target || ip + ml == iend)
+					break;
+			}
+		}
+
+		uint32_t next = cc->cc_chain[cand & cmask];
+		if (next >= cand)
+			break;
+		cand = next;
+	}
+
+	return (best >= ZSTD_MINMATCH ? best : 0);
+}
+
+/* Rough cost, in bits, of coding a match offset. */
+static inline int
+zstd_off_cost(uint32_t off)
+{
+	return (zstd_highbit(off + 1));
+}
+
+/*
+ * Hash chain parser with optional one or two step lazy evaluation.
+ */
+static void
+zstd_parse_chain(zstd_cctx_t *cc, const zstd_params_t *zp,
+    const uint8_t *base, const uint8_t *istart, const uint8_t *iend)
+{
+	const uint8_t *ip = istart, *anchor = istart;
+	const uint8_t *ilimit = iend - 8;
+	uint_t depth = (zp->zp_strategy == ZSTD_STRAT_GREEDY) ? 0 :
+	    (zp->zp_strategy == ZSTD_STRAT_LAZY) ? 1 : 2;
+
+	if (ip == base)
+		ip++;
+
+	while (ip < ilimit) {
+		uint32_t off = 0, rep0 = cc->cc_rep[0];
+		size_t ml = 0;
+		const uint8_t *start = ip;
+
+		if (ip > anchor && rep0 <= (uint32_t)(ip - base) &&
+		    zstd_read32(ip) == zstd_read32(ip - rep0)) {
+			ml = zstd_count(ip + 4, ip + 4 - rep0, iend) + 4;
+			off = rep0;
+		}
+		{
+			uint32_t off2;
+			size_t ml2 = zstd_chain_search(cc, zp, base, ip, iend,
+			    &off2);
+			if (ml2 > ml) {
+				ml = ml2;
+				off = off2;
+			}
+		}
+		if (ml == 0) {
+			ip += 1 + ((ip - anchor) >> 8);
+			continue;
+		}
+
+		/* Look for a better match starting a little later. */
+		for (uint_t d = 0; d < depth && ip < ilimit; ) {
+			uint32_t off2;
+			size_t ml2;
+			int gain1, gain2;
+
+			ip++;
+			d++;
+			ml2 = zstd_chain_search(cc, zp, base, ip, iend, &off2);
+			gain1 = ml * 4 - zstd_off_cost(off) + 4 + 3 * d;
+			gain2 = ml2 * 4 - zstd_off_cost(off2);
+			if (ml2 != 0 && gain2 > gain1) {
+				ml = ml2;
+				off = off2;
+				start = ip;
+				d = 0;
+			}
+		}
+
+		/* Extend the match backwards into the pending literals. */
+		if (off != rep0) {
+			while (start > anchor && start - off > base &&
+			    start[-1] == (start - off)[-1]) {
+				start--;
+				ml++;
+			}
+		}
+
+		zstd_store_seq(cc, anchor, start - anchor, off, ml);
+		ip = anchor = start + ml;
+	}
+
+	memcpy(cc->cc_lit + cc->cc_nlit, anchor, iend - anchor);
+	cc->cc_nlit += iend - anchor;
+}
+
+/*
+ * ==========================================================================
+ * Compression
+ * ==========================================================================
+ */
+
+static size_t
+zstd_compress_frame(zstd_cctx_t *cc, const zstd_params_t *zp,
+    const uint8_t *src, size_t srclen, uint8_t *dst, size_t dstcap)
+{
+	uint8_t *op = dst, *oend = dst + dstcap;
+	uint_t srclog;
+
+	if (dstcap < ZSTD_FRAMEHDR_MIN + 4 + ZSTD_BLOCKHDR_SIZE)
+		return (0);
+
+	zstd_write_le(op, ZSTD_MAGIC, 4);
+	op += 4;
+	if (srclen < 256) {
+		*op++ = 0x20;
+		*op++ = srclen;
+	} else if (srclen < 65536 + 256) {
+		*op++ = 0x60;
+		zstd_write_le(op, srclen - 256, 2);
+		op += 2;
+	} else {
+		*op++ = 0xA0;
+		zstd_write_le(op, srclen, 4);
+		op += 4;
+	}
+
+	srclog = zstd_highbit(MAX(srclen, 2) - 1) + 1;
+	cc->cc_hashlog = MAX(MIN(zp->zp_hashlog, srclog), 8);
+	cc->cc_chainlog = MAX(MIN(zp->zp_chainlog, srclog), 8);
+	memset(cc->cc_htab, 0, sizeof (uint32_t) << cc->cc_hashlog);
+	cc->cc_next = 0;
+	cc->cc_rep[0] = 1;
+	cc->cc_rep[1] = 4;
+	cc->cc_rep[2] = 8;
+
+	for (size_t pos = 0; pos < srclen; ) {
+		size_t bsize = MIN(srclen - pos, ZSTD_BLOCKSIZE_MAX);
+		boolean_t last = (pos + bsize == srclen);
+		uint8_t *bh = op;
+		uint32_t rep[3];
+		size_t lsize, ssize = 0;
+
+		if (oend - op < ZSTD_BLOCKHDR_SIZE)
+			return (0);
+		op += ZSTD_BLOCKHDR_SIZE;
+
+		memcpy(rep, cc->cc_rep, sizeof (rep));
+		cc->cc_nseq = 0;
+		cc->cc_nlit = 0;
+		if (zp->zp_strategy == ZSTD_STRAT_FAST) {
+			zstd_parse_fast(cc, zp, src, src + pos,
+			    src + pos + bsize);
+		} else {
+			zstd_parse_chain(cc, zp, src, src + pos,
+			    src + pos + bsize);
+		}
+
+		/* Never let a compressed block end up larger than raw. */
+		size_t cap = MIN(oend - op, bsize);
+		lsize = zstd_encode_literals(cc, op, cap);
+		if (lsize != 0) {
+			ssize = zstd_encode_sequences(cc, op + lsize,
+			    cap - lsize);
+		}
+
+		if (lsize != 0 && ssize != 0 && lsize + ssize < bsize) {
+			zstd_write_le(bh, last | (ZSTD_BLOCK_COMPRESSED << 1) |
+			    ((lsize + ssize) << 3), ZSTD_BLOCKHDR_SIZE);
+			op += lsize + ssize;
+		} else {
+			/*
+			 * The decoder will not see this block's sequences,
+			 * so forget their effect on the repeat offsets.
+			 */
+			memcpy(cc->cc_rep, rep, sizeof (rep));
+			if (oend - op < bsize)
+				return (0);
+			zstd_write_le(bh, last | (ZSTD_BLOCK_RAW << 1) |
+			    (bsize << 3), ZSTD_BLOCKHDR_SIZE);
+			memcpy(op, src + pos, bsize);
+			op += bsize;
+		}
+		pos += bsize;
+	}
+	return (op - dst);
+}
+
+/*
+ * ==========================================================================
+ * Context cache
+ * ==========================================================================
+ */
+
+typedef struct zstd_ctx_slot {
+	kmutex_t	zcs_lock;
+	void		*zcs_ctx;
+} zstd_ctx_slot_t;
+
+typedef struct zstd_ctx_cache {
+	kmem_cache_t	*zcc_cache;
+	zstd_ctx_slot_t	*zcc_slots;
+	uint_t		zcc_nslots;
+} zstd_ctx_cache_t;
+
+static zstd_ctx_cache_t zstd_cctx_cache;
+static zstd_ctx_cache_t zstd_dctx_cache;
+
+static void
+zstd_ctx_cache_init(zstd_ctx_cache_t *zcc, const char *name, size_t size)
+{
+	zcc->zcc_cache = kmem_cache_create((char *)name, size, 0,
+	    NULL, NULL, NULL, NULL, NULL, 0);
+	zcc->zcc_nslots = boot_ncpus;
+	zcc->zcc_slots = kmem_zalloc(zcc->zcc_nslots *
+	    sizeof (zstd_ctx_slot_t), KM_SLEEP);
+	for (uint_t i = 0; i < zcc->zcc_nslots; i++)
+		mutex_init(&zcc->zcc_slots[i].zcs_lock, NULL, MUTEX_DEFAULT,
+		    NULL);
+}
+
+static void
+zstd_ctx_cache_reap(zstd_ctx_cache_t *zcc)
+{
+	for (uint_t i = 0; i < zcc->zcc_nslots; i++) {
+		zstd_ctx_slot_t *zcs = &zcc->zcc_slots[i];
+
+		if (!mutex_tryenter(&zcs->zcs_lock))
+			continue;
+		if (zcs->zcs_ctx != NULL) {
+			kmem_cache_free(zcc->zcc_cache, zcs->zcs_ctx);
+			zcs->zcs_ctx = NULL;
+		}
+		mutex_exit(&zcs->zcs_lock);
+	}
+	kmem_cache_reap_now(zcc->zcc_cache);
+}
+
+static void
+zstd_ctx_cache_fini(zstd_ctx_cache_t *zcc)
+{
+	for (uint_t i = 0; i < zcc->zcc_nslots; i++) {
+		zstd_ctx_slot_t *zcs = &zcc->zcc_slots[i];
+
+		if (zcs->zcs_ctx != NULL)
+			kmem_cache_free(zcc->zcc_cache, zcs->zcs_ctx);
+		mutex_destroy(&zcs->zcs_lock);
+	}
+	kmem_free(zcc->zcc_slots, zcc->zcc_nslots * sizeof (zstd_ctx_slot_t));
+	kmem_cache_destroy(zcc->zcc_cache);
+	zcc->zcc_slots = NULL;
+	zcc->zcc_cache = NULL;
+}
+
+/*
+ * Get a context, preferably the one cached for the current CPU.  Returns
+ * the slot that must be passed to zstd_ctx_put(), or NULL if the context
+ * came straight from the kmem cache.
+ */
+static void *
+zstd_ctx_get(zstd_ctx_cache_t *zcc, zstd_ctx_slot_t **slotp)
+{
+	zstd_ctx_slot_t *zcs;
+
+	kpreempt_disable();
+	zcs = &zcc->zcc_slots[CPU_SEQID % zcc->zcc_nslots];
+	kpreempt_enable();
+
+	if (mutex_tryenter(&zcs->zcs_lock)) {
+		if (zcs->zcs_ctx == NULL)
+			zcs->zcs_ctx = kmem_cache_alloc(zcc->zcc_cache,
+			    KM_SLEEP);
+		*slotp = zcs;
+		return (zcs->zcs_ctx);
+	}
+
+	ZSTDSTAT_BUMP(zstdstat_cache_miss);
+	*slotp = NULL;
+	return (kmem_cache_alloc(zcc->zcc_cache, KM_SLEEP));
+}
+
+static void
+zstd_ctx_put(zstd_ctx_cache_t *zcc, zstd_ctx_slot_t *zcs, void *ctx)
+{
+	if (zcs != NULL) {
+		ASSERT3P(zcs->zcs_ctx, ==, ctx);
+		mutex_exit(&zcs->zcs_lock);
+	} else {
+		kmem_cache_free(zcc->zcc_cache, ctx);
+	}
+}
+
+/*
+ * ==========================================================================
+ * ZFS interface
+ * ==========================================================================
+ */
+
+size_t
+zstd_compress_zfs(void *s_start, void *d_start, size_t s_len, size_t d_len,
+    int level)
+{
+	const zstd_params_t *zp;
+	zstd_params_t fast;
+	zstd_ctx_slot_t *zcs;
+	zstd_cctx_t *cc;
+	uint32_t bufsiz;
+	char *dest = d_start;
+
+	ASSERT(d_len >= sizeof (bufsiz));
+	ASSERT3S(level, !=, 0);
+	ASSERT3S(level, <=, ZIO_ZSTD_LEVEL_MAX);
+
+	if (level > 0) {
+		zp = &zstd_level_params[level];
+	} else {
+		fast = zstd_level_params[1];
+		fast.zp_accel = -level;
+		zp = &fast;
+	}
+
+	cc = zstd_ctx_get(&zstd_cctx_cache, &zcs);
+	bufsiz = zstd_compress_frame(cc, zp, s_start, s_len,
+	    (uint8_t *)&dest[sizeof (bufsiz)], d_len - sizeof (bufsiz));
+	zstd_ctx_put(&zstd_cctx_cache, zcs, cc);
+
+	ZSTDSTAT_BUMP(zstdstat_compress);
+	if (bufsiz == 0) {
+		ZSTDSTAT_BUMP(zstdstat_compress_fail);
+		return (s_len);
+	}
+
+	/*
+	 * The exact compressed size is stored at the start of the buffer,
+	 * just as with lz4, since the block size is rounded up to a multiple
+	 * of 1<<ashift.
+	 */
+	*(uint32_t *)dest = BE_32(bufsiz);
+
+	return (bufsiz + sizeof (bufsiz));
+}
+
+/*ARGSUSED*/
+int
+zstd_decompress_zfs(void *s_start, void *d_start, size_t s_len, size_t d_len,
+    int level)
+{
+	const char *src = s_start;
+	uint32_t bufsiz = BE_IN32(src);
+	zstd_ctx_slot_t *zcs;
+	zstd_dctx_t *dc;
+	int64_t ret;
+
+	ZSTDSTAT_BUMP(zstdstat_decompress);
+
+	/* invalid compressed buffer size encoded at start */
+	if (bufsiz + sizeof (bufsiz) > s_len) {
+		ZSTDSTAT_BUMP(zstdstat_decompress_fail);
+		return (1);
+	}
+
+	dc = zstd_ctx_get(&zstd_dctx_cache, &zcs);
+	ret = zstd_decompress_frame(dc, (const uint8_t *)&src[sizeof (bufsiz)],
+	    bufsiz, d_start, d_len);
+	zstd_ctx_put(&zstd_dctx_cache, zcs, dc);
+
+	if (ret < 0) {
+		ZSTDSTAT_BUMP(zstdstat_decompress_fail);
+		return (1);
+	}
+	return (0);
+}
+
+/*
+ * Release the per-CPU contexts under memory pressure; they are recreated
+ * on demand.
+ */
+void
+zstd_cache_reap_now(void)
+{
+	ZSTDSTAT_BUMP(zstdstat_cache_reap);
+	zstd_ctx_cache_reap(&zstd_cctx_cache);
+	zstd_ctx_cache_reap(&zstd_dctx_cache);
+}
+
+void
+zstd_init(void)
+{
+	zstd_ctx_cache_init(&zstd_cctx_cache, "zstd_cctx_cache",
+	    sizeof (zstd_cctx_t));
+	zstd_ctx_cache_init(&zstd_dctx_cache, "zstd_dctx_cache",
+	    sizeof (zstd_dctx_t));
+
+	zstd_ksp = kstat_create("zfs", 0, "zstdstats", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (zstd_stats) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+	if (zstd_ksp != NULL) {
+		zstd_ksp->ks_data = &zstd_stats;
+		kstat_install(zstd_ksp);
+	}
+}
+
+void
+zstd_fini(void)
+{
+	if (zstd_ksp != NULL) {
+		kstat_delete(zstd_ksp);
+		zstd_ksp = NULL;
+	}
+	zstd_ctx_cache_fini(&zstd_dctx_cache);
+	zstd_ctx_cache_fini(&zstd_cctx_cache);
+}
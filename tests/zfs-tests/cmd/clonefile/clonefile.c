@@ -0,0 +1,154 @@
+/*
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ */
+
+/*
+ * Clone a file, or a range of it, with copy_file_range(2), FICLONE or
+ * FICLONERANGE.  The destination is created if it does not exist, and is
+ * never truncated.
+ */
+
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef FICLONE
+#define	FICLONE		_IOW(0x94, 9, int)
+#endif
+
+#ifndef FICLONERANGE
+struct file_clone_range {
+	int64_t		src_fd;
+	uint64_t	src_offset;
+	uint64_t	src_length;
+	uint64_t	dest_offset;
+};
+#define	FICLONERANGE	_IOW(0x94, 13, struct file_clone_range)
+#endif
+
+static char *execname = "clonefile";
+
+static void
+usage(void)
+{
+	(void) fprintf(stderr,
+	    "usage: %s -c | -f | -r srcfile dstfile "
+	    "[srcoffset dstoffset length]\n"
+	    "    -c  copy_file_range(2)\n"
+	    "    -f  FICLONE (offsets and length are ignored)\n"
+	    "    -r  FICLONERANGE\n", execname);
+	exit(2);
+}
+
+/*
+ * Call copy_file_range(2) directly, as some C libraries emulate it in
+ * user space and would never reach the file system.
+ */
+static int
+do_copy_file_range(int sfd, off_t soff, int dfd, off_t doff, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = syscall(__NR_copy_file_range, sfd, &soff,
+		    dfd, &doff, len, 0);
+		if (n < 0)
+			return (errno);
+		if (n == 0)
+			break;
+		len -= n;
+	}
+
+	return (0);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct file_clone_range fcr;
+	struct stat st;
+	off_t soff = 0, doff = 0;
+	size_t len = 0;
+	int c, mode = 0, sfd, dfd, error = 0;
+
+	while ((c = getopt(argc, argv, "cfr")) != -1) {
+		switch (c) {
+		case 'c':
+		case 'f':
+		case 'r':
+			if (mode != 0)
+				usage();
+			mode = c;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (mode == 0 || (argc != 2 && argc != 5))
+		usage();
+
+	if ((sfd = open(argv[0], O_RDONLY)) < 0) {
+		perror(argv[0]);
+		return (1);
+	}
+	if ((dfd = open(argv[1], O_WRONLY | O_CREAT, 0644)) < 0) {
+		perror(argv[1]);
+		return (1);
+	}
+
+	if (argc == 5) {
+		soff = strtoll(argv[2], NULL, 0);
+		doff = strtoll(argv[3], NULL, 0);
+		len = strtoull(argv[4], NULL, 0);
+	} else {
+		if (fstat(sfd, &st) != 0) {
+			perror(argv[0]);
+			return (1);
+		}
+		len = st.st_size;
+	}
+
+	switch (mode) {
+	case 'c':
+		error = do_copy_file_range(sfd, soff, dfd, doff, len);
+		break;
+	case 'f':
+		if (ioctl(dfd, FICLONE, sfd) != 0)
+			error = errno;
+		break;
+	case 'r':
+		fcr.src_fd = sfd;
+		fcr.src_offset = soff;
+		fcr.src_length = len;
+		fcr.dest_offset = doff;
+		if (ioctl(dfd, FICLONERANGE, &fcr) != 0)
+			error = errno;
+		break;
+	}
+
+	if (error != 0) {
+		(void) fprintf(stderr, "%s: %s -> %s: %s\n", execname,
+		    argv[0], argv[1], strerror(error));
+	}
+
+	(void) close(sfd);
+	(void) close(dfd);
+
+	return (error != 0);
+}
@@ -723,6 +723,27 @@ test_get_bookmark_props(const char *bookmark)
 	IOC_INPUT_TEST(ZFS_IOC_GET_BOOKMARK_PROPS, bookmark, NULL, NULL, 0);
 }
 
+static void
+test_list_batch(const char *dataset)
+{
+	nvlist_t *optional = fnvlist_alloc();
+	nvlist_t *props = fnvlist_alloc();
+
+	fnvlist_add_boolean(props, "used");
+	fnvlist_add_boolean(optional, ZFS_LIST_SNAPSHOTS);
+	fnvlist_add_uint64(optional, ZFS_LIST_CURSOR, 0);
+	fnvlist_add_uint64(optional, ZFS_LIST_COUNT, 16);
+	fnvlist_add_nvlist(optional, ZFS_LIST_PROPS, props);
+	fnvlist_add_boolean(optional, ZFS_LIST_SIMPLE);
+	fnvlist_add_uint64(optional, SNAP_ITER_MIN_TXG, 1);
+	fnvlist_add_uint64(optional, SNAP_ITER_MAX_TXG, UINT64_MAX);
+
+	IOC_INPUT_TEST(ZFS_IOC_LIST_BATCH, dataset, NULL, optional, 0);
+
+	nvlist_free(props);
+	nvlist_free(optional);
+}
+
 static void
 zfs_ioc_input_tests(const char *pool)
 {
@@ -785,6 +806,8 @@ zfs_ioc_input_tests(const char *pool)
 	test_get_bookmark_props(bookmark);
 	test_destroy_bookmarks(pool, bookmark);
 
+	test_list_batch(dataset);
+
 	test_hold(pool, snapshot);
 	test_get_holds(snapshot);
 	test_release(pool, snapshot);
@@ -954,6 +977,7 @@ validate_ioc_values(void)
 	    ZFS_IOC_BASE + 80 == ZFS_IOC_POOL_TRIM &&
 	    ZFS_IOC_BASE + 81 == ZFS_IOC_REDACT &&
 	    ZFS_IOC_BASE + 82 == ZFS_IOC_GET_BOOKMARK_PROPS &&
+	    ZFS_IOC_BASE + 83 == ZFS_IOC_LIST_BATCH &&
 	    LINUX_IOC_BASE + 1 == ZFS_IOC_EVENTS_NEXT &&
 	    LINUX_IOC_BASE + 2 == ZFS_IOC_EVENTS_CLEAR &&
 	    LINUX_IOC_BASE + 3 == ZFS_IOC_EVENTS_SEEK);
@@ -0,0 +1,464 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://opensource.org/licenses/CDDL-1.0.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * This is just to keep the compiler happy about sys/time.h not declaring
+ * gettimeofday due to -D_KERNEL (we can do this since we're actually
+ * running in userspace, but we need -D_KERNEL for the remaining BLAKE3 code).
+ */
+#ifdef	_KERNEL
+#undef	_KERNEL
+#endif
+
+#include <sys/blake3.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <stdio.h>
+#include <sys/time.h>
+#define NOTE(x)
+
+typedef	enum boolean { B_FALSE, B_TRUE } boolean_t;
+typedef	unsigned long long	u_longlong_t;
+
+/*
+ * BLAKE3 test suite.  Like the official BLAKE3 test vectors, a test message
+ * of length n consists of the bytes (i % 251) for i in [0, n).  The lengths
+ * cover partial and whole blocks and chunks, as well as inputs wide enough
+ * to use the full parallel degree of every SIMD implementation.  The keyed
+ * digests use the key bytes 0x00 .. 0x1f.
+ */
+typedef struct {
+	size_t		len;
+	uint8_t		digest[BLAKE3_OUT_LEN];
+} blake3_test_t;
+
+#define	TEST_MSG_MAX	131072
+
+const blake3_test_t	blake3_hash_tests[] = {
+	{
+		0,
+		{
+			0xAF, 0x13, 0x49, 0xB9, 0xF5, 0xF9, 0xA1, 0xA6,
+			0xA0, 0x40, 0x4D, 0xEA, 0x36, 0xDC, 0xC9, 0x49,
+			0x9B, 0xCB, 0x25, 0xC9, 0xAD, 0xC1, 0x12, 0xB7,
+			0xCC, 0x9A, 0x93, 0xCA, 0xE4, 0x1F, 0x32, 0x62
+		}
+	},
+	{
+		1,
+		{
+			0x2D, 0x3A, 0xDE, 0xDF, 0xF1, 0x1B, 0x61, 0xF1,
+			0x4C, 0x88, 0x6E, 0x35, 0xAF, 0xA0, 0x36, 0x73,
+			0x6D, 0xCD, 0x87, 0xA7, 0x4D, 0x27, 0xB5, 0xC1,
+			0x51, 0x02, 0x25, 0xD0, 0xF5, 0x92, 0xE2, 0x13
+		}
+	},
+	{
+		63,
+		{
+			0xE9, 0xBC, 0x37, 0xA5, 0x94, 0xDA, 0xAD, 0x83,
+			0xBE, 0x94, 0x70, 0xDF, 0x7F, 0x7B, 0x37, 0x98,
+			0x29, 0x7C, 0x3D, 0x83, 0x4C, 0xE8, 0x0B, 0xA8,
+			0x5D, 0x6E, 0x20, 0x76, 0x27, 0xB7, 0xDB, 0x7B
+		}
+	},
+	{
+		64,
+		{
+			0x4E, 0xED, 0x71, 0x41, 0xEA, 0x4A, 0x5C, 0xD4,
+			0xB7, 0x88, 0x60, 0x6B, 0xD2, 0x3F, 0x46, 0xE2,
+			0x12, 0xAF, 0x9C, 0xAC, 0xEB, 0xAC, 0xDC, 0x7D,
+			0x1F, 0x4C, 0x6D, 0xC7, 0xF2, 0x51, 0x1B, 0x98
+		}
+	},
+	{
+		65,
+		{
+			0xDE, 0x1E, 0x5F, 0xA0, 0xBE, 0x70, 0xDF, 0x6D,
+			0x2B, 0xE8, 0xFF, 0xFD, 0x0E, 0x99, 0xCE, 0xAA,
+			0x8E, 0xB6, 0xE8, 0xC9, 0x3A, 0x63, 0xF2, 0xD8,
+			0xD1, 0xC3, 0x0E, 0xCB, 0x6B, 0x26, 0x3D, 0xEE
+		}
+	},
+	{
+		1023,
+		{
+			0x10, 0x10, 0x89, 0x70, 0xEE, 0xDA, 0x3E, 0xB9,
+			0x32, 0xBA, 0xAC, 0x14, 0x28, 0xC7, 0xA2, 0x16,
+			0x3B, 0x0E, 0x92, 0x4C, 0x9A, 0x9E, 0x25, 0xB3,
+			0x5B, 0xBA, 0x72, 0xB2, 0x8F, 0x70, 0xBD, 0x11
+		}
+	},
+	{
+		1024,
+		{
+			0x42, 0x21, 0x47, 0x39, 0xF0, 0x95, 0xA4, 0x06,
+			0xF3, 0xFC, 0x83, 0xDE, 0xB8, 0x89, 0x74, 0x4A,
+			0xC0, 0x0D, 0xF8, 0x31, 0xC1, 0x0D, 0xAA, 0x55,
+			0x18, 0x9B, 0x5D, 0x12, 0x1C, 0x85, 0x5A, 0xF7
+		}
+	},
+	{
+		1025,
+		{
+			0xD0, 0x02, 0x78, 0xAE, 0x47, 0xEB, 0x27, 0xB3,
+			0x4F, 0xAE, 0xCF, 0x67, 0xB4, 0xFE, 0x26, 0x3F,
+			0x82, 0xD5, 0x41, 0x29, 0x16, 0xC1, 0xFF, 0xD9,
+			0x7C, 0x8C, 0xB7, 0xFB, 0x81, 0x4B, 0x84, 0x44
+		}
+	},
+	{
+		2048,
+		{
+			0xE7, 0x76, 0xB6, 0x02, 0x8C, 0x7C, 0xD2, 0x2A,
+			0x4D, 0x0B, 0xA1, 0x82, 0xA8, 0xBF, 0x62, 0x20,
+			0x5D, 0x2E, 0xF5, 0x76, 0x46, 0x7E, 0x83, 0x8E,
+			0xD6, 0xF2, 0x52, 0x9B, 0x85, 0xFB, 0xA2, 0x4A
+		}
+	},
+	{
+		2049,
+		{
+			0x5F, 0x4D, 0x72, 0xF4, 0x0D, 0x7A, 0x5F, 0x82,
+			0xB1, 0x5C, 0xA2, 0xB2, 0xE4, 0x4B, 0x1D, 0xE3,
+			0xC2, 0xEF, 0x86, 0xC4, 0x26, 0xC9, 0x5C, 0x1A,
+			0xF0, 0xB6, 0x87, 0x95, 0x22, 0x56, 0x30, 0x30
+		}
+	},
+	{
+		4096,
+		{
+			0x01, 0x50, 0x94, 0x01, 0x3F, 0x57, 0xA5, 0x27,
+			0x7B, 0x59, 0xD8, 0x47, 0x5C, 0x05, 0x01, 0x04,
+			0x2C, 0x0B, 0x64, 0x2E, 0x53, 0x1B, 0x0A, 0x1C,
+			0x8F, 0x58, 0xD2, 0x16, 0x32, 0x29, 0xE9, 0x69
+		}
+	},
+	{
+		8192,
+		{
+			0xAA, 0xE7, 0x92, 0x48, 0x4C, 0x8E, 0xFE, 0x4F,
+			0x19, 0xE2, 0xCA, 0x7D, 0x37, 0x1D, 0x8C, 0x46,
+			0x7F, 0xFB, 0x10, 0x74, 0x8D, 0x8A, 0x5A, 0x1A,
+			0xE5, 0x79, 0x94, 0x8F, 0x71, 0x8A, 0x2A, 0x63
+		}
+	},
+	{
+		16384,
+		{
+			0xF8, 0x75, 0xD6, 0x64, 0x6D, 0xE2, 0x89, 0x85,
+			0x64, 0x6F, 0x34, 0xEE, 0x13, 0xBE, 0x9A, 0x57,
+			0x6F, 0xD5, 0x15, 0xF7, 0x6B, 0x5B, 0x0A, 0x26,
+			0xBB, 0x32, 0x47, 0x35, 0x04, 0x1D, 0xDD, 0xE4
+		}
+	},
+	{
+		31744,
+		{
+			0x62, 0xB6, 0x96, 0x0E, 0x1A, 0x44, 0xBC, 0xC1,
+			0xEB, 0x1A, 0x61, 0x1A, 0x8D, 0x62, 0x35, 0xB6,
+			0xB4, 0xB7, 0x8F, 0x32, 0xE7, 0xAB, 0xC4, 0xFB,
+			0x4C, 0x6C, 0xDC, 0xCE, 0x94, 0x89, 0x5C, 0x47
+		}
+	},
+	{
+		65536,
+		{
+			0x68, 0xD6, 0x47, 0xE6, 0x19, 0xA9, 0x30, 0xE7,
+			0xB1, 0x08, 0x2F, 0x74, 0xF3, 0x34, 0xB0, 0xC6,
+			0x5A, 0x31, 0x57, 0x25, 0x56, 0x9B, 0xDC, 0x12,
+			0x3F, 0x0E, 0xE1, 0x18, 0x81, 0x71, 0x7B, 0xFE
+		}
+	},
+	{
+		102400,
+		{
+			0xBC, 0x3E, 0x3D, 0x41, 0xA1, 0x14, 0x6B, 0x06,
+			0x9A, 0xBF, 0xFA, 0xD3, 0xC0, 0xD4, 0x48, 0x60,
+			0xCF, 0x66, 0x43, 0x90, 0xAF, 0xCE, 0x4D, 0x96,
+			0x61, 0xF7, 0x90, 0x2E, 0x79, 0x43, 0xE0, 0x85
+		}
+	},
+	{
+		131072,
+		{
+			0x30, 0x6B, 0xAB, 0xA9, 0x3B, 0x1A, 0x39, 0x3C,
+			0xBD, 0x35, 0x17, 0x28, 0x37, 0xC9, 0x8B, 0x0F,
+			0x59, 0xA4, 0x1F, 0x64, 0xE1, 0xB2, 0x68, 0x2A,
+			0xE1, 0x02, 0xD8, 0xB2, 0x53, 0x4B, 0x9E, 0x1C
+		}
+	}
+};
+
+const blake3_test_t	blake3_keyed_tests[] = {
+	{
+		0,
+		{
+			0x73, 0x49, 0x2B, 0x19, 0x99, 0x5D, 0x71, 0xCD,
+			0xB1, 0xE9, 0xD7, 0x4D, 0xEC, 0xC0, 0x98, 0x09,
+			0xEB, 0x73, 0x2F, 0x1B, 0x00, 0xBC, 0x95, 0xC2,
+			0x7C, 0xB1, 0x5F, 0x9D, 0xD4, 0xD6, 0x47, 0x8F
+		}
+	},
+	{
+		1,
+		{
+			0xD0, 0x8B, 0x45, 0xC6, 0xB1, 0x27, 0xEE, 0x94,
+			0xF3, 0xF8, 0x52, 0x7A, 0x0B, 0x82, 0xA5, 0xF8,
+			0x0B, 0xE1, 0x69, 0x5A, 0x0E, 0xAE, 0xC6, 0x02,
+			0x2E, 0x77, 0x2C, 0x0E, 0xB9, 0x5A, 0x7E, 0x8B
+		}
+	},
+	{
+		63,
+		{
+			0xE4, 0x71, 0xDF, 0x92, 0xF6, 0xF7, 0xDE, 0xE1,
+			0x00, 0x13, 0x8A, 0xF7, 0xDA, 0x29, 0x69, 0x59,
+			0x06, 0xB0, 0xDC, 0x34, 0xCC, 0xDE, 0x21, 0x42,
+			0xA7, 0x30, 0xDD, 0x4E, 0xBC, 0xBC, 0x09, 0xCC
+		}
+	},
+	{
+		64,
+		{
+			0xCF, 0xAF, 0x83, 0x8F, 0xF3, 0x20, 0xE0, 0xD8,
+			0x73, 0x01, 0xDC, 0xBA, 0x02, 0xB1, 0xA4, 0xBB,
+			0x39, 0x7D, 0x65, 0x11, 0x9F, 0x57, 0x40, 0x3D,
+			0xF2, 0x81, 0x7A, 0x51, 0xD4, 0x02, 0x5F, 0x9B
+		}
+	},
+	{
+		65,
+		{
+			0xD8, 0xA4, 0x55, 0x28, 0xBF, 0xA9, 0x3A, 0x0D,
+			0x9B, 0x7B, 0xF4, 0xC8, 0x40, 0xB6, 0x8F, 0x64,
+			0xAF, 0x0B, 0x9A, 0xD3, 0xD0, 0xBB, 0xD6, 0xC1,
+			0x42, 0x1C, 0x2A, 0x4C, 0xF1, 0xCD, 0xF3, 0xB4
+		}
+	},
+	{
+		1023,
+		{
+			0xDA, 0x1F, 0x18, 0x06, 0x98, 0x71, 0x51, 0x2A,
+			0xF2, 0x2A, 0xF9, 0xF1, 0x3D, 0xC0, 0x05, 0x80,
+			0x0D, 0xFD, 0x52, 0xC5, 0x5F, 0x42, 0x75, 0x3B,
+			0x5A, 0xE7, 0x18, 0x08, 0x6F, 0xE2, 0xEE, 0x44
+		}
+	},
+	{
+		1024,
+		{
+			0xF4, 0x5A, 0x92, 0x49, 0xA6, 0x27, 0xFD, 0xF1,
+			0xFC, 0xF1, 0x3C, 0x0E, 0x63, 0x76, 0xF6, 0xA9,
+			0xA9, 0xB2, 0x05, 0x6D, 0x6E, 0x1B, 0x56, 0x93,
+			0xA4, 0xB1, 0x19, 0xA3, 0x45, 0x36, 0x65, 0xF9
+		}
+	},
+	{
+		1025,
+		{
+			0x82, 0x22, 0x31, 0x47, 0xA9, 0xB8, 0x04, 0xA0,
+			0xC3, 0xF9, 0xA9, 0x21, 0xB8, 0xD8, 0xAE, 0xE2,
+			0x50, 0xD1, 0xA5, 0x1B, 0xB7, 0x6B, 0xE7, 0x21,
+			0x52, 0xE6, 0xD5, 0xE8, 0xF2, 0x73, 0x49, 0xB3
+		}
+	},
+	{
+		2048,
+		{
+			0x63, 0x6B, 0xFA, 0x71, 0x7D, 0x4F, 0x9F, 0xC3,
+			0xE5, 0x9D, 0xA9, 0xB2, 0xE5, 0xCC, 0xE6, 0xA2,
+			0xB7, 0x8E, 0xB7, 0x04, 0x69, 0xC0, 0xFC, 0xE4,
+			0x9D, 0xA3, 0x8B, 0x54, 0x19, 0x89, 0x24, 0x23
+		}
+	},
+	{
+		2049,
+		{
+			0x54, 0x42, 0xEE, 0xC8, 0x5E, 0x3F, 0xD1, 0x73,
+			0xDC, 0xFF, 0x07, 0xC3, 0x9C, 0xD8, 0xCF, 0xF9,
+			0x68, 0x9F, 0x17, 0x22, 0x44, 0x71, 0xE6, 0x55,
+			0x61, 0x8E, 0xD7, 0x28, 0xCF, 0x03, 0xB0, 0x56
+		}
+	},
+	{
+		4096,
+		{
+			0xE8, 0xC6, 0xE8, 0x59, 0xE0, 0x48, 0x0C, 0x4B,
+			0x06, 0x24, 0x57, 0xDE, 0xFD, 0x04, 0xD2, 0xF4,
+			0x30, 0x3B, 0x6C, 0xC2, 0x80, 0xA0, 0xFE, 0x08,
+			0x0E, 0xC5, 0xC4, 0x34, 0x6A, 0x17, 0x19, 0x37
+		}
+	},
+	{
+		8192,
+		{
+			0xC6, 0x59, 0x14, 0x1D, 0x9D, 0x7E, 0x6E, 0xFA,
+			0xFD, 0x2F, 0x27, 0x4D, 0x43, 0x07, 0xB9, 0xAB,
+			0x33, 0x69, 0xF0, 0x58, 0xC6, 0xD0, 0x3C, 0xD5,
+			0xBA, 0x17, 0xD4, 0x51, 0x8D, 0x77, 0xBD, 0x49
+		}
+	},
+	{
+		16384,
+		{
+			0x88, 0x80, 0xCE, 0x02, 0x0A, 0xB0, 0x45, 0x94,
+			0x20, 0xEE, 0xE7, 0xE9, 0x5F, 0x17, 0x3D, 0x8A,
+			0x0D, 0x55, 0xC9, 0xB4, 0x99, 0xD8, 0x57, 0x88,
+			0x0B, 0x0C, 0x66, 0x1E, 0xB4, 0x16, 0x2B, 0xAE
+		}
+	},
+	{
+		31744,
+		{
+			0x55, 0x25, 0x3F, 0x05, 0x7B, 0xCE, 0x59, 0xE7,
+			0x81, 0x1F, 0xEA, 0x47, 0xAC, 0x0E, 0x72, 0x75,
+			0x1C, 0xA1, 0x2C, 0x40, 0xC4, 0xA5, 0xB8, 0xF3,
+			0xC4, 0x2E, 0x54, 0xDA, 0xA5, 0x07, 0x32, 0x72
+		}
+	},
+	{
+		65536,
+		{
+			0xCA, 0x2A, 0x08, 0x97, 0x11, 0x00, 0x2F, 0x49,
+			0x87, 0x98, 0x9E, 0x5F, 0xAB, 0x9C, 0x11, 0xCA,
+			0x99, 0x40, 0xE9, 0x4E, 0xE2, 0x58, 0xEA, 0x06,
+			0x2D, 0x2B, 0xCB, 0x40, 0x2D, 0xE1, 0x1C, 0xA9
+		}
+	},
+	{
+		102400,
+		{
+			0xAB, 0x2E, 0xCF, 0x04, 0x78, 0xE8, 0x16, 0x06,
+			0x5B, 0xA6, 0x03, 0x9D, 0x8E, 0xC5, 0x83, 0xCB,
+			0xCE, 0x8A, 0x23, 0x35, 0xEF, 0xE9, 0x03, 0xE2,
+			0xD7, 0x31, 0x3C, 0x04, 0xBA, 0x53, 0x30, 0xD2
+		}
+	},
+	{
+		131072,
+		{
+			0x0E, 0xED, 0x93, 0xEE, 0x0E, 0x31, 0xB0, 0xD5,
+			0xBA, 0x7C, 0x0F, 0xEA, 0xF3, 0x07, 0x58, 0xAC,
+			0x65, 0x2C, 0xF2, 0x02, 0xED, 0x65, 0xE6, 0x3A,
+			0x38, 0x0A, 0x11, 0x36, 0x9E, 0x95, 0xA0, 0x86
+		}
+	}
+};
+
+#define	BLAKE3_NTESTS	\
+	(sizeof (blake3_hash_tests) / sizeof (blake3_hash_tests[0]))
+
+int
+main(int argc, char *argv[])
+{
+	boolean_t	failed = B_FALSE;
+	uint64_t	cpu_mhz = 0;
+	uint8_t		key[BLAKE3_KEY_LEN];
+	uint8_t		*msg;
+	uint32_t	id, t;
+
+	if (argc == 2)
+		cpu_mhz = atoi(argv[1]);
+
+	if ((msg = malloc(TEST_MSG_MAX)) == NULL)
+		return (1);
+	for (t = 0; t < TEST_MSG_MAX; t++)
+		msg[t] = t % 251;
+	for (t = 0; t < BLAKE3_KEY_LEN; t++)
+		key[t] = t;
+
+	blake3_impl_init();
+
+#define	BLAKE3_ALGO_TEST(test, keyed)					\
+	do {								\
+		BLAKE3_CTX	ctx;					\
+		uint8_t		digest[BLAKE3_OUT_LEN];			\
+		if (keyed)						\
+			Blake3_InitKeyed(&ctx, key);			\
+		else							\
+			Blake3_Init(&ctx);				\
+		Blake3_Update(&ctx, msg, (test)->len);			\
+		Blake3_Final(&ctx, digest);				\
+		(void) printf("BLAKE3/%s%s\tMessage: %zu bytes"		\
+		    "\tResult: ", blake3_impl_getname(),		\
+		    keyed ? " keyed" : "", (test)->len);		\
+		if (bcmp(digest, (test)->digest, BLAKE3_OUT_LEN) == 0) { \
+			(void) printf("OK\n");				\
+		} else {						\
+			(void) printf("FAILED!\n");			\
+			failed = B_TRUE;				\
+		}							\
+		NOTE(CONSTCOND)						\
+	} while (0)
+
+#define	BLAKE3_PERF_TEST()						\
+	do {								\
+		BLAKE3_CTX	ctx;					\
+		uint8_t		digest[BLAKE3_OUT_LEN];			\
+		uint8_t		block[131072];				\
+		uint64_t	delta;					\
+		double		cpb = 0;				\
+		int		i;					\
+		struct timeval	start, end;				\
+		bzero(block, sizeof (block));				\
+		(void) gettimeofday(&start, NULL);			\
+		Blake3_Init(&ctx);					\
+		for (i = 0; i < 8192; i++)				\
+			Blake3_Update(&ctx, block, sizeof (block));	\
+		Blake3_Final(&ctx, digest);				\
+		(void) gettimeofday(&end, NULL);			\
+		delta = (end.tv_sec * 1000000llu + end.tv_usec) -	\
+		    (start.tv_sec * 1000000llu + start.tv_usec);	\
+		if (cpu_mhz != 0) {					\
+			cpb = (cpu_mhz * 1e6 * ((double)delta /		\
+			    1000000)) / (8192 * 128 * 1024);		\
+		}							\
+		(void) printf("BLAKE3/%s\t%llu us (%.02f CPB)\n",	\
+		    blake3_impl_getname(), (u_longlong_t)delta, cpb);	\
+		NOTE(CONSTCOND)						\
+	} while (0)
+
+	(void) printf("Running algorithm correctness tests:\n");
+	for (id = 0; id < blake3_impl_getcnt(); id++) {
+		blake3_impl_setid(id);
+		for (t = 0; t < BLAKE3_NTESTS; t++) {
+			BLAKE3_ALGO_TEST(&blake3_hash_tests[t], B_FALSE);
+			BLAKE3_ALGO_TEST(&blake3_keyed_tests[t], B_TRUE);
+		}
+	}
+	if (failed) {
+		free(msg);
+		return (1);
+	}
+
+	(void) printf("Running performance tests (hashing 1024 MiB of "
+	    "data):\n");
+	for (id = 0; id < blake3_impl_getcnt(); id++) {
+		blake3_impl_setid(id);
+		BLAKE3_PERF_TEST();
+	}
+
+	blake3_impl_fini();
+	free(msg);
+
+	return (0);
+}
@@ -192,6 +192,8 @@ main(int argc, char *argv[])
 {
 	boolean_t	failed = B_FALSE;
 	uint64_t	cpu_mhz = 0;
+	uint8_t		*mb_msg;
+	uint32_t	id, t;
 
 	if (argc == 2)
 		cpu_mhz = atoi(argv[1]);
@@ -203,8 +205,9 @@ main(int argc, char *argv[])
 		SHA2Init(SHA ## mode ## _MECH_INFO_TYPE, &ctx);		\
 		SHA2Update(&ctx, _m, strlen(_m));			\
 		SHA2Final(digest, &ctx);				\
-		(void) printf("SHA%-9sMessage: " #_m			\
-		    "\tResult: ", #mode);				\
+		(void) printf("SHA%-9s%-10sMessage: " #_m		\
+		    "\tResult: ", #mode,				\
+		    sha2_impl_getname(SHA ## mode ## _MECH_INFO_TYPE));	\
 		if (bcmp(digest, testdigest, diglen / 8) == 0) {	\
 			(void) printf("OK\n");				\
 		} else {						\
@@ -236,30 +239,110 @@ main(int argc, char *argv[])
 			cpb = (cpu_mhz * 1e6 * ((double)delta /		\
 			    1000000)) / (8192 * 128 * 1024);		\
 		}							\
-		(void) printf("SHA%-9s%llu us (%.02f CPB)\n", #mode,	\
+		(void) printf("SHA%-9s%-10s%llu us (%.02f CPB)\n", #mode, \
+		    sha2_impl_getname(SHA ## mode ## _MECH_INFO_TYPE),	\
 		    (u_longlong_t)delta, cpb);				\
 		NOTE(CONSTCOND)						\
 	} while (0)
 
+	/*
+	 * Hash SHA2_MB_CTXS distinct messages with SHA2UpdateMB() and compare
+	 * the digests against hashing each message with SHA2Update(), whose
+	 * result has been verified by the known answer tests above.  The
+	 * messages are fed in two parts to leave partial blocks buffered.
+	 */
+#define	SHA2_MB_CTXS	9
+#define	SHA2_MB_LEN	65536
+#define	SHA2_MB_TEST(mode, diglen)					\
+	do {								\
+		SHA2_CTX	ctx[SHA2_MB_CTXS], ref;			\
+		SHA2_CTX	*ctxs[SHA2_MB_CTXS];			\
+		const void	*in[SHA2_MB_CTXS];			\
+		uint8_t		digest[diglen / 8];			\
+		uint8_t		ref_digest[diglen / 8];			\
+		size_t		n, j, k = 17;				\
+		for (n = 1; n <= SHA2_MB_CTXS; n++) {			\
+			for (j = 0; j < n; j++) {			\
+				SHA2Init(SHA ## mode ## _MECH_INFO_TYPE, \
+				    &ctx[j]);				\
+				ctxs[j] = &ctx[j];			\
+				in[j] = mb_msg + j;			\
+				SHA2Update(&ctx[j], in[j], k);		\
+				in[j] = mb_msg + j + k;			\
+			}						\
+			SHA2UpdateMB(ctxs, in, SHA2_MB_LEN - k, n);	\
+			for (j = 0; j < n; j++) {			\
+				SHA2Final(digest, &ctx[j]);		\
+				SHA2Init(SHA ## mode ## _MECH_INFO_TYPE, \
+				    &ref);				\
+				SHA2Update(&ref, mb_msg + j,		\
+				    SHA2_MB_LEN);			\
+				SHA2Final(ref_digest, &ref);		\
+				if (bcmp(digest, ref_digest,		\
+				    diglen / 8) != 0)			\
+					break;				\
+			}						\
+			if (j < n)					\
+				break;					\
+		}							\
+		(void) printf("SHA%-9s%-10sMultibuffer\tResult: ", #mode, \
+		    sha2_impl_getname(SHA ## mode ## _MECH_INFO_TYPE));	\
+		if (n > SHA2_MB_CTXS) {					\
+			(void) printf("OK\n");				\
+		} else {						\
+			(void) printf("FAILED!\n");			\
+			failed = B_TRUE;				\
+		}							\
+		NOTE(CONSTCOND)						\
+	} while (0)
+
+	if ((mb_msg = malloc(SHA2_MB_LEN + SHA2_MB_CTXS)) == NULL)
+		return (1);
+	for (t = 0; t < SHA2_MB_LEN + SHA2_MB_CTXS; t++)
+		mb_msg[t] = t % 251;
+
+	sha2_impl_init(NULL);
+
 	(void) printf("Running algorithm correctness tests:\n");
-	SHA2_ALGO_TEST(test_msg0, 256, 256, sha256_test_digests[0]);
-	SHA2_ALGO_TEST(test_msg1, 256, 256, sha256_test_digests[1]);
-	SHA2_ALGO_TEST(test_msg0, 384, 384, sha384_test_digests[0]);
-	SHA2_ALGO_TEST(test_msg2, 384, 384, sha384_test_digests[2]);
-	SHA2_ALGO_TEST(test_msg0, 512, 512, sha512_test_digests[0]);
-	SHA2_ALGO_TEST(test_msg2, 512, 512, sha512_test_digests[2]);
-	SHA2_ALGO_TEST(test_msg0, 512_224, 224, sha512_224_test_digests[0]);
-	SHA2_ALGO_TEST(test_msg2, 512_224, 224, sha512_224_test_digests[2]);
-	SHA2_ALGO_TEST(test_msg0, 512_256, 256, sha512_256_test_digests[0]);
-	SHA2_ALGO_TEST(test_msg2, 512_256, 256, sha512_256_test_digests[2]);
+	for (id = 0; id < sha2_impl_getcnt(SHA256_MECH_INFO_TYPE); id++) {
+		sha2_impl_setid(SHA256_MECH_INFO_TYPE, id);
+		SHA2_ALGO_TEST(test_msg0, 256, 256, sha256_test_digests[0]);
+		SHA2_ALGO_TEST(test_msg1, 256, 256, sha256_test_digests[1]);
+		SHA2_MB_TEST(256, 256);
+	}
+	for (id = 0; id < sha2_impl_getcnt(SHA512_MECH_INFO_TYPE); id++) {
+		sha2_impl_setid(SHA512_MECH_INFO_TYPE, id);
+		SHA2_ALGO_TEST(test_msg0, 384, 384, sha384_test_digests[0]);
+		SHA2_ALGO_TEST(test_msg2, 384, 384, sha384_test_digests[2]);
+		SHA2_ALGO_TEST(test_msg0, 512, 512, sha512_test_digests[0]);
+		SHA2_ALGO_TEST(test_msg2, 512, 512, sha512_test_digests[2]);
+		SHA2_ALGO_TEST(test_msg0, 512_224, 224,
+		    sha512_224_test_digests[0]);
+		SHA2_ALGO_TEST(test_msg2, 512_224, 224,
+		    sha512_224_test_digests[2]);
+		SHA2_ALGO_TEST(test_msg0, 512_256, 256,
+		    sha512_256_test_digests[0]);
+		SHA2_ALGO_TEST(test_msg2, 512_256, 256,
+		    sha512_256_test_digests[2]);
+		SHA2_MB_TEST(512, 512);
+	}
+	free(mb_msg);
 
 	if (failed)
 		return (1);
 
 	(void) printf("Running performance tests (hashing 1024 MiB of "
 	    "data):\n");
-	SHA2_PERF_TEST(256, 256);
-	SHA2_PERF_TEST(512, 512);
+	for (id = 0; id < sha2_impl_getcnt(SHA256_MECH_INFO_TYPE); id++) {
+		sha2_impl_setid(SHA256_MECH_INFO_TYPE, id);
+		SHA2_PERF_TEST(256, 256);
+	}
+	for (id = 0; id < sha2_impl_getcnt(SHA512_MECH_INFO_TYPE); id++) {
+		sha2_impl_setid(SHA512_MECH_INFO_TYPE, id);
+		SHA2_PERF_TEST(512, 512);
+	}
+
+	sha2_impl_fini();
 
 	return (0);
 }